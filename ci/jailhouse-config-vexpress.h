@@ -2,3 +2,5 @@
 #define CONFIG_ARM_GIC			1
 #define CONFIG_MACH_VEXPRESS		1
 #define CONFIG_SERIAL_AMBA_PL011	1
+#define CONFIG_EXIT_LATENCY_HISTOGRAMS	1
+#define CONFIG_SHUTDOWN_TIMING		1
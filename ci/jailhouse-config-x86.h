@@ -1 +1,3 @@
 #define CONFIG_TRACE_ERROR		1
+#define CONFIG_EXIT_LATENCY_HISTOGRAMS	1
+#define CONFIG_SHUTDOWN_TIMING		1
@@ -20,7 +20,7 @@
 struct {
 	struct jailhouse_cell_desc cell;
 	__u64 cpus[1];
-	struct jailhouse_memory mem_regions[2];
+	struct jailhouse_memory mem_regions[3];
 	struct jailhouse_cache cache_regions[1];
 	__u8 pio_bitmap[0x2000];
 } __attribute__((packed)) config = {
@@ -50,10 +50,17 @@ struct {
 		},
 		/* communication region */ {
 			.virt_start = 0x00100000,
-			.size = 0x00001000,
+			.size = 0x00002000,
 			.flags = JAILHOUSE_MEM_READ | JAILHOUSE_MEM_WRITE |
 				JAILHOUSE_MEM_COMM_REGION,
 		},
+		/* console ring, use with "console_ring=0x102000" */ {
+			.phys_start = 0x3effe000,
+			.virt_start = 0x00102000,
+			.size = 0x00002000,
+			.flags = JAILHOUSE_MEM_READ | JAILHOUSE_MEM_WRITE |
+				JAILHOUSE_MEM_ROOTSHARED | JAILHOUSE_MEM_CONSOLE,
+		},
 	},
 
 	.cache_regions = {
@@ -11,9 +11,16 @@
  */
 
 #include <linux/cpu.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/mm.h>
+#include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/version.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/zlib.h>
 #include <asm/cacheflush.h>
 
 #include "cell.h"
@@ -21,18 +28,45 @@
 #include "pci.h"
 #include "sysfs.h"
 
+#include <jailhouse/header.h>
 #include <jailhouse/hypercall.h>
 
+struct cell_console {
+	struct jailhouse_console_reader reader;
+	struct delayed_work work;
+};
+
 struct cell *root_cell;
 
 static LIST_HEAD(cells);
 static cpumask_t offlined_cpus;
 
+/*
+ * CPUs that are taken offline once on enable and then stay offline, parked in
+ * the hypervisor, until Jailhouse is disabled. Handing them to cells or
+ * getting them back avoids the costly Linux CPU hotplug round-trip.
+ */
+static char *reserve_cpus;
+module_param(reserve_cpus, charp, 0444);
+MODULE_PARM_DESC(reserve_cpus, "CPUs (list format) kept offline for cells "
+		 "while Jailhouse is enabled");
+static cpumask_t reserved_cpus;
+
+/*
+ * Serializes image mappings of loadable regions against the cell leaving the
+ * loadable state. Nests inside jailhouse_lock and inside the mmap lock.
+ */
+static DEFINE_MUTEX(image_map_lock);
+
 void jailhouse_cell_kobj_release(struct kobject *kobj)
 {
 	struct cell *cell = container_of(kobj, struct cell, kobj);
 
 	jailhouse_pci_cell_cleanup(cell);
+	if (cell->stats)
+		vunmap(cell->stats);
+	if (cell->comm_page)
+		vunmap(cell->comm_page);
 	vfree(cell->memory_regions);
 	kfree(cell);
 }
@@ -82,12 +116,151 @@ struct cell *jailhouse_cell_create(const struct jailhouse_cell_desc *cell_desc)
 	return cell;
 }
 
+static void cell_map_stats(struct cell *cell)
+{
+	unsigned int slots = cpumask_last(&cell->cpus_assigned) + 1;
+	unsigned long size = slots * sizeof(struct jailhouse_cpu_stats);
+	long pfn;
+
+	pfn = jailhouse_call_arg1(JAILHOUSE_HC_CELL_GET_STATS_PAGE, cell->id);
+	if (pfn < 0)
+		return;
+
+	/* on failure, statistics are read via the slower hypercall path */
+	cell->stats = jailhouse_ioremap((phys_addr_t)pfn << PAGE_SHIFT, 0, size);
+	if (cell->stats)
+		cell->num_stats_slots = slots;
+}
+
+/* heartbeat and mailboxes are unavailable if this fails */
+static void cell_map_comm_page(struct cell *cell)
+{
+	long pfn;
+
+	pfn = jailhouse_call_arg1(JAILHOUSE_HC_CELL_GET_COMM_PAGE, cell->id);
+	if (pfn < 0)
+		return;
+
+	cell->comm_page = jailhouse_ioremap((phys_addr_t)pfn << PAGE_SHIFT, 0,
+					    2 * PAGE_SIZE);
+}
+
+static void cell_console_poll(struct work_struct *work)
+{
+	struct cell_console *console =
+		container_of(to_delayed_work(work), struct cell_console, work);
+
+	jailhouse_console_drain(&console->reader);
+	schedule_delayed_work(&console->work, CONSOLE_POLL_INTERVAL);
+}
+
+/*
+ * Drain the console ring of a non-root cell into the kernel log if its
+ * configuration contains one.
+ */
+static void cell_console_start(struct cell *cell)
+{
+	const struct jailhouse_memory *mem = cell->memory_regions;
+	struct cell_console *console;
+	unsigned int n;
+
+	for (n = 0; n < cell->num_memory_regions; n++, mem++)
+		if (mem->flags & JAILHOUSE_MEM_CONSOLE)
+			break;
+	if (n == cell->num_memory_regions)
+		return;
+
+	if (!(mem->flags & JAILHOUSE_MEM_ROOTSHARED) ||
+	    mem->size < sizeof(struct jailhouse_console)) {
+		pr_warn("jailhouse: cell \"%s\": console region must be "
+			"root-shared and hold struct jailhouse_console\n",
+			kobject_name(&cell->kobj));
+		return;
+	}
+
+	console = kzalloc(sizeof(*console), GFP_KERNEL);
+	if (!console)
+		return;
+
+	console->reader.ring = jailhouse_ioremap(mem->phys_start, 0,
+					sizeof(struct jailhouse_console));
+	if (!console->reader.ring) {
+		pr_warn("jailhouse: cell \"%s\": failed to map console ring\n",
+			kobject_name(&cell->kobj));
+		kfree(console);
+		return;
+	}
+	console->reader.cell_name = kobject_name(&cell->kobj);
+
+	/* the cell has not run yet, drop whatever the region contains */
+	console->reader.ring->tail = 0;
+
+	INIT_DELAYED_WORK(&console->work, cell_console_poll);
+	cell->console = console;
+	schedule_delayed_work(&console->work, CONSOLE_POLL_INTERVAL);
+}
+
+static void cell_console_stop(struct cell *cell)
+{
+	struct cell_console *console = cell->console;
+
+	if (!console)
+		return;
+
+	cancel_delayed_work_sync(&console->work);
+	/* catch the final messages of the cell */
+	jailhouse_console_drain(&console->reader);
+
+	vunmap(console->reader.ring);
+	kfree(console);
+	cell->console = NULL;
+}
+
 void jailhouse_cell_register(struct cell *cell)
 {
+	cell_map_stats(cell);
+	if (cell != root_cell) {
+		cell_map_comm_page(cell);
+		cell_console_start(cell);
+	}
+	cell->last_state = cell == root_cell ? JAILHOUSE_CELL_RUNNING :
+		JAILHOUSE_CELL_SHUT_DOWN;
 	list_add_tail(&cell->entry, &cells);
 	jailhouse_sysfs_cell_register(cell);
 }
 
+/*
+ * Called with jailhouse_lock held on each new event of the hypervisor. Cells
+ * enter the failed state when they crash, stop answering messages or miss
+ * their watchdog heartbeat. Pollers of the "state" attribute are notified on
+ * every change, udev only on failures.
+ */
+void jailhouse_cell_check_states(void)
+{
+	struct jailhouse_comm_region *comm_region;
+	struct cell *cell;
+	long state;
+
+	list_for_each_entry(cell, &cells, entry) {
+		comm_region = cell->comm_page;
+		if (comm_region)
+			state = comm_region->cell_state;
+		else
+			state = jailhouse_call_arg1(JAILHOUSE_HC_CELL_GET_STATE,
+						    cell->id);
+		if (state < 0 || state == cell->last_state)
+			continue;
+
+		if (state == JAILHOUSE_CELL_FAILED) {
+			pr_err("jailhouse: cell \"%s\" failed\n",
+			       kobject_name(&cell->kobj));
+			kobject_uevent(&cell->kobj, KOBJ_CHANGE);
+		}
+		sysfs_notify(&cell->kobj, NULL, "state");
+		cell->last_state = state;
+	}
+}
+
 static struct cell *find_cell(struct jailhouse_cell_id *cell_id)
 {
 	struct cell *cell;
@@ -100,8 +273,25 @@ static struct cell *find_cell(struct jailhouse_cell_id *cell_id)
 	return NULL;
 }
 
+/*
+ * Revoke all user mappings of the loadable regions. Must be called before the
+ * root cell loses access to them.
+ */
+static void cell_leave_loadable(struct cell *cell)
+{
+	mutex_lock(&image_map_lock);
+	cell->loadable = false;
+	if (cell->image_mapping) {
+		unmap_mapping_range(cell->image_mapping, 0, 0, 1);
+		cell->image_mapping = NULL;
+	}
+	mutex_unlock(&image_map_lock);
+}
+
 void jailhouse_cell_delete(struct cell *cell)
 {
+	cell_console_stop(cell);
+	cell_leave_loadable(cell);
 	list_del(&cell->entry);
 	jailhouse_sysfs_cell_delete(cell);
 }
@@ -118,6 +308,35 @@ int jailhouse_cell_prepare_root(const struct jailhouse_cell_desc *cell_desc)
 	return 0;
 }
 
+static void reserve_root_cpus(void)
+{
+	unsigned int cpu;
+
+	cpumask_clear(&reserved_cpus);
+	if (!reserve_cpus || !*reserve_cpus)
+		return;
+
+	if (cpulist_parse(reserve_cpus, &reserved_cpus) != 0) {
+		pr_warn("jailhouse: invalid reserve_cpus \"%s\"\n",
+			reserve_cpus);
+		cpumask_clear(&reserved_cpus);
+		return;
+	}
+
+	cpumask_and(&reserved_cpus, &reserved_cpus, &root_cell->cpus_assigned);
+	for_each_cpu(cpu, &reserved_cpus) {
+		if (cpu_online(cpu)) {
+			if (cpu_down(cpu) != 0) {
+				pr_warn("jailhouse: failed to reserve CPU "
+					"%d\n", cpu);
+				cpumask_clear_cpu(cpu, &reserved_cpus);
+				continue;
+			}
+			cpumask_set_cpu(cpu, &offlined_cpus);
+		}
+	}
+}
+
 void jailhouse_cell_register_root(void)
 {
 	jailhouse_pci_do_all_devices(root_cell, JAILHOUSE_PCI_TYPE_IVSHMEM,
@@ -125,6 +344,21 @@ void jailhouse_cell_register_root(void)
 
 	root_cell->id = 0;
 	jailhouse_cell_register(root_cell);
+
+	reserve_root_cpus();
+}
+
+/* Reserved CPUs stay offline, all others are brought back online. */
+static void cell_return_cpu(unsigned int cpu)
+{
+	if (cpumask_test_cpu(cpu, &offlined_cpus) &&
+	    !cpumask_test_cpu(cpu, &reserved_cpus)) {
+		if (cpu_up(cpu) != 0)
+			pr_err("Jailhouse: failed to bring CPU %d "
+			       "back online\n", cpu);
+		cpumask_clear_cpu(cpu, &offlined_cpus);
+	}
+	cpumask_set_cpu(cpu, &root_cell->cpus_assigned);
 }
 
 void jailhouse_cell_delete_root(void)
@@ -159,6 +393,7 @@ int jailhouse_cmd_cell_create(struct jailhouse_cell_create __user *arg)
 	struct jailhouse_cell_create cell_params;
 	struct jailhouse_cell_desc *config;
 	struct jailhouse_cell_id cell_id;
+	ktime_t start, hotplug, hypercall;
 	void __user *user_config;
 	struct cell *cell;
 	unsigned int cpu;
@@ -214,6 +449,7 @@ int jailhouse_cmd_cell_create(struct jailhouse_cell_create __user *arg)
 		goto error_cell_delete;
 	}
 
+	start = ktime_get();
 	for_each_cpu(cpu, &cell->cpus_assigned) {
 		if (cpu_online(cpu)) {
 			err = cpu_down(cpu);
@@ -223,11 +459,14 @@ int jailhouse_cmd_cell_create(struct jailhouse_cell_create __user *arg)
 		}
 		cpumask_clear_cpu(cpu, &root_cell->cpus_assigned);
 	}
+	hotplug = ktime_sub(ktime_get(), start);
 
 	jailhouse_pci_do_all_devices(cell, JAILHOUSE_PCI_TYPE_DEVICE,
 	                             JAILHOUSE_PCI_ACTION_CLAIM);
 
+	start = ktime_get();
 	id = jailhouse_call_arg1(JAILHOUSE_HC_CELL_CREATE, __pa(config));
+	hypercall = ktime_sub(ktime_get(), start);
 	if (id < 0) {
 		err = id;
 		goto error_cpu_online;
@@ -235,8 +474,11 @@ int jailhouse_cmd_cell_create(struct jailhouse_cell_create __user *arg)
 
 	cell->id = id;
 	jailhouse_cell_register(cell);
+	jailhouse_sysfs_cell_update_cpus(root_cell);
 
-	pr_info("Created Jailhouse cell \"%s\"\n", config->name);
+	pr_info("Created Jailhouse cell \"%s\" (CPU hotplug: %lld us, "
+		"hypercall: %lld us)\n", config->name, ktime_to_us(hotplug),
+		ktime_to_us(hypercall));
 
 unlock_out:
 	mutex_unlock(&jailhouse_lock);
@@ -248,7 +490,8 @@ kfree_config_out:
 
 error_cpu_online:
 	for_each_cpu(cpu, &cell->cpus_assigned) {
-		if (!cpu_online(cpu) && cpu_up(cpu) == 0)
+		if (!cpu_online(cpu) &&
+		    !cpumask_test_cpu(cpu, &reserved_cpus) && cpu_up(cpu) == 0)
 			cpumask_clear_cpu(cpu, &offlined_cpus);
 		cpumask_set_cpu(cpu, &root_cell->cpus_assigned);
 	}
@@ -281,32 +524,50 @@ static int cell_management_prologue(struct jailhouse_cell_id *cell_id,
 
 #define MEM_REQ_FLAGS	(JAILHOUSE_MEM_WRITE | JAILHOUSE_MEM_LOADABLE)
 
+/* Streamed images are copied via mappings of at most this size. */
+#define LOAD_CHUNK_SIZE	(1024 * 1024)
+
+/*
+ * Look up the loadable region that fully contains the image. Returns NULL if
+ * there is none.
+ */
+static const struct jailhouse_memory *
+find_load_region(struct cell *cell, u64 target_address, u64 size,
+		 u64 *image_offset)
+{
+	const struct jailhouse_memory *mem = cell->memory_regions;
+	unsigned int regions;
+
+	for (regions = cell->num_memory_regions; regions > 0; regions--) {
+		*image_offset = target_address - mem->virt_start;
+		if (target_address >= mem->virt_start &&
+		    *image_offset < mem->size) {
+			if (size > mem->size - *image_offset ||
+			    (mem->flags & MEM_REQ_FLAGS) != MEM_REQ_FLAGS)
+				return NULL;
+			return mem;
+		}
+		mem++;
+	}
+	return NULL;
+}
+
 static int load_image(struct cell *cell,
 		      struct jailhouse_preload_image __user *uimage)
 {
 	struct jailhouse_preload_image image;
 	const struct jailhouse_memory *mem;
-	unsigned int regions, page_offs;
 	u64 image_offset, phys_start;
+	unsigned int page_offs;
 	void *image_mem;
 	int err = 0;
 
 	if (copy_from_user(&image, uimage, sizeof(image)))
 		return -EFAULT;
 
-	mem = cell->memory_regions;
-	for (regions = cell->num_memory_regions; regions > 0; regions--) {
-		image_offset = image.target_address - mem->virt_start;
-		if (image.target_address >= mem->virt_start &&
-		    image_offset < mem->size) {
-			if (image.size > mem->size - image_offset ||
-			    (mem->flags & MEM_REQ_FLAGS) != MEM_REQ_FLAGS)
-				return -EINVAL;
-			break;
-		}
-		mem++;
-	}
-	if (regions == 0)
+	mem = find_load_region(cell, image.target_address, image.size,
+			       &image_offset);
+	if (!mem)
 		return -EINVAL;
 
 	phys_start = (mem->phys_start + image_offset) & PAGE_MASK;
@@ -338,7 +599,342 @@ static int load_image(struct cell *cell,
 	return err;
 }
 
-int jailhouse_cmd_cell_load(struct jailhouse_cell_load __user *arg)
+static ssize_t read_file_chunk(struct file *file, void *buf, size_t count,
+			       loff_t *pos)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,14,0)
+	return kernel_read(file, buf, count, pos);
+#else
+	ssize_t ret = kernel_read(file, *pos, buf, count);
+
+	if (ret > 0)
+		*pos += ret;
+	return ret;
+#endif
+}
+
+#ifdef CONFIG_ZLIB_INFLATE
+#define GZIP_IN_BUF_SIZE	(64 * 1024)
+
+#define GZIP_FHCRC		0x02
+#define GZIP_FEXTRA		0x04
+#define GZIP_FNAME		0x08
+#define GZIP_FCOMMENT		0x10
+
+/* Returns the length of the gzip member header, or 0 if it is invalid. */
+static unsigned int gzip_header_len(const u8 *buf, unsigned int len)
+{
+	unsigned int pos = 10;
+	u8 flags;
+
+	if (len < pos || buf[0] != 0x1f || buf[1] != 0x8b || buf[2] != 8)
+		return 0;
+
+	flags = buf[3];
+	if (flags & GZIP_FEXTRA) {
+		if (pos + 2 > len)
+			return 0;
+		pos += 2 + (buf[pos] | buf[pos + 1] << 8);
+	}
+	if (flags & GZIP_FNAME) {
+		while (pos < len && buf[pos])
+			pos++;
+		pos++;
+	}
+	if (flags & GZIP_FCOMMENT) {
+		while (pos < len && buf[pos])
+			pos++;
+		pos++;
+	}
+	if (flags & GZIP_FHCRC)
+		pos += 2;
+
+	return pos <= len ? pos : 0;
+}
+
+/*
+ * Inflate a gzip image from a file straight into cell memory. The output may
+ * fill the loadable region up to its end. The gzip trailer is not checked.
+ */
+static int load_gzip_file(const struct jailhouse_memory *mem,
+			  u64 image_offset, struct file *file,
+			  const struct jailhouse_preload_file *preload)
+{
+	u64 phys = mem->phys_start + image_offset, mapped = 0;
+	u64 out_limit = mem->size - image_offset;
+	u64 in_left = preload->size;
+	struct z_stream_s strm = {};
+	unsigned int page_offs, len, header_len;
+	void *image_mem = NULL, *chunk = NULL;
+	loff_t pos = preload->offset;
+	bool header = true;
+	int zret = Z_OK;
+	void *in_buf;
+	ssize_t ret;
+	int err = 0;
+
+	in_buf = vmalloc(GZIP_IN_BUF_SIZE);
+	strm.workspace = vmalloc(zlib_inflate_workspacesize());
+	if (!in_buf || !strm.workspace) {
+		err = -ENOMEM;
+		goto free_out;
+	}
+
+	/* raw deflate, the gzip framing is handled here */
+	if (zlib_inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+		err = -EINVAL;
+		goto free_out;
+	}
+
+	while (zret != Z_STREAM_END) {
+		if (strm.avail_in == 0) {
+			if (in_left == 0) {
+				err = -EINVAL;
+				break;
+			}
+			len = min_t(u64, in_left, GZIP_IN_BUF_SIZE);
+			ret = read_file_chunk(file, in_buf, len, &pos);
+			if (ret < (ssize_t)len) {
+				err = ret < 0 ? ret : -EIO;
+				break;
+			}
+			in_left -= len;
+
+			strm.next_in = in_buf;
+			strm.avail_in = len;
+			if (header) {
+				header_len = gzip_header_len(in_buf, len);
+				if (header_len == 0) {
+					err = -EINVAL;
+					break;
+				}
+				strm.next_in += header_len;
+				strm.avail_in -= header_len;
+				header = false;
+			}
+		}
+
+		if (strm.avail_out == 0) {
+			if (image_mem) {
+				/* see load_image */
+				flush_icache_range((unsigned long)chunk,
+					(unsigned long)strm.next_out);
+				vunmap(image_mem);
+				image_mem = NULL;
+			}
+			if (mapped == out_limit) {
+				/* image does not fit into the region */
+				err = -EINVAL;
+				break;
+			}
+
+			page_offs = offset_in_page(phys + mapped);
+			len = min_t(u64, out_limit - mapped,
+				    LOAD_CHUNK_SIZE - page_offs);
+			image_mem = jailhouse_ioremap((phys + mapped) &
+						      PAGE_MASK, 0,
+						      PAGE_ALIGN(len +
+								 page_offs));
+			if (!image_mem) {
+				pr_err("jailhouse: Unable to map cell RAM at "
+				       "%08llx for image loading\n",
+				       (unsigned long long)(phys + mapped));
+				err = -EBUSY;
+				break;
+			}
+			chunk = image_mem + page_offs;
+			strm.next_out = chunk;
+			strm.avail_out = len;
+			mapped += len;
+		}
+
+		zret = zlib_inflate(&strm, Z_NO_FLUSH);
+		if (zret != Z_OK && zret != Z_STREAM_END) {
+			err = -EINVAL;
+			break;
+		}
+
+		cond_resched();
+	}
+
+	if (image_mem) {
+		flush_icache_range((unsigned long)chunk,
+				   (unsigned long)strm.next_out);
+		vunmap(image_mem);
+	}
+
+	zlib_inflateEnd(&strm);
+
+free_out:
+	vfree(strm.workspace);
+	vfree(in_buf);
+
+	return err;
+}
+#else /* !CONFIG_ZLIB_INFLATE */
+static int load_gzip_file(const struct jailhouse_memory *mem,
+			  u64 image_offset, struct file *file,
+			  const struct jailhouse_preload_file *preload)
+{
+	return -EOPNOTSUPP;
+}
+#endif /* !CONFIG_ZLIB_INFLATE */
+
+/*
+ * Stream an image from a file into cell memory. Only one chunk of the cell
+ * memory is mapped at a time, and the data goes from the page cache straight
+ * to its destination.
+ */
+static int load_file(struct cell *cell,
+		     struct jailhouse_preload_file __user *ufile)
+{
+	struct jailhouse_preload_file preload;
+	u64 image_offset, phys, done;
+	const struct jailhouse_memory *mem;
+	unsigned int page_offs, len;
+	void *image_mem;
+	struct file *file;
+	loff_t pos;
+	ssize_t ret;
+	int err = 0;
+
+	if (copy_from_user(&preload, ufile, sizeof(preload)))
+		return -EFAULT;
+
+	if (preload.flags & ~JAILHOUSE_PRELOAD_GZIP)
+		return -EINVAL;
+
+	/* the size of a compressed image only refers to the file */
+	mem = find_load_region(cell, preload.target_address,
+			       preload.flags & JAILHOUSE_PRELOAD_GZIP ?
+			       0 : preload.size, &image_offset);
+	if (!mem)
+		return -EINVAL;
+
+	file = fget(preload.fd);
+	if (!file)
+		return -EBADF;
+
+	if (preload.flags & JAILHOUSE_PRELOAD_GZIP) {
+		err = load_gzip_file(mem, image_offset, file, &preload);
+		fput(file);
+		return err;
+	}
+
+	pos = preload.offset;
+	for (done = 0; done < preload.size; done += len) {
+		phys = mem->phys_start + image_offset + done;
+		page_offs = offset_in_page(phys);
+		len = min_t(u64, preload.size - done,
+			    LOAD_CHUNK_SIZE - page_offs);
+
+		image_mem = jailhouse_ioremap(phys & PAGE_MASK, 0,
+					      PAGE_ALIGN(len + page_offs));
+		if (!image_mem) {
+			pr_err("jailhouse: Unable to map cell RAM at %08llx "
+			       "for image loading\n", (unsigned long long)phys);
+			err = -EBUSY;
+			break;
+		}
+
+		ret = read_file_chunk(file, image_mem + page_offs, len, &pos);
+		/* see load_image */
+		if (ret > 0)
+			flush_icache_range((unsigned long)image_mem + page_offs,
+					   (unsigned long)image_mem +
+					   page_offs + ret);
+
+		vunmap(image_mem);
+
+		if (ret < len) {
+			/* a file shorter than announced is an error as well */
+			err = ret < 0 ? ret : -EIO;
+			break;
+		}
+
+		cond_resched();
+	}
+
+	fput(file);
+
+	return err;
+}
+
+/* Associates the file with the cell for later image mappings. */
+static void cell_attach_file(struct cell *cell, struct file *file)
+{
+	struct cell *old_cell;
+
+	mutex_lock(&image_map_lock);
+	old_cell = file->private_data;
+	kobject_get(&cell->kobj);
+	file->private_data = cell;
+	cell->loadable = true;
+	mutex_unlock(&image_map_lock);
+
+	if (old_cell)
+		kobject_put(&old_cell->kobj);
+}
+
+void jailhouse_cell_release_file(struct file *file)
+{
+	struct cell *cell = file->private_data;
+
+	if (cell)
+		kobject_put(&cell->kobj);
+}
+
+int jailhouse_cell_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	u64 offset, addr = (u64)vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	const struct jailhouse_memory *mem;
+	unsigned int regions;
+	struct cell *cell;
+	int err = -EINVAL;
+
+	mutex_lock(&image_map_lock);
+
+	cell = file->private_data;
+	if (!cell || !cell->loadable) {
+		err = -EPERM;
+		goto unlock_out;
+	}
+
+	mem = cell->memory_regions;
+	for (regions = cell->num_memory_regions; regions > 0; regions--) {
+		offset = addr - mem->virt_start;
+		if (addr >= mem->virt_start && offset < mem->size) {
+			if (size > mem->size - offset ||
+			    (mem->flags & MEM_REQ_FLAGS) != MEM_REQ_FLAGS)
+				goto unlock_out;
+			break;
+		}
+		mem++;
+	}
+	if (regions == 0)
+		goto unlock_out;
+
+	/* all mappings are revoked at once via the address space */
+	if (cell->image_mapping && cell->image_mapping != file->f_mapping) {
+		err = -EBUSY;
+		goto unlock_out;
+	}
+
+	err = remap_pfn_range(vma, vma->vm_start,
+			      (mem->phys_start + offset) >> PAGE_SHIFT, size,
+			      vma->vm_page_prot);
+	if (!err)
+		cell->image_mapping = file->f_mapping;
+
+unlock_out:
+	mutex_unlock(&image_map_lock);
+
+	return err;
+}
+
+int jailhouse_cmd_cell_load(struct file *file,
+			    struct jailhouse_cell_load __user *arg)
 {
 	struct jailhouse_preload_image __user *image = arg->image;
 	struct jailhouse_cell_load cell_load;
@@ -357,6 +953,8 @@ int jailhouse_cmd_cell_load(struct jailhouse_cell_load __user *arg)
 	if (err)
 		goto unlock_out;
 
+	cell_attach_file(cell, file);
+
 	for (n = cell_load.num_preload_images; n > 0; n--, image++) {
 		err = load_image(cell, image);
 		if (err)
@@ -369,6 +967,40 @@ unlock_out:
 	return err;
 }
 
+int jailhouse_cmd_cell_load_fd(struct file *file,
+			       struct jailhouse_cell_load_fd __user *arg)
+{
+	struct jailhouse_preload_file __user *preload = arg->file;
+	struct jailhouse_cell_load_fd cell_load;
+	struct cell *cell;
+	unsigned int n;
+	int err;
+
+	if (copy_from_user(&cell_load, arg, sizeof(cell_load)))
+		return -EFAULT;
+
+	err = cell_management_prologue(&cell_load.cell_id, &cell);
+	if (err)
+		return err;
+
+	err = jailhouse_call_arg1(JAILHOUSE_HC_CELL_SET_LOADABLE, cell->id);
+	if (err)
+		goto unlock_out;
+
+	cell_attach_file(cell, file);
+
+	for (n = cell_load.num_preload_files; n > 0; n--, preload++) {
+		err = load_file(cell, preload);
+		if (err)
+			break;
+	}
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
 int jailhouse_cmd_cell_start(const char __user *arg)
 {
 	struct jailhouse_cell_id cell_id;
@@ -382,6 +1014,8 @@ int jailhouse_cmd_cell_start(const char __user *arg)
 	if (err)
 		return err;
 
+	cell_leave_loadable(cell);
+
 	err = jailhouse_call_arg1(JAILHOUSE_HC_CELL_START, cell->id);
 
 	mutex_unlock(&jailhouse_lock);
@@ -389,9 +1023,213 @@ int jailhouse_cmd_cell_start(const char __user *arg)
 	return err;
 }
 
+int jailhouse_cmd_cell_start_multi(
+		struct jailhouse_cell_start_multi __user *arg)
+{
+	struct jailhouse_cell_start_multi start_multi;
+	struct jailhouse_cell_id cell_id;
+	struct cell *cell;
+	unsigned int n;
+	u32 *ids;
+	int err;
+
+	if (copy_from_user(&start_multi, arg, sizeof(start_multi)))
+		return -EFAULT;
+
+	if (start_multi.num_cells == 0 ||
+	    start_multi.num_cells > JAILHOUSE_CELL_START_MULTI_MAX)
+		return -EINVAL;
+
+	ids = kmalloc(sizeof(*ids) * start_multi.num_cells, GFP_KERNEL);
+	if (!ids)
+		return -ENOMEM;
+
+	if (mutex_lock_interruptible(&jailhouse_lock) != 0) {
+		err = -EINTR;
+		goto out_free;
+	}
+
+	if (!jailhouse_enabled) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	for (n = 0; n < start_multi.num_cells; n++) {
+		if (copy_from_user(&cell_id, &arg->cell_id[n],
+				   sizeof(cell_id))) {
+			err = -EFAULT;
+			goto unlock_out;
+		}
+		cell_id.name[JAILHOUSE_CELL_ID_NAMELEN] = 0;
+
+		cell = find_cell(&cell_id);
+		if (!cell) {
+			err = -ENOENT;
+			goto unlock_out;
+		}
+		ids[n] = cell->id;
+	}
+
+	/* only revoke mappings once all cells are known to exist */
+	for (n = 0; n < start_multi.num_cells; n++) {
+		cell_id.id = ids[n];
+		cell_leave_loadable(find_cell(&cell_id));
+	}
+
+	err = jailhouse_call_arg2(JAILHOUSE_HC_CELL_START_MULTI, __pa(ids),
+				  start_multi.num_cells);
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+out_free:
+	kfree(ids);
+
+	return err;
+}
+
+int jailhouse_cmd_cell_set_cache(struct jailhouse_cell_cache __user *arg)
+{
+	struct jailhouse_cell_cache cell_cache;
+	struct cell *cell;
+	int err;
+
+	if (copy_from_user(&cell_cache, arg, sizeof(cell_cache)))
+		return -EFAULT;
+
+	if (cell_cache.start > 0xffff || cell_cache.size > 0xffff)
+		return -EINVAL;
+
+	err = cell_management_prologue(&cell_cache.cell_id, &cell);
+	if (err)
+		return err;
+
+	err = jailhouse_call_arg2(JAILHOUSE_HC_CELL_SET_CACHE, cell->id,
+				  JAILHOUSE_CELL_CACHE_ARG(cell_cache.start,
+							   cell_cache.size));
+
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
+int jailhouse_cmd_cell_add_cpu(struct jailhouse_cell_cpu __user *arg)
+{
+	struct jailhouse_cell_cpu cell_cpu;
+	struct cell *cell;
+	unsigned int cpu;
+	int err;
+
+	if (copy_from_user(&cell_cpu, arg, sizeof(cell_cpu)))
+		return -EFAULT;
+
+	cpu = cell_cpu.cpu;
+	if (cpu >= nr_cpu_ids)
+		return -EINVAL;
+
+	err = cell_management_prologue(&cell_cpu.cell_id, &cell);
+	if (err)
+		return err;
+
+	if (!cpumask_test_cpu(cpu, &root_cell->cpus_assigned)) {
+		err = -EBUSY;
+		goto unlock_out;
+	}
+
+	if (cpu_online(cpu)) {
+		err = cpu_down(cpu);
+		if (err)
+			goto unlock_out;
+		cpumask_set_cpu(cpu, &offlined_cpus);
+	}
+
+	err = jailhouse_call_arg2(JAILHOUSE_HC_CELL_ADD_CPU, cell->id, cpu);
+	if (err) {
+		if (cpumask_test_cpu(cpu, &offlined_cpus) && cpu_up(cpu) == 0)
+			cpumask_clear_cpu(cpu, &offlined_cpus);
+		goto unlock_out;
+	}
+
+	cpumask_clear_cpu(cpu, &root_cell->cpus_assigned);
+	cpumask_set_cpu(cpu, &cell->cpus_assigned);
+	jailhouse_sysfs_cell_update_cpus(root_cell);
+	jailhouse_sysfs_cell_update_cpus(cell);
+
+	pr_info("Added CPU %d to Jailhouse cell \"%s\"\n", cpu,
+		kobject_name(&cell->kobj));
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
+int jailhouse_cmd_cell_remove_cpu(struct jailhouse_cell_cpu __user *arg)
+{
+	struct jailhouse_cell_cpu cell_cpu;
+	struct cell *cell;
+	unsigned int cpu;
+	int err;
+
+	if (copy_from_user(&cell_cpu, arg, sizeof(cell_cpu)))
+		return -EFAULT;
+
+	cpu = cell_cpu.cpu;
+	if (cpu >= nr_cpu_ids)
+		return -EINVAL;
+
+	err = cell_management_prologue(&cell_cpu.cell_id, &cell);
+	if (err)
+		return err;
+
+	err = jailhouse_call_arg2(JAILHOUSE_HC_CELL_REMOVE_CPU, cell->id, cpu);
+	if (err)
+		goto unlock_out;
+
+	cpumask_clear_cpu(cpu, &cell->cpus_assigned);
+	cell_return_cpu(cpu);
+	jailhouse_sysfs_cell_update_cpus(cell);
+	jailhouse_sysfs_cell_update_cpus(root_cell);
+
+	pr_info("Removed CPU %d from Jailhouse cell \"%s\"\n", cpu,
+		kobject_name(&cell->kobj));
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
+int jailhouse_cmd_cell_set_memory(struct jailhouse_cell_memory __user *arg,
+				  bool add)
+{
+	struct jailhouse_cell_memory cell_mem;
+	struct cell *cell;
+	int err;
+
+	if (copy_from_user(&cell_mem, arg, sizeof(cell_mem)))
+		return -EFAULT;
+
+	err = cell_management_prologue(&cell_mem.cell_id, &cell);
+	if (err)
+		return err;
+
+	err = jailhouse_call_arg2(add ? JAILHOUSE_HC_CELL_ADD_MEMORY :
+					JAILHOUSE_HC_CELL_REMOVE_MEMORY,
+				  cell->id, cell_mem.region);
+	if (err == 0)
+		pr_info("%s memory region %u %s Jailhouse cell \"%s\"\n",
+			add ? "Added" : "Removed", cell_mem.region,
+			add ? "to" : "from", kobject_name(&cell->kobj));
+
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
 int jailhouse_cmd_cell_destroy(const char __user *arg)
 {
 	struct jailhouse_cell_id cell_id;
+	ktime_t start, hotplug, hypercall;
 	struct cell *cell;
 	unsigned int cpu;
 	int err;
@@ -403,25 +1241,24 @@ int jailhouse_cmd_cell_destroy(const char __user *arg)
 	if (err)
 		return err;
 
+	start = ktime_get();
 	err = jailhouse_call_arg1(JAILHOUSE_HC_CELL_DESTROY, cell->id);
+	hypercall = ktime_sub(ktime_get(), start);
 	if (err)
 		goto unlock_out;
 
-	for_each_cpu(cpu, &cell->cpus_assigned) {
-		if (cpumask_test_cpu(cpu, &offlined_cpus)) {
-			if (cpu_up(cpu) != 0)
-				pr_err("Jailhouse: failed to bring CPU %d "
-				       "back online\n", cpu);
-			cpumask_clear_cpu(cpu, &offlined_cpus);
-		}
-		cpumask_set_cpu(cpu, &root_cell->cpus_assigned);
-	}
+	start = ktime_get();
+	for_each_cpu(cpu, &cell->cpus_assigned)
+		cell_return_cpu(cpu);
+	hotplug = ktime_sub(ktime_get(), start);
+	jailhouse_sysfs_cell_update_cpus(root_cell);
 
 	jailhouse_pci_do_all_devices(cell, JAILHOUSE_PCI_TYPE_DEVICE,
 	                             JAILHOUSE_PCI_ACTION_RELEASE);
 
-	pr_info("Destroyed Jailhouse cell \"%s\"\n",
-		kobject_name(&cell->kobj));
+	pr_info("Destroyed Jailhouse cell \"%s\" (CPU hotplug: %lld us, "
+		"hypercall: %lld us)\n", kobject_name(&cell->kobj),
+		ktime_to_us(hotplug), ktime_to_us(hypercall));
 
 	jailhouse_cell_delete(cell);
 
@@ -430,3 +1267,95 @@ unlock_out:
 
 	return err;
 }
+
+static void cell_snapshot(struct cell *cell,
+			  struct jailhouse_cell_snapshot *info)
+{
+	unsigned int cpu, n;
+	u64 *stats;
+
+	memset(info, 0, sizeof(*info));
+
+	info->id = cell->id;
+	info->state = jailhouse_call_arg1(JAILHOUSE_HC_CELL_GET_STATE,
+					  cell->id);
+	strlcpy(info->name, kobject_name(&cell->kobj), sizeof(info->name));
+
+	for_each_cpu(cpu, &cell->cpus_assigned) {
+		if (cpu >= JAILHOUSE_SNAPSHOT_MAX_CPUS)
+			break;
+		info->cpus_assigned[cpu / 64] |= 1ULL << (cpu % 64);
+		if (jailhouse_call_arg2(JAILHOUSE_HC_CPU_GET_INFO, cpu,
+					JAILHOUSE_CPU_INFO_STATE) ==
+		    JAILHOUSE_CPU_FAILED)
+			info->cpus_failed[cpu / 64] |= 1ULL << (cpu % 64);
+	}
+
+	/* counters are left at zero if they cannot be retrieved */
+	stats = jailhouse_cell_get_stats(cell, true);
+	if (!IS_ERR(stats)) {
+		for (n = 0; n < JAILHOUSE_NUM_CPU_STATS; n++)
+			info->stats[n] = stats[n];
+		kfree(stats);
+	}
+}
+
+/*
+ * Report all cells at once, for monitoring agents that would otherwise have
+ * to read several sysfs files per cell. If the provided array is too small,
+ * only the first entries are filled, but num_cells is set to the total number
+ * of cells so that the caller can retry.
+ */
+int jailhouse_cmd_snapshot(struct jailhouse_snapshot __user *arg)
+{
+	struct jailhouse_cell_snapshot __user *ucells;
+	struct jailhouse_cell_snapshot *info;
+	struct jailhouse_snapshot snapshot;
+	struct cell *cell;
+	unsigned int n = 0;
+	int err = 0;
+
+	BUILD_BUG_ON(JAILHOUSE_NUM_CPU_STATS > JAILHOUSE_SNAPSHOT_MAX_STATS);
+
+	if (copy_from_user(&snapshot, arg, sizeof(snapshot)))
+		return -EFAULT;
+	ucells = (struct jailhouse_cell_snapshot __user *)
+		(unsigned long)snapshot.cells_address;
+
+	info = kmalloc(sizeof(*info), GFP_KERNEL);
+	if (!info)
+		return -ENOMEM;
+
+	if (mutex_lock_interruptible(&jailhouse_lock) != 0) {
+		err = -EINTR;
+		goto out_free;
+	}
+
+	if (!jailhouse_enabled) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	list_for_each_entry(cell, &cells, entry) {
+		if (n < snapshot.max_cells) {
+			cell_snapshot(cell, info);
+			if (copy_to_user(&ucells[n], info, sizeof(*info))) {
+				err = -EFAULT;
+				goto unlock_out;
+			}
+		}
+		n++;
+	}
+
+	snapshot.num_cells = n;
+	snapshot.num_stats = JAILHOUSE_NUM_CPU_STATS;
+	if (copy_to_user(arg, &snapshot, sizeof(snapshot)))
+		err = -EFAULT;
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+out_free:
+	kfree(info);
+
+	return err;
+}
@@ -22,6 +22,9 @@
 
 #include <jailhouse/cell-config.h>
 
+struct jailhouse_cpu_kobj;
+struct cell_console;
+
 struct cell {
 	struct kobject kobj;
 	struct list_head entry;
@@ -33,6 +36,15 @@ struct cell {
 	u32 num_pci_devices;
 	struct jailhouse_pci_device *pci_devices;
 #endif /* CONFIG_PCI */
+	struct jailhouse_cpu_stats *stats;
+	unsigned int num_stats_slots;
+	void *comm_page;
+	u32 last_state;
+	struct kobject *cpus_dir;
+	struct jailhouse_cpu_kobj **cpu_kobjs;
+	bool loadable;
+	struct address_space *image_mapping;
+	struct cell_console *console;
 };
 
 extern struct cell *root_cell;
@@ -43,6 +55,7 @@ struct cell *
 jailhouse_cell_create(const struct jailhouse_cell_desc *cell_desc);
 void jailhouse_cell_register(struct cell *cell);
 void jailhouse_cell_delete(struct cell *cell);
+void jailhouse_cell_check_states(void);
 
 int jailhouse_cell_prepare_root(const struct jailhouse_cell_desc *cell_desc);
 void jailhouse_cell_register_root(void);
@@ -51,8 +64,22 @@ void jailhouse_cell_delete_root(void);
 void jailhouse_cell_delete_all(void);
 
 int jailhouse_cmd_cell_create(struct jailhouse_cell_create __user *arg);
-int jailhouse_cmd_cell_load(struct jailhouse_cell_load __user *arg);
+int jailhouse_cell_mmap(struct file *file, struct vm_area_struct *vma);
+void jailhouse_cell_release_file(struct file *file);
+
+int jailhouse_cmd_cell_load(struct file *file,
+			    struct jailhouse_cell_load __user *arg);
+int jailhouse_cmd_cell_load_fd(struct file *file,
+			       struct jailhouse_cell_load_fd __user *arg);
 int jailhouse_cmd_cell_start(const char __user *arg);
+int jailhouse_cmd_cell_start_multi(
+		struct jailhouse_cell_start_multi __user *arg);
 int jailhouse_cmd_cell_destroy(const char __user *arg);
+int jailhouse_cmd_snapshot(struct jailhouse_snapshot __user *arg);
+int jailhouse_cmd_cell_set_cache(struct jailhouse_cell_cache __user *arg);
+int jailhouse_cmd_cell_add_cpu(struct jailhouse_cell_cpu __user *arg);
+int jailhouse_cmd_cell_remove_cpu(struct jailhouse_cell_cpu __user *arg);
+int jailhouse_cmd_cell_set_memory(struct jailhouse_cell_memory __user *arg,
+				  bool add);
 
 #endif /* !_JAILHOUSE_DRIVER_CELL_H */
@@ -0,0 +1,286 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Events reported by the hypervisor to the root cell: cell state changes,
+ * failed CPUs and IOMMU faults. The hypervisor counts them in a read-only
+ * page. If the root cell owns an ivshmem device of protocol
+ * JAILHOUSE_SHMEM_PROTO_EVENTS, each event raises its MSI-X vector 0.
+ * Otherwise, the page is sampled every STATE_POLL_INTERVAL. The page also
+ * holds a log of recent IOMMU faults and fault counters per device.
+ */
+
+#include <linux/interrupt.h>
+#include <linux/pci.h>
+#include <linux/workqueue.h>
+
+#include "cell.h"
+#include "events.h"
+#include "main.h"
+
+#include <jailhouse/cell-config.h>
+#include <jailhouse/hypercall.h>
+
+#define DRV_NAME	"jailhouse-events"
+
+static struct kobject *events_kobj;
+static struct jailhouse_events *events;
+static u32 events_seen;
+static bool events_irq;
+
+static void events_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(events_work, events_work_fn);
+
+static void events_work_fn(struct work_struct *work)
+{
+	u32 seq = READ_ONCE(events->seq);
+
+	if (seq != events_seen) {
+		/*
+		 * Cell management and disable hold the lock for a while and
+		 * may wait for us, so retry instead of blocking.
+		 */
+		if (!mutex_trylock(&jailhouse_lock)) {
+			schedule_delayed_work(&events_work, 1);
+			return;
+		}
+		events_seen = seq;
+		jailhouse_cell_check_states();
+		mutex_unlock(&jailhouse_lock);
+
+		sysfs_notify(events_kobj, "events", "total");
+	}
+
+	if (!READ_ONCE(events_irq))
+		schedule_delayed_work(&events_work, STATE_POLL_INTERVAL);
+}
+
+/**
+ * Read an event counter.
+ * @param type		Event type (JAILHOUSE_EVENT_*), or
+ * 			JAILHOUSE_NUM_EVENTS for the total number of events.
+ * @param count		Counter value.
+ *
+ * @return 0 on success, -ENODEV if the hypervisor is disabled.
+ *
+ * Called with jailhouse_lock held.
+ */
+int jailhouse_events_read(unsigned int type, u32 *count)
+{
+	if (!events)
+		return -ENODEV;
+
+	*count = type < JAILHOUSE_NUM_EVENTS ? events->count[type] :
+		events->seq;
+	return 0;
+}
+
+#define BDF_ARGS(bdf)	((bdf) >> 8), (((bdf) >> 3) & 0x1f), ((bdf) & 0x7)
+
+/**
+ * Print the IOMMU fault counters per device.
+ * @param buffer	Sysfs buffer of PAGE_SIZE bytes.
+ *
+ * @return Length of the output, or -ENODEV if the hypervisor is disabled.
+ *
+ * Called with jailhouse_lock held.
+ */
+ssize_t jailhouse_events_fault_devices(char *buffer)
+{
+	struct jailhouse_iommu_fault_device *device;
+	ssize_t len = 0;
+	unsigned int n;
+	u32 count;
+
+	if (!events)
+		return -ENODEV;
+
+	for (n = 0; n < JAILHOUSE_IOMMU_FAULT_DEVICES; n++) {
+		device = &events->iommu_faults.devices[n];
+		count = READ_ONCE(device->count);
+		if (count == 0)
+			break;
+		smp_rmb();
+		len += scnprintf(buffer + len, PAGE_SIZE - len,
+				 "%02x:%02x.%x %u\n",
+				 BDF_ARGS(device->device_id), count);
+	}
+
+	count = READ_ONCE(events->iommu_faults.untracked);
+	if (count > 0)
+		len += scnprintf(buffer + len, PAGE_SIZE - len, "other %u\n",
+				 count);
+
+	return len;
+}
+
+/**
+ * Print the most recent IOMMU fault records, oldest first.
+ * @param buffer	Sysfs buffer of PAGE_SIZE bytes.
+ *
+ * @return Length of the output, or -ENODEV if the hypervisor is disabled.
+ *
+ * Called with jailhouse_lock held.
+ */
+ssize_t jailhouse_events_fault_log(char *buffer)
+{
+	struct jailhouse_iommu_faults *faults;
+	struct jailhouse_iommu_fault record, *slot;
+	ssize_t len = 0;
+	u32 head, seq;
+
+	if (!events)
+		return -ENODEV;
+
+	faults = &events->iommu_faults;
+	head = READ_ONCE(faults->head);
+	smp_rmb();
+
+	seq = head > JAILHOUSE_IOMMU_FAULT_RECORDS ?
+		head - JAILHOUSE_IOMMU_FAULT_RECORDS : 0;
+	for (; seq != head; seq++) {
+		slot = &faults->records[seq % JAILHOUSE_IOMMU_FAULT_RECORDS];
+		if (READ_ONCE(slot->seq) != seq + 1)
+			continue;
+		smp_rmb();
+		record = *slot;
+		smp_rmb();
+
+		/* skip records that were overwritten while we copied them */
+		if (READ_ONCE(slot->seq) != seq + 1)
+			continue;
+
+		len += scnprintf(buffer + len, PAGE_SIZE - len,
+				 "%u %u %02x:%02x.%x 0x%x 0x%llx\n", seq,
+				 record.unit, BDF_ARGS(record.device_id),
+				 record.reason, record.info);
+	}
+
+	return len;
+}
+
+/* called with jailhouse_lock held, after the hypervisor was enabled */
+void jailhouse_events_start(struct jailhouse_events *page)
+{
+	events = page;
+	events_seen = events->seq;
+	schedule_delayed_work(&events_work, STATE_POLL_INTERVAL);
+}
+
+/*
+ * Called with jailhouse_lock held, after the hypervisor was disabled and the
+ * event device of the root cell was removed.
+ */
+void jailhouse_events_stop(void)
+{
+	cancel_delayed_work_sync(&events_work);
+	events = NULL;
+}
+
+#ifdef CONFIG_PCI
+struct events_dev {
+	struct msix_entry msix;
+};
+
+static irqreturn_t events_irq_handler(int irq, void *data)
+{
+	mod_delayed_work(system_wq, &events_work, 0);
+	return IRQ_HANDLED;
+}
+
+/*
+ * The device is added while enabling the hypervisor, with jailhouse_lock
+ * held, so probe and remove must not take it.
+ */
+static int events_probe(struct pci_dev *pdev, const struct pci_device_id *id)
+{
+	struct events_dev *edev;
+	int err;
+
+	edev = devm_kzalloc(&pdev->dev, sizeof(*edev), GFP_KERNEL);
+	if (!edev)
+		return -ENOMEM;
+
+	err = pci_enable_device(pdev);
+	if (err)
+		return err;
+
+	edev->msix.entry = 0;
+	err = pci_enable_msix_range(pdev, &edev->msix, 1, 1);
+	if (err < 0)
+		goto err_disable;
+
+	err = request_irq(edev->msix.vector, events_irq_handler, 0, DRV_NAME,
+			  edev);
+	if (err)
+		goto err_disable_msix;
+
+	pci_set_master(pdev);
+	pci_set_drvdata(pdev, edev);
+
+	/* stop sampling, but catch events raised before the irq was ready */
+	WRITE_ONCE(events_irq, true);
+	mod_delayed_work(system_wq, &events_work, 0);
+
+	dev_info(&pdev->dev, "receiving hypervisor events\n");
+	return 0;
+
+err_disable_msix:
+	pci_disable_msix(pdev);
+err_disable:
+	pci_disable_device(pdev);
+	return err;
+}
+
+static void events_remove(struct pci_dev *pdev)
+{
+	struct events_dev *edev = pci_get_drvdata(pdev);
+
+	free_irq(edev->msix.vector, edev);
+	pci_disable_msix(pdev);
+	pci_disable_device(pdev);
+
+	/* fall back to sampling */
+	WRITE_ONCE(events_irq, false);
+	if (events)
+		mod_delayed_work(system_wq, &events_work, 0);
+}
+
+static const struct pci_device_id events_ids[] = {
+	{
+		PCI_DEVICE(0x1af4, 0x1110),
+		.class = (PCI_CLASS_OTHERS << 16) |
+			 JAILHOUSE_SHMEM_PROTO_EVENTS,
+		.class_mask = 0xffffff,
+	},
+	{ 0 }
+};
+
+static struct pci_driver events_driver = {
+	.name		= DRV_NAME,
+	.id_table	= events_ids,
+	.probe		= events_probe,
+	.remove		= events_remove,
+};
+#endif /* CONFIG_PCI */
+
+int jailhouse_events_init(struct device *dev)
+{
+	events_kobj = &dev->kobj;
+#ifdef CONFIG_PCI
+	return pci_register_driver(&events_driver);
+#else
+	return 0;
+#endif
+}
+
+void jailhouse_events_exit(void)
+{
+#ifdef CONFIG_PCI
+	pci_unregister_driver(&events_driver);
+#endif
+}
@@ -0,0 +1,27 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_DRIVER_EVENTS_H
+#define _JAILHOUSE_DRIVER_EVENTS_H
+
+#include <linux/device.h>
+
+#include <jailhouse/hypercall.h>
+
+int jailhouse_events_read(unsigned int type, u32 *count);
+ssize_t jailhouse_events_fault_devices(char *buffer);
+ssize_t jailhouse_events_fault_log(char *buffer);
+
+void jailhouse_events_start(struct jailhouse_events *page);
+void jailhouse_events_stop(void);
+
+int jailhouse_events_init(struct device *dev);
+void jailhouse_events_exit(void);
+
+#endif /* !_JAILHOUSE_DRIVER_EVENTS_H */
@@ -0,0 +1,452 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/*
+ * hvc terminal on top of a Jailhouse ivshmem link of protocol
+ * JAILHOUSE_SHMEM_PROTO_CONSOLE. The link carries one message queue per
+ * direction, see jailhouse/queue.h, the endpoint with IVPosition 0 produces
+ * into the lower half. In the root cell, the terminal shows the console of
+ * the peer cell, in a Linux non-root cell it can serve as its console.
+ * Characters cost a copy into the queue, the doorbell is only rung if the
+ * peer waits for them.
+ */
+
+#include <linux/err.h>
+#include <linux/idr.h>
+#include <linux/interrupt.h>
+#include <linux/io.h>
+#include <linux/module.h>
+#include <linux/pci.h>
+#include <linux/version.h>
+
+#include "hvc_console.h"
+
+#include <jailhouse/cell-config.h>
+#include <jailhouse/queue.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,3,0)
+#define memremap(offset, size, flags)	ioremap_cache(offset, size)
+#define memunmap(addr)			iounmap((void __iomem *)addr)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,6,0)
+#define virt_mb()			mb()
+#define virt_rmb()			rmb()
+#define virt_wmb()			wmb()
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,6,0)
+typedef u8 ivcon_char_t;
+typedef size_t ivcon_count_t;
+typedef ssize_t ivcon_ret_t;
+#else
+typedef char ivcon_char_t;
+typedef int ivcon_count_t;
+typedef int ivcon_ret_t;
+#endif
+
+#define DRV_NAME			"jailhouse-ivshmem-console"
+
+#define IVSHMEM_CFG_SHMEM_PTR		0x40
+#define IVSHMEM_CFG_SHMEM_SZ		0x48
+
+#define IVSHMEM_REG_IVPOS		8
+#define IVSHMEM_REG_DBELL		12
+
+#define SLOT_PAYLOAD(q)			((q)->slot_size - \
+					 sizeof(struct jailhouse_queue_slot))
+
+#define IVCON_MAX_DEVICES		16
+#define IVCON_VTERMNO_BASE		0x4a480000	/* "JH" */
+#define IVCON_OUTBUF_SIZE		256
+
+struct queue_state {
+	struct jailhouse_queue *queue;
+	u32 num_slots;
+	u32 slot_size;
+	/* local copy of head (tx) or tail (rx) */
+	u32 idx;
+	/* value of idx when the peer was last checked for notification */
+	u32 notified_idx;
+};
+
+struct ivcon_dev {
+	struct pci_dev *pdev;
+	void __iomem *registers;
+	void *shmem;
+	u32 peer;
+	int id;
+	struct msix_entry msix;
+	struct hvc_struct *hvc;
+	struct queue_state tx;
+	struct queue_state rx;
+	void *rx_mem;
+	unsigned long rx_size;
+	bool rx_attached;
+	/* bytes of the current receive slot already passed to hvc */
+	u32 rx_offset;
+};
+
+static unsigned int slot_size = 64;
+module_param(slot_size, uint, 0444);
+MODULE_PARM_DESC(slot_size, "Size of the transmit queue slots in bytes");
+
+static DEFINE_IDA(ivcon_ida);
+/* hvc only passes the vterm number to the callbacks, serialized by hvc */
+static struct ivcon_dev *ivcon_devs[IVCON_MAX_DEVICES];
+
+static void ivcon_kick(struct ivcon_dev *con)
+{
+	writel(con->peer << 16, con->registers + IVSHMEM_REG_DBELL);
+}
+
+static int ivcon_init_tx(struct queue_state *q, void *mem, unsigned long size)
+{
+	struct jailhouse_queue *queue = mem;
+
+	if (slot_size < JAILHOUSE_QUEUE_MIN_SLOT_SIZE || slot_size % 8)
+		return -EINVAL;
+	q->num_slots = jailhouse_queue_slots(size, slot_size);
+	if (q->num_slots == 0)
+		return -EINVAL;
+
+	queue->magic = 0;
+	virt_wmb();
+
+	queue->num_slots = q->num_slots;
+	queue->slot_size = slot_size;
+	q->idx = queue->cons.tail;
+	queue->prod.head = q->idx;
+	queue->prod.space_event = q->idx - 1;
+
+	virt_wmb();
+	queue->magic = JAILHOUSE_QUEUE_MAGIC;
+
+	q->queue = queue;
+	q->slot_size = slot_size;
+	q->notified_idx = q->idx;
+	return 0;
+}
+
+static bool ivcon_attach_rx(struct ivcon_dev *con)
+{
+	struct jailhouse_queue *queue = con->rx_mem;
+	struct queue_state *q = &con->rx;
+
+	if (con->rx_attached)
+		return true;
+
+	if (queue->magic != JAILHOUSE_QUEUE_MAGIC)
+		return false;
+	virt_rmb();
+
+	q->num_slots = queue->num_slots;
+	q->slot_size = queue->slot_size;
+	if (q->num_slots == 0 || !is_power_of_2(q->num_slots) ||
+	    q->slot_size < JAILHOUSE_QUEUE_MIN_SLOT_SIZE || q->slot_size % 8 ||
+	    q->num_slots > (con->rx_size - sizeof(struct jailhouse_queue)) /
+			   q->slot_size) {
+		dev_err_once(&con->pdev->dev, "invalid receive queue\n");
+		return false;
+	}
+
+	q->idx = queue->prod.head;
+	queue->cons.tail = q->idx;
+	queue->cons.data_event = q->idx - 1;
+
+	q->queue = queue;
+	q->notified_idx = q->idx;
+	con->rx_offset = 0;
+	con->rx_attached = true;
+	return true;
+}
+
+static bool queue_tx_full(struct queue_state *q)
+{
+	return q->idx - q->queue->cons.tail >= q->num_slots;
+}
+
+static bool queue_rx_empty(struct queue_state *q)
+{
+	return q->queue->prod.head == q->idx;
+}
+
+static struct jailhouse_queue_slot *queue_slot(struct queue_state *q)
+{
+	return jailhouse_queue_slot(q->queue, q->num_slots, q->slot_size,
+				    q->idx);
+}
+
+/* returns true if the caller can wait, false if the queue changed meanwhile */
+static bool queue_prepare_wait_tx(struct queue_state *q)
+{
+	q->queue->prod.space_event = q->queue->cons.tail;
+	virt_mb();
+	return queue_tx_full(q);
+}
+
+static bool queue_prepare_wait_rx(struct queue_state *q)
+{
+	q->queue->cons.data_event = q->idx;
+	virt_mb();
+	return queue_rx_empty(q);
+}
+
+static bool queue_kick_needed(struct queue_state *q, volatile u32 *event)
+{
+	u32 old_idx = q->notified_idx;
+
+	/* publish our index before looking at the peer's event */
+	virt_mb();
+	q->notified_idx = q->idx;
+
+	return jailhouse_queue_need_event(*event, q->idx, old_idx);
+}
+
+static struct ivcon_dev *ivcon_lookup(u32 vtermno)
+{
+	u32 n = vtermno - IVCON_VTERMNO_BASE;
+
+	return n < IVCON_MAX_DEVICES ? ivcon_devs[n] : NULL;
+}
+
+static ivcon_ret_t ivcon_get_chars(u32 vtermno, ivcon_char_t *buf,
+				   ivcon_count_t count)
+{
+	struct ivcon_dev *con = ivcon_lookup(vtermno);
+	struct jailhouse_queue_slot *slot;
+	ivcon_count_t copied = 0;
+	struct queue_state *q;
+	u32 len, chunk;
+
+	if (!con || !ivcon_attach_rx(con))
+		return 0;
+	q = &con->rx;
+
+	while (copied < count) {
+		if (queue_rx_empty(q) && queue_prepare_wait_rx(q))
+			break;
+		virt_rmb();
+
+		slot = queue_slot(q);
+		len = min_t(u32, READ_ONCE(slot->len), SLOT_PAYLOAD(q));
+		chunk = min_t(u32, len - min(con->rx_offset, len),
+			      count - copied);
+		memcpy(buf + copied, slot->data + con->rx_offset, chunk);
+		copied += chunk;
+		con->rx_offset += chunk;
+
+		if (con->rx_offset >= len) {
+			/* finish reading the slot before handing it back */
+			virt_mb();
+			q->queue->cons.tail = ++q->idx;
+			con->rx_offset = 0;
+		}
+	}
+
+	if (queue_kick_needed(q, &q->queue->prod.space_event))
+		ivcon_kick(con);
+
+	return copied;
+}
+
+static ivcon_ret_t ivcon_put_chars(u32 vtermno, const ivcon_char_t *buf,
+				   ivcon_count_t count)
+{
+	struct ivcon_dev *con = ivcon_lookup(vtermno);
+	struct jailhouse_queue_slot *slot;
+	ivcon_count_t sent = 0;
+	struct queue_state *q;
+	u32 chunk;
+
+	if (!con)
+		return count;
+	q = &con->tx;
+
+	while (sent < count) {
+		if (queue_tx_full(q) && queue_prepare_wait_tx(q))
+			break;
+		/* the consumer must be done with the slot before overwriting */
+		virt_mb();
+
+		slot = queue_slot(q);
+		chunk = min_t(u32, count - sent, SLOT_PAYLOAD(q));
+		memcpy(slot->data, buf + sent, chunk);
+		slot->len = chunk;
+
+		virt_wmb();
+		q->queue->prod.head = ++q->idx;
+		sent += chunk;
+	}
+
+	if (queue_kick_needed(q, &q->queue->cons.data_event))
+		ivcon_kick(con);
+
+	/* hvc retries the rest once the peer freed slots and kicked us */
+	return sent;
+}
+
+static const struct hv_ops ivcon_ops = {
+	.get_chars	= ivcon_get_chars,
+	.put_chars	= ivcon_put_chars,
+};
+
+static irqreturn_t ivcon_irq_handler(int irq, void *data)
+{
+	hvc_kick();
+	return IRQ_HANDLED;
+}
+
+static int ivcon_probe(struct pci_dev *pdev, const struct pci_device_id *id)
+{
+	resource_size_t shmem_addr, shmem_size;
+	struct ivcon_dev *con;
+	unsigned long half;
+	u32 lo, hi, ivpos;
+	int err;
+
+	con = devm_kzalloc(&pdev->dev, sizeof(*con), GFP_KERNEL);
+	if (!con)
+		return -ENOMEM;
+
+	con->pdev = pdev;
+
+	err = pci_enable_device(pdev);
+	if (err)
+		return err;
+
+	err = pci_request_regions(pdev, DRV_NAME);
+	if (err)
+		goto err_disable;
+
+	con->registers = pci_iomap(pdev, 0, 0);
+	if (!con->registers) {
+		err = -ENOMEM;
+		goto err_release;
+	}
+
+	ivpos = readl(con->registers + IVSHMEM_REG_IVPOS);
+	if (ivpos > 1) {
+		dev_err(&pdev->dev, "only links between two peers supported\n");
+		err = -ENODEV;
+		goto err_unmap_regs;
+	}
+	con->peer = 1 - ivpos;
+
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_PTR, &lo);
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_PTR + 4, &hi);
+	shmem_addr = ((u64)hi << 32) | lo;
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_SZ, &lo);
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_SZ + 4, &hi);
+	shmem_size = ((u64)hi << 32) | lo;
+
+	con->shmem = memremap(shmem_addr, shmem_size, MEMREMAP_WB);
+	if (!con->shmem) {
+		err = -ENOMEM;
+		goto err_unmap_regs;
+	}
+
+	half = shmem_size / 2;
+	err = ivcon_init_tx(&con->tx, con->shmem + ivpos * half, half);
+	if (err) {
+		dev_err(&pdev->dev, "shared memory too small for queues\n");
+		goto err_unmap_shmem;
+	}
+	con->rx_mem = con->shmem + con->peer * half;
+	con->rx_size = half;
+
+	con->msix.entry = 0;
+	err = pci_enable_msix_range(pdev, &con->msix, 1, 1);
+	if (err < 0)
+		goto err_unmap_shmem;
+
+	con->id = ida_simple_get(&ivcon_ida, 0, IVCON_MAX_DEVICES, GFP_KERNEL);
+	if (con->id < 0) {
+		err = con->id;
+		goto err_disable_msix;
+	}
+	ivcon_devs[con->id] = con;
+
+	err = request_irq(con->msix.vector, ivcon_irq_handler, 0, DRV_NAME,
+			  con);
+	if (err)
+		goto err_free_id;
+
+	pci_set_master(pdev);
+
+	con->hvc = hvc_alloc(IVCON_VTERMNO_BASE + con->id, 0, &ivcon_ops,
+			     IVCON_OUTBUF_SIZE);
+	if (IS_ERR(con->hvc)) {
+		err = PTR_ERR(con->hvc);
+		goto err_free_irq;
+	}
+
+	pci_set_drvdata(pdev, con);
+
+	/* let a peer waiting for our queue attach to it */
+	ivcon_kick(con);
+
+	dev_info(&pdev->dev, "console on hvc%d\n", con->hvc->index);
+	return 0;
+
+err_free_irq:
+	free_irq(con->msix.vector, con);
+err_free_id:
+	ivcon_devs[con->id] = NULL;
+	ida_simple_remove(&ivcon_ida, con->id);
+err_disable_msix:
+	pci_disable_msix(pdev);
+err_unmap_shmem:
+	memunmap(con->shmem);
+err_unmap_regs:
+	pci_iounmap(pdev, con->registers);
+err_release:
+	pci_release_regions(pdev);
+err_disable:
+	pci_disable_device(pdev);
+	return err;
+}
+
+static void ivcon_remove(struct pci_dev *pdev)
+{
+	struct ivcon_dev *con = pci_get_drvdata(pdev);
+
+	hvc_remove(con->hvc);
+	free_irq(con->msix.vector, con);
+	ivcon_devs[con->id] = NULL;
+	ida_simple_remove(&ivcon_ida, con->id);
+	pci_disable_msix(pdev);
+	memunmap(con->shmem);
+	pci_iounmap(pdev, con->registers);
+	pci_release_regions(pdev);
+	pci_disable_device(pdev);
+}
+
+static const struct pci_device_id ivcon_ids[] = {
+	{
+		PCI_DEVICE(0x1af4, 0x1110),
+		.class = (PCI_CLASS_OTHERS << 16) |
+			 JAILHOUSE_SHMEM_PROTO_CONSOLE,
+		.class_mask = 0xffffff,
+	},
+	{ 0 }
+};
+MODULE_DEVICE_TABLE(pci, ivcon_ids);
+
+static struct pci_driver ivcon_driver = {
+	.name		= DRV_NAME,
+	.id_table	= ivcon_ids,
+	.probe		= ivcon_probe,
+	.remove		= ivcon_remove,
+};
+
+module_pci_driver(ivcon_driver);
+
+MODULE_DESCRIPTION("hvc console on Jailhouse ivshmem devices");
+MODULE_LICENSE("GPL");
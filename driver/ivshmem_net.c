@@ -0,0 +1,645 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/*
+ * Virtual Ethernet device on top of a Jailhouse ivshmem link between two
+ * cells, see jailhouse/ivshmem-net.h for the shared memory layout. Frames
+ * are copied once, from the sending skb straight into its queue slot and
+ * from the slot into the receiving skb. A burst of frames signaled as
+ * xmit_more costs a single doorbell, capped by the tx_coalesce parameter,
+ * and no doorbell at all while the peer is still polling. Partial
+ * checksums and TSO are passed through if the peer accepts them.
+ */
+
+#include <linux/etherdevice.h>
+#include <linux/if_vlan.h>
+#include <linux/interrupt.h>
+#include <linux/io.h>
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/pci.h>
+#include <linux/rtnetlink.h>
+#include <linux/skbuff.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+
+#include <jailhouse/cell-config.h>
+#include <jailhouse/ivshmem-net.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,3,0)
+#define memremap(offset, size, flags)	ioremap_cache(offset, size)
+#define memunmap(addr)			iounmap((void __iomem *)addr)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,6,0)
+#define virt_mb()			mb()
+#define virt_rmb()			rmb()
+#define virt_wmb()			wmb()
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,2,0)
+#define ivnet_xmit_more(skb)		netdev_xmit_more()
+#else
+#define ivnet_xmit_more(skb)		((skb)->xmit_more)
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,0,0)
+#define ivnet_set_gso_max(netdev, size)	\
+	netif_set_tso_max_size(netdev, size)
+#else
+#define ivnet_set_gso_max(netdev, size)	\
+	netif_set_gso_max_size(netdev, size)
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,1,0)
+#define ivnet_napi_add(netdev, napi, poll)	\
+	netif_napi_add(netdev, napi, poll)
+#else
+#define ivnet_napi_add(netdev, napi, poll)	\
+	netif_napi_add(netdev, napi, poll, NAPI_POLL_WEIGHT)
+#endif
+
+#define DRV_NAME			"jailhouse-ivshmem-net"
+
+#define IVSHMEM_CFG_SHMEM_PTR		0x40
+#define IVSHMEM_CFG_SHMEM_SZ		0x48
+
+#define IVSHMEM_REG_IVPOS		8
+#define IVSHMEM_REG_DBELL		12
+
+#define SLOT_PAYLOAD(q)			((q)->slot_size - \
+					 sizeof(struct jailhouse_queue_slot))
+
+#define IVNET_HDR_LEN			\
+	sizeof(struct jailhouse_ivshmem_net_hdr)
+#define IVNET_RX_FEATURES		(JAILHOUSE_IVSHMEM_NET_RX_CSUM | \
+					 JAILHOUSE_IVSHMEM_NET_RX_GSO)
+
+struct queue_state {
+	struct jailhouse_queue *queue;
+	u32 num_slots;
+	u32 slot_size;
+	/* local copy of head (tx) or tail (rx) */
+	u32 idx;
+	/* value of idx when the peer was last checked for notification */
+	u32 notified_idx;
+};
+
+struct ivnet_dev {
+	struct pci_dev *pdev;
+	struct net_device *netdev;
+	struct napi_struct napi;
+	void __iomem *registers;
+	void *shmem;
+	unsigned long half;
+	u32 peer;
+	struct msix_entry msix;
+	struct jailhouse_ivshmem_net_info *tx_info;
+	struct jailhouse_ivshmem_net_info *rx_info;
+	struct queue_state tx;
+	struct queue_state rx;
+	bool rx_attached;
+	u32 peer_features;
+	/* applies the peer features, requires the RTNL */
+	struct work_struct features_work;
+};
+
+static unsigned int slot_size = 2048;
+module_param(slot_size, uint, 0444);
+MODULE_PARM_DESC(slot_size, "Size of the transmit queue slots in bytes, "
+		 "limits MTU and TSO size");
+
+static unsigned int tx_coalesce = 32;
+module_param(tx_coalesce, uint, 0644);
+MODULE_PARM_DESC(tx_coalesce, "Maximum frames per doorbell in a burst");
+
+static void ivnet_kick(struct ivnet_dev *in)
+{
+	writel(in->peer << 16, in->registers + IVSHMEM_REG_DBELL);
+}
+
+static int ivnet_init_tx(struct ivnet_dev *in)
+{
+	struct jailhouse_queue *queue = (void *)in->tx_info +
+		JAILHOUSE_IVSHMEM_NET_QUEUE_OFFSET;
+	unsigned long size = in->half - JAILHOUSE_IVSHMEM_NET_QUEUE_OFFSET;
+	struct queue_state *q = &in->tx;
+
+	if (slot_size < sizeof(struct jailhouse_queue_slot) + IVNET_HDR_LEN +
+	    ETH_HLEN || slot_size % 8)
+		return -EINVAL;
+	q->num_slots = jailhouse_queue_slots(size, slot_size);
+	if (q->num_slots == 0)
+		return -EINVAL;
+
+	in->tx_info->magic = 0;
+	queue->magic = 0;
+	virt_wmb();
+
+	in->tx_info->features = IVNET_RX_FEATURES;
+	queue->num_slots = q->num_slots;
+	queue->slot_size = slot_size;
+	q->idx = queue->cons.tail;
+	queue->prod.head = q->idx;
+	queue->prod.space_event = q->idx - 1;
+
+	virt_wmb();
+	queue->magic = JAILHOUSE_QUEUE_MAGIC;
+	in->tx_info->magic = JAILHOUSE_IVSHMEM_NET_MAGIC;
+
+	q->queue = queue;
+	q->slot_size = slot_size;
+	q->notified_idx = q->idx;
+	return 0;
+}
+
+static bool ivnet_attach_rx(struct ivnet_dev *in)
+{
+	struct jailhouse_queue *queue = (void *)in->rx_info +
+		JAILHOUSE_IVSHMEM_NET_QUEUE_OFFSET;
+	unsigned long size = in->half - JAILHOUSE_IVSHMEM_NET_QUEUE_OFFSET;
+	struct queue_state *q = &in->rx;
+
+	if (in->rx_info->magic != JAILHOUSE_IVSHMEM_NET_MAGIC) {
+		if (in->rx_attached) {
+			in->rx_attached = false;
+			netif_carrier_off(in->netdev);
+		}
+		return false;
+	}
+	if (in->rx_attached)
+		return true;
+	virt_rmb();
+
+	q->num_slots = queue->num_slots;
+	q->slot_size = queue->slot_size;
+	if (queue->magic != JAILHOUSE_QUEUE_MAGIC || q->num_slots == 0 ||
+	    !is_power_of_2(q->num_slots) ||
+	    q->slot_size < JAILHOUSE_QUEUE_MIN_SLOT_SIZE || q->slot_size % 8 ||
+	    q->num_slots > (size - sizeof(struct jailhouse_queue)) /
+			   q->slot_size) {
+		dev_err_once(&in->pdev->dev, "invalid receive queue\n");
+		return false;
+	}
+
+	q->idx = queue->prod.head;
+	queue->cons.tail = q->idx;
+	queue->cons.data_event = q->idx - 1;
+
+	q->queue = queue;
+	q->notified_idx = q->idx;
+	in->peer_features = in->rx_info->features;
+	in->rx_attached = true;
+
+	schedule_work(&in->features_work);
+	netif_carrier_on(in->netdev);
+	return true;
+}
+
+static bool queue_tx_full(struct queue_state *q)
+{
+	return q->idx - q->queue->cons.tail >= q->num_slots;
+}
+
+static bool queue_rx_empty(struct queue_state *q)
+{
+	return q->queue->prod.head == q->idx;
+}
+
+static struct jailhouse_queue_slot *queue_slot(struct queue_state *q)
+{
+	return jailhouse_queue_slot(q->queue, q->num_slots, q->slot_size,
+				    q->idx);
+}
+
+/* returns true if the caller can wait, false if the queue changed meanwhile */
+static bool queue_prepare_wait_tx(struct queue_state *q)
+{
+	q->queue->prod.space_event = q->queue->cons.tail;
+	virt_mb();
+	return queue_tx_full(q);
+}
+
+static bool queue_prepare_wait_rx(struct queue_state *q)
+{
+	q->queue->cons.data_event = q->idx;
+	virt_mb();
+	return queue_rx_empty(q);
+}
+
+static bool queue_kick_needed(struct queue_state *q, volatile u32 *event)
+{
+	u32 old_idx = q->notified_idx;
+
+	/* publish our index before looking at the peer's event */
+	virt_mb();
+	q->notified_idx = q->idx;
+
+	return jailhouse_queue_need_event(*event, q->idx, old_idx);
+}
+
+static int ivnet_hdr_from_skb(struct sk_buff *skb,
+			      struct jailhouse_ivshmem_net_hdr *hdr)
+{
+	struct skb_shared_info *sinfo = skb_shinfo(skb);
+
+	memset(hdr, 0, sizeof(*hdr));
+
+	if (skb_is_gso(skb)) {
+		if (sinfo->gso_type & SKB_GSO_TCPV4)
+			hdr->gso_type = JAILHOUSE_IVSHMEM_NET_GSO_TCPV4;
+		else if (sinfo->gso_type & SKB_GSO_TCPV6)
+			hdr->gso_type = JAILHOUSE_IVSHMEM_NET_GSO_TCPV6;
+		else
+			return -EINVAL;
+		if (sinfo->gso_type & SKB_GSO_TCP_ECN)
+			hdr->gso_type |= JAILHOUSE_IVSHMEM_NET_GSO_ECN;
+		hdr->hdr_len = skb_headlen(skb);
+		hdr->gso_size = sinfo->gso_size;
+	}
+
+	if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		hdr->flags = JAILHOUSE_IVSHMEM_NET_F_NEEDS_CSUM;
+		hdr->csum_start = skb_checksum_start_offset(skb);
+		hdr->csum_offset = skb->csum_offset;
+	}
+	return 0;
+}
+
+static int ivnet_hdr_to_skb(struct sk_buff *skb,
+			    const struct jailhouse_ivshmem_net_hdr *hdr)
+{
+	unsigned int gso_type;
+
+	if (hdr->flags & JAILHOUSE_IVSHMEM_NET_F_NEEDS_CSUM &&
+	    !skb_partial_csum_set(skb, hdr->csum_start, hdr->csum_offset))
+		return -EINVAL;
+
+	if (hdr->gso_type == JAILHOUSE_IVSHMEM_NET_GSO_NONE)
+		return 0;
+
+	switch (hdr->gso_type & ~JAILHOUSE_IVSHMEM_NET_GSO_ECN) {
+	case JAILHOUSE_IVSHMEM_NET_GSO_TCPV4:
+		gso_type = SKB_GSO_TCPV4;
+		break;
+	case JAILHOUSE_IVSHMEM_NET_GSO_TCPV6:
+		gso_type = SKB_GSO_TCPV6;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (hdr->gso_type & JAILHOUSE_IVSHMEM_NET_GSO_ECN)
+		gso_type |= SKB_GSO_TCP_ECN;
+	if (hdr->gso_size == 0)
+		return -EINVAL;
+
+	/* the stack verifies the headers of frames from untrusted sources */
+	skb_shinfo(skb)->gso_size = hdr->gso_size;
+	skb_shinfo(skb)->gso_type = gso_type | SKB_GSO_DODGY;
+	skb_shinfo(skb)->gso_segs = 0;
+	return 0;
+}
+
+static void ivnet_receive(struct ivnet_dev *in,
+			  struct jailhouse_queue_slot *slot)
+{
+	struct net_device *netdev = in->netdev;
+	struct jailhouse_ivshmem_net_hdr hdr;
+	struct sk_buff *skb;
+	u32 len;
+
+	len = READ_ONCE(slot->len);
+	if (len < IVNET_HDR_LEN + ETH_HLEN || len > SLOT_PAYLOAD(&in->rx)) {
+		netdev->stats.rx_length_errors++;
+		return;
+	}
+	len -= IVNET_HDR_LEN;
+
+	skb = napi_alloc_skb(&in->napi, len);
+	if (!skb) {
+		netdev->stats.rx_dropped++;
+		return;
+	}
+	memcpy(&hdr, slot->data, IVNET_HDR_LEN);
+	memcpy(skb_put(skb, len), slot->data + IVNET_HDR_LEN, len);
+
+	if (ivnet_hdr_to_skb(skb, &hdr) < 0) {
+		netdev->stats.rx_errors++;
+		dev_kfree_skb_any(skb);
+		return;
+	}
+	skb->protocol = eth_type_trans(skb, netdev);
+
+	netdev->stats.rx_packets++;
+	netdev->stats.rx_bytes += len;
+	napi_gro_receive(&in->napi, skb);
+}
+
+static int ivnet_poll(struct napi_struct *napi, int budget)
+{
+	struct ivnet_dev *in = container_of(napi, struct ivnet_dev, napi);
+	struct queue_state *q = &in->rx;
+	int received = 0;
+
+	if (!ivnet_attach_rx(in)) {
+		napi_complete_done(napi, 0);
+		return 0;
+	}
+
+	while (received < budget && !queue_rx_empty(q)) {
+		virt_rmb();
+		ivnet_receive(in, queue_slot(q));
+
+		/* finish reading the slot before handing it back */
+		virt_mb();
+		q->queue->cons.tail = ++q->idx;
+		received++;
+	}
+	if (received > 0 &&
+	    queue_kick_needed(q, &q->queue->prod.space_event))
+		ivnet_kick(in);
+
+	/* the peer kicks us as well when it freed transmit slots */
+	if (netif_queue_stopped(in->netdev) && !queue_tx_full(&in->tx))
+		netif_wake_queue(in->netdev);
+
+	if (received < budget) {
+		napi_complete_done(napi, received);
+		if (!queue_prepare_wait_rx(q))
+			napi_schedule(napi);
+	}
+	return received;
+}
+
+static netdev_tx_t ivnet_start_xmit(struct sk_buff *skb,
+				    struct net_device *netdev)
+{
+	struct ivnet_dev *in = netdev_priv(netdev);
+	struct queue_state *q = &in->tx;
+	struct jailhouse_queue_slot *slot;
+	bool flush = !ivnet_xmit_more(skb);
+
+	if (queue_tx_full(q)) {
+		netif_stop_queue(netdev);
+		if (queue_prepare_wait_tx(q))
+			return NETDEV_TX_BUSY;
+		netif_wake_queue(netdev);
+	}
+	/* the consumer must be done with the slot before overwriting it */
+	virt_mb();
+
+	slot = queue_slot(q);
+	if (IVNET_HDR_LEN + skb->len > SLOT_PAYLOAD(q) ||
+	    ivnet_hdr_from_skb(skb,
+			(struct jailhouse_ivshmem_net_hdr *)slot->data) < 0) {
+		netdev->stats.tx_dropped++;
+		dev_kfree_skb_any(skb);
+		goto out;
+	}
+	skb_copy_bits(skb, 0, slot->data + IVNET_HDR_LEN, skb->len);
+	slot->len = IVNET_HDR_LEN + skb->len;
+
+	virt_wmb();
+	q->queue->prod.head = ++q->idx;
+
+	netdev->stats.tx_packets++;
+	netdev->stats.tx_bytes += skb->len;
+
+	if (queue_tx_full(q)) {
+		netif_stop_queue(netdev);
+		if (!queue_prepare_wait_tx(q))
+			netif_wake_queue(netdev);
+		flush = true;
+	}
+	dev_consume_skb_any(skb);
+
+out:
+
+	if ((flush || q->idx - q->notified_idx >= tx_coalesce) &&
+	    queue_kick_needed(q, &q->queue->cons.data_event))
+		ivnet_kick(in);
+
+	return NETDEV_TX_OK;
+}
+
+static int ivnet_open(struct net_device *netdev)
+{
+	struct ivnet_dev *in = netdev_priv(netdev);
+
+	napi_enable(&in->napi);
+	netif_start_queue(netdev);
+	/* attach to the peer and pick up frames queued while we were down */
+	napi_schedule(&in->napi);
+	return 0;
+}
+
+static int ivnet_stop(struct net_device *netdev)
+{
+	struct ivnet_dev *in = netdev_priv(netdev);
+
+	netif_stop_queue(netdev);
+	napi_disable(&in->napi);
+	return 0;
+}
+
+static netdev_features_t ivnet_fix_features(struct net_device *netdev,
+					    netdev_features_t features)
+{
+	struct ivnet_dev *in = netdev_priv(netdev);
+
+	if (!(in->peer_features & JAILHOUSE_IVSHMEM_NET_RX_CSUM))
+		features &= ~(NETIF_F_HW_CSUM | NETIF_F_ALL_TSO);
+	if (!(in->peer_features & JAILHOUSE_IVSHMEM_NET_RX_GSO))
+		features &= ~NETIF_F_ALL_TSO;
+	return features;
+}
+
+static const struct net_device_ops ivnet_ops = {
+	.ndo_open		= ivnet_open,
+	.ndo_stop		= ivnet_stop,
+	.ndo_start_xmit		= ivnet_start_xmit,
+	.ndo_fix_features	= ivnet_fix_features,
+	.ndo_set_mac_address	= eth_mac_addr,
+	.ndo_validate_addr	= eth_validate_addr,
+};
+
+static void ivnet_features_work(struct work_struct *work)
+{
+	struct ivnet_dev *in =
+		container_of(work, struct ivnet_dev, features_work);
+
+	rtnl_lock();
+	netdev_update_features(in->netdev);
+	rtnl_unlock();
+}
+
+static irqreturn_t ivnet_irq_handler(int irq, void *data)
+{
+	struct ivnet_dev *in = data;
+
+	napi_schedule(&in->napi);
+	return IRQ_HANDLED;
+}
+
+static int ivnet_probe(struct pci_dev *pdev, const struct pci_device_id *id)
+{
+	resource_size_t shmem_addr, shmem_size;
+	struct net_device *netdev;
+	struct ivnet_dev *in;
+	u32 lo, hi, ivpos;
+	int err;
+
+	netdev = alloc_etherdev(sizeof(*in));
+	if (!netdev)
+		return -ENOMEM;
+
+	in = netdev_priv(netdev);
+	in->pdev = pdev;
+	in->netdev = netdev;
+	INIT_WORK(&in->features_work, ivnet_features_work);
+
+	err = pci_enable_device(pdev);
+	if (err)
+		goto err_free_netdev;
+
+	err = pci_request_regions(pdev, DRV_NAME);
+	if (err)
+		goto err_disable;
+
+	in->registers = pci_iomap(pdev, 0, 0);
+	if (!in->registers) {
+		err = -ENOMEM;
+		goto err_release;
+	}
+
+	ivpos = readl(in->registers + IVSHMEM_REG_IVPOS);
+	if (ivpos > 1) {
+		dev_err(&pdev->dev, "only links between two peers supported\n");
+		err = -ENODEV;
+		goto err_unmap_regs;
+	}
+	in->peer = 1 - ivpos;
+
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_PTR, &lo);
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_PTR + 4, &hi);
+	shmem_addr = ((u64)hi << 32) | lo;
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_SZ, &lo);
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_SZ + 4, &hi);
+	shmem_size = ((u64)hi << 32) | lo;
+
+	in->shmem = memremap(shmem_addr, shmem_size, MEMREMAP_WB);
+	if (!in->shmem) {
+		err = -ENOMEM;
+		goto err_unmap_regs;
+	}
+
+	in->half = shmem_size / 2;
+	in->tx_info = in->shmem + ivpos * in->half;
+	in->rx_info = in->shmem + in->peer * in->half;
+	err = ivnet_init_tx(in);
+	if (err) {
+		dev_err(&pdev->dev, "shared memory too small for queues\n");
+		goto err_unmap_shmem;
+	}
+
+	in->msix.entry = 0;
+	err = pci_enable_msix_range(pdev, &in->msix, 1, 1);
+	if (err < 0)
+		goto err_unmap_shmem;
+
+	SET_NETDEV_DEV(netdev, &pdev->dev);
+	netdev->netdev_ops = &ivnet_ops;
+	netdev->hw_features = NETIF_F_SG | NETIF_F_HW_CSUM | NETIF_F_TSO |
+		NETIF_F_TSO6 | NETIF_F_TSO_ECN;
+	netdev->features = netdev->hw_features;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
+	netdev->max_mtu = SLOT_PAYLOAD(&in->tx) - IVNET_HDR_LEN - ETH_HLEN -
+		VLAN_HLEN;
+#endif
+	ivnet_set_gso_max(netdev, SLOT_PAYLOAD(&in->tx) - IVNET_HDR_LEN);
+	eth_hw_addr_random(netdev);
+	ivnet_napi_add(netdev, &in->napi, ivnet_poll);
+	netif_carrier_off(netdev);
+
+	err = request_irq(in->msix.vector, ivnet_irq_handler, 0, DRV_NAME, in);
+	if (err)
+		goto err_napi_del;
+
+	pci_set_master(pdev);
+	pci_set_drvdata(pdev, in);
+
+	err = register_netdev(netdev);
+	if (err)
+		goto err_free_irq;
+
+	/* let a peer waiting for our queue attach to it */
+	ivnet_kick(in);
+
+	dev_info(&pdev->dev, "%s: %u slots of %u bytes\n", netdev->name,
+		 in->tx.num_slots, in->tx.slot_size);
+	return 0;
+
+err_free_irq:
+	free_irq(in->msix.vector, in);
+err_napi_del:
+	netif_napi_del(&in->napi);
+	pci_disable_msix(pdev);
+err_unmap_shmem:
+	memunmap(in->shmem);
+err_unmap_regs:
+	pci_iounmap(pdev, in->registers);
+err_release:
+	pci_release_regions(pdev);
+err_disable:
+	pci_disable_device(pdev);
+err_free_netdev:
+	free_netdev(netdev);
+	return err;
+}
+
+static void ivnet_remove(struct pci_dev *pdev)
+{
+	struct ivnet_dev *in = pci_get_drvdata(pdev);
+
+	in->tx_info->magic = 0;
+	ivnet_kick(in);
+
+	unregister_netdev(in->netdev);
+	free_irq(in->msix.vector, in);
+	cancel_work_sync(&in->features_work);
+	netif_napi_del(&in->napi);
+	pci_disable_msix(pdev);
+	memunmap(in->shmem);
+	pci_iounmap(pdev, in->registers);
+	pci_release_regions(pdev);
+	pci_disable_device(pdev);
+	free_netdev(in->netdev);
+}
+
+static const struct pci_device_id ivnet_ids[] = {
+	{
+		PCI_DEVICE(0x1af4, 0x1110),
+		.class = (PCI_CLASS_OTHERS << 16) | JAILHOUSE_SHMEM_PROTO_VETH,
+		.class_mask = 0xffffff,
+	},
+	{ 0 }
+};
+MODULE_DEVICE_TABLE(pci, ivnet_ids);
+
+static struct pci_driver ivnet_driver = {
+	.name		= DRV_NAME,
+	.id_table	= ivnet_ids,
+	.probe		= ivnet_probe,
+	.remove		= ivnet_remove,
+};
+
+module_pci_driver(ivnet_driver);
+
+MODULE_DESCRIPTION("Virtual Ethernet on Jailhouse ivshmem devices");
+MODULE_LICENSE("GPL");
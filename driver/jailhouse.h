@@ -70,13 +70,94 @@ struct jailhouse_cell_load {
 	struct jailhouse_preload_image image[];
 };
 
+#define JAILHOUSE_PRELOAD_GZIP		0x00000001
+
+struct jailhouse_preload_file {
+	__s32 fd;
+	__u32 flags;
+	__u64 offset;
+	__u64 size;
+	__u64 target_address;
+};
+
+struct jailhouse_cell_load_fd {
+	struct jailhouse_cell_id cell_id;
+	__u32 num_preload_files;
+	__u32 padding;
+	struct jailhouse_preload_file file[];
+};
+
 #define JAILHOUSE_CELL_ID_UNUSED	(-1)
 
+struct jailhouse_cell_start_multi {
+	__u32 num_cells;
+	__u32 padding;
+	struct jailhouse_cell_id cell_id[];
+};
+
+struct jailhouse_cell_cache {
+	struct jailhouse_cell_id cell_id;
+	__u32 start;
+	__u32 size;
+};
+
+struct jailhouse_cell_cpu {
+	struct jailhouse_cell_id cell_id;
+	__u32 cpu;
+	__u32 padding;
+};
+
+struct jailhouse_cell_memory {
+	struct jailhouse_cell_id cell_id;
+	/* index of the hot-pluggable region in the cell configuration */
+	__u32 region;
+	__u32 padding;
+};
+
+#define JAILHOUSE_SNAPSHOT_MAX_CPUS	256
+#define JAILHOUSE_SNAPSHOT_MAX_STATS	64
+
+/* state of a single cell as returned by JAILHOUSE_SNAPSHOT */
+struct jailhouse_cell_snapshot {
+	__s32 id;
+	__u32 state;
+	char name[JAILHOUSE_CELL_ID_NAMELEN + 1];
+	__u64 cpus_assigned[JAILHOUSE_SNAPSHOT_MAX_CPUS / 64];
+	__u64 cpus_failed[JAILHOUSE_SNAPSHOT_MAX_CPUS / 64];
+	/* indexed by JAILHOUSE_CPU_STAT_*, summed up over all cell CPUs */
+	__u64 stats[JAILHOUSE_SNAPSHOT_MAX_STATS];
+};
+
+struct jailhouse_snapshot {
+	__u64 cells_address;
+	__u32 max_cells;
+	__u32 num_cells;
+	__u32 num_stats;
+	__u32 padding;
+};
+
+#define JAILHOUSE_STATS_NAMELEN		23
+
+/* record format of the statistics_raw sysfs attribute of a cell */
+struct jailhouse_stats_entry {
+	char name[JAILHOUSE_STATS_NAMELEN + 1];
+	__u64 value;
+};
+
 #define JAILHOUSE_ENABLE		_IOW(0, 0, void *)
 #define JAILHOUSE_DISABLE		_IO(0, 1)
 #define JAILHOUSE_CELL_CREATE		_IOW(0, 2, struct jailhouse_cell_create)
 #define JAILHOUSE_CELL_LOAD		_IOW(0, 3, struct jailhouse_cell_load)
 #define JAILHOUSE_CELL_START		_IOW(0, 4, struct jailhouse_cell_id)
 #define JAILHOUSE_CELL_DESTROY		_IOW(0, 5, struct jailhouse_cell_id)
+#define JAILHOUSE_CELL_SET_CACHE	_IOW(0, 6, struct jailhouse_cell_cache)
+#define JAILHOUSE_CELL_START_MULTI	_IOW(0, 7, \
+					     struct jailhouse_cell_start_multi)
+#define JAILHOUSE_CELL_ADD_CPU		_IOW(0, 8, struct jailhouse_cell_cpu)
+#define JAILHOUSE_CELL_REMOVE_CPU	_IOW(0, 9, struct jailhouse_cell_cpu)
+#define JAILHOUSE_CELL_LOAD_FD		_IOW(0, 10, struct jailhouse_cell_load_fd)
+#define JAILHOUSE_SNAPSHOT		_IOWR(0, 11, struct jailhouse_snapshot)
+#define JAILHOUSE_CELL_ADD_MEMORY	_IOW(0, 12, struct jailhouse_cell_memory)
+#define JAILHOUSE_CELL_REMOVE_MEMORY	_IOW(0, 13, struct jailhouse_cell_memory)
 
 #endif /* !_JAILHOUSE_DRIVER_H */
@@ -24,15 +24,19 @@
 #include <linux/reboot.h>
 #include <linux/vmalloc.h>
 #include <linux/io.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 #include <asm/smp.h>
 #include <asm/cacheflush.h>
 #include <asm/tlbflush.h>
 
 #include "cell.h"
+#include "events.h"
 #include "jailhouse.h"
 #include "main.h"
 #include "pci.h"
 #include "sysfs.h"
+#include "trace.h"
 
 #include <jailhouse/header.h>
 #include <jailhouse/hypercall.h>
@@ -68,13 +72,26 @@ MODULE_VERSION(JAILHOUSE_VERSION);
 
 DEFINE_MUTEX(jailhouse_lock);
 bool jailhouse_enabled;
+struct jailhouse_enable_timing jailhouse_enable_timing;
 
 static struct device *jailhouse_dev;
+/*
+ * The verified hypervisor image and the mapping of its memory are kept
+ * across disable so that re-enabling only has to copy and start it.
+ */
+static const struct firmware *hypervisor_fw;
 static void *hypervisor_mem;
+static phys_addr_t hypervisor_mem_phys;
+static unsigned long hypervisor_mem_size;
 static unsigned long hv_core_and_percpu_size;
 static atomic_t call_done;
 static int error_code;
 
+static struct jailhouse_console_reader hv_console;
+
+static void jailhouse_console_poll(struct work_struct *work);
+static DECLARE_DELAYED_WORK(console_work, jailhouse_console_poll);
+
 #ifdef CONFIG_X86
 bool jailhouse_use_vmcall;
 
@@ -174,22 +191,117 @@ static inline const char * jailhouse_fw_name(void)
 #endif
 }
 
+static const struct firmware *get_hypervisor_fw(void)
+{
+	const struct jailhouse_header *header;
+	const struct firmware *fw;
+	const char *fw_name;
+	int err;
+
+	if (hypervisor_fw)
+		return hypervisor_fw;
+
+	fw_name = jailhouse_fw_name();
+	err = request_firmware(&fw, fw_name, jailhouse_dev);
+	if (err) {
+		pr_err("jailhouse: Missing hypervisor image %s\n", fw_name);
+		return ERR_PTR(err);
+	}
+
+	header = (const struct jailhouse_header *)fw->data;
+	if (fw->size < sizeof(*header) ||
+	    memcmp(header->signature, JAILHOUSE_SIGNATURE,
+		   sizeof(header->signature)) != 0) {
+		release_firmware(fw);
+		return ERR_PTR(-EINVAL);
+	}
+
+	hypervisor_fw = fw;
+	return fw;
+}
+
+static void *map_hypervisor_mem(const struct jailhouse_memory *hv_mem)
+{
+	unsigned long remap_addr = 0;
+
+	if (hypervisor_mem && hypervisor_mem_phys == hv_mem->phys_start &&
+	    hypervisor_mem_size == hv_mem->size)
+		return hypervisor_mem;
+
+	if (hypervisor_mem)
+		vunmap(hypervisor_mem);
+
+#ifdef JAILHOUSE_BORROW_ROOT_PT
+	remap_addr = JAILHOUSE_BASE;
+#endif
+	hypervisor_mem = jailhouse_ioremap(hv_mem->phys_start, remap_addr,
+					   hv_mem->size);
+	if (hypervisor_mem) {
+		hypervisor_mem_phys = hv_mem->phys_start;
+		hypervisor_mem_size = hv_mem->size;
+	}
+	return hypervisor_mem;
+}
+
+static void console_flush_line(struct jailhouse_console_reader *reader)
+{
+	reader->line[reader->line_len] = 0;
+	if (reader->cell_name)
+		pr_info("jailhouse: %s: %s\n", reader->cell_name, reader->line);
+	else
+		pr_info("jailhouse: %s\n", reader->line);
+	reader->line_len = 0;
+}
+
+/* Moves new ring content line by line into the kernel log. */
+void jailhouse_console_drain(struct jailhouse_console_reader *reader)
+{
+	struct jailhouse_console *ring = reader->ring;
+	unsigned int tail = ring->tail;
+	char c;
+
+	/* pairs with the store barrier of the console writer */
+	smp_rmb();
+
+	if (tail - reader->next > sizeof(ring->content)) {
+		pr_warn("jailhouse: %s console overrun, %u characters lost\n",
+			reader->cell_name ? reader->cell_name : "hypervisor",
+			tail - reader->next - (u32)sizeof(ring->content));
+		reader->next = tail - sizeof(ring->content);
+	}
+
+	while (reader->next != tail) {
+		c = ring->content[reader->next++ % sizeof(ring->content)];
+		if (c == '\n')
+			console_flush_line(reader);
+		else if (c != '\r')
+			reader->line[reader->line_len++] = c;
+		if (reader->line_len == sizeof(reader->line) - 1)
+			console_flush_line(reader);
+	}
+}
+
+static void jailhouse_console_poll(struct work_struct *work)
+{
+	jailhouse_console_drain(&hv_console);
+	schedule_delayed_work(&console_work, CONSOLE_POLL_INTERVAL);
+}
+
 static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 {
-	const struct firmware *hypervisor;
 	struct jailhouse_system config_header;
-	struct jailhouse_system *config;
 	struct jailhouse_memory *hv_mem = &config_header.hypervisor_memory;
+	struct jailhouse_enable_timing timing;
+	const struct firmware *hypervisor;
+	struct jailhouse_system *config;
 	struct jailhouse_header *header;
-	unsigned long remap_addr = 0;
+	ktime_t start, phase_start, now;
 	void __iomem *console = NULL;
 	unsigned long config_size;
-	const char *fw_name;
 	long max_cpus;
 	int err;
 
-	fw_name = jailhouse_fw_name();
-	if (!fw_name) {
+	if (!jailhouse_fw_name()) {
 		pr_err("jailhouse: Missing or unsupported HVM technology\n");
 		return -ENODEV;
 	}
@@ -218,38 +330,41 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 	if (jailhouse_enabled || !try_module_get(THIS_MODULE))
 		goto error_unlock;
 
-	err = request_firmware(&hypervisor, fw_name, jailhouse_dev);
-	if (err) {
-		pr_err("jailhouse: Missing hypervisor image %s\n", fw_name);
+	start = phase_start = ktime_get();
+
+	hypervisor = get_hypervisor_fw();
+	if (IS_ERR(hypervisor)) {
+		err = PTR_ERR(hypervisor);
 		goto error_put_module;
 	}
 
 	header = (struct jailhouse_header *)hypervisor->data;
 
 	err = -EINVAL;
-	if (memcmp(header->signature, JAILHOUSE_SIGNATURE,
-		   sizeof(header->signature)) != 0 ||
-	    hypervisor->size >= hv_mem->size)
-		goto error_release_fw;
+	if (hypervisor->size >= hv_mem->size)
+		goto error_put_module;
 
 	hv_core_and_percpu_size = header->core_size +
 		max_cpus * header->percpu_size;
 	config_size = jailhouse_system_config_size(&config_header);
 	if (hv_core_and_percpu_size >= hv_mem->size ||
 	    config_size >= hv_mem->size - hv_core_and_percpu_size)
-		goto error_release_fw;
+		goto error_put_module;
 
-#ifdef JAILHOUSE_BORROW_ROOT_PT
-	remap_addr = JAILHOUSE_BASE;
-#endif
-	hypervisor_mem = jailhouse_ioremap(hv_mem->phys_start, remap_addr,
-					   hv_mem->size);
-	if (!hypervisor_mem) {
+	now = ktime_get();
+	timing.firmware = ktime_us_delta(now, phase_start);
+	phase_start = now;
+
+	if (!map_hypervisor_mem(hv_mem)) {
 		pr_err("jailhouse: Unable to map RAM reserved for hypervisor "
 		       "at %08lx\n", (unsigned long)hv_mem->phys_start);
-		goto error_release_fw;
+		goto error_put_module;
 	}
 
+	now = ktime_get();
+	timing.map = ktime_us_delta(now, phase_start);
+	phase_start = now;
+
 	memcpy(hypervisor_mem, hypervisor->data, hypervisor->size);
 	memset(hypervisor_mem + hypervisor->size, 0,
 	       hv_mem->size - hypervisor->size);
@@ -270,7 +385,7 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 		(hypervisor_mem + hv_core_and_percpu_size);
 	if (copy_from_user(config, arg, config_size)) {
 		err = -EFAULT;
-		goto error_unmap;
+		goto error_put_module;
 	}
 
 	if (config->debug_console.flags & JAILHOUSE_MEM_IO) {
@@ -282,7 +397,7 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 			pr_err("jailhouse: Unable to map hypervisor debug "
 			       "console at %08lx\n",
 			       (unsigned long)config->debug_console.phys_start);
-			goto error_unmap;
+			goto error_put_module;
 		}
 		/* The hypervisor has no notion of address spaces, so we need
 		 * to enforce conversion. */
@@ -293,9 +408,17 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 #endif
 	}
 
+	now = ktime_get();
+	timing.copy = ktime_us_delta(now, phase_start);
+	phase_start = now;
+
 	err = jailhouse_cell_prepare_root(&config->root_cell);
 	if (err)
-		goto error_unmap;
+		goto error_unmap_console;
+
+	now = ktime_get();
+	timing.root_cell = ktime_us_delta(now, phase_start);
+	phase_start = now;
 
 	error_code = 0;
 
@@ -315,13 +438,32 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 		goto error_free_cell;
 	}
 
+	now = ktime_get();
+	timing.entry = ktime_us_delta(now, phase_start);
+	timing.total = ktime_us_delta(now, start);
+	jailhouse_enable_timing = timing;
+
 	if (console)
 		iounmap(console);
 
-	release_firmware(hypervisor);
+	jailhouse_events_start(hypervisor_mem + header->events_offset);
 
 	jailhouse_cell_register_root();
 
+	jailhouse_trace_map();
+
+	/*
+	 * In deferred mode, the hypervisor only writes its output into the
+	 * console ring which we drain into the kernel log.
+	 */
+	if (config->debug_console.flags & JAILHOUSE_CON_DEFERRED) {
+		hv_console.ring = hypervisor_mem + header->console_offset;
+		hv_console.next = 0;
+		hv_console.line_len = 0;
+		jailhouse_console_drain(&hv_console);
+		schedule_delayed_work(&console_work, CONSOLE_POLL_INTERVAL);
+	}
+
 	jailhouse_enabled = true;
 
 	mutex_unlock(&jailhouse_lock);
@@ -333,14 +475,10 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 error_free_cell:
 	jailhouse_cell_delete_root();
 
-error_unmap:
-	vunmap(hypervisor_mem);
+error_unmap_console:
 	if (console)
 		iounmap(console);
 
-error_release_fw:
-	release_firmware(hypervisor);
-
 error_put_module:
 	module_put(THIS_MODULE);
 
@@ -389,6 +527,9 @@ static int jailhouse_cmd_disable(void)
 
 	error_code = 0;
 
+	if (hv_console.ring)
+		cancel_delayed_work_sync(&console_work);
+
 	preempt_disable();
 
 	if (num_online_cpus() != cpumask_weight(&root_cell->cpus_assigned)) {
@@ -400,7 +541,7 @@ static int jailhouse_cmd_disable(void)
 		preempt_enable();
 
 		err = -EBUSY;
-		goto unlock_out;
+		goto resume_console;
 	}
 
 	atomic_set(&call_done, 0);
@@ -412,16 +553,26 @@ static int jailhouse_cmd_disable(void)
 
 	err = error_code;
 	if (err)
-		goto unlock_out;
+		goto resume_console;
 
-	vunmap(hypervisor_mem);
+	if (hv_console.ring) {
+		/* catch the final messages of the hypervisor */
+		jailhouse_console_drain(&hv_console);
+		hv_console.ring = NULL;
+	}
 
+	jailhouse_trace_unmap();
 	jailhouse_cell_delete_all();
+	jailhouse_events_stop();
 	jailhouse_enabled = false;
 	module_put(THIS_MODULE);
 
 	pr_info("The Jailhouse was closed.\n");
 
+resume_console:
+	if (hv_console.ring)
+		schedule_delayed_work(&console_work, CONSOLE_POLL_INTERVAL);
+
 unlock_out:
 	mutex_unlock(&jailhouse_lock);
 
@@ -446,15 +597,45 @@ static long jailhouse_ioctl(struct file *file, unsigned int ioctl,
 			(struct jailhouse_cell_create __user *)arg);
 		break;
 	case JAILHOUSE_CELL_LOAD:
-		err = jailhouse_cmd_cell_load(
+		err = jailhouse_cmd_cell_load(file,
 			(struct jailhouse_cell_load __user *)arg);
 		break;
+	case JAILHOUSE_CELL_LOAD_FD:
+		err = jailhouse_cmd_cell_load_fd(file,
+			(struct jailhouse_cell_load_fd __user *)arg);
+		break;
 	case JAILHOUSE_CELL_START:
 		err = jailhouse_cmd_cell_start((const char __user *)arg);
 		break;
 	case JAILHOUSE_CELL_DESTROY:
 		err = jailhouse_cmd_cell_destroy((const char __user *)arg);
 		break;
+	case JAILHOUSE_CELL_SET_CACHE:
+		err = jailhouse_cmd_cell_set_cache(
+			(struct jailhouse_cell_cache __user *)arg);
+		break;
+	case JAILHOUSE_CELL_ADD_CPU:
+		err = jailhouse_cmd_cell_add_cpu(
+			(struct jailhouse_cell_cpu __user *)arg);
+		break;
+	case JAILHOUSE_CELL_REMOVE_CPU:
+		err = jailhouse_cmd_cell_remove_cpu(
+			(struct jailhouse_cell_cpu __user *)arg);
+		break;
+	case JAILHOUSE_CELL_ADD_MEMORY:
+	case JAILHOUSE_CELL_REMOVE_MEMORY:
+		err = jailhouse_cmd_cell_set_memory(
+			(struct jailhouse_cell_memory __user *)arg,
+			ioctl == JAILHOUSE_CELL_ADD_MEMORY);
+		break;
+	case JAILHOUSE_SNAPSHOT:
+		err = jailhouse_cmd_snapshot(
+			(struct jailhouse_snapshot __user *)arg);
+		break;
+	case JAILHOUSE_CELL_START_MULTI:
+		err = jailhouse_cmd_cell_start_multi(
+			(struct jailhouse_cell_start_multi __user *)arg);
+		break;
 	default:
 		err = -EINVAL;
 		break;
@@ -463,10 +644,26 @@ static long jailhouse_ioctl(struct file *file, unsigned int ioctl,
 	return err;
 }
 
+static int jailhouse_open(struct inode *inode, struct file *file)
+{
+	/* set to the cell that was last loaded via this file */
+	file->private_data = NULL;
+	return 0;
+}
+
+static int jailhouse_release(struct inode *inode, struct file *file)
+{
+	jailhouse_cell_release_file(file);
+	return 0;
+}
+
 static const struct file_operations jailhouse_fops = {
 	.owner = THIS_MODULE,
+	.open = jailhouse_open,
+	.release = jailhouse_release,
 	.unlocked_ioctl = jailhouse_ioctl,
 	.compat_ioctl = jailhouse_ioctl,
+	.mmap = jailhouse_cell_mmap,
 	.llseek = noop_llseek,
 };
 
@@ -512,11 +709,25 @@ static int __init jailhouse_init(void)
 	if (err)
 		goto exit_misc;
 
+	err = jailhouse_trace_init();
+	if (err)
+		goto exit_pci;
+
+	err = jailhouse_events_init(jailhouse_dev);
+	if (err)
+		goto exit_trace;
+
 	register_reboot_notifier(&jailhouse_shutdown_nb);
 
 	init_hypercall();
 
 	return 0;
+exit_trace:
+	jailhouse_trace_exit();
+
+exit_pci:
+	jailhouse_pci_unregister();
+
 exit_misc:
 	misc_deregister(&jailhouse_misc_dev);
 
@@ -534,7 +745,12 @@ static void __exit jailhouse_exit(void)
 	misc_deregister(&jailhouse_misc_dev);
 	jailhouse_sysfs_exit(jailhouse_dev);
 	jailhouse_pci_unregister();
+	jailhouse_events_exit();
+	jailhouse_trace_exit();
 	root_device_unregister(jailhouse_dev);
+	if (hypervisor_mem)
+		vunmap(hypervisor_mem);
+	release_firmware(hypervisor_fw);
 }
 
 module_init(jailhouse_init);
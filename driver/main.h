@@ -17,10 +17,37 @@
 
 #include "cell.h"
 
+/* Duration of the phases of the last successful enable, in microseconds */
+struct jailhouse_enable_timing {
+	s64 firmware;
+	s64 map;
+	s64 copy;
+	s64 root_cell;
+	s64 entry;
+	s64 total;
+};
+
+#define CONSOLE_POLL_INTERVAL	(HZ / 10)
+/* sampling of the event page without an event device */
+#define STATE_POLL_INTERVAL	max(HZ / 100, 1)
+#define CONSOLE_LINE_MAX	128
+
+/* State of draining a console ring into the kernel log */
+struct jailhouse_console_reader {
+	struct jailhouse_console *ring;
+	/* NULL for the hypervisor console */
+	const char *cell_name;
+	unsigned int next;
+	char line[CONSOLE_LINE_MAX];
+	unsigned int line_len;
+};
+
 extern struct mutex jailhouse_lock;
 extern bool jailhouse_enabled;
+extern struct jailhouse_enable_timing jailhouse_enable_timing;
 
 void *jailhouse_ioremap(phys_addr_t phys, unsigned long virt,
 			unsigned long size);
+void jailhouse_console_drain(struct jailhouse_console_reader *reader);
 
 #endif /* !_JAILHOUSE_DRIVER_MAIN_H */
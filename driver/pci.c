@@ -12,6 +12,8 @@
  */
 
 #include <linux/pci.h>
+#include <linux/slab.h>
+#include <linux/version.h>
 #include <linux/vmalloc.h>
 
 #include "pci.h"
@@ -37,10 +39,12 @@ static int jailhouse_pci_stub_probe(struct pci_dev *dev,
  * assigned devices.
  * @see jailhouse_pci_claim_release
  *
- * When releasing devices they will not be bound to any driver anymore and
- * from Linuxs point of view the jailhouse dummy will still look like a
- * valid driver. Assignment back to the original driver has to be done
- * manually.
+ * Devices are bound via their driver_override, so only the claimed
+ * functions match the dummy driver, and probing is limited to them. This
+ * matters for SR-IOV devices whose VFs all share the same IDs. When released,
+ * the override is cleared and the device is probed again, giving it back to
+ * the driver Linux selects for it. Kernels without driver_override support
+ * fall back to dynamic IDs. Released devices then remain unbound.
  */
 static struct pci_driver jailhouse_pci_stub_driver = {
 	.name		= "jailhouse-pci-stub",
@@ -48,6 +52,7 @@ static struct pci_driver jailhouse_pci_stub_driver = {
 	.probe		= jailhouse_pci_stub_probe,
 };
 
+/* called with the PCI rescan/remove lock held */
 static void jailhouse_pci_add_device(const struct jailhouse_pci_device *dev)
 {
 	int num;
@@ -57,23 +62,91 @@ static void jailhouse_pci_add_device(const struct jailhouse_pci_device *dev)
 	if (bus) {
 		num = pci_scan_slot(bus, dev->bdf & 0xff);
 		if (num) {
-			pci_lock_rescan_remove();
 			pci_bus_assign_resources(bus);
 			pci_bus_add_devices(bus);
-			pci_unlock_rescan_remove();
 		}
 	}
 }
 
+/* called with the PCI rescan/remove lock held */
 static void jailhouse_pci_remove_device(const struct jailhouse_pci_device *dev)
 {
 	struct pci_dev *l_dev;
 
 	l_dev = pci_get_bus_and_slot(PCI_BUS_NUM(dev->bdf), dev->bdf & 0xff);
 	if (l_dev)
-		pci_stop_and_remove_bus_device_locked(l_dev);
+		pci_stop_and_remove_bus_device(l_dev);
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,16,0)
+static int jailhouse_pci_set_override(struct pci_dev *l_dev, bool claim)
+{
+	const char *name = jailhouse_pci_stub_driver.name;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,19,0)
+	return driver_set_override(&l_dev->dev, &l_dev->driver_override,
+				   name, claim ? strlen(name) : 0);
+#else
+	char *override = NULL;
+
+	if (claim) {
+		override = kstrdup(name, GFP_KERNEL);
+		if (!override)
+			return -ENOMEM;
+	}
+	device_lock(&l_dev->dev);
+	kfree(l_dev->driver_override);
+	l_dev->driver_override = override;
+	device_unlock(&l_dev->dev);
+	return 0;
+#endif
+}
+
+static int jailhouse_pci_claim(struct pci_dev *l_dev)
+{
+	int err;
+
+	err = jailhouse_pci_set_override(l_dev, true);
+	if (err)
+		return err;
+
+	device_release_driver(&l_dev->dev);
+	err = device_attach(&l_dev->dev);
+	return err < 0 ? err : 0;
+}
+
+static void jailhouse_pci_release(struct pci_dev *l_dev)
+{
+	int err;
+
+	jailhouse_pci_set_override(l_dev, false);
+	device_release_driver(&l_dev->dev);
+
+	/* hand the device back to its regular driver, if there is one */
+	err = device_attach(&l_dev->dev);
+	if (err < 0)
+		dev_warn(&l_dev->dev, "failed to reprobe device (%d)\n", err);
+}
+#else /* < 3.16 */
+static int jailhouse_pci_claim(struct pci_dev *l_dev)
+{
+	device_release_driver(&l_dev->dev);
+	return pci_add_dynid(&jailhouse_pci_stub_driver, l_dev->vendor,
+			     l_dev->device, l_dev->subsystem_vendor,
+			     l_dev->subsystem_device, l_dev->class, 0, 0);
+}
+
+static void jailhouse_pci_release(struct pci_dev *l_dev)
+{
+	device_release_driver(&l_dev->dev);
+}
+#endif /* < 3.16 */
+
+/*
+ * Not called under the PCI rescan/remove lock: driver remove and probe
+ * callbacks may take it themselves, e.g. when disabling SR-IOV. The device
+ * reference keeps l_dev valid.
+ */
 static void jailhouse_pci_claim_release(const struct jailhouse_pci_device *dev,
 					unsigned int action)
 {
@@ -91,22 +164,20 @@ static void jailhouse_pci_claim_release(const struct jailhouse_pci_device *dev,
 	drv = l_dev->dev.driver;
 
 	if (action == JAILHOUSE_PCI_ACTION_CLAIM) {
-		if (drv == &jailhouse_pci_stub_driver.driver)
-			return;
-		device_release_driver(&l_dev->dev);
-		err = pci_add_dynid(&jailhouse_pci_stub_driver, l_dev->vendor,
-				    l_dev->device, l_dev->subsystem_vendor,
-				    l_dev->subsystem_device, l_dev->class,
-				    0, 0);
-		if (err)
-			dev_warn(&l_dev->dev, "failed to add dynamic id (%d)\n",
-			         err);
+		if (drv != &jailhouse_pci_stub_driver.driver) {
+			err = jailhouse_pci_claim(l_dev);
+			if (err)
+				dev_warn(&l_dev->dev,
+					 "failed to claim device (%d)\n", err);
+		}
 	} else {
 		/* on "jailhouse disable" we will come here with the
 		 * request to release all pci devices, so check the driver */
 		if (drv == &jailhouse_pci_stub_driver.driver)
-			device_release_driver(&l_dev->dev);
+			jailhouse_pci_release(l_dev);
 	}
+
+	pci_dev_put(l_dev);
 }
 
 /**
@@ -129,7 +200,8 @@ void jailhouse_pci_unregister(void)
 
 /**
  * Apply the given action to all of the cells PCI devices matching the given
- * type.
+ * type. Adding and removing is done for all devices in a single PCI
+ * rescan/remove section.
  * @param cell		the cell containing the PCI devices
  * @param type		PCI device type (JAILHOUSE_PCI_TYPE_*)
  * @param action	action (JAILHOUSE_PCI_ACTION_*)
@@ -137,9 +209,14 @@ void jailhouse_pci_unregister(void)
 void jailhouse_pci_do_all_devices(struct cell *cell, unsigned int type,
 				  unsigned int action)
 {
+	bool rescan = action == JAILHOUSE_PCI_ACTION_ADD ||
+		action == JAILHOUSE_PCI_ACTION_DEL;
 	unsigned int n;
 	const struct jailhouse_pci_device *dev;
 
+	if (rescan)
+		pci_lock_rescan_remove();
+
 	dev = cell->pci_devices;
 	for (n = cell->num_pci_devices; n > 0; n--) {
 		if (dev->type == type) {
@@ -156,6 +233,9 @@ void jailhouse_pci_do_all_devices(struct cell *cell, unsigned int type,
 		}
 		dev++;
 	}
+
+	if (rescan)
+		pci_unlock_rescan_remove();
 }
 
 int jailhouse_pci_cell_setup(struct cell *cell,
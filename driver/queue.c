@@ -0,0 +1,499 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/*
+ * Message queue device on top of a Jailhouse ivshmem link between two cells.
+ * The shared memory is split into two halves, one queue per direction. The
+ * endpoint with IVPosition 0 produces into the lower half. Each write() to
+ * /dev/jailhouse-queue<n> sends one message, each read() receives one.
+ * The queue layout is shared with the inmate library, see
+ * jailhouse/queue.h.
+ */
+
+#include <linux/fs.h>
+#include <linux/idr.h>
+#include <linux/interrupt.h>
+#include <linux/io.h>
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/pci.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+
+#include <jailhouse/queue.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,3,0)
+#define memremap(offset, size, flags)	ioremap_cache(offset, size)
+#define memunmap(addr)			iounmap((void __iomem *)addr)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,6,0)
+#define virt_mb()			mb()
+#define virt_rmb()			rmb()
+#define virt_wmb()			wmb()
+#endif
+
+#define DRV_NAME			"jailhouse-queue"
+
+#define IVSHMEM_CFG_SHMEM_PTR		0x40
+#define IVSHMEM_CFG_SHMEM_SZ		0x48
+
+#define IVSHMEM_REG_IVPOS		8
+#define IVSHMEM_REG_DBELL		12
+
+#define SLOT_PAYLOAD(q)			((q)->slot_size - \
+					 sizeof(struct jailhouse_queue_slot))
+
+struct queue_state {
+	struct jailhouse_queue *queue;
+	u32 num_slots;
+	u32 slot_size;
+	/* local copy of head (tx) or tail (rx) */
+	u32 idx;
+	/* value of idx when the peer was last checked for notification */
+	u32 notified_idx;
+};
+
+struct jailhouse_queue_dev {
+	struct pci_dev *pdev;
+	void __iomem *registers;
+	void *shmem;
+	u32 peer;
+	int id;
+	struct msix_entry msix;
+	struct miscdevice misc;
+	char name[24];
+	wait_queue_head_t wait;
+	struct mutex tx_lock;
+	struct queue_state tx;
+	struct mutex rx_lock;
+	struct queue_state rx;
+	void *rx_mem;
+	unsigned long rx_size;
+	bool rx_attached;
+};
+
+static unsigned int slot_size = 256;
+module_param(slot_size, uint, 0444);
+MODULE_PARM_DESC(slot_size, "Size of the transmit queue slots in bytes");
+
+static DEFINE_IDA(queue_ida);
+
+static void queue_kick(struct jailhouse_queue_dev *qdev)
+{
+	writel(qdev->peer << 16, qdev->registers + IVSHMEM_REG_DBELL);
+}
+
+static int queue_init_tx(struct queue_state *q, void *mem, unsigned long size)
+{
+	struct jailhouse_queue *queue = mem;
+
+	if (slot_size < JAILHOUSE_QUEUE_MIN_SLOT_SIZE || slot_size % 8)
+		return -EINVAL;
+	q->num_slots = jailhouse_queue_slots(size, slot_size);
+	if (q->num_slots == 0)
+		return -EINVAL;
+
+	queue->magic = 0;
+	virt_wmb();
+
+	queue->num_slots = q->num_slots;
+	queue->slot_size = slot_size;
+	q->idx = queue->cons.tail;
+	queue->prod.head = q->idx;
+	queue->prod.space_event = q->idx - 1;
+
+	virt_wmb();
+	queue->magic = JAILHOUSE_QUEUE_MAGIC;
+
+	q->queue = queue;
+	q->slot_size = slot_size;
+	q->notified_idx = q->idx;
+	return 0;
+}
+
+static bool queue_attach_rx(struct jailhouse_queue_dev *qdev)
+{
+	struct jailhouse_queue *queue = qdev->rx_mem;
+	struct queue_state *q = &qdev->rx;
+
+	if (qdev->rx_attached)
+		return true;
+
+	if (queue->magic != JAILHOUSE_QUEUE_MAGIC)
+		return false;
+	virt_rmb();
+
+	q->num_slots = queue->num_slots;
+	q->slot_size = queue->slot_size;
+	if (q->num_slots == 0 || !is_power_of_2(q->num_slots) ||
+	    q->slot_size < JAILHOUSE_QUEUE_MIN_SLOT_SIZE || q->slot_size % 8 ||
+	    q->num_slots > (qdev->rx_size - sizeof(struct jailhouse_queue)) /
+			   q->slot_size) {
+		dev_err_once(&qdev->pdev->dev, "invalid receive queue\n");
+		return false;
+	}
+
+	q->idx = queue->prod.head;
+	queue->cons.tail = q->idx;
+	queue->cons.data_event = q->idx - 1;
+
+	q->queue = queue;
+	q->notified_idx = q->idx;
+	qdev->rx_attached = true;
+	return true;
+}
+
+static bool queue_tx_full(struct queue_state *q)
+{
+	return q->idx - q->queue->cons.tail >= q->num_slots;
+}
+
+static bool queue_rx_empty(struct queue_state *q)
+{
+	return q->queue->prod.head == q->idx;
+}
+
+static struct jailhouse_queue_slot *queue_slot(struct queue_state *q)
+{
+	return jailhouse_queue_slot(q->queue, q->num_slots, q->slot_size,
+				    q->idx);
+}
+
+/* returns true if the caller can wait, false if the queue changed meanwhile */
+static bool queue_prepare_wait_tx(struct queue_state *q)
+{
+	q->queue->prod.space_event = q->queue->cons.tail;
+	virt_mb();
+	return queue_tx_full(q);
+}
+
+static bool queue_prepare_wait_rx(struct queue_state *q)
+{
+	q->queue->cons.data_event = q->idx;
+	virt_mb();
+	return queue_rx_empty(q);
+}
+
+static bool queue_kick_needed(struct queue_state *q, volatile u32 *event)
+{
+	u32 old_idx = q->notified_idx;
+
+	/* publish our index before looking at the peer's event */
+	virt_mb();
+	q->notified_idx = q->idx;
+
+	return jailhouse_queue_need_event(*event, q->idx, old_idx);
+}
+
+static bool queue_rx_ready(struct jailhouse_queue_dev *qdev)
+{
+	struct jailhouse_queue *queue = qdev->rx_mem;
+
+	if (!qdev->rx_attached)
+		return queue->magic == JAILHOUSE_QUEUE_MAGIC;
+	return !queue_rx_empty(&qdev->rx);
+}
+
+static ssize_t queue_read(struct file *file, char __user *buf, size_t count,
+			  loff_t *ppos)
+{
+	struct jailhouse_queue_dev *qdev =
+		container_of(file->private_data, struct jailhouse_queue_dev,
+			     misc);
+	struct queue_state *q = &qdev->rx;
+	struct jailhouse_queue_slot *slot;
+	ssize_t len;
+	int err;
+
+	if (mutex_lock_interruptible(&qdev->rx_lock))
+		return -EINTR;
+
+	while (!queue_attach_rx(qdev) || queue_rx_empty(q)) {
+		if (file->f_flags & O_NONBLOCK) {
+			len = -EAGAIN;
+			goto out;
+		}
+		if (qdev->rx_attached && !queue_prepare_wait_rx(q))
+			continue;
+
+		mutex_unlock(&qdev->rx_lock);
+		err = wait_event_interruptible(qdev->wait,
+					       queue_rx_ready(qdev));
+		if (err)
+			return err;
+		if (mutex_lock_interruptible(&qdev->rx_lock))
+			return -EINTR;
+	}
+	virt_rmb();
+
+	slot = queue_slot(q);
+	len = min_t(size_t, slot->len, SLOT_PAYLOAD(q));
+	len = min_t(size_t, len, count);
+	if (copy_to_user(buf, slot->data, len)) {
+		len = -EFAULT;
+		goto out;
+	}
+
+	/* finish reading the slot before handing it back */
+	virt_mb();
+	q->queue->cons.tail = ++q->idx;
+
+	if (queue_kick_needed(q, &q->queue->prod.space_event))
+		queue_kick(qdev);
+
+out:
+	mutex_unlock(&qdev->rx_lock);
+	return len;
+}
+
+static ssize_t queue_write(struct file *file, const char __user *buf,
+			   size_t count, loff_t *ppos)
+{
+	struct jailhouse_queue_dev *qdev =
+		container_of(file->private_data, struct jailhouse_queue_dev,
+			     misc);
+	struct queue_state *q = &qdev->tx;
+	struct jailhouse_queue_slot *slot;
+	ssize_t len = count;
+	int err;
+
+	if (count > SLOT_PAYLOAD(q))
+		return -EMSGSIZE;
+
+	if (mutex_lock_interruptible(&qdev->tx_lock))
+		return -EINTR;
+
+	while (queue_tx_full(q)) {
+		if (file->f_flags & O_NONBLOCK) {
+			len = -EAGAIN;
+			goto out;
+		}
+		if (!queue_prepare_wait_tx(q))
+			continue;
+
+		mutex_unlock(&qdev->tx_lock);
+		err = wait_event_interruptible(qdev->wait, !queue_tx_full(q));
+		if (err)
+			return err;
+		if (mutex_lock_interruptible(&qdev->tx_lock))
+			return -EINTR;
+	}
+	/* the consumer must be done with the slot before overwriting it */
+	virt_mb();
+
+	slot = queue_slot(q);
+	if (copy_from_user(slot->data, buf, count)) {
+		len = -EFAULT;
+		goto out;
+	}
+	slot->len = count;
+
+	virt_wmb();
+	q->queue->prod.head = ++q->idx;
+
+	if (queue_kick_needed(q, &q->queue->cons.data_event))
+		queue_kick(qdev);
+
+out:
+	mutex_unlock(&qdev->tx_lock);
+	return len;
+}
+
+static unsigned int queue_poll(struct file *file, poll_table *wait)
+{
+	struct jailhouse_queue_dev *qdev =
+		container_of(file->private_data, struct jailhouse_queue_dev,
+			     misc);
+	unsigned int mask = 0;
+
+	poll_wait(file, &qdev->wait, wait);
+
+	mutex_lock(&qdev->rx_lock);
+	if (queue_attach_rx(qdev) &&
+	    (!queue_rx_empty(&qdev->rx) || !queue_prepare_wait_rx(&qdev->rx)))
+		mask |= POLLIN | POLLRDNORM;
+	mutex_unlock(&qdev->rx_lock);
+
+	mutex_lock(&qdev->tx_lock);
+	if (!queue_tx_full(&qdev->tx) || !queue_prepare_wait_tx(&qdev->tx))
+		mask |= POLLOUT | POLLWRNORM;
+	mutex_unlock(&qdev->tx_lock);
+
+	return mask;
+}
+
+static const struct file_operations queue_fops = {
+	.owner		= THIS_MODULE,
+	.read		= queue_read,
+	.write		= queue_write,
+	.poll		= queue_poll,
+	.llseek		= noop_llseek,
+};
+
+static irqreturn_t queue_irq_handler(int irq, void *data)
+{
+	struct jailhouse_queue_dev *qdev = data;
+
+	wake_up_interruptible(&qdev->wait);
+	return IRQ_HANDLED;
+}
+
+static int queue_probe(struct pci_dev *pdev, const struct pci_device_id *id)
+{
+	struct jailhouse_queue_dev *qdev;
+	resource_size_t shmem_addr, shmem_size;
+	unsigned long half;
+	u32 lo, hi, ivpos;
+	int err;
+
+	qdev = devm_kzalloc(&pdev->dev, sizeof(*qdev), GFP_KERNEL);
+	if (!qdev)
+		return -ENOMEM;
+
+	qdev->pdev = pdev;
+	init_waitqueue_head(&qdev->wait);
+	mutex_init(&qdev->tx_lock);
+	mutex_init(&qdev->rx_lock);
+
+	err = pci_enable_device(pdev);
+	if (err)
+		return err;
+
+	err = pci_request_regions(pdev, DRV_NAME);
+	if (err)
+		goto err_disable;
+
+	qdev->registers = pci_iomap(pdev, 0, 0);
+	if (!qdev->registers) {
+		err = -ENOMEM;
+		goto err_release;
+	}
+
+	ivpos = readl(qdev->registers + IVSHMEM_REG_IVPOS);
+	if (ivpos > 1) {
+		dev_err(&pdev->dev, "only links between two peers supported\n");
+		err = -ENODEV;
+		goto err_unmap_regs;
+	}
+	qdev->peer = 1 - ivpos;
+
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_PTR, &lo);
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_PTR + 4, &hi);
+	shmem_addr = ((u64)hi << 32) | lo;
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_SZ, &lo);
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_SZ + 4, &hi);
+	shmem_size = ((u64)hi << 32) | lo;
+
+	qdev->shmem = memremap(shmem_addr, shmem_size, MEMREMAP_WB);
+	if (!qdev->shmem) {
+		err = -ENOMEM;
+		goto err_unmap_regs;
+	}
+
+	half = shmem_size / 2;
+	err = queue_init_tx(&qdev->tx, qdev->shmem + ivpos * half, half);
+	if (err) {
+		dev_err(&pdev->dev, "shared memory too small for queues\n");
+		goto err_unmap_shmem;
+	}
+	qdev->rx_mem = qdev->shmem + qdev->peer * half;
+	qdev->rx_size = half;
+
+	qdev->msix.entry = 0;
+	err = pci_enable_msix_range(pdev, &qdev->msix, 1, 1);
+	if (err < 0)
+		goto err_unmap_shmem;
+
+	qdev->id = ida_simple_get(&queue_ida, 0, 0, GFP_KERNEL);
+	if (qdev->id < 0) {
+		err = qdev->id;
+		goto err_disable_msix;
+	}
+	snprintf(qdev->name, sizeof(qdev->name), DRV_NAME "%d", qdev->id);
+
+	err = request_irq(qdev->msix.vector, queue_irq_handler, 0, qdev->name,
+			  qdev);
+	if (err)
+		goto err_free_id;
+
+	pci_set_master(pdev);
+
+	qdev->misc.minor = MISC_DYNAMIC_MINOR;
+	qdev->misc.name = qdev->name;
+	qdev->misc.fops = &queue_fops;
+	qdev->misc.parent = &pdev->dev;
+	err = misc_register(&qdev->misc);
+	if (err)
+		goto err_free_irq;
+
+	pci_set_drvdata(pdev, qdev);
+
+	/* let a peer waiting for our queue attach to it */
+	queue_kick(qdev);
+
+	dev_info(&pdev->dev, "queue device %s, %u slots of %u bytes\n",
+		 qdev->name, qdev->tx.num_slots, qdev->tx.slot_size);
+	return 0;
+
+err_free_irq:
+	free_irq(qdev->msix.vector, qdev);
+err_free_id:
+	ida_simple_remove(&queue_ida, qdev->id);
+err_disable_msix:
+	pci_disable_msix(pdev);
+err_unmap_shmem:
+	memunmap(qdev->shmem);
+err_unmap_regs:
+	pci_iounmap(pdev, qdev->registers);
+err_release:
+	pci_release_regions(pdev);
+err_disable:
+	pci_disable_device(pdev);
+	return err;
+}
+
+static void queue_remove(struct pci_dev *pdev)
+{
+	struct jailhouse_queue_dev *qdev = pci_get_drvdata(pdev);
+
+	misc_deregister(&qdev->misc);
+	free_irq(qdev->msix.vector, qdev);
+	ida_simple_remove(&queue_ida, qdev->id);
+	pci_disable_msix(pdev);
+	memunmap(qdev->shmem);
+	pci_iounmap(pdev, qdev->registers);
+	pci_release_regions(pdev);
+	pci_disable_device(pdev);
+}
+
+static const struct pci_device_id queue_ids[] = {
+	{
+		PCI_DEVICE(0x1af4, 0x1110),
+		.class = PCI_CLASS_MEMORY_RAM << 8,
+		.class_mask = 0xffffff,
+	},
+	{ 0 }
+};
+MODULE_DEVICE_TABLE(pci, queue_ids);
+
+static struct pci_driver queue_driver = {
+	.name		= DRV_NAME,
+	.id_table	= queue_ids,
+	.probe		= queue_probe,
+	.remove		= queue_remove,
+};
+
+module_pci_driver(queue_driver);
+
+MODULE_DESCRIPTION("Message queues on Jailhouse ivshmem devices");
+MODULE_LICENSE("GPL");
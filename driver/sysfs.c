@@ -10,7 +10,11 @@
  * the COPYING file in the top-level directory.
  */
 
+#include <linux/mutex.h>
+#include <linux/slab.h>
+
 #include "cell.h"
+#include "events.h"
 #include "jailhouse.h"
 #include "main.h"
 #include "sysfs.h"
@@ -65,80 +69,359 @@ struct jailhouse_cpu_stats_attr {
 	unsigned int code;
 };
 
+/* cells/<name>/cpus/<cpu> */
+struct jailhouse_cpu_kobj {
+	struct kobject kobj;
+	struct cell *cell;
+	unsigned int cpu;
+};
+
+static void read_stats_slot(struct jailhouse_cpu_stats *slot, u64 *counter)
+{
+	unsigned int n;
+	u32 seq;
+
+	do {
+		seq = slot->seqcount;
+		smp_rmb();
+		for (n = 0; n < JAILHOUSE_NUM_CPU_STATS; n++)
+			counter[n] = slot->counter[n];
+		smp_rmb();
+	} while ((seq & 1) || seq != slot->seqcount);
+}
+
+static void cell_read_stats_page(struct cell *cell, u64 *stats)
+{
+	u64 counter[JAILHOUSE_NUM_CPU_STATS];
+	unsigned int cpu, n;
+
+	memset(stats, 0, sizeof(*stats) * JAILHOUSE_NUM_CPU_STATS);
+
+	for_each_cpu(cpu, &cell->cpus_assigned) {
+		if (cpu >= cell->num_stats_slots)
+			break;
+		read_stats_slot(&cell->stats[cpu], counter);
+
+		for (n = 0; n < JAILHOUSE_NUM_CPU_STATS; n++)
+			stats[n] += counter[n];
+	}
+}
+
+/*
+ * Retrieve all counters of a cell, summed up over its CPUs, from the
+ * statistics page or with a single hypercall. Per-cell counters, i.e. those
+ * from JAILHOUSE_FIRST_CELL_STAT on, are only sampled by the hypercall. The
+ * caller has to kfree() the returned array.
+ */
+u64 *jailhouse_cell_get_stats(struct cell *cell, bool with_cell_stats)
+{
+	u64 *stats;
+	int err;
+
+	stats = kmalloc(sizeof(*stats) * JAILHOUSE_NUM_CPU_STATS, GFP_KERNEL);
+	if (!stats)
+		return ERR_PTR(-ENOMEM);
+
+	/* CPUs added after the page was mapped have no slot in it */
+	if (cell->stats &&
+	    cpumask_last(&cell->cpus_assigned) < cell->num_stats_slots &&
+	    (!with_cell_stats ||
+	     JAILHOUSE_FIRST_CELL_STAT == JAILHOUSE_NUM_CPU_STATS)) {
+		cell_read_stats_page(cell, stats);
+		return stats;
+	}
+
+	err = jailhouse_call_arg2(JAILHOUSE_HC_CELL_GET_STATS, cell->id,
+				  __pa(stats));
+	if (err < 0) {
+		kfree(stats);
+		return ERR_PTR(err);
+	}
+
+	return stats;
+}
+
+static struct kobj_type cpu_type;
+
+/*
+ * A single counter of one CPU, preferably from the statistics page. The
+ * hypercall fallback only provides the lower 31 bits.
+ */
+static ssize_t cpu_stats_show(struct jailhouse_cpu_kobj *cpu_kobj,
+			      unsigned int code, char *buffer)
+{
+	struct cell *cell = cpu_kobj->cell;
+	u64 counter[JAILHOUSE_NUM_CPU_STATS];
+	long value;
+
+	if (cell->stats && cpu_kobj->cpu < cell->num_stats_slots) {
+		read_stats_slot(&cell->stats[cpu_kobj->cpu], counter);
+		return sprintf(buffer, "%llu\n", counter[code]);
+	}
+
+	value = jailhouse_call_arg2(JAILHOUSE_HC_CPU_GET_INFO, cpu_kobj->cpu,
+				    JAILHOUSE_CPU_INFO_STAT_BASE + code);
+	if (value < 0)
+		return value;
+	return sprintf(buffer, "%ld\n", value);
+}
+
 static ssize_t stats_show(struct kobject *kobj, struct kobj_attribute *attr,
 			  char *buffer)
 {
 	struct jailhouse_cpu_stats_attr *stats_attr =
 		container_of(attr, struct jailhouse_cpu_stats_attr, kattr);
-	unsigned int code = JAILHOUSE_CPU_INFO_STAT_BASE + stats_attr->code;
 	struct cell *cell = container_of(kobj, struct cell, kobj);
-	unsigned long sum = 0;
-	unsigned int cpu;
-	int value;
+	ssize_t written;
+	u64 *stats;
 
-	for_each_cpu(cpu, &cell->cpus_assigned) {
-		value = jailhouse_call_arg2(JAILHOUSE_HC_CPU_GET_INFO, cpu,
-					    code);
-		if (value > 0)
-			sum += value;
-	}
+	/* the statistics group is shared with the per-CPU directories */
+	if (kobj->ktype == &cpu_type)
+		return cpu_stats_show(container_of(kobj,
+						   struct jailhouse_cpu_kobj,
+						   kobj),
+				      stats_attr->code, buffer);
+
+	stats = jailhouse_cell_get_stats(cell,
+			       stats_attr->code >= JAILHOUSE_FIRST_CELL_STAT);
+	if (IS_ERR(stats))
+		return PTR_ERR(stats);
 
-	return sprintf(buffer, "%lu\n", sum);
+	written = sprintf(buffer, "%llu\n", stats[stats_attr->code]);
+
+	kfree(stats);
+	return written;
 }
 
-#define JAILHOUSE_CPU_STATS_ATTR(_name, _code) \
-	static struct jailhouse_cpu_stats_attr _name##_attr = { \
-		.kattr = __ATTR(_name, S_IRUGO, stats_show, NULL), \
-		.code = _code, \
-	}
+/*
+ * The statistics attributes are created from the names the hypervisor
+ * defines for its counters, ordered by JAILHOUSE_CPU_STAT_* code. This also
+ * gives the order of statistics_raw, which tools use to match the exit
+ * latency histograms.
+ */
+static const char *const stats_names[] = { JAILHOUSE_CPU_STAT_NAMES };
 
-JAILHOUSE_CPU_STATS_ATTR(vmexits_total, JAILHOUSE_CPU_STAT_VMEXITS_TOTAL);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_mmio, JAILHOUSE_CPU_STAT_VMEXITS_MMIO);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_management,
-			 JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_hypercall,
-			 JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL);
-#ifdef CONFIG_X86
-JAILHOUSE_CPU_STATS_ATTR(vmexits_pio, JAILHOUSE_CPU_STAT_VMEXITS_PIO);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_xapic, JAILHOUSE_CPU_STAT_VMEXITS_XAPIC);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_cr, JAILHOUSE_CPU_STAT_VMEXITS_CR);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_msr, JAILHOUSE_CPU_STAT_VMEXITS_MSR);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_cpuid, JAILHOUSE_CPU_STAT_VMEXITS_CPUID);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_xsetbv, JAILHOUSE_CPU_STAT_VMEXITS_XSETBV);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_exception,
-			 JAILHOUSE_CPU_STAT_VMEXITS_EXCEPTION);
-#elif defined(CONFIG_ARM)
-JAILHOUSE_CPU_STATS_ATTR(vmexits_maintenance, JAILHOUSE_CPU_STAT_VMEXITS_MAINTENANCE);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_virt_irq, JAILHOUSE_CPU_STAT_VMEXITS_VIRQ);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_virt_sgi, JAILHOUSE_CPU_STAT_VMEXITS_VSGI);
-#endif
+static struct jailhouse_cpu_stats_attr stats_attrs[ARRAY_SIZE(stats_names)];
+static struct attribute *no_attrs[ARRAY_SIZE(stats_names) + 1];
 
-static struct attribute *no_attrs[] = {
-	&vmexits_total_attr.kattr.attr,
-	&vmexits_mmio_attr.kattr.attr,
-	&vmexits_management_attr.kattr.attr,
-	&vmexits_hypercall_attr.kattr.attr,
-#ifdef CONFIG_X86
-	&vmexits_pio_attr.kattr.attr,
-	&vmexits_xapic_attr.kattr.attr,
-	&vmexits_cr_attr.kattr.attr,
-	&vmexits_msr_attr.kattr.attr,
-	&vmexits_cpuid_attr.kattr.attr,
-	&vmexits_xsetbv_attr.kattr.attr,
-	&vmexits_exception_attr.kattr.attr,
-#elif defined(CONFIG_ARM)
-	&vmexits_maintenance_attr.kattr.attr,
-	&vmexits_virt_irq_attr.kattr.attr,
-	&vmexits_virt_sgi_attr.kattr.attr,
-#endif
-	NULL
-};
+static void stats_attrs_init(void)
+{
+	unsigned int n;
+
+	BUILD_BUG_ON(ARRAY_SIZE(stats_names) != JAILHOUSE_NUM_CPU_STATS);
+
+	for (n = 0; n < ARRAY_SIZE(stats_names); n++) {
+		sysfs_attr_init(&stats_attrs[n].kattr.attr);
+		stats_attrs[n].kattr.attr.name = stats_names[n];
+		stats_attrs[n].kattr.attr.mode = S_IRUGO;
+		stats_attrs[n].kattr.show = stats_show;
+		stats_attrs[n].code = n;
+		no_attrs[n] = &stats_attrs[n].kattr.attr;
+	}
+}
+
+/* per-cell counters are not broken down by CPU */
+static umode_t stats_attr_is_visible(struct kobject *kobj,
+				     struct attribute *attr, int n)
+{
+	if (kobj->ktype == &cpu_type && n >= JAILHOUSE_FIRST_CELL_STAT)
+		return 0;
+	return attr->mode;
+}
 
 static struct attribute_group stats_attr_group = {
 	.attrs = no_attrs,
+	.is_visible = stats_attr_is_visible,
 	.name = "statistics"
 };
 
+#define NUM_STATS_ATTRS		ARRAY_SIZE(stats_names)
+
+static ssize_t statistics_raw_read(struct file *filp, struct kobject *kobj,
+				   struct bin_attribute *attr, char *buf,
+				   loff_t off, size_t count)
+{
+	struct cell *cell = container_of(kobj, struct cell, kobj);
+	struct jailhouse_cpu_stats_attr *stats_attr;
+	struct jailhouse_stats_entry *entries;
+	unsigned int n;
+	ssize_t result;
+	u64 *stats;
+
+	entries = kcalloc(NUM_STATS_ATTRS, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	stats = jailhouse_cell_get_stats(cell, true);
+	if (IS_ERR(stats)) {
+		kfree(entries);
+		return PTR_ERR(stats);
+	}
+
+	for (n = 0; n < NUM_STATS_ATTRS; n++) {
+		stats_attr = container_of(no_attrs[n],
+					  struct jailhouse_cpu_stats_attr,
+					  kattr.attr);
+		strlcpy(entries[n].name, stats_attr->kattr.attr.name,
+			sizeof(entries[n].name));
+		entries[n].value = stats[stats_attr->code];
+	}
+
+	result = memory_read_from_buffer(buf, count, &off, entries,
+					 NUM_STATS_ATTRS * sizeof(*entries));
+
+	kfree(stats);
+	kfree(entries);
+
+	return result;
+}
+
+static struct bin_attribute cell_statistics_raw_attr = {
+	.attr = { .name = "statistics_raw", .mode = S_IRUGO },
+	.size = NUM_STATS_ATTRS * sizeof(struct jailhouse_stats_entry),
+	.read = statistics_raw_read,
+};
+
+#define EXIT_LATENCY_SIZE	(JAILHOUSE_NUM_CPU_STATS * \
+				 JAILHOUSE_EXIT_LATENCY_BUCKETS * sizeof(u64))
+
+static ssize_t exit_latency_raw_read(struct file *filp, struct kobject *kobj,
+				     struct bin_attribute *attr, char *buf,
+				     loff_t off, size_t count)
+{
+	struct cell *cell = container_of(kobj, struct cell, kobj);
+	ssize_t result;
+	u64 *histo;
+	int err;
+
+	histo = kmalloc(EXIT_LATENCY_SIZE, GFP_KERNEL);
+	if (!histo)
+		return -ENOMEM;
+
+	err = jailhouse_call_arg2(JAILHOUSE_HC_CELL_GET_EXIT_LATENCY, cell->id,
+				  __pa(histo));
+	if (err < 0) {
+		kfree(histo);
+		return err;
+	}
+
+	result = memory_read_from_buffer(buf, count, &off, histo,
+					 EXIT_LATENCY_SIZE);
+
+	kfree(histo);
+
+	return result;
+}
+
+static struct bin_attribute cell_exit_latency_raw_attr = {
+	.attr = { .name = "exit_latency_raw", .mode = S_IRUGO },
+	.size = EXIT_LATENCY_SIZE,
+	.read = exit_latency_raw_read,
+};
+
+static struct jailhouse_comm_ext *cell_comm_ext(struct cell *cell)
+{
+	return cell->comm_page ? cell->comm_page + JAILHOUSE_COMM_EXT_OFFSET :
+		NULL;
+}
+
+#define MAILBOXES_SIZE		(2 * JAILHOUSE_COMM_MAILBOXES * \
+				 sizeof(struct jailhouse_comm_mailbox))
+
+/* serializes writers of the to_cell mailboxes */
+static DEFINE_MUTEX(mailbox_lock);
+
+static void read_mailbox(struct jailhouse_comm_mailbox *mbox,
+			 struct jailhouse_comm_mailbox *copy)
+{
+	u32 seq;
+
+	do {
+		seq = mbox->seqcount;
+		smp_rmb();
+		copy->len = min_t(u32, mbox->len, JAILHOUSE_COMM_MAILBOX_SIZE);
+		memcpy((void *)copy->data, (void *)mbox->data, copy->len);
+		smp_rmb();
+	} while ((seq & 1) || seq != mbox->seqcount);
+	copy->seqcount = seq;
+}
+
+/*
+ * The file contains the to_cell mailboxes, followed by the from_cell
+ * mailboxes, as struct jailhouse_comm_mailbox. Each mailbox is read
+ * consistently. Writes have to cover complete to_cell mailboxes, the written
+ * sequence counters are ignored.
+ */
+static ssize_t mailboxes_read(struct file *filp, struct kobject *kobj,
+			      struct bin_attribute *attr, char *buf,
+			      loff_t off, size_t count)
+{
+	struct cell *cell = container_of(kobj, struct cell, kobj);
+	struct jailhouse_comm_ext *ext = cell_comm_ext(cell);
+	struct jailhouse_comm_mailbox *copy;
+	unsigned int n;
+	ssize_t result;
+
+	if (!ext)
+		return -ENODEV;
+
+	copy = kzalloc(MAILBOXES_SIZE, GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+
+	for (n = 0; n < JAILHOUSE_COMM_MAILBOXES; n++) {
+		read_mailbox(&ext->to_cell[n], &copy[n]);
+		read_mailbox(&ext->from_cell[n],
+			     &copy[JAILHOUSE_COMM_MAILBOXES + n]);
+	}
+
+	result = memory_read_from_buffer(buf, count, &off, copy,
+					 MAILBOXES_SIZE);
+
+	kfree(copy);
+
+	return result;
+}
+
+static ssize_t mailboxes_write(struct file *filp, struct kobject *kobj,
+			       struct bin_attribute *attr, char *buf,
+			       loff_t off, size_t count)
+{
+	struct cell *cell = container_of(kobj, struct cell, kobj);
+	struct jailhouse_comm_ext *ext = cell_comm_ext(cell);
+	struct jailhouse_comm_mailbox *src, *mbox;
+	unsigned int n;
+
+	if (!ext)
+		return -ENODEV;
+	if (off % sizeof(*mbox) || count % sizeof(*mbox) ||
+	    off + count > sizeof(ext->to_cell))
+		return -EINVAL;
+
+	mutex_lock(&mailbox_lock);
+	for (n = 0; n < count / sizeof(*mbox); n++) {
+		src = (struct jailhouse_comm_mailbox *)buf + n;
+		mbox = &ext->to_cell[off / sizeof(*mbox) + n];
+
+		mbox->seqcount++;
+		smp_wmb();
+		mbox->len = min_t(u32, src->len, JAILHOUSE_COMM_MAILBOX_SIZE);
+		memcpy((void *)mbox->data, (void *)src->data, mbox->len);
+		smp_wmb();
+		mbox->seqcount++;
+	}
+	mutex_unlock(&mailbox_lock);
+
+	return count;
+}
+
+static struct bin_attribute cell_mailboxes_attr = {
+	.attr = { .name = "mailboxes", .mode = S_IRUSR | S_IWUSR },
+	.size = MAILBOXES_SIZE,
+	.read = mailboxes_read,
+	.write = mailboxes_write,
+};
+
 static ssize_t id_show(struct kobject *kobj, struct kobj_attribute *attr,
 		       char *buffer)
 {
@@ -182,6 +465,32 @@ static ssize_t cpus_assigned_show(struct kobject *kobj,
 	return written;
 }
 
+static ssize_t hv_pages_show(struct kobject *kobj,
+			     struct kobj_attribute *attr, char *buf)
+{
+	struct cell *cell = container_of(kobj, struct cell, kobj);
+	long pages;
+
+	pages = jailhouse_call_arg1(JAILHOUSE_HC_HYPERVISOR_GET_INFO,
+				    JAILHOUSE_INFO_CELL_PAGES_BASE + cell->id);
+	if (pages < 0)
+		return pages;
+
+	return sprintf(buf, "%ld\n", pages);
+}
+
+static ssize_t heartbeat_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	struct cell *cell = container_of(kobj, struct cell, kobj);
+	struct jailhouse_comm_ext *ext = cell_comm_ext(cell);
+
+	if (!ext)
+		return -ENODEV;
+
+	return sprintf(buf, "%llu\n", (unsigned long long)ext->heartbeat);
+}
+
 static ssize_t cpus_failed_show(struct kobject *kobj,
 				struct kobj_attribute *attr, char *buf)
 {
@@ -217,12 +526,16 @@ static struct kobj_attribute cell_state_attr = __ATTR_RO(state);
 static struct kobj_attribute cell_cpus_assigned_attr =
 	__ATTR_RO(cpus_assigned);
 static struct kobj_attribute cell_cpus_failed_attr = __ATTR_RO(cpus_failed);
+static struct kobj_attribute cell_hv_pages_attr = __ATTR_RO(hv_pages);
+static struct kobj_attribute cell_heartbeat_attr = __ATTR_RO(heartbeat);
 
 static struct attribute *cell_attrs[] = {
 	&cell_id_attr.attr,
 	&cell_state_attr.attr,
 	&cell_cpus_assigned_attr.attr,
 	&cell_cpus_failed_attr.attr,
+	&cell_hv_pages_attr.attr,
+	&cell_heartbeat_attr.attr,
 	NULL,
 };
 
@@ -232,6 +545,73 @@ static struct kobj_type cell_type = {
 	.default_attrs = cell_attrs,
 };
 
+static void cpu_kobj_release(struct kobject *kobj)
+{
+	kfree(container_of(kobj, struct jailhouse_cpu_kobj, kobj));
+}
+
+static struct kobj_type cpu_type = {
+	.release = cpu_kobj_release,
+	.sysfs_ops = &kobj_sysfs_ops,
+};
+
+static struct jailhouse_cpu_kobj *cpu_kobj_create(struct cell *cell,
+						  unsigned int cpu)
+{
+	struct jailhouse_cpu_kobj *cpu_kobj;
+
+	cpu_kobj = kzalloc(sizeof(*cpu_kobj), GFP_KERNEL);
+	if (!cpu_kobj)
+		return NULL;
+
+	cpu_kobj->cell = cell;
+	cpu_kobj->cpu = cpu;
+
+	if (kobject_init_and_add(&cpu_kobj->kobj, &cpu_type, cell->cpus_dir,
+				 "%u", cpu)) {
+		kobject_put(&cpu_kobj->kobj);
+		return NULL;
+	}
+
+	if (sysfs_create_group(&cpu_kobj->kobj, &stats_attr_group)) {
+		kobject_put(&cpu_kobj->kobj);
+		return NULL;
+	}
+
+	kobject_uevent(&cpu_kobj->kobj, KOBJ_ADD);
+
+	return cpu_kobj;
+}
+
+static void cpu_kobj_delete(struct jailhouse_cpu_kobj *cpu_kobj)
+{
+	sysfs_remove_group(&cpu_kobj->kobj, &stats_attr_group);
+	kobject_put(&cpu_kobj->kobj);
+}
+
+/*
+ * Bring the per-CPU directories in line with the CPUs currently assigned to
+ * the cell. Failing to create a directory only leaves it out.
+ */
+void jailhouse_sysfs_cell_update_cpus(struct cell *cell)
+{
+	unsigned int cpu;
+
+	if (!cell->cpus_dir)
+		return;
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		if (cpumask_test_cpu(cpu, &cell->cpus_assigned)) {
+			if (!cell->cpu_kobjs[cpu])
+				cell->cpu_kobjs[cpu] =
+					cpu_kobj_create(cell, cpu);
+		} else if (cell->cpu_kobjs[cpu]) {
+			cpu_kobj_delete(cell->cpu_kobjs[cpu]);
+			cell->cpu_kobjs[cpu] = NULL;
+		}
+	}
+}
+
 int jailhouse_sysfs_cell_create(struct cell *cell, const char *name)
 {
 	int err;
@@ -249,16 +629,59 @@ int jailhouse_sysfs_cell_create(struct cell *cell, const char *name)
 		return err;
 	}
 
+	err = sysfs_create_bin_file(&cell->kobj, &cell_statistics_raw_attr);
+	if (err) {
+		sysfs_remove_group(&cell->kobj, &stats_attr_group);
+		kobject_put(&cell->kobj);
+		return err;
+	}
+
+	err = sysfs_create_bin_file(&cell->kobj, &cell_exit_latency_raw_attr);
+	if (err) {
+		sysfs_remove_bin_file(&cell->kobj, &cell_statistics_raw_attr);
+		sysfs_remove_group(&cell->kobj, &stats_attr_group);
+		kobject_put(&cell->kobj);
+		return err;
+	}
+
+	err = sysfs_create_bin_file(&cell->kobj, &cell_mailboxes_attr);
+	if (err) {
+		sysfs_remove_bin_file(&cell->kobj, &cell_exit_latency_raw_attr);
+		sysfs_remove_bin_file(&cell->kobj, &cell_statistics_raw_attr);
+		sysfs_remove_group(&cell->kobj, &stats_attr_group);
+		kobject_put(&cell->kobj);
+		return err;
+	}
+
 	return 0;
 }
 
 void jailhouse_sysfs_cell_register(struct cell *cell)
 {
 	kobject_uevent(&cell->kobj, KOBJ_ADD);
+
+	cell->cpu_kobjs = kcalloc(nr_cpu_ids, sizeof(*cell->cpu_kobjs),
+				  GFP_KERNEL);
+	if (cell->cpu_kobjs)
+		cell->cpus_dir = kobject_create_and_add("cpus", &cell->kobj);
+	jailhouse_sysfs_cell_update_cpus(cell);
 }
 
 void jailhouse_sysfs_cell_delete(struct cell *cell)
 {
+	unsigned int cpu;
+
+	if (cell->cpus_dir) {
+		for (cpu = 0; cpu < nr_cpu_ids; cpu++)
+			if (cell->cpu_kobjs[cpu])
+				cpu_kobj_delete(cell->cpu_kobjs[cpu]);
+		kobject_put(cell->cpus_dir);
+	}
+	kfree(cell->cpu_kobjs);
+
+	sysfs_remove_bin_file(&cell->kobj, &cell_mailboxes_attr);
+	sysfs_remove_bin_file(&cell->kobj, &cell_exit_latency_raw_attr);
+	sysfs_remove_bin_file(&cell->kobj, &cell_statistics_raw_attr);
 	sysfs_remove_group(&cell->kobj, &stats_attr_group);
 	kobject_put(&cell->kobj);
 }
@@ -315,6 +738,155 @@ static ssize_t remap_pool_used_show(struct device *dev,
 	return info_show(dev, buffer, JAILHOUSE_INFO_REMAP_POOL_USED);
 }
 
+#define ENABLE_TIMING_ATTR(_name)					\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buffer) \
+{									\
+	return sprintf(buffer, "%lld\n",				\
+		       (long long)jailhouse_enable_timing._name);	\
+}									\
+static DEVICE_ATTR_RO(_name)
+
+ENABLE_TIMING_ATTR(firmware);
+ENABLE_TIMING_ATTR(map);
+ENABLE_TIMING_ATTR(copy);
+ENABLE_TIMING_ATTR(root_cell);
+ENABLE_TIMING_ATTR(entry);
+ENABLE_TIMING_ATTR(total);
+
+/* durations of the last successful enable in microseconds */
+static struct attribute *enable_timing_entries[] = {
+	&dev_attr_firmware.attr,
+	&dev_attr_map.attr,
+	&dev_attr_copy.attr,
+	&dev_attr_root_cell.attr,
+	&dev_attr_entry.attr,
+	&dev_attr_total.attr,
+	NULL
+};
+
+static struct attribute_group enable_timing_group = {
+	.name = "enable_timing",
+	.attrs = enable_timing_entries,
+};
+
+static ssize_t events_show(struct device *dev, char *buffer, unsigned int type)
+{
+	ssize_t result;
+	u32 count;
+
+	if (mutex_lock_interruptible(&jailhouse_lock) != 0)
+		return -EINTR;
+
+	result = jailhouse_events_read(type, &count);
+	if (result == 0)
+		result = sprintf(buffer, "%u\n", count);
+
+	mutex_unlock(&jailhouse_lock);
+	return result;
+}
+
+/* prefixed, some names are also used by the enable_timing group */
+#define EVENTS_ATTR(_name, _type)					\
+static ssize_t events_##_name##_show(struct device *dev,		\
+				     struct device_attribute *attr,	\
+				     char *buffer)			\
+{									\
+	return events_show(dev, buffer, (_type));			\
+}									\
+static struct device_attribute dev_attr_events_##_name =		\
+	__ATTR(_name, S_IRUGO, events_##_name##_show, NULL)
+
+EVENTS_ATTR(cell_state, JAILHOUSE_EVENT_CELL_STATE);
+EVENTS_ATTR(cpu_failed, JAILHOUSE_EVENT_CPU_FAILED);
+EVENTS_ATTR(iommu_fault, JAILHOUSE_EVENT_IOMMU_FAULT);
+EVENTS_ATTR(exit_rate, JAILHOUSE_EVENT_EXIT_RATE);
+EVENTS_ATTR(total, JAILHOUSE_NUM_EVENTS);
+
+static ssize_t events_fault_show(char *buffer,
+				 ssize_t (*show)(char *buffer))
+{
+	ssize_t result;
+
+	if (mutex_lock_interruptible(&jailhouse_lock) != 0)
+		return -EINTR;
+
+	result = show(buffer);
+
+	mutex_unlock(&jailhouse_lock);
+	return result;
+}
+
+static ssize_t iommu_fault_devices_show(struct device *dev,
+					struct device_attribute *attr,
+					char *buffer)
+{
+	return events_fault_show(buffer, jailhouse_events_fault_devices);
+}
+
+static ssize_t iommu_fault_log_show(struct device *dev,
+				    struct device_attribute *attr,
+				    char *buffer)
+{
+	return events_fault_show(buffer, jailhouse_events_fault_log);
+}
+
+static DEVICE_ATTR_RO(iommu_fault_devices);
+static DEVICE_ATTR_RO(iommu_fault_log);
+
+/* events reported by the hypervisor, "total" supports poll() */
+static struct attribute *events_entries[] = {
+	&dev_attr_events_cell_state.attr,
+	&dev_attr_events_cpu_failed.attr,
+	&dev_attr_events_iommu_fault.attr,
+	&dev_attr_events_exit_rate.attr,
+	&dev_attr_iommu_fault_devices.attr,
+	&dev_attr_iommu_fault_log.attr,
+	&dev_attr_events_total.attr,
+	NULL
+};
+
+static struct attribute_group events_group = {
+	.name = "events",
+	.attrs = events_entries,
+};
+
+#define PAGE_OWNER_ATTR(_name, _owner)					\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buffer) \
+{									\
+	return info_show(dev, buffer,					\
+			 JAILHOUSE_INFO_PAGES_BASE + (_owner));		\
+}									\
+static DEVICE_ATTR_RO(_name)
+
+PAGE_OWNER_ATTR(paging, JAILHOUSE_PAGES_PAGING);
+PAGE_OWNER_ATTR(cell, JAILHOUSE_PAGES_CELL);
+PAGE_OWNER_ATTR(mmio, JAILHOUSE_PAGES_MMIO);
+PAGE_OWNER_ATTR(iommu, JAILHOUSE_PAGES_IOMMU);
+PAGE_OWNER_ATTR(irt, JAILHOUSE_PAGES_IRT);
+PAGE_OWNER_ATTR(ivshmem, JAILHOUSE_PAGES_IVSHMEM);
+PAGE_OWNER_ATTR(pci, JAILHOUSE_PAGES_PCI);
+PAGE_OWNER_ATTR(other, JAILHOUSE_PAGES_OTHER);
+
+/* hypervisor memory pages in use, by owning subsystem */
+static struct attribute *mem_owners_entries[] = {
+	&dev_attr_paging.attr,
+	&dev_attr_cell.attr,
+	&dev_attr_mmio.attr,
+	&dev_attr_iommu.attr,
+	&dev_attr_irt.attr,
+	&dev_attr_ivshmem.attr,
+	&dev_attr_pci.attr,
+	&dev_attr_other.attr,
+	NULL
+};
+
+static struct attribute_group mem_owners_group = {
+	.name = "mem_owners",
+	.attrs = mem_owners_entries,
+};
+
 static DEVICE_ATTR_RO(enabled);
 static DEVICE_ATTR_RO(mem_pool_size);
 static DEVICE_ATTR_RO(mem_pool_used);
@@ -339,12 +911,38 @@ int jailhouse_sysfs_init(struct device *dev)
 {
 	int err;
 
+	stats_attrs_init();
+
 	err = sysfs_create_group(&dev->kobj, &jailhouse_attribute_group);
 	if (err)
 		return err;
 
+	err = sysfs_create_group(&dev->kobj, &enable_timing_group);
+	if (err) {
+		sysfs_remove_group(&dev->kobj, &jailhouse_attribute_group);
+		return err;
+	}
+
+	err = sysfs_create_group(&dev->kobj, &mem_owners_group);
+	if (err) {
+		sysfs_remove_group(&dev->kobj, &enable_timing_group);
+		sysfs_remove_group(&dev->kobj, &jailhouse_attribute_group);
+		return err;
+	}
+
+	err = sysfs_create_group(&dev->kobj, &events_group);
+	if (err) {
+		sysfs_remove_group(&dev->kobj, &mem_owners_group);
+		sysfs_remove_group(&dev->kobj, &enable_timing_group);
+		sysfs_remove_group(&dev->kobj, &jailhouse_attribute_group);
+		return err;
+	}
+
 	cells_dir = kobject_create_and_add("cells", &dev->kobj);
 	if (!cells_dir) {
+		sysfs_remove_group(&dev->kobj, &events_group);
+		sysfs_remove_group(&dev->kobj, &mem_owners_group);
+		sysfs_remove_group(&dev->kobj, &enable_timing_group);
 		sysfs_remove_group(&dev->kobj, &jailhouse_attribute_group);
 		return -ENOMEM;
 	}
@@ -355,5 +953,8 @@ int jailhouse_sysfs_init(struct device *dev)
 void jailhouse_sysfs_exit(struct device *dev)
 {
 	kobject_put(cells_dir);
+	sysfs_remove_group(&dev->kobj, &events_group);
+	sysfs_remove_group(&dev->kobj, &mem_owners_group);
+	sysfs_remove_group(&dev->kobj, &enable_timing_group);
 	sysfs_remove_group(&dev->kobj, &jailhouse_attribute_group);
 }
@@ -15,8 +15,11 @@
 
 #include <linux/device.h>
 
+u64 *jailhouse_cell_get_stats(struct cell *cell, bool with_cell_stats);
+
 int jailhouse_sysfs_cell_create(struct cell *cell, const char *name);
 void jailhouse_sysfs_cell_register(struct cell *cell);
+void jailhouse_sysfs_cell_update_cpus(struct cell *cell);
 void jailhouse_sysfs_cell_delete(struct cell *cell);
 
 int jailhouse_sysfs_init(struct device *dev);
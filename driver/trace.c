@@ -0,0 +1,300 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/trace_clock.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#ifdef CONFIG_X86
+#include <asm/tsc.h>
+#else
+#include <clocksource/arm_arch_timer.h>
+#endif
+
+#include "main.h"
+#include "trace.h"
+
+#define CREATE_TRACE_POINTS
+#include "trace_events.h"
+
+#include <jailhouse/hypercall.h>
+
+#define TRACE_BUFFER_SIZE	(JAILHOUSE_TRACE_BUFFER_PAGES * PAGE_SIZE)
+
+/* period of forwarding hypervisor records to the kernel tracepoints */
+#define TRACE_EXPORT_INTERVAL	msecs_to_jiffies(10)
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,2,0)
+#define trace_export_enabled()	true
+#else
+#define trace_export_enabled()						\
+	(trace_vmexit_enabled() || trace_irq_inject_enabled() ||	\
+	 trace_cell_state_enabled())
+#endif
+
+struct trace_cpu {
+	struct jailhouse_trace_buffer *buffer;
+	/* number of records consumed so far, free-running like buffer->head */
+	u32 tail;
+	/* same for the records forwarded to the tracepoints */
+	u32 export_tail;
+	u32 num_records;
+};
+
+static struct dentry *trace_dir;
+static struct trace_cpu *trace_cpus;
+
+static void trace_export(struct work_struct *work);
+static DECLARE_DELAYED_WORK(trace_export_work, trace_export);
+
+/* the hypervisor timestamps records with the TSC or the ARM system counter */
+static u64 trace_read_cycles(void)
+{
+#ifdef CONFIG_X86
+	return get_cycles();
+#else
+	return arch_timer_read_counter();
+#endif
+}
+
+static u32 trace_cycles_khz(void)
+{
+#ifdef CONFIG_X86
+	return tsc_khz;
+#else
+	return arch_timer_get_rate() / 1000;
+#endif
+}
+
+/* called with jailhouse_lock held, after the hypervisor was enabled */
+void jailhouse_trace_map(void)
+{
+	struct trace_cpu *tc;
+	unsigned int cpu;
+	long pfn;
+
+	if (!trace_cpus)
+		return;
+
+	for_each_online_cpu(cpu) {
+		tc = &trace_cpus[cpu];
+
+		pfn = jailhouse_call_arg2(JAILHOUSE_HC_CPU_GET_INFO, cpu,
+					  JAILHOUSE_CPU_INFO_TRACE_BUFFER);
+		if (pfn < 0)
+			continue;
+
+		tc->buffer = jailhouse_ioremap((phys_addr_t)pfn << PAGE_SHIFT,
+					       0, TRACE_BUFFER_SIZE);
+		if (!tc->buffer)
+			continue;
+
+		tc->num_records = tc->buffer->num_records;
+		tc->tail = tc->buffer->head;
+		tc->export_tail = tc->tail;
+	}
+
+	schedule_delayed_work(&trace_export_work, TRACE_EXPORT_INTERVAL);
+}
+
+/* called with jailhouse_lock held, after the hypervisor was disabled */
+void jailhouse_trace_unmap(void)
+{
+	unsigned int cpu;
+
+	if (!trace_cpus)
+		return;
+
+	cancel_delayed_work_sync(&trace_export_work);
+
+	for_each_possible_cpu(cpu)
+		if (trace_cpus[cpu].buffer) {
+			vunmap(trace_cpus[cpu].buffer);
+			trace_cpus[cpu].buffer = NULL;
+		}
+}
+
+static bool trace_read_record(struct trace_cpu *tc, u32 tail,
+			      struct jailhouse_trace_record *record)
+{
+	struct jailhouse_trace_record *slot =
+		&tc->buffer->records[tail % tc->num_records];
+	u32 seq = slot->seq;
+
+	smp_rmb();
+	*record = *slot;
+	smp_rmb();
+
+	/* discard records that were overwritten while we copied them */
+	return seq == tail + 1 && slot->seq == seq;
+}
+
+static void trace_export_record(unsigned int cpu,
+				struct jailhouse_trace_record *record,
+				u64 now_cycles, u64 now_ns, u32 khz)
+{
+	u64 age = 0, time;
+
+	if (khz && now_cycles > record->timestamp)
+		age = mul_u64_u32_div(now_cycles - record->timestamp,
+				      NSEC_PER_MSEC, khz);
+	time = now_ns > age ? now_ns - age : 0;
+
+	switch (record->event) {
+	case JAILHOUSE_TRACE_VMEXIT:
+		trace_vmexit(cpu, time, record->arg[0]);
+		break;
+	case JAILHOUSE_TRACE_IRQ_INJECT:
+		trace_irq_inject(cpu, time, record->arg[0], record->arg[1]);
+		break;
+	case JAILHOUSE_TRACE_CELL_STATE:
+		trace_cell_state(cpu, time, record->arg[0], record->arg[1]);
+		break;
+	}
+}
+
+/*
+ * Forwards new hypervisor records to the tracepoints. Runs independently of
+ * the debugfs readers and without jailhouse_lock, jailhouse_trace_unmap stops
+ * it before releasing the buffers.
+ */
+static void trace_export(struct work_struct *work)
+{
+	struct jailhouse_trace_record record;
+	u64 now_cycles, now_ns;
+	struct trace_cpu *tc;
+	unsigned int cpu;
+	u32 head, khz;
+	bool enabled;
+
+	enabled = trace_export_enabled();
+	khz = trace_cycles_khz();
+
+	for_each_possible_cpu(cpu) {
+		tc = &trace_cpus[cpu];
+		if (!tc->buffer)
+			continue;
+
+		head = tc->buffer->head;
+		smp_rmb();
+
+		/* all records up to head are older than these timestamps */
+		now_ns = trace_clock_local();
+		now_cycles = trace_read_cycles();
+
+		if (!enabled || head - tc->export_tail > tc->num_records)
+			tc->export_tail = enabled ? head - tc->num_records :
+				head;
+
+		for (; tc->export_tail != head; tc->export_tail++)
+			if (trace_read_record(tc, tc->export_tail, &record))
+				trace_export_record(cpu, &record, now_cycles,
+						    now_ns, khz);
+	}
+
+	schedule_delayed_work(&trace_export_work, TRACE_EXPORT_INTERVAL);
+}
+
+static ssize_t trace_read(struct file *file, char __user *buf, size_t count,
+			  loff_t *ppos)
+{
+	struct trace_cpu *tc = file->private_data;
+	struct jailhouse_trace_record record;
+	ssize_t written = 0;
+	u32 head;
+
+	if (count < sizeof(record))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&jailhouse_lock) != 0)
+		return -EINTR;
+
+	if (!tc->buffer) {
+		written = -ENODEV;
+		goto unlock_out;
+	}
+
+	head = tc->buffer->head;
+	smp_rmb();
+
+	/* skip records that were overwritten before we came by */
+	if (head - tc->tail > tc->num_records)
+		tc->tail = head - tc->num_records;
+
+	while (tc->tail != head && count - written >= sizeof(record)) {
+		if (trace_read_record(tc, tc->tail, &record)) {
+			if (copy_to_user(buf + written, &record,
+					 sizeof(record))) {
+				if (written == 0)
+					written = -EFAULT;
+				break;
+			}
+			written += sizeof(record);
+		}
+		tc->tail++;
+	}
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+
+	return written;
+}
+
+static const struct file_operations trace_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = trace_read,
+	.llseek = noop_llseek,
+};
+
+void jailhouse_trace_exit(void)
+{
+	debugfs_remove_recursive(trace_dir);
+	kfree(trace_cpus);
+}
+
+int jailhouse_trace_init(void)
+{
+	struct dentry *dentry;
+	unsigned int cpu;
+	char name[16];
+
+	trace_cpus = kcalloc(nr_cpu_ids, sizeof(*trace_cpus), GFP_KERNEL);
+	if (!trace_cpus)
+		return -ENOMEM;
+
+	trace_dir = debugfs_create_dir("jailhouse", NULL);
+	if (IS_ERR_OR_NULL(trace_dir)) {
+		/* debugfs may be unavailable, the tracepoints work without it */
+		trace_dir = NULL;
+		return 0;
+	}
+
+	for_each_possible_cpu(cpu) {
+		snprintf(name, sizeof(name), "trace_cpu%u", cpu);
+		dentry = debugfs_create_file(name, S_IRUSR, trace_dir,
+					     &trace_cpus[cpu], &trace_fops);
+		if (IS_ERR_OR_NULL(dentry))
+			goto error;
+	}
+
+	return 0;
+
+error:
+	jailhouse_trace_exit();
+	trace_dir = NULL;
+	trace_cpus = NULL;
+	return -ENOMEM;
+}
@@ -0,0 +1,19 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_DRIVER_TRACE_H
+#define _JAILHOUSE_DRIVER_TRACE_H
+
+void jailhouse_trace_map(void);
+void jailhouse_trace_unmap(void);
+
+int jailhouse_trace_init(void);
+void jailhouse_trace_exit(void);
+
+#endif /* !_JAILHOUSE_DRIVER_TRACE_H */
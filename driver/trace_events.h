@@ -0,0 +1,97 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM jailhouse
+
+#if !defined(_JAILHOUSE_DRIVER_TRACE_EVENTS_H) || \
+    defined(TRACE_HEADER_MULTI_READ)
+#define _JAILHOUSE_DRIVER_TRACE_EVENTS_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Hypervisor trace records are drained periodically, so the timestamp of an
+ * event is that of its export. The time of the record itself is provided in
+ * hv_time, converted to the local trace clock, and the CPU that recorded it
+ * in hv_cpu.
+ */
+
+TRACE_EVENT(vmexit,
+	TP_PROTO(unsigned int cpu, u64 time, u64 reason),
+	TP_ARGS(cpu, time, reason),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, hv_cpu)
+		__field(u64, hv_time)
+		__field(u64, reason)
+	),
+
+	TP_fast_assign(
+		__entry->hv_cpu = cpu;
+		__entry->hv_time = time;
+		__entry->reason = reason;
+	),
+
+	TP_printk("cpu=%u time=%llu reason=0x%llx", __entry->hv_cpu,
+		  __entry->hv_time, __entry->reason)
+);
+
+TRACE_EVENT(irq_inject,
+	TP_PROTO(unsigned int cpu, u64 time, u64 irq, u64 target),
+	TP_ARGS(cpu, time, irq, target),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, hv_cpu)
+		__field(u64, hv_time)
+		__field(u64, irq)
+		__field(u64, target)
+	),
+
+	TP_fast_assign(
+		__entry->hv_cpu = cpu;
+		__entry->hv_time = time;
+		__entry->irq = irq;
+		__entry->target = target;
+	),
+
+	TP_printk("cpu=%u time=%llu irq=%llu target=%llu", __entry->hv_cpu,
+		  __entry->hv_time, __entry->irq, __entry->target)
+);
+
+TRACE_EVENT(cell_state,
+	TP_PROTO(unsigned int cpu, u64 time, u64 cell_id, u64 state),
+	TP_ARGS(cpu, time, cell_id, state),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, hv_cpu)
+		__field(u64, hv_time)
+		__field(u64, cell_id)
+		__field(u64, state)
+	),
+
+	TP_fast_assign(
+		__entry->hv_cpu = cpu;
+		__entry->hv_time = time;
+		__entry->cell_id = cell_id;
+		__entry->state = state;
+	),
+
+	TP_printk("cpu=%u time=%llu cell=%llu state=%llu", __entry->hv_cpu,
+		  __entry->hv_time, __entry->cell_id, __entry->state)
+);
+
+#endif /* !_JAILHOUSE_DRIVER_TRACE_EVENTS_H || TRACE_HEADER_MULTI_READ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace_events
+
+#include <trace/define_trace.h>
@@ -0,0 +1,976 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/*
+ * virtio back-end on top of a Jailhouse ivshmem link between two cells,
+ * usually running in the root cell. The virtio device ID is taken from the
+ * PCI class code the hypervisor reports for the link. Network devices show
+ * up as jhvnet<n> interfaces, block devices are backed by the files passed
+ * via the block_files parameter, in probing order. The shared memory layout
+ * is described in jailhouse/virtio-ivshmem.h.
+ */
+
+#include <linux/etherdevice.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/idr.h>
+#include <linux/if_vlan.h>
+#include <linux/interrupt.h>
+#include <linux/io.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/netdevice.h>
+#include <linux/pci.h>
+#include <linux/skbuff.h>
+#include <linux/version.h>
+#include <linux/virtio_blk.h>
+#include <linux/virtio_byteorder.h>
+#include <linux/virtio_config.h>
+#include <linux/virtio_ids.h>
+#include <linux/virtio_net.h>
+#include <linux/virtio_ring.h>
+#include <linux/workqueue.h>
+
+#include <jailhouse/cell-config.h>
+#include <jailhouse/virtio-ivshmem.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,8,0)
+#error virtio over ivshmem requires Linux 4.8 or later
+#endif
+
+#ifndef VIRTIO_F_ACCESS_PLATFORM
+#define VIRTIO_F_ACCESS_PLATFORM	VIRTIO_F_IOMMU_PLATFORM
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,1,0)
+#define back_napi_add(netdev, napi, poll)	\
+	netif_napi_add(netdev, napi, poll)
+#else
+#define back_napi_add(netdev, napi, poll)	\
+	netif_napi_add(netdev, napi, poll, NAPI_POLL_WEIGHT)
+#endif
+
+#define DRV_NAME			"jailhouse-virtio-back"
+
+#define IVSHMEM_CFG_SHMEM_PTR		0x40
+#define IVSHMEM_CFG_SHMEM_SZ		0x48
+
+#define IVSHMEM_REG_IVPOS		8
+#define IVSHMEM_REG_DBELL		12
+
+/* lower bits of the class code of a back-end link */
+#define BACK_DEVICE_ID_MASK		0x3fff
+
+/* minimal granularity of the buffer area, see the front-end */
+#define BUFFER_ALIGN			512
+
+#define NET_QUEUE_RX			0
+#define NET_QUEUE_TX			1
+#define NET_MAX_BUFS			32
+
+#define BLK_MAX_BUFS			130
+#define BLK_SECTOR_SHIFT		9
+
+#define vq16_to_cpu(v)			__virtio16_to_cpu(true, v)
+#define vq32_to_cpu(v)			__virtio32_to_cpu(true, v)
+#define vq64_to_cpu(v)			__virtio64_to_cpu(true, v)
+#define cpu_to_vq16(v)			__cpu_to_virtio16(true, v)
+#define cpu_to_vq32(v)			__cpu_to_virtio32(true, v)
+#define cpu_to_vq64(v)			__cpu_to_virtio64(true, v)
+
+struct virtio_back;
+
+struct back_device {
+	u32 device_id;
+	const char *name;
+	unsigned int num_queues;
+	/* device-specific features, the transport ones are added */
+	u64 features;
+	int (*init)(struct virtio_back *back);
+	void (*exit)(struct virtio_back *back);
+	void (*start)(struct virtio_back *back);
+	void (*stop)(struct virtio_back *back);
+	/* called in interrupt context on each kick while running */
+	void (*notify)(struct virtio_back *back);
+};
+
+/* device side of a split virtqueue */
+struct back_queue {
+	struct vring vring;
+	u16 last_avail;
+	u16 used_idx;
+	bool broken;
+};
+
+struct back_buf {
+	void *addr;
+	u32 len;
+	bool writable;
+};
+
+struct virtio_back {
+	struct pci_dev *pdev;
+	void __iomem *registers;
+	struct jailhouse_virtio_header *header;
+	resource_size_t shmem_size;
+	u32 peer;
+	struct msix_entry msix;
+	const struct back_device *device;
+	void *priv;
+	/*
+	 * Private copies of the layout, the front-end can write to the whole
+	 * shared memory.
+	 */
+	unsigned int queue_size;
+	u64 queue_offset[JAILHOUSE_VIRTIO_MAX_QUEUES];
+	u64 buffer_offset;
+	u64 buffer_size;
+	u64 features;
+	struct back_queue queues[JAILHOUSE_VIRTIO_MAX_QUEUES];
+	/* serializes status changes */
+	struct mutex status_lock;
+	struct work_struct status_work;
+	u8 status;
+	bool running;
+};
+
+struct back_net {
+	struct virtio_back *back;
+	struct net_device *netdev;
+	struct napi_struct napi;
+	struct back_buf bufs[NET_MAX_BUFS];
+};
+
+struct back_blk {
+	struct virtio_back *back;
+	int id;
+	struct file *file;
+	u64 capacity;
+	struct work_struct work;
+	struct back_buf bufs[BLK_MAX_BUFS];
+};
+
+static unsigned int queue_size = 256;
+module_param(queue_size, uint, 0444);
+MODULE_PARM_DESC(queue_size, "Descriptors per virtqueue, a power of two");
+
+static char *block_files[8];
+static unsigned int num_block_files;
+module_param_array(block_files, charp, &num_block_files, 0444);
+MODULE_PARM_DESC(block_files, "Backing files of the block devices");
+
+static DEFINE_IDA(blk_ida);
+
+static void back_kick(struct virtio_back *back)
+{
+	writel(back->peer << 16, back->registers + IVSHMEM_REG_DBELL);
+}
+
+static bool back_range_valid(struct virtio_back *back, u64 addr, u32 len)
+{
+	return addr >= back->buffer_offset && len <= back->buffer_size &&
+		addr - back->buffer_offset <= back->buffer_size - len;
+}
+
+static bool vq_available(struct back_queue *q)
+{
+	return !q->broken &&
+		vq16_to_cpu(READ_ONCE(q->vring.avail->idx)) != q->last_avail;
+}
+
+/*
+ * Fetch the next descriptor chain offered by the front-end. Returns the
+ * number of buffers, 0 if there is no chain, and marks the queue broken on
+ * malformed chains.
+ */
+static int vq_pop(struct virtio_back *back, struct back_queue *q,
+		  struct back_buf *bufs, unsigned int max_bufs, u16 *head)
+{
+	unsigned int num = q->vring.num, n = 0;
+	struct vring_desc *desc;
+	u16 flags, idx;
+	u64 addr;
+	u32 len;
+
+	if (!vq_available(q))
+		return 0;
+	virt_rmb();
+
+	idx = vq16_to_cpu(READ_ONCE(q->vring.avail->ring[q->last_avail %
+							 num]));
+	*head = idx;
+	do {
+		if (idx >= num || n >= max_bufs)
+			goto err_broken;
+
+		desc = &q->vring.desc[idx];
+		addr = vq64_to_cpu(READ_ONCE(desc->addr));
+		len = vq32_to_cpu(READ_ONCE(desc->len));
+		flags = vq16_to_cpu(READ_ONCE(desc->flags));
+		idx = vq16_to_cpu(READ_ONCE(desc->next));
+
+		if (flags & VRING_DESC_F_INDIRECT ||
+		    !back_range_valid(back, addr, len))
+			goto err_broken;
+
+		bufs[n].addr = (void *)back->header + addr;
+		bufs[n].len = len;
+		bufs[n].writable = flags & VRING_DESC_F_WRITE;
+		n++;
+	} while (flags & VRING_DESC_F_NEXT);
+
+	q->last_avail++;
+	return n;
+
+err_broken:
+	dev_err_ratelimited(&back->pdev->dev, "malformed descriptor chain\n");
+	q->broken = true;
+	return 0;
+}
+
+static void vq_push(struct back_queue *q, u16 head, u32 len)
+{
+	struct vring_used_elem *used =
+		&q->vring.used->ring[q->used_idx % q->vring.num];
+
+	used->id = cpu_to_vq32(head);
+	used->len = cpu_to_vq32(len);
+	virt_wmb();
+	q->used_idx++;
+	WRITE_ONCE(q->vring.used->idx, cpu_to_vq16(q->used_idx));
+}
+
+static void vq_signal(struct virtio_back *back, struct back_queue *q)
+{
+	/* order the used index update against reading the flags */
+	virt_mb();
+	if (!(vq16_to_cpu(READ_ONCE(q->vring.avail->flags)) &
+	      VRING_AVAIL_F_NO_INTERRUPT))
+		back_kick(back);
+}
+
+static void net_receive(struct back_net *net, struct back_buf *bufs,
+			unsigned int num)
+{
+	struct net_device *netdev = net->netdev;
+	unsigned int hdr_len = sizeof(struct virtio_net_hdr_v1);
+	unsigned int total = 0, skip = hdr_len, n, chunk;
+	struct sk_buff *skb;
+
+	for (n = 0; n < num; n++) {
+		if (bufs[n].writable) {
+			netdev->stats.rx_errors++;
+			return;
+		}
+		total += bufs[n].len;
+	}
+	if (total <= hdr_len ||
+	    total - hdr_len > netdev->mtu + ETH_HLEN + VLAN_HLEN) {
+		netdev->stats.rx_length_errors++;
+		return;
+	}
+
+	skb = napi_alloc_skb(&net->napi, total - hdr_len);
+	if (!skb) {
+		netdev->stats.rx_dropped++;
+		return;
+	}
+
+	for (n = 0; n < num; n++) {
+		if (bufs[n].len <= skip) {
+			skip -= bufs[n].len;
+			continue;
+		}
+		chunk = bufs[n].len - skip;
+		memcpy(skb_put(skb, chunk), bufs[n].addr + skip, chunk);
+		skip = 0;
+	}
+
+	skb->protocol = eth_type_trans(skb, netdev);
+	netdev->stats.rx_packets++;
+	netdev->stats.rx_bytes += skb->len;
+	napi_gro_receive(&net->napi, skb);
+}
+
+static int net_poll(struct napi_struct *napi, int budget)
+{
+	struct back_net *net = container_of(napi, struct back_net, napi);
+	struct virtio_back *back = net->back;
+	struct back_queue *txq = &back->queues[NET_QUEUE_TX];
+	int received = 0, num;
+	u16 head;
+
+	while (received < budget) {
+		num = vq_pop(back, txq, net->bufs, NET_MAX_BUFS, &head);
+		if (num == 0)
+			break;
+		net_receive(net, net->bufs, num);
+		vq_push(txq, head, 0);
+		received++;
+	}
+	if (received > 0)
+		vq_signal(back, txq);
+
+	if (netif_queue_stopped(net->netdev) &&
+	    vq_available(&back->queues[NET_QUEUE_RX]))
+		netif_wake_queue(net->netdev);
+
+	if (received < budget) {
+		napi_complete_done(napi, received);
+		/* catch kicks that raced with the completion */
+		if (vq_available(txq))
+			napi_schedule(napi);
+	}
+	return received;
+}
+
+static int net_fill(struct back_buf *bufs, unsigned int num, const void *hdr,
+		    unsigned int hdr_len, struct sk_buff *skb)
+{
+	unsigned int total = hdr_len + skb->len, done = 0, n, off, chunk;
+
+	for (n = 0; n < num && done < total; n++) {
+		if (!bufs[n].writable)
+			return -EINVAL;
+		for (off = 0; off < bufs[n].len && done < total;
+		     off += chunk, done += chunk) {
+			if (done < hdr_len) {
+				chunk = min(bufs[n].len - off, hdr_len - done);
+				memcpy(bufs[n].addr + off, hdr + done, chunk);
+			} else {
+				chunk = min(bufs[n].len - off, total - done);
+				skb_copy_bits(skb, done - hdr_len,
+					      bufs[n].addr + off, chunk);
+			}
+		}
+	}
+	return done == total ? total : -ENOSPC;
+}
+
+static netdev_tx_t net_start_xmit(struct sk_buff *skb,
+				  struct net_device *netdev)
+{
+	struct back_net *net = netdev_priv(netdev);
+	struct virtio_back *back = net->back;
+	struct back_queue *rxq = &back->queues[NET_QUEUE_RX];
+	struct virtio_net_hdr_v1 hdr = {
+		.num_buffers = cpu_to_vq16(1),
+	};
+	int num, len;
+	u16 head;
+
+	num = READ_ONCE(back->running) ?
+		vq_pop(back, rxq, net->bufs, NET_MAX_BUFS, &head) : 0;
+	if (num == 0) {
+		netdev->stats.tx_dropped++;
+		goto out;
+	}
+
+	len = net_fill(net->bufs, num, &hdr, sizeof(hdr), skb);
+	if (len < 0) {
+		netdev->stats.tx_errors++;
+		len = 0;
+	} else {
+		netdev->stats.tx_packets++;
+		netdev->stats.tx_bytes += skb->len;
+	}
+	vq_push(rxq, head, len);
+	vq_signal(back, rxq);
+
+out:
+	dev_kfree_skb_any(skb);
+
+	if (!vq_available(rxq)) {
+		netif_stop_queue(netdev);
+		/* the front-end may have refilled while we stopped */
+		virt_mb();
+		if (vq_available(rxq))
+			netif_wake_queue(netdev);
+	}
+	return NETDEV_TX_OK;
+}
+
+static int net_open(struct net_device *netdev)
+{
+	netif_start_queue(netdev);
+	return 0;
+}
+
+static int net_stop(struct net_device *netdev)
+{
+	netif_stop_queue(netdev);
+	return 0;
+}
+
+static const struct net_device_ops net_ops = {
+	.ndo_open		= net_open,
+	.ndo_stop		= net_stop,
+	.ndo_start_xmit		= net_start_xmit,
+	.ndo_set_mac_address	= eth_mac_addr,
+	.ndo_validate_addr	= eth_validate_addr,
+};
+
+static int net_init(struct virtio_back *back)
+{
+	struct virtio_net_config *config =
+		(struct virtio_net_config *)back->header->device.config;
+	struct net_device *netdev;
+	struct back_net *net;
+	int err;
+
+	netdev = alloc_netdev(sizeof(*net), "jhvnet%d", NET_NAME_ENUM,
+			      ether_setup);
+	if (!netdev)
+		return -ENOMEM;
+
+	net = netdev_priv(netdev);
+	net->back = back;
+	net->netdev = netdev;
+	back->priv = net;
+
+	SET_NETDEV_DEV(netdev, &back->pdev->dev);
+	netdev->netdev_ops = &net_ops;
+	eth_hw_addr_random(netdev);
+	back_napi_add(netdev, &net->napi, net_poll);
+	netif_carrier_off(netdev);
+
+	eth_random_addr(config->mac);
+
+	err = register_netdev(netdev);
+	if (err) {
+		netif_napi_del(&net->napi);
+		free_netdev(netdev);
+	}
+	return err;
+}
+
+static void net_exit(struct virtio_back *back)
+{
+	struct back_net *net = back->priv;
+
+	unregister_netdev(net->netdev);
+	netif_napi_del(&net->napi);
+	free_netdev(net->netdev);
+}
+
+static void net_start(struct virtio_back *back)
+{
+	struct back_net *net = back->priv;
+
+	napi_enable(&net->napi);
+	netif_carrier_on(net->netdev);
+	if (netif_running(net->netdev))
+		netif_wake_queue(net->netdev);
+	/* pick up frames queued before we were running */
+	napi_schedule(&net->napi);
+}
+
+static void net_stop_device(struct virtio_back *back)
+{
+	struct back_net *net = back->priv;
+
+	netif_carrier_off(net->netdev);
+	netif_tx_disable(net->netdev);
+	napi_disable(&net->napi);
+}
+
+static void net_notify(struct virtio_back *back)
+{
+	struct back_net *net = back->priv;
+
+	napi_schedule(&net->napi);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,14,0)
+static ssize_t blk_file_read(struct file *file, void *buf, size_t count,
+			     loff_t *pos)
+{
+	ssize_t ret = kernel_read(file, *pos, buf, count);
+
+	if (ret > 0)
+		*pos += ret;
+	return ret;
+}
+
+static ssize_t blk_file_write(struct file *file, const void *buf,
+			      size_t count, loff_t *pos)
+{
+	ssize_t ret = kernel_write(file, buf, count, *pos);
+
+	if (ret > 0)
+		*pos += ret;
+	return ret;
+}
+#else
+#define blk_file_read(file, buf, count, pos)	\
+	kernel_read(file, buf, count, pos)
+#define blk_file_write(file, buf, count, pos)	\
+	kernel_write(file, buf, count, pos)
+#endif
+
+/* Returns the number of bytes written to the front-end. */
+static u32 blk_handle(struct back_blk *blk, struct back_buf *bufs,
+		      unsigned int num)
+{
+	struct back_buf *status = &bufs[num - 1];
+	struct virtio_blk_outhdr hdr;
+	u8 result = VIRTIO_BLK_S_OK;
+	u32 written = 0;
+	unsigned int n;
+	loff_t pos;
+	u64 sectors;
+	ssize_t ret;
+
+	if (num < 2 || bufs[0].writable || bufs[0].len < sizeof(hdr) ||
+	    !status->writable || status->len < 1)
+		return 0;
+
+	memcpy(&hdr, bufs[0].addr, sizeof(hdr));
+	pos = vq64_to_cpu(hdr.sector) << BLK_SECTOR_SHIFT;
+
+	switch (vq32_to_cpu(hdr.type)) {
+	case VIRTIO_BLK_T_IN:
+	case VIRTIO_BLK_T_OUT:
+		for (n = 1, sectors = 0; n < num - 1; n++)
+			sectors += bufs[n].len >> BLK_SECTOR_SHIFT;
+		if (vq64_to_cpu(hdr.sector) > blk->capacity ||
+		    sectors > blk->capacity - vq64_to_cpu(hdr.sector)) {
+			result = VIRTIO_BLK_S_IOERR;
+			break;
+		}
+		for (n = 1; n < num - 1; n++) {
+			if (vq32_to_cpu(hdr.type) == VIRTIO_BLK_T_IN) {
+				if (!bufs[n].writable) {
+					result = VIRTIO_BLK_S_IOERR;
+					break;
+				}
+				ret = blk_file_read(blk->file, bufs[n].addr,
+						    bufs[n].len, &pos);
+				written += bufs[n].len;
+			} else {
+				ret = blk_file_write(blk->file, bufs[n].addr,
+						     bufs[n].len, &pos);
+			}
+			if (ret != bufs[n].len) {
+				result = VIRTIO_BLK_S_IOERR;
+				break;
+			}
+		}
+		break;
+	case VIRTIO_BLK_T_FLUSH:
+		if (vfs_fsync(blk->file, 0))
+			result = VIRTIO_BLK_S_IOERR;
+		break;
+	case VIRTIO_BLK_T_GET_ID:
+		if (num < 3 || !bufs[1].writable) {
+			result = VIRTIO_BLK_S_IOERR;
+			break;
+		}
+		written = min_t(u32, bufs[1].len, VIRTIO_BLK_ID_BYTES);
+		snprintf(bufs[1].addr, written, "jailhouse-vblk%d", blk->id);
+		break;
+	default:
+		result = VIRTIO_BLK_S_UNSUPP;
+		break;
+	}
+
+	*(u8 *)status->addr = result;
+	return written + 1;
+}
+
+static void blk_work(struct work_struct *work)
+{
+	struct back_blk *blk = container_of(work, struct back_blk, work);
+	struct virtio_back *back = blk->back;
+	struct back_queue *q = &back->queues[0];
+	bool completed = false;
+	int num;
+	u16 head;
+
+	while (READ_ONCE(back->running)) {
+		num = vq_pop(back, q, blk->bufs, BLK_MAX_BUFS, &head);
+		if (num == 0)
+			break;
+		vq_push(q, head, blk_handle(blk, blk->bufs, num));
+		completed = true;
+	}
+	if (completed)
+		vq_signal(back, q);
+}
+
+static int blk_init(struct virtio_back *back)
+{
+	struct virtio_blk_config *config =
+		(struct virtio_blk_config *)back->header->device.config;
+	struct device *dev = &back->pdev->dev;
+	struct back_blk *blk;
+	int err;
+
+	blk = devm_kzalloc(dev, sizeof(*blk), GFP_KERNEL);
+	if (!blk)
+		return -ENOMEM;
+
+	blk->back = back;
+	INIT_WORK(&blk->work, blk_work);
+
+	blk->id = ida_simple_get(&blk_ida, 0, 0, GFP_KERNEL);
+	if (blk->id < 0)
+		return blk->id;
+
+	if (blk->id >= num_block_files || !block_files[blk->id]) {
+		dev_err(dev, "no backing file for block device %d\n", blk->id);
+		err = -ENODEV;
+		goto err_free_id;
+	}
+
+	blk->file = filp_open(block_files[blk->id], O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(blk->file)) {
+		blk->file = filp_open(block_files[blk->id],
+				      O_RDONLY | O_LARGEFILE, 0);
+		if (IS_ERR(blk->file)) {
+			err = PTR_ERR(blk->file);
+			goto err_free_id;
+		}
+		back->features |= 1ULL << VIRTIO_BLK_F_RO;
+	}
+
+	blk->capacity = i_size_read(file_inode(blk->file)) >> BLK_SECTOR_SHIFT;
+	config->capacity = cpu_to_vq64(blk->capacity);
+	config->seg_max = cpu_to_vq32(min(back->queue_size,
+					  (unsigned int)BLK_MAX_BUFS) - 2);
+	back->priv = blk;
+
+	dev_info(dev, "block device %d backed by %s, %llu sectors\n", blk->id,
+		 block_files[blk->id], blk->capacity);
+	return 0;
+
+err_free_id:
+	ida_simple_remove(&blk_ida, blk->id);
+	return err;
+}
+
+static void blk_exit(struct virtio_back *back)
+{
+	struct back_blk *blk = back->priv;
+
+	filp_close(blk->file, NULL);
+	ida_simple_remove(&blk_ida, blk->id);
+}
+
+static void blk_start(struct virtio_back *back)
+{
+	struct back_blk *blk = back->priv;
+
+	schedule_work(&blk->work);
+}
+
+static void blk_stop(struct virtio_back *back)
+{
+	struct back_blk *blk = back->priv;
+
+	cancel_work_sync(&blk->work);
+}
+
+static void blk_notify(struct virtio_back *back)
+{
+	struct back_blk *blk = back->priv;
+
+	schedule_work(&blk->work);
+}
+
+static const struct back_device back_devices[] = {
+	{
+		.device_id	= VIRTIO_ID_NET,
+		.name		= "network",
+		.num_queues	= 2,
+		.features	= 1ULL << VIRTIO_NET_F_MAC,
+		.init		= net_init,
+		.exit		= net_exit,
+		.start		= net_start,
+		.stop		= net_stop_device,
+		.notify		= net_notify,
+	},
+	{
+		.device_id	= VIRTIO_ID_BLOCK,
+		.name		= "block",
+		.num_queues	= 1,
+		.features	= (1ULL << VIRTIO_BLK_F_SEG_MAX) |
+				  (1ULL << VIRTIO_BLK_F_FLUSH),
+		.init		= blk_init,
+		.exit		= blk_exit,
+		.start		= blk_start,
+		.stop		= blk_stop,
+		.notify		= blk_notify,
+	},
+};
+
+static int back_start(struct virtio_back *back)
+{
+	u64 required = (1ULL << VIRTIO_F_VERSION_1) |
+		(1ULL << VIRTIO_F_ACCESS_PLATFORM);
+	u64 features = back->header->driver.features;
+	struct back_queue *q;
+	unsigned int n;
+
+	if ((features & ~back->features) || (features & required) != required)
+		return -EINVAL;
+
+	for (n = 0; n < back->device->num_queues; n++) {
+		q = &back->queues[n];
+		vring_init(&q->vring, back->queue_size,
+			   (void *)back->header + back->queue_offset[n],
+			   JAILHOUSE_VIRTIO_VRING_ALIGN);
+		q->last_avail = 0;
+		q->used_idx = 0;
+		q->broken = false;
+	}
+
+	WRITE_ONCE(back->running, true);
+	back->device->start(back);
+	return 0;
+}
+
+static void back_stop(struct virtio_back *back)
+{
+	if (!back->running)
+		return;
+
+	WRITE_ONCE(back->running, false);
+	back->device->stop(back);
+}
+
+static void back_status_work(struct work_struct *work)
+{
+	struct virtio_back *back =
+		container_of(work, struct virtio_back, status_work);
+	u8 status;
+
+	mutex_lock(&back->status_lock);
+
+	status = back->header->driver.status;
+	if (status == back->status)
+		goto out;
+	virt_rmb();
+
+	if (!(status & VIRTIO_CONFIG_S_DRIVER_OK) ||
+	    status & VIRTIO_CONFIG_S_FAILED)
+		back_stop(back);
+	else if (!back->running && back_start(back) < 0)
+		status |= VIRTIO_CONFIG_S_NEEDS_RESET;
+
+	back->status = status;
+	virt_wmb();
+	back->header->device.status = status;
+	back_kick(back);
+
+out:
+	mutex_unlock(&back->status_lock);
+}
+
+static irqreturn_t back_irq_handler(int irq, void *data)
+{
+	struct virtio_back *back = data;
+
+	if (back->header->driver.status != back->status)
+		schedule_work(&back->status_work);
+	if (READ_ONCE(back->running))
+		back->device->notify(back);
+
+	return IRQ_HANDLED;
+}
+
+static int back_format(struct virtio_back *back)
+{
+	struct jailhouse_virtio_header *header = back->header;
+	unsigned long ring_size, offset;
+	unsigned int n;
+
+	if (!is_power_of_2(queue_size) ||
+	    queue_size > JAILHOUSE_VIRTIO_MAX_QUEUE_SIZE)
+		return -EINVAL;
+	back->queue_size = queue_size;
+
+	ring_size = ALIGN(vring_size(queue_size, JAILHOUSE_VIRTIO_VRING_ALIGN),
+			  JAILHOUSE_VIRTIO_VRING_ALIGN);
+	offset = ALIGN(sizeof(*header), JAILHOUSE_VIRTIO_VRING_ALIGN);
+	for (n = 0; n < back->device->num_queues; n++) {
+		back->queue_offset[n] = offset;
+		offset += ring_size;
+	}
+	back->buffer_offset = ALIGN(offset, PAGE_SIZE);
+	if (back->buffer_offset + BUFFER_ALIGN > back->shmem_size)
+		return -ENOSPC;
+	back->buffer_size = back->shmem_size - back->buffer_offset;
+	back->features = back->device->features |
+		(1ULL << VIRTIO_F_VERSION_1) |
+		(1ULL << VIRTIO_F_ACCESS_PLATFORM);
+
+	memset(header, 0, sizeof(*header));
+	header->revision = JAILHOUSE_VIRTIO_REVISION;
+	header->device_id = back->device->device_id;
+	header->num_queues = back->device->num_queues;
+	header->queue_size = back->queue_size;
+	memcpy(header->queue_offset, back->queue_offset,
+	       sizeof(header->queue_offset));
+	header->buffer_offset = back->buffer_offset;
+	header->buffer_size = back->buffer_size;
+	return 0;
+}
+
+static int back_probe(struct pci_dev *pdev, const struct pci_device_id *id)
+{
+	u32 device_id = pdev->class & BACK_DEVICE_ID_MASK;
+	struct virtio_back *back;
+	resource_size_t shmem_addr;
+	u32 lo, hi, ivpos;
+	unsigned int n;
+	int err;
+
+	back = devm_kzalloc(&pdev->dev, sizeof(*back), GFP_KERNEL);
+	if (!back)
+		return -ENOMEM;
+
+	back->pdev = pdev;
+	mutex_init(&back->status_lock);
+	INIT_WORK(&back->status_work, back_status_work);
+
+	for (n = 0; n < ARRAY_SIZE(back_devices); n++)
+		if (back_devices[n].device_id == device_id)
+			back->device = &back_devices[n];
+	if (!back->device) {
+		dev_err(&pdev->dev, "unsupported virtio device %u\n",
+			device_id);
+		return -ENODEV;
+	}
+
+	err = pci_enable_device(pdev);
+	if (err)
+		return err;
+
+	err = pci_request_regions(pdev, DRV_NAME);
+	if (err)
+		goto err_disable;
+
+	back->registers = pci_iomap(pdev, 0, 0);
+	if (!back->registers) {
+		err = -ENOMEM;
+		goto err_release;
+	}
+
+	ivpos = readl(back->registers + IVSHMEM_REG_IVPOS);
+	if (ivpos > 1) {
+		dev_err(&pdev->dev, "only links between two peers supported\n");
+		err = -ENODEV;
+		goto err_unmap_regs;
+	}
+	back->peer = 1 - ivpos;
+
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_PTR, &lo);
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_PTR + 4, &hi);
+	shmem_addr = ((u64)hi << 32) | lo;
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_SZ, &lo);
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_SZ + 4, &hi);
+	back->shmem_size = ((u64)hi << 32) | lo;
+
+	back->header = memremap(shmem_addr, back->shmem_size, MEMREMAP_WB);
+	if (!back->header) {
+		err = -ENOMEM;
+		goto err_unmap_regs;
+	}
+
+	err = back_format(back);
+	if (err) {
+		dev_err(&pdev->dev,
+			"cannot place %u queues of %u descriptors\n",
+			back->device->num_queues, queue_size);
+		goto err_unmap_shmem;
+	}
+
+	err = back->device->init(back);
+	if (err)
+		goto err_unmap_shmem;
+	back->header->device_features = back->features;
+
+	back->msix.entry = 0;
+	err = pci_enable_msix_range(pdev, &back->msix, 1, 1);
+	if (err < 0)
+		goto err_exit_device;
+
+	err = request_irq(back->msix.vector, back_irq_handler, 0, DRV_NAME,
+			  back);
+	if (err)
+		goto err_disable_msix;
+
+	pci_set_master(pdev);
+	pci_set_drvdata(pdev, back);
+
+	/* publish the layout and let a waiting front-end attach */
+	virt_wmb();
+	back->header->magic = JAILHOUSE_VIRTIO_MAGIC;
+	back_kick(back);
+
+	dev_info(&pdev->dev,
+		 "virtio %s back-end, %u queues of %u descriptors\n",
+		 back->device->name, back->device->num_queues,
+		 back->queue_size);
+	return 0;
+
+err_disable_msix:
+	pci_disable_msix(pdev);
+err_exit_device:
+	back->device->exit(back);
+err_unmap_shmem:
+	memunmap(back->header);
+err_unmap_regs:
+	pci_iounmap(pdev, back->registers);
+err_release:
+	pci_release_regions(pdev);
+err_disable:
+	pci_disable_device(pdev);
+	return err;
+}
+
+static void back_remove(struct pci_dev *pdev)
+{
+	struct virtio_back *back = pci_get_drvdata(pdev);
+
+	back->header->magic = 0;
+	free_irq(back->msix.vector, back);
+	cancel_work_sync(&back->status_work);
+	back_stop(back);
+	back->device->exit(back);
+	pci_disable_msix(pdev);
+	memunmap(back->header);
+	pci_iounmap(pdev, back->registers);
+	pci_release_regions(pdev);
+	pci_disable_device(pdev);
+}
+
+static const struct pci_device_id back_ids[] = {
+	{
+		PCI_DEVICE(0x1af4, 0x1110),
+		.class = (PCI_CLASS_OTHERS << 16) |
+			 JAILHOUSE_SHMEM_PROTO_VIRTIO_BACK,
+		.class_mask = 0xffc000,
+	},
+	{ 0 }
+};
+MODULE_DEVICE_TABLE(pci, back_ids);
+
+static struct pci_driver back_driver = {
+	.name		= DRV_NAME,
+	.id_table	= back_ids,
+	.probe		= back_probe,
+	.remove		= back_remove,
+};
+
+module_pci_driver(back_driver);
+
+MODULE_DESCRIPTION("virtio back-end on Jailhouse ivshmem devices");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,683 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/*
+ * virtio front-end on top of a Jailhouse ivshmem link between two cells.
+ * The back-end in the peer cell formats the shared memory, see
+ * jailhouse/virtio-ivshmem.h, and the regular virtio drivers then bind to
+ * the device it announces. As the back-end can only access the shared
+ * memory, a private set of DMA operations bounces all buffers through the
+ * buffer area of the link.
+ */
+
+#include <linux/delay.h>
+#include <linux/genalloc.h>
+#include <linux/highmem.h>
+#include <linux/interrupt.h>
+#include <linux/io.h>
+#include <linux/module.h>
+#include <linux/pci.h>
+#include <linux/scatterlist.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/virtio.h>
+#include <linux/virtio_config.h>
+#include <linux/virtio_ring.h>
+#include <linux/workqueue.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
+#include <linux/dma-map-ops.h>
+#else
+#include <linux/dma-mapping.h>
+#endif
+
+#include <jailhouse/cell-config.h>
+#include <jailhouse/virtio-ivshmem.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,8,0)
+#error virtio over ivshmem requires Linux 4.8 or later
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0) && defined(CONFIG_X86)
+#define set_dma_ops(dev, ops)		((dev)->archdata.dma_ops = (ops))
+#endif
+
+#ifndef VIRTIO_F_ACCESS_PLATFORM
+#define VIRTIO_F_ACCESS_PLATFORM	VIRTIO_F_IOMMU_PLATFORM
+#endif
+
+#ifndef DMA_MAPPING_ERROR
+#define DMA_MAPPING_ERROR		(~(dma_addr_t)0)
+#endif
+
+#define DRV_NAME			"jailhouse-virtio-front"
+
+#define IVSHMEM_CFG_SHMEM_PTR		0x40
+#define IVSHMEM_CFG_SHMEM_SZ		0x48
+
+#define IVSHMEM_REG_IVPOS		8
+#define IVSHMEM_REG_DBELL		12
+
+#define BOUNCE_ORDER			9
+
+#define RESET_TIMEOUT_MS		1000
+
+struct virtio_front {
+	struct virtio_device vdev;
+	struct pci_dev *pdev;
+	void __iomem *registers;
+	struct jailhouse_virtio_header *header;
+	resource_size_t shmem_size;
+	u32 peer;
+	struct msix_entry msix;
+	struct work_struct attach_work;
+	bool attached;
+	bool registered;
+	/* bounce buffers and the original buffer of each chunk */
+	struct gen_pool *buffers;
+	void *buffer_base;
+	phys_addr_t *bounce_orig;
+	/* protects vqs and num_vqs against the interrupt handler */
+	spinlock_t vqs_lock;
+	struct virtqueue *vqs[JAILHOUSE_VIRTIO_MAX_QUEUES];
+	unsigned int num_vqs;
+	u32 config_generation;
+};
+
+static inline struct virtio_front *to_front(struct virtio_device *vdev)
+{
+	return container_of(vdev, struct virtio_front, vdev);
+}
+
+static void front_kick(struct virtio_front *front)
+{
+	writel(front->peer << 16, front->registers + IVSHMEM_REG_DBELL);
+}
+
+static void bounce_copy(void *bounce, phys_addr_t orig, size_t size,
+			bool to_bounce)
+{
+	unsigned long pfn = PFN_DOWN(orig);
+	unsigned long offset = offset_in_page(orig);
+	size_t chunk;
+	char *vaddr;
+
+	while (size > 0) {
+		chunk = min_t(size_t, PAGE_SIZE - offset, size);
+		vaddr = kmap_atomic(pfn_to_page(pfn));
+		if (to_bounce)
+			memcpy(bounce, vaddr + offset, chunk);
+		else
+			memcpy(vaddr + offset, bounce, chunk);
+		kunmap_atomic(vaddr);
+
+		bounce += chunk;
+		size -= chunk;
+		offset = 0;
+		pfn++;
+	}
+}
+
+static struct virtio_front *dev_to_front(struct device *dev)
+{
+	return pci_get_drvdata(to_pci_dev(dev));
+}
+
+static phys_addr_t *bounce_slot(struct virtio_front *front, void *bounce)
+{
+	return &front->bounce_orig[(bounce - front->buffer_base) >>
+				   BOUNCE_ORDER];
+}
+
+static dma_addr_t front_map_page(struct device *dev, struct page *page,
+				 unsigned long offset, size_t size,
+				 enum dma_data_direction dir,
+				 unsigned long attrs)
+{
+	struct virtio_front *front = dev_to_front(dev);
+	phys_addr_t orig = page_to_phys(page) + offset;
+	void *bounce;
+
+	bounce = (void *)gen_pool_alloc(front->buffers, size);
+	if (!bounce)
+		return DMA_MAPPING_ERROR;
+
+	*bounce_slot(front, bounce) = orig;
+	if (dir == DMA_TO_DEVICE || dir == DMA_BIDIRECTIONAL)
+		bounce_copy(bounce, orig, size, true);
+
+	return bounce - (void *)front->header;
+}
+
+static void front_unmap_page(struct device *dev, dma_addr_t dma_addr,
+			     size_t size, enum dma_data_direction dir,
+			     unsigned long attrs)
+{
+	struct virtio_front *front = dev_to_front(dev);
+	void *bounce = (void *)front->header + dma_addr;
+
+	if (dir == DMA_FROM_DEVICE || dir == DMA_BIDIRECTIONAL)
+		bounce_copy(bounce, *bounce_slot(front, bounce), size, false);
+
+	gen_pool_free(front->buffers, (unsigned long)bounce, size);
+}
+
+static int front_map_sg(struct device *dev, struct scatterlist *sgl,
+			int nents, enum dma_data_direction dir,
+			unsigned long attrs)
+{
+	struct scatterlist *sg, *mapped;
+	int n, m;
+
+	for_each_sg(sgl, sg, nents, n) {
+		sg->dma_address = front_map_page(dev, sg_page(sg), sg->offset,
+						 sg->length, dir, attrs);
+		if (sg->dma_address == DMA_MAPPING_ERROR)
+			goto err_unmap;
+		sg_dma_len(sg) = sg->length;
+	}
+	return nents;
+
+err_unmap:
+	for_each_sg(sgl, mapped, n, m)
+		front_unmap_page(dev, mapped->dma_address, sg_dma_len(mapped),
+				 dir, attrs);
+	return 0;
+}
+
+static void front_unmap_sg(struct device *dev, struct scatterlist *sgl,
+			   int nents, enum dma_data_direction dir,
+			   unsigned long attrs)
+{
+	struct scatterlist *sg;
+	int n;
+
+	for_each_sg(sgl, sg, nents, n)
+		front_unmap_page(dev, sg->dma_address, sg_dma_len(sg), dir,
+				 attrs);
+}
+
+static void *front_alloc(struct device *dev, size_t size,
+			 dma_addr_t *dma_handle, gfp_t gfp,
+			 unsigned long attrs)
+{
+	struct virtio_front *front = dev_to_front(dev);
+	void *vaddr;
+
+	vaddr = (void *)gen_pool_alloc(front->buffers, size);
+	if (!vaddr)
+		return NULL;
+
+	memset(vaddr, 0, size);
+	*dma_handle = vaddr - (void *)front->header;
+	return vaddr;
+}
+
+static void front_free(struct device *dev, size_t size, void *vaddr,
+		       dma_addr_t dma_handle, unsigned long attrs)
+{
+	gen_pool_free(dev_to_front(dev)->buffers, (unsigned long)vaddr, size);
+}
+
+static int front_dma_supported(struct device *dev, u64 mask)
+{
+	return 1;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,0,0)
+static int front_mapping_error(struct device *dev, dma_addr_t dma_addr)
+{
+	return dma_addr == DMA_MAPPING_ERROR;
+}
+#endif
+
+static const struct dma_map_ops front_dma_ops = {
+	.alloc		= front_alloc,
+	.free		= front_free,
+	.map_page	= front_map_page,
+	.unmap_page	= front_unmap_page,
+	.map_sg		= front_map_sg,
+	.unmap_sg	= front_unmap_sg,
+	.dma_supported	= front_dma_supported,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,0,0)
+	.mapping_error	= front_mapping_error,
+#endif
+};
+
+static void front_get(struct virtio_device *vdev, unsigned int offset,
+		      void *buf, unsigned int len)
+{
+	struct virtio_front *front = to_front(vdev);
+
+	if (offset + len > JAILHOUSE_VIRTIO_CONFIG_SIZE) {
+		memset(buf, 0, len);
+		return;
+	}
+	memcpy(buf, front->header->device.config + offset, len);
+}
+
+/* The configuration is owned by the back-end, writes are dropped. */
+static void front_set(struct virtio_device *vdev, unsigned int offset,
+		      const void *buf, unsigned int len)
+{
+}
+
+static u32 front_generation(struct virtio_device *vdev)
+{
+	return to_front(vdev)->header->device.config_generation;
+}
+
+static u8 front_get_status(struct virtio_device *vdev)
+{
+	return to_front(vdev)->header->driver.status;
+}
+
+static void front_set_status(struct virtio_device *vdev, u8 status)
+{
+	struct virtio_front *front = to_front(vdev);
+
+	/* make queue and feature updates visible before the status */
+	virt_wmb();
+	front->header->driver.status = status;
+	front_kick(front);
+}
+
+static void front_reset(struct virtio_device *vdev)
+{
+	struct virtio_front *front = to_front(vdev);
+	unsigned int timeout = RESET_TIMEOUT_MS;
+
+	front_set_status(vdev, 0);
+
+	/* the back-end must no longer touch the queues once we return */
+	while (front->header->device.status != 0) {
+		if (timeout-- == 0) {
+			dev_warn(&front->pdev->dev,
+				 "back-end did not acknowledge reset\n");
+			break;
+		}
+		msleep(1);
+	}
+	virt_rmb();
+}
+
+static u64 front_get_features(struct virtio_device *vdev)
+{
+	return to_front(vdev)->header->device_features;
+}
+
+static int front_finalize_features(struct virtio_device *vdev)
+{
+	struct virtio_front *front = to_front(vdev);
+
+	vring_transport_features(vdev);
+
+	if (!__virtio_test_bit(vdev, VIRTIO_F_VERSION_1) ||
+	    !__virtio_test_bit(vdev, VIRTIO_F_ACCESS_PLATFORM)) {
+		dev_err(&front->pdev->dev,
+			"back-end lacks VERSION_1 or ACCESS_PLATFORM\n");
+		return -EINVAL;
+	}
+
+	front->header->driver.features = vdev->features;
+	return 0;
+}
+
+static bool front_notify(struct virtqueue *vq)
+{
+	front_kick(to_front(vq->vdev));
+	return true;
+}
+
+static void front_del_vqs(struct virtio_device *vdev)
+{
+	struct virtio_front *front = to_front(vdev);
+	struct virtqueue *vqs[JAILHOUSE_VIRTIO_MAX_QUEUES];
+	unsigned int num_vqs, n;
+	unsigned long flags;
+
+	spin_lock_irqsave(&front->vqs_lock, flags);
+	num_vqs = front->num_vqs;
+	memcpy(vqs, front->vqs, sizeof(vqs));
+	memset(front->vqs, 0, sizeof(front->vqs));
+	front->num_vqs = 0;
+	spin_unlock_irqrestore(&front->vqs_lock, flags);
+
+	for (n = 0; n < num_vqs; n++)
+		if (vqs[n])
+			vring_del_virtqueue(vqs[n]);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
+static int front_find_vqs(struct virtio_device *vdev, unsigned int nvqs,
+			  struct virtqueue *vqs[], vq_callback_t *callbacks[],
+			  const char * const names[], const bool *ctx,
+			  struct irq_affinity *desc)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
+static int front_find_vqs(struct virtio_device *vdev, unsigned int nvqs,
+			  struct virtqueue *vqs[], vq_callback_t *callbacks[],
+			  const char * const names[], struct irq_affinity *desc)
+#else
+static int front_find_vqs(struct virtio_device *vdev, unsigned int nvqs,
+			  struct virtqueue *vqs[], vq_callback_t *callbacks[],
+			  const char * const names[])
+#endif
+{
+	struct virtio_front *front = to_front(vdev);
+	struct jailhouse_virtio_header *header = front->header;
+	unsigned long flags;
+	unsigned int n;
+	void *ring;
+
+	if (nvqs > header->num_queues)
+		return -ENOENT;
+
+	for (n = 0; n < nvqs; n++) {
+		vqs[n] = NULL;
+		if (!names[n])
+			continue;
+
+		ring = (void *)header + header->queue_offset[n];
+		memset(ring, 0, vring_size(header->queue_size,
+					   JAILHOUSE_VIRTIO_VRING_ALIGN));
+		vqs[n] = vring_new_virtqueue(n, header->queue_size,
+					     JAILHOUSE_VIRTIO_VRING_ALIGN,
+					     vdev, true,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
+					     ctx ? ctx[n] : false,
+#endif
+					     ring, front_notify, callbacks[n],
+					     names[n]);
+		if (!vqs[n])
+			goto err_del_vqs;
+
+		spin_lock_irqsave(&front->vqs_lock, flags);
+		front->vqs[n] = vqs[n];
+		front->num_vqs = n + 1;
+		spin_unlock_irqrestore(&front->vqs_lock, flags);
+	}
+	return 0;
+
+err_del_vqs:
+	front_del_vqs(vdev);
+	return -ENOMEM;
+}
+
+static const char *front_bus_name(struct virtio_device *vdev)
+{
+	return pci_name(to_front(vdev)->pdev);
+}
+
+static const struct virtio_config_ops front_config_ops = {
+	.get			= front_get,
+	.set			= front_set,
+	.generation		= front_generation,
+	.get_status		= front_get_status,
+	.set_status		= front_set_status,
+	.reset			= front_reset,
+	.find_vqs		= front_find_vqs,
+	.del_vqs		= front_del_vqs,
+	.get_features		= front_get_features,
+	.finalize_features	= front_finalize_features,
+	.bus_name		= front_bus_name,
+};
+
+/*
+ * No need to free anything here, the front-end state is device-managed by
+ * the ivshmem device and outlives the virtio device.
+ */
+static void front_release_dev(struct device *dev)
+{
+}
+
+static bool front_layout_valid(struct virtio_front *front)
+{
+	struct jailhouse_virtio_header *header = front->header;
+	unsigned long ring_size;
+	unsigned int n;
+
+	if (header->revision != JAILHOUSE_VIRTIO_REVISION ||
+	    header->num_queues == 0 ||
+	    header->num_queues > JAILHOUSE_VIRTIO_MAX_QUEUES ||
+	    !is_power_of_2(header->queue_size) ||
+	    header->queue_size > JAILHOUSE_VIRTIO_MAX_QUEUE_SIZE)
+		return false;
+
+	ring_size = vring_size(header->queue_size,
+			       JAILHOUSE_VIRTIO_VRING_ALIGN);
+	for (n = 0; n < header->num_queues; n++)
+		if (header->queue_offset[n] < sizeof(*header) ||
+		    header->queue_offset[n] % JAILHOUSE_VIRTIO_VRING_ALIGN ||
+		    header->queue_offset[n] > front->shmem_size - ring_size)
+			return false;
+
+	return header->buffer_offset >= sizeof(*header) &&
+		header->buffer_offset % (1 << BOUNCE_ORDER) == 0 &&
+		header->buffer_size >= (1 << BOUNCE_ORDER) &&
+		header->buffer_offset <= front->shmem_size &&
+		header->buffer_size <= front->shmem_size -
+				       header->buffer_offset;
+}
+
+static void front_attach(struct work_struct *work)
+{
+	struct virtio_front *front =
+		container_of(work, struct virtio_front, attach_work);
+	struct jailhouse_virtio_header *header = front->header;
+	struct device *dev = &front->pdev->dev;
+	int err;
+
+	if (front->attached || header->magic != JAILHOUSE_VIRTIO_MAGIC)
+		return;
+	virt_rmb();
+
+	if (!front_layout_valid(front)) {
+		dev_err_once(dev, "invalid virtio header\n");
+		return;
+	}
+
+	front->bounce_orig = vzalloc((header->buffer_size >> BOUNCE_ORDER) *
+				     sizeof(phys_addr_t));
+	if (!front->bounce_orig)
+		return;
+
+	front->buffer_base = (void *)header + header->buffer_offset;
+	err = gen_pool_add(front->buffers, (unsigned long)front->buffer_base,
+			   header->buffer_size, dev_to_node(dev));
+	if (err) {
+		vfree(front->bounce_orig);
+		front->bounce_orig = NULL;
+		return;
+	}
+	front->config_generation = header->device.config_generation;
+	front->attached = true;
+
+	front->vdev.dev.parent = dev;
+	front->vdev.dev.release = front_release_dev;
+	front->vdev.id.vendor = front->pdev->vendor;
+	front->vdev.id.device = header->device_id;
+	front->vdev.config = &front_config_ops;
+
+	err = register_virtio_device(&front->vdev);
+	if (err) {
+		dev_err(dev, "failed to register virtio device %u: %d\n",
+			header->device_id, err);
+		return;
+	}
+	front->registered = true;
+
+	dev_info(dev, "virtio device %u, %u queues of %u descriptors\n",
+		 header->device_id, header->num_queues, header->queue_size);
+}
+
+static irqreturn_t front_irq_handler(int irq, void *data)
+{
+	struct virtio_front *front = data;
+	u32 generation;
+	unsigned int n;
+
+	if (!front->attached) {
+		schedule_work(&front->attach_work);
+		return IRQ_HANDLED;
+	}
+
+	generation = front->header->device.config_generation;
+	if (generation != front->config_generation) {
+		front->config_generation = generation;
+		if (front->registered)
+			virtio_config_changed(&front->vdev);
+	}
+
+	spin_lock(&front->vqs_lock);
+	for (n = 0; n < front->num_vqs; n++)
+		if (front->vqs[n])
+			vring_interrupt(irq, front->vqs[n]);
+	spin_unlock(&front->vqs_lock);
+
+	return IRQ_HANDLED;
+}
+
+static int front_probe(struct pci_dev *pdev, const struct pci_device_id *id)
+{
+	struct virtio_front *front;
+	resource_size_t shmem_addr;
+	u32 lo, hi, ivpos;
+	int err;
+
+	front = devm_kzalloc(&pdev->dev, sizeof(*front), GFP_KERNEL);
+	if (!front)
+		return -ENOMEM;
+
+	front->pdev = pdev;
+	spin_lock_init(&front->vqs_lock);
+	INIT_WORK(&front->attach_work, front_attach);
+
+	front->buffers = devm_gen_pool_create(&pdev->dev, BOUNCE_ORDER,
+					      dev_to_node(&pdev->dev), NULL);
+	if (IS_ERR_OR_NULL(front->buffers))
+		return -ENOMEM;
+
+	err = pci_enable_device(pdev);
+	if (err)
+		return err;
+
+	err = pci_request_regions(pdev, DRV_NAME);
+	if (err)
+		goto err_disable;
+
+	front->registers = pci_iomap(pdev, 0, 0);
+	if (!front->registers) {
+		err = -ENOMEM;
+		goto err_release;
+	}
+
+	ivpos = readl(front->registers + IVSHMEM_REG_IVPOS);
+	if (ivpos > 1) {
+		dev_err(&pdev->dev, "only links between two peers supported\n");
+		err = -ENODEV;
+		goto err_unmap_regs;
+	}
+	front->peer = 1 - ivpos;
+
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_PTR, &lo);
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_PTR + 4, &hi);
+	shmem_addr = ((u64)hi << 32) | lo;
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_SZ, &lo);
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_SZ + 4, &hi);
+	front->shmem_size = ((u64)hi << 32) | lo;
+
+	if (front->shmem_size < sizeof(struct jailhouse_virtio_header)) {
+		dev_err(&pdev->dev, "shared memory too small\n");
+		err = -EINVAL;
+		goto err_unmap_regs;
+	}
+
+	front->header = memremap(shmem_addr, front->shmem_size, MEMREMAP_WB);
+	if (!front->header) {
+		err = -ENOMEM;
+		goto err_unmap_regs;
+	}
+
+	err = dma_set_mask_and_coherent(&pdev->dev, DMA_BIT_MASK(64));
+	if (err)
+		goto err_unmap_shmem;
+	set_dma_ops(&pdev->dev, &front_dma_ops);
+
+	front->msix.entry = 0;
+	err = pci_enable_msix_range(pdev, &front->msix, 1, 1);
+	if (err < 0)
+		goto err_unmap_shmem;
+
+	pci_set_drvdata(pdev, front);
+
+	err = request_irq(front->msix.vector, front_irq_handler, 0, DRV_NAME,
+			  front);
+	if (err)
+		goto err_disable_msix;
+
+	pci_set_master(pdev);
+
+	/* the back-end may have formatted the link before we came up */
+	schedule_work(&front->attach_work);
+
+	return 0;
+
+err_disable_msix:
+	pci_disable_msix(pdev);
+err_unmap_shmem:
+	memunmap(front->header);
+err_unmap_regs:
+	pci_iounmap(pdev, front->registers);
+err_release:
+	pci_release_regions(pdev);
+err_disable:
+	pci_disable_device(pdev);
+	return err;
+}
+
+static void front_remove(struct pci_dev *pdev)
+{
+	struct virtio_front *front = pci_get_drvdata(pdev);
+
+	/* virtio drivers may wait for completions, keep the interrupt */
+	if (front->registered)
+		unregister_virtio_device(&front->vdev);
+
+	free_irq(front->msix.vector, front);
+	cancel_work_sync(&front->attach_work);
+	vfree(front->bounce_orig);
+	pci_disable_msix(pdev);
+	memunmap(front->header);
+	pci_iounmap(pdev, front->registers);
+	pci_release_regions(pdev);
+	pci_disable_device(pdev);
+}
+
+static const struct pci_device_id front_ids[] = {
+	{
+		PCI_DEVICE(0x1af4, 0x1110),
+		.class = (PCI_CLASS_OTHERS << 16) |
+			 JAILHOUSE_SHMEM_PROTO_VIRTIO_FRONT,
+		.class_mask = 0xffc000,
+	},
+	{ 0 }
+};
+MODULE_DEVICE_TABLE(pci, front_ids);
+
+static struct pci_driver front_driver = {
+	.name		= DRV_NAME,
+	.id_table	= front_ids,
+	.probe		= front_probe,
+	.remove		= front_remove,
+};
+
+module_pci_driver(front_driver);
+
+MODULE_DESCRIPTION("virtio front-end on Jailhouse ivshmem devices");
+MODULE_LICENSE("GPL");
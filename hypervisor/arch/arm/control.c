@@ -11,13 +11,17 @@
  */
 
 #include <jailhouse/control.h>
+#include <jailhouse/mmio.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/processor.h>
 #include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <asm/control.h>
+#include <asm/gic_common.h>
 #include <asm/irqchip.h>
 #include <asm/platform.h>
 #include <asm/processor.h>
+#include <asm/smmu.h>
 #include <asm/sysregs.h>
 #include <asm/traps.h>
 
@@ -193,7 +197,10 @@ static void arch_dump_abt(bool is_data)
 struct registers* arch_handle_exit(struct per_cpu *cpu_data,
 				   struct registers *regs)
 {
+	exit_latency_start(cpu_data);
+
 	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL]++;
+	trace_event(JAILHOUSE_TRACE_VMEXIT, regs->exit_reason, 0);
 
 	switch (regs->exit_reason) {
 	case EXIT_REASON_IRQ:
@@ -229,6 +236,18 @@ struct registers* arch_handle_exit(struct per_cpu *cpu_data,
 		/* Won't return here. */
 		arch_shutdown_self(cpu_data);
 
+	exit_latency_account(cpu_data);
+	cpu_stats_publish(cpu_data);
+	/* interrupts trap, so the root cell's CPUs exit regularly */
+	cell_watchdog_check(cpu_data);
+	/* no hypervisor timer, buffered writes wait for the next exit */
+	mmio_flush_coalesced_expired(cpu_data);
+	/*
+	 * Suspend requests arrive as SGIs which are only noticed after
+	 * returning to the cell, so CPUs are not throttled, just reported.
+	 */
+	cell_exit_rate_check(cpu_data);
+
 	return regs;
 }
 
@@ -267,7 +286,7 @@ void arch_reset_cpu(unsigned int cpu_id)
 		printk("ERROR: unable to reset CPU%d (was running)\n", cpu_id);
 }
 
-void arch_suspend_cpu(unsigned int cpu_id)
+void arch_request_cpu_suspend(unsigned int cpu_id)
 {
 	struct sgi sgi;
 
@@ -282,10 +301,53 @@ void arch_suspend_cpu(unsigned int cpu_id)
 	sgi.id = SGI_CPU_OFF;
 
 	irqchip_send_sgi(&sgi);
+}
 
+void arch_wait_cpu_suspended(unsigned int cpu_id)
+{
 	psci_wait_cpu_stopped(cpu_id);
 }
 
+void arch_send_msg_doorbell(struct cell *cell, unsigned int id)
+{
+	unsigned int cpu = first_cpu(cell->cpu_set);
+	struct sgi sgi;
+
+	/* only virtual SGIs, they have no physical counterpart to disturb */
+	if (!is_sgi(id))
+		return;
+
+	irqchip_set_pending(per_cpu(cpu), id);
+
+	sgi.routing_mode = 0;
+	sgi.aff1 = 0;
+	sgi.aff2 = 0;
+	sgi.aff3 = 0;
+	sgi.targets = 1 << cpu;
+	sgi.id = SGI_INJECT;
+
+	irqchip_send_sgi(&sgi);
+}
+
+void arch_notify_root(void)
+{
+	/* no receiver for the root cell, its driver polls the event page */
+}
+
+unsigned long arch_get_cycles_khz(void)
+{
+	u32 freq;
+
+	arm_read_sysreg(CNTFRQ, freq);
+	return freq / 1000;
+}
+
+void arch_suspend_cpu(unsigned int cpu_id)
+{
+	arch_request_cpu_suspend(cpu_id);
+	arch_wait_cpu_suspended(cpu_id);
+}
+
 void arch_handle_sgi(struct per_cpu *cpu_data, u32 irqn)
 {
 	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT]++;
@@ -306,6 +368,15 @@ unsigned int arm_cpu_virt2phys(struct cell *cell, unsigned int virt_id)
 {
 	unsigned int cpu;
 
+	/* Virtual and physical IDs are identical in the root cell. */
+	if (cell == &root_cell)
+		return cell_owns_cpu(cell, virt_id) ? virt_id : -1;
+
+	if (virt_id < ARM_MAX_MAPPED_VIRT_IDS) {
+		cpu = cell->arch.virt_to_phys_cpu[virt_id];
+		return cpu == ARM_VIRT_ID_UNMAPPED ? -1 : cpu;
+	}
+
 	for_each_cpu(cpu, cell->cpu_set) {
 		if (per_cpu(cpu)->virt_id == virt_id)
 			return cpu;
@@ -348,8 +419,12 @@ int arch_cell_create(struct cell *cell)
 	 * Generate a virtual CPU id according to the position of each CPU in
 	 * the cell set
 	 */
+	memset(cell->arch.virt_to_phys_cpu, ARM_VIRT_ID_UNMAPPED,
+	       sizeof(cell->arch.virt_to_phys_cpu));
 	for_each_cpu(cpu, cell->cpu_set) {
 		per_cpu(cpu)->virt_id = virt_id;
+		if (virt_id < ARM_MAX_MAPPED_VIRT_IDS)
+			cell->arch.virt_to_phys_cpu[virt_id] = cpu;
 		virt_id++;
 	}
 	cell->arch.last_virt_id = virt_id - 1;
@@ -360,6 +435,14 @@ int arch_cell_create(struct cell *cell)
 		return err;
 	}
 
+	err = arm_smmu_cell_init(cell);
+	if (err) {
+		arm_smmu_cell_exit(cell);
+		irqchip_cell_exit(cell);
+		arch_mmu_cell_destroy(cell);
+		return err;
+	}
+
 	register_smp_ops(cell);
 
 	return 0;
@@ -377,11 +460,63 @@ void arch_cell_destroy(struct cell *cell)
 		arch_reset_cpu(cpu);
 	}
 
+	arm_smmu_cell_exit(cell);
+
 	irqchip_cell_exit(cell);
 
 	arch_mmu_cell_destroy(cell);
 }
 
+void arch_cell_add_cpu(struct cell *cell, unsigned int cpu_id)
+{
+	unsigned int cpu, virt_id = 0;
+	bool used;
+
+	/* pick the lowest virtual ID that is not in use by the cell */
+	do {
+		used = false;
+		for_each_cpu_except(cpu, cell->cpu_set, cpu_id)
+			if (per_cpu(cpu)->virt_id == virt_id) {
+				used = true;
+				virt_id++;
+				break;
+			}
+	} while (used);
+
+	per_cpu(cpu_id)->virt_id = virt_id;
+	if (virt_id < ARM_MAX_MAPPED_VIRT_IDS)
+		cell->arch.virt_to_phys_cpu[virt_id] = cpu_id;
+	if (virt_id > cell->arch.last_virt_id)
+		cell->arch.last_virt_id = virt_id;
+
+	/* the CPU waits in arch_smp_spin until the cell turns it on */
+	arch_reset_cpu(cpu_id);
+}
+
+void arch_cell_remove_cpu(struct cell *cell, unsigned int cpu_id)
+{
+	struct per_cpu *cpu_data = per_cpu(cpu_id);
+	unsigned int cpu;
+
+	if (cpu_data->virt_id < ARM_MAX_MAPPED_VIRT_IDS)
+		cell->arch.virt_to_phys_cpu[cpu_data->virt_id] =
+			ARM_VIRT_ID_UNMAPPED;
+	if (cpu_data->virt_id == cell->arch.last_virt_id) {
+		cell->arch.last_virt_id = 0;
+		for_each_cpu(cpu, cell->cpu_set)
+			if (per_cpu(cpu)->virt_id > cell->arch.last_virt_id)
+				cell->arch.last_virt_id = per_cpu(cpu)->virt_id;
+	}
+
+	/* virtual and physical IDs are identical in the root cell */
+	cpu_data->virt_id = cpu_id;
+	arch_reset_cpu(cpu_id);
+}
+
+void arch_cell_reset(struct cell *cell)
+{
+}
+
 /* Note: only supports synchronous flushing as triggered by config_commit! */
 void arch_flush_cell_vcpu_caches(struct cell *cell)
 {
@@ -392,6 +527,25 @@ void arch_flush_cell_vcpu_caches(struct cell *cell)
 			arch_cpu_tlb_flush(per_cpu(cpu));
 		else
 			per_cpu(cpu)->flush_vcpu_caches = true;
+
+	/* DMA masters of the cell walk the same stage-2 tables */
+	arm_smmu_tlb_flush(cell);
+}
+
+int arch_cell_set_cache(struct cell *cell, unsigned int start,
+			unsigned int size)
+{
+	return -ENODEV;
+}
+
+void arch_cell_sample_stats(struct cell *cell, u64 *stats)
+{
+}
+
+int arch_irqchip_set_mask(struct cell *cell, unsigned int chip,
+			  unsigned long pins, unsigned long mask)
+{
+	return -ENOSYS;
 }
 
 void arch_config_commit(struct cell *cell_added_removed)
@@ -441,6 +595,8 @@ void arch_shutdown(void)
 	for (; cell != NULL; cell = cell->next)
 		irqchip_cell_exit(cell);
 
+	arm_smmu_shutdown();
+
 	/*
 	 * Let the exit handler call reset_self to let the core finish its
 	 * shutdown function and release its lock.
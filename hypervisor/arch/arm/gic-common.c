@@ -28,7 +28,19 @@
 extern void *gicd_base;
 extern unsigned int gicd_size;
 
-static DEFINE_SPINLOCK(dist_lock);
+/*
+ * Read-modify-write cycles on distributor registers only need to be
+ * serialized per register, so the locks are sharded by register word. Cells
+ * whose IRQs share a register still use the same lock.
+ */
+#define DIST_LOCKS			16
+
+static spinlock_t dist_locks[DIST_LOCKS];
+
+static spinlock_t *dist_lock(unsigned long reg)
+{
+	return &dist_locks[(reg / 4) % DIST_LOCKS];
+}
 
 /* The GIC interface numbering does not necessarily match the logical map */
 u8 target_cpu_map[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
@@ -88,8 +100,9 @@ restrict_bitmask_access(struct mmio_access *mmio, unsigned int reg_index,
 		 * Relies on a spinlock since we need two mmio accesses.
 		 */
 		unsigned long access_val = mmio->value;
+		spinlock_t *lock = dist_lock(mmio->address);
 
-		spin_lock(&dist_lock);
+		spin_lock(lock);
 
 		mmio->is_write = false;
 		mmio_perform_access(gicd_base, mmio);
@@ -100,7 +113,7 @@ restrict_bitmask_access(struct mmio_access *mmio, unsigned int reg_index,
 		mmio->value |= access_val;
 		mmio_perform_access(gicd_base, mmio);
 
-		spin_unlock(&dist_lock);
+		spin_unlock(lock);
 	} else {
 		mmio->value &= access_mask;
 		mmio_perform_access(gicd_base, mmio);
@@ -160,7 +173,7 @@ static enum mmio_result handle_irq_target(struct mmio_access *mmio,
 	}
 
 	if (mmio->is_write) {
-		spin_lock(&dist_lock);
+		spin_lock(dist_lock(mmio->address));
 		u32 itargetsr =
 			mmio_read32(gicd_base + GICD_ITARGETSR + irq + offset);
 		mmio->value &= access_mask;
@@ -168,7 +181,7 @@ static enum mmio_result handle_irq_target(struct mmio_access *mmio,
 		mmio->value |= (itargetsr & ~access_mask);
 		/* And do the access */
 		mmio_perform_access(gicd_base, mmio);
-		spin_unlock(&dist_lock);
+		spin_unlock(dist_lock(mmio->address));
 	} else {
 		mmio_perform_access(gicd_base, mmio);
 		mmio->value &= access_mask;
@@ -221,7 +234,7 @@ int gic_probe_cpu_id(unsigned int cpu)
 void gic_handle_sgir_write(struct sgi *sgi, bool virt_input)
 {
 	struct per_cpu *cpu_data = this_cpu_data();
-	unsigned int cpu;
+	unsigned int cpu, virt_id;
 	unsigned long targets;
 	unsigned int this_cpu = cpu_data->cpu_id;
 	struct cell *cell = cpu_data->cell;
@@ -232,6 +245,22 @@ void gic_handle_sgir_write(struct sgi *sgi, bool virt_input)
 	targets = sgi->targets;
 	sgi->targets = 0;
 
+	/* Translate the virtual target list directly, without a CPU scan. */
+	if (virt_input && sgi->routing_mode == 0) {
+		while (targets) {
+			virt_id = ffsl(targets);
+			targets &= ~(1UL << virt_id);
+
+			cpu = arm_cpu_virt2phys(cell, virt_id);
+			if (cpu == -1 || cpu == this_cpu)
+				continue;
+
+			irqchip_set_pending(per_cpu(cpu), sgi->id);
+			sgi->targets |= (1 << cpu);
+		}
+		goto send_sgi;
+	}
+
 	/* Filter the targets */
 	for_each_cpu_except(cpu, cell->cpu_set, this_cpu) {
 		/*
@@ -252,6 +281,7 @@ void gic_handle_sgir_write(struct sgi *sgi, bool virt_input)
 		sgi->targets |= (1 << cpu);
 	}
 
+send_sgi:
 	/* Let the other CPUS inject their SGIs */
 	sgi->id = SGI_INJECT;
 	irqchip_send_sgi(sgi);
@@ -12,6 +12,7 @@
 
 #include <jailhouse/control.h>
 #include <jailhouse/mmio.h>
+#include <jailhouse/string.h>
 #include <asm/gic_common.h>
 #include <asm/irqchip.h>
 #include <asm/platform.h>
@@ -49,16 +50,26 @@ static int gic_init(void)
 
 static void gic_clear_pending_irqs(void)
 {
+	struct per_cpu *cpu_data = this_cpu_data();
 	unsigned int n;
 
 	/* Clear list registers. */
 	for (n = 0; n < gic_num_lr; n++)
 		gic_write_lr(n, 0);
+	memset(cpu_data->gic_lr_used, 0, sizeof(cpu_data->gic_lr_used));
+	memset(cpu_data->gic_lr_irqs, 0, sizeof(cpu_data->gic_lr_irqs));
 
 	/* Clear active priority bits. */
 	mmio_write32(gich_base + GICH_APR, 0);
 }
 
+/* GICH is MMIO, so keep a shadow of HCR to avoid read-modify-write cycles */
+static void gic_write_hcr(struct per_cpu *cpu_data, u32 hcr)
+{
+	cpu_data->gic_hcr = hcr;
+	mmio_write32(gich_base + GICH_HCR, hcr);
+}
+
 static int gic_cpu_reset(struct per_cpu *cpu_data, bool is_shutdown)
 {
 	unsigned int i;
@@ -90,7 +101,7 @@ static int gic_cpu_reset(struct per_cpu *cpu_data, bool is_shutdown)
 				     0xffff0000 & ~(1 << MAINTENANCE_IRQ));
 
 	if (is_shutdown)
-		mmio_write32(gich_base + GICH_HCR, 0);
+		gic_write_hcr(cpu_data, 0);
 
 	if (root_shutdown) {
 		gich_vmcr = mmio_read32(gich_base + GICH_VMCR);
@@ -151,7 +162,7 @@ static int gic_cpu_init(struct per_cpu *cpu_data)
 		vmcr |= GICH_VMCR_EOImode;
 
 	mmio_write32(gich_base + GICH_VMCR, vmcr);
-	mmio_write32(gich_base + GICH_HCR, GICH_HCR_EN);
+	gic_write_hcr(cpu_data, GICH_HCR_EN);
 
 	/*
 	 * Clear pending virtual IRQs in case anything is left from previous
@@ -198,8 +209,8 @@ static int gic_cell_init(struct cell *cell)
 	if (err)
 		return err;
 
-	mmio_region_register(cell, (unsigned long)gicd_base, gicd_size,
-			     gic_handle_dist_access, NULL);
+	mmio_region_register_fast(cell, (unsigned long)gicd_base, gicd_size,
+				  gic_handle_dist_access, NULL);
 	return 0;
 }
 
@@ -240,31 +251,61 @@ static int gic_send_sgi(struct sgi *sgi)
 	return 0;
 }
 
-static int gic_inject_irq(struct per_cpu *cpu_data, u16 irq_id)
+/*
+ * Release the shadow state of list registers the guest has completed in the
+ * meantime. Only the LR state is updated by the hardware, never the virtual
+ * ID, so the shadow of the remaining ones stays valid.
+ */
+static void gic_sync_lrs(struct per_cpu *cpu_data)
 {
-	int i;
-	int first_free = -1;
-	u32 lr;
 	unsigned long elsr[2];
+	unsigned int n;
 
 	elsr[0] = mmio_read32(gich_base + GICH_ELSR0);
-	elsr[1] = mmio_read32(gich_base + GICH_ELSR1);
-	for (i = 0; i < gic_num_lr; i++) {
-		if (test_bit(i, elsr)) {
-			/* Entry is available */
-			if (first_free == -1)
-				first_free = i;
-			continue;
+	elsr[1] = gic_num_lr > 32 ? mmio_read32(gich_base + GICH_ELSR1) : 0;
+
+	for (n = 0; n < gic_num_lr; n++)
+		if (test_bit(n, cpu_data->gic_lr_used) && test_bit(n, elsr)) {
+			clear_bit(n, cpu_data->gic_lr_used);
+			clear_bit(cpu_data->gic_lr_irq[n],
+				  cpu_data->gic_lr_irqs);
 		}
+}
 
+static int gic_find_free_lr(struct per_cpu *cpu_data)
+{
+	unsigned int n;
+
+	for (n = 0; n < gic_num_lr; n++)
+		if (!test_bit(n, cpu_data->gic_lr_used))
+			return n;
+	return -1;
+}
+
+static int gic_inject_irq(struct per_cpu *cpu_data, u16 irq_id)
+{
+	int first_free;
+	u32 lr;
+
+	/*
+	 * Work on the shadow state as long as it allows a decision. GICH is
+	 * only read if the IRQ may still be in flight or all LRs appear to be
+	 * occupied.
+	 */
+	if (test_bit(irq_id, cpu_data->gic_lr_irqs)) {
+		gic_sync_lrs(cpu_data);
 		/* Check that there is no overlapping */
-		lr = gic_read_lr(i);
-		if ((lr & GICH_LR_VIRT_ID_MASK) == irq_id)
+		if (test_bit(irq_id, cpu_data->gic_lr_irqs))
 			return -EEXIST;
 	}
 
-	if (first_free == -1)
-		return -EBUSY;
+	first_free = gic_find_free_lr(cpu_data);
+	if (first_free == -1) {
+		gic_sync_lrs(cpu_data);
+		first_free = gic_find_free_lr(cpu_data);
+		if (first_free == -1)
+			return -EBUSY;
+	}
 
 	/* Inject group 0 interrupt (seen as IRQ by the guest) */
 	lr = irq_id;
@@ -277,19 +318,22 @@ static int gic_inject_irq(struct per_cpu *cpu_data, u16 irq_id)
 
 	gic_write_lr(first_free, lr);
 
+	set_bit(first_free, cpu_data->gic_lr_used);
+	cpu_data->gic_lr_irq[first_free] = irq_id;
+	set_bit(irq_id, cpu_data->gic_lr_irqs);
+
 	return 0;
 }
 
 static void gic_enable_maint_irq(bool enable)
 {
-	u32 hcr;
+	struct per_cpu *cpu_data = this_cpu_data();
+	u32 hcr = cpu_data->gic_hcr & ~GICH_HCR_UIE;
 
-	hcr = mmio_read32(gich_base + GICH_HCR);
 	if (enable)
 		hcr |= GICH_HCR_UIE;
-	else
-		hcr &= ~GICH_HCR_UIE;
-	mmio_write32(gich_base + GICH_HCR, hcr);
+	if (hcr != cpu_data->gic_hcr)
+		gic_write_hcr(cpu_data, hcr);
 }
 
 enum mmio_result gic_handle_irq_route(struct mmio_access *mmio,
@@ -71,6 +71,12 @@ static void gic_clear_pending_irqs(void)
 	}
 }
 
+static void gicv3_write_hcr(struct per_cpu *cpu_data, u32 hcr)
+{
+	cpu_data->gic_hcr = hcr;
+	arm_write_sysreg(ICH_HCR_EL2, hcr);
+}
+
 static int gic_cpu_reset(struct per_cpu *cpu_data, bool is_shutdown)
 {
 	unsigned int i;
@@ -116,7 +122,7 @@ static int gic_cpu_reset(struct per_cpu *cpu_data, bool is_shutdown)
 			arm_write_sysreg(ICC_CTLR_EL1, icc_ctlr);
 		}
 
-		arm_write_sysreg(ICH_HCR_EL2, 0);
+		gicv3_write_hcr(cpu_data, 0);
 	}
 
 	arm_write_sysreg(ICH_VMCR_EL2, 0);
@@ -197,7 +203,7 @@ static int gic_cpu_init(struct per_cpu *cpu_data)
 	arm_write_sysreg(ICH_VMCR_EL2, ich_vmcr);
 
 	/* After this, the cells access the virtual interface of the GIC. */
-	arm_write_sysreg(ICH_HCR_EL2, ICH_HCR_EN);
+	gicv3_write_hcr(cpu_data, ICH_HCR_EN);
 
 	return 0;
 }
@@ -242,6 +248,26 @@ static enum mmio_result gic_handle_redist_access(void *arg,
 
 	mmio->address = address - virt_redist;
 
+	/*
+	 * LPIs are not supported in cells yet: the LPI tables would be
+	 * fetched and written by the GIC at addresses controlled by the cell,
+	 * and LPIs would have to be partitioned via an ITS owned by the
+	 * hypervisor. GICR_TYPER does not report them, and attempts to set
+	 * them up are ignored.
+	 */
+	if (mmio->is_write) {
+		switch (mmio->address) {
+		case GICR_CTLR:
+			mmio->value &= ~GICR_CTLR_EnableLPIs;
+			break;
+		case GICR_PROPBASER:
+		case GICR_PROPBASER + 4:
+		case GICR_PENDBASER:
+		case GICR_PENDBASER + 4:
+			return MMIO_HANDLED;
+		}
+	}
+
 	/* Change the ID register, all other accesses are allowed. */
 	if (!mmio->is_write) {
 		switch (mmio->address) {
@@ -267,8 +293,8 @@ static enum mmio_result gic_handle_redist_access(void *arg,
 
 static int gic_cell_init(struct cell *cell)
 {
-	mmio_region_register(cell, (unsigned long)gicd_base, gicd_size,
-			     gic_handle_dist_access, NULL);
+	mmio_region_register_fast(cell, (unsigned long)gicd_base, gicd_size,
+				  gic_handle_dist_access, NULL);
 	mmio_region_register(cell, (unsigned long)gicr_base, gicr_size,
 			     gic_handle_redist_access, NULL);
 
@@ -420,14 +446,13 @@ static int gic_inject_irq(struct per_cpu *cpu_data, u16 irq_id)
 
 static void gicv3_enable_maint_irq(bool enable)
 {
-	u32 hcr;
+	struct per_cpu *cpu_data = this_cpu_data();
+	u32 hcr = cpu_data->gic_hcr & ~ICH_HCR_UIE;
 
-	arm_read_sysreg(ICH_HCR_EL2, hcr);
 	if (enable)
 		hcr |= ICH_HCR_UIE;
-	else
-		hcr &= ~ICH_HCR_UIE;
-	arm_write_sysreg(ICH_HCR_EL2, hcr);
+	if (hcr != cpu_data->gic_hcr)
+		gicv3_write_hcr(cpu_data, hcr);
 }
 
 unsigned int irqchip_mmio_count_regions(struct cell *cell)
@@ -98,6 +98,28 @@ static inline int test_and_set_bit(int nr, volatile unsigned long *addr)
 	return !!(test);
 }
 
+/* Atomically replace *addr by new if it equals old, return previous value */
+static inline unsigned int cmpxchg(volatile unsigned int *addr,
+				   unsigned int old, unsigned int new)
+{
+	unsigned long ret, prev;
+
+	PRELOAD(addr);
+	do {
+		asm volatile (
+			"ldrex	%1, %2\n\t"
+			"mov	%0, #0\n\t"
+			"teq	%1, %3\n\t"
+			"it	eq\n\t"
+			"strexeq %0, %4, %2\n\t"
+			: "=&r" (ret), "=&r" (prev),
+			  "+Qo" (*addr)
+			: "r" (old), "r" (new)
+			: "cc");
+	} while (ret);
+
+	return prev;
+}
 
 /* Count leading zeroes */
 static inline unsigned long clz(unsigned long word)
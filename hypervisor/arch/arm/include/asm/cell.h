@@ -17,6 +17,10 @@
 #include <asm/smp.h>
 #include <asm/spinlock.h>
 
+/* virtual CPU IDs addressable via the SGI target list of affinity 0 */
+#define ARM_MAX_MAPPED_VIRT_IDS		16
+#define ARM_VIRT_ID_UNMAPPED		0xff
+
 #ifndef __ASSEMBLY__
 
 #include <jailhouse/cell-config.h>
@@ -34,6 +38,8 @@ struct arch_cell {
 	u32 irq_bitmap[1024/32];
 
 	unsigned int last_virt_id;
+	/* Physical CPU of each virtual ID, unused in the root cell. */
+	u8 virt_to_phys_cpu[ARM_MAX_MAPPED_VIRT_IDS];
 };
 
 /** PCI-related cell states. */
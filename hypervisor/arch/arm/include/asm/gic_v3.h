@@ -32,6 +32,8 @@
 #define GICR_CTLR		GICD_CTLR
 #define GICR_TYPER		0x0008
 #define GICR_WAKER		0x0014
+#define GICR_PROPBASER		0x0070
+#define GICR_PENDBASER		0x0078
 #define GICR_CIDR0		GICD_CIDR0
 #define GICR_CIDR1		GICD_CIDR1
 #define GICR_CIDR2		GICD_CIDR2
@@ -53,6 +55,8 @@
 #define GICR_ICACTIVER		GICD_ICACTIVER
 #define GICR_IPRIORITY		GICD_IPRIORITY
 
+#define GICR_CTLR_EnableLPIs	(1 << 0)
+
 #define GICR_TYPER_Last		(1 << 4)
 #define GICR_PIDR2_ARCH		GICD_PIDR2_ARCH
 
@@ -14,6 +14,13 @@
 #define _JAILHOUSE_ASM_IRQCHIP_H
 
 #define MAX_PENDING_IRQS	256
+/* upper bound of GIC interrupt IDs (SGIs, PPIs and SPIs) */
+#define MAX_IRQS		1024
+/* upper bound of GICv2 list registers (6-bit GICH_VTR.ListRegs) */
+#define MAX_GIC_LRS		64
+
+/* marks a pending_irqs slot that was reserved but not yet filled */
+#define PENDING_IRQ_EMPTY	0xffff
 
 #include <jailhouse/cell.h>
 #include <jailhouse/mmio.h>
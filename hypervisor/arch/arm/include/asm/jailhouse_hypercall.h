@@ -49,7 +49,17 @@
 #define JAILHOUSE_CPU_STAT_VMEXITS_MAINTENANCE	JAILHOUSE_GENERIC_CPU_STATS
 #define JAILHOUSE_CPU_STAT_VMEXITS_VIRQ		JAILHOUSE_GENERIC_CPU_STATS + 1
 #define JAILHOUSE_CPU_STAT_VMEXITS_VSGI		JAILHOUSE_GENERIC_CPU_STATS + 2
-#define JAILHOUSE_NUM_CPU_STATS			JAILHOUSE_GENERIC_CPU_STATS + 3
+#define JAILHOUSE_CPU_STAT_PENDING_IRQS_DROPPED	JAILHOUSE_GENERIC_CPU_STATS + 3
+#define JAILHOUSE_CPU_STAT_PSCI_STOP_WAIT	JAILHOUSE_GENERIC_CPU_STATS + 4
+#define JAILHOUSE_NUM_CPU_STATS			JAILHOUSE_GENERIC_CPU_STATS + 5
+
+#define JAILHOUSE_CPU_STAT_NAMES					\
+	JAILHOUSE_GENERIC_CPU_STAT_NAMES, "vmexits_maintenance",	\
+	"vmexits_virt_irq", "vmexits_virt_sgi", "pending_irqs_dropped",	\
+	"psci_stop_wait_cycles"
+
+/* statistics from here on are per cell, not accumulated over its CPUs */
+#define JAILHOUSE_FIRST_CELL_STAT		JAILHOUSE_NUM_CPU_STATS
 
 #ifndef __ASSEMBLY__
 
@@ -37,6 +37,7 @@
  * TODO: implement larger PARange support for AArch32
  */
 #define ARM_CELL_ROOT_PT_SZ	1
+#define CELL_ROOT_PT_PAGES	ARM_CELL_ROOT_PT_SZ
 
 #if MAX_PAGE_TABLE_LEVELS < 3
 #define T0SZ			0
@@ -55,13 +56,14 @@
 
 /*
  * Stage-1 and Stage-2 lower attributes.
- * FIXME: The upper attributes (contiguous hint and XN) are not currently in
- * use. If needed in the future, they should be shifted towards the lower word,
- * since the core uses unsigned long to pass the flags.
+ * FIXME: The upper attribute XN is not currently in use. If needed in the
+ * future, it should be shifted towards the lower word, since the core uses
+ * unsigned long to pass the flags.
  * An arch-specific typedef for the flags as well as the addresses would be
  * useful.
  * The contiguous bit is a hint that allows the PE to store blocks of 16 pages
- * in the TLB. This may be a useful optimisation.
+ * in the TLB. It never travels through the core flags: the stage-2 setters
+ * apply it on their own to naturally aligned runs, see paging.c.
  */
 #define PTE_ACCESS_FLAG		(0x1 << 10)
 /*
@@ -93,6 +95,9 @@
  */
 #define PTE_TABLE_FLAGS		0x3
 
+#define PTE_CONTIG_HINT		(1ULL << 52)
+#define PTE_CONTIG_ENTRIES	16
+
 #define PTE_L1_BLOCK_ADDR_MASK	BIT_MASK(39, 30)
 #define PTE_L2_BLOCK_ADDR_MASK	BIT_MASK(39, 21)
 #define PTE_TABLE_ADDR_MASK	BIT_MASK(39, 12)
@@ -141,6 +146,7 @@
 
 /* Stage 2 memory attributes (MemAttr[3:0]) */
 #define S2_MEMATTR_OWBIWB	0xf
+#define S2_MEMATTR_ONCINC	0x5
 #define S2_MEMATTR_DEV		0x1
 
 #define S1_PTE_FLAG_NORMAL	PTE_MEMATTR(HMAIR_IDX_WBRAWA)
@@ -148,6 +154,7 @@
 #define S1_PTE_FLAG_UNCACHED	PTE_MEMATTR(HMAIR_IDX_NC)
 
 #define S2_PTE_FLAG_NORMAL	PTE_MEMATTR(S2_MEMATTR_OWBIWB)
+#define S2_PTE_FLAG_NC		PTE_MEMATTR(S2_MEMATTR_ONCINC)
 #define S2_PTE_FLAG_DEVICE	PTE_MEMATTR(S2_MEMATTR_DEV)
 
 #define S1_DEFAULT_FLAGS	(PTE_FLAG_VALID | PTE_ACCESS_FLAG	\
@@ -40,18 +40,47 @@ struct per_cpu {
 	unsigned int cpu_id;
 	unsigned int virt_id;
 
-	/* synchronizes parallel insertions of SGIs into the pending ring */
-	spinlock_t pending_irqs_lock;
-	u16 pending_irqs[MAX_PENDING_IRQS];
-	unsigned int pending_irqs_head;
-	/* removal from the ring happens lockless, thus tail is volatile */
+	/*
+	 * Lock-free ring of IRQs waiting for a free list register. Producers
+	 * on any CPU reserve a slot by advancing the tail via cmpxchg, only
+	 * the owning CPU consumes entries and advances the head. Both indexes
+	 * are free-running and taken modulo MAX_PENDING_IRQS on access.
+	 */
+	volatile u16 pending_irqs[MAX_PENDING_IRQS];
+	volatile unsigned int pending_irqs_head;
 	volatile unsigned int pending_irqs_tail;
+	/* IRQs currently queued in the ring, used to coalesce duplicates */
+	unsigned long pending_irqs_queued[MAX_IRQS / BITS_PER_LONG];
+	/*
+	 * Only GICv2: list registers filled by gic_inject_irq that were not
+	 * seen empty yet, the IRQs they hold and an IRQ bitmap of the same.
+	 */
+	unsigned long gic_lr_used[MAX_GIC_LRS / BITS_PER_LONG];
+	u16 gic_lr_irq[MAX_GIC_LRS];
+	unsigned long gic_lr_irqs[MAX_IRQS / BITS_PER_LONG];
+	/* Shadow of GICH_HCR (GICv2) or ICH_HCR_EL2 (GICv3) */
+	u32 gic_hcr;
 	/* Only GICv3: redistributor base */
 	void *gicr_base;
 
 	struct cell *cell;
 
-	u32 stats[JAILHOUSE_NUM_CPU_STATS];
+	u64 stats[JAILHOUSE_NUM_CPU_STATS];
+	/* see cell_exit_rate_check */
+	u64 exit_rate_base[JAILHOUSE_EXIT_RATE_CLASSES];
+	u64 exit_rate_window_end;
+	bool exit_rate_exceeded;
+#ifdef CONFIG_EXIT_LATENCY_HISTOGRAMS
+	u64 exit_start;
+	u64 exit_stats[JAILHOUSE_NUM_CPU_STATS];
+	/* JAILHOUSE_NUM_CPU_STATS histograms allocated from mem_pool */
+	u32 (*exit_latency)[JAILHOUSE_EXIT_LATENCY_BUCKETS];
+#endif
+
+	struct mmio_region_cache mmio_cache;
+	struct page_magazine page_magazine;
+
+	struct jailhouse_trace_buffer *trace_buffer;
 
 	bool initialized;
 
@@ -15,6 +15,7 @@
 
 #include <jailhouse/types.h>
 #include <jailhouse/utils.h>
+#include <asm/sysregs.h>
 
 #define PSR_MODE_MASK	0xf
 #define PSR_USR_MODE	0x0
@@ -144,6 +145,15 @@
 /* Condition code */
 #define ESR_ICC_CV_BIT		(1 << 24)
 #define ESR_ICC_COND(icc)	((icc) >> 20 & 0xf)
+/* Data abort syndrome */
+#define ESR_DABT_ISV		(1 << 24)
+#define ESR_DABT_SAS(icc)	((icc) >> 22 & 0x3)
+#define ESR_DABT_SSE		(1 << 21)
+#define ESR_DABT_SRT(icc)	((icc) >> 16 & 0xf)
+#define ESR_DABT_EA		(1 << 9)
+#define ESR_DABT_CM		(1 << 8)
+#define ESR_DABT_S1PTW		(1 << 7)
+#define ESR_DABT_WNR		(1 << 6)
 
 #define EXIT_REASON_UNDEF	0x1
 #define EXIT_REASON_HVC		0x2
@@ -188,6 +198,20 @@ static inline void memory_load_barrier(void)
 {
 }
 
+static inline void memory_store_barrier(void)
+{
+	dmb(ishst);
+}
+
+static inline u64 get_cycles(void)
+{
+	u64 cnt;
+
+	isb();
+	arm_read_sysreg(CNTPCT, cnt);
+	return cnt;
+}
+
 static inline bool is_el2(void)
 {
 	u32 psr;
@@ -0,0 +1,51 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_SMMU_H
+#define _JAILHOUSE_ASM_SMMU_H
+
+#include <jailhouse/cell.h>
+
+#ifdef CONFIG_ARM_SMMU
+
+int arm_smmu_init(void);
+void arm_smmu_shutdown(void);
+
+int arm_smmu_cell_init(struct cell *cell);
+void arm_smmu_cell_exit(struct cell *cell);
+
+void arm_smmu_tlb_flush(struct cell *cell);
+
+#else /* !CONFIG_ARM_SMMU */
+
+static inline int arm_smmu_init(void)
+{
+	return 0;
+}
+
+static inline void arm_smmu_shutdown(void)
+{
+}
+
+static inline int arm_smmu_cell_init(struct cell *cell)
+{
+	return 0;
+}
+
+static inline void arm_smmu_cell_exit(struct cell *cell)
+{
+}
+
+static inline void arm_smmu_tlb_flush(struct cell *cell)
+{
+}
+
+#endif /* !CONFIG_ARM_SMMU */
+
+#endif /* !_JAILHOUSE_ASM_SMMU_H */
@@ -0,0 +1,57 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_STRING_H
+#define _JAILHOUSE_ASM_STRING_H
+
+#include <jailhouse/types.h>
+
+#define WORD_MASK	(sizeof(unsigned long) - 1)
+
+/*
+ * Word-wise variants, the bulk of the callers (page scrubbing, page table
+ * setup) pass page-aligned buffers. Unaligned heads and tails are handled
+ * byte-wise.
+ */
+static inline void *arch_memset(void *s, int c, unsigned long n)
+{
+	unsigned long pattern = (~0UL / 0xff) * (u8)c;
+	u8 *p = s;
+
+	while (n > 0 && ((unsigned long)p & WORD_MASK)) {
+		*p++ = c;
+		n--;
+	}
+	for (; n >= sizeof(unsigned long); n -= sizeof(unsigned long)) {
+		*(unsigned long *)p = pattern;
+		p += sizeof(unsigned long);
+	}
+	while (n-- > 0)
+		*p++ = c;
+	return s;
+}
+
+static inline void *arch_memcpy(void *dest, const void *src, unsigned long n)
+{
+	const u8 *s = src;
+	u8 *d = dest;
+
+	if ((((unsigned long)d | (unsigned long)s) & WORD_MASK) == 0)
+		for (; n >= sizeof(unsigned long);
+		     n -= sizeof(unsigned long)) {
+			*(unsigned long *)d = *(const unsigned long *)s;
+			d += sizeof(unsigned long);
+			s += sizeof(unsigned long);
+		}
+	while (n-- > 0)
+		*d++ = *s++;
+	return dest;
+}
+
+#endif /* !_JAILHOUSE_ASM_STRING_H */
@@ -54,6 +54,7 @@
 #define PAR_EL1		SYSREG_64(0, c7)
 
 #define CNTKCTL_EL1	SYSREG_32(0, c14, c1, 0)
+#define CNTHCTL_EL2	SYSREG_32(4, c14, c1, 0)
 #define CNTP_TVAL_EL0	SYSREG_32(0, c14, c2, 0)
 #define CNTP_CTL_EL0	SYSREG_32(0, c14, c2, 1)
 #define CNTP_CVAL_EL0	SYSREG_64(2, c14)
@@ -91,6 +91,7 @@ void access_cell_reg(struct trap_context *ctx, u8 reg, unsigned long *val,
 void arch_skip_instruction(struct trap_context *ctx);
 
 int arch_handle_dabt(struct trap_context *ctx);
+bool arch_handle_dabt_fast(struct registers *guest_regs, u32 esr);
 
 #endif /* !__ASSEMBLY__ */
 #endif /* !_JAILHOUSE_ASM_TRAPS_H */
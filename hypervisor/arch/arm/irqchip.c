@@ -17,6 +17,8 @@
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/string.h>
+#include <jailhouse/trace.h>
+#include <asm/bitops.h>
 #include <asm/control.h>
 #include <asm/gic_common.h>
 #include <asm/irqchip.h>
@@ -54,28 +56,39 @@ bool irqchip_irq_in_cell(struct cell *cell, unsigned int irq_id)
 void irqchip_set_pending(struct per_cpu *cpu_data, u16 irq_id)
 {
 	bool local_injection = (this_cpu_data() == cpu_data);
-	unsigned int new_tail;
+	unsigned int tail;
+
+	trace_event(JAILHOUSE_TRACE_IRQ_INJECT, irq_id, cpu_data->cpu_id);
 
 	if (local_injection && irqchip.inject_irq(cpu_data, irq_id) != -EBUSY)
 		return;
 
-	spin_lock(&cpu_data->pending_irqs_lock);
+	/* Already queued? Then the pending state is simply merged. */
+	if (test_and_set_bit(irq_id, cpu_data->pending_irqs_queued))
+		goto out;
 
-	new_tail = (cpu_data->pending_irqs_tail + 1) % MAX_PENDING_IRQS;
+	do {
+		tail = cpu_data->pending_irqs_tail;
 
-	/* Queue space available? */
-	if (new_tail != cpu_data->pending_irqs_head) {
-		cpu_data->pending_irqs[cpu_data->pending_irqs_tail] = irq_id;
-		cpu_data->pending_irqs_tail = new_tail;
-		/*
-		 * Make the change to pending_irqs_tail visible before the
-		 * caller sends SGI_INJECT.
-		 */
-		memory_barrier();
-	}
+		/* Queue space available? */
+		if (tail - cpu_data->pending_irqs_head >= MAX_PENDING_IRQS) {
+			this_cpu_data()->stats[
+				JAILHOUSE_CPU_STAT_PENDING_IRQS_DROPPED]++;
+			clear_bit(irq_id, cpu_data->pending_irqs_queued);
+			goto out;
+		}
+	} while (cmpxchg(&cpu_data->pending_irqs_tail, tail, tail + 1) !=
+		 tail);
 
-	spin_unlock(&cpu_data->pending_irqs_lock);
+	/*
+	 * The slot is ours now, but the consumer may already see the new
+	 * tail. It stops at PENDING_IRQ_EMPTY until we filled in the ID.
+	 * Make the slot content visible before the caller sends SGI_INJECT.
+	 */
+	cpu_data->pending_irqs[tail % MAX_PENDING_IRQS] = irq_id;
+	memory_barrier();
 
+out:
 	/*
 	 * The list registers are full, trigger maintenance interrupt if we are
 	 * on the target CPU. In the other case, the caller will send a
@@ -87,10 +100,18 @@ void irqchip_set_pending(struct per_cpu *cpu_data, u16 irq_id)
 
 void irqchip_inject_pending(struct per_cpu *cpu_data)
 {
+	unsigned int head = cpu_data->pending_irqs_head;
 	u16 irq_id;
 
-	while (cpu_data->pending_irqs_head != cpu_data->pending_irqs_tail) {
-		irq_id = cpu_data->pending_irqs[cpu_data->pending_irqs_head];
+	while (head != cpu_data->pending_irqs_tail) {
+		irq_id = cpu_data->pending_irqs[head % MAX_PENDING_IRQS];
+
+		/*
+		 * The producer has not filled in the slot yet. It will raise
+		 * SGI_INJECT afterwards, so we will be called again.
+		 */
+		if (irq_id == PENDING_IRQ_EMPTY)
+			return;
 
 		if (irqchip.inject_irq(cpu_data, irq_id) == -EBUSY) {
 			/*
@@ -101,8 +122,13 @@ void irqchip_inject_pending(struct per_cpu *cpu_data)
 			return;
 		}
 
-		cpu_data->pending_irqs_head =
-			(cpu_data->pending_irqs_head + 1) % MAX_PENDING_IRQS;
+		cpu_data->pending_irqs[head % MAX_PENDING_IRQS] =
+			PENDING_IRQ_EMPTY;
+		clear_bit(irq_id, cpu_data->pending_irqs_queued);
+
+		/* Release the slot only after it was marked empty again. */
+		memory_barrier();
+		cpu_data->pending_irqs_head = ++head;
 	}
 
 	/*
@@ -127,14 +153,25 @@ int irqchip_send_sgi(struct sgi *sgi)
 	return irqchip.send_sgi(sgi);
 }
 
+static void irqchip_clear_pending_ring(struct per_cpu *cpu_data)
+{
+	cpu_data->pending_irqs_head = cpu_data->pending_irqs_tail = 0;
+	memset((void *)cpu_data->pending_irqs, 0xff,
+	       sizeof(cpu_data->pending_irqs));
+	memset(cpu_data->pending_irqs_queued, 0,
+	       sizeof(cpu_data->pending_irqs_queued));
+}
+
 int irqchip_cpu_init(struct per_cpu *cpu_data)
 {
+	irqchip_clear_pending_ring(cpu_data);
+
 	return irqchip.cpu_init(cpu_data);
 }
 
 int irqchip_cpu_reset(struct per_cpu *cpu_data)
 {
-	cpu_data->pending_irqs_head = cpu_data->pending_irqs_tail = 0;
+	irqchip_clear_pending_ring(cpu_data);
 
 	return irqchip.cpu_reset(cpu_data, false);
 }
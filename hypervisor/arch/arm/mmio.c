@@ -61,6 +61,66 @@ static void arch_inject_dabt(struct trap_context *ctx, unsigned long addr)
 	arm_write_sysreg(DFAR, addr);
 }
 
+/*
+ * Handles the common case of a data abort with valid syndrome that targets a
+ * non-banked register, outside of Thumb IT blocks, without setting up a
+ * trap context. Returns false if arch_handle_dabt has to take over, which is
+ * also the case for accesses that fail so that it can report them.
+ */
+bool arch_handle_dabt_fast(struct registers *guest_regs, u32 esr)
+{
+	u32 icc = ESR_ICC(esr);
+	u32 srt = ESR_DABT_SRT(icc);
+	u32 size = 1 << ESR_DABT_SAS(icc);
+	struct mmio_access mmio;
+	unsigned long hpfar;
+	unsigned long hdfar;
+	u32 cpsr, pc;
+
+	if (!(icc & ESR_DABT_ISV) || size > sizeof(unsigned long) ||
+	    icc & (ESR_DABT_EA | ESR_DABT_CM | ESR_DABT_S1PTW))
+		return false;
+
+	/* r0 - r7 are never banked, r8 - r12 only in FIQ mode */
+	arm_read_banked_reg(SPSR_hyp, cpsr);
+	if (srt > 12 ||
+	    (srt > 7 && (cpsr & PSR_MODE_MASK) == PSR_FIQ_MODE) ||
+	    cpsr & PSR_IT_MASK(0xff))
+		return false;
+
+	arm_read_sysreg(HPFAR, hpfar);
+	arm_read_sysreg(HDFAR, hdfar);
+	mmio.address = hpfar << 8;
+	mmio.address |= hdfar & 0xfff;
+
+	mmio.is_write = !!(icc & ESR_DABT_WNR);
+	mmio.size = size;
+	if (mmio.is_write) {
+		mmio.value = guest_regs->usr[srt];
+		if (icc & ESR_DABT_SSE)
+			mmio.value = sign_extend(mmio.value, 8 * size);
+	} else {
+		mmio.value = 0;
+	}
+
+	if (mmio_handle_access(&mmio) != MMIO_HANDLED)
+		return false;
+
+	if (!mmio.is_write) {
+		if (icc & ESR_DABT_SSE)
+			mmio.value = sign_extend(mmio.value, 8 * size);
+		guest_regs->usr[srt] = mmio.value;
+	}
+
+	this_cpu_data()->stats[JAILHOUSE_CPU_STAT_VMEXITS_MMIO]++;
+
+	arm_read_banked_reg(ELR_hyp, pc);
+	pc += ESR_IL(esr) ? 4 : 2;
+	arm_write_banked_reg(ELR_hyp, pc);
+
+	return true;
+}
+
 int arch_handle_dabt(struct trap_context *ctx)
 {
 	enum mmio_result mmio_result;
@@ -21,13 +21,25 @@ int arch_map_memory_region(struct cell *cell,
 {
 	u64 phys_start = mem->phys_start;
 	u32 flags = PTE_FLAG_VALID | PTE_ACCESS_FLAG;
+	int err;
 
 	if (mem->flags & JAILHOUSE_MEM_READ)
 		flags |= S2_PTE_ACCESS_RO;
 	if (mem->flags & JAILHOUSE_MEM_WRITE)
 		flags |= S2_PTE_ACCESS_WO;
-	if (mem->flags & JAILHOUSE_MEM_IO)
+	/*
+	 * WC maps to normal non-cacheable memory, UC to device memory. The
+	 * stricter of stage-1 and stage-2 attributes wins, so a forced type
+	 * can only keep the guest from using a weaker one. It also lifts the
+	 * device attribute of I/O regions.
+	 */
+	if ((mem->flags & JAILHOUSE_MEM_IO &&
+	     !(mem->flags & JAILHOUSE_MEM_TYPE_FORCE)) ||
+	    (mem->flags & JAILHOUSE_MEM_TYPE_MASK) == JAILHOUSE_MEM_TYPE_UC)
 		flags |= S2_PTE_FLAG_DEVICE;
+	else if ((mem->flags & JAILHOUSE_MEM_TYPE_MASK) ==
+		 JAILHOUSE_MEM_TYPE_WC)
+		flags |= S2_PTE_FLAG_NC;
 	else
 		flags |= S2_PTE_FLAG_NORMAL;
 	if (mem->flags & JAILHOUSE_MEM_COMM_REGION)
@@ -37,13 +49,21 @@ int arch_map_memory_region(struct cell *cell,
 		flags |= S2_PAGE_ACCESS_XN;
 	*/
 
-	return paging_create(&cell->arch.mm, phys_start, mem->size,
+	err = paging_create(&cell->arch.mm, phys_start, mem->size,
 		mem->virt_start, flags, PAGING_NON_COHERENT);
+	if (err)
+		return err;
+
+	paging_merge(&cell->arch.mm, mem->virt_start, mem->size,
+		     PAGING_NON_COHERENT);
+	cell->vcpu_caches_dirty = true;
+	return 0;
 }
 
 int arch_unmap_memory_region(struct cell *cell,
 			     const struct jailhouse_memory *mem)
 {
+	cell->vcpu_caches_dirty = true;
 	return paging_destroy(&cell->arch.mm, mem->virt_start, mem->size,
 			PAGING_NON_COHERENT);
 }
@@ -55,11 +75,17 @@ unsigned long arch_paging_gphys2phys(struct per_cpu *cpu_data,
 	return paging_virt2phys(&cpu_data->cell->arch.mm, gphys, flags);
 }
 
+const struct paging_structures *arch_cell_paging_structs(struct cell *cell)
+{
+	return &cell->arch.mm;
+}
+
 int arch_mmu_cell_init(struct cell *cell)
 {
 	cell->arch.mm.root_paging = cell_paging;
 	cell->arch.mm.root_table =
-		page_alloc_aligned(&mem_pool, ARM_CELL_ROOT_PT_SZ);
+		page_alloc_aligned(paging_pool_of(cell), ARM_CELL_ROOT_PT_SZ,
+				   PAGE_OWNER_PAGING);
 
 	if (!cell->arch.mm.root_table)
 		return -ENOMEM;
@@ -69,7 +95,10 @@ int arch_mmu_cell_init(struct cell *cell)
 
 void arch_mmu_cell_destroy(struct cell *cell)
 {
-	page_free(&mem_pool, cell->arch.mm.root_table, ARM_CELL_ROOT_PT_SZ);
+	paging_destroy_tables(&cell->arch.mm, ARM_CELL_ROOT_PT_SZ);
+	page_free(paging_pool_of(cell->arch.mm.root_table),
+		  cell->arch.mm.root_table, ARM_CELL_ROOT_PT_SZ,
+		  PAGE_OWNER_PAGING);
 }
 
 int arch_mmu_cpu_cell_init(struct per_cpu *cpu_data)
@@ -112,17 +141,74 @@ void arch_cpu_tlb_flush(struct per_cpu *cpu_data)
 	cpu_data->flush_vcpu_caches = false;
 }
 
+/*
+ * Above this amount of cell memory, cleaning by MVA is expected to take
+ * longer than walking all cache sets and ways.
+ */
+#define CELL_DCACHE_RANGE_FLUSH_MAX	(2 * 1024 * 1024)
+
+static bool is_cell_ram(const struct jailhouse_memory *mem)
+{
+	return !(mem->flags & (JAILHOUSE_MEM_IO | JAILHOUSE_MEM_COMM_REGION)) &&
+		!JAILHOUSE_MEMORY_IS_SUBPAGE(mem);
+}
+
+/*
+ * Data caches are physically indexed, so the lines of the cell's RAM can
+ * be cleaned via temporary hypervisor mappings, regardless of the virtual
+ * addresses the root cell used to write them.
+ */
+static bool arch_cell_dcaches_flush_range(struct cell *cell)
+{
+	const struct jailhouse_memory *mem;
+	unsigned long size = 0, offs;
+	unsigned int n, pages;
+	void *addr;
+
+	for_each_mem_region(mem, cell->config, n)
+		if (is_cell_ram(mem) && cell_mem_region_present(cell, mem))
+			size += mem->size;
+	if (size > CELL_DCACHE_RANGE_FLUSH_MAX)
+		return false;
+
+	for_each_mem_region(mem, cell->config, n) {
+		if (!is_cell_ram(mem) || !cell_mem_region_present(cell, mem))
+			continue;
+
+		for (offs = 0; offs < mem->size;
+		     offs += pages * PAGE_SIZE) {
+			pages = MIN((mem->size - offs) / PAGE_SIZE,
+				    num_temporary_pages);
+			addr = paging_get_guest_pages(NULL,
+						      mem->virt_start + offs,
+						      pages,
+						      PAGE_DEFAULT_FLAGS);
+			if (!addr)
+				return false;
+			arch_paging_flush_cpu_caches(addr, pages * PAGE_SIZE);
+		}
+	}
+	arch_paging_flush_cpu_caches(&cell->comm_page,
+				     sizeof(cell->comm_page));
+	dsb(ish);
+
+	return true;
+}
+
 void arch_cell_caches_flush(struct cell *cell)
 {
 	/* Only the first CPU needs to clean the data caches */
 	spin_lock(&cell->arch.caches_lock);
 	if (cell->arch.needs_flush) {
 		/*
-		 * Since there is no way to know which virtual addresses have been used
-		 * by the root cell to write the new cell's data, a complete clean has
-		 * to be performed.
+		 * Clean all of the cell's RAM, not only the loadable regions:
+		 * dirty lines left from its previous run would otherwise be
+		 * written back over data the cell stores with caches disabled.
+		 * Fall back to a complete clean by set/way if the cell is
+		 * large or its memory cannot be mapped.
 		 */
-		arch_cpu_dcaches_flush(CACHES_CLEAN_INVALIDATE);
+		if (!arch_cell_dcaches_flush_range(cell))
+			arch_cpu_dcaches_flush(CACHES_CLEAN_INVALIDATE);
 		cell->arch.needs_flush = false;
 	}
 	spin_unlock(&cell->arch.caches_lock);
@@ -80,6 +80,12 @@ static pt_entry_t arm_get_l1_alt_entry(page_table_t page_table, unsigned long vi
 	return &page_table[(virt & BIT_MASK(48,30)) >> 30];
 }
 
+static void arm_set_l1_alt_block(pt_entry_t pte, unsigned long phys,
+				 unsigned long flags)
+{
+	*pte = ((u64)phys & BIT_MASK(48,30)) | flags;
+}
+
 static unsigned long arm_get_l1_alt_phys(pt_entry_t pte, unsigned long virt)
 {
 	if ((*pte & PTE_TABLE_FLAGS) == PTE_TABLE_FLAGS)
@@ -131,6 +137,87 @@ static unsigned long arm_get_l3_phys(pt_entry_t pte, unsigned long virt)
 	return (*pte & PTE_PAGE_ADDR_MASK) | (virt & PAGE_MASK);
 }
 
+/*
+ * Stage-2 tables carry the contiguous hint on every aligned group of 16
+ * entries that maps a physically contiguous run with identical attributes.
+ * The hint must never be left on a group that stops meeting these
+ * conditions, so any write to a hinted entry first drops it from the whole
+ * group. The stage-2 TLB is invalidated for the affected cells before they
+ * run again, see config_commit.
+ */
+static pt_entry_t arm_s2_contig_group(pt_entry_t pte)
+{
+	return (pt_entry_t)((unsigned long)pte &
+			    ~(PTE_CONTIG_ENTRIES * sizeof(u64) - 1));
+}
+
+static void arm_s2_break_contig(pt_entry_t pte)
+{
+	pt_entry_t first;
+	unsigned int n;
+
+	if (!(*pte & PTE_CONTIG_HINT))
+		return;
+
+	first = arm_s2_contig_group(pte);
+	for (n = 0; n < PTE_CONTIG_ENTRIES; n++)
+		first[n] &= ~PTE_CONTIG_HINT;
+}
+
+/*
+ * Called after writing a terminal entry. The core fills tables in ascending
+ * order, so checking when the last entry of a group is written is enough to
+ * catch every run created by paging_create.
+ */
+static void arm_s2_make_contig(pt_entry_t pte, u64 addr_mask,
+			       unsigned long page_size)
+{
+	pt_entry_t first = arm_s2_contig_group(pte);
+	u64 attrs = *first & ~addr_mask;
+	u64 phys = *first & addr_mask;
+	unsigned int n;
+
+	if (pte != first + PTE_CONTIG_ENTRIES - 1 ||
+	    (phys & (PTE_CONTIG_ENTRIES * (u64)page_size - 1)) != 0)
+		return;
+
+	for (n = 1; n < PTE_CONTIG_ENTRIES; n++)
+		if ((first[n] & ~addr_mask) != attrs ||
+		    (first[n] & addr_mask) != phys + n * (u64)page_size)
+			return;
+
+	for (n = 0; n < PTE_CONTIG_ENTRIES; n++)
+		first[n] |= PTE_CONTIG_HINT;
+}
+
+static void arm_s2_clear_entry(pt_entry_t entry)
+{
+	arm_s2_break_contig(entry);
+	arm_clear_entry(entry);
+}
+
+static void arm_s2_set_l2_block(pt_entry_t pte, unsigned long phys,
+				unsigned long flags)
+{
+	arm_s2_break_contig(pte);
+	arm_set_l2_block(pte, phys, flags);
+	arm_s2_make_contig(pte, PTE_L2_BLOCK_ADDR_MASK, 2 * 1024 * 1024);
+}
+
+static void arm_s2_set_l3_page(pt_entry_t pte, unsigned long phys,
+			       unsigned long flags)
+{
+	arm_s2_break_contig(pte);
+	arm_set_l3_page(pte, phys, flags);
+	arm_s2_make_contig(pte, PTE_PAGE_ADDR_MASK, 4 * 1024);
+}
+
+static void arm_s2_set_l12_table(pt_entry_t pte, unsigned long next_pt)
+{
+	arm_s2_break_contig(pte);
+	arm_set_l12_table(pte, next_pt);
+}
+
 #define ARM_PAGING_COMMON				\
 		.entry_valid = arm_entry_valid,		\
 		.get_flags = arm_get_entry_flags,	\
@@ -183,32 +270,41 @@ const static struct paging arm_paging[] = {
 	}
 };
 
+#define ARM_S2_PAGING_COMMON				\
+		.entry_valid = arm_entry_valid,		\
+		.get_flags = arm_get_entry_flags,	\
+		.clear_entry = arm_s2_clear_entry,	\
+		.page_table_empty = arm_page_table_empty,
+
 const static struct paging arm_s2_paging_alt[] = {
 	{
-		ARM_PAGING_COMMON
+		ARM_S2_PAGING_COMMON
+		/* Block entry: 1GB */
+		.page_size = 1024 * 1024 * 1024,
 		.get_entry = arm_get_l1_alt_entry,
+		.set_terminal = arm_set_l1_alt_block,
 		.get_phys = arm_get_l1_alt_phys,
 
 		.set_next_pt = arm_set_l12_table,
 		.get_next_pt = arm_get_l12_table,
 	},
 	{
-		ARM_PAGING_COMMON
-		/* Block entry: 2MB */
+		ARM_S2_PAGING_COMMON
+		/* Block entry: 2MB, contiguous runs of 32MB */
 		.page_size = 2 * 1024 * 1024,
 		.get_entry = arm_get_l2_entry,
-		.set_terminal = arm_set_l2_block,
+		.set_terminal = arm_s2_set_l2_block,
 		.get_phys = arm_get_l2_phys,
 
-		.set_next_pt = arm_set_l12_table,
+		.set_next_pt = arm_s2_set_l12_table,
 		.get_next_pt = arm_get_l12_table,
 	},
 	{
-		ARM_PAGING_COMMON
-		/* Page entry: 4kB */
+		ARM_S2_PAGING_COMMON
+		/* Page entry: 4kB, contiguous runs of 64kB */
 		.page_size = 4 * 1024,
 		.get_entry = arm_get_l3_entry,
-		.set_terminal = arm_set_l3_page,
+		.set_terminal = arm_s2_set_l3_page,
 		.get_phys = arm_get_l3_phys,
 	}
 };
@@ -15,6 +15,7 @@
 #include <asm/psci.h>
 #include <asm/traps.h>
 #include <jailhouse/control.h>
+#include <jailhouse/printk.h>
 
 void _psci_cpu_off(struct psci_mbox *);
 long _psci_cpu_on(struct psci_mbox *, unsigned long, unsigned long);
@@ -63,16 +64,67 @@ long psci_try_resume(unsigned int cpu_id)
 	return -EBUSY;
 }
 
+/*
+ * Waiting relies on the SEV issued by _psci_cpu_off. The event stream of the
+ * physical counter is enabled meanwhile so that WFE also returns periodically
+ * and a CPU that never stops cannot keep us asleep past the timeout.
+ * EVNTI selects counter bit 11, i.e. one event every ~170 us at 24 MHz.
+ */
+#define PSCI_STOP_TIMEOUT_MS	1000
+
+#define CNTHCTL_EVNTEN		(1 << 2)
+#define CNTHCTL_EVNTI_SHIFT	4
+#define CNTHCTL_EVNTI_MASK	(0xf << CNTHCTL_EVNTI_SHIFT)
+#define CNTHCTL_EVNTI_WAIT	(11 << CNTHCTL_EVNTI_SHIFT)
+
 int psci_wait_cpu_stopped(unsigned int cpu_id)
 {
-	/* FIXME: add a delay */
-	do {
-		if (psci_cpu_stopped(cpu_id))
-			return 0;
-		cpu_relax();
-	} while (1);
+	u64 *stat = &this_cpu_data()->stats[JAILHOUSE_CPU_STAT_PSCI_STOP_WAIT];
+	u64 start, now, timeout;
+	int err = 0;
+	u32 cnthctl;
 
-	return -EBUSY;
+	if (psci_cpu_stopped(cpu_id))
+		return 0;
+
+	timeout = (u64)arch_get_cycles_khz() * PSCI_STOP_TIMEOUT_MS;
+
+	arm_read_sysreg(CNTHCTL_EL2, cnthctl);
+	arm_write_sysreg(CNTHCTL_EL2, (cnthctl & ~CNTHCTL_EVNTI_MASK) |
+			 CNTHCTL_EVNTEN | CNTHCTL_EVNTI_WAIT);
+
+	start = get_cycles();
+	while (!psci_cpu_stopped(cpu_id)) {
+		now = get_cycles();
+		if (now - start > timeout) {
+			printk("ERROR: CPU%d did not stop within %d ms\n",
+			       cpu_id, PSCI_STOP_TIMEOUT_MS);
+			err = -EBUSY;
+			break;
+		}
+		wfe();
+	}
+	*stat += get_cycles() - start;
+
+	arm_write_sysreg(CNTHCTL_EL2, cnthctl);
+
+	return err;
+}
+
+/*
+ * Non-root cells see their virtual CPU IDs in MPIDR. Physical MPIDRs are still
+ * accepted for them if they do not match any virtual ID.
+ */
+static unsigned int psci_target_cpu(struct cell *cell, unsigned long mpidr)
+{
+	unsigned int cpu = -1;
+
+	if (cell != &root_cell)
+		cpu = arm_cpu_virt2phys(cell, mpidr & MPIDR_CPUID_MASK);
+	if (cpu == -1)
+		cpu = arm_cpu_by_mpidr(cell, mpidr);
+
+	return cpu;
 }
 
 static long psci_emulate_cpu_on(struct per_cpu *cpu_data,
@@ -81,7 +133,7 @@ static long psci_emulate_cpu_on(struct per_cpu *cpu_data,
 	unsigned int cpu;
 	struct psci_mbox *mbox;
 
-	cpu = arm_cpu_by_mpidr(cpu_data->cell, ctx->regs[1]);
+	cpu = psci_target_cpu(cpu_data->cell, ctx->regs[1]);
 	if (cpu == -1)
 		/* Virtual id not in set */
 		return PSCI_DENIED;
@@ -96,7 +148,7 @@ static long psci_emulate_cpu_on(struct per_cpu *cpu_data,
 static long psci_emulate_affinity_info(struct per_cpu *cpu_data,
 				       struct trap_context *ctx)
 {
-	unsigned int cpu = arm_cpu_by_mpidr(cpu_data->cell, ctx->regs[1]);
+	unsigned int cpu = psci_target_cpu(cpu_data->cell, ctx->regs[1]);
 
 	if (cpu == -1)
 		/* Virtual id not in set */
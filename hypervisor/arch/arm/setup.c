@@ -14,6 +14,8 @@
 #include <asm/irqchip.h>
 #include <asm/percpu.h>
 #include <asm/setup.h>
+#include <asm/smmu.h>
+#include <asm/spinlock.h>
 #include <asm/sysregs.h>
 #include <jailhouse/control.h>
 #include <jailhouse/paging.h>
@@ -49,7 +51,7 @@ int arch_init_early(void)
 	return arch_mmu_cell_init(&root_cell);
 }
 
-int arch_cpu_init(struct per_cpu *cpu_data)
+static int arm_cpu_init(struct per_cpu *cpu_data)
 {
 	int err = 0;
 	unsigned long hcr = HCR_VM_BIT | HCR_IMO_BIT | HCR_FMO_BIT
@@ -93,6 +95,23 @@ int arch_cpu_init(struct per_cpu *cpu_data)
 	return err;
 }
 
+int arch_cpu_init(struct per_cpu *cpu_data)
+{
+	static DEFINE_SPINLOCK(cpu_init_lock);
+	int err;
+
+	/*
+	 * The switch to EL2 goes through the shared identity mapping, and
+	 * irqchip_init sets up global state. Keep bringing up the CPUs one by
+	 * one.
+	 */
+	spin_lock(&cpu_init_lock);
+	err = arm_cpu_init(cpu_data);
+	spin_unlock(&cpu_init_lock);
+
+	return err;
+}
+
 int arch_init_late(void)
 {
 	int err;
@@ -109,7 +128,12 @@ int arch_init_late(void)
 	if (err)
 		return err;
 
-	return map_root_memory_regions();
+	err = map_root_memory_regions();
+	if (err)
+		return err;
+
+	/* DMA of the root cell is translated once its memory is mapped */
+	return arm_smmu_init();
 }
 
 void __attribute__((noreturn)) arch_cpu_activate_vmm(struct per_cpu *cpu_data)
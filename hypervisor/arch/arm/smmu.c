@@ -0,0 +1,321 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * ARM SMMUv2 support for stage-2 translation of DMA requests. Each cell
+ * gets the context bank matching its ID. The bank uses the stage-2 page
+ * tables of the cell's CPUs, so no separate DMA tables are maintained.
+ */
+
+#include <jailhouse/control.h>
+#include <jailhouse/mmio.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/printk.h>
+#include <asm/paging.h>
+#include <asm/platform.h>
+#include <asm/processor.h>
+#include <asm/setup.h>
+#include <asm/smmu.h>
+
+#ifndef SMMU_BASE
+# define SMMU_BASE			NULL
+# define SMMU_SIZE			0
+#endif
+
+#define ARM_SMMU_MAX_SMRS		128
+
+/* global register space 0 */
+#define ARM_SMMU_GR0_sCR0		0x000
+#define  sCR0_CLIENTPD			(1 << 0)
+#define  sCR0_GFRE			(1 << 1)
+#define  sCR0_GFIE			(1 << 2)
+#define  sCR0_GCFGFRE			(1 << 4)
+#define  sCR0_GCFGFIE			(1 << 5)
+#define  sCR0_USFCFG			(1 << 10)
+#define  sCR0_VMIDPNE			(1 << 11)
+#define  sCR0_PTM			(1 << 12)
+#define  sCR0_FB			(1 << 13)
+#define  sCR0_BSU_MASK			(3 << 14)
+#define ARM_SMMU_GR0_ID0		0x020
+#define  ID0_NUMSMRG_MASK		0xff
+#define  ID0_NUMSIDB_SHIFT		9
+#define  ID0_NUMSIDB_MASK		0xf
+#define  ID0_SMS			(1 << 27)
+#define  ID0_S2TS			(1 << 29)
+#define ARM_SMMU_GR0_ID1		0x024
+#define  ID1_NUMS2CB_SHIFT		16
+#define  ID1_NUMS2CB_MASK		0xff
+#define  ID1_NUMPAGENDXB_SHIFT		28
+#define  ID1_NUMPAGENDXB_MASK		0x7
+#define  ID1_PAGESIZE			(1 << 31)
+#define ARM_SMMU_GR0_sGFSR		0x048
+#define ARM_SMMU_GR0_TLBIVMID		0x064
+#define ARM_SMMU_GR0_TLBIALLNSNH	0x068
+#define ARM_SMMU_GR0_TLBIALLH		0x06c
+#define ARM_SMMU_GR0_sTLBGSYNC		0x070
+#define ARM_SMMU_GR0_sTLBGSTATUS	0x074
+#define  sTLBGSTATUS_GSACTIVE		(1 << 0)
+#define ARM_SMMU_GR0_SMR(n)		(0x800 + (n) * 4)
+#define  SMR_VALID			(1 << 31)
+#define ARM_SMMU_GR0_S2CR(n)		(0xc00 + (n) * 4)
+#define  S2CR_TYPE_TRANS		(0 << 16)
+#define  S2CR_TYPE_FAULT		(2 << 16)
+
+/* global register space 1 */
+#define ARM_SMMU_GR1_CBAR(n)		((n) * 4)
+#define  CBAR_TYPE_S2_TRANS		(0 << 16)
+
+/* context banks */
+#define ARM_SMMU_CB_SCTLR		0x00
+#define  SCTLR_M			(1 << 0)
+#define  SCTLR_CFRE			(1 << 5)
+#define ARM_SMMU_CB_TTBR0_LO		0x20
+#define ARM_SMMU_CB_TTBR0_HI		0x24
+#define ARM_SMMU_CB_TCR			0x30
+#define ARM_SMMU_CB_FSR			0x58
+
+#define SMR_UNUSED			-1
+
+static struct {
+	void *base;
+	void *cb_base;
+	unsigned long page_size;
+	unsigned int num_smrs;
+	unsigned int num_s2cbs;
+	u32 sid_mask;
+	/* stream ID matched by each SMR */
+	u32 smr_sid[ARM_SMMU_MAX_SMRS];
+	/* ID of the cell owning the stream, SMR_UNUSED if free */
+	int smr_cell[ARM_SMMU_MAX_SMRS];
+} smmu;
+
+static void *arm_smmu_cb(unsigned int cb)
+{
+	return smmu.cb_base + cb * smmu.page_size;
+}
+
+static void arm_smmu_tlb_sync(void)
+{
+	mmio_write32(smmu.base + ARM_SMMU_GR0_sTLBGSYNC, 0);
+	while (mmio_read32(smmu.base + ARM_SMMU_GR0_sTLBGSTATUS) &
+	       sTLBGSTATUS_GSACTIVE)
+		cpu_relax();
+}
+
+static bool arm_smmu_cell_has_sid(struct cell *cell, u32 sid)
+{
+	const u32 *cell_sid = cell->cfg.stream_ids;
+	unsigned int n;
+
+	for (n = 0; n < cell->config->num_stream_ids; n++, cell_sid++)
+		if (*cell_sid == sid)
+			return true;
+	return false;
+}
+
+static void arm_smmu_assign_smr(unsigned int smr, u32 sid, struct cell *cell)
+{
+	/* route the stream before it starts matching */
+	mmio_write32(smmu.base + ARM_SMMU_GR0_S2CR(smr),
+		     S2CR_TYPE_TRANS | cell->id);
+	mmio_write32(smmu.base + ARM_SMMU_GR0_SMR(smr), SMR_VALID | sid);
+	smmu.smr_sid[smr] = sid;
+	smmu.smr_cell[smr] = cell->id;
+}
+
+static void arm_smmu_release_smr(unsigned int smr)
+{
+	mmio_write32(smmu.base + ARM_SMMU_GR0_SMR(smr), 0);
+	mmio_write32(smmu.base + ARM_SMMU_GR0_S2CR(smr), S2CR_TYPE_FAULT);
+	smmu.smr_cell[smr] = SMR_UNUSED;
+}
+
+static int arm_smmu_get_smr(u32 sid, struct cell *cell)
+{
+	int smr, free_smr = -1;
+
+	for (smr = 0; smr < smmu.num_smrs; smr++) {
+		if (smmu.smr_cell[smr] == SMR_UNUSED) {
+			if (free_smr < 0)
+				free_smr = smr;
+		} else if (smmu.smr_sid[smr] == sid) {
+			/* streams can only be taken over from the root cell */
+			if (smmu.smr_cell[smr] != root_cell.id &&
+			    smmu.smr_cell[smr] != cell->id)
+				return trace_error(-EBUSY);
+			return smr;
+		}
+	}
+	if (free_smr < 0)
+		return trace_error(-E2BIG);
+	return free_smr;
+}
+
+int arm_smmu_cell_init(struct cell *cell)
+{
+	const u32 *sid = cell->cfg.stream_ids;
+	unsigned long root_table;
+	unsigned int n;
+	void *cb;
+	int smr;
+
+	if (!smmu.base || cell->config->num_stream_ids == 0)
+		return 0;
+
+	if (cell->id >= smmu.num_s2cbs)
+		return trace_error(-ERANGE);
+
+	/*
+	 * Share the stage-2 tables of the CPUs. They are updated with
+	 * PAGING_NON_COHERENT, so even a non-coherent table walker sees
+	 * consistent entries.
+	 */
+	cb = arm_smmu_cb(cell->id);
+	root_table = paging_hvirt2phys(cell->arch.mm.root_table);
+	mmio_write32(cb + ARM_SMMU_CB_SCTLR, 0);
+	mmio_write32(smmu.base + smmu.page_size + ARM_SMMU_GR1_CBAR(cell->id),
+		     CBAR_TYPE_S2_TRANS | cell->id);
+	mmio_write32(cb + ARM_SMMU_CB_TCR, VTCR_CELL);
+	mmio_write32(cb + ARM_SMMU_CB_TTBR0_LO, root_table & TTBR_MASK);
+	mmio_write32(cb + ARM_SMMU_CB_TTBR0_HI, 0);
+	mmio_write32(cb + ARM_SMMU_CB_FSR, ~0);
+	mmio_write32(cb + ARM_SMMU_CB_SCTLR, SCTLR_M | SCTLR_CFRE);
+
+	mmio_write32(smmu.base + ARM_SMMU_GR0_TLBIVMID, cell->id);
+	arm_smmu_tlb_sync();
+
+	for (n = 0; n < cell->config->num_stream_ids; n++, sid++) {
+		if (*sid & ~smmu.sid_mask)
+			return trace_error(-EINVAL);
+		smr = arm_smmu_get_smr(*sid, cell);
+		if (smr < 0)
+			return smr;
+		arm_smmu_assign_smr(smr, *sid, cell);
+	}
+
+	return 0;
+}
+
+void arm_smmu_cell_exit(struct cell *cell)
+{
+	unsigned int smr;
+
+	if (!smmu.base)
+		return;
+
+	/* hand streams back to the root cell if it lists them */
+	for (smr = 0; smr < smmu.num_smrs; smr++) {
+		if (smmu.smr_cell[smr] != cell->id)
+			continue;
+		if (cell != &root_cell &&
+		    arm_smmu_cell_has_sid(&root_cell, smmu.smr_sid[smr]))
+			arm_smmu_assign_smr(smr, smmu.smr_sid[smr], &root_cell);
+		else
+			arm_smmu_release_smr(smr);
+	}
+
+	if (cell->id < smmu.num_s2cbs)
+		mmio_write32(arm_smmu_cb(cell->id) + ARM_SMMU_CB_SCTLR, 0);
+	mmio_write32(smmu.base + ARM_SMMU_GR0_TLBIVMID, cell->id);
+	arm_smmu_tlb_sync();
+}
+
+void arm_smmu_tlb_flush(struct cell *cell)
+{
+	if (!smmu.base || cell->config->num_stream_ids == 0)
+		return;
+
+	mmio_write32(smmu.base + ARM_SMMU_GR0_TLBIVMID, cell->id);
+	arm_smmu_tlb_sync();
+}
+
+int arm_smmu_init(void)
+{
+	unsigned int n, num_pages;
+	u32 id0, id1, cr0;
+	int err;
+
+	if (!SMMU_BASE)
+		return 0;
+
+	err = arch_map_device(SMMU_BASE, SMMU_BASE, SMMU_SIZE);
+	if (err)
+		return err;
+	smmu.base = SMMU_BASE;
+
+	id0 = mmio_read32(smmu.base + ARM_SMMU_GR0_ID0);
+	id1 = mmio_read32(smmu.base + ARM_SMMU_GR0_ID1);
+	if (!(id0 & ID0_S2TS) || !(id0 & ID0_SMS)) {
+		printk("SMMU: no stage-2 translation or stream matching\n");
+		err = -EIO;
+		goto err_unmap;
+	}
+
+	smmu.num_smrs = MIN(id0 & ID0_NUMSMRG_MASK, ARM_SMMU_MAX_SMRS);
+	smmu.sid_mask = (1 << ((id0 >> ID0_NUMSIDB_SHIFT) &
+			       ID0_NUMSIDB_MASK)) - 1;
+	smmu.num_s2cbs = (id1 >> ID1_NUMS2CB_SHIFT) & ID1_NUMS2CB_MASK;
+	smmu.page_size = (id1 & ID1_PAGESIZE) ? 0x10000 : 0x1000;
+	num_pages = 1 << (((id1 >> ID1_NUMPAGENDXB_SHIFT) &
+			   ID1_NUMPAGENDXB_MASK) + 1);
+	smmu.cb_base = smmu.base + num_pages * smmu.page_size;
+	if (smmu.cb_base + smmu.num_s2cbs * smmu.page_size >
+	    smmu.base + SMMU_SIZE) {
+		err = trace_error(-EINVAL);
+		goto err_unmap;
+	}
+
+	/* fault all streams and disable all stage-2 context banks */
+	for (n = 0; n < smmu.num_smrs; n++)
+		arm_smmu_release_smr(n);
+	for (n = 0; n < smmu.num_s2cbs; n++) {
+		mmio_write32(arm_smmu_cb(n) + ARM_SMMU_CB_SCTLR, 0);
+		mmio_write32(arm_smmu_cb(n) + ARM_SMMU_CB_FSR, ~0);
+	}
+	mmio_write32(smmu.base + ARM_SMMU_GR0_sGFSR,
+		     mmio_read32(smmu.base + ARM_SMMU_GR0_sGFSR));
+	mmio_write32(smmu.base + ARM_SMMU_GR0_TLBIALLNSNH, 0);
+	mmio_write32(smmu.base + ARM_SMMU_GR0_TLBIALLH, 0);
+	arm_smmu_tlb_sync();
+
+	err = arm_smmu_cell_init(&root_cell);
+	if (err)
+		goto err_unmap;
+
+	/*
+	 * Enable translation. Unmatched streams fault, so DMA masters that
+	 * no cell lists are blocked.
+	 */
+	cr0 = mmio_read32(smmu.base + ARM_SMMU_GR0_sCR0);
+	cr0 &= ~(sCR0_CLIENTPD | sCR0_PTM | sCR0_FB | sCR0_BSU_MASK);
+	cr0 |= sCR0_GFRE | sCR0_GFIE | sCR0_GCFGFRE | sCR0_GCFGFIE |
+		sCR0_USFCFG | sCR0_VMIDPNE;
+	mmio_write32(smmu.base + ARM_SMMU_GR0_sCR0, cr0);
+
+	printk("SMMU: %d stream matching groups, %d stage-2 contexts\n",
+	       smmu.num_smrs, smmu.num_s2cbs);
+
+	return 0;
+
+err_unmap:
+	arch_unmap_device(SMMU_BASE, SMMU_SIZE);
+	smmu.base = NULL;
+	return err;
+}
+
+void arm_smmu_shutdown(void)
+{
+	if (!smmu.base)
+		return;
+
+	/* return to bypass mode, Linux did not use the SMMU */
+	mmio_write32(smmu.base + ARM_SMMU_GR0_sCR0,
+		     mmio_read32(smmu.base + ARM_SMMU_GR0_sCR0) |
+		     sCR0_CLIENTPD);
+	mmio_write32(smmu.base + ARM_SMMU_GR0_TLBIALLNSNH, 0);
+	arm_smmu_tlb_sync();
+}
@@ -189,7 +189,7 @@ void access_cell_reg(struct trap_context *ctx, u8 reg, unsigned long *val,
 	}
 }
 
-static void dump_guest_regs(struct trap_context *ctx)
+static __cold void dump_guest_regs(struct trap_context *ctx)
 {
 	u8 reg;
 	unsigned long reg_val;
@@ -300,10 +300,19 @@ void arch_handle_trap(struct per_cpu *cpu_data, struct registers *guest_regs)
 	u32 exception_class;
 	int ret = TRAP_UNHANDLED;
 
-	arm_read_banked_reg(ELR_hyp, ctx.pc);
-	arm_read_banked_reg(SPSR_hyp, ctx.cpsr);
 	arm_read_sysreg(ESR_EL2, ctx.esr);
 	exception_class = ESR_EC(ctx.esr);
+
+	/*
+	 * Most MMIO accesses can be emulated without a trap context. Data
+	 * aborts are never conditional, so there is no condition to check.
+	 */
+	if (exception_class == ESR_EC_DABT &&
+	    arch_handle_dabt_fast(guest_regs, ctx.esr))
+		return;
+
+	arm_read_banked_reg(ELR_hyp, ctx.pc);
+	arm_read_banked_reg(SPSR_hyp, ctx.cpsr);
 	ctx.regs = guest_regs->usr;
 
 	/*
@@ -22,6 +22,7 @@
 #include <jailhouse/pci.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <asm/amd_iommu.h>
 #include <asm/apic.h>
 #include <asm/iommu.h>
@@ -105,6 +106,7 @@ union buf_entry {
 #define CMD_INV_IOMMU_PAGES		0x03
 # define CMD_INV_IOMMU_PAGES_SIZE	(1 << 0)
 # define CMD_INV_IOMMU_PAGES_PDE	(1 << 1)
+# define CMD_INV_IOMMU_PAGES_MAX_ORDER	(51 - PAGE_SHIFT)
 
 #define EVENT_TYPE_ILL_DEV_TAB_ENTRY	0x01
 #define EVENT_TYPE_PAGE_TAB_HW_ERR	0x04
@@ -139,6 +141,10 @@ static struct amd_iommu {
 	void *devtable_segments[DEV_TABLE_SEG_MAX];
 	u8 dev_tbl_seg_sup;
 	u32 cmd_tail_ptr;
+	/* Last read value of the head register, saves MMIO reads. */
+	u32 cmd_head_ptr;
+	/* Cleared by the IOMMU when a COMPLETION_WAIT is reached. */
+	volatile u64 compl_sem;
 	bool he_supported;
 } iommu_units[JAILHOUSE_MAX_IOMMU_UNITS];
 
@@ -198,7 +204,8 @@ static int amd_iommu_init_pci(struct amd_iommu *entry,
 			 4);
 
 	/* Allocate and map MMIO space */
-	entry->mmio_base = page_alloc(&remap_pool, PAGES(iommu->size));
+	entry->mmio_base = page_alloc(&remap_pool, PAGES(iommu->size),
+				      PAGE_OWNER_IOMMU);
 	if (!entry->mmio_base)
 		return -ENOMEM;
 
@@ -279,7 +286,8 @@ static int amd_iommu_init_buffers(struct amd_iommu *entry,
 				  struct jailhouse_iommu *iommu)
 {
 	/* Allocate and configure command buffer */
-	entry->cmd_buf_base = page_alloc(&mem_pool, PAGES(CMD_BUF_SIZE));
+	entry->cmd_buf_base = page_alloc(&mem_pool, PAGES(CMD_BUF_SIZE),
+					 PAGE_OWNER_IOMMU);
 	if (!entry->cmd_buf_base)
 		return -ENOMEM;
 
@@ -288,9 +296,11 @@ static int amd_iommu_init_buffers(struct amd_iommu *entry,
 		     ((u64)CMD_BUF_LEN_EXPONENT << BUF_LEN_EXPONENT_SHIFT));
 
 	entry->cmd_tail_ptr = 0;
+	entry->cmd_head_ptr = 0;
 
 	/* Allocate and configure event log */
-	entry->evt_log_base = page_alloc(&mem_pool, PAGES(EVT_LOG_SIZE));
+	entry->evt_log_base = page_alloc(&mem_pool, PAGES(EVT_LOG_SIZE),
+					 PAGE_OWNER_IOMMU);
 	if (!entry->evt_log_base)
 		return -ENOMEM;
 
@@ -363,25 +373,37 @@ int iommu_cell_init(struct cell *cell)
 	if (cell->id > 0xffff)
 		return trace_error(-ERANGE);
 
-	return 0;
+	return iommu_check_passthrough(cell);
 }
 
 static void amd_iommu_completion_wait(struct amd_iommu *iommu);
 
+static u32 amd_iommu_cmd_buf_free(struct amd_iommu *iommu)
+{
+	u32 next_tail = (iommu->cmd_tail_ptr + sizeof(union buf_entry)) %
+		CMD_BUF_SIZE;
+
+	return (iommu->cmd_head_ptr - next_tail) % CMD_BUF_SIZE;
+}
+
 static void amd_iommu_submit_command(struct amd_iommu *iommu,
 				     union buf_entry *cmd, bool draining)
 {
-	u32 head, next_tail, bytes_free;
 	unsigned char *cur_ptr;
 
-	head = mmio_read64(iommu->mmio_base + AMD_CMD_BUF_HEAD_REG);
-	next_tail = (iommu->cmd_tail_ptr + sizeof(*cmd)) % CMD_BUF_SIZE;
-	bytes_free = (head - next_tail) % CMD_BUF_SIZE;
-
-	/* Leave space for COMPLETION_WAIT that drains the buffer. */
-	if (bytes_free < (2 * sizeof(*cmd)) && !draining)
-		/* Drain the buffer */
-		amd_iommu_completion_wait(iommu);
+	/*
+	 * Commands are only published to the IOMMU by the tail update of the
+	 * next COMPLETION_WAIT, so the head can only have moved since we last
+	 * looked at it if there is less space left than we thought.
+	 * Leave space for COMPLETION_WAIT that drains the buffer.
+	 */
+	if (amd_iommu_cmd_buf_free(iommu) < (2 * sizeof(*cmd)) && !draining) {
+		iommu->cmd_head_ptr =
+			mmio_read64(iommu->mmio_base + AMD_CMD_BUF_HEAD_REG);
+		if (amd_iommu_cmd_buf_free(iommu) < (2 * sizeof(*cmd)))
+			/* Drain the buffer */
+			amd_iommu_completion_wait(iommu);
+	}
 
 	cur_ptr = &iommu->cmd_buf_base[iommu->cmd_tail_ptr];
 	memcpy(cur_ptr, cmd, sizeof(*cmd));
@@ -418,7 +440,12 @@ int iommu_map_memory_region(struct cell *cell,
 	if (mem->virt_start & BIT_MASK(63, 48))
 		return trace_error(-E2BIG);
 
-	/* vcpu_map_memory_region already did the actual work. */
+	/*
+	 * vcpu_map_memory_region already did the actual work, we only have to
+	 * invalidate the IOTLB on commit.
+	 */
+	if (mem->flags & JAILHOUSE_MEM_DMA)
+		iommu_track_region_change(cell, mem);
 	return 0;
 }
 
@@ -426,6 +453,8 @@ int iommu_unmap_memory_region(struct cell *cell,
 			      const struct jailhouse_memory *mem)
 {
 	/* vcpu_map_memory_region already did the actual work. */
+	if (mem->flags & JAILHOUSE_MEM_DMA)
+		iommu_track_region_change(cell, mem);
 	return 0;
 }
 
@@ -476,7 +505,8 @@ static struct dev_table_entry *get_dev_table_entry(struct amd_iommu *iommu,
 		if (!allocate)
 			return NULL;
 
-		devtable_seg = page_alloc(&mem_pool, PAGES(seg_size));
+		devtable_seg = page_alloc(&mem_pool, PAGES(seg_size),
+					  PAGE_OWNER_IOMMU);
 		if (!devtable_seg)
 			return NULL;
 		iommu->devtable_segments[seg_idx] = devtable_seg;
@@ -531,10 +561,16 @@ int iommu_add_pci_device(struct cell *cell, struct pci_device *device)
 	/* DomainID */
 	dte->raw64[1] = cell->id & 0xffff;
 
-	/* Translation information */
-	dte->raw64[0] = DTE_IR | DTE_IW |
-		paging_hvirt2phys(cell->arch.svm.npt_iommu_structs.root_table) |
-		DTE_PAGING_MODE_4_LEVEL | DTE_TRANSLATION_VALID | DTE_VALID;
+	/* Translation information, Mode 0 lets DMA pass untranslated */
+	if (iommu_cell_passthrough(cell))
+		dte->raw64[0] = DTE_IR | DTE_IW | DTE_TRANSLATION_VALID |
+			DTE_VALID;
+	else
+		dte->raw64[0] = DTE_IR | DTE_IW |
+			paging_hvirt2phys(
+				cell->arch.svm.npt_iommu_structs.root_table) |
+			DTE_PAGING_MODE_4_LEVEL | DTE_TRANSLATION_VALID |
+			DTE_VALID;
 
 	/* TODO: Interrupt remapping. For now, just forward them unmapped. */
 
@@ -543,6 +579,9 @@ int iommu_add_pci_device(struct cell *cell, struct pci_device *device)
 
 	amd_iommu_inv_dte(iommu, bdf);
 
+	iommu_track_domain_change(&root_cell);
+	iommu_track_domain_change(cell);
+
 	return 0;
 }
 
@@ -576,6 +615,10 @@ void iommu_remove_pci_device(struct pci_device *device)
 	arch_paging_flush_cpu_caches(dte, sizeof(*dte));
 
 	amd_iommu_inv_dte(iommu, bdf);
+
+	iommu_track_domain_change(&root_cell);
+	if (device->cell)
+		iommu_track_domain_change(device->cell);
 }
 
 void iommu_cell_exit(struct cell *cell)
@@ -606,13 +649,68 @@ static void amd_iommu_invalidate_pages(struct amd_iommu *iommu,
 	amd_iommu_submit_command(iommu, &invalidate_pages, false);
 }
 
-static void amd_iommu_completion_wait(struct amd_iommu *iommu)
+static void amd_iommu_invalidate_range(struct amd_iommu *iommu,
+				       u16 domain_id, u64 addr,
+				       unsigned int order)
+{
+	union buf_entry invalidate_pages = {{ 0 }};
+
+	/*
+	 * With the S bit set, the lowest clear address bit above bit 12
+	 * encodes the size of the naturally aligned range (see Sect. 2.2.3).
+	 * PDEs are included as the hierarchy may have changed as well.
+	 */
+	if (order > 0)
+		addr |= (((1ULL << (order - 1)) - 1) << PAGE_SHIFT) |
+			CMD_INV_IOMMU_PAGES_SIZE;
+	addr |= CMD_INV_IOMMU_PAGES_PDE;
+
+	invalidate_pages.raw32[1] = domain_id;
+	invalidate_pages.raw32[2] = (u32)addr;
+	invalidate_pages.raw32[3] = addr >> 32;
+	invalidate_pages.type = CMD_INV_IOMMU_PAGES;
+
+	amd_iommu_submit_command(iommu, &invalidate_pages, false);
+}
+
+static void amd_iommu_flush_cell(struct amd_iommu *iommu, struct cell *cell)
+{
+	struct iommu_pending_inv *inv = &cell->arch.iommu_inv;
+	const struct iommu_inv_range *range;
+	unsigned int n, order;
+	u64 addr, pages;
+
+	if (inv->flush_domain) {
+		amd_iommu_invalidate_pages(iommu, cell->id & 0xffff);
+		return;
+	}
+
+	for (n = 0, range = inv->ranges; n < inv->num_ranges; n++, range++) {
+		addr = range->start;
+		pages = range->pages;
+		while (pages > 0) {
+			order = iommu_inv_range_order(addr, pages,
+					CMD_INV_IOMMU_PAGES_MAX_ORDER);
+			amd_iommu_invalidate_range(iommu, cell->id & 0xffff,
+						   addr, order);
+			addr += (u64)PAGE_SIZE << order;
+			pages -= 1ULL << order;
+		}
+	}
+}
+
+/*
+ * Publishes all queued commands, terminated by a COMPLETION_WAIT, without
+ * waiting for their execution. This allows to kick off all units before
+ * polling any of them.
+ */
+static void amd_iommu_start_completion_wait(struct amd_iommu *iommu)
 {
 	union buf_entry completion_wait = {{ 0 }};
-	volatile u64 sem = 1;
 	long addr;
 
-	addr = paging_hvirt2phys(&sem);
+	iommu->compl_sem = 1;
+	addr = paging_hvirt2phys(&iommu->compl_sem);
 
 	completion_wait.raw32[0] = (addr & BIT_MASK(31, 3)) |
 		CMD_COMPL_WAIT_STORE;
@@ -622,8 +720,19 @@ static void amd_iommu_completion_wait(struct amd_iommu *iommu)
 	amd_iommu_submit_command(iommu, &completion_wait, true);
 	mmio_write64(iommu->mmio_base + AMD_CMD_BUF_TAIL_REG,
 		     iommu->cmd_tail_ptr);
+}
 
-	wait_for_zero(&sem, -1);
+static void amd_iommu_finish_completion_wait(struct amd_iommu *iommu)
+{
+	wait_for_zero(&iommu->compl_sem, -1);
+	/* everything up to the COMPLETION_WAIT has been consumed */
+	iommu->cmd_head_ptr = iommu->cmd_tail_ptr;
+}
+
+static void amd_iommu_completion_wait(struct amd_iommu *iommu)
+{
+	amd_iommu_start_completion_wait(iommu);
+	amd_iommu_finish_completion_wait(iommu);
 }
 
 static void amd_iommu_init_fault_nmi(void)
@@ -676,6 +785,7 @@ static void amd_iommu_init_fault_nmi(void)
 void iommu_config_commit(struct cell *cell_added_removed)
 {
 	struct amd_iommu *iommu;
+	struct cell *cell;
 
 	// HACK for QEMU
 	if (iommu_units_count == 0)
@@ -687,15 +797,23 @@ void iommu_config_commit(struct cell *cell_added_removed)
 
 	for_each_iommu(iommu) {
 		/* Flush caches */
-		if (cell_added_removed) {
+		if (cell_added_removed)
 			amd_iommu_invalidate_pages(iommu,
 					cell_added_removed->id & 0xffff);
-			amd_iommu_invalidate_pages(iommu,
-					root_cell.id & 0xffff);
-		}
+		for_each_cell(cell)
+			if (cell != cell_added_removed)
+				amd_iommu_flush_cell(iommu, cell);
 		/* Execute all commands in the buffer */
-		amd_iommu_completion_wait(iommu);
+		amd_iommu_start_completion_wait(iommu);
 	}
+	/* Let the units process their buffers in parallel. */
+	for_each_iommu(iommu)
+		amd_iommu_finish_completion_wait(iommu);
+
+	if (cell_added_removed)
+		iommu_clear_pending_changes(cell_added_removed);
+	for_each_cell(cell)
+		iommu_clear_pending_changes(cell);
 }
 
 struct apic_irq_message iommu_get_remapped_root_int(unsigned int iommu,
@@ -716,6 +834,14 @@ int iommu_map_interrupt(struct cell *cell, u16 device_id, unsigned int vector,
 	return -ENOSYS;
 }
 
+void iommu_map_interrupts_begin(void)
+{
+}
+
+void iommu_map_interrupts_end(void)
+{
+}
+
 void iommu_shutdown(void)
 {
 	struct amd_iommu *iommu;
@@ -733,6 +859,18 @@ void iommu_shutdown(void)
 static void amd_iommu_print_event(struct amd_iommu *iommu,
 				  union buf_entry *entry)
 {
+	bool print;
+
+	trace_event(JAILHOUSE_TRACE_IOMMU_FAULT, entry->raw32[0] & 0xffff,
+		    entry->raw64[1]);
+	print = root_iommu_fault(iommu->idx, entry->raw32[0] & 0xffff,
+				 entry->type, entry->raw64[1]);
+
+	/* command errors are fatal and always reported */
+	if (!print && entry->type != EVENT_TYPE_ILL_CMD_ERR &&
+	    entry->type != EVENT_TYPE_CMD_HW_ERR)
+		return;
+
 	printk("AMD IOMMU %d reported event\n", iommu->idx);
 	printk(" EventCode: %lx, Operand 1: %lx, Operand 2: %lx\n",
 	       entry->type, entry->raw64[0], entry->raw64[1]);
@@ -17,15 +17,21 @@
 #include <jailhouse/printk.h>
 #include <jailhouse/control.h>
 #include <jailhouse/mmio.h>
+#include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <asm/apic.h>
 #include <asm/bitops.h>
 #include <asm/control.h>
+#include <asm/profile.h>
+#include <asm/spinlock.h>
 
 #define XAPIC_REG(x2apic_reg)		((x2apic_reg) << 4)
 
 bool using_x2apic;
 u8 apic_to_cpu_id[] = { [0 ... APIC_MAX_PHYS_ID] = CPU_ID_INVALID };
 
+static DEFINE_SPINLOCK(apic_id_lock);
+
 /* Initialized for x2APIC, adjusted for xAPIC during init */
 static u32 apic_reserved_bits[] = {
 	[0x00 ... 0x07] = -1,
@@ -50,6 +56,8 @@ static u32 apic_reserved_bits[] = {
 };
 static void *xapic_page;
 
+static bool has_tsc_deadline;
+
 static struct {
 	u32 (*read)(unsigned int reg);
 	u32 (*read_id)(void);
@@ -126,12 +134,10 @@ int apic_cpu_init(struct per_cpu *cpu_data)
 	unsigned int n;
 	u32 ldr;
 
-	printk("(APIC ID %d) ", apic_id);
+	printk(" CPU %d: APIC ID %d\n", cpu_id, apic_id);
 
 	if (apic_id > APIC_MAX_PHYS_ID || cpu_id == CPU_ID_INVALID)
 		return trace_error(-ERANGE);
-	if (apic_to_cpu_id[apic_id] != CPU_ID_INVALID)
-		return trace_error(-EBUSY);
 	/* only flat mode with LDR corresponding to logical ID supported */
 	if (!using_x2apic) {
 		ldr = apic_ops.read(APIC_REG_LDR);
@@ -140,7 +146,14 @@ int apic_cpu_init(struct per_cpu *cpu_data)
 			return trace_error(-EIO);
 	}
 
+	/* CPUs are brought up concurrently */
+	spin_lock(&apic_id_lock);
+	if (apic_to_cpu_id[apic_id] != CPU_ID_INVALID) {
+		spin_unlock(&apic_id_lock);
+		return trace_error(-EBUSY);
+	}
 	apic_to_cpu_id[apic_id] = cpu_id;
+	spin_unlock(&apic_id_lock);
 	cpu_data->apic_id = apic_id;
 
 	cpu_data->sipi_vector = -1;
@@ -170,7 +183,7 @@ int apic_init(void)
 		apic_ops.send_ipi = send_x2apic_ipi;
 		using_x2apic = true;
 	} else if (apicbase & APIC_BASE_EN) {
-		xapic_page = page_alloc(&remap_pool, 1);
+		xapic_page = page_alloc(&remap_pool, 1, PAGE_OWNER_OTHER);
 		if (!xapic_page)
 			return trace_error(-ENOMEM);
 		err = paging_create(&hv_paging_structs, XAPIC_BASE, PAGE_SIZE,
@@ -193,6 +206,8 @@ int apic_init(void)
 	} else
 		return trace_error(-EIO);
 
+	has_tsc_deadline = !!(cpuid_ecx(1, 0) & X86_FEATURE_TSC_DEADLINE);
+
 	printk("Using x%sAPIC\n", using_x2apic ? "2" : "");
 
 	return 0;
@@ -248,6 +263,9 @@ void apic_send_irq(struct apic_irq_message irq_msg)
 {
 	u32 delivery_mode = irq_msg.delivery_mode << APIC_ICR_DLVR_SHIFT;
 
+	trace_event(JAILHOUSE_TRACE_IRQ_INJECT, irq_msg.vector,
+		    irq_msg.destination);
+
 	/* IA-32 SDM 10.6: "lowest priority IPI [...] should be avoided" */
 	if (delivery_mode == APIC_ICR_DLVR_LOWPRI) {
 		delivery_mode = APIC_ICR_DLVR_FIXED;
@@ -290,6 +308,30 @@ static void apic_mask_lvt(unsigned int reg)
 		apic_ops.write(reg, val | APIC_LVT_MASKED);
 }
 
+/*
+ * Returns true if the cell programmed the performance monitoring interrupt for
+ * NMI delivery. Such PMIs are intercepted along with all other NMIs and have to
+ * be reinjected.
+ */
+bool apic_pmi_uses_nmi(void)
+{
+	unsigned int maxlvt = (apic_ops.read(APIC_REG_LVR) >> 16) & 0xff;
+
+	return maxlvt >= 4 && !profile_owns_pmi() &&
+		(apic_ops.read(APIC_REG_LVTPC) & APIC_LVT_DLVR_MASK) ==
+		APIC_LVT_DLVR_NMI;
+}
+
+u32 apic_get_lvtpc(void)
+{
+	return apic_ops.read(APIC_REG_LVTPC);
+}
+
+void apic_set_lvtpc(u32 val)
+{
+	apic_ops.write(APIC_REG_LVTPC, val);
+}
+
 void apic_clear(void)
 {
 	unsigned int maxlvt = (apic_ops.read(APIC_REG_LVR) >> 16) & 0xff;
@@ -306,13 +348,22 @@ void apic_clear(void)
 	apic_mask_lvt(APIC_REG_LVTT);
 	if (maxlvt >= 5)
 		apic_mask_lvt(APIC_REG_LVTTHMR);
-	if (maxlvt >= 4)
+	/* the LVTPC stays armed if the hypervisor is profiled */
+	if (maxlvt >= 4 && !profile_owns_pmi())
 		apic_mask_lvt(APIC_REG_LVTPC);
 	apic_mask_lvt(APIC_REG_LVT0);
 	apic_mask_lvt(APIC_REG_LVT1);
 	for (n = 0; n < xlc; n++)
 		apic_mask_lvt(APIC_REG_XLVT0 + n);
 
+	/*
+	 * Disarm the timer in all modes. The deadline MSR is not intercepted,
+	 * so the previous owner of the CPU may have left it armed.
+	 */
+	apic_ops.write(APIC_REG_TMICT, 0);
+	if (has_tsc_deadline)
+		write_msr(MSR_IA32_TSC_DEADLINE, 0);
+
 	/* Clear ISR. This is done in reverse direction as EOI
 	 * clears highest-priority interrupt ISR bit. */
 	for (n = APIC_NUM_INT_REGS-1; n >= 0; n--)
@@ -350,6 +401,7 @@ static bool apic_valid_ipi_mode(u32 lo_val)
 	switch (lo_val & APIC_ICR_SH_MASK) {
 	case APIC_ICR_SH_NONE:
 	case APIC_ICR_SH_SELF:
+	case APIC_ICR_SH_ALLOTHER:
 		break;
 	default:
 		panic_printk("FATAL: Unsupported shorthand, ICR.lo=%x\n",
@@ -386,6 +438,24 @@ static void apic_send_ipi(unsigned int target_cpu_id, u32 orig_icr_hi,
 	}
 }
 
+/*
+ * Return true if all CPUs addressed by the logical destination belong to the
+ * cell. May spuriously return false before the first configuration commit.
+ */
+static bool apic_cell_owns_logical_dest(struct cell *cell, u32 dest)
+{
+	unsigned int cluster_id;
+
+	if (!using_x2apic)
+		return (dest & ~cell->cpu_set->bitmap[0]) == 0;
+
+	cluster_id = (dest & X2APIC_DEST_CLUSTER_ID_MASK) >>
+		X2APIC_DEST_CLUSTER_ID_SHIFT;
+	return cluster_id < X2APIC_MAX_CLUSTERS &&
+		(dest & X2APIC_DEST_LOGICAL_ID_MASK &
+		 ~cell->arch.x2apic_logical_dest[cluster_id]) == 0;
+}
+
 static void apic_send_logical_dest_ipi(u32 lo_val, u32 hi_val)
 {
 	unsigned int target_cpu_id = CPU_ID_INVALID;
@@ -394,6 +464,16 @@ static void apic_send_logical_dest_ipi(u32 lo_val, u32 hi_val)
 	unsigned int cluster_id;
 	unsigned int apic_id;
 
+	/*
+	 * Fixed IPIs to CPUs of the own cell only can be forwarded as a
+	 * single multicast instead of one ICR write per destination.
+	 */
+	if ((lo_val & APIC_ICR_DLVR_MASK) == APIC_ICR_DLVR_FIXED &&
+	    apic_cell_owns_logical_dest(this_cell(), hi_val)) {
+		apic_ops.send_ipi(hi_val, lo_val | APIC_ICR_DEST_LOGICAL);
+		return;
+	}
+
 	if (using_x2apic) {
 		cluster_id = (dest & X2APIC_DEST_CLUSTER_ID_MASK) >>
 			X2APIC_DEST_CLUSTER_ID_SHIFT;
@@ -426,6 +506,8 @@ static bool apic_handle_icr_write(u32 lo_val, u32 hi_val)
 {
 	unsigned int target_cpu_id;
 
+	this_cpu_data()->stats[JAILHOUSE_CPU_STAT_APIC_IPIS]++;
+
 	if (!apic_valid_ipi_mode(lo_val))
 		return false;
 
@@ -437,6 +519,18 @@ static bool apic_handle_icr_write(u32 lo_val, u32 hi_val)
 		return true;
 	}
 
+	/*
+	 * Broadcasts are confined to the cell. This lets a guest bring up all
+	 * its APs with a single INIT-SIPI-SIPI sequence.
+	 */
+	if ((lo_val & APIC_ICR_SH_MASK) == APIC_ICR_SH_ALLOTHER) {
+		lo_val &= ~(APIC_ICR_SH_MASK | APIC_ICR_DEST_LOGICAL);
+		for_each_cpu_except(target_cpu_id, this_cell()->cpu_set,
+				    this_cpu_id())
+			apic_send_ipi(target_cpu_id, hi_val, lo_val);
+		return true;
+	}
+
 	if (lo_val & APIC_ICR_DEST_LOGICAL) {
 		lo_val &= ~APIC_ICR_DEST_LOGICAL;
 		apic_send_logical_dest_ipi(lo_val, hi_val);
@@ -500,6 +594,9 @@ unsigned int apic_mmio_access(unsigned long rip,
 		if (apic_accessing_reserved_bits(reg, val))
 			return 0;
 
+		if (reg == APIC_REG_EOI)
+			this_cpu_data()->stats[JAILHOUSE_CPU_STAT_APIC_EOIS]++;
+
 		if (reg == APIC_REG_ICR) {
 			dest = apic_ops.read(APIC_REG_ICR_HI) >> 24;
 			if (!apic_handle_icr_write(val, dest))
@@ -519,10 +616,14 @@ unsigned int apic_mmio_access(unsigned long rip,
 		else if (reg >= APIC_REG_XLVT0 && reg <= APIC_REG_XLVT3 &&
 			 apic_invalid_lvt_delivery_mode(reg, val))
 			return 0;
-		else if (reg != APIC_REG_ID)
+		/* the LVTPC is reserved for the hypervisor when profiled */
+		else if (reg != APIC_REG_ID &&
+			 (reg != APIC_REG_LVTPC || !profile_owns_pmi()))
 			apic_ops.write(reg, val);
 	} else {
 		val = apic_ops.read(reg);
+		if (reg == APIC_REG_LVR)
+			val &= ~APIC_LVR_EOI_BCAST_SUPPR;
 		this_cpu_data()->guest_regs.by_index[inst.reg_num] = val;
 	}
 	return inst.inst_len;
@@ -537,6 +638,9 @@ bool x2apic_handle_write(void)
 	if (apic_accessing_reserved_bits(reg, val))
 		return false;
 
+	if (reg == APIC_REG_EOI)
+		this_cpu_data()->stats[JAILHOUSE_CPU_STAT_APIC_EOIS]++;
+
 	if (reg == APIC_REG_SELF_IPI)
 		/* TODO: emulate */
 		printk("Unhandled x2APIC self IPI write\n");
@@ -545,7 +649,8 @@ bool x2apic_handle_write(void)
 	else if (reg >= APIC_REG_LVTCMCI && reg <= APIC_REG_LVTERR &&
 		 apic_invalid_lvt_delivery_mode(reg, val))
 		return false;
-	else
+	else if (reg != APIC_REG_LVTPC || !profile_owns_pmi())
+		/* the LVTPC is reserved for the hypervisor when profiled */
 		apic_ops.write(reg, val);
 	return true;
 }
@@ -561,6 +666,15 @@ void x2apic_handle_read(void)
 	else
 		guest_regs->rax = apic_ops.read(reg);
 
+	/*
+	 * Hide support for suppressing EOI broadcasts. Cells then keep
+	 * acknowledging level-triggered IOAPIC interrupts via the EOI
+	 * broadcast of their local APIC instead of trapping IOAPIC EOI
+	 * register writes.
+	 */
+	if (reg == APIC_REG_LVR)
+		guest_regs->rax &= ~APIC_LVR_EOI_BCAST_SUPPR;
+
 	guest_regs->rdx = 0;
 	if (reg == APIC_REG_ICR)
 		guest_regs->rdx = apic_ops.read(reg + 1);
@@ -578,6 +692,9 @@ u32 x2apic_filter_logical_dest(struct cell *cell, u32 destination)
 	unsigned int apic_id, logical_id, cluster_id;
 	u32 dest;
 
+	if (apic_cell_owns_logical_dest(cell, destination))
+		return destination;
+
 	cluster_id = (destination & X2APIC_DEST_CLUSTER_ID_MASK) >>
 		X2APIC_DEST_CLUSTER_ID_SHIFT;
 	dest = destination & X2APIC_DEST_LOGICAL_ID_MASK;
@@ -591,3 +708,34 @@ u32 x2apic_filter_logical_dest(struct cell *cell, u32 destination)
 	}
 	return destination;
 }
+
+static void apic_update_logical_dest(struct cell *cell)
+{
+	unsigned int cpu, apic_id, cluster_id;
+
+	memset(cell->arch.x2apic_logical_dest, 0,
+	       sizeof(cell->arch.x2apic_logical_dest));
+	for_each_cpu(cpu, cell->cpu_set) {
+		apic_id = per_cpu(cpu)->apic_id;
+		cluster_id = apic_id >> X2APIC_CLUSTER_ID_SHIFT;
+		cell->arch.x2apic_logical_dest[cluster_id] |=
+			1 << (apic_id & 0xf);
+	}
+}
+
+/**
+ * Rebuild the logical destination caches after CPUs changed their cells.
+ * @param cell_added_removed	Cell that was added or removed or NULL.
+ *
+ * CPUs only move between the root cell and @c cell_added_removed, so the
+ * caches of all other cells are left untouched.
+ */
+void apic_config_commit(struct cell *cell_added_removed)
+{
+	if (!cell_added_removed)
+		return;
+
+	apic_update_logical_dest(&root_cell);
+	if (cell_added_removed != &root_cell)
+		apic_update_logical_dest(cell_added_removed);
+}
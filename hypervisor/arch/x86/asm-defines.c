@@ -32,4 +32,15 @@ void common(void)
 	       __builtin_offsetof(struct per_cpu, stack) + \
 	       FIELD_SIZEOF(struct per_cpu, stack));
 	DEFINE(PERCPU_SIZE_SHIFT_ASM, PERCPU_SIZE_SHIFT);
+
+	/*
+	 * Per-CPU areas are addressed by shifting the CPU ID while their
+	 * memory is reserved in units of sizeof(struct per_cpu). Both only
+	 * match if the structure has no room left to the next power of two.
+	 */
+	BUILD_BUG_ON(sizeof(struct per_cpu) != 1UL << PERCPU_SIZE_SHIFT);
+	/* The fields accessed by other CPUs must share only one line. */
+	BUILD_BUG_ON(__builtin_offsetof(struct per_cpu, linux_sp) -
+		     __builtin_offsetof(struct per_cpu, control_lock) !=
+		     CACHE_LINE_SIZE);
 }
@@ -29,3 +29,17 @@ int cat_cell_init(struct cell *cell)
 void cat_cell_exit(struct cell *cell)
 {
 }
+
+void cat_cell_cpu_moved(struct cell *cell, unsigned int cpu_id)
+{
+}
+
+void cat_cell_sample_stats(struct cell *cell, u64 *stats)
+{
+}
+
+int cat_cell_set_cache(struct cell *cell, unsigned int start,
+		       unsigned int size)
+{
+	return -ENODEV;
+}
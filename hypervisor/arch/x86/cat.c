@@ -14,50 +14,291 @@
 #include <jailhouse/printk.h>
 #include <jailhouse/utils.h>
 #include <asm/cat.h>
+#include <asm/control.h>
+#include <asm/spinlock.h>
 
 #include <jailhouse/cell-config.h>
 
 #define CAT_ROOT_COS	0
+#define CMT_ROOT_RMID	0
+
+#define MBA_MAX_BANDWIDTH	100
 
 static unsigned int cbm_max, freed_mask;
 static int cos_max = -1;
+static unsigned int l2_cbm_max, l2_domain_shift;
+static int l2_cos_max = -1;
 static u64 orig_root_mask;
+static bool cdp_enabled;
+static unsigned int mba_granularity;
+static int mba_cos_max = -1;
+static int rmid_max = -1;
+static unsigned int cmt_events, cmt_upscale, mbm_width;
 
-int cat_init(void)
+/* protects the bandwidth accumulators of all cells */
+static DEFINE_SPINLOCK(cmt_lock);
+
+static void mba_init(void)
 {
-	int err;
+	unsigned int max_delay;
 
-	if (cpuid_ebx(7, 0) & X86_FEATURE_CAT &&
-	    cpuid_ebx(0x10, 0) & (1 << CAT_RESID_L3)) {
-		cbm_max = cpuid_eax(0x10, CAT_RESID_L3) & CAT_CBM_LEN_MASK;
-		cos_max = cpuid_edx(0x10, CAT_RESID_L3) & CAT_COS_MAX_MASK;
+	if (!(cpuid_ebx(0x10, 0) & (1 << CAT_RESID_MBA)))
+		return;
+
+	if (!(cpuid_ecx(0x10, CAT_RESID_MBA) & MBA_LINEAR)) {
+		printk("MBA: Non-linear throttling not supported\n");
+		return;
 	}
 
-	err = cat_cell_init(&root_cell);
-	orig_root_mask = root_cell.arch.cat_mask;
+	max_delay = (cpuid_eax(0x10, CAT_RESID_MBA) & MBA_MAX_DELAY_MASK) + 1;
+	if (max_delay >= MBA_MAX_BANDWIDTH)
+		return;
 
-	return err;
+	mba_granularity = MBA_MAX_BANDWIDTH - max_delay;
+	mba_cos_max = cpuid_edx(0x10, CAT_RESID_MBA) & MBA_COS_MAX_MASK;
+}
+
+static void l2_init(void)
+{
+	unsigned int n, eax;
+
+	if (!(cpuid_ebx(0x10, 0) & (1 << CAT_RESID_L2)))
+		return;
+
+	/*
+	 * L2 masks are programmed per L2 domain. The APIC IDs of the CPUs
+	 * sharing an L2 cache only differ in their lower bits.
+	 */
+	for (n = 0; ; n++) {
+		eax = cpuid_eax(4, n);
+		if ((eax & CACHE_PARAMS_TYPE_MASK) == 0)
+			return;
+		if (CACHE_PARAMS_LEVEL(eax) == 2)
+			break;
+	}
+	while ((1U << l2_domain_shift) < CACHE_PARAMS_SHARING(eax))
+		l2_domain_shift++;
+
+	l2_cbm_max = cpuid_eax(0x10, CAT_RESID_L2) & CAT_CBM_LEN_MASK;
+	l2_cos_max = cpuid_edx(0x10, CAT_RESID_L2) & CAT_COS_MAX_MASK;
+
+	printk("CAT: L2 allocation with %d COS\n", l2_cos_max + 1);
+}
+
+static void cmt_init(void)
+{
+	if (!(cpuid_ebx(7, 0) & X86_FEATURE_CMT) ||
+	    !(cpuid_edx(0xf, 0) & (1 << CMT_RESID_L3)))
+		return;
+
+	rmid_max = cpuid_ecx(0xf, CMT_RESID_L3);
+	cmt_events = cpuid_edx(0xf, CMT_RESID_L3);
+	cmt_upscale = cpuid_ebx(0xf, CMT_RESID_L3);
+	mbm_width = CMT_MBM_WIDTH_BASE +
+		(cpuid_eax(0xf, CMT_RESID_L3) & CMT_MBM_WIDTH_MASK);
+	if (mbm_width > QM_CTR_DATA_BITS)
+		mbm_width = QM_CTR_DATA_BITS;
+
+	printk("CMT: Monitoring up to %d cells\n", rmid_max + 1);
 }
 
 void cat_update(void)
 {
 	struct cell *cell = this_cell();
-
+	u64 mask = cell->arch.cat_mask, code_mask = cell->arch.cat_code_mask;
+
+	/* cells with only an L2 region follow the root cell's L3 mask */
+	if (mask == 0)
+		mask = code_mask = root_cell.arch.cat_mask;
+
+	if (cdp_enabled) {
+		write_msr(MSR_IA32_L3_QOS_CFG, L3_QOS_CFG_CDP_ENABLE);
+		write_msr(MSR_IA32_L3_MASK_0 + cell->arch.cos * 2, mask);
+		write_msr(MSR_IA32_L3_MASK_0 + cell->arch.cos * 2 + 1,
+			  code_mask);
+	} else if (cos_max >= 0) {
+		write_msr(MSR_IA32_L3_MASK_0 + cell->arch.cos, mask);
+	}
+	if (l2_cos_max >= 0)
+		write_msr(MSR_IA32_L2_MASK_0 + cell->arch.cos,
+			  cell->arch.l2_mask != 0 ? cell->arch.l2_mask :
+			  this_cpu_data()->cat_l2_shared_mask);
+	if ((int)cell->arch.cos <= mba_cos_max)
+		write_msr(MSR_IA32_L2_QOS_EXT_BW_THRTL_0 + cell->arch.cos,
+			  cell->arch.mba_delay);
 	write_msr(MSR_IA32_PQR_ASSOC,
-		  (u64)cell->arch.cos << PQR_ASSOC_COS_SHIFT);
-	write_msr(MSR_IA32_L3_MASK_0 + cell->arch.cos, cell->arch.cat_mask);
+		  ((u64)cell->arch.cos << PQR_ASSOC_COS_SHIFT) |
+		  cell->arch.rmid);
+}
+
+static u64 cell_cat_masks(struct cell *cell)
+{
+	return cell->arch.cat_mask | cell->arch.cat_code_mask;
+}
+
+static void print_cell_masks(struct cell *cell)
+{
+	if (cos_max < 0 || cell->arch.cat_mask == 0)
+		/* no L3 allocation or the root cell's mask is used */;
+	else if (cell->arch.cat_mask == cell->arch.cat_code_mask)
+		printk("CAT: Using COS %d with bitmask %08x for cell %s\n",
+		       cell->arch.cos, cell->arch.cat_mask,
+		       cell->config->name);
+	else
+		printk("CAT: Using COS %d with data bitmask %08x, "
+		       "code bitmask %08x for cell %s\n", cell->arch.cos,
+		       cell->arch.cat_mask, cell->arch.cat_code_mask,
+		       cell->config->name);
+
+	if (cell->arch.l2_mask != 0)
+		printk("CAT: Using COS %d with L2 bitmask %08x for cell %s\n",
+		       cell->arch.cos, cell->arch.l2_mask,
+		       cell->config->name);
+
+	if (cell->arch.mba_delay != 0)
+		printk("MBA: Limiting COS %d to %d percent memory bandwidth\n",
+		       cell->arch.cos, MBA_MAX_BANDWIDTH - cell->arch.mba_delay);
 }
 
 /* root cell has to be stopped */
 static void cat_update_cell(struct cell *cell)
 {
+	struct cell *other;
 	unsigned int cpu;
 
+	if (cell == &root_cell) {
+		/* The root cell only uses unified masks. */
+		root_cell.arch.cat_code_mask = root_cell.arch.cat_mask;
+
+		/* Cells with only an L2 region follow the root's L3 mask. */
+		for_each_non_root_cell(other)
+			if (other->arch.cos != CAT_ROOT_COS &&
+			    other->arch.cat_mask == 0)
+				cat_update_cell(other);
+	}
+
 	for_each_cpu(cpu, cell->cpu_set)
 		if (cpu == this_cpu_id())
 			cat_update();
 		else
-			per_cpu(cpu)->update_cat = true;
+			x86_post_event(per_cpu(cpu), X86_EVENT_UPDATE_CAT);
+}
+
+static bool same_l2_domain(unsigned int cpu1, unsigned int cpu2)
+{
+	return (per_cpu(cpu1)->apic_id >> l2_domain_shift) ==
+		(per_cpu(cpu2)->apic_id >> l2_domain_shift);
+}
+
+/* L2 mask claimed by the cell in the L2 domain of the given CPU */
+static u64 l2_domain_claim(struct cell *cell, unsigned int cpu)
+{
+	unsigned int cell_cpu;
+
+	if (cell->arch.l2_mask != 0)
+		for_each_cpu(cell_cpu, cell->cpu_set)
+			if (same_l2_domain(cpu, cell_cpu))
+				return cell->arch.l2_mask;
+	return 0;
+}
+
+/* Reduce a mask to its uppermost contiguous part. */
+static u64 l2_contiguous_mask(u64 mask)
+{
+	unsigned int lo_mask_start, lo_mask_len;
+	u64 lo_mask;
+
+	while (1) {
+		lo_mask_start = ffsl(mask);
+		lo_mask_len = ffzl(mask >> lo_mask_start);
+		lo_mask = BIT_MASK(lo_mask_start + lo_mask_len - 1,
+				   lo_mask_start);
+
+		if ((mask & ~lo_mask) == 0)
+			return mask;
+		mask &= ~lo_mask;
+	}
+}
+
+/*
+ * Recalculate what cells without own L2 region use in each L2 domain: the
+ * part of the L2 cache not claimed by cells with an L2 region that run CPUs in
+ * that domain. The uppermost bit is never handed out to cells, see
+ * parse_cache_regions, so this never becomes empty. A cell that is just being
+ * created is not yet listed, so it has to be passed as @c added.
+ */
+static void l2_update_shared_masks(struct cell *added)
+{
+	struct cell *cell, *other;
+	unsigned int cpu;
+	u64 mask;
+
+	if (l2_cos_max < 0)
+		return;
+
+	for_each_cell(cell)
+		for_each_cpu(cpu, cell->cpu_set) {
+			mask = BIT_MASK(l2_cbm_max, 0);
+			for_each_non_root_cell(other)
+				mask &= ~l2_domain_claim(other, cpu);
+			if (added)
+				mask &= ~l2_domain_claim(added, cpu);
+			mask = l2_contiguous_mask(mask);
+
+			if (per_cpu(cpu)->cat_l2_shared_mask == mask)
+				continue;
+			per_cpu(cpu)->cat_l2_shared_mask = mask;
+
+			if (cpu == this_cpu_id())
+				cat_update();
+			else
+				x86_post_event(per_cpu(cpu),
+					       X86_EVENT_UPDATE_CAT);
+		}
+}
+
+int cat_init(void)
+{
+	int err;
+
+	cmt_init();
+
+	if (cpuid_ebx(7, 0) & X86_FEATURE_CAT &&
+	    cpuid_ebx(0x10, 0) & (1 << CAT_RESID_L3)) {
+		cbm_max = cpuid_eax(0x10, CAT_RESID_L3) & CAT_CBM_LEN_MASK;
+		cos_max = cpuid_edx(0x10, CAT_RESID_L3) & CAT_COS_MAX_MASK;
+
+		/*
+		 * With code/data prioritization, each COS consumes a pair of
+		 * mask MSRs, halving the number of usable COS.
+		 */
+		if (cpuid_ecx(0x10, CAT_RESID_L3) & CAT_CDP) {
+			cdp_enabled = true;
+			cos_max = (cos_max + 1) / 2 - 1;
+			printk("CAT: Code/data prioritization enabled\n");
+		}
+
+		mba_init();
+	}
+	if (cpuid_ebx(7, 0) & X86_FEATURE_CAT)
+		l2_init();
+
+	err = cat_cell_init(&root_cell);
+	orig_root_mask = root_cell.arch.cat_mask;
+	if (!err)
+		l2_update_shared_masks(NULL);
+
+	return err;
+}
+
+/* highest COS that is valid for all supported cache levels */
+static int cat_cos_limit(void)
+{
+	if (cos_max < 0)
+		return l2_cos_max;
+	if (l2_cos_max < 0)
+		return cos_max;
+	return MIN(cos_max, l2_cos_max);
 }
 
 static u32 get_free_cos(void)
@@ -75,6 +316,62 @@ retry:
 	return cos;
 }
 
+static u32 get_free_rmid(void)
+{
+	struct cell *cell;
+	u32 rmid = CMT_ROOT_RMID;
+
+retry:
+	for_each_cell(cell)
+		if (cell->arch.rmid == rmid) {
+			rmid++;
+			goto retry;
+		}
+
+	return rmid;
+}
+
+static bool cmt_read(u32 rmid, unsigned int event, u64 *value)
+{
+	u64 ctr;
+
+	if (!(cmt_events & QM_EVT_SUPPORTED(event)))
+		return false;
+
+	write_msr(MSR_IA32_QM_EVTSEL,
+		  ((u64)rmid << QM_EVTSEL_RMID_SHIFT) | event);
+	ctr = read_msr(MSR_IA32_QM_CTR);
+	if (ctr & (QM_CTR_ERROR | QM_CTR_UNAVAILABLE))
+		return false;
+
+	*value = ctr;
+	return true;
+}
+
+static void cmt_cell_init(struct cell *cell)
+{
+	u32 rmid;
+
+	cell->arch.rmid = CMT_ROOT_RMID;
+	cell->arch.mbm_bytes[0] = cell->arch.mbm_bytes[1] = 0;
+	cell->arch.mbm_last[0] = cell->arch.mbm_last[1] = 0;
+
+	if (rmid_max < 0 || cell == &root_cell)
+		return;
+
+	rmid = get_free_rmid();
+	if (rmid > rmid_max) {
+		printk("CMT: No free RMID, not monitoring cell %s\n",
+		       cell->config->name);
+		return;
+	}
+	cell->arch.rmid = rmid;
+
+	/* start accumulating from the current counter values of the RMID */
+	cmt_read(rmid, QM_EVT_MBM_TOTAL, &cell->arch.mbm_last[0]);
+	cmt_read(rmid, QM_EVT_MBM_LOCAL, &cell->arch.mbm_last[1]);
+}
+
 static bool merge_freed_mask_to_root(void)
 {
 	bool updated = false;
@@ -102,6 +399,8 @@ static bool shrink_root_cell_mask(u64 cell_mask)
 	unsigned int lo_mask_start, lo_mask_len;
 	u64 lo_mask;
 
+	/* cell_mask may consist of disjoint code and data masks */
+
 	if ((root_cell.arch.cat_mask & ~cell_mask) == 0) {
 		/*
 		 * Try to refill the root mask from the freed mask. The root
@@ -120,21 +419,25 @@ static bool shrink_root_cell_mask(u64 cell_mask)
 		 * Ensure that the root mask is still contiguous:
 		 *
 		 * Check if taking out the new cell's mask from the root mask
-		 * created two halves there. Then shrink the root mask
-		 * additionally by the lower half and add that part to the
-		 * freed mask.
+		 * split it into several parts there. Then shrink the root mask
+		 * additionally by the lowest part and add that part to the
+		 * freed mask, until only one part is left.
 		 *
-		 * Always removing the lower half simplifies this algorithm at
+		 * Always removing the lower parts simplifies this algorithm at
 		 * the price of possibly choosing the smaller sub-mask. Cell
 		 * configurations can avoid this by locating non-root cell
 		 * masks at the beginning of the L3 cache.
 		 */
-		lo_mask_start = ffsl(root_cell.arch.cat_mask);
-		lo_mask_len = ffzl(root_cell.arch.cat_mask >> lo_mask_start);
-		lo_mask = BIT_MASK(lo_mask_start + lo_mask_len - 1,
-				   lo_mask_start);
+		while (1) {
+			lo_mask_start = ffsl(root_cell.arch.cat_mask);
+			lo_mask_len =
+				ffzl(root_cell.arch.cat_mask >> lo_mask_start);
+			lo_mask = BIT_MASK(lo_mask_start + lo_mask_len - 1,
+					   lo_mask_start);
+
+			if ((root_cell.arch.cat_mask & ~lo_mask) == 0)
+				break;
 
-		if (root_cell.arch.cat_mask & ~lo_mask) {
 			root_cell.arch.cat_mask &= ~lo_mask;
 			freed_mask |= lo_mask;
 		}
@@ -150,37 +453,158 @@ static bool shrink_root_cell_mask(u64 cell_mask)
 	return true;
 }
 
+static bool cell_cache_root_shared(struct cell *cell)
+{
+	const struct jailhouse_cache *cache = cell->cfg.cache_regions;
+	unsigned int n;
+
+	for (n = 0; n < cell->config->num_cache_regions; n++, cache++)
+		if (cache->flags & JAILHOUSE_CACHE_ROOTSHARED)
+			return true;
+	return false;
+}
+
+/*
+ * A cell either specifies a single unified L3 region or one L3 code and one
+ * L3 data region. Separate code and data masks require CDP. Non-root cells may
+ * add an L2 region, or only specify that. Regions of cache levels without
+ * allocation support are ignored.
+ */
+static int parse_cache_regions(struct cell *cell)
+{
+	const struct jailhouse_cache *cache = cell->cfg.cache_regions;
+	u64 mask, data_mask = 0, code_mask = 0, l2_mask = 0, l2_used = 0;
+	unsigned int n, bandwidth = 0;
+	struct cell *other;
+
+	if (cell->config->num_cache_regions > 3)
+		return trace_error(-EINVAL);
+
+	for (n = 0; n < cell->config->num_cache_regions; n++, cache++) {
+		if ((cache->type & ~(JAILHOUSE_CACHE_L3 |
+				     JAILHOUSE_CACHE_L2)) != 0 ||
+		    cache->type == 0 ||
+		    (cache->type & JAILHOUSE_CACHE_L2 &&
+		     cache->type != JAILHOUSE_CACHE_L2) ||
+		    cache->size == 0)
+			return trace_error(-EINVAL);
+
+		if (cache->mem_bandwidth > MBA_MAX_BANDWIDTH ||
+		    (cache->mem_bandwidth != 0 && bandwidth != 0 &&
+		     cache->mem_bandwidth != bandwidth))
+			return trace_error(-EINVAL);
+		if (cache->mem_bandwidth != 0)
+			bandwidth = cache->mem_bandwidth;
+
+		if (cache->type == JAILHOUSE_CACHE_L2) {
+			if (l2_cos_max < 0)
+				continue;
+			if (cell == &root_cell || l2_mask != 0 ||
+			    (cache->start + cache->size) > l2_cbm_max)
+				return trace_error(-EINVAL);
+			l2_mask = BIT_MASK(cache->start + cache->size - 1,
+					   cache->start);
+			continue;
+		}
+
+		if (cos_max < 0)
+			continue;
+		if ((cache->start + cache->size) > cbm_max)
+			return trace_error(-EINVAL);
+
+		mask = BIT_MASK(cache->start + cache->size - 1, cache->start);
+
+		if (cache->type & JAILHOUSE_CACHE_L3_DATA) {
+			if (data_mask != 0)
+				return trace_error(-EINVAL);
+			data_mask = mask;
+		}
+		if (cache->type & JAILHOUSE_CACHE_L3_CODE) {
+			if (code_mask != 0)
+				return trace_error(-EINVAL);
+			code_mask = mask;
+		}
+	}
+
+	if ((data_mask == 0) != (code_mask == 0) ||
+	    (data_mask != code_mask &&
+	     (!cdp_enabled || cell == &root_cell)))
+		return trace_error(-EINVAL);
+
+	/*
+	 * L2 masks of different cells must not overlap, independent of the
+	 * L2 domains their CPUs are currently in.
+	 */
+	for_each_non_root_cell(other)
+		if (other != cell)
+			l2_used |= other->arch.l2_mask;
+	if (l2_used & l2_mask)
+		return trace_error(-EBUSY);
+
+	/*
+	 * Without an own L3 region, the root cell uses the whole L3 cache and
+	 * other cells follow the root cell's mask.
+	 */
+	if (data_mask == 0 && cell == &root_cell)
+		data_mask = code_mask = BIT_MASK(cbm_max, 0);
+
+	cell->arch.cat_mask = data_mask;
+	cell->arch.cat_code_mask = code_mask;
+	cell->arch.l2_mask = l2_mask;
+
+	cell->arch.mba_delay = 0;
+	if (bandwidth != 0 && bandwidth < MBA_MAX_BANDWIDTH) {
+		if (mba_cos_max < 0) {
+			printk("MBA: Not supported, ignoring bandwidth limit "
+			       "of cell %s\n", cell->config->name);
+			return 0;
+		}
+		if ((int)cell->arch.cos > mba_cos_max)
+			return trace_error(-EBUSY);
+
+		/* throttle with the next coarser granularity step */
+		bandwidth = (bandwidth + mba_granularity - 1) /
+			mba_granularity * mba_granularity;
+		cell->arch.mba_delay = MBA_MAX_BANDWIDTH - bandwidth;
+	}
+
+	return 0;
+}
+
 int cat_cell_init(struct cell *cell)
 {
-	const struct jailhouse_cache *cache;
+	int err;
 
 	cell->arch.cos = CAT_ROOT_COS;
+	cell->arch.l2_mask = 0;
+	cmt_cell_init(cell);
 
-	if (cos_max < 0)
+	if (cat_cos_limit() < 0) {
+		if (cell->arch.rmid != CMT_ROOT_RMID)
+			cat_update_cell(cell);
 		return 0;
+	}
 
 	if (cell->config->num_cache_regions > 0) {
 		if (cell != &root_cell) {
 			cell->arch.cos = get_free_cos();
-			if (cell->arch.cos > cos_max)
+			if (cell->arch.cos > cat_cos_limit())
 				return trace_error(-EBUSY);
 		}
 
-		cache = jailhouse_cell_cache_regions(cell->config);
-
-		if (cell->config->num_cache_regions != 1 ||
-		    cache->type != JAILHOUSE_CACHE_L3 ||
-		    cache->size == 0 || (cache->start + cache->size) > cbm_max)
-			return trace_error(-EINVAL);
-
-		cell->arch.cat_mask =
-			BIT_MASK(cache->start + cache->size - 1, cache->start);
+		err = parse_cache_regions(cell);
+		if (err)
+			return err;
 
-		if (cell != &root_cell &&
-		    !(cache->flags & JAILHOUSE_CACHE_ROOTSHARED) &&
-		    (root_cell.arch.cat_mask & cell->arch.cat_mask) != 0)
-			if (!shrink_root_cell_mask(cell->arch.cat_mask))
+		if (cell != &root_cell && !cell_cache_root_shared(cell) &&
+		    (root_cell.arch.cat_mask & cell_cat_masks(cell)) != 0)
+			if (!shrink_root_cell_mask(cell_cat_masks(cell))) {
+				cell->arch.l2_mask = 0;
 				return trace_error(-EINVAL);
+			}
+
+		if (cell->arch.l2_mask != 0)
+			l2_update_shared_masks(cell);
 
 		cat_update_cell(cell);
 	} else {
@@ -191,16 +615,48 @@ int cat_cell_init(struct cell *cell)
 		 */
 		cell->arch.cat_mask = (cell == &root_cell) ?
 			BIT_MASK(cbm_max, 0) : root_cell.arch.cat_mask;
+		cell->arch.cat_code_mask = cell->arch.cat_mask;
+		cell->arch.mba_delay = (cell == &root_cell) ?
+			0 : root_cell.arch.mba_delay;
+
+		if (cell->arch.rmid != CMT_ROOT_RMID)
+			cat_update_cell(cell);
 	}
 
-	printk("CAT: Using COS %d with bitmask %08x for cell %s\n",
-	       cell->arch.cos, cell->arch.cat_mask, cell->config->name);
+	print_cell_masks(cell);
 
 	return 0;
 }
 
+/*
+ * A CPU moved between the root cell and the given cell. It has to pick up the
+ * COS and RMID of its new owner when it is restarted.
+ */
+void cat_cell_cpu_moved(struct cell *cell, unsigned int cpu_id)
+{
+	/* the cell's L2 region now covers a different set of L2 domains */
+	if (cell->arch.l2_mask != 0)
+		l2_update_shared_masks(NULL);
+
+	if (cell->arch.cos != CAT_ROOT_COS || cell->arch.rmid != CMT_ROOT_RMID)
+		x86_post_event(per_cpu(cpu_id), X86_EVENT_UPDATE_CAT);
+}
+
 void cat_cell_exit(struct cell *cell)
 {
+	/*
+	 * The CPUs of the cell return to the root cell and have to pick up its
+	 * COS and RMID once they are restarted.
+	 */
+	if (cell->arch.cos != CAT_ROOT_COS || cell->arch.rmid != CMT_ROOT_RMID)
+		cat_update_cell(cell);
+
+	/* hand the L2 region back to the cells sharing its L2 domains */
+	if (cell->arch.l2_mask != 0) {
+		cell->arch.l2_mask = 0;
+		l2_update_shared_masks(NULL);
+	}
+
 	/*
 	 * Only release the mask of cells with an own partition.
 	 * cos is also CAT_ROOT_COS if CAT is unsupported.
@@ -212,7 +668,7 @@ void cat_cell_exit(struct cell *cell)
 	 * Queue bits of released mask for returning to root that were in the
 	 * original root mask as well.
 	 */
-	freed_mask |= cell->arch.cat_mask & orig_root_mask;
+	freed_mask |= cell_cat_masks(cell) & orig_root_mask;
 
 	if (merge_freed_mask_to_root()) {
 		printk("CAT: Extended root cell bitmask to %08x\n",
@@ -220,3 +676,112 @@ void cat_cell_exit(struct cell *cell)
 		cat_update_cell(&root_cell);
 	}
 }
+
+void cat_cell_sample_stats(struct cell *cell, u64 *stats)
+{
+	u64 value, delta;
+	unsigned int n;
+
+	/* cells without own RMID would only report the root cell's values */
+	if (rmid_max < 0 ||
+	    (cell != &root_cell && cell->arch.rmid == CMT_ROOT_RMID))
+		return;
+
+	/*
+	 * The counters are read for the L3 domain of the calling CPU. On
+	 * multi-socket systems, this only covers the cell's activity on the
+	 * socket of that CPU.
+	 */
+	if (cmt_read(cell->arch.rmid, QM_EVT_L3_OCCUPANCY, &value))
+		stats[JAILHOUSE_CPU_STAT_L3_OCCUPANCY] = value * cmt_upscale;
+
+	spin_lock(&cmt_lock);
+	for (n = 0; n < 2; n++) {
+		/*
+		 * Accumulate the bandwidth counters so that wrap-arounds are
+		 * hidden as long as they are sampled often enough.
+		 */
+		if (cmt_read(cell->arch.rmid, QM_EVT_MBM_TOTAL + n, &value)) {
+			delta = (value - cell->arch.mbm_last[n]) &
+				BIT_MASK(mbm_width - 1, 0);
+			cell->arch.mbm_last[n] = value;
+			cell->arch.mbm_bytes[n] += delta * cmt_upscale;
+		}
+		stats[JAILHOUSE_CPU_STAT_MEM_BW_TOTAL + n] =
+			cell->arch.mbm_bytes[n];
+	}
+	spin_unlock(&cmt_lock);
+}
+
+/* root cell and target cell have to be stopped */
+int cat_cell_set_cache(struct cell *cell, unsigned int start,
+		       unsigned int size)
+{
+	unsigned int old_freed_mask;
+	u64 old_mask, mask;
+	bool root_shared;
+	struct cell *other;
+	u32 cos;
+
+	if (cos_max < 0)
+		return -ENODEV;
+
+	if (size == 0 || (start + size) > cbm_max)
+		return trace_error(-EINVAL);
+
+	mask = BIT_MASK(start + size - 1, start);
+
+	for_each_non_root_cell(other)
+		if (other != cell && other->arch.cos != CAT_ROOT_COS &&
+		    (cell_cat_masks(other) & mask) != 0)
+			return trace_error(-EBUSY);
+
+	cos = cell->arch.cos;
+	if (cos == CAT_ROOT_COS) {
+		/* cell shared the root settings so far, give it an own COS */
+		cos = get_free_cos();
+		if (cos > cat_cos_limit())
+			return trace_error(-EBUSY);
+		old_mask = 0;
+	} else {
+		old_mask = cell_cat_masks(cell);
+	}
+
+	root_shared = cell_cache_root_shared(cell);
+
+	if (!root_shared) {
+		/*
+		 * Queue bits released by the cell for returning to root, as in
+		 * cat_cell_exit, but keep the bits of the new mask out of the
+		 * freed mask so that they cannot be merged into the root mask
+		 * while shrinking it.
+		 */
+		old_freed_mask = freed_mask;
+		freed_mask |= old_mask & ~mask & orig_root_mask;
+		freed_mask &= ~mask;
+
+		if ((root_cell.arch.cat_mask & mask) != 0 &&
+		    !shrink_root_cell_mask(mask)) {
+			freed_mask = old_freed_mask;
+			return trace_error(-EINVAL);
+		}
+	}
+
+	/* a cell leaving COS0 must not keep the root's throttling */
+	if (cell->arch.cos == CAT_ROOT_COS)
+		cell->arch.mba_delay = 0;
+	cell->arch.cos = cos;
+	cell->arch.cat_mask = mask;
+	cell->arch.cat_code_mask = mask;
+	cat_update_cell(cell);
+
+	if (!root_shared && merge_freed_mask_to_root()) {
+		printk("CAT: Extended root cell bitmask to %08x\n",
+		       root_cell.arch.cat_mask);
+		cat_update_cell(&root_cell);
+	}
+
+	print_cell_masks(cell);
+
+	return 0;
+}
@@ -19,6 +19,7 @@
 #include <asm/control.h>
 #include <asm/ioapic.h>
 #include <asm/iommu.h>
+#include <asm/profile.h>
 #include <asm/vcpu.h>
 
 struct exception_frame {
@@ -61,6 +62,10 @@ int arch_cell_create(struct cell *cell)
 	cell->comm_page.comm_region.num_cpus = 0;
 	for_each_cpu(cpu, cell->cpu_set)
 		cell->comm_page.comm_region.num_cpus++;
+	cell->comm_page.comm_region.pci_mmconfig_base =
+		system_config->platform_info.x86.mmconfig_base;
+	cell->comm_page.comm_region.pci_mmconfig_end_bus =
+		system_config->platform_info.x86.mmconfig_end_bus;
 
 	return 0;
 
@@ -85,9 +90,13 @@ int arch_map_memory_region(struct cell *cell,
 		return err;
 
 	err = iommu_map_memory_region(cell, mem);
-	if (err)
+	if (err) {
 		vcpu_unmap_memory_region(cell, mem);
-	return err;
+		return err;
+	}
+
+	cell->vcpu_caches_dirty = true;
+	return 0;
 }
 
 int arch_unmap_memory_region(struct cell *cell,
@@ -99,6 +108,7 @@ int arch_unmap_memory_region(struct cell *cell,
 	if (err)
 		return err;
 
+	cell->vcpu_caches_dirty = true;
 	return vcpu_unmap_memory_region(cell, mem);
 }
 
@@ -106,16 +116,29 @@ void arch_flush_cell_vcpu_caches(struct cell *cell)
 {
 	unsigned int cpu;
 
-	for_each_cpu(cpu, cell->cpu_set)
-		if (cpu == this_cpu_id()) {
+	for_each_cpu(cpu, cell->cpu_set) {
+		if (cpu == this_cpu_id())
 			vcpu_tlb_flush();
-		} else {
-			per_cpu(cpu)->flush_vcpu_caches = true;
-			/* make sure the value is written before we kick
-			 * the remote core */
-			memory_barrier();
-			apic_send_nmi_ipi(per_cpu(cpu));
-		}
+		else
+			x86_post_event(per_cpu(cpu), X86_EVENT_FLUSH_CACHES);
+	}
+}
+
+int arch_cell_set_cache(struct cell *cell, unsigned int start,
+			unsigned int size)
+{
+	return cat_cell_set_cache(cell, start, size);
+}
+
+void arch_cell_sample_stats(struct cell *cell, u64 *stats)
+{
+	cat_cell_sample_stats(cell, stats);
+}
+
+int arch_irqchip_set_mask(struct cell *cell, unsigned int chip,
+			  unsigned long pins, unsigned long mask)
+{
+	return ioapic_set_mask(cell, chip, pins, mask);
 }
 
 void arch_cell_destroy(struct cell *cell)
@@ -127,11 +150,37 @@ void arch_cell_destroy(struct cell *cell)
 	vcpu_cell_exit(cell);
 }
 
+void arch_cell_add_cpu(struct cell *cell, unsigned int cpu_id)
+{
+	/* the parked CPU waits for INIT/SIPI from the cell */
+	cat_cell_cpu_moved(cell, cpu_id);
+}
+
+void arch_cell_remove_cpu(struct cell *cell, unsigned int cpu_id)
+{
+	/* the parked CPU waits for INIT/SIPI from the root cell */
+	cat_cell_cpu_moved(cell, cpu_id);
+}
+
+void arch_cell_reset(struct cell *cell)
+{
+	pci_cell_reset(cell);
+}
+
 void arch_config_commit(struct cell *cell_added_removed)
 {
+	apic_config_commit(cell_added_removed);
 	iommu_config_commit(cell_added_removed);
+
+	/*
+	 * Collect the interrupt remapping updates of all devices and submit
+	 * their invalidation at once. Cells affected by the commit are
+	 * suspended, so they cannot trigger the updated interrupts meanwhile.
+	 */
+	iommu_map_interrupts_begin();
 	pci_config_commit(cell_added_removed);
 	ioapic_config_commit(cell_added_removed);
+	iommu_map_interrupts_end();
 }
 
 void arch_shutdown(void)
@@ -144,7 +193,32 @@ void arch_shutdown(void)
 	ioapic_shutdown();
 }
 
-void arch_suspend_cpu(unsigned int cpu_id)
+void arch_send_msg_doorbell(struct cell *cell, unsigned int id)
+{
+	struct apic_irq_message irq_msg = {
+		.vector = id,
+		.delivery_mode = APIC_MSG_DLVR_FIXED,
+		.destination = per_cpu(first_cpu(cell->cpu_set))->apic_id,
+	};
+
+	/* the cell owns the APIC of its CPUs, send a plain fixed IPI */
+	if (id < 32 || id > 0xff)
+		return;
+
+	apic_send_irq(irq_msg);
+}
+
+void arch_notify_root(void)
+{
+	pci_ivshmem_notify_events();
+}
+
+unsigned long arch_get_cycles_khz(void)
+{
+	return tsc_khz;
+}
+
+void arch_request_cpu_suspend(unsigned int cpu_id)
 {
 	struct per_cpu *target_data = per_cpu(cpu_id);
 	bool target_suspended;
@@ -156,12 +230,22 @@ void arch_suspend_cpu(unsigned int cpu_id)
 
 	spin_unlock(&target_data->control_lock);
 
-	if (!target_suspended) {
+	if (!target_suspended)
 		apic_send_nmi_ipi(target_data);
+}
 
-		while (!target_data->cpu_suspended)
-			cpu_relax();
-	}
+void arch_wait_cpu_suspended(unsigned int cpu_id)
+{
+	struct per_cpu *target_data = per_cpu(cpu_id);
+
+	while (!target_data->cpu_suspended)
+		cpu_relax();
+}
+
+void arch_suspend_cpu(unsigned int cpu_id)
+{
+	arch_request_cpu_suspend(cpu_id);
+	arch_wait_cpu_suspended(cpu_id);
 }
 
 void arch_resume_cpu(unsigned int cpu_id)
@@ -221,6 +305,21 @@ void x86_send_init_sipi(unsigned int cpu_id, enum x86_init_sipi type,
 		apic_send_nmi_ipi(target_data);
 }
 
+/*
+ * Post an event without taking the control_lock of the target. Only the first
+ * poster of a pending event kicks the target via NMI, repeated requests fold
+ * into one. A suspended CPU needs no kick as it processes its events before
+ * returning to the guest. Setting the event bit and checking cpu_suspended
+ * pairs with clearing cpu_suspended and fetching the events in
+ * x86_check_events; both sides use locked instructions in between.
+ */
+void x86_post_event(struct per_cpu *target_data, enum x86_event event)
+{
+	if (!test_and_set_bit(event, &target_data->pending_events) &&
+	    !target_data->cpu_suspended)
+		apic_send_nmi_ipi(target_data);
+}
+
 /* control_lock has to be held */
 static void x86_enter_wait_for_sipi(struct per_cpu *cpu_data)
 {
@@ -267,17 +366,18 @@ void x86_check_events(void)
 		}
 	} while (cpu_data->init_signaled);
 
-	if (cpu_data->flush_vcpu_caches) {
-		cpu_data->flush_vcpu_caches = false;
+	spin_unlock(&cpu_data->control_lock);
+
+	/* all events posted so far are handled in this pass */
+	if (test_and_clear_bit(X86_EVENT_FLUSH_CACHES,
+			       &cpu_data->pending_events)) {
 		vcpu_tlb_flush();
+		x86_mmio_inst_cache_flush();
 	}
 
-	if (cpu_data->update_cat) {
-		cpu_data->update_cat = false;
+	if (test_and_clear_bit(X86_EVENT_UPDATE_CAT,
+			       &cpu_data->pending_events))
 		cat_update();
-	}
-
-	spin_unlock(&cpu_data->control_lock);
 
 	/* wait_for_sipi is only modified on this CPU, so checking outside of
 	 * control_lock is fine */
@@ -293,6 +393,16 @@ void x86_check_events(void)
 	iommu_check_pending_faults();
 }
 
+/**
+ * Handle an NMI received in root mode.
+ * @param rip	Instruction pointer interrupted by the NMI.
+ */
+void x86_nmi_handler(unsigned long rip)
+{
+	profile_nmi(rip);
+	vcpu_nmi_handler();
+}
+
 void __attribute__((noreturn))
 x86_exception_handler(struct exception_frame *frame)
 {
@@ -45,12 +45,14 @@
 #define APIC_REG_LVT0			0x35
 #define APIC_REG_LVT1			0x36
 #define APIC_REG_LVTERR			0x37
+#define APIC_REG_TMICT			0x38
 #define APIC_REG_SELF_IPI		0x3f
 #define APIC_REG_XFEAT			0x40
 #define APIC_REG_XLVT0			0x50
 #define APIC_REG_XLVT3			0x53
 
 #define APIC_EOI_ACK			0
+#define APIC_LVR_EOI_BCAST_SUPPR	0x01000000
 #define APIC_SVR_ENABLE_APIC		0x00000100
 #define APIC_ICR_VECTOR_MASK		0x000000ff
 #define APIC_ICR_DLVR_MASK		0x00000700
@@ -156,6 +158,9 @@ int apic_init(void);
 int apic_cpu_init(struct per_cpu *cpu_data);
 
 void apic_clear(void);
+bool apic_pmi_uses_nmi(void);
+u32 apic_get_lvtpc(void);
+void apic_set_lvtpc(u32 val);
 
 void apic_send_nmi_ipi(struct per_cpu *target_data);
 bool apic_filter_irq_dest(struct cell *cell, struct apic_irq_message *irq_msg);
@@ -172,6 +177,8 @@ void x2apic_handle_read(void);
 
 u32 x2apic_filter_logical_dest(struct cell *cell, u32 destination);
 
+void apic_config_commit(struct cell *cell_added_removed);
+
 struct apic_irq_message
 pci_translate_msi_vector(struct pci_device *device, unsigned int vector,
 			 unsigned int legacy_vectors, union x86_msi_vector msi);
@@ -78,6 +78,17 @@ static inline int variable_test_bit(int nr, volatile const unsigned long *addr)
 	return oldbit;
 }
 
+static inline int test_and_clear_bit(int nr, volatile unsigned long *addr)
+{
+	int oldbit;
+
+	asm volatile("lock btr %2,%1\n\t"
+		     "sbb %0,%0" : "=r" (oldbit), BITOP_ADDR(addr)
+		     : "Ir" (nr) : "memory");
+
+	return oldbit;
+}
+
 #define test_bit(nr, addr)			\
 	(__builtin_constant_p((nr))		\
 	 ? constant_test_bit((nr), (addr))	\
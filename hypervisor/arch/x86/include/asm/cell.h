@@ -19,8 +19,80 @@
 
 #include <jailhouse/cell-config.h>
 
+/** Maximum number of address ranges tracked for selective IOMMU flushes. */
+#define IOMMU_MAX_INV_RANGES		16
+
+/** Number of x2APIC clusters covering all supported APIC IDs. */
+#define X2APIC_MAX_CLUSTERS		16
+
+/** Maximum number of precomputed CPUID leaves per cell. */
+#define CPUID_CACHE_ENTRIES		16
+
+/** Maximum number of port I/O handlers per cell. */
+#define PIO_MAX_REGIONS			8
+
+/** Ports covered by one block of the port I/O dispatch table. */
+#define PIO_BLOCK_PORTS			256
+
 struct cell_ioapic;
 
+/** Precomputed CPUID result as reported to the cell. */
+struct cpuid_cache_entry {
+	/** CPUID function (EAX input). */
+	u32 function;
+	/** Subfunction (ECX input), ignored unless @c indexed is set. */
+	u32 index;
+	/** True if the result depends on the subfunction. */
+	bool indexed;
+	/** Resulting register values. */
+	u32 eax, ebx, ecx, edx;
+};
+
+/**
+ * Port I/O handler.
+ * @param port		Accessed port.
+ * @param dir_in	True for input, false for output.
+ * @param size		Access size in bytes.
+ *
+ * @return 1 if the access was handled, 0 if not, -1 on a fatal error.
+ */
+typedef int (*pio_handler)(u16 port, bool dir_in, unsigned int size);
+
+/** Port range emulated by the hypervisor, see vcpu_pio_register(). */
+struct pio_region {
+	/** First port of the range. */
+	u16 base;
+	/** Number of ports. */
+	u16 num;
+	/** True if the ports are trapped even if the cell config grants
+	 * them. */
+	bool moderate;
+	/** Statistics counter incremented on each dispatched exit. */
+	unsigned int stat;
+	/** Access handler. */
+	pio_handler handler;
+};
+
+/** DMA address range with pending IOMMU invalidation. */
+struct iommu_inv_range {
+	/** Page-aligned start address. */
+	u64 start;
+	/** Number of pages. */
+	u64 pages;
+};
+
+/** IOMMU invalidations collected until the next configuration commit. */
+struct iommu_pending_inv {
+	/** Ranges changed since the last configuration commit. */
+	struct iommu_inv_range ranges[IOMMU_MAX_INV_RANGES];
+	/** Number of valid entries in @c ranges. */
+	unsigned int num_ranges;
+	/** Total number of pages covered by @c ranges. */
+	u64 pages;
+	/** True if the complete domain has to be flushed. */
+	bool flush_domain;
+};
+
 /** x86-specific cell states. */
 struct arch_cell {
 	/** Buffer for the EPT/NPT root-level page table. */
@@ -30,12 +102,16 @@ struct arch_cell {
 		struct {
 			/** PIO access bitmap. */
 			u8 *io_bitmap;
+			/** MSR access bitmap. */
+			u8 *msr_bitmap;
 			/** Paging structures used for cell CPUs. */
 			struct paging_structures ept_structs;
 		} vmx; /**< Intel VMX-specific fields. */
 		struct {
 			/** I/O Permissions Map. */
 			u8 *iopm;
+			/** MSR Permissions Map. */
+			u8 *msrpm;
 			/** Paging structures used for cell CPUs and IOMMU. */
 			struct paging_structures npt_iommu_structs;
 		} svm; /**< AMD SVM-specific fields. */
@@ -45,24 +121,69 @@ struct arch_cell {
 		struct {
 			/** Paging structures used for DMA requests. */
 			struct paging_structures pg_structs;
+			/** True if DMA requests are translated via the EPT. */
+			bool shared_pt;
 			/** True if interrupt remapping support is emulated for this
 			 * cell. */
 			bool ir_emulation;
 		} vtd; /**< Intel VT-d specific fields. */
 	};
 
+	/** Pending IOMMU invalidations. */
+	struct iommu_pending_inv iommu_inv;
+
+	/** CPUID leaves that are identical on all CPUs of the cell. */
+	struct cpuid_cache_entry cpuid_cache[CPUID_CACHE_ENTRIES];
+	/** Number of valid entries in @c cpuid_cache. */
+	unsigned int num_cpuid_entries;
+	/** XCR0 bits the cell may set, 0 if XSAVE is unsupported. */
+	u64 xcr0_allowed;
+
 	/** Shadow value of PCI config space address port register. */
 	u32 pci_addr_port_val;
 
+	/** Emulated port ranges of the cell. */
+	struct pio_region pio_regions[PIO_MAX_REGIONS];
+	/** Number of valid entries in @c pio_regions. */
+	unsigned int num_pio_regions;
+	/** Block of @c pio_blocks plus one for each group of PIO_BLOCK_PORTS
+	 * ports, 0 if none of them is emulated. */
+	u8 pio_dir[0x10000 / PIO_BLOCK_PORTS];
+	/** Page holding the dispatch blocks, each mapping its ports to the
+	 * index of the region in @c pio_regions plus one, 0 if unhandled. */
+	u8 *pio_blocks;
+	/** Number of allocated blocks in @c pio_blocks. */
+	unsigned int num_pio_blocks;
+
 	/** List of IOAPICs assigned to this cell. */
 	struct cell_ioapic *ioapics;
 	/** Number of assigned IOAPICs. */
 	unsigned int num_ioapics;
 
+	/** Logical x2APIC IDs of the cell's CPUs, one mask per cluster.
+	 * Rebuilt on each configuration commit. */
+	u16 x2apic_logical_dest[X2APIC_MAX_CLUSTERS];
+
 	/** Class Of Service for cache allocation (Intel only). */
 	u32 cos;
-	/** Allocated L3 cache region (Intel only). */
+	/** Allocated L3 cache region (Intel only). Restricts data accesses
+	 * if code/data prioritization is enabled. */
 	u64 cat_mask;
+	/** Allocated L3 cache region for code fetches if code/data
+	 * prioritization is enabled, otherwise equal to cat_mask. */
+	u64 cat_code_mask;
+	/** Allocated L2 cache region (Intel only), 0 if the cell uses what the
+	 * other cells leave in the L2 domains of its CPUs. */
+	u64 l2_mask;
+	/** Memory bandwidth throttling delay of the COS (Intel MBA only). */
+	u32 mba_delay;
+
+	/** Resource monitoring ID (Intel only). */
+	u32 rmid;
+	/** Last raw readings of the total and local bandwidth counters. */
+	u64 mbm_last[2];
+	/** Accumulated total and local memory traffic in bytes. */
+	u64 mbm_bytes[2];
 };
 
 #endif /* !_JAILHOUSE_ASM_CELL_H */
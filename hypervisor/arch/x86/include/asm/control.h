@@ -16,10 +16,26 @@ struct exception_frame;
 
 enum x86_init_sipi { X86_INIT, X86_SIPI };
 
+/** Requests to other CPUs that are processed by x86_check_events. */
+enum x86_event {
+	/** Flush the TLB of the paging layer that does host physical <->
+	 *  guest physical memory mappings and the MMIO instruction cache. */
+	X86_EVENT_FLUSH_CACHES,
+	/** Apply updated cache allocation and monitoring (Intel only). */
+	X86_EVENT_UPDATE_CAT,
+};
+
+/* TSC rate calibrated against the PM timer, 0 if not available */
+extern unsigned long tsc_khz;
+
 void x86_send_init_sipi(unsigned int cpu_id, enum x86_init_sipi type,
 			int sipi_vector);
 
+void x86_post_event(struct per_cpu *target_data, enum x86_event event);
+
 void x86_check_events(void);
 
+void x86_nmi_handler(unsigned long rip);
+
 void __attribute__((noreturn))
 x86_exception_handler(struct exception_frame *frame);
@@ -90,4 +90,7 @@ void ioapic_cell_exit(struct cell *cell);
 
 void ioapic_config_commit(struct cell *cell_added_removed);
 
+int ioapic_set_mask(struct cell *cell, unsigned int chip, unsigned long pins,
+		    unsigned long mask);
+
 void ioapic_shutdown(void);
@@ -26,6 +26,15 @@ extern unsigned int fault_reporting_cpu_id;
 unsigned int iommu_count_units(void);
 unsigned int iommu_mmio_count_regions(struct cell *cell);
 
+void iommu_track_region_change(struct cell *cell,
+			       const struct jailhouse_memory *mem);
+void iommu_track_domain_change(struct cell *cell);
+void iommu_clear_pending_changes(struct cell *cell);
+unsigned int iommu_inv_range_order(u64 start, u64 pages,
+				   unsigned int max_order);
+int iommu_check_passthrough(struct cell *cell);
+bool iommu_cell_passthrough(struct cell *cell);
+
 int iommu_init(void);
 
 int iommu_cell_init(struct cell *cell);
@@ -44,6 +53,8 @@ int iommu_map_interrupt(struct cell *cell,
 			u16 device_id,
 			unsigned int vector,
 			struct apic_irq_message irq_msg);
+void iommu_map_interrupts_begin(void);
+void iommu_map_interrupts_end(void);
 
 void iommu_cell_exit(struct cell *cell);
 
@@ -65,7 +65,32 @@
 #define JAILHOUSE_CPU_STAT_VMEXITS_CPUID	JAILHOUSE_GENERIC_CPU_STATS + 4
 #define JAILHOUSE_CPU_STAT_VMEXITS_XSETBV	JAILHOUSE_GENERIC_CPU_STATS + 5
 #define JAILHOUSE_CPU_STAT_VMEXITS_EXCEPTION	JAILHOUSE_GENERIC_CPU_STATS + 6
-#define JAILHOUSE_NUM_CPU_STATS			JAILHOUSE_GENERIC_CPU_STATS + 7
+#define JAILHOUSE_CPU_STAT_PCI_CONFIG		JAILHOUSE_GENERIC_CPU_STATS + 7
+#define JAILHOUSE_CPU_STAT_I8042		JAILHOUSE_GENERIC_CPU_STATS + 8
+#define JAILHOUSE_CPU_STAT_XCR0_UPDATES		JAILHOUSE_GENERIC_CPU_STATS + 9
+#define JAILHOUSE_CPU_STAT_MMIO_IOAPIC		JAILHOUSE_GENERIC_CPU_STATS + 10
+#define JAILHOUSE_CPU_STAT_MMIO_MSIX		JAILHOUSE_GENERIC_CPU_STATS + 11
+#define JAILHOUSE_CPU_STAT_MMIO_IVSHMEM		JAILHOUSE_GENERIC_CPU_STATS + 12
+#define JAILHOUSE_CPU_STAT_MMIO_VTD		JAILHOUSE_GENERIC_CPU_STATS + 13
+#define JAILHOUSE_CPU_STAT_APIC_IPIS		JAILHOUSE_GENERIC_CPU_STATS + 14
+#define JAILHOUSE_CPU_STAT_APIC_EOIS		JAILHOUSE_GENERIC_CPU_STATS + 15
+/* cell-wide RDT monitoring values, sampled on request */
+#define JAILHOUSE_CPU_STAT_L3_OCCUPANCY		JAILHOUSE_GENERIC_CPU_STATS + 16
+#define JAILHOUSE_CPU_STAT_MEM_BW_TOTAL		JAILHOUSE_GENERIC_CPU_STATS + 17
+#define JAILHOUSE_CPU_STAT_MEM_BW_LOCAL		JAILHOUSE_GENERIC_CPU_STATS + 18
+#define JAILHOUSE_NUM_CPU_STATS			JAILHOUSE_GENERIC_CPU_STATS + 19
+
+#define JAILHOUSE_CPU_STAT_NAMES					\
+	JAILHOUSE_GENERIC_CPU_STAT_NAMES, "vmexits_pio",		\
+	"vmexits_xapic", "vmexits_cr", "vmexits_msr", "vmexits_cpuid",	\
+	"vmexits_xsetbv", "vmexits_exception", "pci_config_accesses",	\
+	"i8042_accesses", "xcr0_updates", "mmio_ioapic_accesses",	\
+	"mmio_msix_accesses", "mmio_ivshmem_accesses",			\
+	"mmio_vtd_accesses", "apic_ipis", "apic_eois", "l3_occupancy",	\
+	"mem_bw_total", "mem_bw_local"
+
+/* statistics from here on are per cell, not accumulated over its CPUs */
+#define JAILHOUSE_FIRST_CELL_STAT		JAILHOUSE_CPU_STAT_L3_OCCUPANCY
 
 /* CPUID interface */
 #define JAILHOUSE_CPUID_SIGNATURE		0x40000000
@@ -112,6 +137,11 @@ struct jailhouse_comm_region {
 	__u16 pm_timer_address;
 	/** Number of CPUs available to the cell (x86-specific). */
 	__u16 num_cpus;
+	__u32 padding;
+	/** Base address of PCI MMCONFIG, 0 if unavailable (x86-specific). */
+	__u64 pci_mmconfig_base;
+	/** Last bus covered by PCI MMCONFIG (x86-specific). */
+	__u8 pci_mmconfig_end_bus;
 };
 
 /**
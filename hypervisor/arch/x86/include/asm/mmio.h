@@ -42,4 +42,11 @@ struct mmio_instruction {
 struct mmio_instruction x86_mmio_parse(unsigned long pc,
 	const struct guest_paging_structures *pg_structs, bool is_write);
 
+/**
+ * Invalidate the cached MMIO instruction decodings of the calling CPU.
+ * Required when the code the CPU executes may have changed, i.e. on reset and
+ * on cell memory reconfigurations.
+ */
+void x86_mmio_inst_cache_flush(void);
+
 /** @} */
@@ -26,6 +26,7 @@
 #define PAGE_FLAG_PRESENT	0x01
 #define PAGE_FLAG_RW		0x02
 #define PAGE_FLAG_US		0x04
+#define PAGE_FLAG_WRITETHROUGH	0x08
 #define PAGE_FLAG_DEVICE	0x10	/* uncached */
 #define PAGE_FLAG_NOEXECUTE	0x8000000000000000UL
 
@@ -41,6 +42,9 @@
 
 #define NUM_TEMPORARY_PAGES	16
 
+/* EPT and NPT root tables occupy a single page */
+#define CELL_ROOT_PT_PAGES	1
+
 #ifndef __ASSEMBLY__
 
 typedef unsigned long *pt_entry_t;
@@ -25,6 +25,11 @@
 
 #define STACK_SIZE			PAGE_SIZE
 
+#define MMIO_INST_CACHE_SIZE		8
+#define X86_MAX_INST_LEN		15
+
+#define CACHE_LINE_SIZE			64
+
 #ifndef __ASSEMBLY__
 
 #include <jailhouse/cell.h>
@@ -32,7 +37,10 @@
 #include <asm/svm.h>
 #include <asm/vmx.h>
 
-/* Round up sizeof(struct per_cpu) to the next power of two. */
+/*
+ * Round up sizeof(struct per_cpu) to the next power of two. The structure is
+ * expected to fill this size completely, see asm-defines.c.
+ */
 #define PERCPU_SIZE_SHIFT \
 	(BITS_PER_LONG - __builtin_clzl(sizeof(struct per_cpu) - 1))
 
@@ -44,6 +52,24 @@
  * @{
  */
 
+/** Decoded guest instruction that performed an MMIO access. */
+struct mmio_inst_cache_entry {
+	/** Guest page table root the instruction was fetched with. */
+	unsigned long cr3;
+	/** Guest RIP of the instruction, 0 if the entry is unused. */
+	unsigned long rip;
+	/** Instruction length. */
+	u8 inst_len;
+	/** Instruction bytes, compared on lookup to detect modified code. */
+	u8 inst[X86_MAX_INST_LEN];
+	/** Size of the access. */
+	u8 access_size;
+	/** Register holding the value to write or receiving the read value. */
+	u8 reg_num;
+	/** True if the instruction is a write access. */
+	bool is_write;
+};
+
 /** Per-CPU states. */
 struct per_cpu {
 	union {
@@ -56,11 +82,14 @@ struct per_cpu {
 		};
 	};
 
-	/** Linux stack pointer, used for handover to hypervisor. */
-	unsigned long linux_sp;
+	/*
+	 * CPU-local fields, most of them used on every VM exit. Nothing in
+	 * this section may be written or polled by other CPUs.
+	 */
 
 	/** Self reference, required for this_cpu_data(). */
-	struct per_cpu *cpu_data;
+	struct per_cpu *cpu_data
+		__attribute__((aligned(CACHE_LINE_SIZE)));
 	/** Logical CPU ID (same as Linux). */
 	unsigned int cpu_id;
 	/** Physical APIC ID. */
@@ -69,38 +98,58 @@ struct per_cpu {
 	struct cell *cell;
 
 	/** Statistic counters. */
-	u32 stats[JAILHOUSE_NUM_CPU_STATS];
+	u64 stats[JAILHOUSE_NUM_CPU_STATS];
+	/** Statistic counters at the beginning of the exit rate window. */
+	u64 exit_rate_base[JAILHOUSE_EXIT_RATE_CLASSES];
+	/** Cycle counter value at the end of the exit rate window. */
+	u64 exit_rate_window_end;
+	/** True if an exit rate limit was exceeded within the window. */
+	bool exit_rate_exceeded;
 
-	/** Linux states, used for handover to/from hypervisor. @{ */
-	struct desc_table_reg linux_gdtr;
-	struct desc_table_reg linux_idtr;
-	unsigned long linux_reg[NUM_ENTRY_REGS];
-	unsigned long linux_ip;
-	unsigned long linux_cr0;
-	unsigned long linux_cr3;
-	unsigned long linux_cr4;
-	struct segment linux_cs;
-	struct segment linux_ds;
-	struct segment linux_es;
-	struct segment linux_fs;
-	struct segment linux_gs;
-	struct segment linux_tss;
-	unsigned long linux_efer;
-	/** @} */
+#ifdef CONFIG_EXIT_LATENCY_HISTOGRAMS
+	/** Timestamp of the beginning of the current VM exit. */
+	u64 exit_start;
+	/** Statistic counters at the end of the previous VM exit. */
+	u64 exit_stats[JAILHOUSE_NUM_CPU_STATS];
+	/** log2 histograms of VM exit latencies per statistic counter,
+	 * JAILHOUSE_NUM_CPU_STATS entries allocated from mem_pool. */
+	u32 (*exit_latency)[JAILHOUSE_EXIT_LATENCY_BUCKETS];
+#endif
 
-	/** Shadow states. @{ */
-	unsigned long pat;
-	unsigned long mtrr_def_type;
-	/** @} */
+	/** VMCS fields already read during the current VM exit (VMX only).
+	 * Invalidated on each exit, updated by VMCS writes. */
+	struct vmcs_cache vmcs_cache;
+	/** Cache of recently accessed MMIO regions. */
+	struct mmio_region_cache mmio_cache;
+	/** Recently decoded MMIO access instructions. */
+	struct mmio_inst_cache_entry mmio_inst_cache[MMIO_INST_CACHE_SIZE];
+	/** Next entry of mmio_inst_cache to be replaced. */
+	unsigned int mmio_inst_cache_next;
+	/** Free pages of mem_pool cached for this CPU. */
+	struct page_magazine page_magazine;
+	/** Trace buffer of this CPU, mapped read-only into the root cell. */
+	struct jailhouse_trace_buffer *trace_buffer;
+	/** IA32_PERF_GLOBAL_CTRL bit of the profiling counter, 0 if this CPU
+	 * is not profiled. */
+	u64 profile_ctrl;
+	/** Index of the general-purpose counter used for profiling. */
+	unsigned int profile_counter;
+	/** LVTPC value of Linux, restored when the hypervisor is disabled. */
+	u32 profile_linux_lvtpc;
+	/** Hypervisor RIP sampled by the last profiling NMI, 0 if consumed. */
+	volatile unsigned long profile_rip;
+	/** Timestamp of the sample in profile_rip. */
+	u64 profile_time;
+	/** Own ivshmem endpoint whose peers have interrupts deferred by this
+	 * CPU, see pci_ivshmem_flush_deferred. Only cleared by other CPUs
+	 * while this one is parked. */
+	struct pci_ivshmem_endpoint *ivshmem_deferred;
 
-	/** True when CPU is initialized by hypervisor. */
-	bool initialized;
-	union {
-		/** VMX initialization state */
-		enum vmx_state vmx_state;
-		/** SVM initialization state */
-		enum {SVMOFF = 0, SVMON} svm_state;
-	};
+	/*
+	 * Fields written or polled by other CPUs. They occupy a cache line of
+	 * their own so that remote accesses do not bounce the line of the
+	 * CPU-local fields.
+	 */
 
 	/**
 	 * Lock protecting CPU state changes done for control tasks.
@@ -112,9 +161,8 @@ struct per_cpu {
 	 * @li per_cpu::wait_for_sipi
 	 * @li per_cpu::init_signaled
 	 * @li per_cpu::sipi_vector
-	 * @li per_cpu::flush_vcpu_caches
 	 */
-	spinlock_t control_lock;
+	spinlock_t control_lock __attribute__((aligned(CACHE_LINE_SIZE)));
 
 	/** Set to true for instructing the CPU to suspend. */
 	volatile bool suspend_cpu;
@@ -126,11 +174,12 @@ struct per_cpu {
 	bool init_signaled;
 	/** Pending SIPI vector; -1 if none is pending. */
 	int sipi_vector;
-	/** Set to true for a pending TLB flush for the paging layer that does
-	 *  host physical <-> guest physical memory mappings. */
-	bool flush_vcpu_caches;
-	/** Set to true for pending cache allocation updates (Intel only). */
-	bool update_cat;
+	/** Events posted via x86_post_event, one bit per enum x86_event. */
+	volatile unsigned long pending_events;
+	/** L2 cache mask for cells without own L2 region, covering what is
+	 * left in the L2 domain of this CPU. Updated before posting
+	 * X86_EVENT_UPDATE_CAT. */
+	u64 cat_l2_shared_mask;
 	/** Set to true for instructing the CPU to disable hypervisor mode. */
 	bool shutdown_cpu;
 	/** State of the shutdown process. Possible values:
@@ -143,6 +192,43 @@ struct per_cpu {
 	 * guest mode. */
 	bool failed;
 
+	/* Setup, handover and shadow state, rarely used at runtime. */
+
+	/** Linux stack pointer, used for handover to hypervisor. */
+	unsigned long linux_sp __attribute__((aligned(CACHE_LINE_SIZE)));
+
+	/** Linux states, used for handover to/from hypervisor. @{ */
+	struct desc_table_reg linux_gdtr;
+	struct desc_table_reg linux_idtr;
+	unsigned long linux_reg[NUM_ENTRY_REGS];
+	unsigned long linux_ip;
+	unsigned long linux_cr0;
+	unsigned long linux_cr3;
+	unsigned long linux_cr4;
+	struct segment linux_cs;
+	struct segment linux_ds;
+	struct segment linux_es;
+	struct segment linux_fs;
+	struct segment linux_gs;
+	struct segment linux_tss;
+	unsigned long linux_efer;
+	/** @} */
+
+	/** Shadow states. @{ */
+	unsigned long pat;
+	unsigned long mtrr_def_type;
+	u64 xcr0;
+	/** @} */
+
+	/** True when CPU is initialized by hypervisor. */
+	bool initialized;
+	union {
+		/** VMX initialization state */
+		enum vmx_state vmx_state;
+		/** SVM initialization state */
+		enum {SVMOFF = 0, SVMON} svm_state;
+	};
+
 	/** Number of iterations to clear pending APIC IRQs. */
 	unsigned int num_clear_apic_irqs;
 
@@ -24,10 +24,17 @@
 
 /* leaf 0x01, ECX */
 #define X86_FEATURE_VMX					(1 << 5)
+#define X86_FEATURE_EIST				(1 << 7)
+#define X86_FEATURE_TSC_DEADLINE			(1 << 24)
 #define X86_FEATURE_XSAVE				(1 << 26)
 #define X86_FEATURE_HYPERVISOR				(1 << 31)
 
+/* leaf 0x06, EAX */
+#define X86_FEATURE_HWP					(1 << 7)
+#define X86_FEATURE_HWP_PKG_REQ				(1 << 11)
+
 /* leaf 0x07, subleaf 0, EBX */
+#define X86_FEATURE_CMT					(1 << 12)
 #define X86_FEATURE_CAT					(1 << 15)
 
 /* leaf 0x80000001, ECX */
@@ -64,15 +71,29 @@
 	(BIT_MASK(31, 22) | (1UL << 19) | (1UL << 15) | BIT_MASK(12, 11))
 
 #define X86_XCR0_FP					0x00000001
+#define X86_XCR0_SSE					0x00000002
+#define X86_XCR0_AVX					0x00000004
+#define X86_XCR0_MPX					0x00000018
+#define X86_XCR0_AVX512					0x000000e0
+#define X86_XCR0_TILE					0x00060000
 
 #define MSR_IA32_APICBASE				0x0000001b
 #define MSR_IA32_FEATURE_CONTROL			0x0000003a
+#define MSR_IA32_PMC0					0x000000c1
 #define MSR_IA32_PAT					0x00000277
 #define MSR_IA32_MTRR_DEF_TYPE				0x000002ff
 #define MSR_IA32_SYSENTER_CS				0x00000174
 #define MSR_IA32_SYSENTER_ESP				0x00000175
 #define MSR_IA32_SYSENTER_EIP				0x00000176
+#define MSR_IA32_PERFEVTSEL0				0x00000186
+#define MSR_IA32_PERF_CTL				0x00000199
+#define MSR_IA32_PERF_GLOBAL_STATUS			0x0000038e
 #define MSR_IA32_PERF_GLOBAL_CTRL			0x0000038f
+#define MSR_IA32_PERF_GLOBAL_OVF_CTRL			0x00000390
+#define MSR_IA32_TSC_DEADLINE				0x000006e0
+#define MSR_IA32_PM_ENABLE				0x00000770
+#define MSR_IA32_HWP_REQUEST_PKG			0x00000772
+#define MSR_IA32_HWP_REQUEST				0x00000774
 #define MSR_IA32_VMX_BASIC				0x00000480
 #define MSR_IA32_VMX_PINBASED_CTLS			0x00000481
 #define MSR_IA32_VMX_PROCBASED_CTLS			0x00000482
@@ -87,10 +108,16 @@
 #define MSR_IA32_VMX_EPT_VPID_CAP			0x0000048c
 #define MSR_IA32_VMX_TRUE_PROCBASED_CTLS		0x0000048e
 #define MSR_X2APIC_BASE					0x00000800
+#define MSR_X2APIC_LVR					0x00000803
 #define MSR_X2APIC_ICR					0x00000830
 #define MSR_X2APIC_END					0x0000083f
+#define MSR_IA32_L3_QOS_CFG				0x00000c81
+#define MSR_IA32_QM_EVTSEL				0x00000c8d
+#define MSR_IA32_QM_CTR					0x00000c8e
 #define MSR_IA32_PQR_ASSOC				0x00000c8f
 #define MSR_IA32_L3_MASK_0				0x00000c90
+#define MSR_IA32_L2_MASK_0				0x00000d10
+#define MSR_IA32_L2_QOS_EXT_BW_THRTL_0			0x00000d50
 #define MSR_EFER					0xc0000080
 #define MSR_STAR					0xc0000081
 #define MSR_LSTAR					0xc0000082
@@ -107,6 +134,13 @@
 
 #define MTRR_ENABLE					(1UL << 11)
 
+#define PERF_CTL_RATIO_SHIFT				8
+
+#define HWP_REQUEST_MIN_SHIFT				0
+#define HWP_REQUEST_MAX_SHIFT				8
+#define HWP_REQUEST_DESIRED_SHIFT			16
+#define HWP_REQUEST_PKG_CONTROL				(1UL << 42)
+
 #define EFER_LME					0x00000100
 #define EFER_LMA					0x00000400
 #define EFER_NXE					0x00000800
@@ -114,9 +148,37 @@
 #define PQR_ASSOC_COS_SHIFT				32
 
 #define CAT_RESID_L3					1
+#define CAT_RESID_L2					2
+#define CAT_RESID_MBA					3
 
 #define CAT_CBM_LEN_MASK				BIT_MASK(4, 0)
 #define CAT_COS_MAX_MASK				BIT_MASK(15, 0)
+#define CAT_CDP						(1 << 2)
+
+#define L3_QOS_CFG_CDP_ENABLE				(1 << 0)
+
+#define MBA_MAX_DELAY_MASK				BIT_MASK(11, 0)
+#define MBA_LINEAR					(1 << 2)
+#define MBA_COS_MAX_MASK				BIT_MASK(15, 0)
+
+#define CACHE_PARAMS_TYPE_MASK				BIT_MASK(4, 0)
+#define CACHE_PARAMS_LEVEL(eax)				(((eax) >> 5) & 0x7)
+#define CACHE_PARAMS_SHARING(eax)			((((eax) >> 14) & 0xfff) + 1)
+
+#define CMT_RESID_L3					1
+
+#define CMT_MBM_WIDTH_MASK				BIT_MASK(7, 0)
+#define CMT_MBM_WIDTH_BASE				24
+
+#define QM_EVT_L3_OCCUPANCY				1
+#define QM_EVT_MBM_TOTAL				2
+#define QM_EVT_MBM_LOCAL				3
+#define QM_EVT_SUPPORTED(evt)				(1 << ((evt) - 1))
+
+#define QM_EVTSEL_RMID_SHIFT				32
+#define QM_CTR_ERROR					(1UL << 63)
+#define QM_CTR_UNAVAILABLE				(1UL << 62)
+#define QM_CTR_DATA_BITS				62
 
 #define GDT_DESC_NULL					0
 #define GDT_DESC_CODE					1
@@ -209,6 +271,20 @@ static inline void memory_load_barrier(void)
 	asm volatile("lfence" : : : "memory");
 }
 
+static inline void memory_store_barrier(void)
+{
+	/* stores are not reordered against each other on x86 */
+	asm volatile("" : : : "memory");
+}
+
+static inline u64 get_cycles(void)
+{
+	u32 lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return lo | ((u64)hi << 32);
+}
+
 static inline void cpuid(unsigned int *eax, unsigned int *ebx,
 			 unsigned int *ecx, unsigned int *edx)
 {
@@ -309,6 +385,21 @@ static inline unsigned long get_wrmsr_value(union registers *regs)
 	return (u32)regs->rax | (regs->rdx << 32);
 }
 
+static inline u64 read_xcr0(void)
+{
+	u32 low, high;
+
+	asm volatile("xgetbv" : "=a" (low), "=d" (high) : "c" (0));
+	return low | ((u64)high << 32);
+}
+
+static inline void write_xcr0(u64 val)
+{
+	asm volatile("xsetbv"
+		: /* no output */
+		: "c" (0), "a" ((u32)val), "d" ((u32)(val >> 32)));
+}
+
 static inline void read_gdtr(struct desc_table_reg *val)
 {
 	asm volatile("sgdtq %0" : "=m" (*val));
@@ -0,0 +1,34 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_PROFILE_H
+#define _JAILHOUSE_ASM_PROFILE_H
+
+#include <asm/percpu.h>
+
+void profile_cpu_init(struct per_cpu *cpu_data);
+void profile_cpu_exit(struct per_cpu *cpu_data);
+
+void profile_nmi(unsigned long rip);
+void profile_flush(struct per_cpu *cpu_data);
+
+void profile_arm_pmi(void);
+u32 profile_filter_cpuid_pmu(u32 eax);
+
+/**
+ * Check if the hypervisor owns the PMI of the calling CPU.
+ *
+ * @return True if the CPU is profiled.
+ */
+static inline bool profile_owns_pmi(void)
+{
+	return this_cpu_data()->profile_ctrl != 0;
+}
+
+#endif /* !_JAILHOUSE_ASM_PROFILE_H */
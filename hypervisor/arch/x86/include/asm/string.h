@@ -0,0 +1,41 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_STRING_H
+#define _JAILHOUSE_ASM_STRING_H
+
+/*
+ * The string instructions are the fastest option for all sizes on CPUs with
+ * Enhanced REP MOVSB/STOSB (ERMS) and still outperform a byte loop without
+ * it. SSE is not available to the hypervisor. The direction flag is always
+ * clear in hypervisor context.
+ */
+static inline void *arch_memset(void *s, int c, unsigned long n)
+{
+	void *d = s;
+
+	asm volatile("rep stosb"
+		: "+D" (d), "+c" (n)
+		: "a" (c)
+		: "memory");
+	return s;
+}
+
+static inline void *arch_memcpy(void *dest, const void *src, unsigned long n)
+{
+	void *d = dest;
+
+	asm volatile("rep movsb"
+		: "+D" (d), "+S" (src), "+c" (n)
+		:
+		: "memory");
+	return dest;
+}
+
+#endif /* !_JAILHOUSE_ASM_STRING_H */
@@ -53,7 +53,11 @@ struct vcpu_mmio_intercept {
 int vcpu_vendor_init(void);
 
 int vcpu_cell_init(struct cell *cell);
+int vcpu_pio_register(struct cell *cell, u16 base, u16 num, bool moderate,
+		      unsigned int stat, pio_handler handler);
 int vcpu_vendor_cell_init(struct cell *cell);
+int vcpu_vendor_allow_msr(struct cell *cell, u32 msr, u32 flags);
+int vcpu_vendor_intercept_msr(struct cell *cell, u32 msr, u32 flags);
 
 int vcpu_map_memory_region(struct cell *cell,
 			   const struct jailhouse_memory *mem);
@@ -69,11 +73,30 @@ void __attribute__((noreturn)) vcpu_activate_vmm(struct per_cpu *cpu_data);
 void __attribute__((noreturn)) vcpu_deactivate_vmm(void);
 
 void vcpu_handle_exit(struct per_cpu *cpu_data);
+void vcpu_vendor_handle_exit(struct per_cpu *cpu_data);
 
 void vcpu_park(void);
 
 void vcpu_nmi_handler(void);
 
+/**
+ * Make the calling CPU leave the guest at the latest when the cycle counter
+ * reaches the given deadline.
+ * @param deadline	Cycle counter value, 0 if no deadline is needed.
+ *
+ * The deadline only applies to the next guest entry. Without timer support,
+ * the CPU simply leaves the guest on its next regular VM exit.
+ */
+void vcpu_vendor_arm_timer(u64 deadline);
+
+/**
+ * Check if vcpu_vendor_arm_timer enforces its deadline.
+ *
+ * @return True if a timer forces the CPU out of the guest, false if
+ * deadlines wait for the next regular VM exit.
+ */
+bool vcpu_vendor_has_timer(void);
+
 void vcpu_tlb_flush(void);
 
 /*
@@ -102,6 +125,7 @@ void vcpu_vendor_get_mmio_intercept(struct vcpu_mmio_intercept *mmio);
 
 bool vcpu_get_guest_paging_structs(struct guest_paging_structures *pg_structs);
 
+unsigned long vcpu_vendor_get_guest_pat(void);
 void vcpu_vendor_set_guest_pat(unsigned long val);
 
 void vcpu_handle_hypercall(void);
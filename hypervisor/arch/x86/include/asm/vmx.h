@@ -201,6 +201,29 @@ struct vmcs {
 
 enum vmx_state { VMXOFF = 0, VMXON, VMCS_READY };
 
+/* VMCS fields read repeatedly while handling a single exit */
+enum vmcs_cache_field {
+	VMCS_CACHE_GUEST_RIP,
+	VMCS_CACHE_GUEST_RSP,
+	VMCS_CACHE_GUEST_RFLAGS,
+	VMCS_CACHE_GUEST_CR0,
+	VMCS_CACHE_GUEST_CR3,
+	VMCS_CACHE_GUEST_CR4,
+	VMCS_CACHE_GUEST_IA32_EFER,
+	VMCS_CACHE_GUEST_CS_SELECTOR,
+	VMCS_CACHE_VM_ENTRY_CONTROLS,
+	VMCS_CACHE_EXIT_QUALIFICATION,
+	VMCS_CACHE_VM_EXIT_INSTRUCTION_LEN,
+	VMCS_CACHE_GUEST_PHYSICAL_ADDRESS,
+	VMCS_CACHE_FIELDS
+};
+
+struct vmcs_cache {
+	/** Bitmap of valid entries in @c values. */
+	u32 valid;
+	unsigned long values[VMCS_CACHE_FIELDS];
+};
+
 #define GUEST_SEG_LIMIT			(GUEST_ES_LIMIT - GUEST_ES_SELECTOR)
 #define GUEST_SEG_AR_BYTES		(GUEST_ES_AR_BYTES - GUEST_ES_SELECTOR)
 #define GUEST_SEG_BASE			(GUEST_ES_BASE - GUEST_ES_SELECTOR)
@@ -208,6 +231,10 @@ enum vmx_state { VMXOFF = 0, VMXON, VMCS_READY };
 #define GUEST_ACTIVITY_ACTIVE			0
 #define GUEST_ACTIVITY_HLT			1
 
+#define GUEST_INTR_STATE_STI			(1UL << 0)
+#define GUEST_INTR_STATE_MOV_SS			(1UL << 1)
+#define GUEST_INTR_STATE_NMI			(1UL << 3)
+
 #define VMX_MSR_BMP_0000_READ			0
 #define VMX_MSR_BMP_C000_READ			1
 #define VMX_MSR_BMP_0000_WRITE			2
@@ -216,31 +243,46 @@ enum vmx_state { VMXOFF = 0, VMXON, VMCS_READY };
 #define PIN_BASED_NMI_EXITING			(1UL << 3)
 #define PIN_BASED_VMX_PREEMPTION_TIMER		(1UL << 6)
 
+#define CPU_BASED_HLT_EXITING			(1UL << 7)
+#define CPU_BASED_MWAIT_EXITING			(1UL << 10)
 #define CPU_BASED_CR3_LOAD_EXITING		(1UL << 15)
 #define CPU_BASED_CR3_STORE_EXITING		(1UL << 16)
 #define CPU_BASED_USE_IO_BITMAPS		(1UL << 25)
 #define CPU_BASED_USE_MSR_BITMAPS		(1UL << 28)
+#define CPU_BASED_MONITOR_EXITING		(1UL << 29)
+#define CPU_BASED_PAUSE_EXITING			(1UL << 30)
 #define CPU_BASED_ACTIVATE_SECONDARY_CONTROLS	(1UL << 31)
 
+#define CPU_BASED_IDLE_EXITING			(CPU_BASED_HLT_EXITING | \
+						 CPU_BASED_MWAIT_EXITING | \
+						 CPU_BASED_MONITOR_EXITING | \
+						 CPU_BASED_PAUSE_EXITING)
+
 #define SECONDARY_EXEC_VIRTUALIZE_APIC_ACCESSES	(1UL << 0)
 #define SECONDARY_EXEC_ENABLE_EPT		(1UL << 1)
 #define SECONDARY_EXEC_RDTSCP			(1UL << 3)
+#define SECONDARY_EXEC_ENABLE_VPID		(1UL << 5)
 #define SECONDARY_EXEC_UNRESTRICTED_GUEST	(1UL << 7)
+#define SECONDARY_EXEC_PAUSE_LOOP_EXITING	(1UL << 10)
 
 #define VM_EXIT_HOST_ADDR_SPACE_SIZE		(1UL << 9)
+#define VM_EXIT_LOAD_IA32_PERF_GLOBAL_CTRL	(1UL << 12)
 #define VM_EXIT_SAVE_IA32_PAT			(1UL << 18)
 #define VM_EXIT_LOAD_IA32_PAT			(1UL << 19)
 #define VM_EXIT_SAVE_IA32_EFER			(1UL << 20)
 #define VM_EXIT_LOAD_IA32_EFER			(1UL << 21)
 
 #define VM_ENTRY_IA32E_MODE			(1UL << 9)
+#define VM_ENTRY_LOAD_IA32_PERF_GLOBAL_CTRL	(1UL << 13)
 #define VM_ENTRY_LOAD_IA32_PAT			(1UL << 14)
 #define VM_ENTRY_LOAD_IA32_EFER			(1UL << 15)
 
+#define VMX_MISC_PREEMPTION_TIMER_RATE		0x1f
 #define VMX_MISC_ACTIVITY_HLT			(1UL << 6)
 
 #define INTR_INFO_INTR_TYPE_MASK		BIT_MASK(10, 8)
 #define INTR_INFO_UNBLOCK_NMI			(1UL << 12)
+#define INTR_INFO_VALID_MASK			(1UL << 31)
 
 #define INTR_TYPE_NMI_INTR			(2UL << 8)
 
@@ -299,7 +341,10 @@ enum vmx_state { VMXOFF = 0, VMXON, VMCS_READY };
 #define EPT_FLAG_READ				0x001
 #define EPT_FLAG_WRITE				0x002
 #define EPT_FLAG_EXECUTE			0x004
+#define EPT_FLAG_UC_TYPE			0x000
+#define EPT_FLAG_WC_TYPE			0x008
 #define EPT_FLAG_WB_TYPE			0x030
+#define EPT_FLAG_IGNORE_PAT			0x040
 
 #define EPT_TYPE_UNCACHEABLE			0
 #define EPT_TYPE_WRITEBACK			6
@@ -318,6 +363,13 @@ enum vmx_state { VMXOFF = 0, VMXON, VMCS_READY };
 #define VMX_INVEPT_SINGLE			1
 #define VMX_INVEPT_GLOBAL			2
 
+#define VPID_INVVPID				(1UL << 32)
+#define VPID_INVVPID_SINGLE			(1UL << 41)
+#define VPID_INVVPID_ALL			(1UL << 42)
+
+#define VMX_INVVPID_SINGLE			1
+#define VMX_INVVPID_ALL				2
+
 #define APIC_ACCESS_OFFSET_MASK			0x00000fff
 #define APIC_ACCESS_TYPE_MASK			0x0000f000
 #define APIC_ACCESS_TYPE_LINEAR_READ		0x00000000
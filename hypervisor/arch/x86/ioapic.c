@@ -230,7 +230,7 @@ ioapic_get_or_add_phys(const struct jailhouse_irqchip *irqchip)
 	if (num_phys_ioapics == IOAPIC_MAX_CHIPS)
 		return trace_error(NULL);
 
-	phys_ioapic->reg_base = page_alloc(&remap_pool, 1);
+	phys_ioapic->reg_base = page_alloc(&remap_pool, 1, PAGE_OWNER_OTHER);
 	if (!phys_ioapic->reg_base)
 		return trace_error(NULL);
 	err = paging_create(&hv_paging_structs, irqchip->address, PAGE_SIZE,
@@ -238,7 +238,8 @@ ioapic_get_or_add_phys(const struct jailhouse_irqchip *irqchip)
 			    PAGE_DEFAULT_FLAGS | PAGE_FLAG_DEVICE,
 			    PAGING_NON_COHERENT);
 	if (err) {
-		page_free(&remap_pool, phys_ioapic->reg_base, 1);
+		page_free(&remap_pool, phys_ioapic->reg_base, 1,
+			  PAGE_OWNER_OTHER);
 		return NULL;
 	}
 
@@ -272,6 +273,8 @@ static enum mmio_result ioapic_access_handler(void *arg,
 	struct cell_ioapic *ioapic = arg;
 	u32 index, entry;
 
+	this_cpu_data()->stats[JAILHOUSE_CPU_STAT_MMIO_IOAPIC]++;
+
 	switch (mmio->address) {
 	case IOAPIC_REG_INDEX:
 		if (mmio->is_write)
@@ -317,6 +320,9 @@ static enum mmio_result ioapic_access_handler(void *arg,
 		 * unable to ack vectors of other cells. It is therefore not
 		 * recommended to use level-triggered IOAPIC interrupts in
 		 * non-root cells.
+		 * As suppressing the EOI broadcast of the local APIC is not
+		 * offered to cells, this path is only taken by guests that
+		 * explicitly ack the IOAPIC, e.g. after masking a pin.
 		 */
 		mmio_write32(ioapic->phys_ioapic->reg_base + IOAPIC_REG_EOI,
 			     mmio->value);
@@ -332,8 +338,7 @@ invalid_access:
 
 int ioapic_cell_init(struct cell *cell)
 {
-	const struct jailhouse_irqchip *irqchip =
-		jailhouse_cell_irqchips(cell->config);
+	const struct jailhouse_irqchip *irqchip = cell->cfg.irqchips;
 	struct cell_ioapic *ioapic, *root_ioapic;
 	struct phys_ioapic *phys_ioapic;
 	unsigned int n;
@@ -343,7 +348,7 @@ int ioapic_cell_init(struct cell *cell)
 	if (cell->config->num_irqchips > IOAPIC_MAX_CHIPS)
 		return trace_error(-ERANGE);
 
-	cell->arch.ioapics = page_alloc(&mem_pool, 1);
+	cell->arch.ioapics = page_alloc(&mem_pool, 1, PAGE_OWNER_CELL);
 	if (!cell->arch.ioapics)
 		return -ENOMEM;
 
@@ -361,8 +366,8 @@ int ioapic_cell_init(struct cell *cell)
 		ioapic->pin_bitmap = irqchip->pin_bitmap[0];
 		cell->arch.num_ioapics++;
 
-		mmio_region_register(cell, irqchip->address, PAGE_SIZE,
-				     ioapic_access_handler, ioapic);
+		mmio_region_register_fast(cell, irqchip->address, PAGE_SIZE,
+					  ioapic_access_handler, ioapic);
 
 		if (cell != &root_cell) {
 			root_ioapic = ioapic_find_by_address(&root_cell,
@@ -393,7 +398,7 @@ void ioapic_cell_exit(struct cell *cell)
 				root_ioapic->info->pin_bitmap[0];
 	}
 
-	page_free(&mem_pool, cell->arch.ioapics, 1);
+	page_free(&mem_pool, cell->arch.ioapics, 1, PAGE_OWNER_CELL);
 }
 
 void ioapic_config_commit(struct cell *cell_added_removed)
@@ -425,6 +430,42 @@ void ioapic_config_commit(struct cell *cell_added_removed)
 		}
 }
 
+int ioapic_set_mask(struct cell *cell, unsigned int chip, unsigned long pins,
+		    unsigned long mask)
+{
+	union ioapic_redir_entry *shadow_table;
+	struct cell_ioapic *ioapic;
+	unsigned int pin;
+	int err;
+
+	if (chip >= cell->arch.num_ioapics)
+		return -EINVAL;
+
+	ioapic = &cell->arch.ioapics[chip];
+	if (pins & ~(unsigned long)ioapic->pin_bitmap)
+		return -EPERM;
+
+	shadow_table = ioapic->phys_ioapic->shadow_redir_table;
+	for (pin = 0; pin < IOAPIC_NUM_PINS; pin++) {
+		if (!(pins & (1UL << pin)))
+			continue;
+
+		/*
+		 * Same effect as a guest write of the lower half with only
+		 * the mask bit changed, but without the exits for the index
+		 * register and the preceding read.
+		 */
+		shadow_table[pin].native.mask = !!(mask & (1UL << pin));
+		err = ioapic_virt_redir_write(ioapic,
+					      IOAPIC_REDIR_TBL_START + pin * 2,
+					      shadow_table[pin].raw[0]);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
 void ioapic_shutdown(void)
 {
 	union ioapic_redir_entry *shadow_table;
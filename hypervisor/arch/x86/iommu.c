@@ -11,8 +11,12 @@
  */
 
 #include <jailhouse/control.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/printk.h>
 #include <asm/iommu.h>
 
+#define IOMMU_DEFAULT_INV_THRESHOLD	512
+
 unsigned int fault_reporting_cpu_id;
 
 unsigned int iommu_count_units(void)
@@ -42,3 +46,106 @@ struct per_cpu *iommu_select_fault_reporting_cpu(void)
 
 	return cpu_data;
 }
+
+/**
+ * Reject JAILHOUSE_CELL_IOMMU_PASSTHROUGH for all but the root cell.
+ * @param cell		Cell to be initialized.
+ *
+ * @return 0 on success, negative error code otherwise.
+ */
+int iommu_check_passthrough(struct cell *cell)
+{
+	if (cell != &root_cell &&
+	    cell->config->flags & JAILHOUSE_CELL_IOMMU_PASSTHROUGH)
+		return trace_error(-EINVAL);
+	return 0;
+}
+
+/**
+ * Check if DMA of the cell's devices should bypass translation.
+ * @param cell		Cell owning the device.
+ *
+ * @return True if the cell's devices bypass DMA translation.
+ */
+bool iommu_cell_passthrough(struct cell *cell)
+{
+	return cell == &root_cell &&
+		cell->config->flags & JAILHOUSE_CELL_IOMMU_PASSTHROUGH;
+}
+
+/**
+ * Record a DMA mapping change of a cell for the next configuration commit.
+ * @param cell		Cell whose IOMMU mappings were modified.
+ * @param mem		Memory region that was mapped or unmapped.
+ *
+ * The change is remembered as an address range so that iommu_config_commit()
+ * can invalidate only the affected pages. If too many ranges or pages
+ * accumulate, the cell falls back to a full domain flush.
+ */
+void iommu_track_region_change(struct cell *cell,
+			       const struct jailhouse_memory *mem)
+{
+	unsigned long threshold =
+		system_config->platform_info.x86.iommu_inv_threshold;
+	struct iommu_pending_inv *inv = &cell->arch.iommu_inv;
+	u64 pages = PAGES(mem->size);
+
+	if (inv->flush_domain)
+		return;
+
+	if (threshold == 0)
+		threshold = IOMMU_DEFAULT_INV_THRESHOLD;
+
+	if (inv->num_ranges >= IOMMU_MAX_INV_RANGES ||
+	    inv->pages + pages > threshold) {
+		inv->flush_domain = true;
+		return;
+	}
+
+	inv->ranges[inv->num_ranges].start = mem->virt_start & PAGE_MASK;
+	inv->ranges[inv->num_ranges].pages = pages;
+	inv->num_ranges++;
+	inv->pages += pages;
+}
+
+/**
+ * Request a full IOMMU domain flush of a cell on the next configuration
+ * commit.
+ * @param cell		Cell whose translation context was modified.
+ */
+void iommu_track_domain_change(struct cell *cell)
+{
+	cell->arch.iommu_inv.flush_domain = true;
+}
+
+/**
+ * Discard the recorded IOMMU changes of a cell after they were flushed.
+ * @param cell		Cell to reset.
+ */
+void iommu_clear_pending_changes(struct cell *cell)
+{
+	cell->arch.iommu_inv.num_ranges = 0;
+	cell->arch.iommu_inv.pages = 0;
+	cell->arch.iommu_inv.flush_domain = false;
+}
+
+/**
+ * Determine the size of the next naturally aligned invalidation block.
+ * @param start		Page-aligned start address of the remaining range.
+ * @param pages		Number of remaining pages (must be non-zero).
+ * @param max_order	Largest block order the IOMMU supports.
+ *
+ * @return Order of the largest power-of-two block of pages that starts at
+ * @c start, is aligned to its size and does not exceed @c pages.
+ */
+unsigned int iommu_inv_range_order(u64 start, u64 pages,
+				   unsigned int max_order)
+{
+	unsigned int order = 0;
+
+	while (order < max_order && (1ULL << (order + 1)) <= pages &&
+	       !((start >> PAGE_SHIFT) & ((1ULL << (order + 1)) - 1)))
+		order++;
+
+	return order;
+}
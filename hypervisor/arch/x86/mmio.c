@@ -15,12 +15,11 @@
 #include <jailhouse/mmio.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
+#include <jailhouse/string.h>
 #include <asm/ioapic.h>
 #include <asm/iommu.h>
 #include <asm/vcpu.h>
 
-#define X86_MAX_INST_LEN	15
-
 union opcode {
 	u8 raw;
 	struct { /* REX */
@@ -74,7 +73,7 @@ static bool ctx_advance(struct parse_context *ctx,
 	return ctx_maybe_get_bytes(ctx, pc, pg);
 }
 
-struct mmio_instruction x86_mmio_parse(unsigned long pc,
+static struct mmio_instruction x86_mmio_decode(unsigned long pc,
 	const struct guest_paging_structures *pg_structs, bool is_write)
 {
 	struct parse_context ctx = { .remaining = X86_MAX_INST_LEN };
@@ -176,6 +175,103 @@ error:
 	return inst;
 }
 
+static bool x86_mmio_fetch_inst(unsigned long pc,
+				const struct guest_paging_structures *pg_structs,
+				u8 *buf, unsigned int len)
+{
+	unsigned int size;
+	const u8 *inst;
+
+	while (len > 0) {
+		size = len;
+		inst = vcpu_get_inst_bytes(pg_structs, pc, &size);
+		if (!inst)
+			return false;
+		memcpy(buf, inst, size);
+		buf += size;
+		pc += size;
+		len -= size;
+	}
+	return true;
+}
+
+static bool x86_mmio_inst_matches(const struct mmio_inst_cache_entry *entry,
+				  const u8 *inst)
+{
+	unsigned int n;
+
+	for (n = 0; n < entry->inst_len; n++)
+		if (entry->inst[n] != inst[n])
+			return false;
+	return true;
+}
+
+/*
+ * Drivers tend to access their devices from a few instructions only. The
+ * decoding results are therefore cached per CPU, keyed on the guest page table
+ * root and RIP. CR3 writes are not intercepted, but a different root simply
+ * misses the cache. As the guest may have modified or remapped its code, the
+ * instruction bytes are fetched again and compared against the cached ones,
+ * saving only the decoding. Unpaged guest code is never cached as its RIP is
+ * not a linear address.
+ */
+struct mmio_instruction x86_mmio_parse(unsigned long pc,
+	const struct guest_paging_structures *pg_structs, bool is_write)
+{
+	unsigned long cr3 = pg_structs->root_table_gphys;
+	struct per_cpu *cpu_data = this_cpu_data();
+	struct mmio_inst_cache_entry *entry;
+	struct mmio_instruction inst;
+	u8 inst_bytes[X86_MAX_INST_LEN];
+	unsigned int n;
+
+	if (!pg_structs->root_paging)
+		return x86_mmio_decode(pc, pg_structs, is_write);
+
+	for (n = 0; n < MMIO_INST_CACHE_SIZE; n++) {
+		entry = &cpu_data->mmio_inst_cache[n];
+		if (entry->rip != pc || entry->cr3 != cr3 ||
+		    entry->is_write != is_write)
+			continue;
+		if (!x86_mmio_fetch_inst(pc, pg_structs, inst_bytes,
+					 entry->inst_len) ||
+		    !x86_mmio_inst_matches(entry, inst_bytes)) {
+			/* code changed, drop the entry and decode again */
+			entry->rip = 0;
+			break;
+		}
+		inst.inst_len = entry->inst_len;
+		inst.access_size = entry->access_size;
+		inst.reg_num = entry->reg_num;
+		return inst;
+	}
+
+	inst = x86_mmio_decode(pc, pg_structs, is_write);
+	if (inst.inst_len == 0 ||
+	    !x86_mmio_fetch_inst(pc, pg_structs, inst_bytes, inst.inst_len))
+		return inst;
+
+	entry = &cpu_data->mmio_inst_cache[cpu_data->mmio_inst_cache_next];
+	entry->cr3 = cr3;
+	entry->rip = pc;
+	entry->inst_len = inst.inst_len;
+	memcpy(entry->inst, inst_bytes, inst.inst_len);
+	entry->access_size = inst.access_size;
+	entry->reg_num = inst.reg_num;
+	entry->is_write = is_write;
+	cpu_data->mmio_inst_cache_next = (cpu_data->mmio_inst_cache_next + 1) %
+		MMIO_INST_CACHE_SIZE;
+
+	return inst;
+}
+
+void x86_mmio_inst_cache_flush(void)
+{
+	struct per_cpu *cpu_data = this_cpu_data();
+
+	memset(cpu_data->mmio_inst_cache, 0, sizeof(cpu_data->mmio_inst_cache));
+}
+
 unsigned int arch_mmio_count_regions(struct cell *cell)
 {
 	return pci_mmio_count_regions(cell) + ioapic_mmio_count_regions(cell) +
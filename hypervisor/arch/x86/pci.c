@@ -22,7 +22,10 @@
 #include <asm/pci.h>
 #include <asm/processor.h>
 
-/** Protects the root bridge's PIO interface to the PCI config space. */
+/**
+ * Protects the root bridge's PIO interface to the PCI config space. Only used
+ * for devices that cannot be reached via MMCONFIG, see pci_read_config.
+ */
 static DEFINE_SPINLOCK(pci_lock);
 
 u32 arch_pci_read_config(u16 bdf, u16 address, unsigned int size)
@@ -111,8 +114,7 @@ static int data_port_in_handler(struct pci_device *device, u16 address,
 
 	if (pci_cfg_read_moderate(device, address,
 				  size, &reg_data) == PCI_ACCESS_PERFORM)
-		reg_data = arch_pci_read_config(device->info->bdf, address,
-						size);
+		reg_data = pci_read_config(device->info->bdf, address, size);
 
 	set_guest_rax_reg(reg_data, size);
 
@@ -139,8 +141,7 @@ static int data_port_out_handler(struct pci_device *device, u16 address,
 	if (access == PCI_ACCESS_REJECT)
 		return -1;
 	if (access == PCI_ACCESS_PERFORM)
-		arch_pci_write_config(device->info->bdf, address, reg_data,
-				      size);
+		pci_write_config(device->info->bdf, address, reg_data, size);
 	return 1;
 }
 
@@ -275,6 +276,37 @@ pci_translate_msi_vector(struct pci_device *device, unsigned int vector,
 	return irq_msg;
 }
 
+/*
+ * Unless the root cell's interrupt remapping is emulated, a translation only
+ * depends on the guest message and the owner cell's CPU set. Changes of the
+ * latter are handled via pci_msi_translations_invalidate. The tag encodes
+ * further inputs, like the number of MSI vectors.
+ */
+static bool pci_msi_translation_cached(struct pci_device *device,
+				       struct pci_msi_translation *cache,
+				       union x86_msi_vector msi, u32 tag)
+{
+	if (iommu_cell_emulates_ir(device->cell)) {
+		cache->tag = 0;
+		return false;
+	}
+
+	return cache->tag == tag && cache->address == msi.raw.address &&
+		cache->data == msi.raw.data;
+}
+
+static void pci_msi_translation_store(struct pci_device *device,
+				      struct pci_msi_translation *cache,
+				      union x86_msi_vector msi, u32 tag)
+{
+	if (iommu_cell_emulates_ir(device->cell))
+		return;
+
+	cache->address = msi.raw.address;
+	cache->data = msi.raw.data;
+	cache->tag = tag;
+}
+
 void arch_pci_suppress_msi(struct pci_device *device,
 			   const struct jailhouse_pci_capability *cap)
 {
@@ -292,8 +324,10 @@ void arch_pci_suppress_msi(struct pci_device *device,
 
 	/*
 	 * Disable delivery by setting no destination CPU bit in logical
-	 * addressing mode.
+	 * addressing mode. The hardware then no longer reflects the last
+	 * translation.
 	 */
+	device->msi_translated.tag = 0;
 	if (info->msi_64bits)
 		pci_write_config(info->bdf, cap->start + 8, 0, 4);
 	pci_write_config(info->bdf, cap->start + 4, (u32)msi.raw.address, 4);
@@ -336,19 +370,31 @@ int arch_pci_update_msi(struct pci_device *device,
 	if (vectors == 0)
 		return 0;
 
+	/* Linux rewrites unchanged messages, e.g. on affinity no-ops */
+	if (pci_msi_translation_cached(device, &device->msi_translated, msi,
+				       vectors))
+		return 0;
+
+	iommu_map_interrupts_begin();
 	for (n = 0; n < vectors; n++) {
 		irq_msg = pci_translate_msi_vector(device, n, vectors, msi);
 		result = iommu_map_interrupt(device->cell, bdf, n, irq_msg);
-		// HACK for QEMU
-		if (result == -ENOSYS) {
-			for (n = 1; n < (info->msi_64bits ? 4 : 3); n++)
-				pci_write_config(bdf, cap->start + n * 4,
-					device->msi_registers.raw[n], 4);
-			return 0;
-		}
 		if (result < 0)
-			return result;
+			break;
 	}
+	iommu_map_interrupts_end();
+
+	// HACK for QEMU
+	if (result == -ENOSYS) {
+		for (n = 1; n < (info->msi_64bits ? 4 : 3); n++)
+			pci_write_config(bdf, cap->start + n * 4,
+				device->msi_registers.raw[n], 4);
+		pci_msi_translation_store(device, &device->msi_translated,
+					  msi, vectors);
+		return 0;
+	}
+	if (result < 0)
+		return result;
 
 	/* set result to the base index again */
 	result -= vectors - 1;
@@ -360,6 +406,9 @@ int arch_pci_update_msi(struct pci_device *device,
 	pci_write_config(bdf, cap->start + 4,
 			 pci_get_x86_msi_remap_address(result), 4);
 
+	pci_msi_translation_store(device, &device->msi_translated, msi,
+				  vectors);
+
 	return 0;
 }
 
@@ -369,6 +418,7 @@ int arch_pci_update_msix_vector(struct pci_device *device, unsigned int index)
 		.raw.address = device->msix_vectors[index].address,
 		.raw.data = device->msix_vectors[index].data,
 	};
+	struct pci_msi_translation *cache = &device->msix_translated[index];
 	struct apic_irq_message irq_msg;
 	int result;
 
@@ -376,6 +426,13 @@ int arch_pci_update_msix_vector(struct pci_device *device, unsigned int index)
 	    device->msix_vectors[index].masked)
 		return 0;
 
+	/*
+	 * Masking leaves the programmed message in place, so unmasking or
+	 * rewriting an unchanged message requires no update.
+	 */
+	if (pci_msi_translation_cached(device, cache, msi, 1))
+		return 0;
+
 	irq_msg = pci_translate_msi_vector(device, index, 0, msi);
 	result = iommu_map_interrupt(device->cell, device->info->bdf, index,
 				     irq_msg);
@@ -385,6 +442,7 @@ int arch_pci_update_msix_vector(struct pci_device *device, unsigned int index)
 			     device->msix_vectors[index].address);
 		mmio_write32(&device->msix_table[index].data,
 			     device->msix_vectors[index].data);
+		pci_msi_translation_store(device, cache, msi, 1);
 		return 0;
 	}
 	if (result < 0)
@@ -394,5 +452,28 @@ int arch_pci_update_msix_vector(struct pci_device *device, unsigned int index)
 		     pci_get_x86_msi_remap_address(result));
 	mmio_write32(&device->msix_table[index].data, 0);
 
+	pci_msi_translation_store(device, cache, msi, 1);
+
 	return 0;
 }
+
+int arch_pci_update_msix(struct pci_device *device)
+{
+	unsigned int n;
+	int result = 0;
+
+	/*
+	 * The device cannot use the vectors before the moderated config
+	 * space write completes, thus the IOMMU may collect the interrupt
+	 * cache invalidations and submit them at once.
+	 */
+	iommu_map_interrupts_begin();
+	for (n = 0; n < device->info->num_msix_vectors; n++) {
+		result = arch_pci_update_msix_vector(device, n);
+		if (result < 0)
+			break;
+	}
+	iommu_map_interrupts_end();
+
+	return result;
+}
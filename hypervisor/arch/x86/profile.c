@@ -0,0 +1,167 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/processor.h>
+#include <jailhouse/trace.h>
+#include <asm/apic.h>
+#include <asm/processor.h>
+#include <asm/profile.h>
+
+/*
+ * Sampling profiler for the hypervisor itself. The highest general-purpose
+ * counter of the PMU is taken away from the cells and counts unhalted core
+ * cycles while in root mode only, see the IA32_PERF_GLOBAL_CTRL switching on
+ * VM entry and exit. Each overflow raises an NMI that samples the interrupted
+ * RIP. The sample is written to the trace buffer on the next VM exit, as
+ * trace_event must not be called from NMI context.
+ *
+ * Enabled by defining CONFIG_PROFILE_PERIOD (cycles between samples, below
+ * 2^31) in hypervisor/include/jailhouse/config.h. CONFIG_PROFILE_CPUS limits
+ * profiling to a mask of CPUs.
+ */
+#ifndef CONFIG_PROFILE_PERIOD
+#define CONFIG_PROFILE_PERIOD	0
+#endif
+
+#ifndef CONFIG_PROFILE_CPUS
+#define CONFIG_PROFILE_CPUS	(~0UL)
+#endif
+
+#define PERFEVTSEL_UNHALTED_CORE_CYCLES	0x3c
+#define PERFEVTSEL_OS			(1UL << 17)
+#define PERFEVTSEL_INT			(1UL << 20)
+#define PERFEVTSEL_EN			(1UL << 22)
+
+#define PMU_VERSION(eax)		((eax) & 0xff)
+#define PMU_NUM_COUNTERS(eax)		(((eax) >> 8) & 0xff)
+#define PMU_NUM_EVENTS(eax)		(((eax) >> 24) & 0xff)
+#define PMU_NO_CORE_CYCLES		(1UL << 0)
+
+static void profile_reload(struct per_cpu *cpu_data)
+{
+	/* only the lower 32 bits are written, sign-extended */
+	write_msr(MSR_IA32_PMC0 + cpu_data->profile_counter,
+		  -(unsigned long)CONFIG_PROFILE_PERIOD);
+}
+
+/**
+ * Program the profiling counter of a CPU if profiling is enabled for it.
+ * @param cpu_data	Data structure of the CPU.
+ *
+ * Must be called after the hypervisor took over the global counter control,
+ * i.e. with IA32_PERF_GLOBAL_CTRL cleared.
+ */
+void profile_cpu_init(struct per_cpu *cpu_data)
+{
+	u32 eax = cpuid_eax(0x0a, 0);
+	unsigned int counter;
+
+	if (!CONFIG_PROFILE_PERIOD || cpu_data->cpu_id >= BITS_PER_LONG ||
+	    !(CONFIG_PROFILE_CPUS & (1UL << cpu_data->cpu_id)))
+		return;
+
+	/* global control and overflow status require version 2 */
+	if (PMU_VERSION(eax) < 2 || PMU_NUM_COUNTERS(eax) == 0 ||
+	    PMU_NUM_EVENTS(eax) == 0 ||
+	    cpuid_ebx(0x0a, 0) & PMU_NO_CORE_CYCLES)
+		return;
+
+	counter = PMU_NUM_COUNTERS(eax) - 1;
+	cpu_data->profile_counter = counter;
+
+	write_msr(MSR_IA32_PERFEVTSEL0 + counter, 0);
+	profile_reload(cpu_data);
+	write_msr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, 1UL << counter);
+	write_msr(MSR_IA32_PERFEVTSEL0 + counter,
+		  PERFEVTSEL_UNHALTED_CORE_CYCLES | PERFEVTSEL_OS |
+		  PERFEVTSEL_INT | PERFEVTSEL_EN);
+
+	cpu_data->profile_linux_lvtpc = apic_get_lvtpc();
+	cpu_data->profile_ctrl = 1UL << counter;
+	profile_arm_pmi();
+}
+
+/**
+ * Stop profiling on a CPU and hand the PMI back to Linux.
+ * @param cpu_data	Data structure of the CPU.
+ */
+void profile_cpu_exit(struct per_cpu *cpu_data)
+{
+	if (!cpu_data->profile_ctrl)
+		return;
+
+	write_msr(MSR_IA32_PERFEVTSEL0 + cpu_data->profile_counter, 0);
+	write_msr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, cpu_data->profile_ctrl);
+	apic_set_lvtpc(cpu_data->profile_linux_lvtpc);
+	cpu_data->profile_ctrl = 0;
+}
+
+/**
+ * Unmask the PMI of the calling CPU and deliver it as NMI.
+ *
+ * The local APIC masks the LVTPC on each PMI.
+ */
+void profile_arm_pmi(void)
+{
+	apic_set_lvtpc(APIC_LVT_DLVR_NMI);
+}
+
+/**
+ * Take a sample if the profiling counter overflowed.
+ * @param rip	Instruction pointer interrupted by the NMI.
+ *
+ * A sample that was not yet flushed is kept, the new one is dropped.
+ *
+ * @note Called in NMI context.
+ */
+void profile_nmi(unsigned long rip)
+{
+	struct per_cpu *cpu_data = this_cpu_data();
+
+	if (!cpu_data->profile_ctrl ||
+	    !(read_msr(MSR_IA32_PERF_GLOBAL_STATUS) & cpu_data->profile_ctrl))
+		return;
+
+	if (!cpu_data->profile_rip) {
+		cpu_data->profile_time = get_cycles();
+		cpu_data->profile_rip = rip;
+	}
+
+	profile_reload(cpu_data);
+	write_msr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, cpu_data->profile_ctrl);
+	profile_arm_pmi();
+}
+
+/**
+ * Write a pending sample of the calling CPU to its trace buffer.
+ * @param cpu_data	Data structure of the calling CPU.
+ */
+void profile_flush(struct per_cpu *cpu_data)
+{
+	unsigned long rip = cpu_data->profile_rip;
+
+	if (!rip)
+		return;
+
+	trace_event(JAILHOUSE_TRACE_PROFILE, rip, cpu_data->profile_time);
+	cpu_data->profile_rip = 0;
+}
+
+/**
+ * Hide the profiling counter from the cell in CPUID leaf 0x0a.
+ * @param eax	EAX value of leaf 0x0a.
+ *
+ * @return EAX value to report to the cell.
+ */
+u32 profile_filter_cpuid_pmu(u32 eax)
+{
+	if (profile_owns_pmi())
+		eax -= 1 << 8;
+	return eax;
+}
@@ -12,6 +12,7 @@
  * the COPYING file in the top-level directory.
  */
 
+#include <jailhouse/control.h>
 #include <jailhouse/entry.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/pci.h>
@@ -19,8 +20,12 @@
 #include <asm/apic.h>
 #include <asm/bitops.h>
 #include <asm/cat.h>
+#include <asm/control.h>
+#include <asm/io.h>
 #include <asm/ioapic.h>
 #include <asm/iommu.h>
+#include <asm/profile.h>
+#include <asm/spinlock.h>
 #include <asm/vcpu.h>
 
 #define IDT_PRESENT_INT		0x00008e00
@@ -36,11 +41,19 @@ static u64 gdt[] = {
 	[GDT_DESC_TSS_HI] = 0x0000000000000000UL,
 };
 
+static DEFINE_SPINLOCK(gdt_lock);
+
 extern u8 exception_entries[];
 extern u8 nmi_entry[];
 extern u8 irq_entry[];
 
+#define PM_TIMER_HZ		3579545
+#define PM_TIMER_MASK		0x00ffffff
+/* calibrate over 10 ms */
+#define TSC_CALIB_PM_TICKS	(PM_TIMER_HZ / 100)
+
 unsigned long cache_line_size;
+unsigned long tsc_khz;
 static u32 idt[NUM_IDT_DESC * 4];
 
 static void set_idt_int_gate(unsigned int vector, unsigned long entry)
@@ -50,6 +63,26 @@ static void set_idt_int_gate(unsigned int vector, unsigned long entry)
 	idt[vector * 4 + 2] = entry >> 32;
 }
 
+static void calibrate_tsc(void)
+{
+	u16 pm_timer = system_config->platform_info.x86.pm_timer_address;
+	u32 start_pm, elapsed_pm;
+	u64 start_tsc;
+
+	if (pm_timer == 0)
+		return;
+
+	start_pm = inl(pm_timer);
+	start_tsc = get_cycles();
+	do {
+		cpu_relax();
+		elapsed_pm = (inl(pm_timer) - start_pm) & PM_TIMER_MASK;
+	} while (elapsed_pm < TSC_CALIB_PM_TICKS);
+
+	tsc_khz = (get_cycles() - start_tsc) * PM_TIMER_HZ /
+		(elapsed_pm * 1000ULL);
+}
+
 int arch_init_early(void)
 {
 	unsigned long entry;
@@ -58,6 +91,8 @@ int arch_init_early(void)
 
 	cache_line_size = (cpuid_ebx(1, 0) & 0xff00) >> 5;
 
+	calibrate_tsc();
+
 	err = apic_init();
 	if (err)
 		return err;
@@ -179,13 +214,22 @@ int arch_cpu_init(struct per_cpu *cpu_data)
 		"mov %0,%%ss"
 		: : "r" (0));
 
-	/* clear TSS busy flag set by previous loading, then set TR */
+	/*
+	 * Clear TSS busy flag set by previous loading, then set TR. The GDT
+	 * is shared, so other CPUs must not load TR in between.
+	 */
+	spin_lock(&gdt_lock);
 	gdt[GDT_DESC_TSS] &= ~DESC_TSS_BUSY;
 	asm volatile("ltr %%ax" : : "a" (GDT_DESC_TSS * 8));
+	spin_unlock(&gdt_lock);
 
 	cpu_data->linux_cr0 = read_cr0();
 	cpu_data->linux_cr4 = read_cr4();
 
+	/* XCR0 is shared with the guest, only guest XSETBV can change it */
+	cpu_data->xcr0 = (cpu_data->linux_cr4 & X86_CR4_OSXSAVE) ?
+		read_xcr0() : X86_XCR0_FP;
+
 	/* swap CR3 */
 	cpu_data->linux_cr3 = read_cr3();
 	write_cr3(paging_hvirt2phys(hv_paging_structs.root_table));
@@ -250,6 +294,7 @@ void arch_cpu_restore(struct per_cpu *cpu_data, int return_code)
 		return;
 
 	vcpu_exit(cpu_data);
+	profile_cpu_exit(cpu_data);
 
 	write_msr(MSR_IA32_PAT, cpu_data->pat);
 	write_msr(MSR_EFER, cpu_data->linux_efer);
@@ -22,6 +22,7 @@
 #include <jailhouse/printk.h>
 #include <jailhouse/processor.h>
 #include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <jailhouse/utils.h>
 #include <asm/amd_iommu.h>
 #include <asm/apic.h>
@@ -42,18 +43,25 @@
 
 /* IOPM size: two 4-K pages + 3 bits */
 #define IOPM_PAGES			3
+#define MSRPM_PAGES			2
+#define MSRPM_REGION_SIZE		(0x2000/4)
 
 #define NPT_IOMMU_PAGE_DIR_LEVELS	4
 
 static bool has_avic, has_assists, has_flush_by_asid;
+static unsigned int num_asids;
 
 static const struct segment invalid_seg;
 
 static struct paging npt_iommu_paging[NPT_IOMMU_PAGE_DIR_LEVELS];
 
-/* bit cleared: direct access allowed */
-// TODO: convert to whitelist
-static u8 __attribute__((aligned(PAGE_SIZE))) msrpm[][0x2000/4] = {
+/*
+ * bit cleared: direct access allowed
+ *
+ * Template for cells without an MSR allow list. Bits set here are never
+ * cleared in the permission map of a cell.
+ */
+static u8 __attribute__((aligned(PAGE_SIZE))) msrpm[][MSRPM_REGION_SIZE] = {
 	[ SVM_MSRPM_0000 ] = {
 		[      0/4 ...  0x017/4 ] = 0,
 		[  0x018/4 ...  0x01b/4 ] = 0x80, /* 0x01b (w) */
@@ -130,6 +138,11 @@ static int svm_check_features(void)
 	if (cpuid_edx(0x8000000A, 0) & X86_FEATURE_FLUSH_BY_ASID)
 		has_flush_by_asid = true;
 
+	/* ASID 0 is reserved for the host, we need at least one for guests */
+	num_asids = cpuid_ebx(0x8000000A, 0);
+	if (num_asids < 2)
+		return trace_error(-EIO);
+
 	return 0;
 }
 
@@ -150,11 +163,22 @@ static void set_svm_segment_from_segment(struct svm_segment *svm_segment,
 	svm_segment->base = segment->base;
 }
 
+/*
+ * Each cell is tagged with its own ASID (modulo the number available), so that
+ * CPU reassignments do not mix up TLB entries of different cells. As ASIDs are
+ * reused, the entries are flushed whenever a CPU takes up a cell's
+ * configuration.
+ */
 static void svm_set_cell_config(struct cell *cell, struct vmcb *vmcb)
 {
 	vmcb->iopm_base_pa = paging_hvirt2phys(cell->arch.svm.iopm);
+	vmcb->msrpm_base_pa = paging_hvirt2phys(cell->arch.svm.msrpm);
 	vmcb->n_cr3 =
 		paging_hvirt2phys(cell->arch.svm.npt_iommu_structs.root_table);
+	vmcb->guest_asid = 1 + cell->id % (num_asids - 1);
+	vmcb->tlb_control = has_flush_by_asid ? SVM_TLB_FLUSH_GUEST :
+		SVM_TLB_FLUSH_ALL;
+	vmcb->clean_bits &= ~(CLEAN_BITS_IOPM | CLEAN_BITS_ASID | CLEAN_BITS_NP);
 }
 
 static void vmcb_setup(struct per_cpu *cpu_data)
@@ -205,6 +229,11 @@ static void vmcb_setup(struct per_cpu *cpu_data)
 
 	vmcb->g_pat = cpu_data->pat;
 
+	/*
+	 * HLT, PAUSE and MONITOR/MWAIT are left unintercepted, cells own their
+	 * CPUs. Management events arrive as NMIs and wake the CPU. For the same
+	 * reason, the pause filter stays disabled, see vmcs_setup in vmx.c.
+	 */
 	vmcb->general1_intercepts |= GENERAL1_INTERCEPT_NMI;
 	vmcb->general1_intercepts |= GENERAL1_INTERCEPT_CR0_SEL_WRITE;
 	vmcb->general1_intercepts |= GENERAL1_INTERCEPT_CPUID;
@@ -222,11 +251,7 @@ static void vmcb_setup(struct per_cpu *cpu_data)
 	 */
 	vmcb->exception_intercepts |= (1 << DB_VECTOR) | (1 << AC_VECTOR);
 
-	vmcb->msrpm_base_pa = paging_hvirt2phys(msrpm);
-
 	vmcb->np_enable = 1;
-	/* No more than one guest owns the CPU */
-	vmcb->guest_asid = 1;
 
 	/* TODO: Setup AVIC */
 
@@ -244,6 +269,11 @@ unsigned long arch_paging_gphys2phys(struct per_cpu *cpu_data,
 				gphys, flags);
 }
 
+const struct paging_structures *arch_cell_paging_structs(struct cell *cell)
+{
+	return &cell->arch.svm.npt_iommu_structs;
+}
+
 static void npt_iommu_set_next_pt_l4(pt_entry_t pte, unsigned long next_pt)
 {
 	/*
@@ -309,10 +339,14 @@ int vcpu_vendor_init(void)
 	npt_iommu_paging[2].set_next_pt = npt_iommu_set_next_pt_l2;
 	npt_iommu_paging[1].get_phys = npt_iommu_get_phys_l3;
 	npt_iommu_paging[2].get_phys = npt_iommu_get_phys_l2;
+	/* 1 GB NPT pages are available if the host supports them */
+	if (!(cpuid_edx(0x80000001, 0) & X86_FEATURE_GBPAGES))
+		npt_iommu_paging[1].page_size = 0;
 
 	/* Map guest parking code (shared between cells and CPUs) */
 	parking_pt.root_paging = npt_iommu_paging;
-	parking_pt.root_table = parked_mode_npt = page_alloc(&mem_pool, 1);
+	parking_pt.root_table = parked_mode_npt =
+		page_alloc(&mem_pool, 1, PAGE_OWNER_PAGING);
 	if (!parked_mode_npt)
 		return -ENOMEM;
 	err = paging_create(&parking_pt, paging_hvirt2phys(parking_code),
@@ -325,13 +359,18 @@ int vcpu_vendor_init(void)
 	/* This is always false for AMD now (except in nested SVM);
 	   see Sect. 16.3.1 in APMv2 */
 	if (using_x2apic) {
-		/* allow direct x2APIC access except for ICR writes */
+		/*
+		 * allow direct x2APIC access except for ICR writes and
+		 * version reads (see x2apic_handle_read)
+		 */
 		memset(&msrpm[SVM_MSRPM_0000][MSR_X2APIC_BASE/4], 0,
 				(MSR_X2APIC_END - MSR_X2APIC_BASE + 1)/4);
+		msrpm[SVM_MSRPM_0000][MSR_X2APIC_LVR/4] = 0x40;
 		msrpm[SVM_MSRPM_0000][MSR_X2APIC_ICR/4] = 0x02;
 	} else {
 		if (has_avic) {
-			avic_page = page_alloc(&remap_pool, 1);
+			avic_page = page_alloc(&remap_pool, 1,
+					       PAGE_OWNER_OTHER);
 			if (!avic_page)
 				return trace_error(-ENOMEM);
 		}
@@ -346,10 +385,21 @@ int vcpu_vendor_cell_init(struct cell *cell)
 	u64 flags;
 
 	/* allocate iopm  */
-	cell->arch.svm.iopm = page_alloc(&mem_pool, IOPM_PAGES);
+	cell->arch.svm.iopm = page_alloc(&mem_pool, IOPM_PAGES,
+					 PAGE_OWNER_CELL);
 	if (!cell->arch.svm.iopm)
 		return err;
 
+	/* start from the template or intercept all MSRs if allow-listed */
+	cell->arch.svm.msrpm = page_alloc(&mem_pool, MSRPM_PAGES,
+					  PAGE_OWNER_CELL);
+	if (!cell->arch.svm.msrpm)
+		goto err_free_iopm;
+	if (cell->config->num_msrs > 0)
+		memset(cell->arch.svm.msrpm, -1, MSRPM_PAGES * PAGE_SIZE);
+	else
+		memcpy(cell->arch.svm.msrpm, msrpm, sizeof(msrpm));
+
 	/* build root NPT of cell */
 	cell->arch.svm.npt_iommu_structs.root_paging = npt_iommu_paging;
 	cell->arch.svm.npt_iommu_structs.root_table =
@@ -371,21 +421,95 @@ int vcpu_vendor_cell_init(struct cell *cell)
 				    flags, PAGING_NON_COHERENT);
 	}
 	if (err)
-		goto err_free_iopm;
+		goto err_free_msrpm;
 
 	return 0;
 
+err_free_msrpm:
+	page_free(&mem_pool, cell->arch.svm.msrpm, MSRPM_PAGES,
+		  PAGE_OWNER_CELL);
 err_free_iopm:
-	page_free(&mem_pool, cell->arch.svm.iopm, 3);
+	page_free(&mem_pool, cell->arch.svm.iopm, 3, PAGE_OWNER_CELL);
 
 	return err;
 }
 
+int vcpu_vendor_allow_msr(struct cell *cell, u32 msr, u32 flags)
+{
+	unsigned int region, byte = (msr & 0x1fff) / 4;
+	u8 *map = cell->arch.svm.msrpm;
+	u8 mask = 0;
+
+	if (msr <= 0x1fff)
+		region = SVM_MSRPM_0000;
+	else if (msr - 0xc0000000 <= 0x1fff)
+		region = SVM_MSRPM_C000;
+	else if (msr - 0xc0010000 <= 0x1fff)
+		region = SVM_MSRPM_C001;
+	else
+		return trace_error(-EINVAL);
+
+	/* two bits per MSR: read intercept, then write intercept */
+	if (flags & JAILHOUSE_MSR_READ)
+		mask |= 1 << ((msr % 4) * 2);
+	if (flags & JAILHOUSE_MSR_WRITE)
+		mask |= 2 << ((msr % 4) * 2);
+	mask &= ~msrpm[region][byte];
+
+	map[region * MSRPM_REGION_SIZE + byte] &= ~mask;
+
+	return 0;
+}
+
+int vcpu_vendor_intercept_msr(struct cell *cell, u32 msr, u32 flags)
+{
+	unsigned int region, byte = (msr & 0x1fff) / 4;
+	u8 *map = cell->arch.svm.msrpm;
+
+	if (msr <= 0x1fff)
+		region = SVM_MSRPM_0000;
+	else if (msr - 0xc0000000 <= 0x1fff)
+		region = SVM_MSRPM_C000;
+	else if (msr - 0xc0010000 <= 0x1fff)
+		region = SVM_MSRPM_C001;
+	else
+		return trace_error(-EINVAL);
+
+	if (flags & JAILHOUSE_MSR_READ)
+		map[region * MSRPM_REGION_SIZE + byte] |= 1 << ((msr % 4) * 2);
+	if (flags & JAILHOUSE_MSR_WRITE)
+		map[region * MSRPM_REGION_SIZE + byte] |= 2 << ((msr % 4) * 2);
+
+	return 0;
+}
+
 int vcpu_map_memory_region(struct cell *cell,
 			   const struct jailhouse_memory *mem)
 {
 	u64 phys_start = mem->phys_start;
 	u64 flags = PAGE_FLAG_US; /* See APMv2, Section 15.25.5 */
+	int err;
+
+	if ((mem->flags & JAILHOUSE_MEM_HUGE_1G &&
+	     !npt_iommu_paging[1].page_size) ||
+	    (mem->flags & JAILHOUSE_MEM_HUGE_2M &&
+	     !npt_iommu_paging[2].page_size))
+		return trace_error(-EINVAL);
+
+	/*
+	 * Index the PAT_RESET_VALUE entries of the hypervisor: UC for UC,
+	 * UC- for WC, which lets a guest PAT selecting WC take effect. NPT
+	 * cannot override the guest PAT, so JAILHOUSE_MEM_TYPE_FORCE has no
+	 * further effect.
+	 */
+	switch (mem->flags & JAILHOUSE_MEM_TYPE_MASK) {
+	case JAILHOUSE_MEM_TYPE_UC:
+		flags |= PAGE_FLAG_DEVICE | PAGE_FLAG_WRITETHROUGH;
+		break;
+	case JAILHOUSE_MEM_TYPE_WC:
+		flags |= PAGE_FLAG_DEVICE;
+		break;
+	}
 
 	if (mem->flags & JAILHOUSE_MEM_READ)
 		flags |= PAGE_FLAG_PRESENT;
@@ -402,9 +526,15 @@ int vcpu_map_memory_region(struct cell *cell,
 	 * As we also manipulate the IOMMU page table, changes need to be
 	 * coherent.
 	 */
-	return paging_create(&cell->arch.svm.npt_iommu_structs, phys_start,
-			     mem->size, mem->virt_start, flags,
-			     PAGING_COHERENT);
+	err = paging_create(&cell->arch.svm.npt_iommu_structs, phys_start,
+			    mem->size, mem->virt_start, flags,
+			    PAGING_COHERENT);
+	if (err)
+		return err;
+
+	paging_merge(&cell->arch.svm.npt_iommu_structs, mem->virt_start,
+		     mem->size, PAGING_COHERENT);
+	return 0;
 }
 
 int vcpu_unmap_memory_region(struct cell *cell,
@@ -416,9 +546,10 @@ int vcpu_unmap_memory_region(struct cell *cell,
 
 void vcpu_vendor_cell_exit(struct cell *cell)
 {
-	paging_destroy(&cell->arch.svm.npt_iommu_structs, XAPIC_BASE,
-		       PAGE_SIZE, PAGING_NON_COHERENT);
-	page_free(&mem_pool, cell->arch.svm.iopm, 3);
+	paging_destroy_tables(&cell->arch.svm.npt_iommu_structs, 1);
+	page_free(&mem_pool, cell->arch.svm.msrpm, MSRPM_PAGES,
+		  PAGE_OWNER_CELL);
+	page_free(&mem_pool, cell->arch.svm.iopm, 3, PAGE_OWNER_CELL);
 }
 
 int vcpu_init(struct per_cpu *cpu_data)
@@ -636,8 +767,12 @@ void vcpu_vendor_reset(unsigned int sipi_vector)
 
 	vmcb->eventinj = 0;
 
-	/* Almost all of the guest state changed */
-	vmcb->clean_bits = 0;
+	/*
+	 * Intercepts, TPR and LBR state are preserved, svm_set_cell_config
+	 * marks the cell-specific parts.
+	 */
+	vmcb->clean_bits &= ~(CLEAN_BITS_CRX | CLEAN_BITS_DRX | CLEAN_BITS_DT |
+			      CLEAN_BITS_SEG);
 
 	svm_set_cell_config(cpu_data->cell, vmcb);
 
@@ -700,6 +835,11 @@ bool vcpu_get_guest_paging_structs(struct guest_paging_structures *pg_structs)
 	return true;
 }
 
+unsigned long vcpu_vendor_get_guest_pat(void)
+{
+	return this_cpu_data()->pat;
+}
+
 void vcpu_vendor_set_guest_pat(unsigned long val)
 {
 	struct vmcb *vmcb = &this_cpu_data()->vmcb;
@@ -865,7 +1005,8 @@ out_err:
 	return false;
 }
 
-static void dump_guest_regs(union registers *guest_regs, struct vmcb *vmcb)
+static __cold void dump_guest_regs(union registers *guest_regs,
+				   struct vmcb *vmcb)
 {
 	panic_printk("RIP: %p RSP: %p FLAGS: %x\n", vmcb->rip,
 		     vmcb->rsp, vmcb->rflags);
@@ -902,7 +1043,7 @@ void vcpu_vendor_get_mmio_intercept(struct vcpu_mmio_intercept *mmio)
 	mmio->is_write = !!(vmcb->exitinfo1 & 0x2);
 }
 
-void vcpu_handle_exit(struct per_cpu *cpu_data)
+void vcpu_vendor_handle_exit(struct per_cpu *cpu_data)
 {
 	struct vmcb *vmcb = &cpu_data->vmcb;
 	bool res = false;
@@ -912,12 +1053,18 @@ void vcpu_handle_exit(struct per_cpu *cpu_data)
 	/* Restore GS value expected by per_cpu data accessors */
 	write_msr(MSR_GS_BASE, (unsigned long)cpu_data);
 
+	/* A requested TLB flush was carried out by the last VMRUN */
+	vmcb->tlb_control = SVM_TLB_FLUSH_NONE;
+
 	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL]++;
+	trace_event(JAILHOUSE_TRACE_VMEXIT, vmcb->exitcode, 0);
 	/*
 	 * All guest state is marked unmodified; individual handlers must clear
-	 * the bits as needed.
+	 * the bits as needed. State that is not covered by clean bits (RIP,
+	 * RSP, RAX, RFLAGS, TLB control, event injection and the VMLOAD
+	 * state) is always taken from the VMCB.
 	 */
-	vmcb->clean_bits = 0xffffffff;
+	vmcb->clean_bits = CLEAN_BITS_ALL;
 
 	switch (vmcb->exitcode) {
 	case VMEXIT_INVALID:
@@ -1013,6 +1160,16 @@ void vcpu_nmi_handler(void)
 {
 }
 
+void vcpu_vendor_arm_timer(u64 deadline)
+{
+	/* no preemption timer, rely on the regular VM exits of the CPU */
+}
+
+bool vcpu_vendor_has_timer(void)
+{
+	return false;
+}
+
 void vcpu_tlb_flush(void)
 {
 	struct vmcb *vmcb = &this_cpu_data()->vmcb;
@@ -1029,19 +1186,24 @@ const u8 *vcpu_get_inst_bytes(const struct guest_paging_structures *pg_structs,
 	struct vmcb *vmcb = &this_cpu_data()->vmcb;
 	unsigned long start;
 
-	if (has_assists) {
-		if (!*size)
-			return NULL;
-		start = vmcb->rip - pc;
+	if (!*size)
+		return NULL;
+
+	/*
+	 * With decode assists, the CPU provides the bytes at the faulting RIP
+	 * along with the nested page fault, so there is no need to walk the
+	 * guest page tables. Only fall back to mapping the code if the CPU
+	 * fetched fewer bytes than the instruction consists of, e.g. because
+	 * it crosses a page boundary.
+	 */
+	if (has_assists && pc >= vmcb->rip) {
+		start = pc - vmcb->rip;
 		if (start < vmcb->bytes_fetched) {
-			*size = vmcb->bytes_fetched - start;
+			*size = MIN(*size, vmcb->bytes_fetched - start);
 			return &vmcb->guest_bytes[start];
-		} else {
-			return NULL;
 		}
-	} else {
-		return vcpu_map_inst(pg_structs, pc, size);
 	}
+	return vcpu_map_inst(pg_structs, pc, size);
 }
 
 void vcpu_vendor_get_cell_io_bitmap(struct cell *cell,
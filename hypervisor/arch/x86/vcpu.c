@@ -19,13 +19,32 @@
 #include <jailhouse/printk.h>
 #include <jailhouse/string.h>
 #include <jailhouse/types.h>
+#include <jailhouse/utils.h>
 #include <asm/apic.h>
 #include <asm/i8042.h>
 #include <asm/ioapic.h>
 #include <asm/pci.h>
 #include <asm/percpu.h>
+#include <asm/profile.h>
 #include <asm/vcpu.h>
 
+#define CPUID_APIC_ID_SHIFT	24
+
+/*
+ * Leaves that are identical on all CPUs and do not depend on guest state,
+ * precomputed per cell. Everything else, e.g. the topology leaves or the
+ * XSAVE area sizes, is still executed on each exit.
+ */
+static const struct {
+	u32 function;
+	u32 index;
+	bool indexed;
+} cpuid_cached_leaves[] = {
+	{ 0x00000000 }, { 0x00000001 }, { 0x00000007, 0, true },
+	{ 0x80000000 }, { 0x80000001 }, { 0x80000002 }, { 0x80000003 },
+	{ 0x80000004 }, { 0x80000007 }, { 0x80000008 },
+};
+
 /* Can be overridden in vendor-specific code if needed */
 const u8 *vcpu_get_inst_bytes(const struct guest_paging_structures *pg_structs,
 			      unsigned long pc, unsigned int *size)
@@ -55,9 +74,255 @@ out_err:
 	return NULL;
 }
 
+static struct cpuid_cache_entry *
+vcpu_cpuid_cache_add(struct cell *cell, u32 function, u32 index, bool indexed)
+{
+	struct cpuid_cache_entry *entry =
+		&cell->arch.cpuid_cache[cell->arch.num_cpuid_entries++];
+
+	entry->function = function;
+	entry->index = index;
+	entry->indexed = indexed;
+	return entry;
+}
+
+static void vcpu_cpuid_cache_init(struct cell *cell)
+{
+	static const char signature[12] = "Jailhouse";
+	u32 max_basic = cpuid_eax(0, 0);
+	u32 max_ext = cpuid_eax(0x80000000, 0);
+	struct cpuid_cache_entry *entry;
+	unsigned int n;
+	u32 function;
+
+	cell->arch.num_cpuid_entries = 0;
+
+	for (n = 0; n < ARRAY_SIZE(cpuid_cached_leaves); n++) {
+		function = cpuid_cached_leaves[n].function;
+		if (function > (function & 0x80000000 ? max_ext : max_basic))
+			continue;
+
+		entry = vcpu_cpuid_cache_add(cell, function,
+					     cpuid_cached_leaves[n].index,
+					     cpuid_cached_leaves[n].indexed);
+		entry->eax = function;
+		entry->ecx = entry->index;
+		cpuid(&entry->eax, &entry->ebx, &entry->ecx, &entry->edx);
+
+		/* feature masking for the cell goes here */
+		if (function == 0x01)
+			entry->ecx |= X86_FEATURE_HYPERVISOR;
+	}
+
+	entry = vcpu_cpuid_cache_add(cell, JAILHOUSE_CPUID_SIGNATURE, 0, false);
+	entry->eax = JAILHOUSE_CPUID_FEATURES;
+	entry->ebx = *(u32 *)signature;
+	entry->ecx = *(u32 *)(signature + 4);
+	entry->edx = *(u32 *)(signature + 8);
+
+	entry = vcpu_cpuid_cache_add(cell, JAILHOUSE_CPUID_FEATURES, 0, false);
+	entry->eax = entry->ebx = entry->ecx = entry->edx = 0;
+}
+
+static const struct cpuid_cache_entry *
+vcpu_cpuid_lookup(struct cell *cell, u32 function, u32 index)
+{
+	const struct cpuid_cache_entry *entry = cell->arch.cpuid_cache;
+	unsigned int n;
+
+	for (n = 0; n < cell->arch.num_cpuid_entries; n++, entry++)
+		if (entry->function == function &&
+		    (!entry->indexed || entry->index == index))
+			return entry;
+	return NULL;
+}
+
+static int vcpu_cell_init_msrs(struct cell *cell)
+{
+	const struct jailhouse_msr_range *range = cell->cfg.msr_ranges;
+	unsigned int n;
+	u32 msr;
+	int err;
+
+	for (n = 0; n < cell->config->num_msrs; n++, range++) {
+		if (range->num == 0 ||
+		    range->start + range->num - 1 < range->start)
+			return trace_error(-EINVAL);
+
+		for (msr = range->start; msr - range->start < range->num;
+		     msr++) {
+			err = vcpu_vendor_allow_msr(cell, msr, range->flags);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+/* MSRs whose writes are mediated if the cell has performance bounds */
+static const u32 perf_msrs[] = {
+	MSR_IA32_PERF_CTL,
+	MSR_IA32_PM_ENABLE,
+	MSR_IA32_HWP_REQUEST_PKG,
+	MSR_IA32_HWP_REQUEST,
+};
+
+static bool vcpu_perf_msr_supported(u32 msr)
+{
+	switch (msr) {
+	case MSR_IA32_PERF_CTL:
+		return cpuid_ecx(1, 0) & X86_FEATURE_EIST;
+	case MSR_IA32_PM_ENABLE:
+	case MSR_IA32_HWP_REQUEST:
+		return cpuid_eax(6, 0) & X86_FEATURE_HWP;
+	case MSR_IA32_HWP_REQUEST_PKG:
+		return cpuid_eax(6, 0) & X86_FEATURE_HWP_PKG_REQ;
+	default:
+		return false;
+	}
+}
+
+static int vcpu_cell_init_perf(struct cell *cell)
+{
+	bool mediated = false;
+	unsigned int n;
+	int err;
+
+	if (cell->config->perf_max == 0)
+		return 0;
+	if (cell->config->perf_min > cell->config->perf_max)
+		return trace_error(-EINVAL);
+
+	for (n = 0; n < ARRAY_SIZE(perf_msrs); n++) {
+		if (!vcpu_perf_msr_supported(perf_msrs[n]))
+			continue;
+		err = vcpu_vendor_intercept_msr(cell, perf_msrs[n],
+						JAILHOUSE_MSR_WRITE);
+		if (err)
+			return err;
+		mediated = true;
+	}
+
+	/* bounds cannot be enforced without P-state or HWP control */
+	if (!mediated)
+		return trace_error(-EINVAL);
+
+	return 0;
+}
+
+/**
+ * Register a port range emulated by the hypervisor for a cell.
+ * @param cell		Cell the ports are emulated for.
+ * @param base		First port of the range.
+ * @param num		Number of ports.
+ * @param moderate	Trap the ports even if the cell config grants them.
+ *			Ports denied by the config trap anyway.
+ * @param stat		Statistics counter to increment on each access.
+ * @param handler	Access handler.
+ *
+ * Accesses are dispatched via a two-level table indexed by the port, so the
+ * cost does not grow with the number of registered ranges.
+ *
+ * @return 0 on success, negative error code otherwise.
+ */
+int vcpu_pio_register(struct cell *cell, u16 base, u16 num, bool moderate,
+		      unsigned int stat, pio_handler handler)
+{
+	struct arch_cell *arch = &cell->arch;
+	unsigned int port, dir;
+	u8 *block;
+
+	if (num == 0 || base + num > 0x10000)
+		return trace_error(-EINVAL);
+	if (arch->num_pio_regions >= PIO_MAX_REGIONS)
+		return trace_error(-E2BIG);
+
+	if (!arch->pio_blocks) {
+		arch->pio_blocks = page_alloc(&mem_pool, 1, PAGE_OWNER_CELL);
+		if (!arch->pio_blocks)
+			return -ENOMEM;
+	}
+
+	for (port = base; port < base + num; port++) {
+		dir = port / PIO_BLOCK_PORTS;
+		if (arch->pio_dir[dir] == 0) {
+			if (arch->num_pio_blocks >=
+			    PAGE_SIZE / PIO_BLOCK_PORTS)
+				return trace_error(-E2BIG);
+			arch->pio_dir[dir] = ++arch->num_pio_blocks;
+		}
+		block = arch->pio_blocks +
+			(arch->pio_dir[dir] - 1) * PIO_BLOCK_PORTS;
+		if (block[port % PIO_BLOCK_PORTS] != 0)
+			return trace_error(-EEXIST);
+		block[port % PIO_BLOCK_PORTS] = arch->num_pio_regions + 1;
+	}
+
+	arch->pio_regions[arch->num_pio_regions++] = (struct pio_region) {
+		.base = base,
+		.num = num,
+		.moderate = moderate,
+		.stat = stat,
+		.handler = handler,
+	};
+
+	return 0;
+}
+
+static const struct pio_region *vcpu_pio_lookup(struct cell *cell, u16 port)
+{
+	u8 dir = cell->arch.pio_dir[port / PIO_BLOCK_PORTS];
+	u8 index;
+
+	if (dir == 0)
+		return NULL;
+	index = cell->arch.pio_blocks[(dir - 1) * PIO_BLOCK_PORTS +
+				      port % PIO_BLOCK_PORTS];
+	return index ? &cell->arch.pio_regions[index - 1] : NULL;
+}
+
+static void vcpu_moderate_pio(struct cell *cell, struct vcpu_io_bitmap *iobm)
+{
+	const struct pio_region *region;
+	unsigned int n, port;
+
+	for (n = 0; n < cell->arch.num_pio_regions; n++) {
+		region = &cell->arch.pio_regions[n];
+		if (!region->moderate)
+			continue;
+		for (port = region->base; port - region->base < region->num;
+		     port++)
+			iobm->data[port / 8] |= 1 << (port % 8);
+	}
+}
+
+static bool vcpu_pio_granted(struct cell *cell, u16 port)
+{
+	const u8 *pio_bitmap = cell->cfg.pio_bitmap;
+
+	return port / 8 < cell->config->pio_bitmap_size &&
+		!(pio_bitmap[port / 8] & (1 << (port % 8)));
+}
+
+static int vcpu_cell_init_pio(struct cell *cell)
+{
+	int err;
+
+	err = vcpu_pio_register(cell, PCI_REG_ADDR_PORT, 8, false,
+				JAILHOUSE_CPU_STAT_PCI_CONFIG,
+				x86_pci_config_handler);
+	/* catch reset attempts via the keyboard controller if granted */
+	if (!err && vcpu_pio_granted(cell, I8042_CMD_REG))
+		err = vcpu_pio_register(cell, I8042_CMD_REG, 1, true,
+					JAILHOUSE_CPU_STAT_I8042,
+					i8042_access_handler);
+	return err;
+}
+
 int vcpu_cell_init(struct cell *cell)
 {
-	const u8 *pio_bitmap = jailhouse_cell_pio_bitmap(cell->config);
+	const u8 *pio_bitmap = cell->cfg.pio_bitmap;
 	u32 pio_bitmap_size = cell->config->pio_bitmap_size;
 	struct vcpu_io_bitmap cell_iobm, root_cell_iobm;
 	unsigned int n, pm_timer_addr;
@@ -73,6 +338,28 @@ int vcpu_cell_init(struct cell *cell)
 	if (err)
 		return err;
 
+	err = vcpu_cell_init_msrs(cell);
+	if (!err)
+		err = vcpu_cell_init_perf(cell);
+	if (err) {
+		vcpu_vendor_cell_exit(cell);
+		return err;
+	}
+
+	err = vcpu_cell_init_pio(cell);
+	if (err) {
+		page_free(&mem_pool, cell->arch.pio_blocks, 1,
+			  PAGE_OWNER_CELL);
+		vcpu_vendor_cell_exit(cell);
+		return err;
+	}
+
+	vcpu_cpuid_cache_init(cell);
+
+	if (cpuid_ecx(1, 0) & X86_FEATURE_XSAVE)
+		cell->arch.xcr0_allowed = cpuid_eax(0x0d, 0) |
+			((u64)cpuid_edx(0x0d, 0) << 32);
+
 	vcpu_vendor_get_cell_io_bitmap(cell, &cell_iobm);
 
 	/* initialize io bitmap to trap all accesses */
@@ -83,8 +370,7 @@ int vcpu_cell_init(struct cell *cell)
 			cell_iobm.size : pio_bitmap_size;
 	memcpy(cell_iobm.data, pio_bitmap, size);
 
-	/* moderate access to i8042 command register */
-	cell_iobm.data[I8042_CMD_REG / 8] |= 1 << (I8042_CMD_REG % 8);
+	vcpu_moderate_pio(cell, &cell_iobm);
 
 	if (cell != &root_cell) {
 		/*
@@ -92,7 +378,7 @@ int vcpu_cell_init(struct cell *cell)
 		 * access rights.
 		 */
 		vcpu_vendor_get_cell_io_bitmap(&root_cell, &root_cell_iobm);
-		pio_bitmap = jailhouse_cell_pio_bitmap(cell->config);
+		pio_bitmap = cell->cfg.pio_bitmap;
 		for (b = root_cell_iobm.data; pio_bitmap_size > 0;
 		     b++, pio_bitmap++, pio_bitmap_size--)
 			*b |= ~*pio_bitmap;
@@ -110,9 +396,8 @@ int vcpu_cell_init(struct cell *cell)
 
 void vcpu_cell_exit(struct cell *cell)
 {
-	const u8 *root_pio_bitmap =
-		jailhouse_cell_pio_bitmap(root_cell.config);
-	const u8 *pio_bitmap = jailhouse_cell_pio_bitmap(cell->config);
+	const u8 *root_pio_bitmap = root_cell.cfg.pio_bitmap;
+	const u8 *pio_bitmap = cell->cfg.pio_bitmap;
 	u32 pio_bitmap_size = cell->config->pio_bitmap_size;
 	struct vcpu_io_bitmap root_cell_iobm;
 	u8 *b;
@@ -126,9 +411,54 @@ void vcpu_cell_exit(struct cell *cell)
 	     b++, pio_bitmap++, root_pio_bitmap++, pio_bitmap_size--)
 		*b &= *pio_bitmap | *root_pio_bitmap;
 
+	/* ports returned from the cell may include moderated ones */
+	vcpu_moderate_pio(&root_cell, &root_cell_iobm);
+
+	page_free(&mem_pool, cell->arch.pio_blocks, 1, PAGE_OWNER_CELL);
+
 	vcpu_vendor_cell_exit(cell);
 }
 
+/*
+ * Hold a CPU that exceeded an exit rate limit back from its cell. Cell
+ * management and other events end the delay early. The NMI announcing them
+ * makes the CPU exit again right after entering the cell, either via the
+ * preemption timer (VMX) or as soon as GIF is set (SVM).
+ */
+static void vcpu_throttle(struct per_cpu *cpu_data, u64 until)
+{
+	while (get_cycles() < until && !cpu_data->suspend_cpu &&
+	       !cpu_data->pending_events)
+		cpu_relax();
+}
+
+void vcpu_handle_exit(struct per_cpu *cpu_data)
+{
+	u64 deadline, ivshmem_deadline, mmio_deadline, throttle;
+
+	exit_latency_start(cpu_data);
+
+	vcpu_vendor_handle_exit(cpu_data);
+
+	exit_latency_account(cpu_data);
+	cpu_stats_publish(cpu_data);
+
+	throttle = cell_exit_rate_check(cpu_data);
+	if (throttle)
+		vcpu_throttle(cpu_data, throttle);
+
+	deadline = cell_watchdog_check(cpu_data);
+	ivshmem_deadline = pci_ivshmem_flush_deferred(cpu_data);
+	if (ivshmem_deadline && (!deadline || ivshmem_deadline < deadline))
+		deadline = ivshmem_deadline;
+	mmio_deadline = mmio_flush_coalesced_expired(cpu_data);
+	if (mmio_deadline && (!deadline || mmio_deadline < deadline))
+		deadline = mmio_deadline;
+	vcpu_vendor_arm_timer(deadline);
+
+	profile_flush(cpu_data);
+}
+
 void vcpu_handle_hypercall(void)
 {
 	union registers *guest_regs = &this_cpu_data()->guest_regs;
@@ -163,6 +493,7 @@ void vcpu_handle_hypercall(void)
 
 bool vcpu_handle_io_access(void)
 {
+	const struct pio_region *region;
 	struct vcpu_io_intercept io;
 	int result = 0;
 
@@ -172,9 +503,11 @@ bool vcpu_handle_io_access(void)
 	if (io.rep_or_str)
 		goto invalid_access;
 
-	result = x86_pci_config_handler(io.port, io.in, io.size);
-	if (result == 0)
-		result = i8042_access_handler(io.port, io.in, io.size);
+	region = vcpu_pio_lookup(this_cell(), io.port);
+	if (region) {
+		this_cpu_data()->stats[region->stat]++;
+		result = region->handler(io.port, io.in, io.size);
+	}
 
 	if (result == 1) {
 		vcpu_skip_emulated_instruction(io.inst_len);
@@ -202,11 +535,11 @@ bool vcpu_handle_mmio_access(void)
 	vcpu_vendor_get_execution_state(&x_state);
 	vcpu_vendor_get_mmio_intercept(&intercept);
 
-	if (!vcpu_get_guest_paging_structs(&pg_structs))
+	if (unlikely(!vcpu_get_guest_paging_structs(&pg_structs)))
 		goto invalid_access;
 
 	inst = x86_mmio_parse(x_state.rip, &pg_structs, intercept.is_write);
-	if (!inst.inst_len || inst.access_size != 4)
+	if (unlikely(!inst.inst_len || inst.access_size != 4))
 		goto invalid_access;
 
 	mmio.is_write = intercept.is_write;
@@ -215,7 +548,7 @@ bool vcpu_handle_mmio_access(void)
 
 	mmio.address = intercept.phys_addr;
 	result = mmio_handle_access(&mmio);
-	if (result == MMIO_HANDLED) {
+	if (likely(result == MMIO_HANDLED)) {
 		if (!mmio.is_write)
 			guest_regs->by_index[inst.reg_num] = mmio.value;
 		vcpu_skip_emulated_instruction(inst.inst_len);
@@ -256,6 +589,58 @@ bool vcpu_handle_msr_read(void)
 	return true;
 }
 
+static unsigned long vcpu_perf_clamp(unsigned long val, unsigned int shift)
+{
+	const struct jailhouse_cell_desc *config = this_cell()->config;
+	unsigned int level = (val >> shift) & 0xff;
+
+	if (level < config->perf_min)
+		level = config->perf_min;
+	else if (level > config->perf_max)
+		level = config->perf_max;
+
+	return (val & ~(0xffUL << shift)) | ((unsigned long)level << shift);
+}
+
+static bool vcpu_handle_perf_write(void)
+{
+	struct per_cpu *cpu_data = this_cpu_data();
+	u32 msr = cpu_data->guest_regs.rcx;
+	unsigned long val;
+
+	/* only intercepted for bounds if the CPU supports the MSR */
+	if (cpu_data->cell->config->perf_max == 0 ||
+	    !vcpu_perf_msr_supported(msr)) {
+		panic_printk("FATAL: Unhandled MSR write: %x\n", msr);
+		return false;
+	}
+
+	val = get_wrmsr_value(&cpu_data->guest_regs);
+	switch (msr) {
+	case MSR_IA32_PERF_CTL:
+		val = vcpu_perf_clamp(val, PERF_CTL_RATIO_SHIFT);
+		break;
+	case MSR_IA32_HWP_REQUEST:
+		val = vcpu_perf_clamp(val, HWP_REQUEST_MIN_SHIFT);
+		val = vcpu_perf_clamp(val, HWP_REQUEST_MAX_SHIFT);
+		/* a desired performance of 0 selects autonomous mode */
+		if (val & (0xffUL << HWP_REQUEST_DESIRED_SHIFT))
+			val = vcpu_perf_clamp(val, HWP_REQUEST_DESIRED_SHIFT);
+		/* package-level requests would bypass the bounds */
+		val &= ~HWP_REQUEST_PKG_CONTROL;
+		break;
+	default:
+		/*
+		 * Enabling HWP and package-level requests affect CPUs of other
+		 * cells. Leave them to the root cell and ignore the write.
+		 */
+		return true;
+	}
+	write_msr(msr, val);
+
+	return true;
+}
+
 bool vcpu_handle_msr_write(void)
 {
 	struct per_cpu *cpu_data = this_cpu_data();
@@ -287,11 +672,25 @@ bool vcpu_handle_msr_write(void)
 		 * and disabled. When disabled, we turn off all caching by
 		 * setting the guest PAT to 0. When enabled, guest PAT +
 		 * host-controlled MTRRs define the guest's memory types.
+		 * Only toggling the enable bit requires a PAT update.
 		 */
 		val = get_wrmsr_value(&cpu_data->guest_regs);
-		cpu_data->mtrr_def_type = val;
-		vcpu_vendor_set_guest_pat((val & MTRR_ENABLE) ?
-					  cpu_data->pat : 0);
+		if ((val ^ cpu_data->mtrr_def_type) & MTRR_ENABLE) {
+			/* PAT may have been written directly by the guest */
+			cpu_data->pat = vcpu_vendor_get_guest_pat();
+			cpu_data->mtrr_def_type = val;
+			vcpu_vendor_set_guest_pat((val & MTRR_ENABLE) ?
+						  cpu_data->pat : 0);
+		} else {
+			cpu_data->mtrr_def_type = val;
+		}
+		break;
+	case MSR_IA32_PERF_CTL:
+	case MSR_IA32_PM_ENABLE:
+	case MSR_IA32_HWP_REQUEST_PKG:
+	case MSR_IA32_HWP_REQUEST:
+		if (!vcpu_handle_perf_write())
+			return false;
 		break;
 	default:
 		panic_printk("FATAL: Unhandled MSR write: %x\n",
@@ -305,26 +704,24 @@ bool vcpu_handle_msr_write(void)
 
 void vcpu_handle_cpuid(void)
 {
-	static const char signature[12] = "Jailhouse";
-	union registers *guest_regs = &this_cpu_data()->guest_regs;
+	struct per_cpu *cpu_data = this_cpu_data();
+	union registers *guest_regs = &cpu_data->guest_regs;
+	const struct cpuid_cache_entry *entry;
 	u32 function = guest_regs->rax;
 
-	this_cpu_data()->stats[JAILHOUSE_CPU_STAT_VMEXITS_CPUID]++;
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_CPUID]++;
 
-	switch (function) {
-	case JAILHOUSE_CPUID_SIGNATURE:
-		guest_regs->rax = JAILHOUSE_CPUID_FEATURES;
-		guest_regs->rbx = *(u32 *)signature;
-		guest_regs->rcx = *(u32 *)(signature + 4);
-		guest_regs->rdx = *(u32 *)(signature + 8);
-		break;
-	case JAILHOUSE_CPUID_FEATURES:
-		guest_regs->rax = 0;
-		guest_regs->rbx = 0;
-		guest_regs->rcx = 0;
-		guest_regs->rdx = 0;
-		break;
-	default:
+	entry = vcpu_cpuid_lookup(cpu_data->cell, function, guest_regs->rcx);
+	if (entry) {
+		guest_regs->rax = entry->eax;
+		guest_regs->rbx = entry->ebx;
+		guest_regs->rcx = entry->ecx;
+		guest_regs->rdx = entry->edx;
+		/* the initial APIC ID is the only per-CPU part of leaf 1 */
+		if (function == 0x01)
+			guest_regs->rbx = (entry->ebx & BIT_MASK(23, 0)) |
+				(cpu_data->apic_id << CPUID_APIC_ID_SHIFT);
+	} else {
 		/* clear upper 32 bits of the involved registers */
 		guest_regs->rax &= 0xffffffff;
 		guest_regs->rbx &= 0xffffffff;
@@ -333,29 +730,46 @@ void vcpu_handle_cpuid(void)
 
 		cpuid((u32 *)&guest_regs->rax, (u32 *)&guest_regs->rbx,
 		      (u32 *)&guest_regs->rcx, (u32 *)&guest_regs->rdx);
-		if (function == 0x01)
-			guest_regs->rcx |= X86_FEATURE_HYPERVISOR;
-		break;
+		if (function == 0x0a)
+			guest_regs->rax =
+				profile_filter_cpuid_pmu(guest_regs->rax);
 	}
 
 	vcpu_skip_emulated_instruction(X86_INST_LEN_CPUID);
 }
 
+/* component groups that can only be enabled together, see SDM on XSETBV */
+static bool xcr0_valid(u64 val)
+{
+	return (val & X86_XCR0_FP) &&
+		(!(val & X86_XCR0_AVX) || (val & X86_XCR0_SSE)) &&
+		((val & X86_XCR0_MPX) == 0 ||
+		 (val & X86_XCR0_MPX) == X86_XCR0_MPX) &&
+		((val & X86_XCR0_AVX512) == 0 ||
+		 ((val & X86_XCR0_AVX512) == X86_XCR0_AVX512 &&
+		  (val & X86_XCR0_AVX))) &&
+		((val & X86_XCR0_TILE) == 0 ||
+		 (val & X86_XCR0_TILE) == X86_XCR0_TILE);
+}
+
 bool vcpu_handle_xsetbv(void)
 {
-	union registers *guest_regs = &this_cpu_data()->guest_regs;
+	struct per_cpu *cpu_data = this_cpu_data();
+	union registers *guest_regs = &cpu_data->guest_regs;
+	u64 val = (u32)guest_regs->rax | (guest_regs->rdx << 32);
 
-	this_cpu_data()->stats[JAILHOUSE_CPU_STAT_VMEXITS_XSETBV]++;
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_XSETBV]++;
 
-	if (cpuid_ecx(1, 0) & X86_FEATURE_XSAVE &&
-	    guest_regs->rax & X86_XCR0_FP &&
-	    (guest_regs->rax & ~cpuid_eax(0x0d, 0)) == 0 &&
-	     guest_regs->rcx == 0 && guest_regs->rdx == 0) {
+	if (guest_regs->rcx == 0 &&
+	    (val & ~cpu_data->cell->arch.xcr0_allowed) == 0 &&
+	    xcr0_valid(val)) {
 		vcpu_skip_emulated_instruction(X86_INST_LEN_XSETBV);
-		asm volatile(
-			"xsetbv"
-			: /* no output */
-			: "a" (guest_regs->rax), "c" (0), "d" (0));
+		/* context switches tend to rewrite the current value */
+		if (val != cpu_data->xcr0) {
+			cpu_data->stats[JAILHOUSE_CPU_STAT_XCR0_UPDATES]++;
+			write_xcr0(val);
+			cpu_data->xcr0 = val;
+		}
 		return true;
 	}
 	panic_printk("FATAL: Invalid xsetbv parameters: xcr[%d] = %08x:%08x\n",
@@ -370,6 +784,7 @@ void vcpu_reset(unsigned int sipi_vector)
 	vcpu_vendor_reset(sipi_vector);
 
 	memset(&cpu_data->guest_regs, 0, sizeof(cpu_data->guest_regs));
+	x86_mmio_inst_cache_flush();
 
 	if (sipi_vector == APIC_BSP_PSEUDO_SIPI) {
 		cpu_data->pat = PAT_RESET_VALUE;
@@ -19,9 +19,11 @@
 #include <jailhouse/string.h>
 #include <jailhouse/control.h>
 #include <jailhouse/hypercall.h>
+#include <jailhouse/trace.h>
 #include <asm/apic.h>
 #include <asm/control.h>
 #include <asm/iommu.h>
+#include <asm/profile.h>
 #include <asm/vcpu.h>
 #include <asm/vmx.h>
 
@@ -34,9 +36,18 @@ static const struct segment invalid_seg = {
 	.access_rights = 0x10000
 };
 
-/* bit cleared: direct access allowed */
-// TODO: convert to whitelist
-static u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[][0x2000/8] = {
+#define MSR_BITMAP_SIZE		(0x2000/8)
+
+/*
+ * bit cleared: direct access allowed
+ *
+ * Template for cells without an MSR allow list. Bits set here are never
+ * cleared in the bitmap of a cell. IA32_TSC_DEADLINE (0x6e0) is passed
+ * through, apic_clear disarms it when a CPU changes hands. IA32_PAT (0x277)
+ * is only intercepted while the guest has MTRRs disabled, see
+ * vmx_set_msr_bitmap.
+ */
+static u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[][MSR_BITMAP_SIZE] = {
 	[ VMX_MSR_BMP_0000_READ ] = {
 		[      0/8 ...  0x26f/8 ] = 0,
 		[  0x270/8 ...  0x277/8 ] = 0x80, /* 0x277 */
@@ -81,6 +92,11 @@ static u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[][0x2000/8] = {
 static u8 __attribute__((aligned(PAGE_SIZE))) apic_access_page[PAGE_SIZE];
 static struct paging ept_paging[EPT_PAGE_DIR_LEVELS];
 static u32 enable_rdtscp;
+static u32 enable_vpid;
+/* VM entry/exit controls switching IA32_PERF_GLOBAL_CTRL, if available */
+static u32 enable_perf_entry_ctrl, enable_perf_exit_ctrl;
+/* rate of the preemption timer: TSC >> preemption_timer_shift */
+static unsigned int preemption_timer_shift;
 static unsigned long cr_maybe1[2], cr_required1[2];
 
 static bool vmxon(struct per_cpu *cpu_data)
@@ -117,6 +133,8 @@ static bool vmcs_load(struct per_cpu *cpu_data)
 	unsigned long vmcs_addr = paging_hvirt2phys(&cpu_data->vmcs);
 	u8 ok;
 
+	cpu_data->vmcs_cache.valid = 0;
+
 	asm volatile(
 		"vmptrld (%1)\n\t"
 		"seta %0"
@@ -126,11 +144,58 @@ static bool vmcs_load(struct per_cpu *cpu_data)
 	return ok;
 }
 
+static inline int vmcs_cache_index(unsigned long field)
+{
+	switch (field) {
+	case GUEST_RIP:
+		return VMCS_CACHE_GUEST_RIP;
+	case GUEST_RSP:
+		return VMCS_CACHE_GUEST_RSP;
+	case GUEST_RFLAGS:
+		return VMCS_CACHE_GUEST_RFLAGS;
+	case GUEST_CR0:
+		return VMCS_CACHE_GUEST_CR0;
+	case GUEST_CR3:
+		return VMCS_CACHE_GUEST_CR3;
+	case GUEST_CR4:
+		return VMCS_CACHE_GUEST_CR4;
+	case GUEST_IA32_EFER:
+		return VMCS_CACHE_GUEST_IA32_EFER;
+	case GUEST_CS_SELECTOR:
+		return VMCS_CACHE_GUEST_CS_SELECTOR;
+	case VM_ENTRY_CONTROLS:
+		return VMCS_CACHE_VM_ENTRY_CONTROLS;
+	case EXIT_QUALIFICATION:
+		return VMCS_CACHE_EXIT_QUALIFICATION;
+	case VM_EXIT_INSTRUCTION_LEN:
+		return VMCS_CACHE_VM_EXIT_INSTRUCTION_LEN;
+	case GUEST_PHYSICAL_ADDRESS:
+		return VMCS_CACHE_GUEST_PHYSICAL_ADDRESS;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Frequently used fields are only read once per VM exit. The field is
+ * constant at all call sites, so the lookup above is resolved at compile
+ * time.
+ */
 static inline unsigned long vmcs_read64(unsigned long field)
 {
+	struct vmcs_cache *cache = &this_cpu_data()->vmcs_cache;
+	int index = vmcs_cache_index(field);
 	unsigned long value;
 
+	if (index >= 0 && cache->valid & (1 << index))
+		return cache->values[index];
+
 	asm volatile("vmread %1,%0" : "=r" (value) : "r" (field) : "cc");
+
+	if (index >= 0) {
+		cache->values[index] = value;
+		cache->valid |= 1 << index;
+	}
 	return value;
 }
 
@@ -146,6 +211,8 @@ static inline u32 vmcs_read32(unsigned long field)
 
 static bool vmcs_write64(unsigned long field, unsigned long val)
 {
+	struct vmcs_cache *cache = &this_cpu_data()->vmcs_cache;
+	int index = vmcs_cache_index(field);
 	u8 ok;
 
 	asm volatile(
@@ -154,10 +221,14 @@ static bool vmcs_write64(unsigned long field, unsigned long val)
 		: "=qm" (ok)
 		: "r" (val), "r" (field)
 		: "cc");
-	if (!ok)
+	if (ok && index >= 0) {
+		cache->values[index] = val;
+		cache->valid |= 1 << index;
+	} else if (!ok) {
 		printk("FATAL: vmwrite %08lx failed, error %d, caller %p\n",
 		       field, vmcs_read32(VM_INSTRUCTION_ERROR),
 		       __builtin_return_address(0));
+	}
 	return ok;
 }
 
@@ -217,10 +288,11 @@ static int vmx_check_features(void)
 	    !(vmx_proc_ctrl & CPU_BASED_ACTIVATE_SECONDARY_CONTROLS))
 		return trace_error(-EIO);
 
-	/* require disabling of CR3 access interception */
+	/* require disabling of CR3 access and idle instruction interception */
 	vmx_proc_ctrl = read_msr(MSR_IA32_VMX_TRUE_PROCBASED_CTLS);
 	if (vmx_proc_ctrl &
-	    (CPU_BASED_CR3_LOAD_EXITING | CPU_BASED_CR3_STORE_EXITING))
+	    (CPU_BASED_CR3_LOAD_EXITING | CPU_BASED_CR3_STORE_EXITING |
+	     CPU_BASED_IDLE_EXITING))
 		return trace_error(-EIO);
 
 	/* require APIC access, EPT and unrestricted guest mode support */
@@ -233,6 +305,12 @@ static int vmx_check_features(void)
 	    !(vmx_proc_ctrl2 & SECONDARY_EXEC_UNRESTRICTED_GUEST))
 		return trace_error(-EIO);
 
+	/* use VPIDs if they can be invalidated per context or globally */
+	if (vmx_proc_ctrl2 & SECONDARY_EXEC_ENABLE_VPID &&
+	    ept_cap & VPID_INVVPID &&
+	    ept_cap & (VPID_INVVPID_SINGLE | VPID_INVVPID_ALL))
+		enable_vpid = SECONDARY_EXEC_ENABLE_VPID;
+
 	/* require RDTSCP if present in CPUID */
 	if (cpuid_edx(0x80000001, 0) & X86_FEATURE_RDTSCP) {
 		enable_rdtscp = SECONDARY_EXEC_RDTSCP;
@@ -251,9 +329,24 @@ static int vmx_check_features(void)
 	    !(vmx_exit_ctrl & VM_EXIT_LOAD_IA32_EFER))
 		return trace_error(-EIO);
 
+	/*
+	 * Pass the PMU through if an architectural one exists and its global
+	 * control can be switched on VM entry and exit. CPUs are not shared
+	 * between cells, so the counters need no context switching, only the
+	 * hypervisor must not be accounted to the cell.
+	 */
+	if ((cpuid_eax(0x0a, 0) & 0xff) > 0 &&
+	    vmx_entry_ctrl & VM_ENTRY_LOAD_IA32_PERF_GLOBAL_CTRL &&
+	    vmx_exit_ctrl & VM_EXIT_LOAD_IA32_PERF_GLOBAL_CTRL) {
+		enable_perf_entry_ctrl = VM_ENTRY_LOAD_IA32_PERF_GLOBAL_CTRL;
+		enable_perf_exit_ctrl = VM_EXIT_LOAD_IA32_PERF_GLOBAL_CTRL;
+	}
+
 	/* require activity state HLT */
 	if (!(read_msr(MSR_IA32_VMX_MISC) & VMX_MISC_ACTIVITY_HLT))
 		return trace_error(-EIO);
+	preemption_timer_shift =
+		read_msr(MSR_IA32_VMX_MISC) & VMX_MISC_PREEMPTION_TIMER_RATE;
 
 	/*
 	 * Retrieve/validate restrictions on CR0
@@ -306,11 +399,15 @@ int vcpu_vendor_init(void)
 		ept_paging[2].page_size = 0;
 
 	if (using_x2apic) {
-		/* allow direct x2APIC access except for ICR writes */
+		/*
+		 * allow direct x2APIC access except for ICR writes and
+		 * version reads (see x2apic_handle_read)
+		 */
 		memset(&msr_bitmap[VMX_MSR_BMP_0000_READ][MSR_X2APIC_BASE/8],
 		       0, (MSR_X2APIC_END - MSR_X2APIC_BASE + 1)/8);
 		memset(&msr_bitmap[VMX_MSR_BMP_0000_WRITE][MSR_X2APIC_BASE/8],
 		       0, (MSR_X2APIC_END - MSR_X2APIC_BASE + 1)/8);
+		msr_bitmap[VMX_MSR_BMP_0000_READ][MSR_X2APIC_LVR/8] = 0x08;
 		msr_bitmap[VMX_MSR_BMP_0000_WRITE][MSR_X2APIC_ICR/8] = 0x01;
 	}
 
@@ -324,15 +421,43 @@ unsigned long arch_paging_gphys2phys(struct per_cpu *cpu_data,
 				flags);
 }
 
+const struct paging_structures *arch_cell_paging_structs(struct cell *cell)
+{
+	return &cell->arch.vmx.ept_structs;
+}
+
 int vcpu_vendor_cell_init(struct cell *cell)
 {
 	int err;
 
 	/* allocate io_bitmap */
-	cell->arch.vmx.io_bitmap = page_alloc(&mem_pool, PIO_BITMAP_PAGES);
+	cell->arch.vmx.io_bitmap = page_alloc(&mem_pool, PIO_BITMAP_PAGES,
+					      PAGE_OWNER_CELL);
 	if (!cell->arch.vmx.io_bitmap)
 		return -ENOMEM;
 
+	/*
+	 * Start from the template or intercept all MSRs if allow-listed. The
+	 * second page is used while guest MTRRs are disabled and differs only
+	 * in intercepting PAT.
+	 */
+	cell->arch.vmx.msr_bitmap = page_alloc(&mem_pool, 2, PAGE_OWNER_CELL);
+	if (!cell->arch.vmx.msr_bitmap) {
+		err = -ENOMEM;
+		goto err_free_io_bitmap;
+	}
+	if (cell->config->num_msrs > 0)
+		memset(cell->arch.vmx.msr_bitmap, -1, PAGE_SIZE);
+	else
+		memcpy(cell->arch.vmx.msr_bitmap, msr_bitmap,
+		       sizeof(msr_bitmap));
+	memcpy(cell->arch.vmx.msr_bitmap + PAGE_SIZE,
+	       cell->arch.vmx.msr_bitmap, PAGE_SIZE);
+	cell->arch.vmx.msr_bitmap[VMX_MSR_BMP_0000_READ * MSR_BITMAP_SIZE +
+				  MSR_IA32_PAT / 8] &= ~(1 << (MSR_IA32_PAT % 8));
+	cell->arch.vmx.msr_bitmap[VMX_MSR_BMP_0000_WRITE * MSR_BITMAP_SIZE +
+				  MSR_IA32_PAT / 8] &= ~(1 << (MSR_IA32_PAT % 8));
+
 	/* build root EPT of cell */
 	cell->arch.vmx.ept_structs.root_paging = ept_paging;
 	cell->arch.vmx.ept_structs.root_table =
@@ -344,21 +469,98 @@ int vcpu_vendor_cell_init(struct cell *cell)
 			    EPT_FLAG_READ | EPT_FLAG_WRITE | EPT_FLAG_WB_TYPE,
 			    PAGING_NON_COHERENT);
 	if (err)
-		goto err_free_io_bitmap;
+		goto err_free_msr_bitmap;
 
 	return 0;
 
+err_free_msr_bitmap:
+	page_free(&mem_pool, cell->arch.vmx.msr_bitmap, 2, PAGE_OWNER_CELL);
 err_free_io_bitmap:
-	page_free(&mem_pool, cell->arch.vmx.io_bitmap, 2);
+	page_free(&mem_pool, cell->arch.vmx.io_bitmap, 2, PAGE_OWNER_CELL);
 
 	return err;
 }
 
+int vcpu_vendor_allow_msr(struct cell *cell, u32 msr, u32 flags)
+{
+	unsigned int region, byte = (msr & 0x1fff) / 8;
+	u8 *bitmap = cell->arch.vmx.msr_bitmap;
+	u8 bit = 1 << (msr % 8);
+
+	if (msr <= 0x1fff)
+		region = VMX_MSR_BMP_0000_READ;
+	else if (msr - 0xc0000000 <= 0x1fff)
+		region = VMX_MSR_BMP_C000_READ;
+	else
+		return trace_error(-EINVAL);
+
+	/* PAT is template-trapped, so both pages can be updated alike */
+	if (flags & JAILHOUSE_MSR_READ && !(msr_bitmap[region][byte] & bit)) {
+		bitmap[region * MSR_BITMAP_SIZE + byte] &= ~bit;
+		bitmap[PAGE_SIZE + region * MSR_BITMAP_SIZE + byte] &= ~bit;
+	}
+
+	region += VMX_MSR_BMP_0000_WRITE - VMX_MSR_BMP_0000_READ;
+	if (flags & JAILHOUSE_MSR_WRITE && !(msr_bitmap[region][byte] & bit)) {
+		bitmap[region * MSR_BITMAP_SIZE + byte] &= ~bit;
+		bitmap[PAGE_SIZE + region * MSR_BITMAP_SIZE + byte] &= ~bit;
+	}
+
+	return 0;
+}
+
+int vcpu_vendor_intercept_msr(struct cell *cell, u32 msr, u32 flags)
+{
+	unsigned int region, byte = (msr & 0x1fff) / 8;
+	u8 *bitmap = cell->arch.vmx.msr_bitmap;
+	u8 bit = 1 << (msr % 8);
+
+	if (msr <= 0x1fff)
+		region = VMX_MSR_BMP_0000_READ;
+	else if (msr - 0xc0000000 <= 0x1fff)
+		region = VMX_MSR_BMP_C000_READ;
+	else
+		return trace_error(-EINVAL);
+
+	if (flags & JAILHOUSE_MSR_READ) {
+		bitmap[region * MSR_BITMAP_SIZE + byte] |= bit;
+		bitmap[PAGE_SIZE + region * MSR_BITMAP_SIZE + byte] |= bit;
+	}
+
+	region += VMX_MSR_BMP_0000_WRITE - VMX_MSR_BMP_0000_READ;
+	if (flags & JAILHOUSE_MSR_WRITE) {
+		bitmap[region * MSR_BITMAP_SIZE + byte] |= bit;
+		bitmap[PAGE_SIZE + region * MSR_BITMAP_SIZE + byte] |= bit;
+	}
+
+	return 0;
+}
+
 int vcpu_map_memory_region(struct cell *cell,
 			   const struct jailhouse_memory *mem)
 {
 	u64 phys_start = mem->phys_start;
-	u32 flags = EPT_FLAG_WB_TYPE;
+	u32 flags;
+	int err;
+
+	/* the requested page size has to be available, see vmx_init */
+	if ((mem->flags & JAILHOUSE_MEM_HUGE_1G && !ept_paging[1].page_size) ||
+	    (mem->flags & JAILHOUSE_MEM_HUGE_2M && !ept_paging[2].page_size))
+		return trace_error(-EINVAL);
+
+	/* combined with the guest PAT, UC and WC take precedence over it */
+	switch (mem->flags & JAILHOUSE_MEM_TYPE_MASK) {
+	case JAILHOUSE_MEM_TYPE_UC:
+		flags = EPT_FLAG_UC_TYPE;
+		break;
+	case JAILHOUSE_MEM_TYPE_WC:
+		flags = EPT_FLAG_WC_TYPE;
+		break;
+	default:
+		flags = EPT_FLAG_WB_TYPE;
+	}
+	if (mem->flags & JAILHOUSE_MEM_TYPE_FORCE)
+		flags |= EPT_FLAG_IGNORE_PAT;
 
 	if (mem->flags & JAILHOUSE_MEM_READ)
 		flags |= EPT_FLAG_READ;
@@ -369,8 +571,14 @@ int vcpu_map_memory_region(struct cell *cell,
 	if (mem->flags & JAILHOUSE_MEM_COMM_REGION)
 		phys_start = paging_hvirt2phys(&cell->comm_page);
 
-	return paging_create(&cell->arch.vmx.ept_structs, phys_start, mem->size,
-			     mem->virt_start, flags, PAGING_NON_COHERENT);
+	err = paging_create(&cell->arch.vmx.ept_structs, phys_start, mem->size,
+			    mem->virt_start, flags, PAGING_NON_COHERENT);
+	if (err)
+		return err;
+
+	paging_merge(&cell->arch.vmx.ept_structs, mem->virt_start, mem->size,
+		     PAGING_NON_COHERENT);
+	return 0;
 }
 
 int vcpu_unmap_memory_region(struct cell *cell,
@@ -382,9 +590,9 @@ int vcpu_unmap_memory_region(struct cell *cell,
 
 void vcpu_vendor_cell_exit(struct cell *cell)
 {
-	paging_destroy(&cell->arch.vmx.ept_structs, XAPIC_BASE, PAGE_SIZE,
-		       PAGING_NON_COHERENT);
-	page_free(&mem_pool, cell->arch.vmx.io_bitmap, 2);
+	paging_destroy_tables(&cell->arch.vmx.ept_structs, 1);
+	page_free(&mem_pool, cell->arch.vmx.msr_bitmap, 2, PAGE_OWNER_CELL);
+	page_free(&mem_pool, cell->arch.vmx.io_bitmap, 2, PAGE_OWNER_CELL);
 }
 
 void vcpu_tlb_flush(void)
@@ -435,6 +643,55 @@ static bool vmx_set_guest_cr(unsigned int cr_idx, unsigned long val)
 	return ok;
 }
 
+/*
+ * Each cell runs under its own VPID, so that TLB entries of the cell's guest
+ * survive VM exits. As VPIDs are reused after a cell was destroyed or after
+ * re-enabling the hypervisor, the entries are invalidated whenever a CPU
+ * takes up a cell's configuration.
+ */
+static bool vmx_set_vpid(u16 vpid)
+{
+	unsigned long vpid_cap = read_msr(MSR_IA32_VMX_EPT_VPID_CAP);
+	struct {
+		u64 vpid;
+		u64 linear_addr;
+	} descriptor;
+	u64 type;
+	u8 ok;
+
+	if (!vmcs_write16(VIRTUAL_PROCESSOR_ID, vpid))
+		return false;
+
+	descriptor.vpid = vpid;
+	descriptor.linear_addr = 0;
+	if (vpid_cap & VPID_INVVPID_SINGLE)
+		type = VMX_INVVPID_SINGLE;
+	else
+		type = VMX_INVVPID_ALL;
+	asm volatile(
+		"invvpid (%1),%2\n\t"
+		"seta %0\n\t"
+		: "=qm" (ok)
+		: "r" (&descriptor), "r" (type)
+		: "memory", "cc");
+
+	return ok;
+}
+
+/*
+ * With guest MTRRs enabled, PAT is passed through and saved and restored via
+ * the VM-exit and VM-entry controls. Disabled MTRRs are emulated by running
+ * the guest with a PAT of 0, so its own value is shadowed meanwhile.
+ */
+static bool vmx_set_msr_bitmap(void)
+{
+	u8 *bitmap = this_cell()->arch.vmx.msr_bitmap;
+
+	if (!(this_cpu_data()->mtrr_def_type & MTRR_ENABLE))
+		bitmap += PAGE_SIZE;
+	return vmcs_write64(MSR_BITMAP, paging_hvirt2phys(bitmap));
+}
+
 static bool vmx_set_cell_config(void)
 {
 	struct cell *cell = this_cell();
@@ -445,11 +702,15 @@ static bool vmx_set_cell_config(void)
 	ok &= vmcs_write64(IO_BITMAP_A, paging_hvirt2phys(io_bitmap));
 	ok &= vmcs_write64(IO_BITMAP_B,
 			   paging_hvirt2phys(io_bitmap + PAGE_SIZE));
+	ok &= vmx_set_msr_bitmap();
 
 	ok &= vmcs_write64(EPT_POINTER,
 		paging_hvirt2phys(cell->arch.vmx.ept_structs.root_table) |
 		EPT_TYPE_WRITEBACK | EPT_PAGE_WALK_LEN);
 
+	if (enable_vpid)
+		ok &= vmx_set_vpid(cell->id + 1);
+
 	return ok;
 }
 
@@ -545,6 +806,13 @@ static bool vmcs_setup(struct per_cpu *cpu_data)
 	ok &= vmcs_write64(GUEST_IA32_PAT, cpu_data->pat);
 	ok &= vmcs_write64(GUEST_IA32_EFER, cpu_data->linux_efer);
 
+	/*
+	 * vcpu_init stopped all counters. In root mode, only the profiling
+	 * counter runs, if any.
+	 */
+	ok &= vmcs_write64(GUEST_IA32_PERF_GLOBAL_CTRL, 0);
+	ok &= vmcs_write64(HOST_IA32_PERF_GLOBAL_CTRL, cpu_data->profile_ctrl);
+
 	ok &= vmcs_write64(VMCS_LINK_POINTER, -1UL);
 	ok &= vmcs_write32(VM_ENTRY_INTR_INFO_FIELD, 0);
 
@@ -554,18 +822,28 @@ static bool vmcs_setup(struct per_cpu *cpu_data)
 
 	ok &= vmcs_write32(VMX_PREEMPTION_TIMER_VALUE, 0);
 
+	/*
+	 * Cells own their CPUs, so HLT, MONITOR/MWAIT and PAUSE run natively
+	 * and guests can enter C-states directly. Management events are sent
+	 * as NMIs, which terminate HLT and MWAIT and exit via NMI exiting.
+	 */
 	val = read_msr(MSR_IA32_VMX_PROCBASED_CTLS);
 	val |= CPU_BASED_USE_IO_BITMAPS | CPU_BASED_USE_MSR_BITMAPS |
 		CPU_BASED_ACTIVATE_SECONDARY_CONTROLS;
-	val &= ~(CPU_BASED_CR3_LOAD_EXITING | CPU_BASED_CR3_STORE_EXITING);
+	val &= ~(CPU_BASED_CR3_LOAD_EXITING | CPU_BASED_CR3_STORE_EXITING |
+		 CPU_BASED_IDLE_EXITING);
 	ok &= vmcs_write32(CPU_BASED_VM_EXEC_CONTROL, val);
 
-	ok &= vmcs_write64(MSR_BITMAP, paging_hvirt2phys(msr_bitmap));
-
 	val = read_msr(MSR_IA32_VMX_PROCBASED_CTLS2);
 	val |= SECONDARY_EXEC_VIRTUALIZE_APIC_ACCESSES |
 		SECONDARY_EXEC_ENABLE_EPT | SECONDARY_EXEC_UNRESTRICTED_GUEST |
-		enable_rdtscp;
+		enable_rdtscp | enable_vpid;
+	/*
+	 * No PAUSE-loop exiting: a spinning vCPU has no one to yield to, and
+	 * cell_suspend signals all CPUs of a cell at once, so lock holders and
+	 * waiters stop together.
+	 */
+	val &= ~SECONDARY_EXEC_PAUSE_LOOP_EXITING;
 	ok &= vmcs_write32(SECONDARY_VM_EXEC_CONTROL, val);
 
 	ok &= vmcs_write64(APIC_ACCESS_ADDR,
@@ -580,7 +858,8 @@ static bool vmcs_setup(struct per_cpu *cpu_data)
 	val = read_msr(MSR_IA32_VMX_EXIT_CTLS);
 	val |= VM_EXIT_HOST_ADDR_SPACE_SIZE |
 		VM_EXIT_SAVE_IA32_PAT | VM_EXIT_LOAD_IA32_PAT |
-		VM_EXIT_SAVE_IA32_EFER | VM_EXIT_LOAD_IA32_EFER;
+		VM_EXIT_SAVE_IA32_EFER | VM_EXIT_LOAD_IA32_EFER |
+		enable_perf_exit_ctrl;
 	ok &= vmcs_write32(VM_EXIT_CONTROLS, val);
 
 	ok &= vmcs_write32(VM_EXIT_MSR_STORE_COUNT, 0);
@@ -589,7 +868,7 @@ static bool vmcs_setup(struct per_cpu *cpu_data)
 
 	val = read_msr(MSR_IA32_VMX_ENTRY_CTLS);
 	val |= VM_ENTRY_IA32E_MODE | VM_ENTRY_LOAD_IA32_PAT |
-		VM_ENTRY_LOAD_IA32_EFER;
+		VM_ENTRY_LOAD_IA32_EFER | enable_perf_entry_ctrl;
 	ok &= vmcs_write32(VM_ENTRY_CONTROLS, val);
 
 	ok &= vmcs_write64(CR4_GUEST_HOST_MASK, 0);
@@ -616,6 +895,10 @@ int vcpu_init(struct per_cpu *cpu_data)
 	if (err)
 		return err;
 
+	/* the profiling counter is gated by the VM exit controls */
+	if (enable_perf_exit_ctrl)
+		profile_cpu_init(cpu_data);
+
 	revision_id = (u32)read_msr(MSR_IA32_VMX_BASIC);
 	cpu_data->vmxon_region.revision_id = revision_id;
 	cpu_data->vmxon_region.shadow_indicator = 0;
@@ -719,6 +1002,7 @@ void __attribute__((noreturn)) vcpu_deactivate_vmm(void)
 	cpu_data->linux_cr0 = vmcs_read64(GUEST_CR0);
 	cpu_data->linux_cr3 = vmcs_read64(GUEST_CR3);
 	cpu_data->linux_cr4 = vmcs_read64(GUEST_CR4);
+	cpu_data->pat = vcpu_vendor_get_guest_pat();
 
 	cpu_data->linux_gdtr.base = vmcs_read64(GUEST_GDTR_BASE);
 	cpu_data->linux_gdtr.limit = vmcs_read64(GUEST_GDTR_LIMIT);
@@ -736,6 +1020,9 @@ void __attribute__((noreturn)) vcpu_deactivate_vmm(void)
 	write_msr(MSR_IA32_SYSENTER_CS, vmcs_read32(GUEST_SYSENTER_CS));
 	write_msr(MSR_IA32_SYSENTER_EIP, vmcs_read64(GUEST_SYSENTER_EIP));
 	write_msr(MSR_IA32_SYSENTER_ESP, vmcs_read64(GUEST_SYSENTER_ESP));
+	if (enable_perf_entry_ctrl)
+		write_msr(MSR_IA32_PERF_GLOBAL_CTRL,
+			  vmcs_read64(GUEST_IA32_PERF_GLOBAL_CTRL));
 
 	cpu_data->linux_ds.selector = vmcs_read16(GUEST_DS_SELECTOR);
 	cpu_data->linux_es.selector = vmcs_read16(GUEST_ES_SELECTOR);
@@ -840,6 +1127,7 @@ void vcpu_vendor_reset(unsigned int sipi_vector)
 	ok &= vmcs_write32(GUEST_IDTR_LIMIT, 0xffff);
 
 	ok &= vmcs_write64(GUEST_IA32_EFER, 0);
+	ok &= vmcs_write64(GUEST_IA32_PERF_GLOBAL_CTRL, 0);
 
 	ok &= vmcs_write32(GUEST_SYSENTER_CS, 0);
 	ok &= vmcs_write64(GUEST_SYSENTER_EIP, 0);
@@ -877,8 +1165,42 @@ static void vmx_preemption_timer_set_enable(bool enable)
 
 void vcpu_nmi_handler(void)
 {
-	if (this_cpu_data()->vmx_state == VMCS_READY)
+	if (this_cpu_data()->vmx_state == VMCS_READY) {
+		/* the timer may be armed for a deadline, exit immediately */
+		vmcs_write32(VMX_PREEMPTION_TIMER_VALUE, 0);
 		vmx_preemption_timer_set_enable(true);
+	}
+}
+
+void vcpu_vendor_arm_timer(u64 deadline)
+{
+	struct per_cpu *cpu_data = this_cpu_data();
+	u64 now, ticks = 0;
+
+	if (deadline == 0)
+		return;
+
+	now = get_cycles();
+	if (deadline > now)
+		ticks = MIN((deadline - now) >> preemption_timer_shift,
+			    0xffffffffULL);
+	vmcs_write32(VMX_PREEMPTION_TIMER_VALUE, ticks);
+	vmx_preemption_timer_set_enable(true);
+
+	/*
+	 * Events are posted before the NMI is sent. If the NMI arrived before
+	 * the timer value was written, the event must not wait for the
+	 * deadline.
+	 */
+	memory_barrier();
+	if (cpu_data->pending_events)
+		vmcs_write32(VMX_PREEMPTION_TIMER_VALUE, 0);
+}
+
+bool vcpu_vendor_has_timer(void)
+{
+	/* the preemption timer is required by vmx_check_features */
+	return true;
 }
 
 void vcpu_park(void)
@@ -898,6 +1220,29 @@ static void vmx_check_events(void)
 	x86_check_events();
 }
 
+/*
+ * A counter overflow of the passed-through PMU raises an NMI if the cell
+ * programmed its LVTPC that way. As all NMIs are intercepted, reflect it into
+ * the cell. A PMI that coincides with a hypervisor NMI is handled by the same
+ * injection, a spurious one is filtered by the guest's status check.
+ */
+static void vmx_reflect_pmi(void)
+{
+	if (!enable_perf_entry_ctrl ||
+	    read_msr(MSR_IA32_PERF_GLOBAL_STATUS) == 0 ||
+	    !apic_pmi_uses_nmi())
+		return;
+
+	/* the NMI is lost if the guest cannot take it right now */
+	if (vmcs_read32(GUEST_INTERRUPTIBILITY_INFO) &
+	    (GUEST_INTR_STATE_STI | GUEST_INTR_STATE_MOV_SS |
+	     GUEST_INTR_STATE_NMI))
+		return;
+
+	vmcs_write32(VM_ENTRY_INTR_INFO_FIELD,
+		     INTR_INFO_VALID_MASK | INTR_TYPE_NMI_INTR | NMI_VECTOR);
+}
+
 static void vmx_handle_exception_nmi(void)
 {
 	u32 intr_info = vmcs_read32(VM_EXIT_INTR_INFO);
@@ -905,6 +1250,7 @@ static void vmx_handle_exception_nmi(void)
 	if ((intr_info & INTR_INFO_INTR_TYPE_MASK) == INTR_TYPE_NMI_INTR) {
 		this_cpu_data()->stats[JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT]++;
 		asm volatile("int %0" : : "i" (NMI_VECTOR));
+		vmx_reflect_pmi();
 	} else {
 		this_cpu_data()->stats[JAILHOUSE_CPU_STAT_VMEXITS_EXCEPTION]++;
 		/*
@@ -989,9 +1335,19 @@ bool vcpu_get_guest_paging_structs(struct guest_paging_structures *pg_structs)
 	return true;
 }
 
+unsigned long vcpu_vendor_get_guest_pat(void)
+{
+	struct per_cpu *cpu_data = this_cpu_data();
+
+	if (!(cpu_data->mtrr_def_type & MTRR_ENABLE))
+		return cpu_data->pat;
+	return vmcs_read64(GUEST_IA32_PAT);
+}
+
 void vcpu_vendor_set_guest_pat(unsigned long val)
 {
 	vmcs_write64(GUEST_IA32_PAT, val);
+	vmx_set_msr_bitmap();
 }
 
 static bool vmx_handle_apic_access(void)
@@ -1028,7 +1384,7 @@ static bool vmx_handle_apic_access(void)
 	return false;
 }
 
-static void dump_vm_exit_details(u32 reason)
+static __cold void dump_vm_exit_details(u32 reason)
 {
 	panic_printk("qualification %x\n", vmcs_read64(EXIT_QUALIFICATION));
 	panic_printk("vectoring info: %x interrupt info: %x\n",
@@ -1041,7 +1397,7 @@ static void dump_vm_exit_details(u32 reason)
 			     vmcs_read64(GUEST_LINEAR_ADDRESS));
 }
 
-static void dump_guest_regs(union registers *guest_regs)
+static __cold void dump_guest_regs(union registers *guest_regs)
 {
 	panic_printk("RIP: %p RSP: %p FLAGS: %x\n", vmcs_read64(GUEST_RIP),
 		     vmcs_read64(GUEST_RSP), vmcs_read64(GUEST_RFLAGS));
@@ -1081,11 +1437,16 @@ void vcpu_vendor_get_mmio_intercept(struct vcpu_mmio_intercept *mmio)
 	mmio->is_write = !!(exitq & 0x2);
 }
 
-void vcpu_handle_exit(struct per_cpu *cpu_data)
+void vcpu_vendor_handle_exit(struct per_cpu *cpu_data)
 {
-	u32 reason = vmcs_read32(VM_EXIT_REASON);
+	u32 reason;
+
+	/* guest state changed while the guest was running */
+	cpu_data->vmcs_cache.valid = 0;
 
+	reason = vmcs_read32(VM_EXIT_REASON);
 	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL]++;
+	trace_event(JAILHOUSE_TRACE_VMEXIT, reason, 0);
 
 	switch (reason) {
 	case EXIT_REASON_EXCEPTION_NMI:
@@ -1114,7 +1475,15 @@ void vcpu_handle_exit(struct per_cpu *cpu_data)
 	case EXIT_REASON_MSR_WRITE:
 		cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_MSR]++;
 		if (cpu_data->guest_regs.rcx == MSR_IA32_PERF_GLOBAL_CTRL) {
-			/* ignore writes */
+			/*
+			 * The value becomes effective on VM entry. Without the
+			 * entry/exit controls, ignore writes. The profiling
+			 * counter stays off in guest mode.
+			 */
+			if (enable_perf_entry_ctrl)
+				vmcs_write64(GUEST_IA32_PERF_GLOBAL_CTRL,
+					get_wrmsr_value(&cpu_data->guest_regs) &
+					~cpu_data->profile_ctrl);
 			vcpu_skip_emulated_instruction(X86_INST_LEN_WRMSR);
 			return;
 		} else if (vcpu_handle_msr_write())
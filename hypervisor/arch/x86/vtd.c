@@ -18,16 +18,19 @@
 #include <jailhouse/pci.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <asm/apic.h>
 #include <asm/iommu.h>
 #include <asm/bitops.h>
 #include <asm/ioapic.h>
 #include <asm/spinlock.h>
+#include <asm/vmx.h>
 
 #define VTD_ROOT_PRESENT		0x00000001
 
 #define VTD_CTX_PRESENT			0x00000001
 #define VTD_CTX_TTYPE_MLP_UNTRANS	0x00000000
+#define VTD_CTX_TTYPE_PASSTHROUGH	0x00000008
 
 #define VTD_CTX_AGAW_39			0x00000001
 #define VTD_CTX_AGAW_48			0x00000002
@@ -53,12 +56,17 @@ struct vtd_entry {
 # define VTD_CAP_SAGAW48		(1UL << 10)
 # define VTD_CAP_SLLPS2M		(1UL << 34)
 # define VTD_CAP_SLLPS1G		(1UL << 35)
+# define VTD_CAP_PSI			(1UL << 39)
 # define VTD_CAP_FRO_MASK		BIT_MASK(33, 24)
 # define VTD_CAP_NFR_MASK		BIT_MASK(47, 40)
+# define VTD_CAP_MAMV_MASK		BIT_MASK(53, 48)
+# define VTD_CAP_MAMV_SHIFT		48
 #define VTD_ECAP_REG			0x10
+# define VTD_ECAP_C			(1UL << 0)
 # define VTD_ECAP_QI			(1UL << 1)
 # define VTD_ECAP_IR			(1UL << 3)
 # define VTD_ECAP_EIM			(1UL << 4)
+# define VTD_ECAP_PT			(1UL << 6)
 #define VTD_GCMD_REG			0x18
 # define VTD_GCMD_SIRTP			(1UL << 24)
 # define VTD_GCMD_IRE			(1UL << 25)
@@ -103,9 +111,12 @@ struct vtd_entry {
 #define VTD_REQ_INV_IOTLB		0x02
 # define VTD_INV_IOTLB_GLOBAL		(1UL << 4)
 # define VTD_INV_IOTLB_DOMAIN		(2UL << 4)
+# define VTD_INV_IOTLB_PAGE		(3UL << 4)
 # define VTD_INV_IOTLB_DW		(1UL << 6)
 # define VTD_INV_IOTLB_DR		(1UL << 7)
 # define VTD_INV_IOTLB_DOMAIN_SHIFT	16
+# define VTD_INV_IOTLB_AM_MASK		BIT_MASK(5, 0)
+# define VTD_INV_IOTLB_ADDR_MASK	BIT_MASK(63, 12)
 
 #define VTD_REQ_INV_INT			0x04
 # define VTD_INV_INT_GLOBAL		(0UL << 4)
@@ -158,12 +169,46 @@ union vtd_irte {
 /* A unit can occupy up to 3 pages for registers, we reserve 4. */
 #define DMAR_MMIO_SIZE			(PAGE_SIZE * 4)
 
+#define VTD_INV_QUEUE_ENTRIES		(PAGE_SIZE / sizeof(struct vtd_entry))
+/* Leave room for the wait descriptor that terminates a batch. */
+#define VTD_INV_BATCH_MAX		(VTD_INV_QUEUE_ENTRIES - 1)
+
 struct vtd_irte_usage {
 	u16 device_id;
 	u16 vector:10,
 	    used:1;
 } __attribute__((packed));
 
+/*
+ * Interrupt remapping table allocator: reserved regions are kept in a dense
+ * array, chained into a hash on the device ID, free ranges in an array of
+ * extents sorted by start index. Both arrays are bounded by interrupt_limit.
+ */
+#define VTD_IRT_HASH_SIZE		256
+
+struct vtd_irt_region {
+	u16 device_id;
+	u16 start;
+	u16 length;
+	/* index + 1 of the next region in the hash chain, 0 terminates */
+	u16 hash_next;
+};
+
+struct vtd_irt_extent {
+	u16 start;
+	u16 length;
+};
+
+/*
+ * Invalidation requests collected across all units, submitted with a single
+ * wait descriptor per unit. Protected by inv_queue_lock.
+ */
+struct vtd_inv_batch {
+	unsigned int tail[JAILHOUSE_MAX_IOMMU_UNITS];
+	unsigned int pending[JAILHOUSE_MAX_IOMMU_UNITS];
+	volatile u32 completed[JAILHOUSE_MAX_IOMMU_UNITS];
+};
+
 struct vtd_emulation {
 	u64 irta;
 	unsigned int irt_entries;
@@ -175,6 +220,11 @@ struct vtd_emulation {
 	u32 fault_event_regs[4];
 };
 
+/* Interrupt cache invalidation range [start, end) pending emulation. */
+struct vtd_inv_int_range {
+	unsigned int start, end;
+};
+
 static const struct vtd_entry inv_global_context = {
 	.lo_word = VTD_REQ_INV_CONTEXT | VTD_INV_CONTEXT_GLOBAL,
 };
@@ -191,13 +241,35 @@ static struct vtd_entry __attribute__((aligned(PAGE_SIZE)))
 	root_entry_table[256];
 static union vtd_irte *int_remap_table;
 static unsigned int int_remap_table_size_log2;
+static struct vtd_irt_region *irt_regions;
+static unsigned int irt_num_regions;
+static struct vtd_irt_extent *irt_free;
+static unsigned int irt_num_free;
+static u16 irt_hash[VTD_IRT_HASH_SIZE];
 static struct paging vtd_paging[VTD_MAX_PAGE_TABLE_LEVELS];
 static void *dmar_reg_base;
 static void *unit_inv_queue;
 static unsigned int dmar_units;
 static unsigned int dmar_pt_levels;
 static unsigned int dmar_num_did = ~0U;
+static unsigned int dmar_psi_max_order = ~0U;
+static bool dmar_psi_unsupported;
+/* cells may use their EPT for DMA as well, see vtd_can_share_ept */
+static bool dmar_can_share_pt;
+static bool dmar_sagaw48;
+/* all units support pass-through context entries */
+static bool dmar_passthrough = true;
 static DEFINE_SPINLOCK(inv_queue_lock);
+static struct vtd_inv_batch inv_batch;
+/*
+ * Interrupt remapping updates collected by int_batch_cpu, see
+ * iommu_map_interrupts_begin. Only accessed by that CPU while holding
+ * int_batch_lock.
+ */
+static DEFINE_SPINLOCK(int_batch_lock);
+static unsigned int int_batch_cpu = -1;
+static unsigned int int_batch_depth;
+static int int_batch_first = -1, int_batch_last;
 static struct vtd_emulation root_cell_units[JAILHOUSE_MAX_IOMMU_UNITS];
 static bool dmar_units_initialized;
 
@@ -244,7 +316,142 @@ static void vtd_submit_iq_request(void *reg_base, void *inv_queue,
 	spin_unlock(&inv_queue_lock);
 }
 
-static void vtd_flush_domain_caches(unsigned int did)
+/**
+ * Start collecting invalidation requests for the hypervisor-owned queues of
+ * all DMAR units.
+ *
+ * @see vtd_inv_batch_queue
+ * @see vtd_inv_batch_end
+ */
+static void vtd_inv_batch_begin(void)
+{
+	void *reg_base = dmar_reg_base;
+	unsigned int n;
+
+	spin_lock(&inv_queue_lock);
+
+	for (n = 0; n < dmar_units; n++, reg_base += DMAR_MMIO_SIZE) {
+		inv_batch.tail[n] = mmio_read64_field(reg_base + VTD_IQT_REG,
+						      VTD_IQT_QT_MASK);
+		inv_batch.pending[n] = 0;
+	}
+}
+
+/*
+ * Submit all queued requests, terminating each unit's list with a single
+ * wait descriptor and polling for their completion in parallel.
+ */
+static void vtd_inv_batch_flush(void)
+{
+	void *reg_base = dmar_reg_base;
+	struct vtd_entry inv_wait = {
+		.lo_word = VTD_REQ_INV_WAIT | VTD_INV_WAIT_SW |
+			VTD_INV_WAIT_FN | (1UL << VTD_INV_WAIT_SDATA_SHIFT),
+	};
+	bool done;
+	unsigned int n;
+
+	for (n = 0; n < dmar_units; n++, reg_base += DMAR_MMIO_SIZE) {
+		if (inv_batch.pending[n] == 0)
+			continue;
+
+		inv_batch.completed[n] = 0;
+		inv_wait.hi_word = paging_hvirt2phys(&inv_batch.completed[n]);
+		inv_batch.tail[n] = inv_queue_write(unit_inv_queue +
+						    n * PAGE_SIZE,
+						    inv_batch.tail[n],
+						    inv_wait);
+
+		mmio_write64_field(reg_base + VTD_IQT_REG, VTD_IQT_QT_MASK,
+				   inv_batch.tail[n]);
+	}
+
+	do {
+		done = true;
+		for (n = 0; n < dmar_units; n++)
+			if (inv_batch.pending[n] > 0 &&
+			    !inv_batch.completed[n])
+				done = false;
+		if (!done)
+			cpu_relax();
+	} while (!done);
+
+	for (n = 0; n < dmar_units; n++)
+		inv_batch.pending[n] = 0;
+}
+
+/**
+ * Queue an invalidation request for the specified DMAR unit.
+ * @param unit		Unit number.
+ * @param inv_request	Invalidation descriptor.
+ *
+ * @note Must be called between vtd_inv_batch_begin() and vtd_inv_batch_end().
+ */
+static void vtd_inv_batch_queue(unsigned int unit,
+				const struct vtd_entry *inv_request)
+{
+	if (inv_batch.pending[unit] >= VTD_INV_BATCH_MAX)
+		vtd_inv_batch_flush();
+
+	inv_batch.tail[unit] = inv_queue_write(unit_inv_queue +
+					       unit * PAGE_SIZE,
+					       inv_batch.tail[unit],
+					       *inv_request);
+	inv_batch.pending[unit]++;
+}
+
+static void vtd_inv_batch_queue_all(const struct vtd_entry *inv_request)
+{
+	unsigned int n;
+
+	for (n = 0; n < dmar_units; n++)
+		vtd_inv_batch_queue(n, inv_request);
+}
+
+/**
+ * Submit all queued invalidation requests and wait for their completion.
+ *
+ * @see vtd_inv_batch_begin
+ */
+static void vtd_inv_batch_end(void)
+{
+	vtd_inv_batch_flush();
+	spin_unlock(&inv_queue_lock);
+}
+
+/*
+ * Invalidate the interrupt cache entries collected so far by the current
+ * iommu_map_interrupts_begin section and wait for their completion.
+ */
+static void vtd_int_batch_flush(void)
+{
+	struct vtd_entry inv_int = {
+		.lo_word = VTD_REQ_INV_INT | VTD_INV_INT_INDEX,
+	};
+	unsigned int mask_order = 0;
+
+	if (int_batch_first < 0)
+		return;
+
+	/* smallest aligned block covering all updated entries */
+	while ((int_batch_first >> mask_order) !=
+	       (int_batch_last >> mask_order))
+		mask_order++;
+
+	inv_int.lo_word |=
+		((u64)(int_batch_first & ~((1 << mask_order) - 1)) <<
+		 VTD_INV_INT_IIDX_SHIFT) |
+		(mask_order << VTD_INV_INT_IM_SHIFT);
+
+	vtd_inv_batch_begin();
+	vtd_inv_batch_queue_all(&inv_int);
+	vtd_inv_batch_end();
+
+	int_batch_first = -1;
+	int_batch_last = 0;
+}
+
+static void vtd_queue_domain_flush(unsigned int did)
 {
 	const struct vtd_entry inv_context = {
 		.lo_word = VTD_REQ_INV_CONTEXT | VTD_INV_CONTEXT_DOMAIN |
@@ -255,15 +462,54 @@ static void vtd_flush_domain_caches(unsigned int did)
 			VTD_INV_IOTLB_DW | VTD_INV_IOTLB_DR |
 			(did << VTD_INV_IOTLB_DOMAIN_SHIFT),
 	};
-	void *inv_queue = unit_inv_queue;
-	void *reg_base = dmar_reg_base;
-	unsigned int n;
 
-	for (n = 0; n < dmar_units; n++) {
-		vtd_submit_iq_request(reg_base, inv_queue, &inv_context);
-		vtd_submit_iq_request(reg_base, inv_queue, &inv_iotlb);
-		reg_base += DMAR_MMIO_SIZE;
-		inv_queue += PAGE_SIZE;
+	vtd_inv_batch_queue_all(&inv_context);
+	vtd_inv_batch_queue_all(&inv_iotlb);
+}
+
+static void vtd_queue_page_flush(unsigned int did, u64 addr,
+				 unsigned int order)
+{
+	const struct vtd_entry inv_iotlb = {
+		.lo_word = VTD_REQ_INV_IOTLB | VTD_INV_IOTLB_PAGE |
+			VTD_INV_IOTLB_DW | VTD_INV_IOTLB_DR |
+			(did << VTD_INV_IOTLB_DOMAIN_SHIFT),
+		.hi_word = (addr & VTD_INV_IOTLB_ADDR_MASK) |
+			(order & VTD_INV_IOTLB_AM_MASK),
+	};
+
+	vtd_inv_batch_queue_all(&inv_iotlb);
+}
+
+/*
+ * Queue the invalidations needed for the mapping changes a cell recorded
+ * since the last commit. Page-selective requests are used as long as all
+ * units support them, otherwise (or if the change was too large) the whole
+ * domain is flushed.
+ */
+static void vtd_queue_cell_flush(struct cell *cell)
+{
+	struct iommu_pending_inv *inv = &cell->arch.iommu_inv;
+	const struct iommu_inv_range *range;
+	unsigned int n, order;
+	u64 addr, pages;
+
+	if (inv->flush_domain ||
+	    (inv->num_ranges > 0 && dmar_psi_unsupported)) {
+		vtd_queue_domain_flush(cell->id);
+		return;
+	}
+
+	for (n = 0, range = inv->ranges; n < inv->num_ranges; n++, range++) {
+		addr = range->start;
+		pages = range->pages;
+		while (pages > 0) {
+			order = iommu_inv_range_order(addr, pages,
+						      dmar_psi_max_order);
+			vtd_queue_page_flush(cell->id, addr, order);
+			addr += (u64)PAGE_SIZE << order;
+			pages -= 1ULL << order;
+		}
 	}
 }
 
@@ -337,8 +583,7 @@ static void *vtd_get_fault_rec_reg_addr(void *reg_base)
 		mmio_read64_field(reg_base + VTD_CAP_REG, VTD_CAP_FRO_MASK);
 }
 
-static void vtd_print_fault_record_reg_status(unsigned int unit_no,
-					      void *reg_base)
+static void vtd_report_fault_record(unsigned int unit_no, void *reg_base)
 {
 	unsigned int sid = mmio_read64_field(reg_base + VTD_FRCD_HI_REG,
 					     VTD_FRCD_HI_SID_MASK);
@@ -349,34 +594,61 @@ static void vtd_print_fault_record_reg_status(unsigned int unit_no,
 	unsigned int type = mmio_read64_field(reg_base + VTD_FRCD_HI_REG,
 					      VTD_FRCD_HI_TYPE);
 
+	trace_event(JAILHOUSE_TRACE_IOMMU_FAULT, sid, fi);
+	if (!root_iommu_fault(unit_no, sid, fr, fi))
+		return;
+
 	printk("VT-d fault event reported by IOMMU %d:\n", unit_no);
 	printk(" Source Identifier (bus:dev.func): %02x:%02x.%x\n",
 	       PCI_BDF_PARAMS(sid));
 	printk(" Fault Reason: 0x%x Fault Info: %lx Type %d\n", fr, fi, type);
 }
 
+/*
+ * Drains all pending fault records, starting at the one the unit reports
+ * first. Faults are only logged, printing is rate-limited by
+ * root_iommu_fault, so a flood of faults does not stall the reporting CPU.
+ */
 void iommu_check_pending_faults(void)
 {
-	unsigned int fr_index;
+	unsigned int fr_index, nfr, n, count;
 	void *reg_base = dmar_reg_base;
-	unsigned int n;
 	void *fault_reg_addr, *rec_reg_addr;
 
 	if (this_cpu_id() != fault_reporting_cpu_id)
 		return;
 
-	for (n = 0; n < dmar_units; n++, reg_base += DMAR_MMIO_SIZE)
-		if (mmio_read32_field(reg_base + VTD_FSTS_REG, VTD_FSTS_PPF)) {
-			fr_index = mmio_read32_field(reg_base + VTD_FSTS_REG,
-						     VTD_FSTS_FRI_MASK);
-			fault_reg_addr = vtd_get_fault_rec_reg_addr(reg_base);
+	for (n = 0; n < dmar_units; n++, reg_base += DMAR_MMIO_SIZE) {
+		if (!mmio_read32_field(reg_base + VTD_FSTS_REG, VTD_FSTS_PPF))
+			continue;
+
+		/* the capability holds the number of records minus 1 */
+		nfr = mmio_read64_field(reg_base + VTD_CAP_REG,
+					VTD_CAP_NFR_MASK) + 1;
+		fr_index = mmio_read32_field(reg_base + VTD_FSTS_REG,
+					     VTD_FSTS_FRI_MASK);
+		fault_reg_addr = vtd_get_fault_rec_reg_addr(reg_base);
+
+		for (count = 0; count < nfr; count++) {
 			rec_reg_addr = fault_reg_addr + 16 * fr_index;
-			vtd_print_fault_record_reg_status(n, rec_reg_addr);
+			if (!mmio_read64_field(rec_reg_addr + VTD_FRCD_HI_REG,
+					       VTD_FRCD_HI_F))
+				break;
+
+			vtd_report_fault_record(n, rec_reg_addr);
 
 			/* Clear faults in record registers */
 			mmio_write64_field(rec_reg_addr + VTD_FRCD_HI_REG,
 					   VTD_FRCD_HI_F, VTD_FRCD_HI_F_CLEAR);
+
+			fr_index = (fr_index + 1) % nfr;
 		}
+
+		/* records were lost, they are not counted */
+		if (mmio_read32_field(reg_base + VTD_FSTS_REG, VTD_FSTS_PFO))
+			mmio_write32_field(reg_base + VTD_FSTS_REG,
+					   VTD_FSTS_PFO, VTD_FSTS_PFO_CLEAR);
+	}
 }
 
 static int vtd_emulate_inv_int(unsigned int unit_no, unsigned int index)
@@ -401,10 +673,30 @@ static int vtd_emulate_inv_int(unsigned int unit_no, unsigned int index)
 				   irte_usage->vector, irq_msg);
 }
 
+/*
+ * Emulate the interrupt cache invalidations for the collected index range
+ * [start, end) of a root cell unit.
+ */
+static int vtd_emulate_inv_int_range(unsigned int unit_no,
+				     struct vtd_inv_int_range *range)
+{
+	unsigned int n;
+	int result;
+
+	for (n = range->start; n < range->end; n++) {
+		result = vtd_emulate_inv_int(unit_no, n);
+		if (result < 0)
+			return result;
+	}
+	range->start = range->end = 0;
+	return 0;
+}
+
 static int vtd_emulate_qi_request(unsigned int unit_no,
-				  struct vtd_entry inv_desc)
+				  struct vtd_entry inv_desc,
+				  struct vtd_inv_int_range *pending)
 {
-	unsigned int start, count, n;
+	unsigned int start, end;
 	void *status_page;
 	int result;
 
@@ -413,24 +705,49 @@ static int vtd_emulate_qi_request(unsigned int unit_no,
 		if (inv_desc.lo_word & VTD_INV_INT_INDEX) {
 			start = (inv_desc.lo_word & VTD_INV_INT_IIDX_MASK) >>
 				VTD_INV_INT_IIDX_SHIFT;
-			count =
-			    1 << ((inv_desc.lo_word & VTD_INV_INT_IM_MASK) >>
-				  VTD_INV_INT_IM_SHIFT);
+			end = start +
+			    (1 << ((inv_desc.lo_word & VTD_INV_INT_IM_MASK) >>
+				   VTD_INV_INT_IM_SHIFT));
+			if (end > root_cell_units[unit_no].irt_entries)
+				end = root_cell_units[unit_no].irt_entries;
+			if (start >= end)
+				return 0;
 		} else {
 			start = 0;
-			count = root_cell_units[unit_no].irt_entries;
+			end = root_cell_units[unit_no].irt_entries;
 		}
-		for (n = start; n < start + count; n++) {
-			result = vtd_emulate_inv_int(unit_no, n);
-			if (result < 0)
-				return result;
+
+		/*
+		 * Merge overlapping or adjacent requests, so that repeated
+		 * invalidations of the same entries and a global one
+		 * following indexed ones are emulated only once.
+		 */
+		if (pending->start < pending->end &&
+		    start <= pending->end && end >= pending->start) {
+			if (start < pending->start)
+				pending->start = start;
+			if (end > pending->end)
+				pending->end = end;
+			return 0;
 		}
-		return 0;
+		result = vtd_emulate_inv_int_range(unit_no, pending);
+		pending->start = start;
+		pending->end = end;
+		return result;
 	case VTD_REQ_INV_WAIT:
 		if (inv_desc.lo_word & VTD_INV_WAIT_IF ||
 		    !(inv_desc.lo_word & VTD_INV_WAIT_SW))
 			return -EINVAL;
 
+		/*
+		 * Everything queued before the wait descriptor has to be
+		 * visible to the hardware before the guest is signaled.
+		 */
+		result = vtd_emulate_inv_int_range(unit_no, pending);
+		if (result < 0)
+			return result;
+		vtd_int_batch_flush();
+
 		status_page = paging_get_guest_pages(NULL, inv_desc.hi_word, 1,
 						     PAGE_DEFAULT_FLAGS);
 		if (!status_page)
@@ -449,9 +766,13 @@ static enum mmio_result vtd_unit_access_handler(void *arg,
 {
 	struct vtd_emulation *unit = arg;
 	unsigned int unit_no = unit - root_cell_units;
+	struct vtd_inv_int_range pending = { 0, 0 };
 	struct vtd_entry inv_desc;
 	void *inv_desc_page;
 	unsigned int reg;
+	int result;
+
+	this_cpu_data()->stats[JAILHOUSE_CPU_STAT_MMIO_VTD]++;
 
 	if (mmio->address == VTD_FSTS_REG && !mmio->is_write) {
 		/*
@@ -475,6 +796,13 @@ static enum mmio_result vtd_unit_access_handler(void *arg,
 		return MMIO_HANDLED;
 	}
 	if (mmio->address == VTD_IQT_REG && mmio->is_write) {
+		/*
+		 * Drain the whole queue in this exit. Interrupt cache
+		 * invalidations are coalesced and forwarded to the hardware
+		 * as a single request, either on the next wait descriptor or
+		 * once the tail is reached.
+		 */
+		iommu_map_interrupts_begin();
 		while (unit->iqh != (mmio->value & ~PAGE_MASK)) {
 			inv_desc_page =
 				paging_get_guest_pages(NULL, unit->iqa, 1,
@@ -485,12 +813,17 @@ static enum mmio_result vtd_unit_access_handler(void *arg,
 			inv_desc =
 			    *(struct vtd_entry *)(inv_desc_page + unit->iqh);
 
-			if (vtd_emulate_qi_request(unit_no, inv_desc) != 0)
+			if (vtd_emulate_qi_request(unit_no, inv_desc,
+						   &pending) != 0)
 				goto invalid_iq_entry;
 
 			unit->iqh += 1 << VTD_IQH_QH_SHIFT;
 			unit->iqh &= ~PAGE_MASK;
 		}
+		result = vtd_emulate_inv_int_range(unit_no, &pending);
+		iommu_map_interrupts_end();
+		if (result < 0)
+			goto invalid_iq_entry_unbatched;
 		return MMIO_HANDLED;
 	}
 	panic_printk("FATAL: Unhandled DMAR unit %s access, register %02x\n",
@@ -498,6 +831,8 @@ static enum mmio_result vtd_unit_access_handler(void *arg,
 	return MMIO_ERROR;
 
 invalid_iq_entry:
+	iommu_map_interrupts_end();
+invalid_iq_entry_unbatched:
 	panic_printk("FATAL: Invalid/unsupported invalidation queue entry\n");
 	return -1;
 }
@@ -558,14 +893,15 @@ static int vtd_init_ir_emulation(unsigned int unit_no, void *reg_base)
 	root_cell.arch.vtd.ir_emulation = true;
 
 	base = system_config->platform_info.x86.iommu_units[unit_no].base;
-	mmio_region_register(&root_cell, base, PAGE_SIZE,
-			     vtd_unit_access_handler, unit);
+	mmio_region_register_fast(&root_cell, base, PAGE_SIZE,
+				  vtd_unit_access_handler, unit);
 
 	unit->irta = mmio_read64(reg_base + VTD_IRTA_REG);
 	unit->irt_entries = 2 << (unit->irta & VTD_IRTA_SIZE_MASK);
 
 	size = PAGE_ALIGN(sizeof(struct vtd_irte_usage) * unit->irt_entries);
-	unit->irte_map = page_alloc(&mem_pool, size / PAGE_SIZE);
+	unit->irte_map = page_alloc(&mem_pool, size / PAGE_SIZE,
+				    PAGE_OWNER_IRT);
 	if (!unit->irte_map)
 		return -ENOMEM;
 
@@ -585,10 +921,38 @@ static int vtd_init_ir_emulation(unsigned int unit_no, void *reg_base)
 	return 0;
 }
 
+/*
+ * EPT entries can serve as second-level VT-d entries: R/W sit in the same
+ * bits, and VT-d ignores the execute, memory type and IPAT bits in legacy
+ * mode. It takes 4-level tables, snooped table walks because EPT updates
+ * are not flushed from the caches, and all large pages that EPT may use.
+ */
+static bool vtd_can_share_ept(bool sagaw48, bool coherent,
+			      unsigned long sllps_caps)
+{
+	unsigned long ept_cap = read_msr(MSR_IA32_VMX_EPT_VPID_CAP);
+
+	if (!sagaw48 || !coherent)
+		return false;
+	if (ept_cap & EPT_2M_PAGES && !(sllps_caps & VTD_CAP_SLLPS2M))
+		return false;
+	if (ept_cap & EPT_1G_PAGES && !(sllps_caps & VTD_CAP_SLLPS1G))
+		return false;
+	return true;
+}
+
+static const struct paging_structures *vtd_cell_pg_structs(struct cell *cell)
+{
+	if (cell->arch.vtd.shared_pt)
+		return arch_cell_paging_structs(cell);
+	return &cell->arch.vtd.pg_structs;
+}
+
 int iommu_init(void)
 {
 	unsigned long version, caps, ecaps, ctrls, sllps_caps = ~0UL;
 	unsigned int units, pt_levels, num_did, n;
+	bool sagaw48 = true, coherent = true;
 	struct jailhouse_iommu *unit;
 	void *reg_base;
 	int err;
@@ -600,21 +964,36 @@ int iommu_init(void)
 		return trace_error(-EINVAL);
 
 	int_remap_table =
-		page_alloc(&mem_pool, PAGES(sizeof(union vtd_irte) << n));
+		page_alloc(&mem_pool, PAGES(sizeof(union vtd_irte) << n),
+			   PAGE_OWNER_IRT);
 	if (!int_remap_table)
 		return -ENOMEM;
 
 	int_remap_table_size_log2 = n;
 
+	irt_regions = page_alloc(&mem_pool,
+				 PAGES(sizeof(struct vtd_irt_region) << n),
+				 PAGE_OWNER_IRT);
+	irt_free = page_alloc(&mem_pool,
+			      PAGES(sizeof(struct vtd_irt_extent) << n),
+			      PAGE_OWNER_IRT);
+	if (!irt_regions || !irt_free)
+		return -ENOMEM;
+
+	irt_free[0].start = 0;
+	irt_free[0].length = system_config->interrupt_limit;
+	irt_num_free = irt_free[0].length > 0 ? 1 : 0;
+
 	units = iommu_count_units();
 	if (units == 0)
 		return trace_error(-EINVAL);
 
-	dmar_reg_base = page_alloc(&remap_pool, units * PAGES(DMAR_MMIO_SIZE));
+	dmar_reg_base = page_alloc(&remap_pool, units * PAGES(DMAR_MMIO_SIZE),
+				   PAGE_OWNER_IOMMU);
 	if (!dmar_reg_base)
 		return trace_error(-ENOMEM);
 
-	unit_inv_queue = page_alloc(&mem_pool, units);
+	unit_inv_queue = page_alloc(&mem_pool, units, PAGE_OWNER_IOMMU);
 	if (!unit_inv_queue)
 		return -ENOMEM;
 
@@ -647,8 +1026,18 @@ int iommu_init(void)
 			pt_levels = 4;
 		else
 			return trace_error(-EIO);
+		if (!(caps & VTD_CAP_SAGAW48))
+			sagaw48 = false;
 		sllps_caps &= caps;
 
+		if (caps & VTD_CAP_PSI)
+			dmar_psi_max_order =
+				MIN(dmar_psi_max_order,
+				    (caps & VTD_CAP_MAMV_MASK) >>
+				    VTD_CAP_MAMV_SHIFT);
+		else
+			dmar_psi_unsupported = true;
+
 		if (dmar_pt_levels > 0 && dmar_pt_levels != pt_levels)
 			return trace_error(-EIO);
 		dmar_pt_levels = pt_levels;
@@ -660,6 +1049,10 @@ int iommu_init(void)
 		if (!(ecaps & VTD_ECAP_QI) || !(ecaps & VTD_ECAP_IR) ||
 		    (using_x2apic && !(ecaps & VTD_ECAP_EIM)))
 			return trace_error(-EIO);
+		if (!(ecaps & VTD_ECAP_C))
+			coherent = false;
+		if (!(ecaps & VTD_ECAP_PT))
+			dmar_passthrough = false;
 
 		ctrls = mmio_read32(reg_base + VTD_GSTS_REG) &
 			VTD_GSTS_USED_CTRLS;
@@ -681,6 +1074,11 @@ int iommu_init(void)
 
 	dmar_units = units;
 
+	dmar_sagaw48 = sagaw48;
+	dmar_can_share_pt = vtd_can_share_ept(sagaw48, coherent, sllps_caps);
+	if (dmar_can_share_pt)
+		dmar_pt_levels = 4;
+
 	/*
 	 * Derive vdt_paging from very similar x86_64_paging,
 	 * replicating 0..3 for 4 levels and 1..3 for 3 levels.
@@ -689,10 +1087,16 @@ int iommu_init(void)
 	       sizeof(struct paging) * dmar_pt_levels);
 	for (n = 0; n < dmar_pt_levels; n++)
 		vtd_paging[n].set_next_pt = vtd_set_next_pt;
+	/* superpages have to be supported by all units sharing the tables */
 	if (!(sllps_caps & VTD_CAP_SLLPS1G))
 		vtd_paging[dmar_pt_levels - 3].page_size = 0;
 	if (!(sllps_caps & VTD_CAP_SLLPS2M))
 		vtd_paging[dmar_pt_levels - 2].page_size = 0;
+	printk("DMAR: %u-level page tables, 2M pages %s, 1G pages %s, "
+	       "EPT sharing %s\n", dmar_pt_levels,
+	       sllps_caps & VTD_CAP_SLLPS2M ? "on" : "off",
+	       sllps_caps & VTD_CAP_SLLPS1G ? "on" : "off",
+	       dmar_can_share_pt ? "possible" : "unavailable");
 
 	return iommu_cell_init(&root_cell);
 }
@@ -704,11 +1108,13 @@ static void vtd_update_irte(unsigned int index, union vtd_irte content)
 			((u64)index << VTD_INV_INT_IIDX_SHIFT),
 	};
 	union vtd_irte *irte = &int_remap_table[index];
-	void *inv_queue = unit_inv_queue;
-	void *reg_base = dmar_reg_base;
-	unsigned int n;
+	bool was_present = irte->field.p;
 
 	if (content.field.p) {
+		if (was_present && irte->raw[0] == content.raw[0] &&
+		    irte->raw[1] == content.raw[1])
+			return;
+
 		/*
 		 * Write upper half first to preserve non-presence.
 		 * If the entry was present before, we are only modifying the
@@ -727,63 +1133,171 @@ static void vtd_update_irte(unsigned int index, union vtd_irte content)
 	}
 	arch_paging_flush_cpu_caches(irte, sizeof(*irte));
 
-	for (n = 0; n < dmar_units; n++) {
-		vtd_submit_iq_request(reg_base, inv_queue, &inv_int);
-		reg_base += DMAR_MMIO_SIZE;
-		inv_queue += PAGE_SIZE;
+	/*
+	 * Without caching mode (rejected by vtd_init), not-present entries
+	 * are never cached, so only updates of present ones need to be
+	 * invalidated.
+	 */
+	if (!was_present)
+		return;
+
+	if (int_batch_cpu == this_cpu_id()) {
+		if (int_batch_first < 0 || index < int_batch_first)
+			int_batch_first = index;
+		if (index > int_batch_last)
+			int_batch_last = index;
+		return;
 	}
+
+	vtd_inv_batch_begin();
+	vtd_inv_batch_queue_all(&inv_int);
+	vtd_inv_batch_end();
 }
 
-static int vtd_find_int_remap_region(u16 device_id)
+static unsigned int vtd_irt_hash(u16 device_id)
 {
-	int n;
+	return (device_id ^ (device_id >> 8)) % VTD_IRT_HASH_SIZE;
+}
+
+static struct vtd_irt_region *vtd_find_irt_region(u16 device_id)
+{
+	unsigned int n = irt_hash[vtd_irt_hash(device_id)];
+	struct vtd_irt_region *region;
+
+	while (n > 0) {
+		region = &irt_regions[n - 1];
+		if (region->device_id == device_id)
+			return region;
+		n = region->hash_next;
+	}
+	return NULL;
+}
 
-	/* interrupt_limit is < 2^16, see vtd_init */
-	for (n = 0; n < system_config->interrupt_limit; n++)
-		if (int_remap_table[n].field.assigned &&
-		    int_remap_table[n].field.sid == device_id)
-			return n;
+static void vtd_irt_hash_unlink(struct vtd_irt_region *region)
+{
+	u16 *link = &irt_hash[vtd_irt_hash(region->device_id)];
+	unsigned int index = region - irt_regions + 1;
+
+	while (*link != index)
+		link = &irt_regions[*link - 1].hash_next;
+	*link = region->hash_next;
+}
+
+static int vtd_find_int_remap_region(u16 device_id)
+{
+	struct vtd_irt_region *region = vtd_find_irt_region(device_id);
 
-	return -ENOENT;
+	return region ? region->start : -ENOENT;
 }
 
 static int vtd_reserve_int_remap_region(u16 device_id, unsigned int length)
 {
-	int n, start = -E2BIG;
+	struct vtd_irt_extent *extent, *best = NULL;
+	struct vtd_irt_region *region;
+	unsigned int n, start;
+	u16 *head;
 
-	if (length == 0 || vtd_find_int_remap_region(device_id) >= 0)
+	if (length == 0 || vtd_find_irt_region(device_id))
 		return 0;
 
-	for (n = 0; n < system_config->interrupt_limit; n++) {
-		if (int_remap_table[n].field.assigned) {
-			start = -E2BIG;
-			continue;
-		}
-		if (start < 0)
-			start = n;
-		if (n + 1 == start + length) {
-			printk("Reserving %u interrupt(s) for device %04x "
-			       "at index %d\n", length, device_id, start);
-			for (n = start; n < start + length; n++) {
-				int_remap_table[n].field.assigned = 1;
-				int_remap_table[n].field.sid = device_id;
-			}
-			return start;
+	/* best fit keeps large extents for devices with many vectors */
+	for (n = 0, extent = irt_free; n < irt_num_free; n++, extent++)
+		if (extent->length >= length &&
+		    (!best || extent->length < best->length)) {
+			best = extent;
+			if (best->length == length)
+				break;
 		}
+	if (!best)
+		return trace_error(-E2BIG);
+
+	start = best->start;
+	best->start += length;
+	best->length -= length;
+	if (best->length == 0) {
+		irt_num_free--;
+		for (n = best - irt_free; n < irt_num_free; n++)
+			irt_free[n] = irt_free[n + 1];
+	}
+
+	region = &irt_regions[irt_num_regions++];
+	region->device_id = device_id;
+	region->start = start;
+	region->length = length;
+	head = &irt_hash[vtd_irt_hash(device_id)];
+	region->hash_next = *head;
+	*head = irt_num_regions;
+
+	printk("Reserving %u interrupt(s) for device %04x at index %d\n",
+	       length, device_id, start);
+	for (n = start; n < start + length; n++) {
+		int_remap_table[n].field.assigned = 1;
+		int_remap_table[n].field.sid = device_id;
 	}
-	return trace_error(-E2BIG);
+	return start;
 }
 
-static void vtd_free_int_remap_region(u16 device_id, unsigned int length)
+static void vtd_release_irt_extent(unsigned int start, unsigned int length)
+{
+	struct vtd_irt_extent *prev = NULL, *next = NULL;
+	unsigned int pos = 0, n;
+
+	/* first extent behind the released range */
+	while (pos < irt_num_free && irt_free[pos].start < start)
+		pos++;
+	if (pos > 0 && irt_free[pos - 1].start + irt_free[pos - 1].length ==
+	    start)
+		prev = &irt_free[pos - 1];
+	if (pos < irt_num_free && start + length == irt_free[pos].start)
+		next = &irt_free[pos];
+
+	if (prev && next) {
+		prev->length += length + next->length;
+		irt_num_free--;
+		for (n = pos; n < irt_num_free; n++)
+			irt_free[n] = irt_free[n + 1];
+	} else if (prev) {
+		prev->length += length;
+	} else if (next) {
+		next->start = start;
+		next->length += length;
+	} else {
+		for (n = irt_num_free; n > pos; n--)
+			irt_free[n] = irt_free[n - 1];
+		irt_free[pos].start = start;
+		irt_free[pos].length = length;
+		irt_num_free++;
+	}
+}
+
+static void vtd_free_int_remap_region(u16 device_id)
 {
 	union vtd_irte free_irte = { .field.p = 0, .field.assigned = 0 };
-	int pos = vtd_find_int_remap_region(device_id);
+	struct vtd_irt_region *region = vtd_find_irt_region(device_id);
+	struct vtd_irt_region *last;
+	unsigned int n;
+
+	if (!region)
+		return;
 
-	if (pos >= 0) {
-		printk("Freeing %u interrupt(s) for device %04x at index %d\n",
-		       length, device_id, pos);
-		while (length-- > 0)
-			vtd_update_irte(pos++, free_irte);
+	printk("Freeing %u interrupt(s) for device %04x at index %d\n",
+	       region->length, device_id, region->start);
+	iommu_map_interrupts_begin();
+	for (n = region->start; n < region->start + region->length; n++)
+		vtd_update_irte(n, free_irte);
+	iommu_map_interrupts_end();
+
+	vtd_release_irt_extent(region->start, region->length);
+
+	/* keep the region array dense by moving the last entry into the gap */
+	vtd_irt_hash_unlink(region);
+	last = &irt_regions[--irt_num_regions];
+	if (region != last) {
+		vtd_irt_hash_unlink(last);
+		*region = *last;
+		region->hash_next = irt_hash[vtd_irt_hash(region->device_id)];
+		irt_hash[vtd_irt_hash(region->device_id)] =
+			region - irt_regions + 1;
 	}
 }
 
@@ -808,7 +1322,8 @@ int iommu_add_pci_device(struct cell *cell, struct pci_device *device)
 		context_entry_table =
 			paging_phys2hvirt(*root_entry_lo & PAGE_MASK);
 	} else {
-		context_entry_table = page_alloc(&mem_pool, 1);
+		context_entry_table = page_alloc(&mem_pool, 1,
+						 PAGE_OWNER_IOMMU);
 		if (!context_entry_table)
 			goto error_nomem;
 		*root_entry_lo = VTD_ROOT_PRESENT |
@@ -817,17 +1332,32 @@ int iommu_add_pci_device(struct cell *cell, struct pci_device *device)
 	}
 
 	context_entry = &context_entry_table[PCI_DEVFN(bdf)];
-	context_entry->lo_word = VTD_CTX_PRESENT | VTD_CTX_TTYPE_MLP_UNTRANS |
-		paging_hvirt2phys(cell->arch.vtd.pg_structs.root_table);
-	context_entry->hi_word =
-		(dmar_pt_levels == 3 ? VTD_CTX_AGAW_39 : VTD_CTX_AGAW_48) |
-		(cell->id << VTD_CTX_DID_SHIFT);
+	if (iommu_cell_passthrough(cell) && dmar_passthrough) {
+		/* address width has to be the largest one supported */
+		context_entry->lo_word =
+			VTD_CTX_PRESENT | VTD_CTX_TTYPE_PASSTHROUGH;
+		context_entry->hi_word =
+			(dmar_sagaw48 ? VTD_CTX_AGAW_48 : VTD_CTX_AGAW_39) |
+			(cell->id << VTD_CTX_DID_SHIFT);
+	} else {
+		context_entry->lo_word =
+			VTD_CTX_PRESENT | VTD_CTX_TTYPE_MLP_UNTRANS |
+			paging_hvirt2phys(vtd_cell_pg_structs(cell)->root_table);
+		context_entry->hi_word =
+			(dmar_pt_levels == 3 ? VTD_CTX_AGAW_39 :
+			 VTD_CTX_AGAW_48) |
+			(cell->id << VTD_CTX_DID_SHIFT);
+	}
 	arch_paging_flush_cpu_caches(context_entry, sizeof(*context_entry));
 
+	/* context entries are cached per domain, flush old and new owner */
+	iommu_track_domain_change(&root_cell);
+	iommu_track_domain_change(cell);
+
 	return 0;
 
 error_nomem:
-	vtd_free_int_remap_region(bdf, max_vectors);
+	vtd_free_int_remap_region(bdf);
 	return -ENOMEM;
 }
 
@@ -843,8 +1373,7 @@ void iommu_remove_pci_device(struct pci_device *device)
 	if (dmar_units == 0)
 		return;
 
-	vtd_free_int_remap_region(bdf, MAX(device->info->num_msi_vectors,
-					   device->info->num_msix_vectors));
+	vtd_free_int_remap_region(bdf);
 
 	context_entry_table = paging_phys2hvirt(*root_entry_lo & PAGE_MASK);
 	context_entry = &context_entry_table[PCI_DEVFN(bdf)];
@@ -852,19 +1381,22 @@ void iommu_remove_pci_device(struct pci_device *device)
 	context_entry->lo_word &= ~VTD_CTX_PRESENT;
 	arch_paging_flush_cpu_caches(&context_entry->lo_word, sizeof(u64));
 
+	iommu_track_domain_change(&root_cell);
+	if (device->cell)
+		iommu_track_domain_change(device->cell);
+
 	for (n = 0; n < 256; n++)
 		if (context_entry_table[n].lo_word & VTD_CTX_PRESENT)
 			return;
 
 	*root_entry_lo &= ~VTD_ROOT_PRESENT;
 	arch_paging_flush_cpu_caches(root_entry_lo, sizeof(u64));
-	page_free(&mem_pool, context_entry_table, 1);
+	page_free(&mem_pool, context_entry_table, 1, PAGE_OWNER_IOMMU);
 }
 
 int iommu_cell_init(struct cell *cell)
 {
-	const struct jailhouse_irqchip *irqchip =
-		jailhouse_cell_irqchips(cell->config);
+	const struct jailhouse_irqchip *irqchip = cell->cfg.irqchips;
 	unsigned int n;
 	int result;
 
@@ -875,10 +1407,31 @@ int iommu_cell_init(struct cell *cell)
 	if (cell->id >= dmar_num_did)
 		return trace_error(-ERANGE);
 
-	cell->arch.vtd.pg_structs.root_paging = vtd_paging;
-	cell->arch.vtd.pg_structs.root_table = page_alloc(&mem_pool, 1);
-	if (!cell->arch.vtd.pg_structs.root_table)
-		return -ENOMEM;
+	result = iommu_check_passthrough(cell);
+	if (result)
+		return result;
+	if (iommu_cell_passthrough(cell) && !dmar_passthrough)
+		printk("WARNING: DMAR units lack pass-through support, "
+		       "translating root cell DMA\n");
+
+	/*
+	 * Sharing makes all regions of the cell reachable by its devices, so
+	 * the cell has to ask for it.
+	 */
+	cell->arch.vtd.shared_pt = dmar_can_share_pt &&
+		cell->config->flags & JAILHOUSE_CELL_IOMMU_SHARE_PT;
+	if (cell->config->flags & JAILHOUSE_CELL_IOMMU_SHARE_PT &&
+	    !cell->arch.vtd.shared_pt)
+		printk("WARNING: DMAR units cannot share EPT, using separate "
+		       "page tables\n");
+
+	if (!cell->arch.vtd.shared_pt) {
+		cell->arch.vtd.pg_structs.root_paging = vtd_paging;
+		cell->arch.vtd.pg_structs.root_table =
+			page_alloc(paging_pool_of(cell), 1, PAGE_OWNER_PAGING);
+		if (!cell->arch.vtd.pg_structs.root_table)
+			return -ENOMEM;
+	}
 
 	/* reserve regions for IRQ chips (if not done already) */
 	for (n = 0; n < cell->config->num_irqchips; n++, irqchip++) {
@@ -897,11 +1450,21 @@ int iommu_map_memory_region(struct cell *cell,
 			    const struct jailhouse_memory *mem)
 {
 	u32 flags = 0;
+	int err;
 
 	// HACK for QEMU
 	if (dmar_units == 0)
 		return 0;
 
+	/*
+	 * With shared tables, vcpu_map_memory_region already did the work,
+	 * and every region is visible to DMA.
+	 */
+	if (cell->arch.vtd.shared_pt) {
+		iommu_track_region_change(cell, mem);
+		return 0;
+	}
+
 	if (!(mem->flags & JAILHOUSE_MEM_DMA))
 		return 0;
 
@@ -913,23 +1476,42 @@ int iommu_map_memory_region(struct cell *cell,
 	if (mem->flags & JAILHOUSE_MEM_WRITE)
 		flags |= VTD_PAGE_WRITE;
 
-	return paging_create(&cell->arch.vtd.pg_structs, mem->phys_start,
-			     mem->size, mem->virt_start, flags,
-			     PAGING_COHERENT);
+	err = paging_create(&cell->arch.vtd.pg_structs, mem->phys_start,
+			    mem->size, mem->virt_start, flags,
+			    PAGING_COHERENT);
+	if (err)
+		return err;
+	paging_merge(&cell->arch.vtd.pg_structs, mem->virt_start, mem->size,
+		     PAGING_COHERENT);
+
+	iommu_track_region_change(cell, mem);
+	return 0;
 }
 
 int iommu_unmap_memory_region(struct cell *cell,
 			      const struct jailhouse_memory *mem)
 {
+	int err;
+
 	// HACK for QEMU
 	if (dmar_units == 0)
 		return 0;
 
+	if (cell->arch.vtd.shared_pt) {
+		iommu_track_region_change(cell, mem);
+		return 0;
+	}
+
 	if (!(mem->flags & JAILHOUSE_MEM_DMA))
 		return 0;
 
-	return paging_destroy(&cell->arch.vtd.pg_structs, mem->virt_start,
-			      mem->size, PAGING_COHERENT);
+	err = paging_destroy(&cell->arch.vtd.pg_structs, mem->virt_start,
+			     mem->size, PAGING_COHERENT);
+	if (err)
+		return err;
+
+	iommu_track_region_change(cell, mem);
+	return 0;
 }
 
 struct apic_irq_message
@@ -1034,13 +1616,55 @@ update_irte:
 	return base_index + vector;
 }
 
+/**
+ * Start collecting the interrupt cache invalidations of subsequent
+ * interrupt remapping updates on this CPU. Calls can be nested.
+ *
+ * The caller must not let the affected devices use the updated interrupts
+ * before calling iommu_map_interrupts_end.
+ */
+void iommu_map_interrupts_begin(void)
+{
+	if (int_batch_cpu == this_cpu_id()) {
+		int_batch_depth++;
+		return;
+	}
+
+	spin_lock(&int_batch_lock);
+	int_batch_cpu = this_cpu_id();
+	int_batch_depth = 1;
+	int_batch_first = -1;
+	int_batch_last = 0;
+}
+
+/**
+ * Invalidate the interrupt cache entries updated since the outermost
+ * iommu_map_interrupts_begin with a single index-mask request per unit and
+ * wait for its completion.
+ */
+void iommu_map_interrupts_end(void)
+{
+	if (--int_batch_depth > 0)
+		return;
+
+	vtd_int_batch_flush();
+
+	int_batch_cpu = -1;
+	spin_unlock(&int_batch_lock);
+}
+
 void iommu_cell_exit(struct cell *cell)
 {
 	// HACK for QEMU
 	if (dmar_units == 0)
 		return;
 
-	page_free(&mem_pool, cell->arch.vtd.pg_structs.root_table, 1);
+	if (!cell->arch.vtd.shared_pt) {
+		paging_destroy_tables(&cell->arch.vtd.pg_structs, 1);
+		page_free(paging_pool_of(cell->arch.vtd.pg_structs.root_table),
+			  cell->arch.vtd.pg_structs.root_table, 1,
+			  PAGE_OWNER_PAGING);
+	}
 
 	/*
 	 * Note that reservation regions of IOAPICs won't be released because
@@ -1052,6 +1676,7 @@ void iommu_config_commit(struct cell *cell_added_removed)
 {
 	void *inv_queue = unit_inv_queue;
 	void *reg_base = dmar_reg_base;
+	struct cell *cell;
 	int n;
 
 	// HACK for QEMU
@@ -1069,10 +1694,54 @@ void iommu_config_commit(struct cell *cell_added_removed)
 		}
 		dmar_units_initialized = true;
 	} else {
+		vtd_inv_batch_begin();
 		if (cell_added_removed)
-			vtd_flush_domain_caches(cell_added_removed->id);
-		vtd_flush_domain_caches(root_cell.id);
+			vtd_queue_domain_flush(cell_added_removed->id);
+		for_each_cell(cell)
+			if (cell != cell_added_removed)
+				vtd_queue_cell_flush(cell);
+		vtd_inv_batch_end();
 	}
+
+	if (cell_added_removed)
+		iommu_clear_pending_changes(cell_added_removed);
+	for_each_cell(cell)
+		iommu_clear_pending_changes(cell);
+}
+
+/*
+ * Restore the invalidation queue head pointer by filling the root cell's
+ * queue with wait descriptors up to the head it last saw. They are submitted
+ * with a single tail update, and each writes its position as status, so the
+ * last one signals that the hardware is in sync with the Linux state again.
+ */
+static void vtd_restore_iq_head(void *reg_base, void *root_inv_queue,
+				unsigned int head)
+{
+	volatile u32 completed = 0;
+	struct vtd_entry inv_wait = {
+		.hi_word = paging_hvirt2phys(&completed),
+	};
+	unsigned int index = 0;
+
+	if (head == 0)
+		return;
+
+	spin_lock(&inv_queue_lock);
+
+	while (index < head) {
+		inv_wait.lo_word = VTD_REQ_INV_WAIT | VTD_INV_WAIT_SW |
+			VTD_INV_WAIT_FN |
+			((u64)(index + 1) << VTD_INV_WAIT_SDATA_SHIFT);
+		index = inv_queue_write(root_inv_queue, index, inv_wait);
+	}
+
+	mmio_write64_field(reg_base + VTD_IQT_REG, VTD_IQT_QT_MASK, head);
+
+	while (completed != head)
+		cpu_relax();
+
+	spin_unlock(&inv_queue_lock);
 }
 
 static void vtd_restore_ir(unsigned int unit_no, void *reg_base)
@@ -1092,16 +1761,12 @@ static void vtd_restore_ir(unsigned int unit_no, void *reg_base)
 	mmio_write64(reg_base + VTD_IQA_REG, unit->iqa);
 	vtd_update_gcmd_reg(reg_base, VTD_GCMD_QIE, 1);
 
-	/*
-	 * Restore invalidation queue head pointer by issuing dummy requests
-	 * until the hardware is in sync with the Linux state again.
-	 */
-	iqh =unit->iqh;
+	iqh = unit->iqh;
 	root_inv_queue = paging_get_guest_pages(NULL, unit->iqa, 1,
 						PAGE_DEFAULT_FLAGS);
 	if (root_inv_queue)
-		while (mmio_read64(reg_base + VTD_IQH_REG) != iqh)
-			vtd_submit_iq_request(reg_base, root_inv_queue, NULL);
+		vtd_restore_iq_head(reg_base, root_inv_queue,
+				    iqh >> VTD_IQH_QH_SHIFT);
 	else
 		printk("WARNING: Failed to restore invalidation queue head\n");
 
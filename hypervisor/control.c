@@ -17,13 +17,50 @@
 #include <jailhouse/paging.h>
 #include <jailhouse/processor.h>
 #include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <jailhouse/utils.h>
 #include <asm/bitops.h>
 #include <asm/spinlock.h>
 
 enum msg_type {MSG_REQUEST, MSG_INFORMATION};
 enum failure_mode {ABORT_ON_ERROR, WARN_ON_ERROR};
-enum management_task {CELL_START, CELL_SET_LOADABLE, CELL_DESTROY};
+enum management_task {CELL_START, CELL_SET_LOADABLE, CELL_DESTROY,
+		      CELL_SET_CACHE, CELL_SET_CPUS, CELL_SET_MEMORY};
+
+/*
+ * Time a cell gets for replying to a request message, in milliseconds. 0 waits
+ * forever. Can be overridden in include/jailhouse/config.h.
+ */
+#ifndef CONFIG_MSG_REPLY_TIMEOUT_MS
+#define CONFIG_MSG_REPLY_TIMEOUT_MS	0
+#endif
+
+/*
+ * Interval of the root cell checking the heartbeats of cells that armed
+ * their watchdog, in milliseconds. Can be overridden in
+ * include/jailhouse/config.h.
+ */
+#ifndef CONFIG_WATCHDOG_PERIOD_MS
+#define CONFIG_WATCHDOG_PERIOD_MS	10
+#endif
+
+/*
+ * Window over which the VM exits of a CPU are counted against the rate limits
+ * of its cell, in milliseconds. Can be overridden in
+ * include/jailhouse/config.h.
+ */
+#ifndef CONFIG_EXIT_RATE_WINDOW_MS
+#define CONFIG_EXIT_RATE_WINDOW_MS	10
+#endif
+
+/* cycle counter value of the next watchdog check, see cell_watchdog_check */
+static u64 watchdog_next_check;
+
+/* parameters of the clock in the communication pages, see clock_init */
+static struct jailhouse_clock clock;
+
+union events_page events_page __attribute__((aligned(PAGE_SIZE)));
+static DEFINE_SPINLOCK(events_lock);
 
 /** System configuration as used while activating the hypervisor. */
 struct jailhouse_system *system_config;
@@ -33,6 +70,17 @@ struct cell root_cell;
 static DEFINE_SPINLOCK(shutdown_lock);
 static unsigned int num_cells = 1;
 
+/*
+ * Bit 0 is set while a cell management hypercall or the hypervisor shutdown
+ * is in progress. cell_create prepares the new cell while the other root CPUs
+ * keep running: it copies the configuration, allocates from mem_pool and
+ * remap_pool, extends hv_paging_structs and sets the charged cell. Every
+ * hypercall that does any of this therefore has to own this bit. A CPU that
+ * finds it taken fails with -EBUSY instead of spinning, because the owner may
+ * need to suspend that CPU, which only succeeds once it left the hypervisor.
+ */
+static unsigned long management_busy;
+
 /**
  * CPU set iterator.
  * @param cpu		Previous CPU ID.
@@ -71,10 +119,21 @@ bool cpu_id_valid(unsigned long cpu_id)
 
 static void cell_suspend(struct cell *cell, struct per_cpu *cpu_data)
 {
+	u64 start = get_cycles();
 	unsigned int cpu;
 
+	/*
+	 * Signal all CPUs before waiting for any of them, so that they enter
+	 * the suspended state in parallel.
+	 */
+	for_each_cpu_except(cpu, cell->cpu_set, cpu_data->cpu_id)
+		arch_request_cpu_suspend(cpu);
 	for_each_cpu_except(cpu, cell->cpu_set, cpu_data->cpu_id)
-		arch_suspend_cpu(cpu);
+		arch_wait_cpu_suspended(cpu);
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_CELL_SUSPENDS]++;
+	cpu_data->stats[JAILHOUSE_CPU_STAT_CELL_SUSPEND_CYCLES] +=
+		get_cycles() - start;
 }
 
 static void cell_resume(struct per_cpu *cpu_data)
@@ -85,6 +144,103 @@ static void cell_resume(struct per_cpu *cpu_data)
 		arch_resume_cpu(cpu);
 }
 
+/**
+ * Report an event to the root cell.
+ * @param type		Event type (JAILHOUSE_EVENT_*).
+ *
+ * The event is counted in the event page, then the root cell is interrupted
+ * if it provides a receiver for it.
+ *
+ * @see arch_notify_root
+ */
+void root_event(unsigned int type)
+{
+	struct jailhouse_events *events = &events_page.events;
+
+	spin_lock(&events_lock);
+	events->count[type]++;
+	memory_store_barrier();
+	events->seq++;
+	spin_unlock(&events_lock);
+
+	arch_notify_root();
+}
+
+/**
+ * Log an IOMMU fault in the event page and report it to the root cell.
+ * @param unit		Index of the reporting IOMMU unit.
+ * @param device_id	Requester ID of the faulting device.
+ * @param reason	Vendor-specific fault reason or event code.
+ * @param info		Vendor-specific fault information.
+ *
+ * The fault is recorded in the ring and counted per device, neither involves
+ * the console. Callers should only print the fault if this returns true,
+ * which is the case when the count of the device reaches a power of two. A
+ * device flooding the IOMMU with faults thus cannot hog the console and
+ * the printk lock.
+ *
+ * @return True if the fault should be printed.
+ */
+bool root_iommu_fault(unsigned int unit, u16 device_id, u32 reason, u64 info)
+{
+	struct jailhouse_iommu_faults *faults =
+		&events_page.events.iommu_faults;
+	struct jailhouse_iommu_fault_device *device;
+	struct jailhouse_iommu_fault *record;
+	u32 seq, count = 0;
+	unsigned int n;
+
+	spin_lock(&events_lock);
+
+	seq = faults->head;
+	record = &faults->records[seq % JAILHOUSE_IOMMU_FAULT_RECORDS];
+
+	record->seq = 0;
+	memory_store_barrier();
+
+	record->device_id = device_id;
+	record->unit = unit;
+	record->reason = reason;
+	record->info = info;
+
+	memory_store_barrier();
+	record->seq = seq + 1;
+	faults->head = seq + 1;
+
+	/* entries are never released, so the first unused one ends the list */
+	for (n = 0; n < JAILHOUSE_IOMMU_FAULT_DEVICES; n++) {
+		device = &faults->devices[n];
+		if (device->count == 0) {
+			device->device_id = device_id;
+			memory_store_barrier();
+			device->count = count = 1;
+			break;
+		}
+		if (device->device_id == device_id) {
+			count = ++device->count;
+			break;
+		}
+	}
+	if (count == 0)
+		count = ++faults->untracked;
+
+	spin_unlock(&events_lock);
+
+	root_event(JAILHOUSE_EVENT_IOMMU_FAULT);
+
+	return (count & (count - 1)) == 0;
+}
+
+static void cell_set_failed(struct cell *cell)
+{
+	cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_FAILED;
+	trace_event(JAILHOUSE_TRACE_CELL_STATE, cell->id,
+		    JAILHOUSE_CELL_FAILED);
+
+	cell->reported_state = JAILHOUSE_CELL_FAILED;
+	root_event(JAILHOUSE_EVENT_CELL_STATE);
+}
+
 /**
  * Deliver a message to cell and wait for the reply.
  * @param cell		Target cell.
@@ -100,11 +256,21 @@ static void cell_resume(struct per_cpu *cpu_data)
 static bool cell_send_message(struct cell *cell, u32 message,
 			      enum msg_type type)
 {
+	u32 doorbell;
+	u64 start, timeout;
+
 	if (cell->config->flags & JAILHOUSE_CELL_PASSIVE_COMMREG)
 		return true;
 
 	jailhouse_send_msg_to_cell(&cell->comm_page.comm_region, message);
 
+	doorbell = cell->comm_page.comm_region.msg_doorbell;
+	if (doorbell & JAILHOUSE_MSG_DOORBELL_ENABLE)
+		arch_send_msg_doorbell(cell, JAILHOUSE_MSG_DOORBELL_ID(doorbell));
+
+	timeout = (u64)arch_get_cycles_khz() * CONFIG_MSG_REPLY_TIMEOUT_MS;
+	start = get_cycles();
+
 	while (1) {
 		u32 reply = cell->comm_page.comm_region.reply_from_cell;
 		u32 cell_state = cell->comm_page.comm_region.cell_state;
@@ -122,6 +288,21 @@ static bool cell_send_message(struct cell *cell, u32 message,
 		if (reply != JAILHOUSE_MSG_NONE)
 			return false;
 
+		/*
+		 * A cell that stops answering requests is considered failed,
+		 * so that it can still be shut down and does not stall
+		 * further management requests. Informational messages are
+		 * never a reason to fail a cell.
+		 */
+		if (type == MSG_REQUEST && timeout != 0 &&
+		    get_cycles() - start > timeout) {
+			printk("WARNING: Cell \"%s\" did not reply to message "
+			       "%d, considering it failed\n",
+			       cell->config->name, message);
+			cell_set_failed(cell);
+			return true;
+		}
+
 		cpu_relax();
 	}
 }
@@ -162,6 +343,82 @@ retry:
 	return id;
 }
 
+static unsigned int stats_pages(struct cell *cell)
+{
+	return PAGES(cell->num_stats_slots * sizeof(struct jailhouse_cpu_stats));
+}
+
+static __cold int check_mem_regions(struct cell *cell)
+{
+	const struct jailhouse_memory *mem;
+	unsigned long align;
+	unsigned int n;
+
+	for_each_mem_region(mem, cell->config, n) {
+		if ((mem->flags & JAILHOUSE_MEM_TYPE_MASK) ==
+		    JAILHOUSE_MEM_TYPE_MASK)
+			return trace_error(-EINVAL);
+
+		/* hot-pluggable regions are plain RAM of non-root cells */
+		if (mem->flags & JAILHOUSE_MEM_HOTPLUG &&
+		    (cell == &root_cell || n >= JAILHOUSE_MEM_HOTPLUG_REGIONS ||
+		     mem->flags & (JAILHOUSE_MEM_IO | JAILHOUSE_MEM_COMM_REGION |
+				   JAILHOUSE_MEM_LOADABLE |
+				   JAILHOUSE_MEM_ROOTSHARED) ||
+		     JAILHOUSE_MEMORY_IS_SUBPAGE(mem)))
+			return trace_error(-EINVAL);
+
+		/* the comm region must not expose memory beyond its pages */
+		if (mem->flags & JAILHOUSE_MEM_COMM_REGION &&
+		    mem->size > sizeof(cell->comm_page))
+			return trace_error(-EINVAL);
+
+		switch (mem->flags &
+			(JAILHOUSE_MEM_HUGE_2M | JAILHOUSE_MEM_HUGE_1G)) {
+		case 0:
+			continue;
+		case JAILHOUSE_MEM_HUGE_2M:
+			align = 2 * 1024 * 1024;
+			break;
+		case JAILHOUSE_MEM_HUGE_1G:
+			align = 1024 * 1024 * 1024;
+			break;
+		default:
+			return trace_error(-EINVAL);
+		}
+		if (mem->flags & JAILHOUSE_MEM_COMM_REGION ||
+		    (mem->phys_start | mem->virt_start | mem->size) &
+		    (align - 1))
+			return trace_error(-EINVAL);
+	}
+	return 0;
+}
+
+static int exit_rate_init(struct cell *cell)
+{
+	const struct jailhouse_cell_desc *config = cell->config;
+	unsigned int class;
+	u32 limit;
+
+	if (config->exit_rate_action > JAILHOUSE_EXIT_RATE_FAIL)
+		return trace_error(-EINVAL);
+
+	for (class = 0; class < JAILHOUSE_EXIT_RATE_CLASSES; class++) {
+		limit = config->exit_rate_limits[class];
+		/* split up, 32-bit hosts lack a 64-bit divide */
+		cell->exit_rate_budget[class] =
+			(u64)(limit / 1000) * CONFIG_EXIT_RATE_WINDOW_MS +
+			(limit % 1000) * CONFIG_EXIT_RATE_WINDOW_MS / 1000;
+		if (limit == 0)
+			continue;
+		if (cell->exit_rate_budget[class] == 0)
+			cell->exit_rate_budget[class] = 1;
+		cell->exit_rate_limited = true;
+	}
+
+	return 0;
+}
+
 /**
  * Initialize a new cell.
  * @param cell	Cell to be initializes.
@@ -180,10 +437,25 @@ int cell_init(struct cell *cell)
 
 	cell->id = get_free_cell_id();
 
+	cell->cfg.mem_regions = jailhouse_cell_mem_regions(cell->config);
+	cell->cfg.cache_regions = jailhouse_cell_cache_regions(cell->config);
+	cell->cfg.irqchips = jailhouse_cell_irqchips(cell->config);
+	cell->cfg.pio_bitmap = jailhouse_cell_pio_bitmap(cell->config);
+	cell->cfg.pci_devices = jailhouse_cell_pci_devices(cell->config);
+	cell->cfg.pci_caps = jailhouse_cell_pci_caps(cell->config);
+	cell->cfg.msr_ranges = jailhouse_cell_msr_ranges(cell->config);
+	cell->cfg.stream_ids = jailhouse_cell_stream_ids(cell->config);
+
 	if (cpu_set_size > PAGE_SIZE)
 		return trace_error(-EINVAL);
+	err = check_mem_regions(cell);
+	if (err)
+		return err;
+	err = exit_rate_init(cell);
+	if (err)
+		return err;
 	if (cpu_set_size > sizeof(cell->small_cpu_set.bitmap)) {
-		cpu_set = page_alloc(&mem_pool, 1);
+		cpu_set = page_alloc(&mem_pool, 1, PAGE_OWNER_CELL);
 		if (!cpu_set)
 			return -ENOMEM;
 	} else {
@@ -194,9 +466,27 @@ int cell_init(struct cell *cell)
 
 	cell->cpu_set = cpu_set;
 
+	cell->num_stats_slots = MIN(cpu_set->max_cpu_id + 1,
+				    hypervisor_header.max_cpus);
+	cell->stats_page = page_alloc(&mem_pool, stats_pages(cell),
+				      PAGE_OWNER_CELL);
+	if (!cell->stats_page) {
+		err = -ENOMEM;
+		goto err_free_cpu_set;
+	}
+
 	err = mmio_cell_init(cell);
-	if (err && cell->cpu_set != &cell->small_cpu_set)
-		page_free(&mem_pool, cell->cpu_set, 1);
+	if (err)
+		goto err_free_stats;
+
+	return 0;
+
+err_free_stats:
+	page_free(&mem_pool, cell->stats_page, stats_pages(cell),
+		  PAGE_OWNER_CELL);
+err_free_cpu_set:
+	if (cell->cpu_set != &cell->small_cpu_set)
+		page_free(&mem_pool, cell->cpu_set, 1, PAGE_OWNER_CELL);
 
 	return err;
 }
@@ -205,8 +495,386 @@ static void cell_exit(struct cell *cell)
 {
 	mmio_cell_exit(cell);
 
+	page_free(&mem_pool, cell->stats_page, stats_pages(cell),
+		  PAGE_OWNER_CELL);
+
 	if (cell->cpu_set != &cell->small_cpu_set)
-		page_free(&mem_pool, cell->cpu_set, 1);
+		page_free(&mem_pool, cell->cpu_set, 1, PAGE_OWNER_CELL);
+}
+
+/**
+ * Map the statistics page of a cell read-only into the root cell.
+ * @param cell		Cell owning the statistics page.
+ *
+ * The page is mapped at its physical address, replacing the empty page that
+ * backs the hypervisor memory in the root cell at that location.
+ *
+ * @return 0 on success, negative error code otherwise.
+ *
+ * @see cpu_stats_publish
+ */
+int cell_stats_map(struct cell *cell)
+{
+	struct jailhouse_memory stats_mem;
+
+	stats_mem.phys_start = paging_hvirt2phys(cell->stats_page);
+	stats_mem.virt_start = stats_mem.phys_start;
+	stats_mem.size = stats_pages(cell) * PAGE_SIZE;
+	stats_mem.flags = JAILHOUSE_MEM_READ;
+
+	return arch_map_memory_region(&root_cell, &stats_mem);
+}
+
+/* back hypervisor pages in the root cell with the empty page again */
+static void unmap_hv_pages_from_root_cell(void *start, unsigned int pages)
+{
+	struct jailhouse_memory hv_page;
+	unsigned int n;
+
+	hv_page.phys_start = paging_hvirt2phys(empty_page);
+	hv_page.virt_start = paging_hvirt2phys(start);
+	hv_page.size = PAGE_SIZE;
+	hv_page.flags = JAILHOUSE_MEM_READ;
+
+	for (n = 0; n < pages; n++) {
+		/*
+		 * This cannot fail. The hypervisor memory is mapped page-wise
+		 * into the root cell.
+		 */
+		arch_map_memory_region(&root_cell, &hv_page);
+		hv_page.virt_start += PAGE_SIZE;
+	}
+}
+
+static void cell_stats_unmap(struct cell *cell)
+{
+	unmap_hv_pages_from_root_cell(cell->stats_page, stats_pages(cell));
+}
+
+/*
+ * Map the communication pages of a non-root cell into the root cell, at their
+ * physical address. The communication region is only readable, its fields
+ * steer the hypervisor's messaging. The extension area is writable for the
+ * mailboxes.
+ */
+static int cell_comm_map(struct cell *cell)
+{
+	struct jailhouse_memory comm_mem;
+	int err;
+
+	BUILD_BUG_ON(JAILHOUSE_COMM_EXT_OFFSET != PAGE_SIZE);
+	BUILD_BUG_ON(sizeof(struct jailhouse_comm_ext) > PAGE_SIZE);
+
+	comm_mem.phys_start = paging_hvirt2phys(&cell->comm_page.comm_region);
+	comm_mem.virt_start = comm_mem.phys_start;
+	comm_mem.size = PAGE_SIZE;
+	comm_mem.flags = JAILHOUSE_MEM_READ;
+
+	err = arch_map_memory_region(&root_cell, &comm_mem);
+	if (err)
+		return err;
+
+	comm_mem.phys_start = paging_hvirt2phys(&cell->comm_page.comm_ext);
+	comm_mem.virt_start = comm_mem.phys_start;
+	comm_mem.flags = JAILHOUSE_MEM_READ | JAILHOUSE_MEM_WRITE;
+
+	return arch_map_memory_region(&root_cell, &comm_mem);
+}
+
+/**
+ * Publish the statistics of the calling CPU in its cell's statistics page.
+ * @param cpu_data	Data structure of the calling CPU.
+ *
+ * Only counters that differ from their published value are written, which
+ * are usually just the few ones touched by the last VM exit. If none
+ * changed, the slot is left alone. Readers have to retry if the sequence
+ * counter was odd or changed while copying the counters.
+ *
+ * @note Invoked by the architecture-specific code at the end of each VM exit.
+ */
+void cpu_stats_publish(struct per_cpu *cpu_data)
+{
+	struct cell *cell = cpu_data->cell;
+	struct jailhouse_cpu_stats *slot;
+	unsigned int n = 0;
+
+	if (cpu_data->cpu_id >= cell->num_stats_slots)
+		return;
+	slot = &cell->stats_page[cpu_data->cpu_id];
+
+	/* the slot is only written by this CPU, no need to synchronize */
+	while (slot->counter[n] == cpu_data->stats[n])
+		if (++n == JAILHOUSE_NUM_CPU_STATS)
+			return;
+
+	slot->seqcount++;
+	memory_store_barrier();
+	for (; n < JAILHOUSE_NUM_CPU_STATS; n++)
+		if (slot->counter[n] != cpu_data->stats[n])
+			slot->counter[n] = cpu_data->stats[n];
+	memory_store_barrier();
+	slot->seqcount++;
+}
+
+static void cell_watchdog_run(struct cell *cell, u64 now)
+{
+	struct jailhouse_comm_ext *ext = &cell->comm_page.comm_ext;
+	u32 state = cell->comm_page.comm_region.cell_state;
+	u64 heartbeat;
+
+	if (state != JAILHOUSE_CELL_RUNNING &&
+	    state != JAILHOUSE_CELL_RUNNING_LOCKED)
+		return;
+
+	heartbeat = ext->heartbeat;
+
+	/* latch the timeout, a hanging cell must not be able to disarm it */
+	if (cell->watchdog_timeout == 0) {
+		if (ext->watchdog_timeout_ms == 0)
+			return;
+		cell->watchdog_timeout =
+			(u64)arch_get_cycles_khz() * ext->watchdog_timeout_ms;
+		cell->watchdog_heartbeat = heartbeat;
+		cell->watchdog_last_beat = now;
+		return;
+	}
+
+	if (heartbeat != cell->watchdog_heartbeat) {
+		cell->watchdog_heartbeat = heartbeat;
+		cell->watchdog_last_beat = now;
+		return;
+	}
+
+	if (now - cell->watchdog_last_beat <= cell->watchdog_timeout)
+		return;
+
+	printk("WARNING: Cell \"%s\" missed its watchdog heartbeat, "
+	       "considering it failed\n", cell->config->name);
+	cell_set_failed(cell);
+	cell->watchdog_timeout = 0;
+}
+
+/**
+ * Set up the clock published in the communication pages, taking the current
+ * cycle counter value as the common epoch.
+ *
+ * The multiplier is chosen as precise as possible while still fitting into
+ * 32 bits, so that cells can convert counter values with 64-bit arithmetic
+ * only.
+ */
+void clock_init(void)
+{
+	unsigned long khz = arch_get_cycles_khz();
+	u64 dividend, rem, mult;
+	int bit;
+
+	clock.epoch = get_cycles();
+	if (khz == 0)
+		return;
+
+	for (clock.shift = 32; clock.shift > 0; clock.shift--) {
+		/* long division, 32-bit hosts lack a 64-bit divide */
+		dividend = 1000000ULL << clock.shift;
+		rem = mult = 0;
+		for (bit = 63; bit >= 0; bit--) {
+			rem = (rem << 1) | ((dividend >> bit) & 1);
+			mult <<= 1;
+			if (rem >= khz) {
+				rem -= khz;
+				mult |= 1;
+			}
+		}
+		if (mult <= 0xffffffff)
+			break;
+	}
+	clock.mult = mult;
+	clock.frequency_khz = khz;
+
+	root_cell.comm_page.comm_ext.clock = clock;
+}
+
+/**
+ * Check the heartbeats of cells that armed their watchdog.
+ * @param cpu_data	Data structure of the calling CPU.
+ *
+ * Only the first CPU of the root cell performs the check, at most every
+ * CONFIG_WATCHDOG_PERIOD_MS. A cell whose heartbeat in the communication
+ * region extension did not change within its timeout is set to failed state,
+ * just like a cell that does not reply to messages. State changes the cells
+ * perform on their own, e.g. shutting down, are reported to the root cell as
+ * JAILHOUSE_EVENT_CELL_STATE.
+ *
+ * @return Cycle counter value at which the calling CPU should check again, 0
+ * if it does not run the watchdog.
+ *
+ * @note Invoked by the architecture-specific code at the end of each VM exit.
+ * Cell management suspends all other root cell CPUs, so the check runs
+ * serialized with it.
+ */
+u64 cell_watchdog_check(struct per_cpu *cpu_data)
+{
+	struct cell *cell;
+	u32 state;
+	u64 now;
+
+	if (cpu_data->cell != &root_cell || !root_cell.next ||
+	    cpu_data->cpu_id != first_cpu(root_cell.cpu_set))
+		return 0;
+
+	now = get_cycles();
+	if (now < watchdog_next_check)
+		return watchdog_next_check;
+	watchdog_next_check =
+		now + (u64)arch_get_cycles_khz() * CONFIG_WATCHDOG_PERIOD_MS;
+
+	for_each_non_root_cell(cell) {
+		cell_watchdog_run(cell, now);
+
+		/* states written by the cell itself, e.g. on shutdown */
+		state = cell->comm_page.comm_region.cell_state;
+		if (state != cell->reported_state) {
+			cell->reported_state = state;
+			root_event(JAILHOUSE_EVENT_CELL_STATE);
+		}
+	}
+
+	return watchdog_next_check;
+}
+
+static void cell_exit_rate_exceeded(struct cell *cell, unsigned int class)
+{
+	trace_event(JAILHOUSE_TRACE_EXIT_RATE, cell->id, class);
+	root_event(JAILHOUSE_EVENT_EXIT_RATE);
+
+	if (cell->config->exit_rate_action != JAILHOUSE_EXIT_RATE_FAIL ||
+	    cell == &root_cell ||
+	    cell->comm_page.comm_region.cell_state == JAILHOUSE_CELL_FAILED)
+		return;
+
+	printk("WARNING: Cell \"%s\" exceeded its VM exit rate limit, "
+	       "considering it failed\n", cell->config->name);
+	cell_set_failed(cell);
+}
+
+/**
+ * Check the VM exit rate limits of the cell running on a CPU.
+ * @param cpu_data	Data structure of the calling CPU.
+ *
+ * The exits of each class are counted per CPU over windows of
+ * CONFIG_EXIT_RATE_WINDOW_MS, based on the statistics counters. The first
+ * time a limit is exceeded within a window, this is recorded as
+ * JAILHOUSE_TRACE_EXIT_RATE and reported to the root cell as
+ * JAILHOUSE_EVENT_EXIT_RATE. With JAILHOUSE_EXIT_RATE_FAIL, a non-root cell
+ * is also set to failed state. That action as well as
+ * JAILHOUSE_EXIT_RATE_THROTTLE ask for holding the CPU back until the window
+ * ends.
+ *
+ * @return Cycle counter value until which the calling CPU should not return
+ * to its cell, 0 if it can continue.
+ *
+ * @note Invoked by the architecture-specific code at the end of each VM exit.
+ */
+u64 cell_exit_rate_check(struct per_cpu *cpu_data)
+{
+	struct cell *cell = cpu_data->cell;
+	unsigned int class;
+	u64 now, exits;
+
+	if (!cell->exit_rate_limited)
+		return 0;
+
+	now = get_cycles();
+	if (now >= cpu_data->exit_rate_window_end) {
+		cpu_data->exit_rate_window_end = now +
+			(u64)arch_get_cycles_khz() * CONFIG_EXIT_RATE_WINDOW_MS;
+		for (class = 0; class < JAILHOUSE_EXIT_RATE_CLASSES; class++)
+			cpu_data->exit_rate_base[class] =
+				cpu_data->stats[class];
+		cpu_data->exit_rate_exceeded = false;
+		return 0;
+	}
+
+	if (!cpu_data->exit_rate_exceeded) {
+		for (class = 0; class < JAILHOUSE_EXIT_RATE_CLASSES; class++) {
+			exits = cpu_data->stats[class] -
+				cpu_data->exit_rate_base[class];
+			if (cell->exit_rate_budget[class] != 0 &&
+			    exits > cell->exit_rate_budget[class])
+				break;
+		}
+		if (class == JAILHOUSE_EXIT_RATE_CLASSES)
+			return 0;
+
+		cpu_data->exit_rate_exceeded = true;
+		cell_exit_rate_exceeded(cell, class);
+	}
+
+	if (cell->config->exit_rate_action == JAILHOUSE_EXIT_RATE_WARN)
+		return 0;
+	return cpu_data->exit_rate_window_end;
+}
+
+#ifdef CONFIG_EXIT_LATENCY_HISTOGRAMS
+/**
+ * Allocate the VM exit latency histograms of a CPU.
+ * @param cpu_data	Data structure of the CPU.
+ *
+ * The histograms are kept out of struct per_cpu to keep the latter compact.
+ *
+ * @return 0 on success, negative error code otherwise.
+ */
+int exit_latency_cpu_init(struct per_cpu *cpu_data)
+{
+	unsigned int size = JAILHOUSE_NUM_CPU_STATS *
+		sizeof(cpu_data->exit_latency[0]);
+
+	cpu_data->exit_latency = page_alloc(&mem_pool, PAGES(size),
+					    PAGE_OWNER_OTHER);
+	if (!cpu_data->exit_latency)
+		return -ENOMEM;
+	memset(cpu_data->exit_latency, 0, size);
+
+	return 0;
+}
+
+/**
+ * Account the latency of the current VM exit.
+ * @param cpu_data	Data structure of the calling CPU.
+ *
+ * The latency is sorted into the log2 histogram of each statistic counter
+ * that changed during the exit, i.e. the histogram of
+ * JAILHOUSE_CPU_STAT_VMEXITS_TOTAL covers all exits while, e.g., the one of
+ * JAILHOUSE_CPU_STAT_VMEXITS_MMIO only covers MMIO exits.
+ *
+ * @note Invoked by the architecture-specific code at the end of each VM exit.
+ *
+ * @see exit_latency_start
+ */
+void exit_latency_account(struct per_cpu *cpu_data)
+{
+	u64 cycles = get_cycles() - cpu_data->exit_start;
+	unsigned int bucket = 0, n;
+
+	if (cycles)
+		bucket = MIN(63 - __builtin_clzll(cycles),
+			     JAILHOUSE_EXIT_LATENCY_BUCKETS - 1);
+
+	for (n = 0; n < JAILHOUSE_NUM_CPU_STATS; n++)
+		if (cpu_data->stats[n] != cpu_data->exit_stats[n]) {
+			cpu_data->exit_stats[n] = cpu_data->stats[n];
+			cpu_data->exit_latency[n][bucket]++;
+		}
+}
+#endif
+
+static void cpu_stats_reset(struct per_cpu *cpu_data)
+{
+	memset(cpu_data->stats, 0, sizeof(cpu_data->stats));
+#ifdef CONFIG_EXIT_LATENCY_HISTOGRAMS
+	memset(cpu_data->exit_stats, 0, sizeof(cpu_data->exit_stats));
+	memset(cpu_data->exit_latency, 0,
+	       JAILHOUSE_NUM_CPU_STATS * sizeof(cpu_data->exit_latency[0]));
+#endif
 }
 
 /**
@@ -219,9 +887,29 @@ static void cell_exit(struct cell *cell)
  */
 void config_commit(struct cell *cell_added_removed)
 {
-	arch_flush_cell_vcpu_caches(&root_cell);
-	if (cell_added_removed && cell_added_removed != &root_cell)
+	struct cell *cell;
+
+	/*
+	 * Only flush the vCPU caches of cells whose mappings changed, leaving
+	 * unrelated cells undisturbed. Moving CPUs always affects the root
+	 * cell as well as the cell that was added or removed.
+	 */
+	if (cell_added_removed) {
+		root_cell.vcpu_caches_dirty = true;
+		cell_added_removed->vcpu_caches_dirty = true;
+	}
+
+	for_each_cell(cell)
+		if (cell->vcpu_caches_dirty) {
+			arch_flush_cell_vcpu_caches(cell);
+			cell->vcpu_caches_dirty = false;
+		}
+
+	/* a cell under construction or destruction is not on the list */
+	if (cell_added_removed && cell_added_removed->vcpu_caches_dirty) {
 		arch_flush_cell_vcpu_caches(cell_added_removed);
+		cell_added_removed->vcpu_caches_dirty = false;
+	}
 
 	arch_config_commit(cell_added_removed);
 }
@@ -233,6 +921,32 @@ static bool address_in_region(unsigned long addr,
 	       addr < (region->phys_start + region->size);
 }
 
+/*
+ * Non-root cells may share memory regions of identical location and size,
+ * e.g. a DMA buffer that a device of one cell fills and the other cell
+ * consumes. Such a region is only returned to the root cell when its last
+ * user is destroyed.
+ */
+static bool region_used_by_other_cell(struct cell *excluded,
+				      const struct jailhouse_memory *mem)
+{
+	const struct jailhouse_memory *other;
+	struct cell *cell;
+	unsigned int n;
+
+	for_each_non_root_cell(cell) {
+		if (cell == excluded)
+			continue;
+		for_each_mem_region(other, cell->config, n)
+			if (!(other->flags & JAILHOUSE_MEM_COMM_REGION) &&
+			    other->phys_start == mem->phys_start &&
+			    other->size == mem->size &&
+			    cell_mem_region_present(cell, other))
+				return true;
+	}
+	return false;
+}
+
 static int unmap_from_root_cell(const struct jailhouse_memory *mem)
 {
 	/*
@@ -299,28 +1013,32 @@ static void cell_destroy_internal(struct per_cpu *cpu_data, struct cell *cell)
 	const struct jailhouse_memory *mem;
 	unsigned int cpu, n;
 
+	trace_event(JAILHOUSE_TRACE_CELL_DESTROY, cell->id, 0);
+
 	for_each_cpu(cpu, cell->cpu_set) {
 		arch_park_cpu(cpu);
 
 		set_bit(cpu, root_cell.cpu_set->bitmap);
 		per_cpu(cpu)->cell = &root_cell;
 		per_cpu(cpu)->failed = false;
-		memset(per_cpu(cpu)->stats, 0, sizeof(per_cpu(cpu)->stats));
+		cpu_stats_reset(per_cpu(cpu));
 	}
 
-	for_each_mem_region(mem, cell->config, n) {
-		if (!JAILHOUSE_MEMORY_IS_SUBPAGE(mem))
-			/*
-			 * This cannot fail. The region was mapped as a whole
-			 * before, thus no hugepages need to be broken up to
-			 * unmap it.
-			 */
-			arch_unmap_memory_region(cell, mem);
-
+	/*
+	 * The mappings of the cell are not removed region by region.
+	 * arch_cell_destroy releases its paging structures as a whole, and the
+	 * following config_commit flushes the cell's TLBs and IOMMU domain.
+	 */
+	for_each_mem_region(mem, cell->config, n)
 		if (!(mem->flags & (JAILHOUSE_MEM_COMM_REGION |
-				    JAILHOUSE_MEM_ROOTSHARED)))
+				    JAILHOUSE_MEM_ROOTSHARED)) &&
+		    cell_mem_region_present(cell, mem) &&
+		    !region_used_by_other_cell(cell, mem))
 			remap_to_root_cell(mem, WARN_ON_ERROR);
-	}
+
+	cell_stats_unmap(cell);
+	unmap_hv_pages_from_root_cell(&cell->comm_page,
+				      sizeof(cell->comm_page) / PAGE_SIZE);
 
 	arch_cell_destroy(cell);
 
@@ -344,20 +1062,18 @@ static int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
 	if (cpu_data->cell != &root_cell)
 		return -EPERM;
 
-	cell_suspend(&root_cell, cpu_data);
-
-	if (!cell_reconfig_ok(NULL)) {
-		err = -EPERM;
-		goto err_resume;
-	}
-
+	/*
+	 * Preparation phase: the root cell keeps running while we copy and
+	 * validate the configuration and set up the structures that are
+	 * private to the new cell. We own management_busy, so no other
+	 * management hypercall can change the set of cells, the page pools,
+	 * hv_paging_structs or the charged cell meanwhile.
+	 */
 	cfg_pages = PAGES(cfg_page_offs + sizeof(struct jailhouse_cell_desc));
 	cfg_mapping = paging_get_guest_pages(NULL, config_address, cfg_pages,
 					     PAGE_READONLY_FLAGS);
-	if (!cfg_mapping) {
-		err = -ENOMEM;
-		goto err_resume;
-	}
+	if (!cfg_mapping)
+		return -ENOMEM;
 
 	cfg = (struct jailhouse_cell_desc *)(cfg_mapping + cfg_page_offs);
 
@@ -367,35 +1083,38 @@ static int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
 		 * sizeof(cell->config->name) == sizeof(cfg->name) and
 		 * cell->config->name is guaranteed to be null-terminated.
 		 */
-		if (strcmp(cell->config->name, cfg->name) == 0) {
-			err = -EEXIST;
-			goto err_resume;
-		}
+		if (strcmp(cell->config->name, cfg->name) == 0)
+			return -EEXIST;
 
 	cfg_total_size = jailhouse_cell_config_size(cfg);
 	cfg_pages = PAGES(cfg_page_offs + cfg_total_size);
-	if (cfg_pages > NUM_TEMPORARY_PAGES) {
-		err = trace_error(-E2BIG);
-		goto err_resume;
-	}
+	if (cfg_pages > num_temporary_pages)
+		return trace_error(-E2BIG);
 
 	if (!paging_get_guest_pages(NULL, config_address, cfg_pages,
-				    PAGE_READONLY_FLAGS)) {
-		err = -ENOMEM;
-		goto err_resume;
-	}
+				    PAGE_READONLY_FLAGS))
+		return -ENOMEM;
 
 	cell_pages = PAGES(sizeof(*cell) + cfg_total_size);
-	cell = page_alloc(&mem_pool, cell_pages);
-	if (!cell) {
-		err = -ENOMEM;
-		goto err_resume;
-	}
+	cell = page_alloc(paging_node_pool(cfg), cell_pages, PAGE_OWNER_CELL);
+	if (!cell)
+		return -ENOMEM;
 
 	cell->data_pages = cell_pages;
+	cell->hv_pages = cell_pages;
+	paging_charge_cell(cell);
 	cell->config = ((void *)cell) + sizeof(*cell);
 	memcpy(cell->config, cfg, cfg_total_size);
 
+	/*
+	 * The root cell may have modified the descriptor while we were
+	 * copying it. Only trust the copy if it is self-consistent.
+	 */
+	if (jailhouse_cell_config_size(cell->config) != cfg_total_size) {
+		err = trace_error(-EINVAL);
+		goto err_free_cell;
+	}
+
 	err = cell_init(cell);
 	if (err)
 		goto err_free_cell;
@@ -413,16 +1132,35 @@ static int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
 			goto err_cell_exit;
 		}
 
+	/* sub-page regions only populate the new cell's MMIO dispatcher */
+	for_each_mem_region(mem, cell->config, n)
+		if (JAILHOUSE_MEMORY_IS_SUBPAGE(mem)) {
+			err = mmio_subpage_register(cell, mem);
+			if (err)
+				goto err_cell_exit;
+		}
+
+	/*
+	 * Commit phase: everything from here on hands over resources of the
+	 * root cell and therefore has to run with the root cell suspended.
+	 */
+	cell_suspend(&root_cell, cpu_data);
+
+	if (!cell_reconfig_ok(NULL)) {
+		err = -EPERM;
+		goto err_resume;
+	}
+
 	err = arch_cell_create(cell);
 	if (err)
-		goto err_cell_exit;
+		goto err_resume;
 
 	for_each_cpu(cpu, cell->cpu_set) {
 		arch_park_cpu(cpu);
 
 		clear_bit(cpu, root_cell.cpu_set->bitmap);
 		per_cpu(cpu)->cell = cell;
-		memset(per_cpu(cpu)->stats, 0, sizeof(per_cpu(cpu)->stats));
+		cpu_stats_reset(per_cpu(cpu));
 	}
 
 	/*
@@ -430,6 +1168,10 @@ static int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
 	 * the new cell instead.
 	 */
 	for_each_mem_region(mem, cell->config, n) {
+		/* hot-pluggable regions are only assigned on request */
+		if (!cell_mem_region_present(cell, mem))
+			continue;
+
 		/*
 		 * Unmap exceptions:
 		 *  - the communication region is not backed by root memory
@@ -442,17 +1184,29 @@ static int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
 				goto err_destroy_cell;
 		}
 
-		if (JAILHOUSE_MEMORY_IS_SUBPAGE(mem))
-			err = mmio_subpage_register(cell, mem);
-		else
+		if (!JAILHOUSE_MEMORY_IS_SUBPAGE(mem)) {
 			err = arch_map_memory_region(cell, mem);
-		if (err)
-			goto err_destroy_cell;
+			if (err)
+				goto err_destroy_cell;
+		}
 	}
 
+	err = cell_stats_map(cell);
+	if (err)
+		goto err_destroy_cell;
+
+	err = cell_comm_map(cell);
+	if (err)
+		goto err_destroy_cell;
+
+	paging_share_tables(cell);
+
 	config_commit(cell);
 
 	cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_SHUT_DOWN;
+	cell->reported_state = JAILHOUSE_CELL_SHUT_DOWN;
+	trace_event(JAILHOUSE_TRACE_CELL_STATE, cell->id,
+		    JAILHOUSE_CELL_SHUT_DOWN);
 
 	last = &root_cell;
 	while (last->next)
@@ -462,24 +1216,28 @@ static int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
 
 	cell_reconfig_completed();
 
-	printk("Created cell \"%s\"\n", cell->config->name);
+	cell_resume(cpu_data);
 
-	paging_dump_stats("after cell creation");
+	paging_charge_cell(NULL);
 
-	cell_resume(cpu_data);
+	printk("Created cell \"%s\"\n", cell->config->name);
+
+	paging_dump_stats("after cell creation", cell);
 
 	return cell->id;
 
 err_destroy_cell:
 	cell_destroy_internal(cpu_data, cell);
 	/* cell_destroy_internal already calls cell_exit */
+	cell_resume(cpu_data);
 	goto err_free_cell;
+err_resume:
+	cell_resume(cpu_data);
 err_cell_exit:
 	cell_exit(cell);
 err_free_cell:
-	page_free(&mem_pool, cell, cell_pages);
-err_resume:
-	cell_resume(cpu_data);
+	paging_charge_cell(NULL);
+	page_free(paging_pool_of(cell), cell, cell_pages, PAGE_OWNER_CELL);
 
 	return err;
 }
@@ -494,6 +1252,8 @@ static int cell_management_prologue(enum management_task task,
 				    struct per_cpu *cpu_data, unsigned long id,
 				    struct cell **cell_ptr)
 {
+	bool keeps_running;
+
 	/* We do not support management commands over non-root cells. */
 	if (cpu_data->cell != &root_cell)
 		return -EPERM;
@@ -515,8 +1275,15 @@ static int cell_management_prologue(enum management_task task,
 		return -EINVAL;
 	}
 
+	/*
+	 * Changing the cache partition or the CPU set keeps the cell running,
+	 * so it is rather a reconfiguration than a shutdown.
+	 */
+	keeps_running = task == CELL_SET_CACHE || task == CELL_SET_CPUS ||
+		task == CELL_SET_MEMORY;
 	if ((task == CELL_DESTROY && !cell_reconfig_ok(*cell_ptr)) ||
-	    !cell_shutdown_ok(*cell_ptr)) {
+	    (keeps_running && !cell_reconfig_ok(NULL)) ||
+	    (!keeps_running && !cell_shutdown_ok(*cell_ptr))) {
 		cell_resume(cpu_data);
 		return -EPERM;
 	}
@@ -526,10 +1293,54 @@ static int cell_management_prologue(enum management_task task,
 	return 0;
 }
 
-static int cell_start(struct per_cpu *cpu_data, unsigned long id)
+/* unmap all loadable memory regions from the root cell */
+static int cell_unmap_loadable(struct cell *cell)
 {
 	const struct jailhouse_memory *mem;
-	unsigned int cpu, n;
+	unsigned int n;
+	int err;
+
+	for_each_mem_region(mem, cell->config, n)
+		if (mem->flags & JAILHOUSE_MEM_LOADABLE) {
+			err = unmap_from_root_cell(mem);
+			if (err)
+				return err;
+		}
+	return 0;
+}
+
+static void cell_launch(struct cell *cell)
+{
+	unsigned int cpu;
+
+	/* present a consistent Communication Region state to the cell */
+	cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_RUNNING;
+	cell->comm_page.comm_region.msg_to_cell = JAILHOUSE_MSG_NONE;
+	cell->comm_page.comm_ext.heartbeat = 0;
+	cell->comm_page.comm_ext.watchdog_timeout_ms = 0;
+	cell->watchdog_timeout = 0;
+	memset((void *)cell->comm_page.comm_ext.from_cell, 0,
+	       sizeof(cell->comm_page.comm_ext.from_cell));
+	cell->comm_page.comm_ext.clock = clock;
+	trace_event(JAILHOUSE_TRACE_CELL_STATE, cell->id,
+		    JAILHOUSE_CELL_RUNNING);
+
+	/*
+	 * Memory mappings and device assignments survive a restart, so only
+	 * the device state needs to be brought back to its initial values.
+	 */
+	arch_cell_reset(cell);
+
+	for_each_cpu(cpu, cell->cpu_set) {
+		per_cpu(cpu)->failed = false;
+		arch_reset_cpu(cpu);
+	}
+
+	printk("Started cell \"%s\"\n", cell->config->name);
+}
+
+static int cell_start(struct per_cpu *cpu_data, unsigned long id)
+{
 	struct cell *cell;
 	int err;
 
@@ -538,29 +1349,103 @@ static int cell_start(struct per_cpu *cpu_data, unsigned long id)
 		return err;
 
 	if (cell->loadable) {
-		/* unmap all loadable memory regions from the root cell */
-		for_each_mem_region(mem, cell->config, n)
-			if (mem->flags & JAILHOUSE_MEM_LOADABLE) {
-				err = unmap_from_root_cell(mem);
-				if (err)
-					goto out_resume;
-			}
+		err = cell_unmap_loadable(cell);
+		if (err)
+			goto out_resume;
 
 		config_commit(NULL);
 
 		cell->loadable = false;
 	}
 
-	/* present a consistent Communication Region state to the cell */
-	cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_RUNNING;
-	cell->comm_page.comm_region.msg_to_cell = JAILHOUSE_MSG_NONE;
+	cell_launch(cell);
 
-	for_each_cpu(cpu, cell->cpu_set) {
-		per_cpu(cpu)->failed = false;
-		arch_reset_cpu(cpu);
+out_resume:
+	cell_resume(cpu_data);
+
+	return err;
+}
+
+/*
+ * Start a set of cells within a single suspension of the root cell. The
+ * loadable regions of all of them are revoked from the root cell with one
+ * config_commit.
+ */
+static int cell_start_multi(struct per_cpu *cpu_data,
+			    unsigned long ids_address, unsigned long num)
+{
+	unsigned long page_offs = ids_address & ~PAGE_MASK;
+	struct cell *cells[JAILHOUSE_CELL_START_MULTI_MAX];
+	bool commit = false;
+	unsigned int n, m;
+	struct cell *cell;
+	const u32 *ids;
+	int err = 0;
+
+	/* We do not support management commands over non-root cells. */
+	if (cpu_data->cell != &root_cell)
+		return -EPERM;
+
+	if (num == 0 || num > JAILHOUSE_CELL_START_MULTI_MAX)
+		return -EINVAL;
+
+	cell_suspend(&root_cell, cpu_data);
+
+	ids = paging_get_guest_pages(NULL, ids_address,
+				     PAGES(page_offs + num * sizeof(u32)),
+				     PAGE_READONLY_FLAGS);
+	if (!ids) {
+		err = -ENOMEM;
+		goto out_resume;
 	}
+	ids = (void *)ids + page_offs;
 
-	printk("Started cell \"%s\"\n", cell->config->name);
+	for (n = 0; n < num; n++) {
+		for_each_cell(cell)
+			if (cell->id == ids[n])
+				break;
+		if (!cell) {
+			err = -ENOENT;
+			goto out_resume;
+		}
+		/* root cell cannot be managed, and each cell only once */
+		if (cell == &root_cell) {
+			err = -EINVAL;
+			goto out_resume;
+		}
+		for (m = 0; m < n; m++)
+			if (cells[m] == cell) {
+				err = -EINVAL;
+				goto out_resume;
+			}
+		cells[n] = cell;
+	}
+
+	for (n = 0; n < num; n++)
+		if (!cell_shutdown_ok(cells[n])) {
+			err = -EPERM;
+			goto out_resume;
+		}
+
+	for (n = 0; n < num; n++)
+		cell_suspend(cells[n], cpu_data);
+
+	for (n = 0; n < num; n++)
+		if (cells[n]->loadable) {
+			err = cell_unmap_loadable(cells[n]);
+			if (err)
+				goto out_resume;
+			commit = true;
+		}
+
+	if (commit) {
+		config_commit(NULL);
+		for (n = 0; n < num; n++)
+			cells[n]->loadable = false;
+	}
+
+	for (n = 0; n < num; n++)
+		cell_launch(cells[n]);
 
 out_resume:
 	cell_resume(cpu_data);
@@ -589,10 +1474,13 @@ static int cell_set_loadable(struct per_cpu *cpu_data, unsigned long id)
 
 	cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_SHUT_DOWN;
 	cell->loadable = true;
+	trace_event(JAILHOUSE_TRACE_CELL_STATE, cell->id,
+		    JAILHOUSE_CELL_SHUT_DOWN);
 
 	/* map all loadable memory regions into the root cell */
 	for_each_mem_region(mem, cell->config, n)
-		if (mem->flags & JAILHOUSE_MEM_LOADABLE) {
+		if (mem->flags & JAILHOUSE_MEM_LOADABLE &&
+		    !region_used_by_other_cell(cell, mem)) {
 			err = remap_to_root_cell(mem, ABORT_ON_ERROR);
 			if (err)
 				goto out_resume;
@@ -608,6 +1496,205 @@ out_resume:
 	return err;
 }
 
+static int cell_set_cache(struct per_cpu *cpu_data, unsigned long id,
+			  unsigned long region)
+{
+	struct cell *cell;
+	unsigned int cpu;
+	int err;
+
+	err = cell_management_prologue(CELL_SET_CACHE, cpu_data, id, &cell);
+	if (err)
+		return err;
+
+	err = arch_cell_set_cache(cell, JAILHOUSE_CELL_CACHE_ARG_START(region),
+				  JAILHOUSE_CELL_CACHE_ARG_SIZE(region));
+
+	/* the cell keeps running, so let it continue where it was suspended */
+	for_each_cpu(cpu, cell->cpu_set)
+		arch_resume_cpu(cpu);
+
+	cell_resume(cpu_data);
+
+	return err;
+}
+
+/*
+ * Move a CPU between the root cell and a non-root cell while the latter keeps
+ * running. The CPU is parked like on cell creation or destruction. The new
+ * owner then brings it up the same way it brings up any offline CPU. A
+ * non-root cell has to approve a removal, after taking the CPU offline.
+ */
+static int cell_move_cpu(struct per_cpu *cpu_data, unsigned long id,
+			 unsigned long cpu_id, bool add)
+{
+	const unsigned long *config_cpu_set;
+	unsigned int cpu, boot_cpu = 0;
+	struct cell *cell, *from, *to;
+	int err;
+
+	err = cell_management_prologue(CELL_SET_CPUS, cpu_data, id, &cell);
+	if (err)
+		return err;
+
+	from = add ? &root_cell : cell;
+	to = add ? cell : &root_cell;
+
+	/* the CPU must fit into the target set, which is sized by config */
+	if (cpu_id == cpu_data->cpu_id || !cell_owns_cpu(from, cpu_id) ||
+	    cpu_id > to->cpu_set->max_cpu_id) {
+		err = trace_error(-EINVAL);
+		goto out_resume;
+	}
+
+	/* the first CPU of the configuration boots the cell, it has to stay */
+	config_cpu_set = jailhouse_cell_cpu_set(cell->config);
+	while (boot_cpu < cell->config->cpu_set_size * 8 &&
+	       !test_bit(boot_cpu, config_cpu_set))
+		boot_cpu++;
+	if (!add && cpu_id == boot_cpu) {
+		err = trace_error(-EBUSY);
+		goto out_resume;
+	}
+
+	if (!add) {
+		cell->comm_page.comm_ext.cpu_hotplug_id = cpu_id;
+
+		for_each_cpu(cpu, cell->cpu_set)
+			arch_resume_cpu(cpu);
+		if (!cell_send_message(cell, JAILHOUSE_MSG_CPU_REMOVE_REQUEST,
+				       MSG_REQUEST)) {
+			cell_resume(cpu_data);
+			return -EPERM;
+		}
+		cell_suspend(cell, cpu_data);
+	}
+
+	arch_park_cpu(cpu_id);
+
+	clear_bit(cpu_id, from->cpu_set->bitmap);
+	set_bit(cpu_id, to->cpu_set->bitmap);
+	per_cpu(cpu_id)->cell = to;
+	per_cpu(cpu_id)->failed = false;
+	cpu_stats_reset(per_cpu(cpu_id));
+
+	if (add)
+		arch_cell_add_cpu(cell, cpu_id);
+	else
+		arch_cell_remove_cpu(cell, cpu_id);
+
+	config_commit(cell);
+
+	printk("%s CPU %d %s cell \"%s\"\n", add ? "Added" : "Removed",
+	       (int)cpu_id, add ? "to" : "from", cell->config->name);
+
+out_resume:
+	for_each_cpu(cpu, cell->cpu_set)
+		arch_resume_cpu(cpu);
+	cell_resume(cpu_data);
+
+	return err;
+}
+
+/*
+ * Assign a hot-pluggable memory region of the configuration to a running cell
+ * or take it back. The cell is informed about added memory afterwards, and it
+ * has to approve a removal, after taking the memory offline.
+ */
+static int cell_set_memory(struct per_cpu *cpu_data, unsigned long id,
+			   unsigned long region, bool add)
+{
+	struct jailhouse_comm_ext *comm_ext;
+	const struct jailhouse_memory *mem;
+	struct cell *cell;
+	unsigned int cpu;
+	bool shared;
+	u64 mask;
+	int err;
+
+	err = cell_management_prologue(CELL_SET_MEMORY, cpu_data, id, &cell);
+	if (err)
+		return err;
+
+	if (region >= cell->config->num_memory_regions) {
+		err = trace_error(-EINVAL);
+		goto out_resume;
+	}
+	mem = &cell->cfg.mem_regions[region];
+	if (!(mem->flags & JAILHOUSE_MEM_HOTPLUG)) {
+		err = trace_error(-EINVAL);
+		goto out_resume;
+	}
+	mask = 1ULL << region;
+	if (((cell->mem_hotplug_present & mask) != 0) == add) {
+		err = -EBUSY;
+		goto out_resume;
+	}
+
+	comm_ext = &cell->comm_page.comm_ext;
+	comm_ext->mem_hotplug_start = mem->virt_start;
+	comm_ext->mem_hotplug_size = mem->size;
+
+	/* identical regions of other cells are already taken from the root */
+	shared = region_used_by_other_cell(cell, mem);
+
+	if (add) {
+		if (!shared) {
+			err = unmap_from_root_cell(mem);
+			if (err)
+				goto out_remap;
+		}
+		err = arch_map_memory_region(cell, mem);
+		if (err)
+			goto out_remap;
+		cell->mem_hotplug_present |= mask;
+	} else {
+		for_each_cpu(cpu, cell->cpu_set)
+			arch_resume_cpu(cpu);
+		if (!cell_send_message(cell,
+				       JAILHOUSE_MSG_MEMORY_REMOVE_REQUEST,
+				       MSG_REQUEST)) {
+			cell_resume(cpu_data);
+			return -EPERM;
+		}
+		cell_suspend(cell, cpu_data);
+
+		err = arch_unmap_memory_region(cell, mem);
+		if (err)
+			goto out_commit;
+		if (!shared)
+			remap_to_root_cell(mem, WARN_ON_ERROR);
+		cell->mem_hotplug_present &= ~mask;
+	}
+
+	config_commit(cell);
+
+	printk("%s memory region %d %s cell \"%s\"\n",
+	       add ? "Added" : "Removed", (int)region, add ? "to" : "from",
+	       cell->config->name);
+
+	for_each_cpu(cpu, cell->cpu_set)
+		arch_resume_cpu(cpu);
+	if (add)
+		cell_send_message(cell, JAILHOUSE_MSG_MEMORY_ADDED,
+				  MSG_INFORMATION);
+	cell_resume(cpu_data);
+
+	return 0;
+
+out_remap:
+	if (!shared)
+		remap_to_root_cell(mem, WARN_ON_ERROR);
+out_commit:
+	config_commit(cell);
+out_resume:
+	for_each_cpu(cpu, cell->cpu_set)
+		arch_resume_cpu(cpu);
+	cell_resume(cpu_data);
+
+	return err;
+}
+
 static int cell_destroy(struct per_cpu *cpu_data, unsigned long id)
 {
 	struct cell *cell, *previous;
@@ -619,7 +1706,9 @@ static int cell_destroy(struct per_cpu *cpu_data, unsigned long id)
 
 	printk("Closing cell \"%s\"\n", cell->config->name);
 
+	paging_charge_cell(cell);
 	cell_destroy_internal(cpu_data, cell);
+	paging_charge_cell(NULL);
 
 	previous = &root_cell;
 	while (previous->next != cell)
@@ -627,8 +1716,9 @@ static int cell_destroy(struct per_cpu *cpu_data, unsigned long id)
 	previous->next = cell->next;
 	num_cells--;
 
-	page_free(&mem_pool, cell, cell->data_pages);
-	paging_dump_stats("after cell destruction");
+	page_free(paging_pool_of(cell), cell, cell->data_pages,
+		  PAGE_OWNER_CELL);
+	paging_dump_stats("after cell destruction", NULL);
 
 	cell_reconfig_completed();
 
@@ -666,9 +1756,23 @@ static int cell_get_state(struct per_cpu *cpu_data, unsigned long id)
 	return -ENOENT;
 }
 
-static int shutdown(struct per_cpu *cpu_data)
+#ifdef CONFIG_SHUTDOWN_TIMING
+/* Microseconds between two cycle counter values, saturating after ~4 s. */
+static unsigned int cycles_to_us(u64 start, u64 end)
+{
+	u64 ns = jailhouse_clock_ns(&clock, end) -
+		jailhouse_clock_ns(&clock, start);
+
+	return (ns > 0xffffffffULL ? 0xffffffffU : (u32)ns) / 1000;
+}
+#endif
+
+static __cold int shutdown(struct per_cpu *cpu_data)
 {
 	unsigned int this_cpu = cpu_data->cpu_id;
+#ifdef CONFIG_SHUTDOWN_TIMING
+	u64 start, cells_closed, end;
+#endif
 	struct cell *cell;
 	unsigned int cpu;
 	int state, ret;
@@ -681,12 +1785,29 @@ static int shutdown(struct per_cpu *cpu_data)
 
 	if (cpu_data->shutdown_state == SHUTDOWN_NONE) {
 		state = SHUTDOWN_STARTED;
-		for_each_non_root_cell(cell)
-			if (!cell_shutdown_ok(cell))
-				state = -EPERM;
+		if (test_and_set_bit(0, &management_busy))
+			state = -EBUSY;
+		else
+			for_each_non_root_cell(cell)
+				if (!cell_shutdown_ok(cell))
+					state = -EPERM;
+		if (state == -EPERM)
+			clear_bit(0, &management_busy);
 
 		if (state == SHUTDOWN_STARTED) {
 			printk("Shutting down hypervisor\n");
+#ifdef CONFIG_SHUTDOWN_TIMING
+			start = get_cycles();
+#endif
+
+			/*
+			 * Let the CPUs of all cells stop in parallel. Once
+			 * released below, each one tears down its own state
+			 * concurrently with the others.
+			 */
+			for_each_non_root_cell(cell)
+				for_each_cpu(cpu, cell->cpu_set)
+					arch_request_cpu_suspend(cpu);
 
 			for_each_non_root_cell(cell) {
 				cell_suspend(cell, cpu_data);
@@ -700,9 +1821,21 @@ static int shutdown(struct per_cpu *cpu_data)
 				}
 			}
 
+#ifdef CONFIG_SHUTDOWN_TIMING
+			cells_closed = get_cycles();
+#endif
+
 			printk("Closing root cell \"%s\"\n",
 			       root_cell.config->name);
 			arch_shutdown();
+
+#ifdef CONFIG_SHUTDOWN_TIMING
+			end = get_cycles();
+			printk(" Took %u us (cells: %u us, devices: %u us)\n",
+			       cycles_to_us(start, end),
+			       cycles_to_us(start, cells_closed),
+			       cycles_to_us(cells_closed, end));
+#endif
 		}
 
 		for_each_cpu(cpu, root_cell.cpu_set)
@@ -723,24 +1856,42 @@ static int shutdown(struct per_cpu *cpu_data)
 
 static long hypervisor_get_info(struct per_cpu *cpu_data, unsigned long type)
 {
+	struct cell *cell;
+
 	switch (type) {
 	case JAILHOUSE_INFO_MEM_POOL_SIZE:
 		return mem_pool.pages;
 	case JAILHOUSE_INFO_MEM_POOL_USED:
-		return mem_pool.used_pages;
+		return paging_pool_used_pages(&mem_pool);
 	case JAILHOUSE_INFO_REMAP_POOL_SIZE:
 		return remap_pool.pages;
 	case JAILHOUSE_INFO_REMAP_POOL_USED:
 		return remap_pool.used_pages;
 	case JAILHOUSE_INFO_NUM_CELLS:
 		return num_cells;
-	default:
-		return -EINVAL;
 	}
+
+	if (type >= JAILHOUSE_INFO_PAGES_BASE &&
+	    type - JAILHOUSE_INFO_PAGES_BASE < NUM_PAGE_OWNERS)
+		return paging_owner_pages(type - JAILHOUSE_INFO_PAGES_BASE);
+
+	if (type >= JAILHOUSE_INFO_CELL_PAGES_BASE) {
+		type -= JAILHOUSE_INFO_CELL_PAGES_BASE;
+		for_each_cell(cell)
+			if (cell->id == type) {
+				if (cpu_data->cell != &root_cell &&
+				    cpu_data->cell != cell)
+					return -EPERM;
+				return cell->hv_pages;
+			}
+		return -ENOENT;
+	}
+
+	return -EINVAL;
 }
 
-static int cpu_get_info(struct per_cpu *cpu_data, unsigned long cpu_id,
-			unsigned long type)
+static long cpu_get_info(struct per_cpu *cpu_data, unsigned long cpu_id,
+			 unsigned long type)
 {
 	if (!cpu_id_valid(cpu_id))
 		return -EINVAL;
@@ -757,6 +1908,14 @@ static int cpu_get_info(struct per_cpu *cpu_data, unsigned long cpu_id,
 	if (type == JAILHOUSE_CPU_INFO_STATE) {
 		return per_cpu(cpu_id)->failed ? JAILHOUSE_CPU_FAILED :
 			JAILHOUSE_CPU_RUNNING;
+	} else if (type == JAILHOUSE_CPU_INFO_TRACE_BUFFER) {
+		/* only the root cell has the trace buffers mapped */
+		if (cpu_data->cell != &root_cell)
+			return -EPERM;
+		if (!per_cpu(cpu_id)->trace_buffer)
+			return -ENOENT;
+		return paging_hvirt2phys(per_cpu(cpu_id)->trace_buffer) >>
+			PAGE_SHIFT;
 	} else if (type >= JAILHOUSE_CPU_INFO_STAT_BASE &&
 		type - JAILHOUSE_CPU_INFO_STAT_BASE < JAILHOUSE_NUM_CPU_STATS) {
 		type -= JAILHOUSE_CPU_INFO_STAT_BASE;
@@ -765,6 +1924,119 @@ static int cpu_get_info(struct per_cpu *cpu_data, unsigned long cpu_id,
 		return -EINVAL;
 }
 
+static int cell_get_stats(struct per_cpu *cpu_data, unsigned long id,
+			  unsigned long stats_address)
+{
+	unsigned long page_offs = stats_address & ~PAGE_MASK;
+	unsigned int cpu, n;
+	struct cell *cell;
+	u64 *stats;
+
+	if (cpu_data->cell != &root_cell)
+		return -EPERM;
+
+	/*
+	 * We do not need explicit synchronization with cell_create/destroy
+	 * because their cell_suspend(root_cell) will not return before we left
+	 * this hypercall.
+	 */
+	for_each_cell(cell)
+		if (cell->id == id)
+			break;
+	if (!cell)
+		return -ENOENT;
+
+	stats = paging_get_guest_pages(NULL, stats_address,
+				       PAGES(page_offs + sizeof(u64) *
+					     JAILHOUSE_NUM_CPU_STATS),
+				       PAGE_DEFAULT_FLAGS);
+	if (!stats)
+		return -ENOMEM;
+	stats = (void *)stats + page_offs;
+
+	for (n = 0; n < JAILHOUSE_FIRST_CELL_STAT; n++) {
+		stats[n] = 0;
+		for_each_cpu(cpu, cell->cpu_set)
+			stats[n] += per_cpu(cpu)->stats[n];
+	}
+	for (; n < JAILHOUSE_NUM_CPU_STATS; n++)
+		stats[n] = 0;
+	arch_cell_sample_stats(cell, stats);
+
+	return JAILHOUSE_NUM_CPU_STATS;
+}
+
+static long cell_get_stats_page(struct per_cpu *cpu_data, unsigned long id)
+{
+	struct cell *cell;
+
+	if (cpu_data->cell != &root_cell)
+		return -EPERM;
+
+	/* See cell_get_stats for synchronization with cell_create/destroy. */
+	for_each_cell(cell)
+		if (cell->id == id)
+			return paging_hvirt2phys(cell->stats_page) >> PAGE_SHIFT;
+
+	return -ENOENT;
+}
+
+static long cell_get_comm_page(struct per_cpu *cpu_data, unsigned long id)
+{
+	struct cell *cell;
+
+	if (cpu_data->cell != &root_cell)
+		return -EPERM;
+
+	/* only the pages of non-root cells are mapped into the root cell */
+	for_each_non_root_cell(cell)
+		if (cell->id == id)
+			return paging_hvirt2phys(&cell->comm_page) >>
+				PAGE_SHIFT;
+
+	return -ENOENT;
+}
+
+#ifdef CONFIG_EXIT_LATENCY_HISTOGRAMS
+static int cell_get_exit_latency(struct per_cpu *cpu_data, unsigned long id,
+				 unsigned long histo_address)
+{
+	unsigned long page_offs = histo_address & ~PAGE_MASK;
+	unsigned int cpu, n, bucket;
+	struct cell *cell;
+	u64 (*histo)[JAILHOUSE_EXIT_LATENCY_BUCKETS];
+
+	if (cpu_data->cell != &root_cell)
+		return -EPERM;
+
+	/* See cell_get_stats for synchronization with cell_create/destroy. */
+	for_each_cell(cell)
+		if (cell->id == id)
+			break;
+	if (!cell)
+		return -ENOENT;
+
+	histo = paging_get_guest_pages(NULL, histo_address,
+				       PAGES(page_offs + sizeof(*histo) *
+					     JAILHOUSE_NUM_CPU_STATS),
+				       PAGE_DEFAULT_FLAGS);
+	if (!histo)
+		return -ENOMEM;
+	histo = (void *)histo + page_offs;
+
+	for (n = 0; n < JAILHOUSE_NUM_CPU_STATS; n++)
+		for (bucket = 0; bucket < JAILHOUSE_EXIT_LATENCY_BUCKETS;
+		     bucket++) {
+			histo[n][bucket] = 0;
+			for_each_cpu(cpu, cell->cpu_set)
+				histo[n][bucket] +=
+					per_cpu(cpu)->exit_latency[n][bucket];
+		}
+
+	return JAILHOUSE_NUM_CPU_STATS;
+}
+#endif
+
 /**
  * Handle hypercall invoked by a cell.
  * @param code		Hypercall code.
@@ -775,9 +2047,39 @@ static int cpu_get_info(struct per_cpu *cpu_data, unsigned long cpu_id,
  *
  * @note If @c arg1 and @c arg2 are valid depends on the hypercall code.
  */
+static long cell_management(struct per_cpu *cpu_data, unsigned long code,
+			    unsigned long arg1, unsigned long arg2)
+{
+	switch (code) {
+	case JAILHOUSE_HC_CELL_CREATE:
+		return cell_create(cpu_data, arg1);
+	case JAILHOUSE_HC_CELL_START:
+		return cell_start(cpu_data, arg1);
+	case JAILHOUSE_HC_CELL_START_MULTI:
+		return cell_start_multi(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_CELL_SET_LOADABLE:
+		return cell_set_loadable(cpu_data, arg1);
+	case JAILHOUSE_HC_CELL_ADD_CPU:
+		return cell_move_cpu(cpu_data, arg1, arg2, true);
+	case JAILHOUSE_HC_CELL_REMOVE_CPU:
+		return cell_move_cpu(cpu_data, arg1, arg2, false);
+	case JAILHOUSE_HC_CELL_ADD_MEMORY:
+		return cell_set_memory(cpu_data, arg1, arg2, true);
+	case JAILHOUSE_HC_CELL_REMOVE_MEMORY:
+		return cell_set_memory(cpu_data, arg1, arg2, false);
+	case JAILHOUSE_HC_CELL_DESTROY:
+		return cell_destroy(cpu_data, arg1);
+	case JAILHOUSE_HC_CELL_SET_CACHE:
+		return cell_set_cache(cpu_data, arg1, arg2);
+	default:
+		return -ENOSYS;
+	}
+}
+
 long hypercall(unsigned long code, unsigned long arg1, unsigned long arg2)
 {
 	struct per_cpu *cpu_data = this_cpu_data();
+	long ret;
 
 	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL]++;
 
@@ -785,19 +2087,40 @@ long hypercall(unsigned long code, unsigned long arg1, unsigned long arg2)
 	case JAILHOUSE_HC_DISABLE:
 		return shutdown(cpu_data);
 	case JAILHOUSE_HC_CELL_CREATE:
-		return cell_create(cpu_data, arg1);
 	case JAILHOUSE_HC_CELL_START:
-		return cell_start(cpu_data, arg1);
+	case JAILHOUSE_HC_CELL_START_MULTI:
 	case JAILHOUSE_HC_CELL_SET_LOADABLE:
-		return cell_set_loadable(cpu_data, arg1);
+	case JAILHOUSE_HC_CELL_ADD_CPU:
+	case JAILHOUSE_HC_CELL_REMOVE_CPU:
+	case JAILHOUSE_HC_CELL_ADD_MEMORY:
+	case JAILHOUSE_HC_CELL_REMOVE_MEMORY:
 	case JAILHOUSE_HC_CELL_DESTROY:
-		return cell_destroy(cpu_data, arg1);
+	case JAILHOUSE_HC_CELL_SET_CACHE:
+		if (test_and_set_bit(0, &management_busy))
+			return -EBUSY;
+		ret = cell_management(cpu_data, code, arg1, arg2);
+		clear_bit(0, &management_busy);
+		return ret;
+	case JAILHOUSE_HC_IRQCHIP_SET_MASK:
+		return arch_irqchip_set_mask(cpu_data->cell,
+				JAILHOUSE_IRQCHIP_PINS_ARG_CHIP(arg1),
+				JAILHOUSE_IRQCHIP_PINS_ARG_PINS(arg1), arg2);
 	case JAILHOUSE_HC_HYPERVISOR_GET_INFO:
 		return hypervisor_get_info(cpu_data, arg1);
 	case JAILHOUSE_HC_CELL_GET_STATE:
 		return cell_get_state(cpu_data, arg1);
 	case JAILHOUSE_HC_CPU_GET_INFO:
 		return cpu_get_info(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_CELL_GET_STATS:
+		return cell_get_stats(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_CELL_GET_STATS_PAGE:
+		return cell_get_stats_page(cpu_data, arg1);
+	case JAILHOUSE_HC_CELL_GET_COMM_PAGE:
+		return cell_get_comm_page(cpu_data, arg1);
+#ifdef CONFIG_EXIT_LATENCY_HISTOGRAMS
+	case JAILHOUSE_HC_CELL_GET_EXIT_LATENCY:
+		return cell_get_exit_latency(cpu_data, arg1, arg2);
+#endif
 	default:
 		return -ENOSYS;
 	}
@@ -849,8 +2172,9 @@ void panic_park(void)
 			cell_failed = false;
 			break;
 		}
+	root_event(JAILHOUSE_EVENT_CPU_FAILED);
 	if (cell_failed)
-		cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_FAILED;
+		cell_set_failed(cell);
 
 	arch_panic_park();
 
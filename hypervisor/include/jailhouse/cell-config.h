@@ -42,9 +42,27 @@
 #define JAILHOUSE_CELL_NAME_MAXLEN	31
 
 #define JAILHOUSE_CELL_PASSIVE_COMMREG	0x00000001
+/** Let the devices of the root cell bypass DMA translation (x86 only). They
+ * can then reach all physical memory, including that of other cells, so
+ * this is only suitable for platforms whose root cell devices are trusted.
+ * Not permitted for non-root cells. */
+#define JAILHOUSE_CELL_IOMMU_PASSTHROUGH	0x00000002
+/** Let VT-d use the EPT of the cell for DMA translation if the DMAR units
+ * permit (x86 only). The cell's devices can then reach all of its memory
+ * regions, not only those flagged JAILHOUSE_MEM_DMA. */
+#define JAILHOUSE_CELL_IOMMU_SHARE_PT		0x00000004
 
 #define JAILHOUSE_CELL_DESC_SIGNATURE	"JAILCELL"
 
+/* VM exit classes with a rate limit, JAILHOUSE_CPU_STAT_VMEXITS_TOTAL to
+ * JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL */
+#define JAILHOUSE_EXIT_RATE_CLASSES	4
+
+/* Actions on exceeding an exit rate limit */
+#define JAILHOUSE_EXIT_RATE_WARN	0
+#define JAILHOUSE_EXIT_RATE_THROTTLE	1
+#define JAILHOUSE_EXIT_RATE_FAIL	2
+
 struct jailhouse_cell_desc {
 	char signature[8];
 	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
@@ -57,6 +75,22 @@ struct jailhouse_cell_desc {
 	__u32 pio_bitmap_size;
 	__u32 num_pci_devices;
 	__u32 num_pci_caps;
+	__u32 num_msrs;
+
+	/** Bounds for the performance levels (P-state ratios, HWP
+	 * performance) the cell may request, x86 only. If perf_max is 0,
+	 * requests are not mediated. */
+	__u8 perf_min;
+	__u8 perf_max;
+
+	/** Number of SMMU stream IDs of the cell's DMA masters, ARM only. */
+	__u32 num_stream_ids;
+
+	/** VM exits per second each CPU of the cell may cause, indexed by
+	 * JAILHOUSE_CPU_STAT_VMEXITS_*. 0 means no limit. */
+	__u32 exit_rate_limits[JAILHOUSE_EXIT_RATE_CLASSES];
+	/** Action on exceeding a limit, JAILHOUSE_EXIT_RATE_*. */
+	__u32 exit_rate_action;
 } __attribute__((packed));
 
 #define JAILHOUSE_MEM_READ		0x0001
@@ -68,11 +102,37 @@ struct jailhouse_cell_desc {
 #define JAILHOUSE_MEM_LOADABLE		0x0040
 #define JAILHOUSE_MEM_ROOTSHARED	0x0080
 #define JAILHOUSE_MEM_IO_UNALIGNED	0x0100
+/* Require 2M or 1G pages for the region in the cell's paging structures.
+ * Start addresses and size have to be aligned accordingly. */
+#define JAILHOUSE_MEM_HUGE_2M		0x0200
+#define JAILHOUSE_MEM_HUGE_1G		0x4000
+/* Memory type of the region, write-back by default */
+#define JAILHOUSE_MEM_TYPE_MASK		0x1800
+#define JAILHOUSE_MEM_TYPE_WB		0x0000
+#define JAILHOUSE_MEM_TYPE_WC		0x0800
+#define JAILHOUSE_MEM_TYPE_UC		0x1000
+/* Apply the memory type regardless of the guest's own settings (PAT, stage-1
+ * attributes) where the hardware permits, also for I/O regions */
+#define JAILHOUSE_MEM_TYPE_FORCE	0x2000
+/* RAM of a non-root cell that is only assigned on request while the cell
+ * runs, see JAILHOUSE_HC_CELL_ADD_MEMORY. Limited to the first
+ * JAILHOUSE_MEM_HOTPLUG_REGIONS regions of the configuration. */
+#define JAILHOUSE_MEM_HOTPLUG		0x8000
+#define JAILHOUSE_MEM_HOTPLUG_REGIONS	64
+/* debug_console only: write to the console ring, let the driver drain it */
+#define JAILHOUSE_CON_DEFERRED		0x0200
+/* cell memory only: console ring of the cell, drained by the driver */
+#define JAILHOUSE_MEM_CONSOLE		0x0400
 #define JAILHOUSE_MEM_IO_WIDTH_SHIFT	16 /* uses bits 8..11 */
 #define JAILHOUSE_MEM_IO_8		(1 << JAILHOUSE_MEM_IO_WIDTH_SHIFT)
 #define JAILHOUSE_MEM_IO_16		(2 << JAILHOUSE_MEM_IO_WIDTH_SHIFT)
 #define JAILHOUSE_MEM_IO_32		(4 << JAILHOUSE_MEM_IO_WIDTH_SHIFT)
 #define JAILHOUSE_MEM_IO_64		(8 << JAILHOUSE_MEM_IO_WIDTH_SHIFT)
+/*
+ * sub-page regions only: writes may be delayed and are performed in order
+ * before the next other trapped MMIO access of the cell, see hypervisor/mmio.c
+ */
+#define JAILHOUSE_MEM_IO_COALESCED	0x00100000
 
 struct jailhouse_memory {
 	__u64 phys_start;
@@ -88,6 +148,7 @@ struct jailhouse_memory {
 #define JAILHOUSE_CACHE_L3_DATA		0x02
 #define JAILHOUSE_CACHE_L3		(JAILHOUSE_CACHE_L3_CODE | \
 					 JAILHOUSE_CACHE_L3_DATA)
+#define JAILHOUSE_CACHE_L2		0x04
 
 #define JAILHOUSE_CACHE_ROOTSHARED	0x0001
 
@@ -95,7 +156,9 @@ struct jailhouse_cache {
 	__u32 start;
 	__u32 size;
 	__u8 type;
-	__u8 padding;
+	/** Limit for the memory bandwidth of the cell in percent, 0 for no
+	 * limit. Only effective with Intel MBA. */
+	__u8 mem_bandwidth;
 	__u16 flags;
 } __attribute__((packed));
 
@@ -125,8 +188,23 @@ struct jailhouse_pci_device {
 	__u64 msix_address;
 	/** used to refer to memory in virtual PCI devices */
 	__u32 shmem_region;
+	/** protocol spoken over an ivshmem device, see
+	 * JAILHOUSE_SHMEM_PROTO_* */
+	__u16 shmem_protocol;
 } __attribute__((packed));
 
+/*
+ * Protocols of ivshmem devices, reported to the cell via the PCI class code
+ * 0xff<protocol>. Undefined links keep the class of a memory controller. For
+ * virtio, the virtio device ID is added to the front-end or back-end value.
+ */
+#define JAILHOUSE_SHMEM_PROTO_UNDEFINED		0x0000
+#define JAILHOUSE_SHMEM_PROTO_VETH		0x0001
+#define JAILHOUSE_SHMEM_PROTO_CONSOLE		0x0002
+#define JAILHOUSE_SHMEM_PROTO_EVENTS		0x0003
+#define JAILHOUSE_SHMEM_PROTO_VIRTIO_FRONT	0x8000
+#define JAILHOUSE_SHMEM_PROTO_VIRTIO_BACK	0xc000
+
 #define JAILHOUSE_PCI_EXT_CAP		0x8000
 
 #define JAILHOUSE_PCICAPS_WRITE		0x0001
@@ -138,6 +216,20 @@ struct jailhouse_pci_capability {
 	__u16 flags;
 } __attribute__((packed));
 
+#define JAILHOUSE_MSR_READ		0x0001
+#define JAILHOUSE_MSR_WRITE		0x0002
+
+/**
+ * Range of MSRs the cell may access directly (x86 only). If a cell lists
+ * any, all other MSRs are intercepted. MSRs the hypervisor has to emulate
+ * remain intercepted regardless of this list.
+ */
+struct jailhouse_msr_range {
+	__u32 start;
+	__u32 num;
+	__u32 flags;
+} __attribute__((packed));
+
 #define JAILHOUSE_MAX_IOMMU_UNITS	8
 
 struct jailhouse_iommu {
@@ -149,6 +241,22 @@ struct jailhouse_iommu {
 	__u32 amd_features;
 } __attribute__((packed));
 
+#define JAILHOUSE_MAX_MEMORY_NODES	4
+#define JAILHOUSE_MEMORY_NODE_CPUS	256
+
+/**
+ * Additional hypervisor memory attached to a NUMA node. Like
+ * jailhouse_system::hypervisor_memory, it must be excluded from the memory
+ * of all cells. Data structures of cells whose first CPU is listed in
+ * cpu_set are allocated from it. Unused entries have a size of 0.
+ */
+struct jailhouse_memory_node {
+	__u64 phys_start;
+	__u64 size;
+	/** Bit n of byte m is set if CPU m * 8 + n belongs to the node. */
+	__u8 cpu_set[JAILHOUSE_MEMORY_NODE_CPUS / 8];
+} __attribute__((packed));
+
 #define JAILHOUSE_SYSTEM_SIGNATURE	"JAILSYST"
 
 struct jailhouse_system {
@@ -159,13 +267,26 @@ struct jailhouse_system {
 		struct {
 			__u64 mmconfig_base;
 			__u8 mmconfig_end_bus;
-			__u8 padding[5];
+			__u8 padding;
+			/** Number of changed pages above which IOMMU
+			 * invalidations fall back to flushing the whole
+			 * domain. 0 selects the hypervisor default. */
+			__u32 iommu_inv_threshold;
 			__u16 pm_timer_address;
 			struct jailhouse_iommu
 				iommu_units[JAILHOUSE_MAX_IOMMU_UNITS];
 		} __attribute__((packed)) x86;
 	} __attribute__((packed)) platform_info;
 	__u32 interrupt_limit;
+	struct jailhouse_memory_node memory_nodes[JAILHOUSE_MAX_MEMORY_NODES];
+	/** Pages of the temporary mapping window of each CPU, bounding the
+	 * size of cell configurations. 0 selects a window that can take a
+	 * configuration as large as this one. */
+	__u32 temporary_pages;
+	/** Pages of the remapping region, including the temporary windows.
+	 * 0 selects the architecture default, grown by the temporary windows
+	 * beyond their default size. */
+	__u32 remap_pages;
 	struct jailhouse_cell_desc root_cell;
 } __attribute__((packed));
 
@@ -179,7 +300,9 @@ jailhouse_cell_config_size(struct jailhouse_cell_desc *cell)
 		cell->num_irqchips * sizeof(struct jailhouse_irqchip) +
 		cell->pio_bitmap_size +
 		cell->num_pci_devices * sizeof(struct jailhouse_pci_device) +
-		cell->num_pci_caps * sizeof(struct jailhouse_pci_capability);
+		cell->num_pci_caps * sizeof(struct jailhouse_pci_capability) +
+		cell->num_msrs * sizeof(struct jailhouse_msr_range) +
+		cell->num_stream_ids * sizeof(__u32);
 }
 
 static inline __u32
@@ -242,4 +365,19 @@ jailhouse_cell_pci_caps(const struct jailhouse_cell_desc *cell)
 		 cell->num_pci_devices * sizeof(struct jailhouse_pci_device));
 }
 
+static inline const struct jailhouse_msr_range *
+jailhouse_cell_msr_ranges(const struct jailhouse_cell_desc *cell)
+{
+	return (const struct jailhouse_msr_range *)
+		((void *)jailhouse_cell_pci_caps(cell) +
+		 cell->num_pci_caps * sizeof(struct jailhouse_pci_capability));
+}
+
+static inline const __u32 *
+jailhouse_cell_stream_ids(const struct jailhouse_cell_desc *cell)
+{
+	return (const __u32 *)((void *)jailhouse_cell_msr_ranges(cell) +
+		cell->num_msrs * sizeof(struct jailhouse_msr_range));
+}
+
 #endif /* !_JAILHOUSE_CELL_CONFIG_H */
@@ -22,15 +22,47 @@
 #include <jailhouse/cell-config.h>
 #include <jailhouse/hypercall.h>
 
+/**
+ * Sections of a cell configuration, resolved once by cell_init so that hot
+ * paths do not have to sum up the sizes of all preceding sections.
+ */
+struct cell_config_sections {
+	/** Memory regions. */
+	const struct jailhouse_memory *mem_regions;
+	/** Cache regions. */
+	const struct jailhouse_cache *cache_regions;
+	/** Interrupt chips. */
+	const struct jailhouse_irqchip *irqchips;
+	/** PIO access bitmap. */
+	const u8 *pio_bitmap;
+	/** PCI devices. */
+	const struct jailhouse_pci_device *pci_devices;
+	/** PCI capabilities. */
+	const struct jailhouse_pci_capability *pci_caps;
+	/** MSR ranges. */
+	const struct jailhouse_msr_range *msr_ranges;
+	/** Stream IDs. */
+	const u32 *stream_ids;
+};
+
 /** Cell-related states. */
 struct cell {
-	union {
-		/** Communication region. */
-		struct jailhouse_comm_region comm_region;
-		/** Padding to full page size. */
-		u8 padding[PAGE_SIZE];
+	struct {
+		union {
+			/** Communication region. */
+			struct jailhouse_comm_region comm_region;
+			/** Padding to full page size. */
+			u8 padding[PAGE_SIZE];
+		};
+		union {
+			/** Extension area, also writable by the root cell. */
+			struct jailhouse_comm_ext comm_ext;
+			/** Padding to full page size. */
+			u8 ext_padding[PAGE_SIZE];
+		};
 	} __attribute__((aligned(PAGE_SIZE))) comm_page;
-	/**< Page containing the communication region (shared with cell). */
+	/**< Pages containing the communication region and its extension area
+	 * (shared with cell). */
 
 	/** Architecture-specific fields. */
 	struct arch_cell arch;
@@ -40,8 +72,13 @@ struct cell {
 	/** Number of pages used for storing cell-specific states and
 	 * configuration data. */
 	unsigned int data_pages;
+	/** Number of hypervisor pages allocated on behalf of the cell, see
+	 * paging_charge_cell. */
+	unsigned long hv_pages;
 	/** Pointer to static cell description. */
 	struct jailhouse_cell_desc *config;
+	/** Sections of @c config. */
+	struct cell_config_sections cfg;
 
 	/** Pointer to cell's CPU set. */
 	struct cpu_set *cpu_set;
@@ -50,24 +87,75 @@ struct cell {
 
 	/** True while the cell can be loaded by the root cell. */
 	bool loadable;
+	/** Hot-pluggable memory regions currently assigned to the cell, one
+	 * bit per region index. */
+	u64 mem_hotplug_present;
+	/** True if the memory mappings of the cell changed since the last
+	 * config_commit, i.e. its vCPU caches need to be flushed. */
+	bool vcpu_caches_dirty;
+
+	/** Statistics page, mapped read-only into the root cell. */
+	struct jailhouse_cpu_stats *stats_page;
+	/** Number of entries in @c stats_page. */
+	unsigned int num_stats_slots;
+
+	/** Watchdog timeout in cycles as latched from the communication
+	 * region, 0 while disarmed. */
+	u64 watchdog_timeout;
+	/** Heartbeat value seen by the last watchdog check. */
+	u64 watchdog_heartbeat;
+	/** Cycle counter value when the heartbeat last changed. */
+	u64 watchdog_last_beat;
+	/** Cell state last reported to the root cell. */
+	u32 reported_state;
+
+	/** VM exits allowed per CPU within CONFIG_EXIT_RATE_WINDOW_MS,
+	 * indexed by JAILHOUSE_CPU_STAT_VMEXITS_*, 0 if unlimited. */
+	u64 exit_rate_budget[JAILHOUSE_EXIT_RATE_CLASSES];
+	/** True if any of @c exit_rate_budget is set. */
+	bool exit_rate_limited;
 
 	/** Pointer to next cell in the system. */
 	struct cell *next;
 
 	/** List of PCI devices assigned to this cell. */
 	struct pci_device *pci_devices;
+	/** Two-level BDF lookup table for @c pci_devices.
+	 * @see pci_get_assigned_device */
+	u16 *pci_lookup;
+	/** Number of pages used by @c pci_lookup. */
+	unsigned int pci_lookup_pages;
 
-	/** Lock protecting changes to mmio_locations, mmio_handlers, and
-	 * num_mmio_regions. */
+	/** Lock protecting changes to mmio_locations, mmio_handlers,
+	 * num_mmio_regions, and mmio_generation. */
 	spinlock_t mmio_region_lock;
 	/** MMIO region description table. */
 	struct mmio_region_location *mmio_locations;
 	/** MMIO region handler table. */
 	struct mmio_region_handler *mmio_handlers;
+	/** Sub-page region descriptors, @c max_mmio_regions entries. */
+	struct mmio_subpage *mmio_subpages;
+	/** Start addresses of the MMIO regions in Eytzinger order, starting
+	 * at element 1. @c NULL if the cell has no search index. */
+	unsigned long *mmio_index_starts;
+	/** Position of each @c mmio_index_starts element in
+	 * @c mmio_locations. */
+	unsigned int *mmio_index_regions;
+	/** Number of regions covered by the search index. */
+	unsigned int mmio_index_num;
+	/** Regions of hypervisor-emulated devices, checked before
+	 * @c mmio_locations. */
+	struct mmio_fast_region mmio_fast_regions[MMIO_FAST_SLOTS];
+	/** Buffer of coalesced MMIO writes, @c NULL if the cell has no
+	 * region with JAILHOUSE_MEM_IO_COALESCED. */
+	struct mmio_coalesced_ring *mmio_coalesced;
 	/** Number of MMIO regions in use. */
 	unsigned int num_mmio_regions;
 	/** Maximum number of MMIO regions. */
 	unsigned int max_mmio_regions;
+	/** Generation of the MMIO region table, incremented on each change.
+	 * Used to invalidate per-CPU lookup caches. */
+	volatile unsigned int mmio_generation;
 };
 
 extern struct cell root_cell;
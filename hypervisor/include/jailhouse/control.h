@@ -12,8 +12,10 @@
 
 #include <asm/bitops.h>
 #include <asm/percpu.h>
+#include <asm/processor.h>
 #include <jailhouse/cell.h>
 #include <jailhouse/cell-config.h>
+#include <jailhouse/utils.h>
 
 #define SHUTDOWN_NONE			0
 #define SHUTDOWN_STARTED		1
@@ -30,6 +32,14 @@
 
 extern struct jailhouse_system *system_config;
 
+/** Event page, kept separate from other hypervisor data. */
+union events_page {
+	struct jailhouse_events events;
+	u8 padding[PAGE_SIZE];
+};
+
+extern union events_page events_page;
+
 unsigned int next_cpu(unsigned int cpu, struct cpu_set *cpu_set,
 		      int exception);
 
@@ -105,6 +115,22 @@ unsigned int next_cpu(unsigned int cpu, struct cpu_set *cpu_set,
 	     (counter) < (config)->num_memory_regions;			\
 	     (mem)++, (counter)++)
 
+/**
+ * Check if a memory region of the cell configuration is assigned to the cell.
+ * @param cell		Cell the region belongs to.
+ * @param mem		Memory region of the cell configuration.
+ *
+ * @return False for a hot-pluggable region that is currently not added.
+ */
+static inline bool cell_mem_region_present(struct cell *cell,
+					   const struct jailhouse_memory *mem)
+{
+	unsigned int index = mem - cell->cfg.mem_regions;
+
+	return !(mem->flags & JAILHOUSE_MEM_HOTPLUG) ||
+		(cell->mem_hotplug_present & (1ULL << index));
+}
+
 /**
  * Check if the CPU is assigned to the specified cell.
  * @param cell		Cell the CPU may belong to.
@@ -122,12 +148,49 @@ bool cpu_id_valid(unsigned long cpu_id);
 
 int cell_init(struct cell *cell);
 
+int cell_stats_map(struct cell *cell);
+void cpu_stats_publish(struct per_cpu *cpu_data);
+u64 cell_watchdog_check(struct per_cpu *cpu_data);
+u64 cell_exit_rate_check(struct per_cpu *cpu_data);
+void clock_init(void);
+void root_event(unsigned int type);
+bool root_iommu_fault(unsigned int unit, u16 device_id, u32 reason, u64 info);
+
+#ifdef CONFIG_EXIT_LATENCY_HISTOGRAMS
+/**
+ * Record the beginning of a VM exit for latency accounting.
+ * @param cpu_data	Data structure of the calling CPU.
+ *
+ * @see exit_latency_account
+ */
+static inline void exit_latency_start(struct per_cpu *cpu_data)
+{
+	cpu_data->exit_start = get_cycles();
+}
+
+int exit_latency_cpu_init(struct per_cpu *cpu_data);
+void exit_latency_account(struct per_cpu *cpu_data);
+#else
+static inline int exit_latency_cpu_init(struct per_cpu *cpu_data)
+{
+	return 0;
+}
+
+static inline void exit_latency_start(struct per_cpu *cpu_data)
+{
+}
+
+static inline void exit_latency_account(struct per_cpu *cpu_data)
+{
+}
+#endif
+
 void config_commit(struct cell *cell_added_removed);
 
 long hypercall(unsigned long code, unsigned long arg1, unsigned long arg2);
 
-void __attribute__((noreturn)) panic_stop(void);
-void panic_park(void);
+void __attribute__((noreturn)) __cold panic_stop(void);
+void __cold panic_park(void);
 
 /**
  * Suspend a remote CPU.
@@ -150,6 +213,59 @@ void panic_park(void);
  */
 void arch_suspend_cpu(unsigned int cpu_id);
 
+/**
+ * Notify a cell about a new message in its communication region.
+ * @param cell		Target cell.
+ * @param id		Architecture-specific interrupt ID the cell registered
+ * 			in the doorbell field of its communication region.
+ *
+ * Invalid IDs are ignored, the cell then has to poll for messages.
+ */
+void arch_send_msg_doorbell(struct cell *cell, unsigned int id);
+
+/**
+ * Interrupt the root cell about a new event in the event page.
+ *
+ * Does nothing if the root cell provides no receiver for the interrupt, it
+ * then has to poll the event page.
+ *
+ * @see root_event
+ */
+void arch_notify_root(void);
+
+/**
+ * Get the rate of the counter read by get_cycles().
+ *
+ * @return Rate in kHz, 0 if unknown.
+ */
+unsigned long arch_get_cycles_khz(void);
+
+/**
+ * Request the suspension of a remote CPU without waiting for it.
+ * @param cpu_id	ID of the target CPU.
+ *
+ * Performs the signalling part of arch_suspend_cpu(). This allows to suspend
+ * a set of CPUs in parallel by requesting the suspension of all of them
+ * first and then calling arch_wait_cpu_suspended() for each.
+ *
+ * @note This function must not be invoked for the caller's CPU.
+ *
+ * @see arch_suspend_cpu
+ * @see arch_wait_cpu_suspended
+ */
+void arch_request_cpu_suspend(unsigned int cpu_id);
+
+/**
+ * Wait for a remote CPU to enter suspended state.
+ * @param cpu_id	ID of the target CPU.
+ *
+ * @note The suspension must have been requested via
+ * arch_request_cpu_suspend() before.
+ *
+ * @see arch_request_cpu_suspend
+ */
+void arch_wait_cpu_suspended(unsigned int cpu_id);
+
 /**
  * Resume a suspended remote CPU.
  * @param cpu_id	ID of the target CPU.
@@ -263,6 +379,73 @@ int arch_cell_create(struct cell *cell);
  */
 void arch_cell_destroy(struct cell *cell);
 
+/**
+ * Performs the architecture-specific steps for handing a CPU over to a
+ * non-root cell that may already be running.
+ * @param cell		Cell that received the CPU.
+ * @param cpu_id	ID of the CPU. It is parked and already assigned to
+ * 			@c cell.
+ *
+ * @see arch_cell_remove_cpu
+ */
+void arch_cell_add_cpu(struct cell *cell, unsigned int cpu_id);
+
+/**
+ * Performs the architecture-specific steps for returning a CPU of a
+ * non-root cell to the root cell.
+ * @param cell		Cell that lost the CPU.
+ * @param cpu_id	ID of the CPU. It is parked and already assigned to
+ * 			the root cell.
+ *
+ * @see arch_cell_add_cpu
+ */
+void arch_cell_remove_cpu(struct cell *cell, unsigned int cpu_id);
+
+/**
+ * Performs the architecture-specific steps for resetting a cell before it is
+ * (re-)started, keeping its memory mappings and device assignments.
+ * @param cell		Cell to be reset.
+ */
+void arch_cell_reset(struct cell *cell);
+
+/**
+ * Performs the architecture-specific steps for changing the cache partition
+ * of a cell at runtime.
+ * @param cell		Cell to be reconfigured.
+ * @param start		First cache partitioning unit of the new partition.
+ * @param size		Size of the new partition in partitioning units.
+ *
+ * @return 0 on success, negative error code otherwise.
+ *
+ * @note The root cell and the target cell have to be suspended.
+ */
+int arch_cell_set_cache(struct cell *cell, unsigned int start,
+			unsigned int size);
+
+/**
+ * Samples the architecture-specific statistics that are maintained per cell
+ * rather than per CPU.
+ * @param cell		Cell to be queried.
+ * @param stats		Statistics array, indexed by JAILHOUSE_CPU_STAT_*.
+ *			Entries from JAILHOUSE_FIRST_CELL_STAT on are filled.
+ *
+ * @note Only called on root cell CPUs.
+ */
+void arch_cell_sample_stats(struct cell *cell, u64 *stats);
+
+/**
+ * Masks and unmasks a set of interrupt controller pins of the calling cell
+ * with a single request.
+ * @param cell		Calling cell.
+ * @param chip		Index of the irqchip in the cell configuration.
+ * @param pins		Bitmap of the pins to be updated.
+ * @param mask		Bitmap of the new mask states, set bits mask the pin.
+ *
+ * @return 0 on success, negative error code otherwise.
+ */
+int arch_irqchip_set_mask(struct cell *cell, unsigned int chip,
+			  unsigned long pins, unsigned long mask);
+
 /**
  * Performs the architecture-specific steps for applying configuration changes.
  * @param cell_added_removed	Cell that was added or removed to/from the
@@ -276,7 +459,7 @@ void arch_config_commit(struct cell *cell_added_removed);
 /**
  * Shutdown architecture-specific subsystems while disabling the hypervisor.
  */
-void arch_shutdown(void);
+void __cold arch_shutdown(void);
 
 /**
  * Performs the architecture-specifc steps to stop the current CPU on panic.
@@ -285,7 +468,7 @@ void arch_shutdown(void);
  *
  * @see panic_stop
  */
-void __attribute__((noreturn)) arch_panic_stop(void);
+void __attribute__((noreturn)) __cold arch_panic_stop(void);
 
 /**
  * Performs the architecture-specific steps to park the current CPU on panic.
@@ -295,6 +478,6 @@ void __attribute__((noreturn)) arch_panic_stop(void);
  *
  * @see panic_park
  */
-void arch_panic_park(void);
+void __cold arch_panic_park(void);
 
 /** @} */
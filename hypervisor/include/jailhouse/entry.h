@@ -15,6 +15,7 @@
 
 #include <jailhouse/header.h>
 #include <jailhouse/types.h>
+#include <jailhouse/utils.h>
 
 #include <jailhouse/cell-config.h>
 
@@ -43,6 +44,9 @@ struct cell;
 
 extern struct jailhouse_header hypervisor_header;
 
+/** Zero page backing the hypervisor memory in the root cell (read-only). */
+extern const u8 empty_page[];
+
 /**
  * Architecture-specific entry point for enabling the hypervisor.
  * @param cpu_id	Logical ID of the calling CPU.
@@ -74,7 +78,7 @@ int arch_entry(unsigned int cpu_id);
  *
  * @see arch_entry
  */
-int entry(unsigned int cpu_id, struct per_cpu *cpu_data);
+int __cold entry(unsigned int cpu_id, struct per_cpu *cpu_data);
 
 /**
  * Map the root cell's memory regions.
@@ -83,7 +87,7 @@ int entry(unsigned int cpu_id, struct per_cpu *cpu_data);
  *
  * Invoked by the architecture-specific setup code.
  */
-int map_root_memory_regions(void);
+int __cold map_root_memory_regions(void);
 
 /**
  * Perform architecture-specific early setup steps.
@@ -93,7 +97,7 @@ int map_root_memory_regions(void);
  * @note This is called over the master CPU that performs CPU-unrelated setup
  * steps.
  */
-int arch_init_early(void);
+int __cold arch_init_early(void);
 
 /**
  * Perform architecture-specific CPU setup steps.
@@ -101,7 +105,7 @@ int arch_init_early(void);
  *
  * @return 0 on success, negative error code otherwise.
  */
-int arch_cpu_init(struct per_cpu *cpu_data);
+int __cold arch_cpu_init(struct per_cpu *cpu_data);
 
 /**
  * Perform architecture-specific late setup steps.
@@ -111,7 +115,7 @@ int arch_cpu_init(struct per_cpu *cpu_data);
  * @note This is called over the master CPU that performs CPU-unrelated setup
  * steps.
  */
-int arch_init_late(void);
+int __cold arch_init_late(void);
 
 /**
  * Perform architecture-specific activation of the hypervisor mode.
@@ -131,7 +135,7 @@ void __attribute__((noreturn)) arch_cpu_activate_vmm(struct per_cpu *cpu_data);
  * @note Depending on the architectural implementation, this function may not
  * return to the caller but rather jump to the target Linux context.
  */
-void arch_cpu_restore(struct per_cpu *cpu_data, int return_code);
+void __cold arch_cpu_restore(struct per_cpu *cpu_data, int return_code);
 
 /** @} */
 #endif /* !_JAILHOUSE_ENTRY_H */
@@ -12,6 +12,23 @@
 
 #define JAILHOUSE_SIGNATURE	"JAILHOUS"
 
+/* sized to make struct jailhouse_console fill two 4K pages */
+#define JAILHOUSE_CONSOLE_SIZE	8184
+
+/**
+ * Ring buffer of hypervisor console output, mapped read-only into the root
+ * cell.
+ */
+struct jailhouse_console {
+	/** Number of characters written so far, free-running. */
+	volatile unsigned int tail;
+	/** \privatesection */
+	unsigned int padding;
+	/** \publicsection */
+	/** Characters, indexed by their number modulo the ring size. */
+	char content[JAILHOUSE_CONSOLE_SIZE];
+};
+
 /**
  * @ingroup Setup
  * @{
@@ -48,4 +65,12 @@ struct jailhouse_header {
 	/** Virtual base address of the debug console device (if used).
 	 * @note Filled by Linux loader driver before entry. */
 	void *debug_console_base;
+	/** Offset of the console ring (struct jailhouse_console) from the
+	 * hypervisor base.
+	 * @note Filled at build time. */
+	unsigned long console_offset;
+	/** Offset of the event page (struct jailhouse_events) from the
+	 * hypervisor base.
+	 * @note Filled at build time. */
+	unsigned long events_offset;
 };
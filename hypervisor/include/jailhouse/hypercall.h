@@ -47,6 +47,30 @@
 #define JAILHOUSE_HC_HYPERVISOR_GET_INFO	5
 #define JAILHOUSE_HC_CELL_GET_STATE		6
 #define JAILHOUSE_HC_CPU_GET_INFO		7
+#define JAILHOUSE_HC_CELL_GET_STATS		8
+#define JAILHOUSE_HC_CELL_GET_STATS_PAGE	9
+#define JAILHOUSE_HC_CELL_GET_EXIT_LATENCY	10
+#define JAILHOUSE_HC_CELL_SET_CACHE		11
+#define JAILHOUSE_HC_IRQCHIP_SET_MASK		12
+#define JAILHOUSE_HC_CELL_START_MULTI		13
+#define JAILHOUSE_HC_CELL_ADD_CPU		14
+#define JAILHOUSE_HC_CELL_REMOVE_CPU		15
+#define JAILHOUSE_HC_CELL_GET_COMM_PAGE		16
+#define JAILHOUSE_HC_CELL_ADD_MEMORY		17
+#define JAILHOUSE_HC_CELL_REMOVE_MEMORY		18
+
+/* Maximum number of cells per JAILHOUSE_HC_CELL_START_MULTI */
+#define JAILHOUSE_CELL_START_MULTI_MAX		64
+
+/* Cache region argument of JAILHOUSE_HC_CELL_SET_CACHE */
+#define JAILHOUSE_CELL_CACHE_ARG(start, size)	(((size) << 16) | (start))
+#define JAILHOUSE_CELL_CACHE_ARG_START(arg)	((arg) & 0xffff)
+#define JAILHOUSE_CELL_CACHE_ARG_SIZE(arg)	(((arg) >> 16) & 0xffff)
+
+/* Pin selection argument of JAILHOUSE_HC_IRQCHIP_SET_MASK */
+#define JAILHOUSE_IRQCHIP_PINS_ARG(chip, pins)	(((chip) << 24) | (pins))
+#define JAILHOUSE_IRQCHIP_PINS_ARG_CHIP(arg)	(((arg) >> 24) & 0xff)
+#define JAILHOUSE_IRQCHIP_PINS_ARG_PINS(arg)	((arg) & 0xffffff)
 
 /* Hypervisor information type */
 #define JAILHOUSE_INFO_MEM_POOL_SIZE		0
@@ -54,9 +78,25 @@
 #define JAILHOUSE_INFO_REMAP_POOL_SIZE		2
 #define JAILHOUSE_INFO_REMAP_POOL_USED		3
 #define JAILHOUSE_INFO_NUM_CELLS		4
+/* + page owner: used pages of the hypervisor memory pools per subsystem */
+#define JAILHOUSE_INFO_PAGES_BASE		100
+/* + cell ID: hypervisor pages accounted to the cell */
+#define JAILHOUSE_INFO_CELL_PAGES_BASE		0x10000
+
+/* Page owners */
+#define JAILHOUSE_PAGES_PAGING			0
+#define JAILHOUSE_PAGES_CELL			1
+#define JAILHOUSE_PAGES_MMIO			2
+#define JAILHOUSE_PAGES_IOMMU			3
+#define JAILHOUSE_PAGES_IRT			4
+#define JAILHOUSE_PAGES_IVSHMEM			5
+#define JAILHOUSE_PAGES_PCI			6
+#define JAILHOUSE_PAGES_OTHER			7
+#define JAILHOUSE_NUM_PAGE_OWNERS		8
 
 /* Hypervisor information type */
 #define JAILHOUSE_CPU_INFO_STATE		0
+#define JAILHOUSE_CPU_INFO_TRACE_BUFFER		1
 #define JAILHOUSE_CPU_INFO_STAT_BASE		1000
 
 /* CPU state */
@@ -68,13 +108,48 @@
 #define JAILHOUSE_CPU_STAT_VMEXITS_MMIO		1
 #define JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT	2
 #define JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL	3
-#define JAILHOUSE_GENERIC_CPU_STATS		4
+#define JAILHOUSE_CPU_STAT_MMIO_CACHE_HITS	4
+#define JAILHOUSE_CPU_STAT_MMIO_CYCLES		5
+#define JAILHOUSE_CPU_STAT_CELL_SUSPENDS	6
+#define JAILHOUSE_CPU_STAT_CELL_SUSPEND_CYCLES	7
+#define JAILHOUSE_CPU_STAT_MMIO_SUBPAGE		8
+#define JAILHOUSE_GENERIC_CPU_STATS		9
+
+/*
+ * Names of the statistics, indexed by JAILHOUSE_CPU_STAT_*. The driver
+ * creates its sysfs attributes from JAILHOUSE_CPU_STAT_NAMES, which the
+ * architecture extends by its own counters.
+ */
+#define JAILHOUSE_GENERIC_CPU_STAT_NAMES				\
+	"vmexits_total", "vmexits_mmio", "vmexits_management",		\
+	"vmexits_hypercall", "mmio_cache_hits", "mmio_cycles",		\
+	"cell_suspends", "cell_suspend_cycles", "mmio_subpage_accesses"
+
+/* log2 buckets of VM exit latency histograms, in units of get_cycles() */
+#define JAILHOUSE_EXIT_LATENCY_BUCKETS		32
+
+/* Trace events */
+#define JAILHOUSE_TRACE_VMEXIT			1 /* arch exit reason */
+#define JAILHOUSE_TRACE_MMIO			2 /* address, size | write */
+#define JAILHOUSE_TRACE_IRQ_INJECT		3 /* IRQ/vector, target */
+#define JAILHOUSE_TRACE_CELL_STATE		4 /* cell ID, new state */
+#define JAILHOUSE_TRACE_CELL_DESTROY		5 /* cell ID */
+#define JAILHOUSE_TRACE_IOMMU_FAULT		6 /* device ID, fault info */
+#define JAILHOUSE_TRACE_PROFILE			7 /* hypervisor PC, timestamp */
+#define JAILHOUSE_TRACE_EXIT_RATE		8 /* cell ID, exit class */
+
+#define JAILHOUSE_TRACE_MMIO_WRITE		0x80000000
+
+#define JAILHOUSE_TRACE_BUFFER_PAGES		4
 
 #define JAILHOUSE_MSG_NONE			0
 
 /* messages to cell */
 #define JAILHOUSE_MSG_SHUTDOWN_REQUEST		1
 #define JAILHOUSE_MSG_RECONFIG_COMPLETED	2
+#define JAILHOUSE_MSG_MEMORY_ADDED		3
+#define JAILHOUSE_MSG_MEMORY_REMOVE_REQUEST	4
+#define JAILHOUSE_MSG_CPU_REMOVE_REQUEST	5
 
 /* replies from cell */
 #define JAILHOUSE_MSG_UNKNOWN			1
@@ -88,6 +163,10 @@
 #define JAILHOUSE_CELL_SHUT_DOWN		2 /* terminal state */
 #define JAILHOUSE_CELL_FAILED			3 /* terminal state */
 
+/* Doorbell of the communication region, the ID is architecture-specific */
+#define JAILHOUSE_MSG_DOORBELL_ENABLE		0x80000000
+#define JAILHOUSE_MSG_DOORBELL_ID(val)		((val) & 0xffff)
+
 #define COMM_REGION_GENERIC_HEADER					\
 	/** Message code sent from hypervisor to cell. */		\
 	volatile __u32 msg_to_cell;					\
@@ -95,10 +174,203 @@
 	volatile __u32 reply_from_cell;					\
 	/** Cell state, initialized by hypervisor, updated by cell. */	\
 	volatile __u32 cell_state;					\
-	/** \privatesection */						\
-	volatile __u32 padding;						\
-	/** \publicsection */
+	/** Interrupt raised on new messages, set by cell. */		\
+	volatile __u32 msg_doorbell;
+
+/* Extension area, in the page following the communication region */
+#define JAILHOUSE_COMM_EXT_OFFSET		0x1000
+#define JAILHOUSE_COMM_MAILBOXES		8
+#define JAILHOUSE_COMM_MAILBOX_SIZE		56
+
+/* Event types reported to the root cell, see struct jailhouse_events */
+#define JAILHOUSE_EVENT_CELL_STATE		0
+#define JAILHOUSE_EVENT_CPU_FAILED		1
+#define JAILHOUSE_EVENT_IOMMU_FAULT		2
+#define JAILHOUSE_EVENT_EXIT_RATE		3
+#define JAILHOUSE_NUM_EVENTS			4
+
+/* IOMMU fault log in the event page, see struct jailhouse_iommu_faults */
+#define JAILHOUSE_IOMMU_FAULT_RECORDS		64
+#define JAILHOUSE_IOMMU_FAULT_DEVICES		32
 
 #include <asm/jailhouse_hypercall.h>
 
+#ifndef __ASSEMBLY__
+
+/**
+ * Statistics of a CPU as published in the read-only statistics page of its
+ * cell. The page contains one entry per logical CPU ID.
+ */
+struct jailhouse_cpu_stats {
+	/** Odd while the hypervisor updates the counters. */
+	volatile __u32 seqcount;
+	/** \privatesection */
+	__u32 padding;
+	/** \publicsection */
+	/** Counters, indexed by JAILHOUSE_CPU_STAT_*. */
+	volatile __u64 counter[JAILHOUSE_NUM_CPU_STATS];
+};
+
+/**
+ * Application-defined mailbox in the extension area of the communication
+ * page. Only one side writes a mailbox, readers have to retry if the sequence
+ * counter was odd or changed while copying the data.
+ */
+struct jailhouse_comm_mailbox {
+	/** Odd while the writer updates the mailbox. */
+	volatile __u32 seqcount;
+	/** Number of valid bytes in @c data. */
+	volatile __u32 len;
+	/** Payload, the format is defined by the applications. */
+	volatile __u8 data[JAILHOUSE_COMM_MAILBOX_SIZE];
+};
+
+/**
+ * Clock published by the hypervisor, identical in all cells. It is based on
+ * the TSC on x86 and on the physical counter (CNTPCT) on ARM.
+ */
+struct jailhouse_clock {
+	/** Counter frequency in kHz, 0 if the clock is not available. */
+	__u64 frequency_khz;
+	/** Counter value at the common epoch, the hypervisor activation. */
+	__u64 epoch;
+	/** Conversion factors, see jailhouse_clock_ns(). @{ */
+	__u32 mult;
+	__u32 shift;
+	/** @} */
+};
+
+/**
+ * Convert a counter value into nanoseconds since the common epoch.
+ * @param clock		Clock parameters.
+ * @param counter	Counter value.
+ *
+ * @return Nanoseconds, computed as ((counter - epoch) * mult) >> shift
+ * without a 128-bit intermediate.
+ */
+static inline __u64 jailhouse_clock_ns(const struct jailhouse_clock *clock,
+				       __u64 counter)
+{
+	__u64 delta = counter - clock->epoch;
+
+	return (((delta >> 32) * clock->mult) << (32 - clock->shift)) +
+		(((delta & 0xffffffff) * clock->mult) >> clock->shift);
+}
+
+/**
+ * Extension area of the communication region, located at
+ * JAILHOUSE_COMM_EXT_OFFSET. The hypervisor maps this page of non-root cells
+ * also writable into the root cell, so both sides can exchange data without
+ * hypercalls. The preceding page with the communication region is only
+ * readable for the root cell.
+ */
+struct jailhouse_comm_ext {
+	/** Counter incremented by the cell to signal that it is alive. */
+	volatile __u64 heartbeat;
+	/** Watchdog timeout in milliseconds, armed by the cell, 0 if unused. */
+	volatile __u32 watchdog_timeout_ms;
+	/** \privatesection */
+	__u8 padding[52];
+	/** \publicsection */
+	/** Mailboxes written by the root cell, preserved across restarts. */
+	struct jailhouse_comm_mailbox to_cell[JAILHOUSE_COMM_MAILBOXES];
+	/** Mailboxes written by the cell, cleared on cell start. */
+	struct jailhouse_comm_mailbox from_cell[JAILHOUSE_COMM_MAILBOXES];
+	/** Common clock, rewritten on cell start. */
+	struct jailhouse_clock clock;
+	/** Guest-physical start of the memory region that was added or is to
+	 * be removed, see JAILHOUSE_MSG_MEMORY_*. */
+	volatile __u64 mem_hotplug_start;
+	/** Size of that memory region. */
+	volatile __u64 mem_hotplug_size;
+	/** ID of the CPU that is to be removed, see
+	 * JAILHOUSE_MSG_CPU_REMOVE_REQUEST. */
+	volatile __u32 cpu_hotplug_id;
+};
+
+/**
+ * Events the root cell should react on, published in a read-only page of the
+ * hypervisor. The root cell is interrupted on each new event if it owns an
+ * ivshmem device of protocol JAILHOUSE_SHMEM_PROTO_EVENTS.
+ */
+/** IOMMU fault record. */
+struct jailhouse_iommu_fault {
+	/** Sequence number of the record plus 1, 0 while being written. */
+	volatile __u32 seq;
+	/** Requester ID (bus:dev.func) of the faulting device. */
+	__u16 device_id;
+	/** Index of the reporting IOMMU unit. */
+	__u16 unit;
+	/** Vendor-specific fault reason or event code. */
+	__u32 reason;
+	/** \privatesection */
+	__u32 padding;
+	/** \publicsection */
+	/** Vendor-specific fault information, usually the faulting address. */
+	__u64 info;
+};
+
+/** Number of faults reported for a device. */
+struct jailhouse_iommu_fault_device {
+	/** Requester ID (bus:dev.func) of the device. */
+	volatile __u32 device_id;
+	/** Number of faults so far, 0 if the entry is unused. */
+	volatile __u32 count;
+};
+
+/**
+ * Log of IOMMU faults, part of the event page. Records are written as a ring,
+ * overwriting the oldest ones, like the trace buffer.
+ */
+struct jailhouse_iommu_faults {
+	/** Number of records written so far, free-running. */
+	volatile __u32 head;
+	/** Faults of devices that did not fit into @c devices. */
+	volatile __u32 untracked;
+	/** Fault counters of the first devices that faulted. */
+	struct jailhouse_iommu_fault_device
+		devices[JAILHOUSE_IOMMU_FAULT_DEVICES];
+	/** Record n is stored in slot n modulo JAILHOUSE_IOMMU_FAULT_RECORDS. */
+	struct jailhouse_iommu_fault records[JAILHOUSE_IOMMU_FAULT_RECORDS];
+};
+
+struct jailhouse_events {
+	/** Number of events reported so far, free-running. */
+	volatile __u32 seq;
+	/** Number of events per type, indexed by JAILHOUSE_EVENT_*. */
+	volatile __u32 count[JAILHOUSE_NUM_EVENTS];
+	/** Recent IOMMU faults and per-device fault counters. */
+	struct jailhouse_iommu_faults iommu_faults;
+};
+
+/** Binary trace event record. */
+struct jailhouse_trace_record {
+	/** Sequence number of the record plus 1, 0 while being written. */
+	volatile __u32 seq;
+	/** Event type, see JAILHOUSE_TRACE_*. */
+	__u32 event;
+	/** Timestamp in units of the CPU cycle counter. */
+	__u64 timestamp;
+	/** Event-specific arguments. */
+	__u64 arg[2];
+};
+
+/**
+ * Per-CPU trace buffer, mapped read-only into the root cell. Records are
+ * written as a ring, overwriting the oldest ones.
+ */
+struct jailhouse_trace_buffer {
+	/** Number of records written so far, free-running. */
+	volatile __u32 head;
+	/** Number of record slots in the ring. */
+	__u32 num_records;
+	/** \privatesection */
+	__u32 padding[6];
+	/** \publicsection */
+	/** Ring of records. */
+	struct jailhouse_trace_record records[];
+};
+
+#endif /* !__ASSEMBLY__ */
+
 #endif /* !_JAILHOUSE_HYPERCALL_H */
@@ -0,0 +1,94 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _JAILHOUSE_IVSHMEM_NET_H
+#define _JAILHOUSE_IVSHMEM_NET_H
+
+#include <jailhouse/queue.h>
+
+/*
+ * Virtual Ethernet link on top of an ivshmem device between two cells. The
+ * shared memory is split into two halves like for plain message queues,
+ * the endpoint with IVPosition 0 transmits via the lower half. Each half
+ * starts with struct jailhouse_ivshmem_net_info, followed by a
+ * struct jailhouse_queue at JAILHOUSE_IVSHMEM_NET_QUEUE_OFFSET. Every slot
+ * of the queue carries one frame, prefixed by struct
+ * jailhouse_ivshmem_net_hdr.
+ *
+ * The transmitter may only use the offloads the receiver announced in its
+ * own info block. Frames with JAILHOUSE_IVSHMEM_NET_F_NEEDS_CSUM carry a
+ * partial checksum to be completed at csum_start + csum_offset, frames with
+ * a GSO type are to be segmented into gso_size payload chunks, both
+ * following the virtio network header semantics.
+ */
+
+#define JAILHOUSE_IVSHMEM_NET_MAGIC	0x54454e4a	/* "JNET" */
+
+#define JAILHOUSE_IVSHMEM_NET_QUEUE_OFFSET	JAILHOUSE_QUEUE_CACHELINE
+
+/* offloads a receiver accepts */
+#define JAILHOUSE_IVSHMEM_NET_RX_CSUM		(1 << 0)
+#define JAILHOUSE_IVSHMEM_NET_RX_GSO		(1 << 1)
+
+#define JAILHOUSE_IVSHMEM_NET_F_NEEDS_CSUM	0x01
+
+#define JAILHOUSE_IVSHMEM_NET_GSO_NONE		0x00
+#define JAILHOUSE_IVSHMEM_NET_GSO_TCPV4		0x01
+#define JAILHOUSE_IVSHMEM_NET_GSO_TCPV6		0x04
+#define JAILHOUSE_IVSHMEM_NET_GSO_ECN		0x80
+
+struct jailhouse_ivshmem_net_info {
+	/** Set by the transmitter after its queue is formatted. */
+	volatile __u32 magic;
+	/** Offloads the transmitter accepts for frames it receives. */
+	__u32 features;
+} __attribute__((aligned(JAILHOUSE_QUEUE_CACHELINE)));
+
+struct jailhouse_ivshmem_net_hdr {
+	/** JAILHOUSE_IVSHMEM_NET_F_* */
+	__u8 flags;
+	/** JAILHOUSE_IVSHMEM_NET_GSO_* */
+	__u8 gso_type;
+	/** Length of the headers to be replicated for each segment. */
+	__u16 hdr_len;
+	/** Payload bytes per segment. */
+	__u16 gso_size;
+	/** Checksum range start and offset of the checksum field in it. */
+	__u16 csum_start;
+	__u16 csum_offset;
+	__u16 padding;
+};
+
+#endif /* !_JAILHOUSE_IVSHMEM_NET_H */
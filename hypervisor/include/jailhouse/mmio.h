@@ -15,9 +15,11 @@
 
 #include <jailhouse/types.h>
 #include <asm/mmio.h>
+#include <asm/spinlock.h>
 #include <jailhouse/cell-config.h>
 
 struct cell;
+struct per_cpu;
 
 /**
  * @defgroup IO I/O Access Subsystem
@@ -157,6 +159,92 @@ struct mmio_region_handler {
 	mmio_handler handler;
 	/** Argument to pass to the handler. */
 	void *arg;
+	/** True if writes may be buffered by the handler, see
+	 * mmio_region_register_coalesced. */
+	bool coalesced;
+};
+
+/** Number of per-cell slots for regions of hypervisor-emulated devices. */
+#define MMIO_FAST_SLOTS		8
+
+/**
+ * Region of a hypervisor-emulated device, dispatched without lookup in the
+ * region table, see mmio_region_register_fast.
+ */
+struct mmio_fast_region {
+	/** Start address of the region. */
+	unsigned long start;
+	/** Region size, 0 if the slot is unused. */
+	unsigned long size;
+	/** Access handler and its argument. */
+	struct mmio_region_handler handler;
+};
+
+/**
+ * Sub-page region with its permanent hypervisor mapping.
+ *
+ * The descriptor carries a copy of the region parameters as registrations
+ * may be made for temporary region descriptions.
+ */
+struct mmio_subpage {
+	/** Mapping of the pages backing the region, @c NULL if unused. */
+	void *pages;
+	/** Number of mapped pages. */
+	unsigned int num_pages;
+	/** Guest-physical start address the region is registered at. */
+	unsigned long virt_start;
+	/** Physical start address of the region. */
+	unsigned long phys_start;
+	/** Permitted access sizes, see MMIO_SUBPAGE_ACCESS. */
+	u16 access_mask;
+	/** True if writes are buffered in the ring of the cell. */
+	bool coalesced;
+};
+
+/**
+ * Position of the access sizes permitted for a given direction and alignment
+ * in mmio_subpage::access_mask. Each group holds the sizes in bytes as bits,
+ * i.e. 1, 2, 4 and 8.
+ */
+#define MMIO_COALESCED_ENTRIES	32
+
+struct mmio_coalesced_ring {
+	/** Protects the ring, taken by all CPUs of the cell. */
+	spinlock_t lock;
+	/** Number of buffered writes. */
+	unsigned int count;
+	/** Cycle counter value when the oldest buffered write was taken. */
+	u64 first_cycles;
+	struct {
+		/** Base of the mapping to write to. */
+		void *base;
+		/** Offset, size and value of the write. */
+		struct mmio_access access;
+	} entries[MMIO_COALESCED_ENTRIES];
+};
+
+#define MMIO_SUBPAGE_ACCESS(is_write, unaligned)	\
+	(((is_write) * 2 + (unaligned)) * 4)
+
+/** Number of recently used regions tracked by the per-CPU lookup cache. */
+#define MMIO_CACHE_SIZE		4
+
+/**
+ * Per-CPU cache of recently resolved MMIO regions.
+ *
+ * The cache only stores indexes into the region table of a cell. Hits are
+ * validated against the live region location, so a stale entry can only cause
+ * a miss, never a wrong dispatch.
+ */
+struct mmio_region_cache {
+	/** Cell the cached indexes refer to. */
+	struct cell *cell;
+	/** Region table generation the cached indexes are valid for. */
+	unsigned int generation;
+	/** Slot to be replaced on the next miss. */
+	unsigned int next_slot;
+	/** Region indexes, slot 0 holding the last hit; -1 if unused. */
+	int index[MMIO_CACHE_SIZE];
 };
 
 int mmio_cell_init(struct cell *cell);
@@ -164,8 +252,19 @@ int mmio_cell_init(struct cell *cell);
 void mmio_region_register(struct cell *cell, unsigned long start,
 			  unsigned long size, mmio_handler handler,
 			  void *handler_arg);
+void mmio_region_register_fast(struct cell *cell, unsigned long start,
+			       unsigned long size, mmio_handler handler,
+			       void *handler_arg);
+void mmio_region_register_coalesced(struct cell *cell, unsigned long start,
+				    unsigned long size, mmio_handler handler,
+				    void *handler_arg);
 void mmio_region_unregister(struct cell *cell, unsigned long start);
 
+void mmio_write_coalesced(struct cell *cell, void *base,
+			  struct mmio_access *mmio);
+void mmio_flush_coalesced(struct cell *cell);
+u64 mmio_flush_coalesced_expired(struct per_cpu *cpu_data);
+
 enum mmio_result mmio_handle_access(struct mmio_access *mmio);
 
 void mmio_cell_exit(struct cell *cell);
@@ -14,8 +14,10 @@
 #define _JAILHOUSE_PAGING_H
 
 #include <jailhouse/entry.h>
+#include <jailhouse/hypercall.h>
 #include <jailhouse/types.h>
 #include <asm/paging.h>
+#include <asm/spinlock.h>
 
 /**
  * @defgroup Paging Page Management Subsystem
@@ -38,7 +40,29 @@
  */
 #define TEMPORARY_MAPPING_BASE	REMAP_BASE
 
-/** Page pool state. */
+/** Subsystems pages are accounted to, see JAILHOUSE_INFO_PAGES_BASE. */
+enum page_owner {
+	PAGE_OWNER_PAGING = JAILHOUSE_PAGES_PAGING,
+	PAGE_OWNER_CELL = JAILHOUSE_PAGES_CELL,
+	PAGE_OWNER_MMIO = JAILHOUSE_PAGES_MMIO,
+	PAGE_OWNER_IOMMU = JAILHOUSE_PAGES_IOMMU,
+	PAGE_OWNER_IRT = JAILHOUSE_PAGES_IRT,
+	PAGE_OWNER_IVSHMEM = JAILHOUSE_PAGES_IVSHMEM,
+	PAGE_OWNER_PCI = JAILHOUSE_PAGES_PCI,
+	PAGE_OWNER_OTHER = JAILHOUSE_PAGES_OTHER,
+	NUM_PAGE_OWNERS = JAILHOUSE_NUM_PAGE_OWNERS,
+};
+
+/** Maximum order (log2 of the number of pages) of a page pool block. */
+#define PAGE_POOL_MAX_ORDER	20
+
+/**
+ * Page pool state.
+ *
+ * Pages are managed by a buddy allocator. Free blocks of 2^order pages are
+ * recorded in one bitmap per order. Blocks are aligned to their size with
+ * respect to the absolute page number, not just relative to the pool base.
+ */
 struct page_pool {
 	/** Base address of the pool. */
 	void *base_address;
@@ -46,10 +70,42 @@ struct page_pool {
 	unsigned long pages;
 	/** Number of currently used pages. */
 	unsigned long used_pages;
-	/** Bitmap of used pages. */
-	unsigned long *used_bitmap;
+	/** Block position of the first pool page, i.e. its page number modulo
+	 * 2^PAGE_POOL_MAX_ORDER. */
+	unsigned long offset;
+	/** Per-order bitmaps of free blocks. */
+	unsigned long *free_bitmap[PAGE_POOL_MAX_ORDER + 1];
+	/** Per-order number of free blocks. */
+	unsigned long free_blocks[PAGE_POOL_MAX_ORDER + 1];
+	/** Per-order index of the first bitmap word that may contain a free
+	 * block. */
+	unsigned long search_hint[PAGE_POOL_MAX_ORDER + 1];
 	/** Set @c PAGE_SCRUB_ON_FREE to zero-out pages on release. */
 	unsigned long flags;
+	/** Serializes bitmap updates. */
+	spinlock_t lock;
+	/** Number of pages allocated per subsystem, see @ref page_owner. */
+	unsigned long owner_pages[NUM_PAGE_OWNERS];
+};
+
+/** Number of single pages a CPU can cache in its page magazine. */
+#define PAGE_MAGAZINE_SIZE	32
+/** Number of pages moved between a magazine and mem_pool at once. */
+#define PAGE_MAGAZINE_BATCH	(PAGE_MAGAZINE_SIZE / 2)
+
+/**
+ * Per-CPU cache of free single pages of mem_pool.
+ *
+ * Pages held by a magazine are accounted as used in mem_pool.used_pages but
+ * are reported as free, see paging_pool_used_pages. They are already scrubbed.
+ */
+struct page_magazine {
+	/** Serializes the owning CPU against remote draining. */
+	spinlock_t lock;
+	/** Number of cached pages. */
+	unsigned int count;
+	/** Cached pages, the most recently freed one last. */
+	void *pages[PAGE_MAGAZINE_SIZE];
 };
 
 /** Define coherency of page creation/destruction. */
@@ -174,6 +230,7 @@ struct guest_paging_structures {
 #include <asm/paging_modes.h>
 
 extern unsigned long page_offset;
+extern unsigned int num_temporary_pages;
 
 extern struct page_pool mem_pool;
 extern struct page_pool remap_pool;
@@ -182,9 +239,25 @@ extern struct paging_structures hv_paging_structs;
 
 unsigned long paging_get_phys_invalid(pt_entry_t pte, unsigned long virt);
 
-void *page_alloc(struct page_pool *pool, unsigned int num);
-void *page_alloc_aligned(struct page_pool *pool, unsigned int num);
-void page_free(struct page_pool *pool, void *first_page, unsigned int num);
+void *page_alloc(struct page_pool *pool, unsigned int num,
+		 enum page_owner owner);
+void *page_alloc_aligned(struct page_pool *pool, unsigned int num,
+			 enum page_owner owner);
+void page_free(struct page_pool *pool, void *first_page, unsigned int num,
+	       enum page_owner owner);
+
+void paging_enable_magazines(void);
+unsigned long paging_pool_used_pages(const struct page_pool *pool);
+
+struct cell;
+
+void paging_charge_cell(struct cell *cell);
+unsigned long paging_owner_pages(enum page_owner owner);
+
+struct jailhouse_cell_desc;
+
+struct page_pool *paging_node_pool(const struct jailhouse_cell_desc *config);
+struct page_pool *paging_pool_of(const void *page);
 
 /**
  * Translate virtual hypervisor address to physical address.
@@ -236,12 +309,28 @@ unsigned long paging_virt2phys(const struct paging_structures *pg_structs,
 unsigned long arch_paging_gphys2phys(struct per_cpu *cpu_data,
 				     unsigned long gphys, unsigned long flags);
 
+/**
+ * Get the paging structures translating guest-physical addresses of a cell.
+ * @param cell		Cell to return the paging structures for.
+ *
+ * @return Reference to the cell's guest-physical paging structures.
+ *
+ * @see arch_paging_gphys2phys
+ */
+const struct paging_structures *arch_cell_paging_structs(struct cell *cell);
+
 int paging_create(const struct paging_structures *pg_structs,
 		    unsigned long phys, unsigned long size, unsigned long virt,
 		    unsigned long flags, enum paging_coherent coherent);
 int paging_destroy(const struct paging_structures *pg_structs,
 		   unsigned long virt, unsigned long size,
 		   enum paging_coherent coherent);
+void paging_destroy_tables(const struct paging_structures *pg_structs,
+			   unsigned int root_pages);
+void paging_merge(const struct paging_structures *pg_structs,
+		  unsigned long virt, unsigned long size,
+		  enum paging_coherent coherent);
+void paging_share_tables(struct cell *cell);
 
 void *paging_get_guest_pages(const struct guest_paging_structures *pg_structs,
 			     unsigned long gaddr, unsigned int num,
@@ -255,7 +344,7 @@ int paging_init(void);
  */
 void arch_paging_init(void);
 
-void paging_dump_stats(const char *when);
+void paging_dump_stats(const char *when, struct cell *cell);
 
 /* --- To be provided by asm/paging.h --- */
 
@@ -306,13 +395,13 @@ void paging_dump_stats(const char *when);
  * Start address of remapping region in the hypervisor address space.
  *
  * @def NUM_REMAP_BITMAP_PAGES
- * Number of pages for the used-pages bitmap which records allocations in the
- * remapping region.
+ * Default size of the remapping region in units of (PAGE_SIZE * 8) pages.
  */
 
 /**
  * @def NUM_TEMPORARY_PAGES
- * Number of pages used for each CPU in the temporary remapping region.
+ * Minimum number of pages used for each CPU in the temporary remapping region
+ * if the system configuration does not specify it, see num_temporary_pages.
  */
 
 /**
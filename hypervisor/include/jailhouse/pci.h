@@ -30,10 +30,15 @@
 #define PCI_CFG_INT		0x3c
 
 #define PCI_CONFIG_HEADER_SIZE	0x40
+#define PCI_CONFIG_SPACE_SIZE	0x1000
+
+/* access policy of each config space dword, 2 bits per dword */
+#define PCI_CFG_POLICY_BYTES	(PCI_CONFIG_SPACE_SIZE / 4 / 4)
 
 #define PCI_NUM_BARS		6
 
 #define PCI_DEV_CLASS_MEM	0x05
+#define PCI_DEV_CLASS_OTHER	0xff
 
 #define PCI_CAP_MSI		0x05
 #define PCI_CAP_MSIX		0x11
@@ -116,6 +121,14 @@ union pci_msix_vector {
 	/** @publicsection */
 } __attribute__((packed));
 
+/** Guest-visible MSI or MSI-X message that was last translated. */
+struct pci_msi_translation {
+	u64 address;
+	u32 data;
+	/** Architecture-specific tag of the translation, 0 if invalid. */
+	u32 tag;
+} __attribute__((packed));
+
 struct pci_ivshmem_endpoint;
 
 /**
@@ -128,6 +141,9 @@ struct pci_device {
 	struct cell *cell;
 	/** Shadow BAR */
 	u32 bar[PCI_NUM_BARS];
+	/** Precomputed access policy for config space dwords beyond the
+	 * header. */
+	u8 cfg_policy[PCI_CFG_POLICY_BYTES];
 
 	/** Shadow state of MSI config space registers. */
 	union pci_msi_registers msi_registers;
@@ -142,6 +158,14 @@ struct pci_device {
 	union pci_msix_vector *msix_vectors;
 	/** Buffer for shadow table of up to PCI_EMBEDDED_MSIX_VECTS vectors. */
 	union pci_msix_vector msix_vector_array[PCI_EMBEDDED_MSIX_VECTS];
+
+	/** MSI message the hardware was last programmed for. */
+	struct pci_msi_translation msi_translated;
+	/** MSI-X messages the hardware was last programmed for. */
+	struct pci_msi_translation *msix_translated;
+	/** Buffer for up to PCI_EMBEDDED_MSIX_VECTS translated vectors. */
+	struct pci_msi_translation
+		msix_translated_array[PCI_EMBEDDED_MSIX_VECTS];
 };
 
 unsigned int pci_mmio_count_regions(struct cell *cell);
@@ -160,11 +184,14 @@ enum pci_access pci_cfg_write_moderate(struct pci_device *device, u16 address,
 
 int pci_cell_init(struct cell *cell);
 void pci_cell_exit(struct cell *cell);
+void pci_cell_reset(struct cell *cell);
 
 void pci_config_commit(struct cell *cell_added_removed);
 
 unsigned int pci_enabled_msi_vectors(struct pci_device *device);
 
+void pci_msi_translations_invalidate(struct pci_device *device);
+
 void pci_prepare_handover(void);
 void pci_shutdown(void);
 
@@ -243,13 +270,26 @@ int arch_pci_update_msi(struct pci_device *device,
  */
 int arch_pci_update_msix_vector(struct pci_device *device, unsigned int index);
 
+/**
+ * Update the mappings of all MSI-X vectors of a given device.
+ * @param device	Device to be updated.
+ *
+ * @return 0 on success, negative error code otherwise.
+ *
+ * @see arch_pci_update_msix_vector
+ */
+int arch_pci_update_msix(struct pci_device *device);
+
 /**
  * @defgroup PCI-IVSHMEM ivshmem
  * @{
  */
 int pci_ivshmem_init(struct cell *cell, struct pci_device *device);
 void pci_ivshmem_exit(struct pci_device *device);
+void pci_ivshmem_reset(struct pci_device *device);
 int pci_ivshmem_update_msix(struct pci_device *device);
+void pci_ivshmem_notify_events(void);
+u64 pci_ivshmem_flush_deferred(struct per_cpu *cpu_data);
 enum pci_access pci_ivshmem_cfg_write(struct pci_device *device,
 				      unsigned int row, u32 mask, u32 value);
 enum pci_access pci_ivshmem_cfg_read(struct pci_device *device, u16 address,
@@ -11,13 +11,16 @@
  */
 
 #include <jailhouse/types.h>
+#include <jailhouse/utils.h>
 
 extern volatile unsigned long panic_in_progress;
 extern unsigned long panic_cpu;
 
+extern struct jailhouse_console console;
+
 void printk(const char *fmt, ...);
 
-void panic_printk(const char *fmt, ...);
+void __cold panic_printk(const char *fmt, ...);
 
 #ifdef CONFIG_TRACE_ERROR
 #define trace_error(code) ({						  \
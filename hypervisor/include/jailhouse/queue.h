@@ -0,0 +1,128 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _JAILHOUSE_QUEUE_H
+#define _JAILHOUSE_QUEUE_H
+
+/*
+ * Single-producer/single-consumer message queue on top of shared memory,
+ * e.g. an ivshmem region. The queue header is written once by the producer.
+ * Afterwards, each side only writes to its own cache line, and messages are
+ * passed in fixed-size slots. Indices are free-running, the slot of an index
+ * is (index & (num_slots - 1)).
+ *
+ * Notifications follow the virtio event index scheme: A side that is about
+ * to wait publishes the index it has processed up to in its event field. The
+ * peer only signals when it moves its own index across that value. This way,
+ * a batch of messages triggers at most one doorbell, and none while the peer
+ * is busy anyway.
+ */
+
+#define JAILHOUSE_QUEUE_MAGIC		0x5148534a	/* "JSHQ" */
+#define JAILHOUSE_QUEUE_CACHELINE	64
+
+#define JAILHOUSE_QUEUE_MIN_SLOT_SIZE	16
+
+struct jailhouse_queue_slot {
+	__u32 len;
+	__u32 padding;
+	__u8 data[];
+};
+
+struct jailhouse_queue {
+	/** Set by the producer after all other header fields are valid. */
+	volatile __u32 magic;
+	/** Number of slots, a power of two. */
+	__u32 num_slots;
+	/** Size of a slot in bytes, including struct jailhouse_queue_slot. */
+	__u32 slot_size;
+	__u32 padding;
+
+	/* written by the producer only */
+	struct {
+		/** Index of the next slot to be filled. */
+		volatile __u32 head;
+		/** Tail index the producer waits for to move past. */
+		volatile __u32 space_event;
+	} prod __attribute__((aligned(JAILHOUSE_QUEUE_CACHELINE)));
+
+	/* written by the consumer only */
+	struct {
+		/** Index of the next slot to be consumed. */
+		volatile __u32 tail;
+		/** Head index the consumer waits for to move past. */
+		volatile __u32 data_event;
+	} cons __attribute__((aligned(JAILHOUSE_QUEUE_CACHELINE)));
+
+	__u8 slots[] __attribute__((aligned(JAILHOUSE_QUEUE_CACHELINE)));
+};
+
+/**
+ * Check if moving an index from @c old_idx to @c new_idx crossed the event
+ * index published by the peer, i.e. if the peer has to be notified.
+ */
+static inline int jailhouse_queue_need_event(__u32 event, __u32 new_idx,
+					     __u32 old_idx)
+{
+	return (__u32)(new_idx - event - 1) < (__u32)(new_idx - old_idx);
+}
+
+/**
+ * Return the largest power-of-two number of slots of size @c slot_size that
+ * fit into a queue of @c size bytes, or 0 if not even one slot fits.
+ */
+static inline __u32 jailhouse_queue_slots(unsigned long size,
+					  __u32 slot_size)
+{
+	unsigned long available;
+	__u32 slots = 1;
+
+	if (size < sizeof(struct jailhouse_queue) + slot_size)
+		return 0;
+	available = (size - sizeof(struct jailhouse_queue)) / slot_size;
+	while (slots * 2 <= available && slots < 0x80000000)
+		slots *= 2;
+	return slots;
+}
+
+static inline struct jailhouse_queue_slot *
+jailhouse_queue_slot(struct jailhouse_queue *queue, __u32 num_slots,
+		     __u32 slot_size, __u32 idx)
+{
+	return (struct jailhouse_queue_slot *)
+		(queue->slots + (idx & (num_slots - 1)) * slot_size);
+}
+
+#endif /* !_JAILHOUSE_QUEUE_H */
@@ -0,0 +1,35 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_TRACE_H
+#define _JAILHOUSE_TRACE_H
+
+#include <jailhouse/hypercall.h>
+#include <asm/percpu.h>
+
+/**
+ * @defgroup Trace Trace Subsystem
+ *
+ * The trace subsystem records binary events into per-CPU ring buffers that
+ * the root cell can read without synchronizing with the hypervisor.
+ *
+ * @{
+ */
+
+#define TRACE_NUM_RECORDS						\
+	((JAILHOUSE_TRACE_BUFFER_PAGES * PAGE_SIZE -			\
+	  sizeof(struct jailhouse_trace_buffer)) /			\
+	 sizeof(struct jailhouse_trace_record))
+
+int trace_cpu_init(struct per_cpu *cpu_data);
+
+void trace_event(unsigned int event, unsigned long arg0, unsigned long arg1);
+
+/** @} */
+#endif /* !_JAILHOUSE_TRACE_H */
@@ -24,4 +24,19 @@
 #define BIT_MASK(last, first) \
 	((0xffffffffffffffffULL >> (64 - ((last) + 1 - (first)))) << (first))
 
+/* break the build if the condition is true */
+#define BUILD_BUG_ON(cond)	((void)sizeof(char[1 - 2 * !!(cond)]))
+
+/* branch hints for paths that are (not) taken in the common case */
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+
+/*
+ * Rarely executed function (setup, shutdown, panic). It is optimized for
+ * size, branches leading to it are predicted as not taken, and its code is
+ * placed into .text.unlikely, away from the exit handling paths.
+ */
+#define __cold			__attribute__((cold))
+
 #define MAX(a, b)		((a) >= (b) ? (a) : (b))
+#define MIN(a, b)		((a) <= (b) ? (a) : (b))
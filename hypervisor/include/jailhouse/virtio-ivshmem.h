@@ -0,0 +1,106 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _JAILHOUSE_VIRTIO_IVSHMEM_H
+#define _JAILHOUSE_VIRTIO_IVSHMEM_H
+
+/*
+ * virtio transport on top of an ivshmem link between two cells. The shared
+ * memory starts with struct jailhouse_virtio_header, followed by the split
+ * virtqueues (standard vring layout, aligned to JAILHOUSE_VIRTIO_VRING_ALIGN)
+ * and the buffer area. Descriptor addresses are offsets relative to the
+ * beginning of the shared memory and must point into the buffer area, so
+ * the back-end never needs access to other memory of the front-end.
+ *
+ * The back-end formats the header and signals the front-end. Afterwards,
+ * each side only writes to its own section of the header. Both sides use
+ * vector 0 of their ivshmem device: the front-end rings the back-end after
+ * status changes and queue kicks, the back-end rings the front-end after
+ * formatting the header, completing buffers and changing the configuration.
+ * A notified side checks all of its queues.
+ */
+
+#define JAILHOUSE_VIRTIO_MAGIC		0x4f495456	/* "VTIO" */
+#define JAILHOUSE_VIRTIO_REVISION	1
+
+#define JAILHOUSE_VIRTIO_CACHELINE	64
+#define JAILHOUSE_VIRTIO_VRING_ALIGN	64
+
+#define JAILHOUSE_VIRTIO_MAX_QUEUES	8
+#define JAILHOUSE_VIRTIO_MAX_QUEUE_SIZE	1024
+#define JAILHOUSE_VIRTIO_CONFIG_SIZE	256
+
+struct jailhouse_virtio_header {
+	/** Set by the back-end after all other fields are valid. */
+	volatile __u32 magic;
+	__u32 revision;
+	/** virtio device ID, e.g. 1 for network and 2 for block devices. */
+	__u32 device_id;
+	/** Number of virtqueues. */
+	__u32 num_queues;
+	/** Descriptors per virtqueue, a power of two. */
+	__u32 queue_size;
+	__u32 padding;
+	/** Features offered by the back-end. */
+	__u64 device_features;
+	/** Offsets of the vrings, relative to the header. */
+	__u64 queue_offset[JAILHOUSE_VIRTIO_MAX_QUEUES];
+	/** Area holding all buffers, relative to the header. */
+	__u64 buffer_offset;
+	__u64 buffer_size;
+
+	/* written by the front-end only */
+	struct {
+		/** Features accepted by the front-end. */
+		__u64 features;
+		/** Device status, see VIRTIO_CONFIG_S_*. */
+		volatile __u32 status;
+		__u32 padding;
+	} driver __attribute__((aligned(JAILHOUSE_VIRTIO_CACHELINE)));
+
+	/* written by the back-end only */
+	struct {
+		/** Last device status the back-end has acted upon. A reset is
+		 * complete when this reads 0 again. */
+		volatile __u32 status;
+		/** Incremented on each change of the configuration data. */
+		volatile __u32 config_generation;
+		/** Device-specific configuration, e.g. struct
+		 * virtio_net_config. */
+		__u8 config[JAILHOUSE_VIRTIO_CONFIG_SIZE];
+	} device __attribute__((aligned(JAILHOUSE_VIRTIO_CACHELINE)));
+};
+
+#endif /* !_JAILHOUSE_VIRTIO_IVSHMEM_H */
@@ -12,14 +12,11 @@
 
 #include <jailhouse/string.h>
 #include <jailhouse/types.h>
+#include <asm/string.h>
 
 void *memset(void *s, int c, unsigned long n)
 {
-	u8 *p = s;
-
-	while (n-- > 0)
-		*p++ = c;
-	return s;
+	return arch_memset(s, c, n);
 }
 
 int strcmp(const char *s1, const char *s2)
@@ -35,10 +32,5 @@ int strcmp(const char *s1, const char *s2)
 
 void *memcpy(void *dest, const void *src, unsigned long n)
 {
-	const u8 *s = src;
-	u8 *d = dest;
-
-	while (n-- > 0)
-		*d++ = *s++;
-	return dest;
+	return arch_memcpy(dest, src, n);
 }
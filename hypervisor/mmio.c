@@ -15,8 +15,69 @@
 #include <jailhouse/mmio.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
+#include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <asm/percpu.h>
 
+/*
+ * Cells with at least this many MMIO regions get a search index in addition
+ * to the sorted region table, see mmio_index_lookup. 0 disables the index.
+ * Can be overridden in include/jailhouse/config.h.
+ */
+#ifndef CONFIG_MMIO_INDEX_MIN_REGIONS
+#define CONFIG_MMIO_INDEX_MIN_REGIONS	32
+#endif
+
+/*
+ * Maximum delay of writes to JAILHOUSE_MEM_IO_COALESCED regions in
+ * microseconds. Only enforced on CPUs with a hypervisor timer (VMX
+ * preemption timer), elsewhere buffered writes are performed on the next
+ * VM exit of the cell at the latest. Can be overridden in
+ * include/jailhouse/config.h.
+ */
+#ifndef CONFIG_MMIO_COALESCE_US
+#define CONFIG_MMIO_COALESCE_US		100
+#endif
+
+/* tables are placed at cache line boundaries of the common allocation */
+#define MMIO_TABLE_ALIGN	64
+#define MMIO_TABLE_SIZE(num, type) \
+	(((num) * sizeof(type) + MMIO_TABLE_ALIGN - 1) & ~(MMIO_TABLE_ALIGN - 1))
+
+static bool mmio_index_enabled(struct cell *cell)
+{
+	return CONFIG_MMIO_INDEX_MIN_REGIONS > 0 &&
+		cell->max_mmio_regions >= CONFIG_MMIO_INDEX_MIN_REGIONS;
+}
+
+static bool mmio_coalesced_enabled(struct cell *cell)
+{
+	const struct jailhouse_memory *mem;
+	unsigned int n;
+
+	for_each_mem_region(mem, cell->config, n)
+		if (JAILHOUSE_MEMORY_IS_SUBPAGE(mem) &&
+		    mem->flags & JAILHOUSE_MEM_IO_COALESCED)
+			return true;
+	return false;
+}
+
+static unsigned long mmio_tables_size(struct cell *cell)
+{
+	unsigned int num = cell->max_mmio_regions;
+	unsigned long size;
+
+	size = MMIO_TABLE_SIZE(num, struct mmio_region_location) +
+		MMIO_TABLE_SIZE(num, struct mmio_region_handler) +
+		MMIO_TABLE_SIZE(num, struct mmio_subpage);
+	if (mmio_index_enabled(cell))
+		size += MMIO_TABLE_SIZE(num + 1, unsigned long) +
+			MMIO_TABLE_SIZE(num + 1, unsigned int);
+	if (mmio_coalesced_enabled(cell))
+		size += MMIO_TABLE_SIZE(1, struct mmio_coalesced_ring);
+	return size;
+}
+
 /**
  * Perform MMIO-specific initialization for a new cell.
  * @param cell		Cell to be initialized.
@@ -28,7 +89,7 @@
 int mmio_cell_init(struct cell *cell)
 {
 	const struct jailhouse_memory *mem;
-	unsigned int n;
+	unsigned int n, num;
 	void *pages;
 
 	cell->max_mmio_regions = arch_mmio_count_regions(cell);
@@ -36,17 +97,32 @@ int mmio_cell_init(struct cell *cell)
 	for_each_mem_region(mem, cell->config, n)
 		if (JAILHOUSE_MEMORY_IS_SUBPAGE(mem))
 			cell->max_mmio_regions++;
+	num = cell->max_mmio_regions;
 
-	pages = page_alloc(&mem_pool,
-			   PAGES(cell->max_mmio_regions *
-				 (sizeof(struct mmio_region_location) +
-				  sizeof(struct mmio_region_handler))));
+	pages = page_alloc(paging_pool_of(cell),
+			   PAGES(mmio_tables_size(cell)), PAGE_OWNER_MMIO);
 	if (!pages)
 		return -ENOMEM;
 
+	/* lookups only touch the locations and the index, keep them apart */
 	cell->mmio_locations = pages;
-	cell->mmio_handlers = pages +
-		cell->max_mmio_regions * sizeof(struct mmio_region_location);
+	pages += MMIO_TABLE_SIZE(num, struct mmio_region_location);
+	cell->mmio_handlers = pages;
+	pages += MMIO_TABLE_SIZE(num, struct mmio_region_handler);
+	cell->mmio_subpages = pages;
+	pages += MMIO_TABLE_SIZE(num, struct mmio_subpage);
+	if (mmio_index_enabled(cell)) {
+		cell->mmio_index_starts = pages;
+		pages += MMIO_TABLE_SIZE(num + 1, unsigned long);
+		cell->mmio_index_regions = pages;
+		pages += MMIO_TABLE_SIZE(num + 1, unsigned int);
+	}
+	if (mmio_coalesced_enabled(cell)) {
+		cell->mmio_coalesced = pages;
+		/* empty ring with an unlocked lock */
+		memset(cell->mmio_coalesced, 0,
+		       sizeof(*cell->mmio_coalesced));
+	}
 
 	return 0;
 }
@@ -69,19 +145,41 @@ static void copy_region(struct cell *cell, unsigned int src, unsigned dst)
 	cell->mmio_locations[dst].size = cell->mmio_locations[src].size;
 }
 
-/**
- * Register a MMIO region access handler for a cell.
- * @param cell		Cell than can access the region.
- * @param start		Region start address in cell address space.
- * @param size		Region size.
- * @param handler	Access handler.
- * @param handler_arg	Opaque argument to pass to handler.
- *
- * @see mmio_region_unregister
+static unsigned int mmio_index_fill(struct cell *cell, unsigned int region,
+				    unsigned int pos)
+{
+	if (pos > cell->num_mmio_regions)
+		return region;
+
+	/* in-order traversal of the implicit tree assigns ascending starts */
+	region = mmio_index_fill(cell, region, pos * 2);
+	cell->mmio_index_starts[pos] = cell->mmio_locations[region].start;
+	cell->mmio_index_regions[pos] = region;
+	return mmio_index_fill(cell, region + 1, pos * 2 + 1);
+}
+
+/*
+ * Rebuild the search index after the region table changed. Concurrent
+ * lookups may see a partially updated index, but their results are validated
+ * against the region table, see mmio_index_lookup.
  */
-void mmio_region_register(struct cell *cell, unsigned long start,
-			  unsigned long size, mmio_handler handler,
-			  void *handler_arg)
+static void mmio_index_update(struct cell *cell)
+{
+	if (!cell->mmio_index_starts)
+		return;
+
+	cell->mmio_index_num = 0;
+	memory_barrier();
+
+	mmio_index_fill(cell, 0, 1);
+	memory_barrier();
+
+	cell->mmio_index_num = cell->num_mmio_regions;
+}
+
+static void __mmio_region_register(struct cell *cell, unsigned long start,
+				   unsigned long size, mmio_handler handler,
+				   void *handler_arg, bool coalesced)
 {
 	unsigned int index, n;
 
@@ -124,14 +222,93 @@ void mmio_region_register(struct cell *cell, unsigned long start,
 	cell->mmio_locations[index].start = start;
 	cell->mmio_handlers[index].handler = handler;
 	cell->mmio_handlers[index].arg = handler_arg;
+	cell->mmio_handlers[index].coalesced = coalesced;
 	/* Ensure all fields are committed before activating the region. */
 	memory_barrier();
 
 	cell->mmio_locations[index].size = size;
 
+	/* Region indexes have shifted, invalidate all lookup caches. */
+	cell->mmio_generation++;
+
+	mmio_index_update(cell);
+
 	spin_unlock(&cell->mmio_region_lock);
 }
 
+/**
+ * Register a MMIO region access handler for a cell.
+ * @param cell		Cell than can access the region.
+ * @param start		Region start address in cell address space.
+ * @param size		Region size.
+ * @param handler	Access handler.
+ * @param handler_arg	Opaque argument to pass to handler.
+ *
+ * @see mmio_region_unregister
+ */
+void mmio_region_register(struct cell *cell, unsigned long start,
+			  unsigned long size, mmio_handler handler,
+			  void *handler_arg)
+{
+	__mmio_region_register(cell, start, size, handler, handler_arg, false);
+}
+
+/**
+ * Register a MMIO region whose handler may buffer writes via
+ * mmio_write_coalesced. Pending writes are performed before any other access
+ * of the cell is dispatched, including reads from such a region. Falls back
+ * to mmio_region_register if the cell has no coalescing buffer. Parameters
+ * are the same as for mmio_region_register.
+ *
+ * @see mmio_region_unregister
+ */
+void mmio_region_register_coalesced(struct cell *cell, unsigned long start,
+				    unsigned long size, mmio_handler handler,
+				    void *handler_arg)
+{
+	__mmio_region_register(cell, start, size, handler, handler_arg,
+			       cell->mmio_coalesced != NULL);
+}
+
+/**
+ * Register a MMIO region of a device emulated by the hypervisor itself.
+ * Such regions are checked first on each access, without any table lookup.
+ * Falls back to mmio_region_register if all fast slots of the cell are in
+ * use. Parameters are the same as for mmio_region_register.
+ *
+ * @see mmio_region_unregister
+ */
+void mmio_region_register_fast(struct cell *cell, unsigned long start,
+			       unsigned long size, mmio_handler handler,
+			       void *handler_arg)
+{
+	struct mmio_fast_region *slot;
+	unsigned int n;
+
+	spin_lock(&cell->mmio_region_lock);
+
+	for (n = 0; n < MMIO_FAST_SLOTS; n++) {
+		slot = &cell->mmio_fast_regions[n];
+		if (slot->size != 0)
+			continue;
+
+		/* same commit protocol as copy_region */
+		slot->start = start;
+		slot->handler.handler = handler;
+		slot->handler.arg = handler_arg;
+		slot->handler.coalesced = false;
+		memory_barrier();
+		slot->size = size;
+
+		spin_unlock(&cell->mmio_region_lock);
+		return;
+	}
+
+	spin_unlock(&cell->mmio_region_lock);
+
+	mmio_region_register(cell, start, size, handler, handler_arg);
+}
+
 static int find_region(struct cell *cell, unsigned long address,
 		       unsigned int size)
 {
@@ -166,10 +343,19 @@ static int find_region(struct cell *cell, unsigned long address,
  */
 void mmio_region_unregister(struct cell *cell, unsigned long start)
 {
+	unsigned int n;
 	int index;
 
 	spin_lock(&cell->mmio_region_lock);
 
+	for (n = 0; n < MMIO_FAST_SLOTS; n++)
+		if (cell->mmio_fast_regions[n].size != 0 &&
+		    cell->mmio_fast_regions[n].start == start) {
+			cell->mmio_fast_regions[n].size = 0;
+			spin_unlock(&cell->mmio_region_lock);
+			return;
+		}
+
 	index = find_region(cell, start, 0);
 	if (index >= 0) {
 		for (/* empty */; index < cell->num_mmio_regions; index++)
@@ -182,10 +368,207 @@ void mmio_region_unregister(struct cell *cell, unsigned long start)
 		memory_barrier();
 
 		cell->num_mmio_regions--;
+
+		/* Region indexes have shifted, invalidate all lookup caches. */
+		cell->mmio_generation++;
+
+		mmio_index_update(cell);
 	}
 	spin_unlock(&cell->mmio_region_lock);
 }
 
+static bool region_match(struct cell *cell, int index, unsigned long address,
+			 unsigned int size)
+{
+	struct mmio_region_location region;
+
+	if (index < 0 || index >= cell->num_mmio_regions)
+		return false;
+
+	region = cell->mmio_locations[index];
+	return address >= region.start &&
+		region.start + region.size >= address + size;
+}
+
+/*
+ * Search the start addresses in Eytzinger order for the last region starting
+ * at or below the address. A lookup walks down the implicit tree from element
+ * 1, so the top levels share a few cache lines, and only the final candidate
+ * touches the region table. The candidate is validated there, a mismatch
+ * falls back to the binary search over the region table, which keeps
+ * lookups correct during index updates.
+ */
+static int mmio_index_lookup(struct cell *cell, unsigned long address,
+			     unsigned int size)
+{
+	unsigned int num = cell->mmio_index_num;
+	unsigned int pos = 1;
+	int index;
+
+	memory_load_barrier();
+
+	if (num == 0)
+		return find_region(cell, address, size);
+
+	while (pos <= num)
+		pos = pos * 2 + (cell->mmio_index_starts[pos] <= address);
+	/* strip the right turns taken after the last left turn */
+	pos >>= __builtin_ffs(~pos);
+
+	/* pos is the first region starting above address, 0 if none */
+	index = (pos == 0 ? (int)num : (int)cell->mmio_index_regions[pos]) - 1;
+	if (region_match(cell, index, address, size))
+		return index;
+	return find_region(cell, address, size);
+}
+
+static int find_region_cached(struct cell *cell, unsigned long address,
+			      unsigned int size)
+{
+	struct per_cpu *cpu_data = this_cpu_data();
+	struct mmio_region_cache *cache = &cpu_data->mmio_cache;
+	unsigned int generation = cell->mmio_generation;
+	unsigned int n;
+	int index;
+
+	/* Read the generation before any region it may refer to. */
+	memory_load_barrier();
+
+	if (cache->cell != cell || cache->generation != generation) {
+		cache->cell = cell;
+		cache->generation = generation;
+		cache->next_slot = 1;
+		for (n = 0; n < MMIO_CACHE_SIZE; n++)
+			cache->index[n] = -1;
+	}
+
+	/* Fast path: same region as the last access. */
+	if (region_match(cell, cache->index[0], address, size)) {
+		cpu_data->stats[JAILHOUSE_CPU_STAT_MMIO_CACHE_HITS]++;
+		return cache->index[0];
+	}
+
+	for (n = 1; n < MMIO_CACHE_SIZE; n++) {
+		index = cache->index[n];
+		if (region_match(cell, index, address, size)) {
+			/* promote to last-hit slot */
+			cache->index[n] = cache->index[0];
+			cache->index[0] = index;
+			cpu_data->stats[JAILHOUSE_CPU_STAT_MMIO_CACHE_HITS]++;
+			return index;
+		}
+	}
+
+	if (cell->mmio_index_starts)
+		index = mmio_index_lookup(cell, address, size);
+	else
+		index = find_region(cell, address, size);
+	if (index >= 0) {
+		/*
+		 * Demote the previous last hit into the recent-regions table,
+		 * replacing its entries round-robin.
+		 */
+		if (cache->index[0] >= 0) {
+			cache->index[cache->next_slot] = cache->index[0];
+			if (++cache->next_slot >= MMIO_CACHE_SIZE)
+				cache->next_slot = 1;
+		}
+		cache->index[0] = index;
+	}
+	return index;
+}
+
+static void mmio_coalesced_drain(struct mmio_coalesced_ring *ring)
+{
+	unsigned int n;
+
+	for (n = 0; n < ring->count; n++)
+		mmio_perform_access(ring->entries[n].base,
+				    &ring->entries[n].access);
+	ring->count = 0;
+}
+
+/**
+ * Buffer a write of the current cell instead of performing it right away.
+ * Only to be called by handlers of regions registered via
+ * mmio_region_register_coalesced.
+ * @param cell		Cell issuing the write.
+ * @param base		Virtual base address the write is relative to.
+ * @param mmio		Write access, with the offset to @c base as address.
+ *
+ * @see mmio_flush_coalesced
+ */
+void mmio_write_coalesced(struct cell *cell, void *base,
+			  struct mmio_access *mmio)
+{
+	struct mmio_coalesced_ring *ring = cell->mmio_coalesced;
+
+	spin_lock(&ring->lock);
+
+	if (ring->count == MMIO_COALESCED_ENTRIES)
+		mmio_coalesced_drain(ring);
+	if (ring->count == 0)
+		ring->first_cycles = get_cycles();
+
+	ring->entries[ring->count].base = base;
+	ring->entries[ring->count].access = *mmio;
+	ring->count++;
+
+	spin_unlock(&ring->lock);
+}
+
+/**
+ * Perform all buffered writes of a cell in the order they were issued.
+ * @param cell		Cell to flush.
+ *
+ * @see mmio_write_coalesced
+ */
+void mmio_flush_coalesced(struct cell *cell)
+{
+	struct mmio_coalesced_ring *ring = cell->mmio_coalesced;
+
+	if (likely(!ring || ring->count == 0))
+		return;
+
+	spin_lock(&ring->lock);
+	mmio_coalesced_drain(ring);
+	spin_unlock(&ring->lock);
+}
+
+/**
+ * Perform the buffered writes of the caller's cell once the oldest of them
+ * is due.
+ * @param cpu_data	Data structure of the calling CPU.
+ *
+ * @return Cycle counter value at which the CPU has to check again, 0 if
+ * nothing is pending.
+ *
+ * @note Invoked by the architecture-specific code at the end of each VM exit.
+ */
+u64 mmio_flush_coalesced_expired(struct per_cpu *cpu_data)
+{
+	struct mmio_coalesced_ring *ring = cpu_data->cell->mmio_coalesced;
+	u64 deadline = 0;
+
+	if (likely(!ring || ring->count == 0))
+		return 0;
+
+	spin_lock(&ring->lock);
+	if (ring->count > 0) {
+		/* approximates 1000 by 1024, 32-bit hosts lack a divide */
+		deadline = ring->first_cycles +
+			(((u64)arch_get_cycles_khz() *
+			  CONFIG_MMIO_COALESCE_US) >> 10);
+		if (get_cycles() >= deadline) {
+			mmio_coalesced_drain(ring);
+			deadline = 0;
+		}
+	}
+	spin_unlock(&ring->lock);
+
+	return deadline;
+}
+
 /**
  * Dispatch MMIO access of a cell CPU.
  * @param mmio		MMIO access description. @a mmio->value will receive the
@@ -202,15 +585,55 @@ void mmio_region_unregister(struct cell *cell, unsigned long start)
 enum mmio_result mmio_handle_access(struct mmio_access *mmio)
 {
 	struct cell *cell = this_cell();
-	int index = find_region(cell, mmio->address, mmio->size);
-	mmio_handler handler;
+	u64 start_cycles = get_cycles();
+	struct mmio_region_handler *region;
+	struct mmio_fast_region *slot;
+	enum mmio_result result;
+	unsigned int n;
+	int index;
+
+	trace_event(JAILHOUSE_TRACE_MMIO, mmio->address,
+		    mmio->size | (mmio->is_write ? JAILHOUSE_TRACE_MMIO_WRITE : 0));
+
+	for (n = 0; n < MMIO_FAST_SLOTS; n++) {
+		slot = &cell->mmio_fast_regions[n];
+		if (mmio->address >= slot->start &&
+		    slot->start + slot->size >= mmio->address + mmio->size) {
+			memory_load_barrier();
+			mmio_flush_coalesced(cell);
+			mmio->address -= slot->start;
+			result = slot->handler.handler(slot->handler.arg, mmio);
+			goto out;
+		}
+	}
+
+	index = find_region_cached(cell, mmio->address, mmio->size);
+	if (unlikely(index < 0)) {
+		result = MMIO_UNHANDLED;
+	} else {
+		region = &cell->mmio_handlers[index];
+		/* only writes may overtake buffered ones */
+		if (!region->coalesced || !mmio->is_write)
+			mmio_flush_coalesced(cell);
+		mmio->address -= cell->mmio_locations[index].start;
+		result = region->handler(region->arg, mmio);
+	}
+
+out:
+	this_cpu_data()->stats[JAILHOUSE_CPU_STAT_MMIO_CYCLES] +=
+		get_cycles() - start_cycles;
 
-	if (index < 0)
-		return MMIO_UNHANDLED;
+	return result;
+}
 
-	handler = cell->mmio_handlers[index].handler;
-	mmio->address -= cell->mmio_locations[index].start;
-	return handler(cell->mmio_handlers[index].arg, mmio);
+static void mmio_subpage_unmap(struct mmio_subpage *subpage)
+{
+	/* cannot fail, destruction of same size as construction */
+	paging_destroy(&hv_paging_structs, (unsigned long)subpage->pages,
+		       subpage->num_pages * PAGE_SIZE, PAGING_NON_COHERENT);
+	page_free(&remap_pool, subpage->pages, subpage->num_pages,
+		  PAGE_OWNER_MMIO);
+	subpage->pages = NULL;
 }
 
 /**
@@ -221,10 +644,16 @@ enum mmio_result mmio_handle_access(struct mmio_access *mmio)
  */
 void mmio_cell_exit(struct cell *cell)
 {
-	page_free(&mem_pool, cell->mmio_locations,
-		  PAGES(cell->max_mmio_regions *
-			(sizeof(struct mmio_region_location) +
-			 sizeof(struct mmio_region_handler))));
+	unsigned int n;
+
+	mmio_flush_coalesced(cell);
+
+	for (n = 0; n < cell->max_mmio_regions; n++)
+		if (cell->mmio_subpages[n].pages)
+			mmio_subpage_unmap(&cell->mmio_subpages[n]);
+
+	page_free(paging_pool_of(cell), cell->mmio_locations,
+		  PAGES(mmio_tables_size(cell)), PAGE_OWNER_MMIO);
 }
 
 void mmio_perform_access(void *base, struct mmio_access *mmio)
@@ -269,64 +698,129 @@ void mmio_perform_access(void *base, struct mmio_access *mmio)
 
 static enum mmio_result mmio_handle_subpage(void *arg, struct mmio_access *mmio)
 {
-	const struct jailhouse_memory *mem = arg;
-	u64 perm = mmio->is_write ? JAILHOUSE_MEM_WRITE : JAILHOUSE_MEM_READ;
-	unsigned long page_virt = TEMPORARY_MAPPING_BASE +
-		this_cpu_id() * PAGE_SIZE * NUM_TEMPORARY_PAGES;
-	unsigned long page_phys =
-		((unsigned long)mem->phys_start + mmio->address) & PAGE_MASK;
-	unsigned long virt_base;
-	int err;
-
-	/* check read/write access permissions */
-	if (!(mem->flags & perm))
-		goto invalid_access;
+	const struct mmio_subpage *subpage = arg;
+	bool unaligned = mmio->address & (mmio->size - 1);
 
-	/* width bit according to access size needs to be set */
-	if (!((mmio->size << JAILHOUSE_MEM_IO_WIDTH_SHIFT) & mem->flags))
-		goto invalid_access;
-
-	/* naturally unaligned access needs to be allowed explicitly */
-	if (mmio->address & (mmio->size - 1) &&
-	    !(mem->flags & JAILHOUSE_MEM_IO_UNALIGNED))
-		goto invalid_access;
+	this_cpu_data()->stats[JAILHOUSE_CPU_STAT_MMIO_SUBPAGE]++;
 
-	err = paging_create(&hv_paging_structs, page_phys, PAGE_SIZE,
-			    page_virt, PAGE_DEFAULT_FLAGS | PAGE_FLAG_DEVICE,
-			    PAGING_NON_COHERENT);
-	if (err)
+	if (!(subpage->access_mask &
+	      (mmio->size << MMIO_SUBPAGE_ACCESS(mmio->is_write, unaligned))))
 		goto invalid_access;
 
-	/*
-	 * This virt_base gives the following effective virtual address in
-	 * mmio_perform_access:
-	 *
-	 *     page_virt + (mem->phys_start & ~PAGE_MASK) +
-	 *         (mmio->address & ~PAGE_MASK)
-	 *
-	 * Reason: mmio_perform_access does addr = base + mmio->address.
-	 */
-	virt_base = page_virt + (mem->phys_start & ~PAGE_MASK) -
-		(mmio->address & PAGE_MASK);
-	mmio_perform_access((void *)virt_base, mmio);
+	/* mmio_perform_access adds mmio->address, the offset in the region */
+	if (mmio->is_write && subpage->coalesced)
+		mmio_write_coalesced(this_cell(), subpage->pages +
+				     (subpage->phys_start & ~PAGE_MASK), mmio);
+	else
+		mmio_perform_access(subpage->pages +
+				    (subpage->phys_start & ~PAGE_MASK), mmio);
 	return MMIO_HANDLED;
 
 invalid_access:
 	panic_printk("FATAL: Invalid MMIO %s, address: %x, size: %x\n",
 		     mmio->is_write ? "write" : "read",
-		     mem->phys_start + mmio->address, mmio->size);
+		     subpage->phys_start + mmio->address, mmio->size);
 	return MMIO_ERROR;
 }
 
+/* Derive permitted access directions, widths and alignment from flags. */
+static u16 mmio_subpage_access_mask(const struct jailhouse_memory *mem)
+{
+	u16 widths = (mem->flags >> JAILHOUSE_MEM_IO_WIDTH_SHIFT) & 0xf;
+	u16 mask = 0;
+
+	if (mem->flags & JAILHOUSE_MEM_READ) {
+		mask |= widths << MMIO_SUBPAGE_ACCESS(false, false);
+		if (mem->flags & JAILHOUSE_MEM_IO_UNALIGNED)
+			mask |= widths << MMIO_SUBPAGE_ACCESS(false, true);
+	}
+	if (mem->flags & JAILHOUSE_MEM_WRITE) {
+		mask |= widths << MMIO_SUBPAGE_ACCESS(true, false);
+		if (mem->flags & JAILHOUSE_MEM_IO_UNALIGNED)
+			mask |= widths << MMIO_SUBPAGE_ACCESS(true, true);
+	}
+	return mask;
+}
+
+/**
+ * Register a sub-page memory region of a cell. Accesses to it are trapped and
+ * performed via a mapping of the backing pages that is established here and
+ * kept until the region is unregistered or the cell is destroyed.
+ * @param cell		Cell the region belongs to.
+ * @param mem		Region description, does not have to be persistent.
+ *
+ * @return 0 on success, negative error code otherwise.
+ *
+ * @see mmio_subpage_unregister
+ */
 int mmio_subpage_register(struct cell *cell, const struct jailhouse_memory *mem)
 {
-	mmio_region_register(cell, mem->virt_start, mem->size,
-			     mmio_handle_subpage, (void *)mem);
+	struct mmio_subpage *subpage = NULL;
+	unsigned int n;
+	int err;
+
+	for (n = 0; n < cell->max_mmio_regions; n++)
+		if (!cell->mmio_subpages[n].pages) {
+			subpage = &cell->mmio_subpages[n];
+			break;
+		}
+	if (!subpage)
+		return trace_error(-ENOMEM);
+
+	subpage->num_pages = PAGES((mem->phys_start & ~PAGE_MASK) + mem->size);
+	subpage->pages = page_alloc(&remap_pool, subpage->num_pages,
+				    PAGE_OWNER_MMIO);
+	if (!subpage->pages)
+		return trace_error(-ENOMEM);
+
+	err = paging_create(&hv_paging_structs, mem->phys_start,
+			    subpage->num_pages * PAGE_SIZE,
+			    (unsigned long)subpage->pages,
+			    PAGE_DEFAULT_FLAGS | PAGE_FLAG_DEVICE,
+			    PAGING_NON_COHERENT);
+	if (err) {
+		page_free(&remap_pool, subpage->pages, subpage->num_pages,
+			  PAGE_OWNER_MMIO);
+		subpage->pages = NULL;
+		return err;
+	}
+
+	subpage->virt_start = mem->virt_start;
+	subpage->phys_start = mem->phys_start;
+	subpage->access_mask = mmio_subpage_access_mask(mem);
+	subpage->coalesced = cell->mmio_coalesced &&
+		mem->flags & JAILHOUSE_MEM_IO_COALESCED;
+
+	if (subpage->coalesced)
+		mmio_region_register_coalesced(cell, mem->virt_start,
+					       mem->size, mmio_handle_subpage,
+					       subpage);
+	else
+		mmio_region_register(cell, mem->virt_start, mem->size,
+				     mmio_handle_subpage, subpage);
 	return 0;
 }
 
+/**
+ * Unregister a sub-page memory region of a cell and release its mapping.
+ * @param cell		Cell the region belongs to.
+ * @param mem		Region description, only the start address is used.
+ *
+ * @see mmio_subpage_register
+ */
 void mmio_subpage_unregister(struct cell *cell,
 			     const struct jailhouse_memory *mem)
 {
+	unsigned int n;
+
 	mmio_region_unregister(cell, mem->virt_start);
+	/* buffered writes may still refer to the mapping */
+	mmio_flush_coalesced(cell);
+
+	for (n = 0; n < cell->max_mmio_regions; n++)
+		if (cell->mmio_subpages[n].pages &&
+		    cell->mmio_subpages[n].virt_start == mem->virt_start) {
+			mmio_subpage_unmap(&cell->mmio_subpages[n]);
+			break;
+		}
 }
@@ -14,13 +14,21 @@
 #include <jailhouse/printk.h>
 #include <jailhouse/string.h>
 #include <jailhouse/control.h>
+#include <jailhouse/utils.h>
 #include <asm/bitops.h>
 
 #define BITS_PER_PAGE		(PAGE_SIZE * 8)
 
+#define BITMAP_WORDS(bits)	(((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
 #define INVALID_PAGE_NR		(~0UL)
 
+#ifndef CONFIG_MAX_SHARED_PAGE_TABLES
+#define CONFIG_MAX_SHARED_PAGE_TABLES	64
+#endif
+
 #define PAGE_SCRUB_ON_FREE	0x1
+#define PAGE_POOL_MAGAZINES	0x2
 
 extern u8 __page_pool[];
 
@@ -36,9 +44,25 @@ struct page_pool mem_pool;
 /** Page pool containing virtual pages for remappings by the hypervisor. */
 struct page_pool remap_pool = {
 	.base_address = (void *)REMAP_BASE,
-	.pages = BITS_PER_PAGE * NUM_REMAP_BITMAP_PAGES,
+};
+/** Number of pages of the temporary mapping window of each CPU. */
+unsigned int num_temporary_pages;
+
+/** Page table referenced by the paging structures of more than one cell. */
+struct shared_table {
+	/** The table, NULL if the slot is unused. */
+	page_table_t table;
+	/** Number of entries referencing the table, at least 2. */
+	unsigned int refs;
 };
 
+static struct shared_table shared_tables[CONFIG_MAX_SHARED_PAGE_TABLES];
+static unsigned int num_shared_tables;
+/** Page pools over the per-node hypervisor memory, empty if not configured. */
+static struct page_pool node_pools[JAILHOUSE_MAX_MEMORY_NODES];
+/** Cell that hypervisor pages are currently accounted to, if any. */
+static struct cell *charged_cell;
+
 /** Descriptor of the hypervisor paging structures. */
 struct paging_structures hv_paging_structs;
 
@@ -56,113 +80,351 @@ unsigned long paging_get_phys_invalid(pt_entry_t pte, unsigned long virt)
 	return INVALID_PHYS_ADDR;
 }
 
-static unsigned long find_next_free_page(struct page_pool *pool,
-					 unsigned long start)
+static unsigned long pool_first_block(const struct page_pool *pool,
+				      unsigned int order)
 {
-	unsigned long bmp_pos, bmp_val, page_nr;
-	unsigned long start_mask = 0;
+	return pool->offset >> order;
+}
 
-	if (start >= pool->pages)
-		return INVALID_PAGE_NR;
+/* Number of blocks of the given order that overlap with the pool */
+static unsigned long pool_num_blocks(const struct page_pool *pool,
+				     unsigned int order)
+{
+	return ((pool->offset + pool->pages - 1) >> order) -
+		pool_first_block(pool, order) + 1;
+}
 
-	/*
-	 * If we don't start on the beginning of a bitmap word, create a mask
-	 * to mark the pages before the start page as (virtually) used.
-	 */
-	if (start % BITS_PER_LONG > 0)
-		start_mask = ~0UL >> (BITS_PER_LONG - (start % BITS_PER_LONG));
-
-	for (bmp_pos = start / BITS_PER_LONG;
-	     bmp_pos < pool->pages / BITS_PER_LONG; bmp_pos++) {
-		bmp_val = pool->used_bitmap[bmp_pos] | start_mask;
-		start_mask = 0;
-		if (bmp_val != ~0UL) {
-			page_nr = ffzl(bmp_val) + bmp_pos * BITS_PER_LONG;
-			if (page_nr >= pool->pages)
-				break;
-			return page_nr;
+static unsigned long pool_bitmap_size(const struct page_pool *pool)
+{
+	unsigned long size = 0;
+	unsigned int order;
+
+	for (order = 0; order <= PAGE_POOL_MAX_ORDER; order++)
+		size += BITMAP_WORDS(pool_num_blocks(pool, order)) *
+			sizeof(unsigned long);
+	return size;
+}
+
+static bool block_is_free(const struct page_pool *pool, unsigned int order,
+			  unsigned long block)
+{
+	unsigned long first = pool_first_block(pool, order);
+
+	if (block < first || block - first >= pool_num_blocks(pool, order))
+		return false;
+	return test_bit(block - first, pool->free_bitmap[order]);
+}
+
+static void take_block(struct page_pool *pool, unsigned int order,
+		       unsigned long block)
+{
+	clear_bit(block - pool_first_block(pool, order),
+		  pool->free_bitmap[order]);
+	pool->free_blocks[order]--;
+}
+
+static void put_block(struct page_pool *pool, unsigned int order,
+		      unsigned long block)
+{
+	unsigned long bit = block - pool_first_block(pool, order);
+
+	set_bit(bit, pool->free_bitmap[order]);
+	pool->free_blocks[order]++;
+	if (bit / BITS_PER_LONG < pool->search_hint[order])
+		pool->search_hint[order] = bit / BITS_PER_LONG;
+}
+
+/* Return block number of the lowest free block of the given order. */
+static unsigned long find_free_block(struct page_pool *pool,
+				     unsigned int order)
+{
+	unsigned long words = BITMAP_WORDS(pool_num_blocks(pool, order));
+	unsigned long *bitmap = pool->free_bitmap[order];
+	unsigned long pos;
+
+	for (pos = pool->search_hint[order]; pos < words; pos++)
+		if (bitmap[pos] != 0) {
+			pool->search_hint[order] = pos;
+			return pos * BITS_PER_LONG + ffsl(bitmap[pos]) +
+				pool_first_block(pool, order);
 		}
-	}
 
 	return INVALID_PAGE_NR;
 }
 
+/*
+ * Release a naturally aligned block, starting at block position pos, merging
+ * it with free buddies as far as possible.
+ */
+static void free_block(struct page_pool *pool, unsigned long pos,
+		       unsigned int order)
+{
+	unsigned long buddy;
+
+	while (order < PAGE_POOL_MAX_ORDER) {
+		buddy = (pos >> order) ^ 1;
+		if (!block_is_free(pool, order, buddy))
+			break;
+		take_block(pool, order, buddy);
+		pos &= ~(1UL << order);
+		order++;
+	}
+	put_block(pool, order, pos >> order);
+}
+
+/* Release an arbitrary page range by splitting it into aligned blocks. */
+static void free_range(struct page_pool *pool, unsigned long page_nr,
+		       unsigned long num)
+{
+	unsigned long pos = pool->offset + page_nr;
+	unsigned int order;
+
+	while (num > 0) {
+		order = pos ? ffsl(pos) : PAGE_POOL_MAX_ORDER;
+		if (order > PAGE_POOL_MAX_ORDER)
+			order = PAGE_POOL_MAX_ORDER;
+		while ((1UL << order) > num)
+			order--;
+
+		free_block(pool, pos, order);
+
+		pos += 1UL << order;
+		num -= 1UL << order;
+	}
+}
+
+static unsigned int num_to_order(unsigned long num)
+{
+	if (num <= 1)
+		return 0;
+	return BITS_PER_LONG - __builtin_clzl(num - 1);
+}
+
+/*
+ * Initialize the buddy bitmaps of a pool, using the provided zeroed storage
+ * of pool_bitmap_size() bytes. The first reserved pages are marked as used.
+ */
+static void page_pool_init(struct page_pool *pool, unsigned long *bitmap,
+			   unsigned long reserved)
+{
+	unsigned int order;
+
+	for (order = 0; order <= PAGE_POOL_MAX_ORDER; order++) {
+		pool->free_bitmap[order] = bitmap;
+		pool->free_blocks[order] = 0;
+		pool->search_hint[order] = 0;
+		bitmap += BITMAP_WORDS(pool_num_blocks(pool, order));
+	}
+
+	pool->used_pages = reserved;
+	free_range(pool, reserved, pool->pages - reserved);
+}
+
 /**
  * Allocate consecutive pages from the specified pool.
  * @param pool		Page pool to allocate from.
  * @param num		Number of pages.
- * @param align_mask	Choose start so that start_page_no & align_mask == 0.
  *
  * @return Pointer to first page or NULL if allocation failed.
  *
+ * @note The returned pages are aligned according to the smallest power of two
+ * that is equal to or larger than @c num.
+ *
  * @see page_free
  */
-static void *page_alloc_internal(struct page_pool *pool, unsigned int num,
-				 unsigned long align_mask)
-{
-	/* The pool itself might not be aligned as required. */
-	unsigned long aligned_start =
-		((unsigned long)pool->base_address >> PAGE_SHIFT) & align_mask;
-	unsigned long next = aligned_start;
-	unsigned long start, last;
-	unsigned int allocated;
-
-restart:
-	/* Forward the search start to the next aligned page. */
-	if ((next - aligned_start) & align_mask)
-		next += num - ((next - aligned_start) & align_mask);
-
-	start = next = find_next_free_page(pool, next);
-	if (start == INVALID_PAGE_NR || num == 0)
-		return NULL;
+static void *page_alloc_internal(struct page_pool *pool, unsigned int num)
+{
+	unsigned int order = num_to_order(num);
+	unsigned long block, pos;
+	unsigned int n;
 
-	/* Enforce alignment (none of align_mask is 0). */
-	if ((start - aligned_start) & align_mask)
-		goto restart;
+	if (num == 0 || order > PAGE_POOL_MAX_ORDER)
+		return NULL;
 
-	for (allocated = 1, last = start; allocated < num;
-	     allocated++, last = next) {
-		next = find_next_free_page(pool, last + 1);
-		if (next == INVALID_PAGE_NR)
+	/* Fast path: a free block of the requested order is available. */
+	for (n = order; pool->free_blocks[n] == 0; n++)
+		if (n == PAGE_POOL_MAX_ORDER)
 			return NULL;
-		if (next != last + 1)
-			goto restart;	/* not consecutive */
+
+	block = find_free_block(pool, n);
+	take_block(pool, n, block);
+	pos = block << n;
+
+	/* Split larger block, putting back the upper halves. */
+	while (n > order) {
+		n--;
+		put_block(pool, n, (pos >> n) + 1);
 	}
 
-	for (allocated = 0; allocated < num; allocated++)
-		set_bit(start + allocated, pool->used_bitmap);
+	/* Give back the unneeded tail of the block. */
+	if (num < (1UL << order))
+		free_range(pool, pos - pool->offset + num,
+			   (1UL << order) - num);
 
 	pool->used_pages += num;
 
-	return pool->base_address + start * PAGE_SIZE;
+	return pool->base_address + (pos - pool->offset) * PAGE_SIZE;
+}
+
+static void *pool_alloc(struct page_pool *pool, unsigned int num)
+{
+	void *pages;
+
+	spin_lock(&pool->lock);
+	pages = page_alloc_internal(pool, num);
+	spin_unlock(&pool->lock);
+
+	return pages;
+}
+
+/* Return the oldest num pages of the magazine to the pool. */
+static void magazine_drain(struct page_pool *pool, struct page_magazine *mag,
+			   unsigned int num)
+{
+	unsigned int n;
+
+	spin_lock(&pool->lock);
+	for (n = 0; n < num; n++)
+		free_range(pool, (mag->pages[n] - pool->base_address) /
+				 PAGE_SIZE, 1);
+	pool->used_pages -= num;
+	spin_unlock(&pool->lock);
+
+	mag->count -= num;
+	for (n = 0; n < mag->count; n++)
+		mag->pages[n] = mag->pages[n + num];
+}
+
+/*
+ * Refill an empty magazine, preferably with a single block that is then split
+ * up, otherwise with as many single pages as available.
+ */
+static void magazine_refill(struct page_pool *pool, struct page_magazine *mag)
+{
+	void *block, *page;
+	unsigned int n;
+
+	spin_lock(&pool->lock);
+	block = page_alloc_internal(pool, PAGE_MAGAZINE_BATCH);
+	if (block) {
+		/* hand out the lowest page first */
+		for (n = PAGE_MAGAZINE_BATCH; n > 0; n--)
+			mag->pages[mag->count++] = block + (n - 1) * PAGE_SIZE;
+	} else {
+		while (mag->count < PAGE_MAGAZINE_BATCH) {
+			page = page_alloc_internal(pool, 1);
+			if (!page)
+				break;
+			mag->pages[mag->count++] = page;
+		}
+	}
+	spin_unlock(&pool->lock);
+}
+
+/*
+ * Management operations are serialized, so plain updates of the counters
+ * suffice.
+ */
+static void account_pages(struct page_pool *pool, enum page_owner owner,
+			  long pages)
+{
+	pool->owner_pages[owner] += pages;
+	if (charged_cell && pool != &remap_pool)
+		charged_cell->hv_pages += pages;
+}
+
+/*
+ * Return the pages of all magazines to the pool. Called with no magazine lock
+ * held, so magazine locks always nest outside of the pool lock.
+ */
+static void magazines_reclaim(struct page_pool *pool)
+{
+	struct page_magazine *mag;
+	unsigned int cpu;
+
+	for (cpu = 0; cpu < hypervisor_header.max_cpus; cpu++) {
+		mag = &per_cpu(cpu)->page_magazine;
+		spin_lock(&mag->lock);
+		if (mag->count > 0)
+			magazine_drain(pool, mag, mag->count);
+		spin_unlock(&mag->lock);
+	}
+}
+
+static void *pool_alloc_cached(struct page_pool *pool, unsigned int num)
+{
+	struct page_magazine *mag;
+	void *pages = NULL;
+
+	if (!(pool->flags & PAGE_POOL_MAGAZINES))
+		return pool_alloc(pool, num);
+
+	if (num == 1) {
+		mag = &this_cpu_data()->page_magazine;
+		spin_lock(&mag->lock);
+		if (mag->count == 0)
+			magazine_refill(pool, mag);
+		if (mag->count > 0)
+			pages = mag->pages[--mag->count];
+		spin_unlock(&mag->lock);
+		if (pages)
+			return pages;
+	} else {
+		pages = pool_alloc(pool, num);
+		if (pages)
+			return pages;
+	}
+
+	/*
+	 * Other CPUs may still cache free pages, and those may also complete
+	 * a larger block.
+	 */
+	magazines_reclaim(pool);
+	return pool_alloc(pool, num);
 }
 
 /**
  * Allocate consecutive pages from the specified pool.
  * @param pool	Page pool to allocate from.
  * @param num	Number of pages.
+ * @param owner	Subsystem the pages are accounted to.
  *
  * @return Pointer to first page or NULL if allocation failed.
  *
+ * @note Single pages of mem_pool are served from the magazine of the calling
+ * CPU once paging_enable_magazines was called.
+ *
  * @see page_free
  */
-void *page_alloc(struct page_pool *pool, unsigned int num)
+void *page_alloc(struct page_pool *pool, unsigned int num,
+		 enum page_owner owner)
 {
-	return page_alloc_internal(pool, num, 0);
+	void *pages = pool_alloc_cached(pool, num);
+
+	if (pages)
+		account_pages(pool, owner, num);
+	return pages;
 }
 
 /**
  * Allocate aligned consecutive pages from the specified pool.
  * @param pool	Page pool to allocate from.
  * @param num	Number of pages. Num needs to be a power of 2.
+ * @param owner	Subsystem the pages are accounted to.
  *
  * @return Pointer to first page or NULL if allocation failed.
  *
  * @see page_free
  */
-void *page_alloc_aligned(struct page_pool *pool, unsigned int num)
+void *page_alloc_aligned(struct page_pool *pool, unsigned int num,
+			 enum page_owner owner)
 {
-	return page_alloc_internal(pool, num, num - 1);
+	/*
+	 * Invariant: a buddy block of order n starts at a multiple of 2^n
+	 * pages, and page_alloc_internal serves each request from the head of
+	 * one block of the rounded-up order. Magazines only hold single pages.
+	 */
+	return page_alloc(pool, num, owner);
 }
 
 /**
@@ -170,24 +432,144 @@ void *page_alloc_aligned(struct page_pool *pool, unsigned int num)
  * @param pool	Page pool to release to.
  * @param page	Address of first page.
  * @param num	Number of pages.
+ * @param owner	Subsystem the pages were allocated for.
  *
  * @see page_alloc
  */
-void page_free(struct page_pool *pool, void *page, unsigned int num)
+void page_free(struct page_pool *pool, void *page, unsigned int num,
+	       enum page_owner owner)
 {
-	unsigned long page_nr;
+	struct page_magazine *mag;
+	unsigned int n;
 
-	if (!page)
+	if (!page || num == 0)
 		return;
 
-	while (num-- > 0) {
-		if (pool->flags & PAGE_SCRUB_ON_FREE)
-			memset(page, 0, PAGE_SIZE);
-		page_nr = (page - pool->base_address) / PAGE_SIZE;
-		clear_bit(page_nr, pool->used_bitmap);
-		pool->used_pages--;
-		page += PAGE_SIZE;
+	account_pages(pool, owner, -(long)num);
+
+	if (pool->flags & PAGE_SCRUB_ON_FREE)
+		for (n = 0; n < num; n++)
+			memset(page + n * PAGE_SIZE, 0, PAGE_SIZE);
+
+	if (num == 1 && pool->flags & PAGE_POOL_MAGAZINES) {
+		mag = &this_cpu_data()->page_magazine;
+		spin_lock(&mag->lock);
+		if (mag->count == PAGE_MAGAZINE_SIZE)
+			magazine_drain(pool, mag, PAGE_MAGAZINE_BATCH);
+		mag->pages[mag->count++] = page;
+		spin_unlock(&mag->lock);
+		return;
+	}
+
+	spin_lock(&pool->lock);
+	free_range(pool, (page - pool->base_address) / PAGE_SIZE, num);
+	pool->used_pages -= num;
+	spin_unlock(&pool->lock);
+}
+
+/**
+ * Account hypervisor pages allocated or released from now on to a cell.
+ * @param cell	Cell to charge, or NULL to stop charging.
+ *
+ * Only pages of mem_pool and the node pools are charged.
+ */
+void paging_charge_cell(struct cell *cell)
+{
+	charged_cell = cell;
+}
+
+/**
+ * Get the number of hypervisor pages used by a subsystem.
+ * @param owner	Subsystem to query.
+ *
+ * @return Pages allocated for the subsystem from mem_pool and the node pools.
+ */
+unsigned long paging_owner_pages(enum page_owner owner)
+{
+	unsigned long pages = mem_pool.owner_pages[owner];
+	unsigned int n;
+
+	for (n = 0; n < JAILHOUSE_MAX_MEMORY_NODES; n++)
+		pages += node_pools[n].owner_pages[owner];
+	return pages;
+}
+
+/**
+ * Put per-CPU page magazines in front of mem_pool.
+ *
+ * @note Must only be called when all CPUs that may allocate pages can access
+ * their per-CPU data via this_cpu_data.
+ */
+void paging_enable_magazines(void)
+{
+	mem_pool.flags |= PAGE_POOL_MAGAZINES;
+}
+
+/**
+ * Get the number of pages of a pool that are actually in use.
+ * @param pool	Page pool to query.
+ *
+ * @return Used pages, not counting free pages cached in page magazines.
+ */
+unsigned long paging_pool_used_pages(const struct page_pool *pool)
+{
+	unsigned long used = pool->used_pages;
+	unsigned int cpu;
+
+	if (pool->flags & PAGE_POOL_MAGAZINES)
+		for (cpu = 0; cpu < hypervisor_header.max_cpus; cpu++)
+			used -= per_cpu(cpu)->page_magazine.count;
+	return used;
+}
+
+/**
+ * Select the page pool for the data structures of a cell.
+ * @param config	Configuration of the cell.
+ *
+ * @return Pool of the memory node the first CPU of the cell belongs to, or
+ * 	   @c mem_pool if there is no such node.
+ *
+ * @see paging_pool_of
+ */
+struct page_pool *paging_node_pool(const struct jailhouse_cell_desc *config)
+{
+	const unsigned long *cpu_set = jailhouse_cell_cpu_set(config);
+	const struct jailhouse_memory_node *node;
+	unsigned int cpu, n;
+
+	for (cpu = 0; cpu < config->cpu_set_size * 8; cpu++)
+		if (test_bit(cpu, cpu_set))
+			break;
+	if (cpu >= JAILHOUSE_MEMORY_NODE_CPUS)
+		return &mem_pool;
+
+	for (n = 0; n < JAILHOUSE_MAX_MEMORY_NODES; n++) {
+		node = &system_config->memory_nodes[n];
+		if (node_pools[n].pages > 0 &&
+		    node->cpu_set[cpu / 8] & (1 << (cpu % 8)))
+			return &node_pools[n];
 	}
+	return &mem_pool;
+}
+
+/**
+ * Look up the page pool a page was allocated from.
+ * @param page		Address of the page.
+ *
+ * @return Node pool containing the page, @c mem_pool otherwise.
+ *
+ * @see paging_node_pool
+ */
+struct page_pool *paging_pool_of(const void *page)
+{
+	unsigned int n;
+
+	for (n = 0; n < JAILHOUSE_MAX_MEMORY_NODES; n++)
+		if (page >= node_pools[n].base_address &&
+		    page < node_pools[n].base_address +
+			   node_pools[n].pages * PAGE_SIZE)
+			return &node_pools[n];
+	return &mem_pool;
 }
 
 /**
@@ -231,8 +613,156 @@ static void flush_pt_entry(pt_entry_t pte, enum paging_coherent coherent)
 		arch_paging_flush_cpu_caches(pte, sizeof(*pte));
 }
 
-static int split_hugepage(const struct paging *paging, pt_entry_t pte,
-			  unsigned long virt, enum paging_coherent coherent)
+static page_table_t next_table(const struct paging *paging, pt_entry_t pte)
+{
+	if (!paging->entry_valid(pte, PAGE_PRESENT_FLAGS) ||
+	    paging->get_phys(pte, 0) != INVALID_PHYS_ADDR)
+		return NULL;
+	return paging_phys2hvirt(paging->get_next_pt(pte));
+}
+
+static struct shared_table *shared_table_find(page_table_t pt)
+{
+	unsigned int n;
+
+	if (num_shared_tables == 0 || !pt)
+		return NULL;
+
+	for (n = 0; n < ARRAY_SIZE(shared_tables); n++)
+		if (shared_tables[n].table == pt)
+			return &shared_tables[n];
+	return NULL;
+}
+
+/* Add a reference to pt, registering it as shared on the first one. */
+static bool shared_table_get(page_table_t pt)
+{
+	struct shared_table *shared = shared_table_find(pt);
+	unsigned int n;
+
+	if (shared) {
+		shared->refs++;
+		return true;
+	}
+
+	for (n = 0; n < ARRAY_SIZE(shared_tables); n++)
+		if (!shared_tables[n].table) {
+			shared_tables[n].table = pt;
+			shared_tables[n].refs = 2;
+			num_shared_tables++;
+			return true;
+		}
+	return false;
+}
+
+/* Drop a reference to pt. Returns true if the table is still referenced. */
+static bool shared_table_put(page_table_t pt)
+{
+	struct shared_table *shared = shared_table_find(pt);
+
+	if (!shared)
+		return false;
+
+	if (--shared->refs == 1) {
+		shared->table = NULL;
+		num_shared_tables--;
+	}
+	return true;
+}
+
+static void destroy_tables(const struct paging *paging, page_table_t pt,
+			   unsigned int pages)
+{
+	pt_entry_t pte, end = pt + pages * PAGE_SIZE / sizeof(*pt);
+	page_table_t next_pt;
+
+	for (pte = pt; pte < end; pte++) {
+		next_pt = next_table(paging, pte);
+		if (!next_pt || shared_table_put(next_pt))
+			continue;
+		destroy_tables(paging + 1, next_pt, 1);
+		page_free(paging_pool_of(next_pt), next_pt, 1,
+			  PAGE_OWNER_PAGING);
+	}
+}
+
+/* Drop a reference to a table, releasing it and its subtree on the last. */
+static void release_table(const struct paging *paging, page_table_t pt)
+{
+	if (shared_table_put(pt))
+		return;
+	destroy_tables(paging, pt, 1);
+	page_free(paging_pool_of(pt), pt, 1, PAGE_OWNER_PAGING);
+}
+
+/*
+ * Copy a table that is about to be modified. Its child tables are shared
+ * between original and copy. Once the registry of shared tables is full,
+ * sharing stops, and the child tables are copied as well.
+ */
+static page_table_t copy_table(struct page_pool *pool,
+			       const struct paging *paging, page_table_t pt,
+			       enum paging_coherent coherent)
+{
+	pt_entry_t entry, copy_entry, end = pt + PAGE_SIZE / sizeof(*pt);
+	page_table_t copy, next_pt, next_copy;
+
+	copy = page_alloc(pool, 1, PAGE_OWNER_PAGING);
+	if (!copy)
+		return NULL;
+	memcpy(copy, pt, PAGE_SIZE);
+
+	for (entry = pt, copy_entry = copy; entry < end;
+	     entry++, copy_entry++) {
+		next_pt = next_table(paging, entry);
+		if (!next_pt || shared_table_get(next_pt))
+			continue;
+
+		next_copy = copy_table(pool, paging + 1, next_pt, coherent);
+		if (!next_copy) {
+			/* the remaining entries hold no references yet */
+			for (; copy_entry < copy + PAGE_SIZE / sizeof(*pt);
+			     copy_entry++)
+				paging->clear_entry(copy_entry);
+			release_table(paging, copy);
+			return NULL;
+		}
+		paging->set_next_pt(copy_entry, paging_hvirt2phys(next_copy));
+	}
+	if (coherent == PAGING_COHERENT)
+		arch_paging_flush_cpu_caches(copy, PAGE_SIZE);
+
+	return copy;
+}
+
+/*
+ * Replace the table below a non-terminal entry by a private copy if it is
+ * shared, so that it can be modified. This only fails if the pool runs out
+ * of pages, not because of a full registry of shared tables.
+ */
+static int unshare_table(struct page_pool *pool, const struct paging *paging,
+			 pt_entry_t pte, enum paging_coherent coherent)
+{
+	page_table_t pt = paging_phys2hvirt(paging->get_next_pt(pte));
+	page_table_t copy;
+
+	if (!shared_table_find(pt))
+		return 0;
+
+	copy = copy_table(pool, paging + 1, pt, coherent);
+	if (!copy)
+		return -ENOMEM;
+
+	paging->set_next_pt(pte, paging_hvirt2phys(copy));
+	flush_pt_entry(pte, coherent);
+	shared_table_put(pt);
+
+	return 0;
+}
+
+static int split_hugepage(struct page_pool *pool, const struct paging *paging,
+			  pt_entry_t pte, unsigned long virt,
+			  enum paging_coherent coherent)
 {
 	unsigned long phys = paging->get_phys(pte, virt);
 	struct paging_structures sub_structs;
@@ -248,7 +778,7 @@ static int split_hugepage(const struct paging *paging, pt_entry_t pte,
 	flags = paging->get_flags(pte);
 
 	sub_structs.root_paging = paging + 1;
-	sub_structs.root_table = page_alloc(&mem_pool, 1);
+	sub_structs.root_table = page_alloc(pool, 1, PAGE_OWNER_PAGING);
 	if (!sub_structs.root_table)
 		return -ENOMEM;
 	paging->set_next_pt(pte, paging_hvirt2phys(sub_structs.root_table));
@@ -271,15 +801,20 @@ static int split_hugepage(const struct paging *paging, pt_entry_t pte,
  * @return 0 on success, negative error code otherwise.
  *
  * @note The function aims at using the largest possible page size for the
- * mapping but does not consolidate with neighboring mappings.
+ * mapping but does not consolidate with neighboring mappings. Use
+ * paging_merge for this.
  *
  * @see paging_destroy
+ * @see paging_merge
  * @see paging_get_guest_pages
  */
 int paging_create(const struct paging_structures *pg_structs,
 		  unsigned long phys, unsigned long size, unsigned long virt,
 		  unsigned long flags, enum paging_coherent coherent)
 {
+	/* page tables follow the root table to its memory node */
+	struct page_pool *pool = paging_pool_of(pg_structs->root_table);
+
 	phys &= PAGE_MASK;
 	virt &= PAGE_MASK;
 	size = PAGE_ALIGN(size);
@@ -287,37 +822,27 @@ int paging_create(const struct paging_structures *pg_structs,
 	while (size > 0) {
 		const struct paging *paging = pg_structs->root_paging;
 		page_table_t pt = pg_structs->root_table;
-		pt_entry_t pte;
+		pt_entry_t pte, first_pte, last_pte;
 		int err;
 
 		while (1) {
 			pte = paging->get_entry(pt, virt);
 			if (paging->page_size > 0 &&
 			    paging->page_size <= size &&
-			    ((phys | virt) & (paging->page_size - 1)) == 0) {
-				/*
-				 * We might be overwriting a more fine-grained
-				 * mapping, so release it first. This cannot
-				 * fail as we are working along hugepage
-				 * boundaries.
-				 */
-				if (paging->page_size > PAGE_SIZE)
-					paging_destroy(pg_structs, virt,
-						       paging->page_size,
-						       coherent);
-				paging->set_terminal(pte, phys, flags);
-				flush_pt_entry(pte, coherent);
+			    ((phys | virt) & (paging->page_size - 1)) == 0)
 				break;
-			}
 			if (paging->entry_valid(pte, PAGE_PRESENT_FLAGS)) {
-				err = split_hugepage(paging, pte, virt,
+				err = split_hugepage(pool, paging, pte, virt,
 						     coherent);
+				if (!err)
+					err = unshare_table(pool, paging, pte,
+							    coherent);
 				if (err)
 					return err;
 				pt = paging_phys2hvirt(
 						paging->get_next_pt(pte));
 			} else {
-				pt = page_alloc(&mem_pool, 1);
+				pt = page_alloc(pool, 1, PAGE_OWNER_PAGING);
 				if (!pt)
 					return -ENOMEM;
 				paging->set_next_pt(pte,
@@ -326,12 +851,42 @@ int paging_create(const struct paging_structures *pg_structs,
 			}
 			paging++;
 		}
-		if (pg_structs == &hv_paging_structs)
-			arch_paging_flush_page_tlbs(virt);
 
-		phys += paging->page_size;
-		virt += paging->page_size;
-		size -= paging->page_size;
+		/*
+		 * Fill all consecutive entries of this table that can take
+		 * pages of the selected size without walking again from the
+		 * root. phys and virt stay aligned to the page size while
+		 * advancing. Leave the loop when the next entry wraps around
+		 * into the beginning of the table.
+		 */
+		first_pte = pte;
+		do {
+			/*
+			 * We might be overwriting a more fine-grained
+			 * mapping, so release it first. This cannot fail as
+			 * we are working along hugepage boundaries.
+			 */
+			if (paging->page_size > PAGE_SIZE &&
+			    paging->entry_valid(pte, PAGE_PRESENT_FLAGS))
+				paging_destroy(pg_structs, virt,
+					       paging->page_size, coherent);
+			paging->set_terminal(pte, phys, flags);
+			if (pg_structs == &hv_paging_structs)
+				arch_paging_flush_page_tlbs(virt);
+
+			phys += paging->page_size;
+			virt += paging->page_size;
+			size -= paging->page_size;
+
+			last_pte = pte;
+			if (size < paging->page_size)
+				break;
+			pte = paging->get_entry(pt, virt);
+		} while (pte > last_pte);
+
+		if (coherent == PAGING_COHERENT)
+			arch_paging_flush_cpu_caches(first_pte,
+				(last_pte - first_pte + 1) * sizeof(*pte));
 	}
 	return 0;
 }
@@ -348,7 +903,8 @@ int paging_create(const struct paging_structures *pg_structs,
  * @note If required, this function tries to break up hugepages if they should
  * be unmapped only partially. This may require allocating additional pages for
  * the paging structures, thus can fail. Unmap request that covers only full
- * pages never fail.
+ * pages never fail. The same applies to page tables shared with other cells,
+ * which have to be copied unless they are unmapped completely.
  *
  * @see paging_create
  */
@@ -356,6 +912,8 @@ int paging_destroy(const struct paging_structures *pg_structs,
 		   unsigned long virt, unsigned long size,
 		   enum paging_coherent coherent)
 {
+	struct page_pool *pool = paging_pool_of(pg_structs->root_table);
+
 	size = PAGE_ALIGN(size);
 
 	while (size > 0) {
@@ -374,13 +932,22 @@ int paging_destroy(const struct paging_structures *pg_structs,
 				break;
 			if (paging->get_phys(pte, virt) != INVALID_PHYS_ADDR) {
 				if (paging->page_size > size) {
-					err = split_hugepage(paging, pte, virt,
-							     coherent);
+					err = split_hugepage(pool, paging, pte,
+							     virt, coherent);
 					if (err)
 						return err;
 				} else
 					break;
 			}
+			/* a fully covered shared subtree only loses a ref */
+			if (paging->page_size > 0 &&
+			    paging->page_size <= size &&
+			    (virt & (paging->page_size - 1)) == 0 &&
+			    shared_table_put(next_table(paging, pte)))
+				break;
+			err = unshare_table(pool, paging, pte, coherent);
+			if (err)
+				return err;
 			pt[++n] = paging_phys2hvirt(paging->get_next_pt(pte));
 			paging++;
 		}
@@ -393,7 +960,8 @@ int paging_destroy(const struct paging_structures *pg_structs,
 			flush_pt_entry(pte, coherent);
 			if (n == 0 || !paging->page_table_empty(pt[n]))
 				break;
-			page_free(&mem_pool, pt[n], 1);
+			page_free(paging_pool_of(pt[n]), pt[n], 1,
+				  PAGE_OWNER_PAGING);
 			paging--;
 			pte = paging->get_entry(pt[--n], virt);
 		}
@@ -408,6 +976,204 @@ int paging_destroy(const struct paging_structures *pg_structs,
 	return 0;
 }
 
+/**
+ * Release all page tables below the root table of a paging structure.
+ * @param pg_structs	Descriptor of paging structures to be torn down.
+ * @param root_pages	Number of pages of the root table.
+ *
+ * In contrast to paging_destroy, entries are neither cleared nor flushed
+ * one by one. The tables are released in a single pass, and the root table
+ * is cleared at the end. The cost thus only depends on the number of page
+ * tables, not on the size of the mapped regions. Tables shared with other
+ * cells only lose a reference.
+ *
+ * @note The paging structures must no longer be in use by any CPU or device.
+ * The caller is responsible for flushing the related TLBs afterwards.
+ *
+ * @see paging_destroy
+ */
+void paging_destroy_tables(const struct paging_structures *pg_structs,
+			   unsigned int root_pages)
+{
+	destroy_tables(pg_structs->root_paging, pg_structs->root_table,
+		       root_pages);
+	memset(pg_structs->root_table, 0, root_pages * PAGE_SIZE);
+}
+
+static void merge_hugepage(const struct paging_structures *pg_structs,
+			   unsigned int level, unsigned long virt,
+			   enum paging_coherent coherent)
+{
+	struct page_pool *pool = paging_pool_of(pg_structs->root_table);
+	const struct paging *paging = pg_structs->root_paging;
+	page_table_t pt = pg_structs->root_table;
+	unsigned long phys, flags, offs, child_phys;
+	const struct paging *child;
+	page_table_t child_pt;
+	pt_entry_t pte, child_pte;
+	unsigned int n;
+
+	virt &= ~(paging[level].page_size - 1);
+
+	for (n = 0; n <= level; n++, paging++) {
+		pte = paging->get_entry(pt, virt);
+		if (!paging->entry_valid(pte, PAGE_PRESENT_FLAGS) ||
+		    paging->get_phys(pte, virt) != INVALID_PHYS_ADDR)
+			return;
+		if (n < level) {
+			/* merging is optional, skip it if unsharing fails */
+			if (unshare_table(pool, paging, pte, coherent))
+				return;
+			pt = paging_phys2hvirt(paging->get_next_pt(pte));
+		}
+	}
+	paging--;
+
+	/*
+	 * The child table can be replaced by a single terminal entry if all
+	 * its entries are terminal, map contiguous physical memory starting
+	 * at a suitably aligned address and share the same access flags.
+	 */
+	child = paging + 1;
+	child_pt = paging_phys2hvirt(paging->get_next_pt(pte));
+	phys = INVALID_PHYS_ADDR;
+	flags = 0;
+	for (offs = 0; offs < paging->page_size; offs += child->page_size) {
+		child_pte = child->get_entry(child_pt, virt + offs);
+		if (!child->entry_valid(child_pte, PAGE_PRESENT_FLAGS))
+			return;
+		child_phys = child->get_phys(child_pte, virt + offs);
+		if (child_phys == INVALID_PHYS_ADDR)
+			return;
+		if (offs == 0) {
+			if (child_phys & (paging->page_size - 1))
+				return;
+			phys = child_phys;
+			flags = child->get_flags(child_pte);
+		} else if (child_phys != phys + offs ||
+			   child->get_flags(child_pte) != flags) {
+			return;
+		}
+	}
+
+	paging->set_terminal(pte, phys, flags);
+	flush_pt_entry(pte, coherent);
+	release_table(child, child_pt);
+}
+
+/**
+ * Merge fine-grained mappings at the borders of a region into hugepages.
+ * @param pg_structs	Descriptor of paging structures to be used.
+ * @param virt		Virtual start address of the region.
+ * @param size		Size of the region.
+ * @param coherent	Coherency of mapping.
+ *
+ * After a region has been (re-)mapped via paging_create, page tables that
+ * cover its borders may have become fully populated with contiguous pages of
+ * identical access flags. Such tables are collapsed into a hugepage entry of
+ * the next higher level, and the table pages are returned to the pool.
+ * The inner part of the region is already mapped with the largest possible
+ * page size by paging_create.
+ *
+ * @note Must not be used on hv_paging_structs as no TLB flushes are issued.
+ *
+ * @see paging_create
+ */
+void paging_merge(const struct paging_structures *pg_structs,
+		  unsigned long virt, unsigned long size,
+		  enum paging_coherent coherent)
+{
+	const struct paging *paging = pg_structs->root_paging;
+	unsigned long last = (virt & PAGE_MASK) + PAGE_ALIGN(size) - 1;
+	unsigned int levels = 0;
+
+	if (size == 0)
+		return;
+
+	while (paging[levels].page_size != PAGE_SIZE)
+		levels++;
+
+	/* bottom-up, so that merged entries can be merged further */
+	while (levels-- > 0) {
+		if (paging[levels].page_size == 0 ||
+		    paging[levels + 1].page_size == 0)
+			continue;
+		merge_hugepage(pg_structs, levels, virt, coherent);
+		if ((virt ^ last) & ~(paging[levels].page_size - 1))
+			merge_hugepage(pg_structs, levels, last, coherent);
+	}
+}
+
+static bool tables_equal(page_table_t pt1, page_table_t pt2)
+{
+	const unsigned long *word1 = (unsigned long *)pt1;
+	const unsigned long *word2 = (unsigned long *)pt2;
+	unsigned int n;
+
+	for (n = 0; n < PAGE_SIZE / sizeof(unsigned long); n++)
+		if (word1[n] != word2[n])
+			return false;
+	return true;
+}
+
+static void share_tables(const struct paging *paging, page_table_t pt,
+			 page_table_t other, unsigned int pages)
+{
+	pt_entry_t pte, other_pte, end = pt + pages * PAGE_SIZE / sizeof(*pt);
+	page_table_t next_pt, other_next_pt;
+
+	for (pte = pt, other_pte = other; pte < end; pte++, other_pte++) {
+		next_pt = next_table(paging, pte);
+		other_next_pt = next_table(paging, other_pte);
+		/* only private tables of the new cell are modified */
+		if (!next_pt || !other_next_pt || next_pt == other_next_pt ||
+		    shared_table_find(next_pt))
+			continue;
+
+		/* bottom-up, so that the parents can become equal as well */
+		share_tables(paging + 1, next_pt, other_next_pt, 1);
+
+		if (!tables_equal(next_pt, other_next_pt) ||
+		    !shared_table_get(other_next_pt))
+			continue;
+
+		paging->set_next_pt(pte, paging_hvirt2phys(other_next_pt));
+		flush_pt_entry(pte, PAGING_COHERENT);
+		release_table(paging + 1, next_pt);
+	}
+}
+
+/**
+ * Share page tables of a new cell with identical ones of existing cells.
+ * @param cell		Cell whose paging structures were just created.
+ *
+ * Cells created from similar configurations often map the same device
+ * windows or shared memory regions at the same addresses. Each table below
+ * the root of the cell that has an equal counterpart at the same position in
+ * another non-root cell is released, and the entry is redirected to that
+ * counterpart. Subtrees are compared bottom-up, so whole branches can be
+ * shared. Shared tables are reference-counted and copied before being
+ * modified, see unshare_table.
+ *
+ * @note Must be called before the cell is started and before it is added to
+ * the cell list. At most CONFIG_MAX_SHARED_PAGE_TABLES tables are shared.
+ */
+void paging_share_tables(struct cell *cell)
+{
+	const struct paging_structures *pg_structs =
+		arch_cell_paging_structs(cell);
+	const struct paging_structures *other_structs;
+	struct cell *other;
+
+	for_each_non_root_cell(other) {
+		other_structs = arch_cell_paging_structs(other);
+		if (other_structs->root_paging != pg_structs->root_paging)
+			continue;
+		share_tables(pg_structs->root_paging, pg_structs->root_table,
+			     other_structs->root_table, CELL_ROOT_PT_PAGES);
+	}
+}
+
 static unsigned long
 paging_gvirt2gphys(const struct guest_paging_structures *pg_structs,
 		   unsigned long gvirt, unsigned long tmp_page,
@@ -468,11 +1234,11 @@ void *paging_get_guest_pages(const struct guest_paging_structures *pg_structs,
 			     unsigned long flags)
 {
 	unsigned long page_base = TEMPORARY_MAPPING_BASE +
-		this_cpu_id() * PAGE_SIZE * NUM_TEMPORARY_PAGES;
+		this_cpu_id() * PAGE_SIZE * num_temporary_pages;
 	unsigned long phys, gphys, page_virt = page_base;
 	int err;
 
-	if (num > NUM_TEMPORARY_PAGES)
+	if (num > num_temporary_pages)
 		return NULL;
 	while (num-- > 0) {
 		if (pg_structs)
@@ -495,6 +1261,62 @@ void *paging_get_guest_pages(const struct guest_paging_structures *pg_structs,
 	return (void *)page_base;
 }
 
+static bool ranges_overlap(unsigned long start1, unsigned long size1,
+			   unsigned long start2, unsigned long size2)
+{
+	return start1 < start2 + size2 && start2 < start1 + size1;
+}
+
+/*
+ * Node memory is mapped at the same offset as the hypervisor region, so
+ * paging_hvirt2phys and paging_phys2hvirt remain valid for its pages.
+ */
+static int node_pool_init(struct page_pool *pool,
+			  const struct jailhouse_memory_node *node)
+{
+	unsigned long virt = node->phys_start + page_offset;
+	unsigned long bitmap_pages;
+	int err;
+
+	if (node->size == 0)
+		return 0;
+
+	if ((node->phys_start | node->size) & ~PAGE_MASK ||
+	    virt + node->size - 1 < virt ||
+	    ranges_overlap(virt, node->size, JAILHOUSE_BASE,
+			   system_config->hypervisor_memory.size) ||
+	    ranges_overlap(virt, node->size, REMAP_BASE,
+			   remap_pool.pages * PAGE_SIZE))
+		return trace_error(-EINVAL);
+
+	if (system_config->debug_console.flags & JAILHOUSE_MEM_IO &&
+	    ranges_overlap(virt, node->size,
+			   (unsigned long)hypervisor_header.debug_console_base,
+			   system_config->debug_console.size))
+		return trace_error(-EINVAL);
+
+	pool->base_address = (void *)virt;
+	pool->offset = (virt >> PAGE_SHIFT) &
+		((1UL << PAGE_POOL_MAX_ORDER) - 1);
+	pool->pages = node->size / PAGE_SIZE;
+	bitmap_pages = PAGES(pool_bitmap_size(pool));
+	if (pool->pages <= bitmap_pages)
+		return trace_error(-EINVAL);
+
+	err = paging_create(&hv_paging_structs, node->phys_start, node->size,
+			    virt, PAGE_DEFAULT_FLAGS, PAGING_NON_COHERENT);
+	if (err)
+		return err;
+
+	/* unlike the hypervisor region, the driver does not clear it */
+	memset(pool->base_address, 0, node->size);
+
+	page_pool_init(pool, pool->base_address, bitmap_pages);
+	pool->flags = PAGE_SCRUB_ON_FREE;
+
+	return 0;
+}
+
 /**
  * Initialize the page mapping subsystem.
  *
@@ -502,7 +1324,10 @@ void *paging_get_guest_pages(const struct guest_paging_structures *pg_structs,
  */
 int paging_init(void)
 {
-	unsigned long n, per_cpu_pages, config_pages, bitmap_pages, vaddr;
+	unsigned long per_cpu_pages, config_pages, bitmap_pages, vaddr;
+	unsigned long temporary_pages, max_remap_pages;
+	unsigned long *bitmap;
+	unsigned int n;
 	int err;
 
 	per_cpu_pages = hypervisor_header.max_cpus *
@@ -513,32 +1338,57 @@ int paging_init(void)
 	page_offset = JAILHOUSE_BASE -
 		system_config->hypervisor_memory.phys_start;
 
+	mem_pool.base_address = __page_pool;
+	mem_pool.offset = ((unsigned long)__page_pool >> PAGE_SHIFT) &
+		((1UL << PAGE_POOL_MAX_ORDER) - 1);
 	mem_pool.pages = (system_config->hypervisor_memory.size -
 		(__page_pool - (u8 *)&hypervisor_header)) / PAGE_SIZE;
-	bitmap_pages = (mem_pool.pages + BITS_PER_PAGE - 1) / BITS_PER_PAGE;
+	bitmap_pages = PAGES(pool_bitmap_size(&mem_pool));
 
 	if (mem_pool.pages <= per_cpu_pages + config_pages + bitmap_pages)
 		return -ENOMEM;
 
-	mem_pool.base_address = __page_pool;
-	mem_pool.used_bitmap =
-		(unsigned long *)(__page_pool + per_cpu_pages * PAGE_SIZE +
-				  config_pages * PAGE_SIZE);
-	mem_pool.used_pages = per_cpu_pages + config_pages + bitmap_pages;
-	for (n = 0; n < mem_pool.used_pages; n++)
-		set_bit(n, mem_pool.used_bitmap);
+	bitmap = (unsigned long *)(__page_pool + per_cpu_pages * PAGE_SIZE +
+				   config_pages * PAGE_SIZE);
+	memset(bitmap, 0, bitmap_pages * PAGE_SIZE);
+	page_pool_init(&mem_pool, bitmap,
+		       per_cpu_pages + config_pages + bitmap_pages);
 	mem_pool.flags = PAGE_SCRUB_ON_FREE;
 
-	remap_pool.used_bitmap = page_alloc(&mem_pool, NUM_REMAP_BITMAP_PAGES);
-	remap_pool.used_pages =
-		hypervisor_header.max_cpus * NUM_TEMPORARY_PAGES;
-	for (n = 0; n < remap_pool.used_pages; n++)
-		set_bit(n, remap_pool.used_bitmap);
+	/* one more page as configs are not necessarily page-aligned */
+	num_temporary_pages = system_config->temporary_pages;
+	if (num_temporary_pages == 0)
+		num_temporary_pages = MAX(NUM_TEMPORARY_PAGES, config_pages + 1);
+
+	max_remap_pages = (JAILHOUSE_BASE - REMAP_BASE) / PAGE_SIZE;
+	if (num_temporary_pages > max_remap_pages / hypervisor_header.max_cpus)
+		return trace_error(-E2BIG);
+	temporary_pages = hypervisor_header.max_cpus * num_temporary_pages;
+
+	remap_pool.pages = system_config->remap_pages;
+	if (remap_pool.pages == 0) {
+		remap_pool.pages = BITS_PER_PAGE * NUM_REMAP_BITMAP_PAGES;
+		if (num_temporary_pages > NUM_TEMPORARY_PAGES)
+			remap_pool.pages += hypervisor_header.max_cpus *
+				(num_temporary_pages - NUM_TEMPORARY_PAGES);
+	}
+	if (remap_pool.pages <= temporary_pages ||
+	    remap_pool.pages > max_remap_pages)
+		return trace_error(-E2BIG);
+
+	remap_pool.offset = (REMAP_BASE >> PAGE_SHIFT) &
+		((1UL << PAGE_POOL_MAX_ORDER) - 1);
+	bitmap_pages = PAGES(pool_bitmap_size(&remap_pool));
+	bitmap = page_alloc(&mem_pool, bitmap_pages, PAGE_OWNER_PAGING);
+	if (!bitmap)
+		return -ENOMEM;
+	page_pool_init(&remap_pool, bitmap, temporary_pages);
 
 	arch_paging_init();
 
 	hv_paging_structs.root_paging = hv_paging;
-	hv_paging_structs.root_table = page_alloc(&mem_pool, 1);
+	hv_paging_structs.root_table = page_alloc(&mem_pool, 1,
+						  PAGE_OWNER_PAGING);
 	if (!hv_paging_structs.root_table)
 		return -ENOMEM;
 
@@ -567,6 +1417,13 @@ int paging_init(void)
 			return err;
 	}
 
+	for (n = 0; n < JAILHOUSE_MAX_MEMORY_NODES; n++) {
+		err = node_pool_init(&node_pools[n],
+				     &system_config->memory_nodes[n]);
+		if (err)
+			return err;
+	}
+
 	/* Make sure any remappings to the temporary regions can be performed
 	 * without allocations of page table pages. */
 	return paging_create(&hv_paging_structs, 0,
@@ -575,13 +1432,111 @@ int paging_init(void)
 			     PAGING_NON_COHERENT);
 }
 
+static const char *const page_owner_names[NUM_PAGE_OWNERS] = {
+	[PAGE_OWNER_PAGING] = "paging",
+	[PAGE_OWNER_CELL] = "cell",
+	[PAGE_OWNER_MMIO] = "mmio",
+	[PAGE_OWNER_IOMMU] = "iommu",
+	[PAGE_OWNER_IRT] = "irt",
+	[PAGE_OWNER_IVSHMEM] = "ivshmem",
+	[PAGE_OWNER_PCI] = "pci",
+	[PAGE_OWNER_OTHER] = "other",
+};
+
+static void dump_pool_fragmentation(const char *name,
+				    const struct page_pool *pool)
+{
+	unsigned int order;
+
+	printk("  %s free blocks per order:", name);
+	for (order = 0; order <= PAGE_POOL_MAX_ORDER; order++)
+		if (pool->free_blocks[order] > 0)
+			printk(" %d:%d", order, pool->free_blocks[order]);
+	printk("\n");
+}
+
+static void dump_cell_page_sizes(struct cell *cell)
+{
+	const struct paging_structures *pg_structs =
+		arch_cell_paging_structs(cell);
+	unsigned long count[MAX_PAGE_TABLE_LEVELS] = { 0 };
+	unsigned int size[MAX_PAGE_TABLE_LEVELS] = { 0 };
+	const unsigned int levels = MAX_PAGE_TABLE_LEVELS;
+	const struct jailhouse_memory *mem;
+	const struct paging *paging;
+	unsigned long virt, end, step;
+	unsigned int n, level;
+	page_table_t pt;
+	pt_entry_t pte;
+
+	for_each_mem_region(mem, cell->config, n) {
+		if (JAILHOUSE_MEMORY_IS_SUBPAGE(mem) ||
+		    !cell_mem_region_present(cell, mem))
+			continue;
+
+		virt = mem->virt_start;
+		end = mem->virt_start + mem->size;
+		while (virt < end) {
+			paging = pg_structs->root_paging;
+			pt = pg_structs->root_table;
+			/* holes are skipped in steps of the smallest page */
+			step = PAGE_SIZE;
+			for (level = 0; level < levels; level++) {
+				pte = paging->get_entry(pt, virt);
+				if (!paging->entry_valid(pte,
+							 PAGE_PRESENT_FLAGS)) {
+					if (paging->page_size > 0)
+						step = paging->page_size;
+					break;
+				}
+				if (paging->get_phys(pte, virt) !=
+				    INVALID_PHYS_ADDR) {
+					step = paging->page_size;
+					size[level] = step;
+					count[level]++;
+					break;
+				}
+				pt = paging_phys2hvirt(
+						paging->get_next_pt(pte));
+				paging++;
+			}
+			virt = (virt & ~(step - 1)) + step;
+		}
+	}
+
+	printk("  cell \"%s\" pages per size:", cell->config->name);
+	for (level = 0; level < levels; level++)
+		if (count[level] > 0)
+			printk(" %uK:%lu", size[level] / 1024, count[level]);
+	printk("\n");
+}
+
 /**
  * Dump usage statistic of the page pools.
- * @param when String that characterizes the associated event.
+ * @param when	String that characterizes the associated event.
+ * @param cell	Cell whose mix of guest page sizes should be reported as
+ * 		well, or NULL.
  */
-void paging_dump_stats(const char *when)
+void paging_dump_stats(const char *when, struct cell *cell)
 {
+	unsigned int n;
+
 	printk("Page pool usage %s: mem %d/%d, remap %d/%d\n", when,
-	       mem_pool.used_pages, mem_pool.pages,
+	       paging_pool_used_pages(&mem_pool), mem_pool.pages,
 	       remap_pool.used_pages, remap_pool.pages);
+	for (n = 0; n < JAILHOUSE_MAX_MEMORY_NODES; n++)
+		if (node_pools[n].pages > 0)
+			printk("  node %d: %d/%d\n", n,
+			       node_pools[n].used_pages, node_pools[n].pages);
+	printk("  pages per owner:");
+	for (n = 0; n < NUM_PAGE_OWNERS; n++)
+		printk(" %s:%lu/%lu", page_owner_names[n],
+		       paging_owner_pages(n), remap_pool.owner_pages[n]);
+	printk("\n");
+	dump_pool_fragmentation("mem", &mem_pool);
+	dump_pool_fragmentation("remap", &remap_pool);
+	if (num_shared_tables > 0)
+		printk("  shared page tables: %d\n", num_shared_tables);
+	if (cell)
+		dump_cell_page_sizes(cell);
 }
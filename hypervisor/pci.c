@@ -15,17 +15,28 @@
 #include <jailhouse/mmio.h>
 #include <jailhouse/pci.h>
 #include <jailhouse/printk.h>
+#include <jailhouse/string.h>
 #include <jailhouse/utils.h>
 
+#define MSIX_VECTOR_DATA_DWORD		2
 #define MSIX_VECTOR_CTRL_DWORD		3
 
+/* shadow table and translation cache of devices with many MSI-X vectors */
+#define PCI_MSIX_STATE_PAGES(dev)					\
+	PAGES((sizeof(union pci_msix_vector) +				\
+	       sizeof(struct pci_msi_translation)) *			\
+	      (dev)->info->num_msix_vectors)
+
+/* number of buses, also number of devfns per bus */
+#define PCI_LOOKUP_ENTRIES		256
+
 #define for_each_configured_pci_device(dev, cell)			\
 	for ((dev) = (cell)->pci_devices;				\
 	     (dev) - (cell)->pci_devices < (cell)->config->num_pci_devices; \
 	     (dev)++)
 
 #define for_each_pci_cap(cap, dev, counter)				\
-	for ((cap) = jailhouse_cell_pci_caps((dev)->cell->config) +	\
+	for ((cap) = (dev)->cell->cfg.pci_caps +			\
 		(dev)->info->caps_start, (counter) = 0;			\
 	     (counter) < (dev)->info->num_caps;				\
 	     (cap)++, (counter)++)
@@ -61,14 +72,20 @@ static const struct pci_cfg_control bridge_write[PCI_CONFIG_HEADER_SIZE] = {
 	[0x3c/4] = {PCI_CONFIG_ALLOW,  0xffff00ff}, /* Int Line, Bridge Ctrl */
 };
 
+/* policy of config space dwords beyond the header, see pci_build_cfg_policy */
+enum pci_cfg_policy {
+	PCI_CFG_POLICY_MODERATE,	/* requires full moderation */
+	PCI_CFG_POLICY_PASS,		/* read and write access */
+	PCI_CFG_POLICY_RDONLY,		/* read access, writes are rejected */
+};
+
 static void *pci_space;
 static u64 mmcfg_start, mmcfg_size;
 static u8 end_bus;
 
 unsigned int pci_mmio_count_regions(struct cell *cell)
 {
-	const struct jailhouse_pci_device *dev_infos =
-		jailhouse_cell_pci_devices(cell->config);
+	const struct jailhouse_pci_device *dev_infos = cell->cfg.pci_devices;
 	unsigned int n, regions = 0;
 
 	if (system_config->platform_info.x86.mmconfig_base)
@@ -146,18 +163,78 @@ void pci_write_config(u16 bdf, u16 address, u32 value, unsigned int size)
  */
 struct pci_device *pci_get_assigned_device(const struct cell *cell, u16 bdf)
 {
-	const struct jailhouse_pci_device *dev_info =
-		jailhouse_cell_pci_devices(cell->config);
-	u32 n;
+	struct pci_device *device;
+	u16 bus_table, entry;
 
-	/* We iterate over the static device information to increase cache
-	 * locality. */
-	for (n = 0; n < cell->config->num_pci_devices; n++)
-		if (dev_info[n].bdf == bdf)
-			return cell->pci_devices[n].cell ?
-				&cell->pci_devices[n] : NULL;
+	if (!cell->pci_lookup)
+		return NULL;
 
-	return NULL;
+	bus_table = cell->pci_lookup[PCI_BUS(bdf)];
+	if (bus_table == 0)
+		return NULL;
+
+	entry = cell->pci_lookup[bus_table * PCI_LOOKUP_ENTRIES +
+				 PCI_DEVFN(bdf)];
+	if (entry == 0)
+		return NULL;
+
+	/* The cell pointer encodes active ownership, see pci_cell_init. */
+	device = &cell->pci_devices[entry - 1];
+	return device->cell ? device : NULL;
+}
+
+/**
+ * Build the BDF lookup table of a cell.
+ * @param cell	Cell the table is built for.
+ *
+ * The table starts with one entry per bus that holds the index of the
+ * table for that bus, or 0 if the cell has no devices on it. Each bus table
+ * holds, per devfn, the index of the device in @c pci_devices plus 1, or 0.
+ * Duplicate BDFs resolve to the first device, like the former linear search.
+ *
+ * @return 0 on success, negative error code otherwise.
+ *
+ * @private
+ */
+static int pci_build_lookup(struct cell *cell)
+{
+	const struct jailhouse_pci_device *dev_infos = cell->cfg.pci_devices;
+	unsigned long bus_bitmap[PCI_LOOKUP_ENTRIES / BITS_PER_LONG] = { 0 };
+	unsigned int ndev, bus, num_buses = 0;
+	u16 *entry;
+
+	if (cell->config->num_pci_devices >= 0xffff)
+		return trace_error(-EINVAL);
+
+	for (ndev = 0; ndev < cell->config->num_pci_devices; ndev++) {
+		bus = PCI_BUS(dev_infos[ndev].bdf);
+		if (!test_bit(bus, bus_bitmap)) {
+			set_bit(bus, bus_bitmap);
+			num_buses++;
+		}
+	}
+
+	cell->pci_lookup_pages = PAGES((1 + num_buses) * PCI_LOOKUP_ENTRIES *
+				       sizeof(*cell->pci_lookup));
+	cell->pci_lookup = page_alloc(&mem_pool, cell->pci_lookup_pages,
+				      PAGE_OWNER_PCI);
+	if (!cell->pci_lookup)
+		return -ENOMEM;
+
+	num_buses = 0;
+	for (ndev = 0; ndev < cell->config->num_pci_devices; ndev++) {
+		bus = PCI_BUS(dev_infos[ndev].bdf);
+		if (cell->pci_lookup[bus] == 0)
+			cell->pci_lookup[bus] = ++num_buses;
+
+		entry = &cell->pci_lookup[cell->pci_lookup[bus] *
+					  PCI_LOOKUP_ENTRIES +
+					  PCI_DEVFN(dev_infos[ndev].bdf)];
+		if (*entry == 0)
+			*entry = ndev + 1;
+	}
+
+	return 0;
 }
 
 /**
@@ -173,8 +250,7 @@ static const struct jailhouse_pci_capability *
 pci_find_capability(struct pci_device *device, u16 address)
 {
 	const struct jailhouse_pci_capability *cap =
-		jailhouse_cell_pci_caps(device->cell->config) +
-		device->info->caps_start;
+		device->cell->cfg.pci_caps + device->info->caps_start;
 	u32 n;
 
 	for (n = 0; n < device->info->num_caps; n++, cap++)
@@ -184,6 +260,78 @@ pci_find_capability(struct pci_device *device, u16 address)
 	return NULL;
 }
 
+static enum pci_cfg_policy pci_get_cfg_policy(struct pci_device *device,
+					      u16 address)
+{
+	unsigned int dword = address / 4;
+
+	return (device->cfg_policy[dword / 4] >> ((dword % 4) * 2)) & 0x3;
+}
+
+static void pci_set_cfg_policy(struct pci_device *device, unsigned int dword,
+			       enum pci_cfg_policy policy)
+{
+	unsigned int shift = (dword % 4) * 2;
+
+	device->cfg_policy[dword / 4] &= ~(0x3 << shift);
+	device->cfg_policy[dword / 4] |= policy << shift;
+}
+
+/**
+ * Precompute the access policy of a device's config space beyond the header.
+ * @param device	The device to be accessed.
+ *
+ * Dwords outside of any capability are read-only. Dwords fully covered by a
+ * capability are passed through or read-only, depending on the capability's
+ * write permission. Dwords of MSI and MSI-X capabilities, which are emulated,
+ * and dwords partially covered by a capability keep requiring the full
+ * moderation via pci_find_capability. Capabilities are applied in reverse
+ * order so that the first matching one takes precedence, like in
+ * pci_find_capability.
+ *
+ * @private
+ */
+static void pci_build_cfg_policy(struct pci_device *device)
+{
+	const struct jailhouse_pci_capability *cap =
+		device->cell->cfg.pci_caps +
+		device->info->caps_start + device->info->num_caps;
+	unsigned int dword, first, end;
+	enum pci_cfg_policy policy;
+	u32 n;
+
+	for (dword = PCI_CONFIG_HEADER_SIZE / 4;
+	     dword < PCI_CONFIG_SPACE_SIZE / 4; dword++)
+		pci_set_cfg_policy(device, dword, PCI_CFG_POLICY_RDONLY);
+
+	for (n = 0; n < device->info->num_caps; n++) {
+		cap--;
+		if (cap->len == 0 ||
+		    cap->start + cap->len > PCI_CONFIG_SPACE_SIZE)
+			continue;
+
+		if (cap->id == PCI_CAP_MSI || cap->id == PCI_CAP_MSIX)
+			policy = PCI_CFG_POLICY_MODERATE;
+		else if (cap->flags & JAILHOUSE_PCICAPS_WRITE)
+			policy = PCI_CFG_POLICY_PASS;
+		else
+			policy = PCI_CFG_POLICY_RDONLY;
+
+		first = cap->start / 4;
+		end = (cap->start + cap->len + 3) / 4;
+		for (dword = first; dword < end; dword++) {
+			if (dword < PCI_CONFIG_HEADER_SIZE / 4)
+				continue;
+			if (dword * 4 < cap->start ||
+			    (dword + 1) * 4 > cap->start + cap->len)
+				pci_set_cfg_policy(device, dword,
+						   PCI_CFG_POLICY_MODERATE);
+			else
+				pci_set_cfg_policy(device, dword, policy);
+		}
+	}
+}
+
 /**
  * Moderate config space read access.
  * @param device	The device to be accessed. If NULL, access will be
@@ -227,7 +375,8 @@ enum pci_access pci_cfg_read_moderate(struct pci_device *device, u16 address,
 	if (device->info->type == JAILHOUSE_PCI_TYPE_IVSHMEM)
 		return pci_ivshmem_cfg_read(device, address, value);
 
-	if (address < PCI_CONFIG_HEADER_SIZE)
+	if (address < PCI_CONFIG_HEADER_SIZE ||
+	    pci_get_cfg_policy(device, address) != PCI_CFG_POLICY_MODERATE)
 		return PCI_ACCESS_PERFORM;
 
 	cap = pci_find_capability(device, address);
@@ -245,20 +394,6 @@ enum pci_access pci_cfg_read_moderate(struct pci_device *device, u16 address,
 	return PCI_ACCESS_PERFORM;
 }
 
-static int pci_update_msix(struct pci_device *device,
-			   const struct jailhouse_pci_capability *cap)
-{
-	unsigned int n;
-	int result;
-
-	for (n = 0; n < device->info->num_msix_vectors; n++) {
-		result = arch_pci_update_msix_vector(device, n);
-		if (result < 0)
-			return result;
-	}
-	return 0;
-}
-
 /**
  * Moderate config space write access.
  * @param device	The device to be accessed. If NULL, access will be
@@ -321,6 +456,15 @@ enum pci_access pci_cfg_write_moderate(struct pci_device *device, u16 address,
 	if (device->info->type == JAILHOUSE_PCI_TYPE_IVSHMEM)
 		return pci_ivshmem_cfg_write(device, address / 4, mask, value);
 
+	switch (pci_get_cfg_policy(device, address)) {
+	case PCI_CFG_POLICY_PASS:
+		return PCI_ACCESS_PERFORM;
+	case PCI_CFG_POLICY_RDONLY:
+		return PCI_ACCESS_REJECT;
+	default:
+		break;
+	}
+
 	cap = pci_find_capability(device, address);
 	if (!cap || !(cap->flags & JAILHOUSE_PCICAPS_WRITE))
 		return PCI_ACCESS_REJECT;
@@ -344,7 +488,7 @@ enum pci_access pci_cfg_write_moderate(struct pci_device *device, u16 address,
 		device->msix_registers.raw &= ~mask;
 		device->msix_registers.raw |= value;
 
-		if (pci_update_msix(device, cap) < 0)
+		if (arch_pci_update_msix(device) < 0)
 			return PCI_ACCESS_REJECT;
 	}
 
@@ -365,7 +509,8 @@ int pci_init(void)
 		end_bus = system_config->platform_info.x86.mmconfig_end_bus;
 		mmcfg_size = (end_bus + 1) * 256 * 4096;
 
-		pci_space = page_alloc(&remap_pool, mmcfg_size / PAGE_SIZE);
+		pci_space = page_alloc(&remap_pool, mmcfg_size / PAGE_SIZE,
+				       PAGE_OWNER_PCI);
 		if (!pci_space)
 			return trace_error(-ENOMEM);
 
@@ -388,6 +533,8 @@ static enum mmio_result pci_msix_access_handler(void *arg,
 	struct pci_device *device = arg;
 	unsigned int index;
 
+	this_cpu_data()->stats[JAILHOUSE_CPU_STAT_MMIO_MSIX]++;
+
 	/* access must be DWORD-aligned */
 	if (mmio->address & 0x3)
 		goto invalid_access;
@@ -403,7 +550,17 @@ static enum mmio_result pci_msix_access_handler(void *arg,
 			goto invalid_access;
 
 		device->msix_vectors[index].raw[dword] = mmio->value;
-		if (arch_pci_update_msix_vector(device, index) < 0)
+
+		/*
+		 * Only the vector control word commits an update, unless the
+		 * vector is unmasked. For drivers that reprogram unmasked
+		 * vectors, the data word then completes the update, assuming
+		 * it is written last, as Linux does.
+		 */
+		if ((dword == MSIX_VECTOR_CTRL_DWORD ||
+		     (dword == MSIX_VECTOR_DATA_DWORD &&
+		      !device->msix_vectors[index].masked)) &&
+		    arch_pci_update_msix_vector(device, index) < 0)
 			goto invalid_access;
 
 		if (dword == MSIX_VECTOR_CTRL_DWORD)
@@ -433,6 +590,8 @@ static enum mmio_result pci_mmconfig_access_handler(void *arg,
 	enum pci_access result;
 	u32 val;
 
+	this_cpu_data()->stats[JAILHOUSE_CPU_STAT_PCI_CONFIG]++;
+
 	/* access must be DWORD-aligned */
 	if (reg_addr & 0x3)
 		goto invalid_access;
@@ -572,7 +731,8 @@ static int pci_add_physical_device(struct cell *cell, struct pci_device *device)
 	err = arch_pci_add_physical_device(cell, device);
 
 	if (!err && device->info->msix_address) {
-		device->msix_table = page_alloc(&remap_pool, size / PAGE_SIZE);
+		device->msix_table = page_alloc(&remap_pool, size / PAGE_SIZE,
+						PAGE_OWNER_PCI);
 		if (!device->msix_table) {
 			err = trace_error(-ENOMEM);
 			goto error_remove_dev;
@@ -587,14 +747,17 @@ static int pci_add_physical_device(struct cell *cell, struct pci_device *device)
 			goto error_page_free;
 
 		if (device->info->num_msix_vectors > PCI_EMBEDDED_MSIX_VECTS) {
-			pages = PAGES(sizeof(union pci_msix_vector) *
-				      device->info->num_msix_vectors);
-			device->msix_vectors = page_alloc(&mem_pool, pages);
+			pages = PCI_MSIX_STATE_PAGES(device);
+			device->msix_vectors = page_alloc(&mem_pool, pages,
+							  PAGE_OWNER_PCI);
 			if (!device->msix_vectors) {
 				err = -ENOMEM;
 				goto error_unmap_table;
 			}
+			device->msix_translated = (void *)(device->msix_vectors +
+					device->info->num_msix_vectors);
 		}
+		pci_msi_translations_invalidate(device);
 
 		mmio_region_register(cell, device->info->msix_address, size,
 				     pci_msix_access_handler, device);
@@ -606,7 +769,8 @@ error_unmap_table:
 	paging_destroy(&hv_paging_structs, (unsigned long)device->msix_table,
 		       size, PAGING_NON_COHERENT);
 error_page_free:
-	page_free(&remap_pool, device->msix_table, size / PAGE_SIZE);
+	page_free(&remap_pool, device->msix_table, size / PAGE_SIZE,
+		  PAGE_OWNER_PCI);
 error_remove_dev:
 	arch_pci_remove_physical_device(device);
 	return err;
@@ -628,12 +792,12 @@ static void pci_remove_physical_device(struct pci_device *device)
 	/* cannot fail, destruction of same size as construction */
 	paging_destroy(&hv_paging_structs, (unsigned long)device->msix_table,
 		       size, PAGING_NON_COHERENT);
-	page_free(&remap_pool, device->msix_table, size / PAGE_SIZE);
+	page_free(&remap_pool, device->msix_table, size / PAGE_SIZE,
+		  PAGE_OWNER_PCI);
 
 	if (device->msix_vectors != device->msix_vector_array)
 		page_free(&mem_pool, device->msix_vectors,
-			  PAGES(sizeof(union pci_msix_vector) *
-				device->info->num_msix_vectors));
+			  PCI_MSIX_STATE_PAGES(device), PAGE_OWNER_PCI);
 
 	mmio_region_unregister(device->cell, device->info->msix_address);
 }
@@ -650,8 +814,7 @@ int pci_cell_init(struct cell *cell)
 {
 	unsigned int devlist_pages = PAGES(cell->config->num_pci_devices *
 					   sizeof(struct pci_device));
-	const struct jailhouse_pci_device *dev_infos =
-		jailhouse_cell_pci_devices(cell->config);
+	const struct jailhouse_pci_device *dev_infos = cell->cfg.pci_devices;
 	const struct jailhouse_pci_capability *cap;
 	struct pci_device *device, *root_device;
 	unsigned int ndev, ncap;
@@ -664,10 +827,15 @@ int pci_cell_init(struct cell *cell)
 	if (cell->config->num_pci_devices == 0)
 		return 0;
 
-	cell->pci_devices = page_alloc(&mem_pool, devlist_pages);
+	cell->pci_devices = page_alloc(&mem_pool, devlist_pages,
+				       PAGE_OWNER_PCI);
 	if (!cell->pci_devices)
 		return -ENOMEM;
 
+	err = pci_build_lookup(cell);
+	if (err)
+		goto error;
+
 	/*
 	 * We order device states in the same way as the static information
 	 * so that we can use the index of the latter to find the former. For
@@ -678,6 +846,7 @@ int pci_cell_init(struct cell *cell)
 		device = &cell->pci_devices[ndev];
 		device->info = &dev_infos[ndev];
 		device->msix_vectors = device->msix_vector_array;
+		device->msix_translated = device->msix_translated_array;
 
 		if (device->info->type == JAILHOUSE_PCI_TYPE_IVSHMEM) {
 			err = pci_ivshmem_init(cell, device);
@@ -701,6 +870,7 @@ int pci_cell_init(struct cell *cell)
 			goto error;
 
 		device->cell = cell;
+		pci_build_cfg_policy(device);
 
 		for_each_pci_cap(cap, device, ncap)
 			if (cap->id == PCI_CAP_MSI)
@@ -764,7 +934,77 @@ void pci_cell_exit(struct cell *cell)
 			}
 		}
 
-	page_free(&mem_pool, cell->pci_devices, devlist_pages);
+	if (cell->pci_lookup)
+		page_free(&mem_pool, cell->pci_lookup, cell->pci_lookup_pages,
+			  PAGE_OWNER_PCI);
+	page_free(&mem_pool, cell->pci_devices, devlist_pages,
+		  PAGE_OWNER_PCI);
+}
+
+/**
+ * Discard the cached MSI and MSI-X translations of a device so that the next
+ * update reprograms the hardware, also for unchanged guest messages.
+ * @param device	Device whose translations shall be discarded.
+ */
+void pci_msi_translations_invalidate(struct pci_device *device)
+{
+	unsigned int n;
+
+	device->msi_translated.tag = 0;
+	for (n = 0; n < device->info->num_msix_vectors; n++)
+		device->msix_translated[n].tag = 0;
+}
+
+static void pci_reset_device(struct pci_device *device)
+{
+	const struct jailhouse_pci_capability *cap;
+	unsigned int n;
+
+	memset(&device->msi_registers, 0, sizeof(device->msi_registers));
+	device->msix_registers.raw = 0;
+	pci_msi_translations_invalidate(device);
+	for (n = 0; n < device->info->num_msix_vectors; n++) {
+		device->msix_vectors[n].address = 0;
+		device->msix_vectors[n].data = 0;
+		device->msix_vectors[n].masked = 1;
+	}
+
+	if (device->info->type == JAILHOUSE_PCI_TYPE_IVSHMEM) {
+		pci_ivshmem_reset(device);
+		return;
+	}
+
+	/*
+	 * Stop DMA and interrupt generation of the physical device. The cell
+	 * has to re-enable decoding and bus mastering when it boots again.
+	 */
+	pci_write_config(device->info->bdf, PCI_CFG_COMMAND,
+			 PCI_CMD_INTX_OFF, 2);
+
+	for_each_pci_cap(cap, device, n)
+		if (cap->id == PCI_CAP_MSI || cap->id == PCI_CAP_MSIX)
+			/* disable MSI/MSI-X by clearing the control word */
+			pci_write_config(device->info->bdf, cap->start + 2,
+					 0, 2);
+}
+
+/**
+ * Reset the PCI devices of a cell to their initial state, e.g. before the
+ * cell is restarted.
+ * @param cell	Cell whose devices shall be reset.
+ *
+ * Memory mappings and device assignments are not touched.
+ */
+void pci_cell_reset(struct cell *cell)
+{
+	struct pci_device *device;
+
+	if (!cell->pci_devices)
+		return;
+
+	for_each_configured_pci_device(device, cell)
+		if (device->cell)
+			pci_reset_device(device);
 }
 
 /**
@@ -786,11 +1026,13 @@ void pci_config_commit(struct cell *cell_added_removed)
 
 	for_each_configured_pci_device(device, &root_cell)
 		if (device->cell) {
+			/* interrupt destinations depend on the CPU sets */
+			pci_msi_translations_invalidate(device);
 			for_each_pci_cap(cap, device, n) {
 				if (cap->id == PCI_CAP_MSI) {
 					err = arch_pci_update_msi(device, cap);
 				} else if (cap->id == PCI_CAP_MSIX) {
-					err = pci_update_msix(device, cap);
+					err = arch_pci_update_msix(device);
 					pci_suppress_msix(device, cap, false);
 				}
 				if (err)
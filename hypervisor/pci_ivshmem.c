@@ -15,8 +15,10 @@
  * shared memory and interrupts based on MSI-X.
  *
  * The implementation in Jailhouse provides a shared memory device between
- * exactly 2 cells. The link between the two PCI devices is established by
- * choosing the same BDF, memory location, and memory size.
+ * up to IVSHMEM_MAX_PEERS cells. The link between the PCI devices is
+ * established by choosing the same BDF, memory location, and memory size.
+ * Each endpoint reports its slot in the link as IVPosition. Peers are
+ * addressed via the doorbell register encoding (peer << 16) | vector.
  */
 
 #include <jailhouse/control.h>
@@ -27,6 +29,8 @@
 #include <jailhouse/utils.h>
 #include <jailhouse/processor.h>
 #include <asm/apic.h>
+#include <asm/bitops.h>
+#include <asm/vcpu.h>
 
 #define VIRTIO_VENDOR_ID	0x1af4
 #define IVSHMEM_DEVICE_ID	0x1110
@@ -37,69 +41,208 @@
 #define IVSHMEM_CFG_SHMEM_PTR	0x40
 #define IVSHMEM_CFG_SHMEM_SZ	0x48
 
-#define IVSHMEM_MSIX_VECTORS	1
+#define IVSHMEM_MAX_MSIX_VECTORS	PCI_EMBEDDED_MSIX_VECTS
 #define IVSHMEM_CFG_MSIX_CAP	0x50
 
+#define IVSHMEM_REG_INTRMASK	0
 #define IVSHMEM_REG_IVPOS	8
 #define IVSHMEM_REG_DBELL	12
+#define IVSHMEM_REG_INTRMOD	16
+
+/* upper bound of the interrupt moderation interval, in microseconds */
+#define IVSHMEM_MAX_INTR_MODERATION	10000
 
 #define IVSHMEM_CFG_SIZE	(IVSHMEM_CFG_MSIX_CAP + 12)
 
 #define IVSHMEM_BAR0_SIZE	256
-#define IVSHMEM_BAR4_SIZE	((0x18 * IVSHMEM_MSIX_VECTORS + 0xf) & ~0xf)
+#define IVSHMEM_BAR4_SIZE(vectors)	((0x18 * (vectors) + 0xf) & ~0xf)
+
+/* all endpoints of a link have to fit into a single page */
+#define IVSHMEM_MAX_PEERS	8
+
+struct pci_ivshmem_data;
 
 struct pci_ivshmem_endpoint {
 	u32 cspace[IVSHMEM_CFG_SIZE / sizeof(u32)];
 	u32 ivpos;
+	u32 intr_mask;
+	/* minimum interval between interrupts, in microseconds and cycles */
+	u32 intr_moderation;
+	u64 intr_moderation_cycles;
+	/* cycle counter value before which interrupts are deferred */
+	u64 intr_next;
+	/* vectors deferred by the moderation, delivered on expiry */
+	unsigned long intr_pending;
+	unsigned int num_vectors;
 	u64 bar0_address;
 	u64 bar4_address;
 	struct pci_device *device;
-	struct pci_ivshmem_endpoint *remote;
-	struct apic_irq_message irq_msg;
+	struct pci_ivshmem_data *iv;
+	struct apic_irq_message irq_msg[IVSHMEM_MAX_MSIX_VECTORS];
 };
 
 struct pci_ivshmem_data {
-	struct pci_ivshmem_endpoint eps[2];
+	u16 bdf;
+	u64 shmem_phys;
+	u64 shmem_size;
+	u64 shmem_type;
+	struct pci_ivshmem_endpoint eps[IVSHMEM_MAX_PEERS];
 	struct pci_ivshmem_data *next;
 };
 
 static struct pci_ivshmem_data *ivshmem_list;
 
+/* root cell device of protocol JAILHOUSE_SHMEM_PROTO_EVENTS, if any */
+static struct pci_ivshmem_endpoint *events_endpoint;
+
 static const u32 default_cspace[IVSHMEM_CFG_SIZE / sizeof(u32)] = {
 	[0x00/4] = (IVSHMEM_DEVICE_ID << 16) | VIRTIO_VENDOR_ID,
 	[0x04/4] = (PCI_STS_CAPS << 16),
 	[0x08/4] = PCI_DEV_CLASS_MEM << 24,
 	[0x2c/4] = (IVSHMEM_DEVICE_ID << 16) | VIRTIO_VENDOR_ID,
 	[0x34/4] = IVSHMEM_CFG_MSIX_CAP,
-	/* MSI-X capability */
-	[IVSHMEM_CFG_MSIX_CAP/4] = (0xC000 + IVSHMEM_MSIX_VECTORS - 1) << 16
-				   | (0x00 << 8) | PCI_CAP_MSIX,
+	/* MSI-X capability, table size and PBA offset are patched in per
+	 * endpoint according to the configured number of vectors */
+	[IVSHMEM_CFG_MSIX_CAP/4] = (0xC000 << 16) | (0x00 << 8) | PCI_CAP_MSIX,
 	[(IVSHMEM_CFG_MSIX_CAP + 0x4)/4] = PCI_CFG_BAR/8 + 2,
-	[(IVSHMEM_CFG_MSIX_CAP + 0x8)/4] = 0x10 * IVSHMEM_MSIX_VECTORS |
-					   (PCI_CFG_BAR/8 + 2),
+	[(IVSHMEM_CFG_MSIX_CAP + 0x8)/4] = PCI_CFG_BAR/8 + 2,
 };
 
-static void ivshmem_write_doorbell(struct pci_ivshmem_endpoint *ive)
+static void ivshmem_trigger_interrupt(struct pci_ivshmem_endpoint *ive,
+				      unsigned int vector)
 {
-	struct pci_ivshmem_endpoint *remote = ive->remote;
 	struct apic_irq_message irq_msg;
 
-	if (!remote)
+	/* unconnected slots report no vectors */
+	if (vector >= ive->num_vectors)
+		return;
+	/* the receiver is polling on this vector, do not disturb it */
+	if (ive->intr_mask & (1 << vector))
 		return;
 
 	/* get a copy of the struct before using it, the read barrier makes
 	 * sure the copy is consistent */
-	irq_msg = remote->irq_msg;
+	irq_msg = ive->irq_msg[vector];
 	memory_load_barrier();
 	if (irq_msg.valid)
 		apic_send_irq(irq_msg);
 }
 
+/*
+ * Deliver the interrupts a moderated endpoint deferred if its interval has
+ * expired, or unconditionally if forced. Returns the cycle counter value at
+ * which deferred interrupts are due, 0 if none are left.
+ */
+static u64 ivshmem_flush_pending(struct pci_ivshmem_endpoint *ive, u64 now,
+				 bool force)
+{
+	unsigned int vector;
+
+	if (!ive->intr_pending)
+		return 0;
+	if (now < ive->intr_next && !force)
+		return ive->intr_next;
+
+	ive->intr_next = now + ive->intr_moderation_cycles;
+	for (vector = 0; vector < IVSHMEM_MAX_MSIX_VECTORS; vector++)
+		if (test_and_clear_bit(vector, &ive->intr_pending))
+			ivshmem_trigger_interrupt(ive, vector);
+	return 0;
+}
+
+static u64 ivshmem_flush_peers(struct pci_ivshmem_endpoint *sender, u64 now,
+			       bool force)
+{
+	u64 deadline, next = 0;
+	unsigned int peer;
+
+	for (peer = 0; peer < IVSHMEM_MAX_PEERS; peer++) {
+		deadline = ivshmem_flush_pending(&sender->iv->eps[peer], now,
+						 force);
+		if (deadline && (!next || deadline < next))
+			next = deadline;
+	}
+	return next;
+}
+
+/*
+ * Kicks of a peer that set a moderation interval are delivered right away
+ * only if the interval since its last interrupt expired. Otherwise, the
+ * vector is latched and the sending CPU delivers it when the interval ends,
+ * see pci_ivshmem_flush_deferred. Concurrent senders may occasionally
+ * deliver the same latched vector twice, which is harmless.
+ */
+static void ivshmem_kick(struct pci_ivshmem_endpoint *sender,
+			 struct pci_ivshmem_endpoint *ive, unsigned int vector)
+{
+	struct per_cpu *cpu_data;
+	u64 now;
+
+	if (!ive->intr_moderation) {
+		ivshmem_trigger_interrupt(ive, vector);
+		return;
+	}
+
+	now = get_cycles();
+	if (now >= ive->intr_next && !ive->intr_pending) {
+		ive->intr_next = now + ive->intr_moderation_cycles;
+		ivshmem_trigger_interrupt(ive, vector);
+		return;
+	}
+
+	set_bit(vector, &ive->intr_pending);
+
+	cpu_data = this_cpu_data();
+	if (cpu_data->ivshmem_deferred && cpu_data->ivshmem_deferred != sender)
+		/* only one link is tracked per CPU, flush the previous one */
+		ivshmem_flush_peers(cpu_data->ivshmem_deferred, now, true);
+	cpu_data->ivshmem_deferred = sender;
+}
+
+static void ivshmem_write_doorbell(struct pci_ivshmem_endpoint *ive,
+				   u32 value)
+{
+	unsigned int peer = value >> 16, vector = value & 0xffff;
+
+	/* the upper 16 bits select the peer, the lower ones its vector. Kicks
+	 * of peers not connected or vectors they do not provide are dropped. */
+	if (peer >= IVSHMEM_MAX_PEERS || vector >= IVSHMEM_MAX_MSIX_VECTORS)
+		return;
+	ivshmem_kick(ive, &ive->iv->eps[peer], vector);
+}
+
+static void ivshmem_write_intr_moderation(struct pci_ivshmem_endpoint *ive,
+					  u32 value)
+{
+	unsigned long cycles_khz = arch_get_cycles_khz();
+
+	/* deferred kicks need a timer to leave the sender's cell on time */
+	if (!vcpu_vendor_has_timer() || cycles_khz == 0)
+		value = 0;
+	if (value > IVSHMEM_MAX_INTR_MODERATION)
+		value = IVSHMEM_MAX_INTR_MODERATION;
+
+	ive->intr_moderation_cycles = (u64)cycles_khz * value / 1000;
+	memory_barrier();
+	ive->intr_moderation = value;
+}
+
 static enum mmio_result ivshmem_register_mmio(void *arg,
 					      struct mmio_access *mmio)
 {
 	struct pci_ivshmem_endpoint *ive = arg;
 
+	this_cpu_data()->stats[JAILHOUSE_CPU_STAT_MMIO_IVSHMEM]++;
+
+	/* vectors the peer must not raise, set while polling */
+	if (mmio->address == IVSHMEM_REG_INTRMASK) {
+		if (mmio->is_write)
+			ive->intr_mask = mmio->value;
+		else
+			mmio->value = ive->intr_mask;
+		return MMIO_HANDLED;
+	}
+
 	/* read-only IVPosition */
 	if (mmio->address == IVSHMEM_REG_IVPOS && !mmio->is_write) {
 		mmio->value = ive->ivpos;
@@ -108,17 +251,27 @@ static enum mmio_result ivshmem_register_mmio(void *arg,
 
 	if (mmio->address == IVSHMEM_REG_DBELL) {
 		if (mmio->is_write)
-			ivshmem_write_doorbell(ive);
+			ivshmem_write_doorbell(ive, mmio->value);
 		else
 			mmio->value = 0;
 		return MMIO_HANDLED;
 	}
+
+	/* minimum interval between the interrupts raised by the peers */
+	if (mmio->address == IVSHMEM_REG_INTRMOD) {
+		if (mmio->is_write)
+			ivshmem_write_intr_moderation(ive, mmio->value);
+		else
+			mmio->value = ive->intr_moderation;
+		return MMIO_HANDLED;
+	}
 	panic_printk("FATAL: Invalid ivshmem register %s, number %02x\n",
 		     mmio->is_write ? "write" : "read", mmio->address);
 	return MMIO_ERROR;
 }
 
-static bool ivshmem_is_msix_masked(struct pci_ivshmem_endpoint *ive)
+static bool ivshmem_is_msix_masked(struct pci_ivshmem_endpoint *ive,
+				   unsigned int vector)
 {
 	union pci_msix_registers c;
 
@@ -128,7 +281,7 @@ static bool ivshmem_is_msix_masked(struct pci_ivshmem_endpoint *ive)
 		return true;
 
 	/* local mask */
-	if (ive->device->msix_vectors[0].masked)
+	if (ive->device->msix_vectors[vector].masked)
 		return true;
 
 	/* PCI Bus Master */
@@ -138,23 +291,24 @@ static bool ivshmem_is_msix_masked(struct pci_ivshmem_endpoint *ive)
 	return false;
 }
 
-static int ivshmem_update_msix(struct pci_ivshmem_endpoint *ive)
+static int ivshmem_update_msix_vector(struct pci_ivshmem_endpoint *ive,
+				      unsigned int vector)
 {
 	union x86_msi_vector msi = {
-		.raw.address = ive->device->msix_vectors[0].address,
-		.raw.data = ive->device->msix_vectors[0].data,
+		.raw.address = ive->device->msix_vectors[vector].address,
+		.raw.data = ive->device->msix_vectors[vector].data,
 	};
 	struct apic_irq_message irq_msg;
 
 	/* before doing anything mark the cached irq_msg as invalid,
 	 * on success it will be valid on return. */
-	ive->irq_msg.valid = 0;
+	ive->irq_msg[vector].valid = 0;
 	memory_barrier();
 
-	if (ivshmem_is_msix_masked(ive))
+	if (ivshmem_is_msix_masked(ive, vector))
 		return 0;
 
-	irq_msg = pci_translate_msi_vector(ive->device, 0, 0, msi);
+	irq_msg = pci_translate_msi_vector(ive->device, vector, 0, msi);
 	if (!irq_msg.valid)
 		return 0;
 
@@ -168,10 +322,23 @@ static int ivshmem_update_msix(struct pci_ivshmem_endpoint *ive)
 	/* now copy the whole struct into our cache and mark the cache
 	 * valid at the end */
 	irq_msg.valid = 0;
-	ive->irq_msg = irq_msg;
+	ive->irq_msg[vector] = irq_msg;
 	memory_barrier();
-	ive->irq_msg.valid = 1;
+	ive->irq_msg[vector].valid = 1;
+
+	return 0;
+}
+
+static int ivshmem_update_msix(struct pci_ivshmem_endpoint *ive)
+{
+	unsigned int vector;
+	int err;
 
+	for (vector = 0; vector < ive->num_vectors; vector++) {
+		err = ivshmem_update_msix_vector(ive, vector);
+		if (err)
+			return err;
+	}
 	return 0;
 }
 
@@ -180,11 +347,13 @@ static enum mmio_result ivshmem_msix_mmio(void *arg, struct mmio_access *mmio)
 	struct pci_ivshmem_endpoint *ive = arg;
 	u32 *msix_table = (u32 *)ive->device->msix_vectors;
 
+	this_cpu_data()->stats[JAILHOUSE_CPU_STAT_MMIO_IVSHMEM]++;
+
 	if (mmio->address % 4)
 		goto fail;
 
 	/* MSI-X PBA */
-	if (mmio->address >= 0x10 * IVSHMEM_MSIX_VECTORS) {
+	if (mmio->address >= 0x10 * ive->num_vectors) {
 		if (mmio->is_write) {
 			goto fail;
 		} else {
@@ -195,7 +364,8 @@ static enum mmio_result ivshmem_msix_mmio(void *arg, struct mmio_access *mmio)
 	} else {
 		if (mmio->is_write) {
 			msix_table[mmio->address / 4] = mmio->value;
-			if (ivshmem_update_msix(ive))
+			if (ivshmem_update_msix_vector(ive,
+						       mmio->address / 0x10))
 				return MMIO_ERROR;
 		} else {
 			mmio->value = msix_table[mmio->address / 4];
@@ -217,6 +387,7 @@ static int ivshmem_write_command(struct pci_ivshmem_endpoint *ive, u16 val)
 {
 	u16 *cmd = (u16 *)&ive->cspace[PCI_CFG_COMMAND/4];
 	struct pci_device *device = ive->device;
+	unsigned long bar4_size;
 	int err;
 
 	if ((val & PCI_CMD_MASTER) != (*cmd & PCI_CMD_MASTER)) {
@@ -233,14 +404,16 @@ static int ivshmem_write_command(struct pci_ivshmem_endpoint *ive, u16 val)
 		}
 		if (val & PCI_CMD_MEM) {
 			ive->bar0_address = (*(u64 *)&device->bar[0]) & ~0xfL;
-			mmio_region_register(device->cell, ive->bar0_address,
-					     IVSHMEM_BAR0_SIZE,
-					     ivshmem_register_mmio, ive);
+			mmio_region_register_fast(device->cell,
+						  ive->bar0_address,
+						  IVSHMEM_BAR0_SIZE,
+						  ivshmem_register_mmio, ive);
 
 			ive->bar4_address = (*(u64 *)&device->bar[4]) & ~0xfL;
-			mmio_region_register(device->cell, ive->bar4_address,
-					     IVSHMEM_BAR4_SIZE,
-					     ivshmem_msix_mmio, ive);
+			bar4_size = IVSHMEM_BAR4_SIZE(ive->num_vectors);
+			mmio_region_register_fast(device->cell,
+						  ive->bar4_address, bar4_size,
+						  ivshmem_msix_mmio, ive);
 		}
 		*cmd = (*cmd & ~PCI_CMD_MEM) | (val & PCI_CMD_MEM);
 	}
@@ -264,70 +437,65 @@ static int ivshmem_write_msix_control(struct pci_ivshmem_endpoint *ive, u32 val)
 	return 0;
 }
 
-static struct pci_ivshmem_data **ivshmem_find(struct pci_device *d,
-					      int *cellnum)
-{
-	struct pci_ivshmem_data **ivp, *iv;
-	u16 bdf2;
-
-	for (ivp = &ivshmem_list; *ivp; ivp = &((*ivp)->next)) {
-		iv = *ivp;
-		bdf2 = iv->eps[0].device->info->bdf;
-		if (d->info->bdf == bdf2) {
-			if (iv->eps[0].device == d) {
-				if (cellnum)
-					*cellnum = 0;
-				return ivp;
-			}
-			if (iv->eps[1].device == d) {
-				if (cellnum)
-					*cellnum = 1;
-				return ivp;
-			}
-			if (!cellnum)
-				return ivp;
-		}
-	}
-
-	return NULL;
-}
-
 static void ivshmem_connect_cell(struct pci_ivshmem_data *iv,
 				 struct pci_device *d,
 				 const struct jailhouse_memory *mem,
-				 int cellnum)
+				 unsigned int slot)
 {
-	struct pci_ivshmem_endpoint *remote = &iv->eps[(cellnum + 1) % 2];
-	struct pci_ivshmem_endpoint *ive = &iv->eps[cellnum];
+	struct pci_ivshmem_endpoint *ive = &iv->eps[slot];
 
 	d->bar[0] = PCI_BAR_64BIT;
 	d->bar[4] = PCI_BAR_64BIT;
 
 	memcpy(ive->cspace, &default_cspace, sizeof(default_cspace));
 
+	if (d->info->shmem_protocol != JAILHOUSE_SHMEM_PROTO_UNDEFINED)
+		ive->cspace[0x08/4] = (PCI_DEV_CLASS_OTHER << 24) |
+			(d->info->shmem_protocol << 8);
+
+	ive->cspace[IVSHMEM_CFG_MSIX_CAP/4] |=
+		(d->info->num_msix_vectors - 1) << 16;
+	ive->cspace[(IVSHMEM_CFG_MSIX_CAP + 0x8)/4] |=
+		0x10 * d->info->num_msix_vectors;
+
 	ive->cspace[IVSHMEM_CFG_SHMEM_PTR/4] = (u32)mem->virt_start;
 	ive->cspace[IVSHMEM_CFG_SHMEM_PTR/4 + 1] = (u32)(mem->virt_start >> 32);
 	ive->cspace[IVSHMEM_CFG_SHMEM_SZ/4] = (u32)mem->size;
 	ive->cspace[IVSHMEM_CFG_SHMEM_SZ/4 + 1] = (u32)(mem->size >> 32);
 
+	ive->ivpos = slot;
+	ive->intr_mask = 0;
+	ive->intr_moderation = 0;
+	ive->intr_pending = 0;
+	ive->iv = iv;
 	ive->device = d;
-	if (remote->device) {
-		ive->remote = remote;
-		remote->remote = ive;
-		ive->ivpos = (remote->ivpos + 1) % 2;
-	} else {
-		ive->ivpos = cellnum;
-		ive->remote = NULL;
-		remote->remote = NULL;
-	}
 	d->ivshmem_endpoint = ive;
+
+	/* peers may kick us as soon as the slot reports vectors */
+	memory_barrier();
+	ive->num_vectors = d->info->num_msix_vectors;
 }
 
-static void ivshmem_disconnect_cell(struct pci_ivshmem_data *iv, int cellnum)
+static void ivshmem_disconnect_cell(struct pci_ivshmem_endpoint *ive)
 {
-	struct pci_ivshmem_endpoint *remote = &iv->eps[(cellnum + 1) % 2];
-	struct pci_ivshmem_endpoint *ive = &iv->eps[cellnum];
 	u16 cmd = *(u16 *)&ive->cspace[PCI_CFG_COMMAND / 4];
+	unsigned int vector, cpu;
+
+	/*
+	 * The CPUs of the cell are parked. Deliver what they deferred and
+	 * forget the link before they can be handed to another cell.
+	 */
+	for_each_cpu(cpu, ive->device->cell->cpu_set)
+		if (per_cpu(cpu)->ivshmem_deferred == ive) {
+			ivshmem_flush_peers(ive, get_cycles(), true);
+			per_cpu(cpu)->ivshmem_deferred = NULL;
+		}
+
+	/* stop accepting kicks from the peers before tearing down */
+	ive->num_vectors = 0;
+	for (vector = 0; vector < IVSHMEM_MAX_MSIX_VECTORS; vector++)
+		ive->irq_msg[vector].valid = 0;
+	memory_barrier();
 
 	if (cmd & PCI_CMD_MEM) {
 		mmio_region_unregister(this_cell(), ive->bar0_address);
@@ -335,8 +503,6 @@ static void ivshmem_disconnect_cell(struct pci_ivshmem_data *iv, int cellnum)
 	}
 	ive->device->ivshmem_endpoint = NULL;
 	ive->device = NULL;
-	ive->remote = NULL;
-	remote->remote = NULL;
 }
 
 /**
@@ -414,52 +580,111 @@ int pci_ivshmem_update_msix(struct pci_device *device)
  */
 int pci_ivshmem_init(struct cell *cell, struct pci_device *device)
 {
-	const struct jailhouse_memory *mem, *mem0;
-	struct pci_ivshmem_data **ivp;
-	struct pci_device *dev0;
+	const struct jailhouse_memory *mem;
+	struct pci_ivshmem_data **ivp, *iv;
+	struct jailhouse_memory events_mem;
+	unsigned int slot;
 
-	if (device->info->num_msix_vectors != 1)
+	if (device->info->num_msix_vectors < 1 ||
+	    device->info->num_msix_vectors > IVSHMEM_MAX_MSIX_VECTORS)
 		return trace_error(-EINVAL);
 
-	if (device->info->shmem_region >= cell->config->num_memory_regions)
+	/* BAR4 has to cover the MSI-X table and PBA of all vectors */
+	if (IVSHMEM_BAR4_SIZE(device->info->num_msix_vectors) >
+	    ~device->info->bar_mask[4] + 1)
 		return trace_error(-EINVAL);
 
-	mem = jailhouse_cell_mem_regions(cell->config)
-		+ device->info->shmem_region;
-	ivp = ivshmem_find(device, NULL);
-	if (ivp) {
-		dev0 = (*ivp)->eps[0].device;
-		mem0 = jailhouse_cell_mem_regions(dev0->cell->config) +
-			dev0->info->shmem_region;
-
-		/* we already have a datastructure, connect second endpoint */
-		if ((mem0->phys_start == mem->phys_start) &&
-		    (mem0->size == mem->size)) {
-			if ((*ivp)->eps[1].device)
-				return trace_error(-EBUSY);
-			ivshmem_connect_cell(*ivp, device, mem, 1);
-			printk("Virtual PCI connection established "
-				"\"%s\" <--> \"%s\"\n",
-				cell->config->name, dev0->cell->config->name);
-			goto connected;
-		}
+	if (device->info->shmem_protocol == JAILHOUSE_SHMEM_PROTO_EVENTS) {
+		/* a single link of the root cell to the read-only event page,
+		 * a shmem_region is not needed */
+		if (cell != &root_cell || events_endpoint)
+			return trace_error(-EINVAL);
+
+		events_mem.phys_start = paging_hvirt2phys(&events_page);
+		events_mem.virt_start = events_mem.phys_start;
+		events_mem.size = PAGE_SIZE;
+		events_mem.flags = JAILHOUSE_MEM_READ;
+		mem = &events_mem;
+	} else {
+		if (device->info->shmem_region >=
+		    cell->config->num_memory_regions)
+			return trace_error(-EINVAL);
+
+		mem = cell->cfg.mem_regions + device->info->shmem_region;
+	}
+
+	for (ivp = &ivshmem_list; *ivp; ivp = &((*ivp)->next)) {
+		iv = *ivp;
+		if (iv->bdf != device->info->bdf ||
+		    iv->shmem_phys != mem->phys_start ||
+		    iv->shmem_size != mem->size)
+			continue;
+
+		/* all peers have to access the memory with the same type */
+		if ((mem->flags & JAILHOUSE_MEM_TYPE_MASK) != iv->shmem_type)
+			return trace_error(-EINVAL);
+
+		/* we already have a datastructure, connect another endpoint */
+		for (slot = 0; slot < IVSHMEM_MAX_PEERS; slot++)
+			if (!iv->eps[slot].device)
+				break;
+		if (slot == IVSHMEM_MAX_PEERS)
+			return trace_error(-EBUSY);
+		ivshmem_connect_cell(iv, device, mem, slot);
+		printk("Virtual PCI connection established, cell \"%s\" "
+		       "is peer %u\n", cell->config->name, slot);
+		goto connected;
 	}
 
 	/* this is the first endpoint, allocate a new datastructure */
-	for (ivp = &ivshmem_list; *ivp; ivp = &((*ivp)->next))
-		; /* empty loop */
-	*ivp = page_alloc(&mem_pool, 1);
-	if (!(*ivp))
+	iv = page_alloc(&mem_pool, 1, PAGE_OWNER_IVSHMEM);
+	if (!iv)
 		return -ENOMEM;
-	ivshmem_connect_cell(*ivp, device, mem, 0);
+	iv->bdf = device->info->bdf;
+	iv->shmem_phys = mem->phys_start;
+	iv->shmem_size = mem->size;
+	iv->shmem_type = mem->flags & JAILHOUSE_MEM_TYPE_MASK;
+	ivshmem_connect_cell(iv, device, mem, 0);
+	*ivp = iv;
 
 connected:
+	if (mem == &events_mem)
+		events_endpoint = device->ivshmem_endpoint;
+
 	printk("Adding virtual PCI device %02x:%02x.%x to cell \"%s\"\n",
 	       PCI_BDF_PARAMS(device->info->bdf), cell->config->name);
 
 	return 0;
 }
 
+/**
+ * Reset an ivshmem device to its initial state, typically when the
+ * corresponding cell is restarted. The connection to the peers is kept.
+ * @param device	The device to be reset.
+ */
+void pci_ivshmem_reset(struct pci_device *device)
+{
+	struct pci_ivshmem_endpoint *ive = device->ivshmem_endpoint;
+	union pci_msix_registers c;
+
+	if (!ive)
+		return;
+
+	/* drops bus mastering and BAR decoding, invalidating cached vectors */
+	ivshmem_write_command(ive, 0);
+
+	c.raw = ive->cspace[IVSHMEM_CFG_MSIX_CAP/4];
+	c.enable = 0;
+	c.fmask = 0;
+	ive->cspace[IVSHMEM_CFG_MSIX_CAP/4] = c.raw;
+
+	ive->intr_mask = 0;
+	ive->intr_moderation = 0;
+	ive->intr_pending = 0;
+	device->bar[0] = PCI_BAR_64BIT;
+	device->bar[4] = PCI_BAR_64BIT;
+}
+
 /**
  * Unregister a ivshmem device, typically when the corresponding cell exits.
  * @param device	The device to be stopped.
@@ -467,23 +692,65 @@ connected:
  */
 void pci_ivshmem_exit(struct pci_device *device)
 {
+	struct pci_ivshmem_endpoint *ive = device->ivshmem_endpoint;
 	struct pci_ivshmem_data **ivp, *iv;
-	int cellnum;
+	unsigned int slot;
 
-	ivp = ivshmem_find(device, &cellnum);
-	if (!ivp || !(*ivp))
+	if (!ive)
 		return;
 
-	iv = *ivp;
+	if (ive == events_endpoint)
+		events_endpoint = NULL;
+
+	iv = ive->iv;
+	ivshmem_disconnect_cell(ive);
 
-	ivshmem_disconnect_cell(iv, cellnum);
+	for (slot = 0; slot < IVSHMEM_MAX_PEERS; slot++)
+		if (iv->eps[slot].device)
+			return;
 
-	if (cellnum == 0) {
-		if (!iv->eps[1].device) {
+	/* last endpoint is gone, release the link */
+	for (ivp = &ivshmem_list; *ivp; ivp = &((*ivp)->next))
+		if (*ivp == iv) {
 			*ivp = iv->next;
-			page_free(&mem_pool, iv, 1);
+			page_free(&mem_pool, iv, 1, PAGE_OWNER_IVSHMEM);
 			return;
 		}
-		iv->eps[0] = iv->eps[1];
-	}
+}
+
+/**
+ * Interrupt the root cell via vector 0 of its event device, if it has one.
+ *
+ * @see root_event
+ */
+void pci_ivshmem_notify_events(void)
+{
+	struct pci_ivshmem_endpoint *ive = events_endpoint;
+
+	if (ive)
+		ivshmem_trigger_interrupt(ive, 0);
+}
+
+/**
+ * Deliver the ivshmem interrupts the calling CPU deferred due to the
+ * moderation interval of their receivers, once the interval has expired.
+ * @param cpu_data	Data structure of the calling CPU.
+ *
+ * @return Cycle counter value at which the CPU has to check again, 0 if
+ * nothing is pending.
+ *
+ * @note Invoked by the architecture-specific code at the end of each VM exit.
+ */
+u64 pci_ivshmem_flush_deferred(struct per_cpu *cpu_data)
+{
+	struct pci_ivshmem_endpoint *sender = cpu_data->ivshmem_deferred;
+	u64 next;
+
+	if (!sender)
+		return 0;
+
+	next = ivshmem_flush_peers(sender, get_cycles(), false);
+	if (!next)
+		cpu_data->ivshmem_deferred = NULL;
+	return next;
 }
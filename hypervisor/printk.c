@@ -11,6 +11,7 @@
  */
 
 #include <stdarg.h>
+#include <jailhouse/control.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/processor.h>
 #include <jailhouse/string.h>
@@ -20,9 +21,29 @@
 volatile unsigned long panic_in_progress;
 unsigned long panic_cpu = -1;
 
+/** Console ring, drained by the root cell in deferred mode. */
+struct jailhouse_console console __attribute__((aligned(PAGE_SIZE)));
+
 static DEFINE_SPINLOCK(printk_lock);
 
-#define console_write(msg)	arch_dbg_write(msg)
+static void console_write(const char *msg)
+{
+	unsigned int tail = console.tail;
+	const char *c;
+
+	for (c = msg; *c; c++)
+		console.content[tail++ % sizeof(console.content)] = *c;
+
+	/* publish the content before the new tail */
+	memory_store_barrier();
+	console.tail = tail;
+
+	/* panic output always goes out synchronously */
+	if (panic_in_progress || !system_config ||
+	    !(system_config->debug_console.flags & JAILHOUSE_CON_DEFERRED))
+		arch_dbg_write(msg);
+}
+
 #include "printk-core.c"
 
 void printk(const char *fmt, ...)
@@ -17,19 +17,20 @@
 #include <jailhouse/paging.h>
 #include <jailhouse/control.h>
 #include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <generated/version.h>
 #include <asm/spinlock.h>
 
 extern u8 __text_start[], __page_pool[];
 
-static const __attribute__((aligned(PAGE_SIZE))) u8 empty_page[PAGE_SIZE];
+const __attribute__((aligned(PAGE_SIZE))) u8 empty_page[PAGE_SIZE];
 
 static DEFINE_SPINLOCK(init_lock);
 static unsigned int master_cpu_id = -1;
 static volatile unsigned int initialized_cpus;
 static volatile int error;
 
-static void init_early(unsigned int cpu_id)
+static __cold void init_early(unsigned int cpu_id)
 {
 	unsigned long core_and_percpu_size = hypervisor_header.core_size +
 		sizeof(struct per_cpu) * hypervisor_header.max_cpus;
@@ -54,7 +55,9 @@ static void init_early(unsigned int cpu_id)
 	root_cell.config = &system_config->root_cell;
 
 	root_cell.id = -1;
+	paging_charge_cell(&root_cell);
 	error = cell_init(&root_cell);
+	paging_charge_cell(NULL);
 	if (error)
 		return;
 
@@ -81,26 +84,63 @@ static void init_early(unsigned int cpu_id)
 		hv_page.virt_start += PAGE_SIZE;
 	}
 
-	paging_dump_stats("after early setup");
+	error = cell_stats_map(&root_cell);
+	if (error)
+		return;
+
+	hv_page.phys_start = paging_hvirt2phys(&console);
+	hv_page.virt_start = hv_page.phys_start;
+	hv_page.size = sizeof(console);
+	error = arch_map_memory_region(&root_cell, &hv_page);
+	if (error)
+		return;
+
+	hv_page.phys_start = paging_hvirt2phys(&events_page);
+	hv_page.virt_start = hv_page.phys_start;
+	hv_page.size = PAGE_SIZE;
+	error = arch_map_memory_region(&root_cell, &hv_page);
+	if (error)
+		return;
+
+	paging_dump_stats("after early setup", NULL);
 	printk("Initializing processors:\n");
 }
 
-static void cpu_init(struct per_cpu *cpu_data)
+/*
+ * Per-CPU setup steps that touch shared hypervisor state, e.g. the page
+ * pools. Called with init_lock held.
+ */
+static __cold int cpu_init_early(struct per_cpu *cpu_data)
 {
-	int err = -EINVAL;
-
-	printk(" CPU %d... ", cpu_data->cpu_id);
+	int err;
 
 	if (!cpu_id_valid(cpu_data->cpu_id))
-		goto failed;
+		return -EINVAL;
 
 	cpu_data->cell = &root_cell;
 
-	err = arch_cpu_init(cpu_data);
+	err = exit_latency_cpu_init(cpu_data);
 	if (err)
-		goto failed;
+		return err;
 
-	printk("OK\n");
+	return trace_cpu_init(cpu_data);
+}
+
+/*
+ * Architecture-specific per-CPU setup. Runs concurrently on all CPUs, so
+ * arch_cpu_init has to serialize accesses to shared state on its own.
+ */
+static __cold void cpu_init(struct per_cpu *cpu_data, int err)
+{
+	if (!err)
+		err = arch_cpu_init(cpu_data);
+
+	printk(" CPU %d... %s\n", cpu_data->cpu_id, err ? "FAILED" : "OK");
+
+	if (err) {
+		error = err;
+		return;
+	}
 
 	/*
 	 * If this CPU is last, make sure everything was committed before we
@@ -108,32 +148,31 @@ static void cpu_init(struct per_cpu *cpu_data)
 	 * continue.
 	 */
 	memory_barrier();
+	spin_lock(&init_lock);
 	initialized_cpus++;
-	return;
-
-failed:
-	printk("FAILED\n");
-	error = err;
+	spin_unlock(&init_lock);
 }
 
 int map_root_memory_regions(void)
 {
 	const struct jailhouse_memory *mem;
 	unsigned int n;
-	int err;
+	int err = 0;
 
+	paging_charge_cell(&root_cell);
 	for_each_mem_region(mem, root_cell.config, n) {
 		if (JAILHOUSE_MEMORY_IS_SUBPAGE(mem))
 			err = mmio_subpage_register(&root_cell, mem);
 		else
 			err = arch_map_memory_region(&root_cell, mem);
 		if (err)
-			return err;
+			break;
 	}
-	return 0;
+	paging_charge_cell(NULL);
+	return err;
 }
 
-static void init_late(void)
+static __cold void init_late(void)
 {
 	unsigned int cpu, expected_cpus = 0;
 
@@ -148,15 +187,21 @@ static void init_late(void)
 	if (error)
 		return;
 
+	clock_init();
+
 	config_commit(&root_cell);
 
-	paging_dump_stats("after late setup");
+	paging_dump_stats("after late setup", &root_cell);
+
+	paging_enable_magazines();
 }
 
 int entry(unsigned int cpu_id, struct per_cpu *cpu_data)
 {
 	static volatile bool activate;
+	u64 start = 0, early_done = 0, cpus_done = 0;
 	bool master = false;
+	int err = 0;
 
 	cpu_data->cpu_id = cpu_id;
 
@@ -164,20 +209,30 @@ int entry(unsigned int cpu_id, struct per_cpu *cpu_data)
 
 	if (master_cpu_id == -1) {
 		master = true;
+		start = get_cycles();
 		init_early(cpu_id);
+		early_done = get_cycles();
 	}
 
 	if (!error)
-		cpu_init(cpu_data);
+		err = cpu_init_early(cpu_data);
 
 	spin_unlock(&init_lock);
 
+	if (!error)
+		cpu_init(cpu_data, err);
+
 	while (!error && initialized_cpus < hypervisor_header.online_cpus)
 		cpu_relax();
 
 	if (!error && master) {
+		cpus_done = get_cycles();
 		init_late();
 		if (!error) {
+			printk("Setup cycles: early %lu, CPUs %lu, late %lu\n",
+			       (unsigned long)(early_done - start),
+			       (unsigned long)(cpus_done - early_done),
+			       (unsigned long)(get_cycles() - cpus_done));
 			/*
 			 * Make sure everything was committed before we signal
 			 * the other CPUs that they can continue.
@@ -211,4 +266,6 @@ hypervisor_header = {
 	.core_size = (unsigned long)__page_pool - JAILHOUSE_BASE,
 	.percpu_size = sizeof(struct per_cpu),
 	.entry = arch_entry - JAILHOUSE_BASE,
+	.console_offset = (unsigned long)&console - JAILHOUSE_BASE,
+	.events_offset = (unsigned long)&events_page - JAILHOUSE_BASE,
 };
@@ -0,0 +1,91 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/cell.h>
+#include <jailhouse/control.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/processor.h>
+#include <jailhouse/trace.h>
+#include <asm/processor.h>
+
+/**
+ * Set up the trace buffer of a CPU and map it into the root cell.
+ * @param cpu_data	Data structure of the CPU.
+ *
+ * The buffer is mapped read-only at its physical address into the root cell,
+ * replacing the empty page backing the hypervisor memory there.
+ *
+ * @return 0 on success, negative error code otherwise.
+ */
+int trace_cpu_init(struct per_cpu *cpu_data)
+{
+	struct jailhouse_trace_buffer *buffer;
+	struct jailhouse_memory buffer_mem;
+	int err;
+
+	buffer = page_alloc(&mem_pool, JAILHOUSE_TRACE_BUFFER_PAGES,
+			    PAGE_OWNER_OTHER);
+	if (!buffer)
+		return -ENOMEM;
+
+	buffer->num_records = TRACE_NUM_RECORDS;
+
+	buffer_mem.phys_start = paging_hvirt2phys(buffer);
+	buffer_mem.virt_start = buffer_mem.phys_start;
+	buffer_mem.size = JAILHOUSE_TRACE_BUFFER_PAGES * PAGE_SIZE;
+	buffer_mem.flags = JAILHOUSE_MEM_READ;
+
+	err = arch_map_memory_region(&root_cell, &buffer_mem);
+	if (err) {
+		page_free(&mem_pool, buffer, JAILHOUSE_TRACE_BUFFER_PAGES,
+			  PAGE_OWNER_OTHER);
+		return err;
+	}
+
+	cpu_data->trace_buffer = buffer;
+
+	return 0;
+}
+
+/**
+ * Record an event in the trace buffer of the calling CPU.
+ * @param event		Event type, see JAILHOUSE_TRACE_*.
+ * @param arg0		First event-specific argument.
+ * @param arg1		Second event-specific argument.
+ *
+ * The buffer has a single writer, so no atomic operations are required.
+ * Readers check that the sequence number of a record is unchanged and matches
+ * the expected one after copying it.
+ *
+ * @note Must not be called from NMI context.
+ */
+void trace_event(unsigned int event, unsigned long arg0, unsigned long arg1)
+{
+	struct jailhouse_trace_buffer *buffer = this_cpu_data()->trace_buffer;
+	struct jailhouse_trace_record *record;
+	u32 seq;
+
+	if (!buffer)
+		return;
+
+	seq = buffer->head;
+	record = &buffer->records[seq % TRACE_NUM_RECORDS];
+
+	record->seq = 0;
+	memory_store_barrier();
+
+	record->event = event;
+	record->timestamp = get_cycles();
+	record->arg[0] = arg0;
+	record->arg[1] = arg1;
+
+	memory_store_barrier();
+	record->seq = seq + 1;
+	buffer->head = seq + 1;
+}
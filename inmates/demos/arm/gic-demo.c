@@ -18,30 +18,29 @@
 #define CMDLINE_BUFFER_SIZE	256
 CMDLINE_BUFFER(CMDLINE_BUFFER_SIZE);
 
-#define BEATS_PER_SEC		10
-
 static u64 ticks_per_beat;
 static volatile u64 expected_ticks;
 static bool blinking_led;
+static unsigned long period_us, report_us, elapsed_us;
+static volatile bool report_due;
+static struct histogram jitter;
 
+/* jitter is only recorded in timer ticks, printing would add UART delays */
 static void handle_IRQ(unsigned int irqn)
 {
-	static u64 min_delta = ~0ULL, max_delta = 0;
 	u64 delta;
 
 	if (irqn != TIMER_IRQ)
 		return;
 
 	delta = timer_get_ticks() - expected_ticks;
-	if (delta < min_delta)
-		min_delta = delta;
-	if (delta > max_delta)
-		max_delta = delta;
+	hist_add(&jitter, delta);
 
-	printk("Timer fired, jitter: %6ld ns, min: %6ld ns, max: %6ld ns\n",
-	       (long)timer_ticks_to_ns(delta),
-	       (long)timer_ticks_to_ns(min_delta),
-	       (long)timer_ticks_to_ns(max_delta));
+	elapsed_us += period_us;
+	if (elapsed_us >= report_us) {
+		elapsed_us = 0;
+		report_due = true;
+	}
 
 	if (blinking_led) {
 #ifdef CONFIG_MACH_SUN7I
@@ -55,19 +54,41 @@ static void handle_IRQ(unsigned int irqn)
 	timer_start(ticks_per_beat);
 }
 
+static unsigned long ticks_to_ns(unsigned long ticks)
+{
+	return timer_ticks_to_ns(ticks);
+}
+
 void inmate_main(void)
 {
+	unsigned long freq_khz;
+
+	period_us = cmdline_parse_int("timer_period_us", 100000);
+	if (period_us == 0)
+		period_us = 100000;
+	report_us = cmdline_parse_int("report_interval_s", 1) * 1000000;
+	hist_reset(&jitter);
+
 	printk("Initializing the GIC...\n");
 	gic_setup(handle_IRQ);
 	gic_enable_irq(TIMER_IRQ);
 
 	printk("Initializing the timer...\n");
-	ticks_per_beat = timer_get_frequency() / BEATS_PER_SEC;
+	/* avoid 64-bit and run-time divisions, the ms split keeps precision */
+	freq_khz = timer_get_frequency() / 1000;
+	ticks_per_beat = freq_khz * (period_us / 1000) +
+		freq_khz * (period_us % 1000) / 1000;
 	expected_ticks = timer_get_ticks() + ticks_per_beat;
 	timer_start(ticks_per_beat);
 
 	blinking_led = cmdline_parse_bool("blinking_led");
 
-	while (1)
+	while (1) {
 		asm volatile("wfi" : : : "memory");
+
+		if (report_due) {
+			report_due = false;
+			hist_print_summary(&jitter, "Timer jitter", ticks_to_ns);
+		}
+	}
 }
@@ -28,22 +28,26 @@ CMDLINE_BUFFER(CMDLINE_BUFFER_SIZE);
 
 #define APIC_TIMER_VECTOR	32
 
+static unsigned long timer_period;
 static unsigned long expected_time;
-static unsigned long min = -1, max;
+static unsigned long ticks_per_report, ticks_to_report;
+static volatile bool report_due;
+static struct histogram jitter;
 
+/* jitter is only recorded, printing it here would add UART delays */
 static void irq_handler(void)
 {
-	unsigned long delta;
+	long delta;
 
 	delta = tsc_read() - expected_time;
-	if (delta < min)
-		min = delta;
-	if (delta > max)
-		max = delta;
-	printk("Timer fired, jitter: %6ld ns, min: %6ld ns, max: %6ld ns\n",
-	       delta, min, max);
-
-	expected_time += 100 * NS_PER_MSEC;
+	hist_add(&jitter, delta > 0 ? delta : 0);
+
+	if (--ticks_to_report == 0) {
+		ticks_to_report = ticks_per_report;
+		report_due = true;
+	}
+
+	expected_time += timer_period;
 	apic_timer_set(expected_time - tsc_read());
 }
 
@@ -98,6 +102,19 @@ void inmate_main(void)
 	if (cache_pollution)
 		printk("Cache pollution enabled\n");
 
+	timer_period = cmdline_parse_int("timer_period_us", 100000) *
+		NS_PER_USEC;
+	if (timer_period == 0)
+		timer_period = 100 * NS_PER_MSEC;
+	ticks_per_report = cmdline_parse_int("report_interval_s", 1) *
+		NS_PER_SEC / timer_period;
+	if (ticks_per_report == 0)
+		ticks_per_report = 1;
+	ticks_to_report = ticks_per_report;
+	hist_reset(&jitter);
+	printk("Timer period: %lu us, report interval: %lu ticks\n",
+	       timer_period / NS_PER_USEC, ticks_per_report);
+
 	tsc_freq = tsc_init();
 	printk("Calibrated TSC frequency: %lu.%03u kHz\n", tsc_freq / 1000,
 	       tsc_freq % 1000);
@@ -110,6 +127,11 @@ void inmate_main(void)
 		if (cache_pollution)
 			pollute_cache();
 
+		if (report_due) {
+			report_due = false;
+			hist_print_summary(&jitter, "Timer jitter", NULL);
+		}
+
 		switch (comm_region->msg_to_cell) {
 		case JAILHOUSE_MSG_SHUTDOWN_REQUEST:
 			if (!allow_terminate) {
@@ -128,6 +150,7 @@ void inmate_main(void)
 		}
 	}
 
+	hist_print_summary(&jitter, "Timer jitter", NULL);
 	printk("Stopped APIC demo\n");
 	comm_region->cell_state = JAILHOUSE_CELL_SHUT_DOWN;
 }
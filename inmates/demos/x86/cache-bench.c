@@ -0,0 +1,212 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Cache interference benchmark. A pointer chase through a random cyclic
+ * permutation of cache lines probes the memory latency while the APIC timer
+ * fires periodically, as in the apic-demo, to record the interrupt jitter.
+ * After each window, both are reported as histograms on the console, so
+ * that the noise caused by a stressor in another cell (e.g. tools/cache-stress
+ * in the root cell) can be compared with and without CAT partitioning.
+ * Chase batches interrupted by the timer are discarded.
+ *
+ * Command line parameters:
+ *  wss_kb=N			working set of the pointer chase in KB
+ *				(default 4096, at most 30720)
+ *  timer_period_us=N		APIC timer period (default 100)
+ *  window_ms=N			reporting window (default 1000)
+ */
+
+#include <inmate.h>
+
+#define CMDLINE_BUFFER_SIZE	256
+CMDLINE_BUFFER(CMDLINE_BUFFER_SIZE);
+
+#ifdef CONFIG_UART_OXPCIE952
+#define UART_BASE		0xe010
+#else
+#define UART_BASE		0x3f8
+#endif
+
+#define APIC_TIMER_VECTOR	32
+
+/* the chase buffer follows the initially mapped 2 MB of cell RAM */
+#define CHASE_BASE		0x200000
+#define CHASE_MAX_SIZE		(30 * 1024 * 1024)
+#define CHASE_HOPS		256
+
+static struct histogram latency_hist;
+/* double-buffered so that the handler never waits for a report */
+static struct histogram jitter_hists[2];
+static struct histogram *jitter_hist = &jitter_hists[0];
+
+static unsigned long timer_period;
+static unsigned long expected_time;
+static volatile unsigned long timer_irqs;
+
+static inline u64 rdtsc_ordered(void)
+{
+	u32 lo, hi;
+
+	asm volatile("lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi)
+		     : : "memory");
+	return (u64)lo | ((u64)hi << 32);
+}
+
+static void report(const struct histogram *hist, const char *name)
+{
+	hist_print_summary(hist, name, NULL);
+	hist_print_buckets(hist, name, NULL);
+}
+
+static void irq_handler(void)
+{
+	unsigned long now = tsc_read();
+	long delta = now - expected_time;
+
+	hist_add(jitter_hist, delta > 0 ? delta : 0);
+	timer_irqs++;
+
+	/* skip periods that were missed entirely */
+	do
+		expected_time += timer_period;
+	while ((long)(expected_time - now) <= 0);
+	apic_timer_set(expected_time - tsc_read());
+}
+
+static void init_apic(void)
+{
+	int_init();
+	int_set_handler(APIC_TIMER_VECTOR, irq_handler);
+	apic_timer_init(APIC_TIMER_VECTOR);
+
+	expected_time = tsc_read() + timer_period;
+	apic_timer_set(timer_period);
+}
+
+static u64 random_next(u64 *state)
+{
+	/* xorshift64 */
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/*
+ * Link all cache lines of the buffer to a single random cycle (Sattolo's
+ * algorithm), both to defeat the hardware prefetchers and to visit the
+ * whole working set.
+ */
+static void **chase_init(unsigned long size)
+{
+	unsigned long lines = size / CACHE_LINE_SIZE;
+	unsigned long *line, n, j, tmp;
+	u64 random = rdtsc_ordered() | 1;
+	char *buffer = (char *)CHASE_BASE;
+
+	map_range(buffer, size, MAP_CACHED);
+
+	for (n = 0; n < lines; n++)
+		*(unsigned long *)(buffer + n * CACHE_LINE_SIZE) = n;
+
+	for (n = lines - 1; n > 0; n--) {
+		j = random_next(&random) % n;
+		line = (unsigned long *)(buffer + n * CACHE_LINE_SIZE);
+		tmp = *line;
+		*line = *(unsigned long *)(buffer + j * CACHE_LINE_SIZE);
+		*(unsigned long *)(buffer + j * CACHE_LINE_SIZE) = tmp;
+	}
+
+	for (n = 0; n < lines; n++) {
+		line = (unsigned long *)(buffer + n * CACHE_LINE_SIZE);
+		*line = (unsigned long)buffer + *line * CACHE_LINE_SIZE;
+	}
+
+	return (void **)buffer;
+}
+
+static void **chase(void **pos)
+{
+	unsigned int n;
+
+	for (n = 0; n < CHASE_HOPS; n++)
+		pos = *pos;
+	return pos;
+}
+
+void inmate_main(void)
+{
+	unsigned long wss, tsc_freq, irqs, discarded = 0;
+	struct histogram *jitter_done, *jitter_next;
+	u64 start, end, window_start, window_cycles;
+	unsigned int window = 0;
+	void **pos;
+
+	printk_uart_base = UART_BASE;
+
+	wss = cmdline_parse_int("wss_kb", 4096) * 1024;
+	if (wss > CHASE_MAX_SIZE)
+		wss = CHASE_MAX_SIZE;
+	if (wss < PAGE_SIZE)
+		wss = PAGE_SIZE;
+	timer_period = cmdline_parse_int("timer_period_us", 100) * NS_PER_USEC;
+	if (timer_period == 0) {
+		printk("cache-bench: invalid timer period\n");
+		return;
+	}
+
+	tsc_freq = tsc_init();
+	window_cycles = (u64)cmdline_parse_int("window_ms", 1000) * tsc_freq /
+		1000;
+
+	pos = chase_init(wss);
+	hist_reset(&latency_hist);
+	hist_reset(jitter_hist);
+
+	printk("# cache-bench: tsc_khz=%lu wss_kb=%lu timer_period_us=%lu\n",
+	       tsc_freq / 1000, wss / 1024, timer_period / NS_PER_USEC);
+	printk("# histogram lines: metric,bucket_upper_bound,count\n");
+
+	init_apic();
+	asm volatile("sti");
+
+	window_start = rdtsc_ordered();
+	while (1) {
+		irqs = timer_irqs;
+		start = rdtsc_ordered();
+		pos = chase(pos);
+		end = rdtsc_ordered();
+
+		if (timer_irqs == irqs)
+			hist_add(&latency_hist,
+				 tsc_cycles_to_ns(end - start) / CHASE_HOPS);
+		else
+			discarded++;
+
+		if (end - window_start < window_cycles)
+			continue;
+
+		jitter_done = jitter_hist;
+		jitter_next = jitter_done == &jitter_hists[0] ?
+			&jitter_hists[1] : &jitter_hists[0];
+		hist_reset(jitter_next);
+		asm volatile("cli" : : : "memory");
+		jitter_hist = jitter_next;
+		asm volatile("sti" : : : "memory");
+
+		printk("# window %u: %lu chase batches discarded\n", window,
+		       discarded);
+		report(&latency_hist, "load_latency_ns");
+		report(jitter_done, "timer_jitter_ns");
+
+		hist_reset(&latency_hist);
+		discarded = 0;
+		window++;
+		window_start = rdtsc_ordered();
+	}
+}
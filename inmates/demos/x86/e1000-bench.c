@@ -0,0 +1,182 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Packet rate benchmark on top of the e1000 driver library. It runs in the
+ * cell of configs/e1000-demo.c and reports the achieved frame and bit rates
+ * once per second. Bit rates account for the frame as passed to the NIC,
+ * i.e. without FCS, preamble and inter-frame gap.
+ *
+ * Command line parameters:
+ *  mode=tx|rx|fwd		transmit broadcast frames, count received
+ *				frames or send them back with swapped
+ *				addresses (default fwd)
+ *  size=N			frame size in tx mode, without FCS
+ *				(default 60)
+ *  burst=N			frames per doorbell (default 32)
+ *  spin_us=N			polling time before falling back to the
+ *				receive interrupt (default 100)
+ *  irq				enable the receive interrupt fallback
+ */
+
+#include <inmate.h>
+
+#define CMDLINE_BUFFER_SIZE	256
+CMDLINE_BUFFER(CMDLINE_BUFFER_SIZE);
+
+#ifdef CONFIG_UART_OXPCIE952
+#define UART_BASE		0xe000
+#else
+#define UART_BASE		0x2f8
+#endif
+
+#define E1000_VECTOR		40
+
+#define MAX_BURST		64
+#define MIN_FRAME_SIZE		60
+#define MAX_FRAME_SIZE		1514
+
+#define FRAME_TYPE_BENCH	0x044a
+
+struct eth_header {
+	u8	dst[6];
+	u8	src[6];
+	u16	type;
+} __attribute__((packed));
+
+enum bench_mode { MODE_TX, MODE_RX, MODE_FWD };
+
+static u8 tx_frame[MAX_FRAME_SIZE];
+static struct e1000_packet packets[MAX_BURST];
+
+static void report(const char *mode, unsigned long frames,
+		   unsigned long bytes, unsigned long elapsed)
+{
+	printk("%s: %lu frames/s, %lu Mbit/s\n", mode,
+	       frames * NS_PER_SEC / elapsed, bytes * 8000 / elapsed);
+}
+
+static void swap_addresses(struct e1000_packet *packets, unsigned int num,
+			   unsigned long *bytes)
+{
+	struct eth_header *eth;
+	unsigned int n;
+	u8 tmp[6];
+
+	for (n = 0; n < num; n++) {
+		eth = packets[n].data;
+		memcpy(tmp, eth->dst, sizeof(tmp));
+		memcpy(eth->dst, eth->src, sizeof(eth->dst));
+		memcpy(eth->src, tmp, sizeof(eth->src));
+		*bytes += packets[n].len;
+	}
+}
+
+void inmate_main(void)
+{
+	static const char *mode_names[] = { "tx", "rx", "fwd" };
+	unsigned long frames = 0, bytes = 0, last, now, spin_us, size;
+	struct eth_header *eth = (struct eth_header *)tx_frame;
+	char mode_str[8];
+	enum bench_mode mode;
+	unsigned int burst, n, sent, received;
+	u8 mac[6];
+	int bdf;
+
+	printk_uart_base = UART_BASE;
+
+	cmdline_parse_str("mode", mode_str, sizeof(mode_str), "fwd");
+	if (strncmp(mode_str, "tx", sizeof(mode_str)) == 0)
+		mode = MODE_TX;
+	else if (strncmp(mode_str, "rx", sizeof(mode_str)) == 0)
+		mode = MODE_RX;
+	else
+		mode = MODE_FWD;
+
+	size = cmdline_parse_int("size", MIN_FRAME_SIZE);
+	if (size < sizeof(*eth))
+		size = sizeof(*eth);
+	if (size > MAX_FRAME_SIZE)
+		size = MAX_FRAME_SIZE;
+	burst = cmdline_parse_int("burst", 32);
+	if (burst == 0 || burst > MAX_BURST)
+		burst = MAX_BURST;
+	spin_us = cmdline_parse_int("spin_us", 100);
+
+	pci_init();
+	bdf = pci_find_device(PCI_ID_ANY, PCI_ID_ANY, 0);
+	if (bdf < 0) {
+		printk("No device found!\n");
+		return;
+	}
+	if (e1000_init(bdf, mac) < 0) {
+		printk("MMIO BAR not found!\n");
+		return;
+	}
+
+	if (cmdline_parse_bool("irq")) {
+		int_init();
+		if (e1000_enable_irq(bdf, E1000_VECTOR) < 0)
+			printk("No MSI support, polling only\n");
+	}
+
+	memset(eth->dst, 0xff, sizeof(eth->dst));
+	memcpy(eth->src, mac, sizeof(eth->src));
+	eth->type = FRAME_TYPE_BENCH;
+	for (n = 0; n < burst; n++) {
+		packets[n].data = tx_frame;
+		packets[n].len = size;
+	}
+
+	printk("e1000-bench: mode %s, burst %u", mode_names[mode], burst);
+	if (mode == MODE_TX)
+		printk(", frame size %lu", size);
+	printk("\n");
+
+	tsc_init();
+	last = tsc_read();
+	while (1) {
+		switch (mode) {
+		case MODE_TX:
+			sent = e1000_send(packets, burst);
+			frames += sent;
+			bytes += sent * size;
+			break;
+		case MODE_RX:
+			received = e1000_receive(packets, burst);
+			if (received == 0) {
+				e1000_wait_rx(spin_us);
+				break;
+			}
+			for (n = 0; n < received; n++)
+				bytes += packets[n].len;
+			frames += received;
+			e1000_receive_done(received);
+			break;
+		case MODE_FWD:
+			received = e1000_receive(packets, burst);
+			if (received == 0) {
+				e1000_wait_rx(spin_us);
+				break;
+			}
+			swap_addresses(packets, received, &bytes);
+			for (sent = 0; sent < received; )
+				sent += e1000_send(&packets[sent],
+						   received - sent);
+			frames += received;
+			e1000_receive_done(received);
+			break;
+		}
+
+		now = tsc_read();
+		if (now - last >= NS_PER_SEC) {
+			report(mode_names[mode], frames, bytes, now - last);
+			frames = bytes = 0;
+			last = now;
+		}
+	}
+}
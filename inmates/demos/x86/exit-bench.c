@@ -0,0 +1,361 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Micro-benchmark of the hypervisor exit paths. Each test measures the
+ * round-trip cost of one trapping operation in TSC cycles and reports
+ * min/median/p99/max over all samples as CSV lines on the console. The
+ * pci_config_read test covers both the address and the data port access.
+ * MMIO and ping-pong tests require an ivshmem device, the latter also a peer
+ * cell running this benchmark as responder.
+ *
+ * Command line parameters:
+ *  samples=N			samples per test (default 1000)
+ *  xapic			also run the xAPIC IPI test, only valid if the
+ *				hypervisor runs the APICs in xAPIC mode
+ *  ivshmem_responder		only answer doorbells of an ivshmem peer
+ *  ivshmem_peer=N		peer to ping, default 1 (0 if we are peer 1)
+ */
+
+#include <inmate.h>
+
+#define CMDLINE_BUFFER_SIZE	256
+CMDLINE_BUFFER(CMDLINE_BUFFER_SIZE);
+
+#ifdef CONFIG_UART_OXPCIE952
+#define UART_BASE		0xe010
+#else
+#define UART_BASE		0x3f8
+#endif
+
+#define MAX_SAMPLES		4096
+#define WARMUP_SAMPLES		16
+
+#define IPI_VECTOR		40
+#define IVSHMEM_VECTOR		41
+
+#define MSR_IA32_PAT		0x277
+
+#define XAPIC_BASE		0xfee00000
+#define XAPIC_ICR		0x300
+#define XAPIC_ICR_HI		0x310
+
+#define PCI_REG_ADDR_PORT	0xcf8
+
+#define IVSHMEM_VENDORID	0x1af4
+#define IVSHMEM_DEVICEID	0x1110
+
+#define IVSHMEM_CFG_SHMEM_PTR	0x40
+#define IVSHMEM_CFG_SHMEM_SZ	0x48
+
+#define IVSHMEM_REG_INTRMASK	0
+#define IVSHMEM_REG_IVPOS	8
+#define IVSHMEM_REG_DBELL	12
+
+/* written to the start of the shared memory by a ready responder */
+#define IVSHMEM_READY_MAGIC	0x4a484252  /* "JHBR" */
+#define IVSHMEM_PEER_TIMEOUT	(1000 * NS_PER_MSEC)
+
+struct ivshmem {
+	int bdf;
+	void *registers;
+	volatile u32 *shmem;
+	unsigned int peer;
+};
+
+typedef void (*bench_fn_t)(void);
+
+static unsigned long samples[MAX_SAMPLES];
+static unsigned int num_samples;
+
+static volatile bool irq_received;
+static u32 apic_id;
+static struct ivshmem ivshmem = { .bdf = -1 };
+
+static inline u64 rdtsc_ordered(void)
+{
+	u32 lo, hi;
+
+	asm volatile("lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi)
+		     : : "memory");
+	return (u64)lo | ((u64)hi << 32);
+}
+
+/* in-place heap sort, samples are only sorted for evaluation */
+static void sift_down(unsigned long *a, unsigned int start, unsigned int end)
+{
+	unsigned int root = start, child;
+	unsigned long tmp;
+
+	while ((child = 2 * root + 1) < end) {
+		if (child + 1 < end && a[child] < a[child + 1])
+			child++;
+		if (a[root] >= a[child])
+			return;
+		tmp = a[root];
+		a[root] = a[child];
+		a[child] = tmp;
+		root = child;
+	}
+}
+
+static void sort_samples(unsigned long *a, unsigned int count)
+{
+	unsigned int n;
+	unsigned long tmp;
+
+	for (n = count / 2; n > 0; n--)
+		sift_down(a, n - 1, count);
+	for (n = count; n > 1; n--) {
+		tmp = a[0];
+		a[0] = a[n - 1];
+		a[n - 1] = tmp;
+		sift_down(a, 0, n - 1);
+	}
+}
+
+static void report(const char *name)
+{
+	sort_samples(samples, num_samples);
+	printk("%s,%u,%lu,%lu,%lu,%lu\n", name, num_samples, samples[0],
+	       samples[num_samples / 2], samples[num_samples * 99 / 100],
+	       samples[num_samples - 1]);
+}
+
+static void run_bench(const char *name, bench_fn_t fn)
+{
+	unsigned int n;
+	u64 start;
+
+	for (n = 0; n < WARMUP_SAMPLES; n++)
+		fn();
+
+	for (n = 0; n < num_samples; n++) {
+		start = rdtsc_ordered();
+		fn();
+		samples[n] = rdtsc_ordered() - start;
+	}
+
+	report(name);
+}
+
+static void bench_baseline(void)
+{
+}
+
+static void bench_hypercall(void)
+{
+	jailhouse_call_arg1(JAILHOUSE_HC_HYPERVISOR_GET_INFO,
+			    JAILHOUSE_INFO_NUM_CELLS);
+}
+
+static void bench_cpuid(void)
+{
+	u32 eax = 0, ebx, ecx = 0, edx;
+
+	asm volatile("cpuid"
+		: "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx)
+		: : "memory");
+}
+
+static void bench_msr(void)
+{
+	read_msr(MSR_IA32_PAT);
+}
+
+static void bench_pio(void)
+{
+	inl(PCI_REG_ADDR_PORT);
+}
+
+static void bench_pci_config(void)
+{
+	pci_read_config(ivshmem.bdf >= 0 ? ivshmem.bdf : 0,
+			PCI_CFG_VENDOR_ID, 4);
+}
+
+static void bench_mmio_read(void)
+{
+	mmio_read32(ivshmem.registers + IVSHMEM_REG_INTRMASK);
+}
+
+static void bench_mmio_write(void)
+{
+	mmio_write32(ivshmem.registers + IVSHMEM_REG_INTRMASK, 0);
+}
+
+static void wait_for_irq(void)
+{
+	while (!irq_received)
+		cpu_relax();
+	irq_received = false;
+}
+
+static void bench_x2apic_ipi(void)
+{
+	write_msr(X2APIC_ICR, ((u64)apic_id << 32) | APIC_LVL_ASSERT |
+		  IPI_VECTOR);
+	wait_for_irq();
+}
+
+static void bench_xapic_ipi(void)
+{
+	mmio_write32((void *)XAPIC_BASE + XAPIC_ICR_HI, apic_id << 24);
+	mmio_write32((void *)XAPIC_BASE + XAPIC_ICR,
+		     APIC_LVL_ASSERT | IPI_VECTOR);
+	wait_for_irq();
+}
+
+static void ivshmem_kick(unsigned int peer)
+{
+	mmio_write32(ivshmem.registers + IVSHMEM_REG_DBELL, peer << 16);
+}
+
+static void bench_ivshmem_ping(void)
+{
+	ivshmem_kick(ivshmem.peer);
+	wait_for_irq();
+}
+
+static void irq_handler(void)
+{
+	irq_received = true;
+}
+
+static void ivshmem_responder_handler(void)
+{
+	ivshmem_kick(ivshmem.peer);
+}
+
+static u64 pci_cfg_read64(u16 bdf, unsigned int addr)
+{
+	return ((u64)pci_read_config(bdf, addr + 4, 4) << 32) |
+		pci_read_config(bdf, addr, 4);
+}
+
+static bool ivshmem_init(bool responder)
+{
+	u64 shmem_size;
+	int bdf;
+
+	bdf = pci_find_device(IVSHMEM_VENDORID, IVSHMEM_DEVICEID, 0);
+	if (bdf < 0)
+		return false;
+
+	if (pci_find_cap(bdf, PCI_CAP_MSIX) < 0) {
+		printk("# ivshmem device is not MSI-X capable\n");
+		return false;
+	}
+
+	ivshmem.bdf = bdf;
+	ivshmem.shmem = (void *)pci_cfg_read64(bdf, IVSHMEM_CFG_SHMEM_PTR);
+	shmem_size = pci_cfg_read64(bdf, IVSHMEM_CFG_SHMEM_SZ);
+
+	/* place the register and MSI-X BARs right behind the shared memory */
+	ivshmem.registers = (void *)(((unsigned long)ivshmem.shmem +
+				      shmem_size + PAGE_SIZE - 1) & PAGE_MASK);
+	pci_write_config(bdf, PCI_CFG_BAR, (unsigned long)ivshmem.registers,
+			 4);
+	pci_write_config(bdf, PCI_CFG_BAR + 4,
+			 (unsigned long)ivshmem.registers >> 32, 4);
+	pci_write_config(bdf, PCI_CFG_BAR + 16,
+			 (unsigned long)ivshmem.registers + PAGE_SIZE, 4);
+	pci_write_config(bdf, PCI_CFG_BAR + 20,
+			 ((unsigned long)ivshmem.registers + PAGE_SIZE) >> 32,
+			 4);
+	pci_write_config(bdf, PCI_CFG_COMMAND, PCI_CMD_MEM | PCI_CMD_MASTER,
+			 2);
+	map_range((void *)ivshmem.shmem, shmem_size + 2 * PAGE_SIZE,
+		  MAP_UNCACHED);
+
+	ivshmem.peer = cmdline_parse_int("ivshmem_peer",
+		mmio_read32(ivshmem.registers + IVSHMEM_REG_IVPOS) == 1 ?
+		0 : 1);
+
+	int_set_handler(IVSHMEM_VECTOR, responder ? ivshmem_responder_handler :
+			irq_handler);
+	pci_msix_set_vector(bdf, IVSHMEM_VECTOR, 0);
+
+	return true;
+}
+
+static bool ivshmem_wait_for_peer(void)
+{
+	unsigned long start = tsc_read();
+
+	while (ivshmem.shmem[0] != IVSHMEM_READY_MAGIC)
+		if (tsc_read() - start > IVSHMEM_PEER_TIMEOUT)
+			return false;
+	return true;
+}
+
+void inmate_main(void)
+{
+	bool responder;
+	unsigned long tsc_freq;
+
+	printk_uart_base = UART_BASE;
+
+	num_samples = cmdline_parse_int("samples", 1000);
+	if (num_samples == 0 || num_samples > MAX_SAMPLES)
+		num_samples = MAX_SAMPLES;
+	responder = cmdline_parse_bool("ivshmem_responder");
+
+	hypercall_init();
+	int_init();
+	int_set_handler(IPI_VECTOR, irq_handler);
+	apic_id = cpu_id();
+
+	tsc_freq = tsc_init();
+
+	if (ivshmem_init(responder) && responder) {
+		asm volatile("sti");
+		ivshmem.shmem[0] = IVSHMEM_READY_MAGIC;
+		printk("# exit-bench: answering doorbells of peer %u\n",
+		       ivshmem.peer);
+		while (1)
+			asm volatile("hlt");
+	}
+
+	printk("# exit-bench: tsc_khz=%lu samples=%u\n", tsc_freq / 1000,
+	       num_samples);
+	printk("test,samples,min,median,p99,max\n");
+
+	run_bench("baseline", bench_baseline);
+	run_bench("hypercall", bench_hypercall);
+	run_bench("cpuid", bench_cpuid);
+	run_bench("msr_read", bench_msr);
+	run_bench("pio_read", bench_pio);
+	run_bench("pci_config_read", bench_pci_config);
+
+	if (ivshmem.bdf >= 0) {
+		run_bench("mmio_read", bench_mmio_read);
+		run_bench("mmio_write", bench_mmio_write);
+	} else {
+		printk("# no ivshmem device, skipping MMIO tests\n");
+	}
+
+	asm volatile("sti");
+
+	run_bench("x2apic_ipi", bench_x2apic_ipi);
+
+	if (cmdline_parse_bool("xapic")) {
+		map_range((void *)XAPIC_BASE, PAGE_SIZE, MAP_UNCACHED);
+		run_bench("xapic_ipi", bench_xapic_ipi);
+	}
+
+	if (ivshmem.bdf >= 0) {
+		if (ivshmem_wait_for_peer())
+			run_bench("ivshmem_ping_pong", bench_ivshmem_ping);
+		else
+			printk("# no ivshmem responder, skipping ping-pong\n");
+	}
+
+	printk("# exit-bench: done\n");
+
+	asm volatile("cli; hlt");
+}
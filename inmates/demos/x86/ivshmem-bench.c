@@ -0,0 +1,261 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Cell side of the inter-cell benchmark, driven by tools/ivshmem-bench on
+ * the peer via the jailhouse-queue driver. It uses the message queues of
+ * jailhouse/queue.h on the first ivshmem device: pings are answered with the
+ * TSC of their arrival, data messages are counted until the end of a stream
+ * is signaled. As no TSC offsetting is applied to cells, timestamps of both
+ * sides are comparable.
+ *
+ * Command line parameters:
+ *  slot_size=N			size of the transmit queue slots (default 256)
+ *  poll			busy-poll the queue instead of waiting for
+ *				doorbell interrupts, can be changed by the peer
+ */
+
+#include <inmate.h>
+#include <jailhouse/queue.h>
+
+#define CMDLINE_BUFFER_SIZE	256
+CMDLINE_BUFFER(CMDLINE_BUFFER_SIZE);
+
+#ifdef CONFIG_UART_OXPCIE952
+#define UART_BASE		0xe010
+#else
+#define UART_BASE		0x3f8
+#endif
+
+#define IVSHMEM_VECTOR		40
+
+#define IVSHMEM_VENDORID	0x1af4
+#define IVSHMEM_DEVICEID	0x1110
+
+#define IVSHMEM_CFG_SHMEM_PTR	0x40
+#define IVSHMEM_CFG_SHMEM_SZ	0x48
+
+#define IVSHMEM_REG_IVPOS	8
+#define IVSHMEM_REG_DBELL	12
+
+#define MAX_MSG_SIZE		4096
+
+/* keep in sync with tools/ivshmem-bench.c */
+enum bench_msg_type {
+	BENCH_PING = 1,
+	BENCH_PONG,
+	BENCH_DATA,
+	BENCH_END,
+	BENCH_STATS,
+	BENCH_MODE,
+};
+
+struct bench_msg {
+	u32 type;
+	u32 seq;
+	/* TSC of the sender when sending (STATS: last data message) */
+	u64 tx_tsc;
+	/* PONG: TSC when the ping arrived (STATS: first data message) */
+	u64 rx_tsc;
+	/* STATS: bytes and messages received, MODE: 1 for polling */
+	u64 value[2];
+} __attribute__((packed));
+
+struct ivshmem {
+	int bdf;
+	void *registers;
+	void *shmem;
+	u64 shmem_size;
+	unsigned int ivpos;
+};
+
+static struct ivshmem ivshmem;
+static struct shmem_queue tx_queue, rx_queue;
+static bool polling;
+
+static u8 rx_buf[MAX_MSG_SIZE];
+
+static inline u64 rdtsc(void)
+{
+	u32 lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return (u64)lo | ((u64)hi << 32);
+}
+
+static void irq_handler(void)
+{
+}
+
+/* sti takes effect after hlt, so no doorbell is lost in between */
+static void wait_for_doorbell(void)
+{
+	if (polling)
+		cpu_relax();
+	else
+		asm volatile("sti; hlt; cli" : : : "memory");
+}
+
+static void kick_peer(void)
+{
+	mmio_write32(ivshmem.registers + IVSHMEM_REG_DBELL,
+		     (1 - ivshmem.ivpos) << 16);
+}
+
+static u64 pci_cfg_read64(u16 bdf, unsigned int addr)
+{
+	return ((u64)pci_read_config(bdf, addr + 4, 4) << 32) |
+		pci_read_config(bdf, addr, 4);
+}
+
+static bool ivshmem_init(void)
+{
+	unsigned long regs;
+	int bdf;
+
+	pci_init();
+	bdf = pci_find_device(IVSHMEM_VENDORID, IVSHMEM_DEVICEID, 0);
+	if (bdf < 0) {
+		printk("ivshmem-bench: no ivshmem device found\n");
+		return false;
+	}
+
+	ivshmem.bdf = bdf;
+	ivshmem.shmem = (void *)pci_cfg_read64(bdf, IVSHMEM_CFG_SHMEM_PTR);
+	ivshmem.shmem_size = pci_cfg_read64(bdf, IVSHMEM_CFG_SHMEM_SZ);
+
+	/* place the register and MSI-X BARs right behind the shared memory */
+	regs = ((unsigned long)ivshmem.shmem + ivshmem.shmem_size +
+		PAGE_SIZE - 1) & PAGE_MASK;
+	ivshmem.registers = (void *)regs;
+	pci_write_config(bdf, PCI_CFG_BAR, regs, 4);
+	pci_write_config(bdf, PCI_CFG_BAR + 4, regs >> 32, 4);
+	pci_write_config(bdf, PCI_CFG_BAR + 16, regs + PAGE_SIZE, 4);
+	pci_write_config(bdf, PCI_CFG_BAR + 20, (regs + PAGE_SIZE) >> 32, 4);
+	pci_write_config(bdf, PCI_CFG_COMMAND, PCI_CMD_MEM | PCI_CMD_MASTER,
+			 2);
+	map_range(ivshmem.shmem, ivshmem.shmem_size, MAP_CACHED);
+	map_range(ivshmem.registers, 2 * PAGE_SIZE, MAP_UNCACHED);
+
+	ivshmem.ivpos = mmio_read32(ivshmem.registers + IVSHMEM_REG_IVPOS);
+	if (ivshmem.ivpos > 1) {
+		printk("ivshmem-bench: only links between two peers "
+		       "supported\n");
+		return false;
+	}
+
+	int_set_handler(IVSHMEM_VECTOR, irq_handler);
+	pci_msix_set_vector(bdf, IVSHMEM_VECTOR, 0);
+
+	return true;
+}
+
+static void send(const struct bench_msg *msg)
+{
+	while (!shmem_queue_push(&tx_queue, msg, sizeof(*msg)))
+		if (shmem_queue_prepare_wait(&tx_queue))
+			wait_for_doorbell();
+
+	if (shmem_queue_kick_needed(&tx_queue))
+		kick_peer();
+}
+
+static int receive(void)
+{
+	int len;
+
+	while ((len = shmem_queue_pop(&rx_queue, rx_buf,
+				      sizeof(rx_buf))) < 0)
+		if (polling || shmem_queue_prepare_wait(&rx_queue))
+			wait_for_doorbell();
+
+	/* the peer may wait for a free slot */
+	if (shmem_queue_kick_needed(&rx_queue))
+		kick_peer();
+
+	return len;
+}
+
+void inmate_main(void)
+{
+	unsigned long half, slot_size;
+	u64 bytes = 0, messages = 0, first = 0, last = 0, now;
+	struct bench_msg *msg = (struct bench_msg *)rx_buf;
+	struct bench_msg reply;
+	int len;
+
+	printk_uart_base = UART_BASE;
+
+	slot_size = cmdline_parse_int("slot_size", 256);
+	polling = cmdline_parse_bool("poll");
+
+	int_init();
+	if (!ivshmem_init())
+		goto out;
+
+	/* the endpoint with IVPosition 0 produces into the lower half */
+	half = ivshmem.shmem_size / 2;
+	if (shmem_queue_init_producer(&tx_queue,
+				      ivshmem.shmem + ivshmem.ivpos * half,
+				      half, slot_size) < 0) {
+		printk("ivshmem-bench: invalid slot size %lu\n", slot_size);
+		goto out;
+	}
+	/* let a peer waiting for our queue attach to it */
+	kick_peer();
+
+	while (shmem_queue_init_consumer(&rx_queue, ivshmem.shmem +
+					 (1 - ivshmem.ivpos) * half,
+					 half) < 0)
+		wait_for_doorbell();
+
+	printk("ivshmem-bench: ready, %s mode\n",
+	       polling ? "polling" : "interrupt");
+
+	while (1) {
+		len = receive();
+		now = rdtsc();
+		if (len < 8)
+			continue;
+
+		switch (msg->type) {
+		case BENCH_PING:
+			reply = *msg;
+			reply.type = BENCH_PONG;
+			reply.rx_tsc = now;
+			reply.tx_tsc = rdtsc();
+			send(&reply);
+			break;
+		case BENCH_DATA:
+			if (messages == 0)
+				first = now;
+			last = now;
+			bytes += len;
+			messages++;
+			break;
+		case BENCH_END:
+			memset(&reply, 0, sizeof(reply));
+			reply.type = BENCH_STATS;
+			reply.seq = msg->seq;
+			reply.rx_tsc = first;
+			reply.tx_tsc = last;
+			reply.value[0] = bytes;
+			reply.value[1] = messages;
+			send(&reply);
+			bytes = messages = 0;
+			break;
+		case BENCH_MODE:
+			polling = msg->value[0] != 0;
+			reply = *msg;
+			send(&reply);
+			break;
+		}
+	}
+
+out:
+	asm volatile("hlt");
+}
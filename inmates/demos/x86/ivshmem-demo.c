@@ -100,9 +100,12 @@ static int get_ivpos(struct ivshmem_dev_data *d)
 
 static void send_irq(struct ivshmem_dev_data *d)
 {
-	printk("IVSHMEM: %02x:%02x.%x sending IRQ\n",
-	       d->bdf >> 8, (d->bdf >> 3) & 0x1f, d->bdf & 0x3);
-	mmio_write32(d->registers + 3, 1);
+	/* peer 0 kicks peer 1, everyone else kicks peer 0, vector 0 */
+	int peer = get_ivpos(d) == 0 ? 1 : 0;
+
+	printk("IVSHMEM: %02x:%02x.%x sending IRQ to peer %d\n",
+	       d->bdf >> 8, (d->bdf >> 3) & 0x1f, d->bdf & 0x3, peer);
+	mmio_write32(d->registers + 3, peer << 16);
 }
 
 static void irq_handler(void)
@@ -120,6 +123,7 @@ void inmate_main(void)
 	printk_uart_base = UART_BASE;
 
 	int_init();
+	pci_init();
 
 again:
 	bdf = pci_find_device(VENDORID, DEVICEID, bdf);
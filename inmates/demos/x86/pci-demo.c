@@ -50,6 +50,7 @@ void inmate_main(void)
 	int_init();
 	int_set_handler(IRQ_VECTOR, irq_handler);
 
+	pci_init();
 	bdf = pci_find_device(PCI_ID_ANY, PCI_ID_ANY, 0);
 	if (bdf < 0) {
 		printk("No device found!\n");
@@ -60,10 +61,8 @@ void inmate_main(void)
 	       pci_read_config(bdf, PCI_CFG_DEVICE_ID, 2),
 	       bdf >> 8, (bdf >> 3) & 0x1f, bdf & 0x3);
 
-	bar = pci_read_config(bdf, PCI_CFG_BAR, 4);
-	if ((bar & 0x6) == 0x4)
-		bar |= (u64)pci_read_config(bdf, PCI_CFG_BAR + 4, 4) << 32;
-	hdbar = (void *)(bar & ~0xfUL);
+	bar = pci_read_bar(bdf, 0);
+	hdbar = (void *)bar;
 	map_range(hdbar, PAGE_SIZE, MAP_UNCACHED);
 	printk("HDBAR at %p\n", hdbar);
 
@@ -13,6 +13,11 @@
 #include <mach/gic_v2.h>
 #include <gic.h>
 
+#define GICD_ITARGETSR		0x0800
+#define GICD_SGIR		0x0f00
+
+#define GICD_SGIR_TARGET_SHIFT	16
+
 #define GICC_CTLR		0x0000
 #define GICC_PMR		0x0004
 #define GICC_IAR		0x000c
@@ -22,6 +27,9 @@
 
 #define GICC_PMR_DEFAULT	0xf0
 
+/* GIC CPU interface of each CPU, learned when it calls gic_init */
+static u8 gic_cpu_map[SMP_MAX_CPUS];
+
 void gic_enable(unsigned int irqn)
 {
 	mmio_write32(GICD_BASE + GICD_ISENABLER, 1 << irqn);
@@ -29,6 +37,9 @@ void gic_enable(unsigned int irqn)
 
 int gic_init(void)
 {
+	/* the banked target of SGI 0 is the interface of the reading CPU */
+	gic_cpu_map[cpu_id()] = mmio_read32(GICD_BASE + GICD_ITARGETSR) & 0xff;
+
 	mmio_write32(GICC_BASE + GICC_CTLR, GICC_CTLR_GRPEN1);
 	mmio_write32(GICC_BASE + GICC_PMR, GICC_PMR_DEFAULT);
 
@@ -44,3 +55,11 @@ u32 gic_read_ack(void)
 {
 	return mmio_read32(GICC_BASE + GICC_IAR);
 }
+
+void gic_send_sgi(unsigned int cpu_id, unsigned int sgi)
+{
+	memory_store_barrier();
+	mmio_write32(GICD_BASE + GICD_SGIR,
+		     gic_cpu_map[cpu_id] << GICD_SGIR_TARGET_SHIFT |
+		     (sgi & SGI_MAX));
+}
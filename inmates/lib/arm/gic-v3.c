@@ -22,9 +22,12 @@
 #define ICC_PMR_EL1		SYSREG_32(0, c4, c6, 0)
 #define ICC_CTLR_EL1		SYSREG_32(0, c12, c12, 4)
 #define ICC_IGRPEN1_EL1		SYSREG_32(0, c12, c12, 7)
+#define ICC_SGI1R_EL1		SYSREG_64(0, c12)
 
 #define ICC_IGRPEN1_EN		0x1
 
+#define ICC_SGIR_IRQN_SHIFT	24
+
 void gic_enable(unsigned int irqn)
 {
 	if (is_spi(irqn))
@@ -55,3 +58,13 @@ u32 gic_read_ack(void)
 	arm_read_sysreg(ICC_IAR1_EL1, val);
 	return val;
 }
+
+void gic_send_sgi(unsigned int cpu_id, unsigned int sgi)
+{
+	/* targets in affinity 0 only, cells use virtual CPU IDs from 0 on */
+	u64 val = (u64)(sgi & SGI_MAX) << ICC_SGIR_IRQN_SHIFT | 1 << cpu_id;
+
+	asm volatile("dsb ishst" : : : "memory");
+	arm_write_sysreg(ICC_SGI1R_EL1, val);
+	asm volatile("isb");
+}
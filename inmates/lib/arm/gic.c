@@ -14,7 +14,6 @@
 #include <gic.h>
 
 static irq_handler_t irq_handler = (irq_handler_t)NULL;
-static __attribute__((aligned(0x1000))) u32 irq_stack[1024];
 
 /* Replaces the weak reference in header.S */
 void vector_irq(void)
@@ -37,8 +36,7 @@ void gic_setup(irq_handler_t handler)
 	gic_init();
 	irq_handler = handler;
 
-	asm volatile (".arch_extension virt\n");
-	asm volatile ("msr	SP_irq, %0\n" : : "r" (irq_stack));
+	/* The IRQ stack of this CPU was set up by header.S */
 	asm volatile ("cpsie	i\n");
 }
 
@@ -46,3 +44,8 @@ void gic_enable_irq(unsigned int irq)
 {
 	gic_enable(irq);
 }
+
+void gic_send_ipi(unsigned int cpu_id, unsigned int sgi)
+{
+	gic_send_sgi(cpu_id, sgi);
+}
@@ -16,6 +16,8 @@
 
 #define GICD_ISENABLER			0x0100
 
+#define SGI_MAX				15
+
 #define is_spi(irqn)			((irqn) > 31 && (irqn) < 1020)
 
 #ifndef __ASSEMBLY__
@@ -24,6 +26,7 @@ int gic_init(void);
 void gic_enable(unsigned int irqn);
 void gic_write_eoi(u32 irqn);
 u32 gic_read_ack(void);
+void gic_send_sgi(unsigned int cpu_id, unsigned int sgi);
 
 #endif /* !__ASSEMBLY__ */
 #endif
@@ -13,6 +13,9 @@
 #ifndef _JAILHOUSE_INMATE_H
 #define _JAILHOUSE_INMATE_H
 
+/* GICv3 SGIs reach affinity 0 targets only */
+#define SMP_MAX_CPUS		16
+
 #ifndef __ASSEMBLY__
 typedef signed char s8;
 typedef unsigned char u8;
@@ -26,6 +29,34 @@ typedef unsigned int u32;
 typedef signed long long s64;
 typedef unsigned long long u64;
 
+static inline void cpu_relax(void)
+{
+	asm volatile("yield" : : : "memory");
+}
+
+static inline unsigned int cpu_id(void)
+{
+	u32 mpidr;
+
+	asm volatile("mrc p15, 0, %0, c0, c0, 5" : "=r" (mpidr));
+	return mpidr & 0xff;
+}
+
+static inline void memory_barrier(void)
+{
+	asm volatile("dmb ish" : : : "memory");
+}
+
+static inline void memory_load_barrier(void)
+{
+	asm volatile("dmb ish" : : : "memory");
+}
+
+static inline void memory_store_barrier(void)
+{
+	asm volatile("dmb ishst" : : : "memory");
+}
+
 static inline u32 mmio_read32(void *address)
 {
 	return *(volatile u32 *)address;
@@ -41,12 +72,17 @@ void __attribute__((interrupt("IRQ"))) __attribute__((used)) vector_irq(void);
 typedef void (*irq_handler_t)(unsigned int);
 void gic_setup(irq_handler_t handler);
 void gic_enable_irq(unsigned int irq);
+void gic_send_ipi(unsigned int cpu_id, unsigned int sgi);
 
 unsigned long timer_get_frequency(void);
 u64 timer_get_ticks(void);
 u64 timer_ticks_to_ns(u64 ticks);
 void timer_start(u64 timeout);
 
+extern volatile u32 smp_num_cpus;
+extern u8 smp_cpu_ids[SMP_MAX_CPUS];
+int smp_start_cpu(unsigned int cpu_id, void (*entry)(void));
+
 #endif /* !__ASSEMBLY__ */
 
 #include "../inmate_common.h"
@@ -0,0 +1,22 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+
+extern char heap_start[];
+
+static unsigned long heap_pos = (unsigned long)heap_start;
+
+void *alloc(unsigned long size, unsigned long align)
+{
+	unsigned long base = (heap_pos + align - 1) & ~(align - 1);
+
+	heap_pos = base + size;
+	return (void *)base;
+}
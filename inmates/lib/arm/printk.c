@@ -16,7 +16,7 @@
 
 static struct uart_chip chip;
 
-static void console_write(const char *msg)
+static void uart_write(const char *msg)
 {
 	char c = 0;
 
@@ -34,6 +34,14 @@ static void console_write(const char *msg)
 	}
 }
 
+static void console_write(const char *msg)
+{
+	if (printk_ring)
+		printk_ring_write(msg);
+	else
+		uart_write(msg);
+}
+
 #include "../../../hypervisor/printk-core.c"
 
 void printk(const char *fmt, ...)
@@ -42,7 +50,8 @@ void printk(const char *fmt, ...)
 	va_list ap;
 
 	if (!inited) {
-		uart_chip_init(&chip);
+		if (!printk_ring_init())
+			uart_chip_init(&chip);
 		inited = true;
 	}
 
@@ -0,0 +1,101 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+
+#define PSCI_CPU_ON_32		0x84000003
+
+#define AP_STACK_SIZE		(16 * 1024)
+#define AP_IRQ_STACK_SIZE	(4 * 1024)
+
+void ap_start(void);
+
+void (* volatile ap_entry)(void);
+void *ap_stack, *ap_irq_stack;
+
+volatile u32 smp_num_cpus = 1;
+u8 smp_cpu_ids[SMP_MAX_CPUS];
+
+static int psci_cpu_on(unsigned int cpu_id, void (*entry)(void))
+{
+	register unsigned long r0 asm("r0") = PSCI_CPU_ON_32;
+	register unsigned long r1 asm("r1") = cpu_id;
+	register unsigned long r2 asm("r2") = (unsigned long)entry;
+	register unsigned long r3 asm("r3") = 0;
+
+	asm volatile(".arch_extension virt\n"
+		     "hvc	#0\n"
+		     : "+r" (r0) : "r" (r1), "r" (r2), "r" (r3) : "memory");
+	return r0;
+}
+
+/* jumped to by ap_start on the stacks provided by smp_start_cpu */
+void __attribute__((noreturn)) ap_main(void)
+{
+	void (*entry)(void) = ap_entry;
+
+	/* serialized by smp_start_cpu, no atomics required */
+	if (smp_num_cpus < SMP_MAX_CPUS)
+		smp_cpu_ids[smp_num_cpus] = cpu_id();
+	memory_store_barrier();
+	smp_num_cpus++;
+
+	memory_barrier();
+	ap_entry = NULL;
+
+	entry();
+
+	asm volatile("cpsid	if" : : : "memory");
+	while (1)
+		asm volatile("wfi");
+}
+
+/*
+ * Starts the CPU with the given (virtual) ID on the given function. Returns
+ * once the CPU runs, or the negative PSCI error code if the CPU does not
+ * belong to the cell or is already running. Must not be called concurrently.
+ */
+int smp_start_cpu(unsigned int cpu_id, void (*entry)(void))
+{
+	char *stacks = alloc(AP_IRQ_STACK_SIZE + AP_STACK_SIZE, 4096);
+	int err;
+
+	/* CPUs started earlier may still run, so each gets its own stacks */
+	ap_irq_stack = stacks + AP_IRQ_STACK_SIZE;
+	ap_stack = stacks + AP_IRQ_STACK_SIZE + AP_STACK_SIZE;
+	ap_entry = entry;
+	memory_barrier();
+
+	err = psci_cpu_on(cpu_id, ap_start);
+	if (err) {
+		ap_entry = NULL;
+		return err;
+	}
+
+	while (ap_entry != NULL)
+		cpu_relax();
+
+	return 0;
+}
+
+/* events instead of interrupts, so that the GIC setup is left untouched */
+void wakeup_init_cpu(void)
+{
+}
+
+void wakeup_cpu(unsigned int cpu_id)
+{
+	asm volatile("dsb ish; sev" : : : "memory");
+}
+
+void wakeup_wait(volatile unsigned int *flag)
+{
+	while (!*flag)
+		asm volatile("wfe" : : : "memory");
+}
@@ -31,19 +31,37 @@ u64 timer_get_ticks(void)
 	return pct64;
 }
 
+/* shift-and-subtract, the runtime is independent of the quotient */
 static unsigned long emul_division(u64 val, u64 div)
 {
 	unsigned long cnt = 0;
+	unsigned int shift = 0;
 
-	while (val > div) {
-		val -= div;
-		cnt++;
+	while (div <= (val >> 1) && !(div & (1ULL << 63))) {
+		div <<= 1;
+		shift++;
+	}
+	while (1) {
+		cnt <<= 1;
+		if (val >= div) {
+			val -= div;
+			cnt |= 1;
+		}
+		if (shift-- == 0)
+			break;
+		div >>= 1;
 	}
 	return cnt;
 }
 
 u64 timer_ticks_to_ns(u64 ticks)
 {
+	struct jailhouse_clock clock = comm_ext->clock;
+
+	if (clock.frequency_khz != 0) {
+		clock.epoch = 0;
+		return jailhouse_clock_ns(&clock, ticks);
+	}
 	return emul_division(ticks * 1000,
 			     timer_get_frequency() / 1000 / 1000);
 }
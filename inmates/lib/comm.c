@@ -0,0 +1,98 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Access to the extension area of the communication region: a heartbeat
+ * counter and application-defined mailboxes that the root cell can read and
+ * write without issuing hypercalls.
+ */
+
+#include <inmate.h>
+
+/**
+ * Signal that the cell is alive. Supervisors in the root cell consider the
+ * cell stalled if the counter stops moving.
+ */
+void comm_heartbeat(void)
+{
+	comm_ext->heartbeat++;
+}
+
+/**
+ * Arm the hypervisor watchdog of the cell. Once armed, the cell is set to
+ * failed state if comm_heartbeat() is not called for longer than the
+ * timeout. The watchdog stays armed until the cell is restarted.
+ * @param timeout_ms	Timeout in milliseconds.
+ */
+void comm_watchdog_arm(unsigned int timeout_ms)
+{
+	comm_heartbeat();
+	/* the heartbeat has to be visible before the timeout starts */
+	memory_store_barrier();
+	comm_ext->watchdog_timeout_ms = timeout_ms;
+}
+
+/**
+ * Publish data in one of the mailboxes written by the cell.
+ * @param index		Mailbox index, below JAILHOUSE_COMM_MAILBOXES.
+ * @param data		Data to be published.
+ * @param len		Length of the data, at most
+ * 			JAILHOUSE_COMM_MAILBOX_SIZE bytes.
+ *
+ * @return true on success, false on invalid arguments.
+ */
+bool comm_mailbox_write(unsigned int index, const void *data,
+			unsigned int len)
+{
+	struct jailhouse_comm_mailbox *mbox;
+
+	if (index >= JAILHOUSE_COMM_MAILBOXES ||
+	    len > JAILHOUSE_COMM_MAILBOX_SIZE)
+		return false;
+	mbox = &comm_ext->from_cell[index];
+
+	mbox->seqcount++;
+	memory_store_barrier();
+	memcpy((void *)mbox->data, data, len);
+	mbox->len = len;
+	memory_store_barrier();
+	mbox->seqcount++;
+
+	return true;
+}
+
+/**
+ * Read one of the mailboxes written by the root cell.
+ * @param index		Mailbox index, below JAILHOUSE_COMM_MAILBOXES.
+ * @param buf		Buffer receiving the data.
+ * @param size		Size of the buffer.
+ *
+ * @return Length of the data, -1 on invalid arguments or if the buffer is too
+ * small.
+ */
+int comm_mailbox_read(unsigned int index, void *buf, unsigned int size)
+{
+	struct jailhouse_comm_mailbox *mbox;
+	u32 seq, len;
+
+	if (index >= JAILHOUSE_COMM_MAILBOXES)
+		return -1;
+	mbox = &comm_ext->to_cell[index];
+
+	do {
+		while ((seq = mbox->seqcount) & 1)
+			cpu_relax();
+		memory_load_barrier();
+		len = mbox->len;
+		if (len > JAILHOUSE_COMM_MAILBOX_SIZE || len > size)
+			return -1;
+		memcpy(buf, (void *)mbox->data, len);
+		memory_load_barrier();
+	} while (mbox->seqcount != seq);
+
+	return len;
+}
@@ -0,0 +1,51 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Buffered console: printk output goes into a ring in shared memory that the
+ * root cell drains, instead of waiting for the UART on each character. The
+ * ring has the layout of the hypervisor console (struct jailhouse_console)
+ * and is located via the "console_ring" command line parameter, typically
+ * pointing to a memory region flagged JAILHOUSE_MEM_CONSOLE or to the shared
+ * memory of an ivshmem device.
+ */
+
+#include <inmate.h>
+#include <jailhouse/header.h>
+
+struct jailhouse_console *printk_ring;
+
+/**
+ * Look up the console ring on the command line, unless the inmate already
+ * set printk_ring.
+ *
+ * @return true if printk output goes to the ring.
+ */
+bool printk_ring_init(void)
+{
+	if (!printk_ring)
+		printk_ring = (struct jailhouse_console *)(unsigned long)
+			cmdline_parse_int("console_ring", 0);
+	return printk_ring != NULL;
+}
+
+/*
+ * Never waits for the reader. If the ring is full, the oldest characters are
+ * overwritten, and the reader detects that from the tail.
+ */
+void printk_ring_write(const char *msg)
+{
+	unsigned int tail = printk_ring->tail;
+
+	while (*msg)
+		printk_ring->content[tail++ % sizeof(printk_ring->content)] =
+			*msg++;
+
+	/* publish the content before the new tail */
+	memory_store_barrier();
+	printk_ring->tail = tail;
+}
@@ -0,0 +1,230 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Heap allocator on top of the page-granular alloc() of the architecture.
+ *
+ * Requests of up to HEAP_MAX_SLAB_SIZE are served from power-of-two size
+ * classes, each page of a class (slab) carrying a header in its first cache
+ * line. Larger requests get page runs with the same header, which are reused
+ * first-fit after being freed. All blocks are cache-line aligned, and free
+ * blocks are chained through their first word. malloc and free are
+ * serialized by a spinlock. Memory is never given back to alloc().
+ *
+ * Fixed-size object pools are not locked at all: each pool must only be used
+ * by a single CPU, e.g. by keeping one pool per CPU.
+ *
+ * Only shifts are used for size calculations, so this works on targets
+ * without hardware division as well.
+ */
+
+#include <inmate.h>
+
+#define HEAP_PAGE_SHIFT		12
+#define HEAP_PAGE_SIZE		(1UL << HEAP_PAGE_SHIFT)
+#define HEAP_PAGE_MASK		(~(HEAP_PAGE_SIZE - 1))
+
+#define HEAP_SLAB_CLASSES	6
+#define HEAP_MAX_SLAB_SIZE	(CACHE_LINE_SIZE << (HEAP_SLAB_CLASSES - 1))
+
+#define HEAP_MAGIC_SLAB		0x51ab51abUL
+#define HEAP_MAGIC_RUN		0x5e5e5e5eUL
+
+/* occupies the first cache line of each slab page and page run */
+struct heap_block {
+	unsigned long magic;
+	/* size class of a slab, number of pages of a run */
+	unsigned long size;
+	/* next free run */
+	struct heap_block *next;
+};
+
+struct heap_object {
+	struct heap_object *next;
+};
+
+static struct heap_object *slab_free[HEAP_SLAB_CLASSES];
+static struct heap_block *run_free;
+static struct spinlock heap_lock;
+
+static unsigned int size_class(unsigned long size)
+{
+	unsigned int class = 0;
+
+	while ((CACHE_LINE_SIZE << class) < size)
+		class++;
+	return class;
+}
+
+static bool slab_refill(unsigned int class)
+{
+	unsigned long obj_size = CACHE_LINE_SIZE << class;
+	struct heap_block *slab = alloc(HEAP_PAGE_SIZE, HEAP_PAGE_SIZE);
+	struct heap_object *obj;
+	unsigned long pos;
+
+	if (!slab)
+		return false;
+
+	slab->magic = HEAP_MAGIC_SLAB;
+	slab->size = class;
+
+	for (pos = CACHE_LINE_SIZE; pos + obj_size <= HEAP_PAGE_SIZE;
+	     pos += obj_size) {
+		obj = (struct heap_object *)((unsigned long)slab + pos);
+		obj->next = slab_free[class];
+		slab_free[class] = obj;
+	}
+	return true;
+}
+
+static struct heap_block *run_get(unsigned long pages)
+{
+	struct heap_block **prev, *run, *rest;
+
+	for (prev = &run_free; *prev; prev = &(*prev)->next) {
+		run = *prev;
+		if (run->size < pages)
+			continue;
+
+		if (run->size > pages) {
+			rest = (struct heap_block *)((unsigned long)run +
+				(pages << HEAP_PAGE_SHIFT));
+			rest->magic = HEAP_MAGIC_RUN;
+			rest->size = run->size - pages;
+			rest->next = run->next;
+			*prev = rest;
+		} else {
+			*prev = run->next;
+		}
+		run->size = pages;
+		return run;
+	}
+
+	run = alloc(pages << HEAP_PAGE_SHIFT, HEAP_PAGE_SIZE);
+	if (run) {
+		run->magic = HEAP_MAGIC_RUN;
+		run->size = pages;
+	}
+	return run;
+}
+
+/**
+ * Allocate a cache-line aligned block of at least size bytes.
+ *
+ * @return pointer to the block, NULL if size is 0 or no memory is left.
+ */
+void *malloc(unsigned long size)
+{
+	struct heap_object *obj = NULL;
+	struct heap_block *run;
+	unsigned int class;
+
+	if (size == 0)
+		return NULL;
+
+	spin_lock(&heap_lock);
+	if (size <= HEAP_MAX_SLAB_SIZE) {
+		class = size_class(size);
+		if (slab_free[class] || slab_refill(class)) {
+			obj = slab_free[class];
+			slab_free[class] = obj->next;
+		}
+	} else {
+		run = run_get((size + CACHE_LINE_SIZE + HEAP_PAGE_SIZE - 1) >>
+			      HEAP_PAGE_SHIFT);
+		if (run)
+			obj = (struct heap_object *)((unsigned long)run +
+						     CACHE_LINE_SIZE);
+	}
+	spin_unlock(&heap_lock);
+
+	return obj;
+}
+
+/**
+ * Return a block obtained from malloc. NULL pointers are ignored.
+ */
+void free(void *ptr)
+{
+	struct heap_block *block =
+		(struct heap_block *)((unsigned long)ptr & HEAP_PAGE_MASK);
+	struct heap_object *obj = ptr;
+
+	if (!ptr)
+		return;
+
+	spin_lock(&heap_lock);
+	if (block->magic == HEAP_MAGIC_SLAB) {
+		obj->next = slab_free[block->size];
+		slab_free[block->size] = obj;
+	} else if (block->magic == HEAP_MAGIC_RUN) {
+		block->next = run_free;
+		run_free = block;
+	} else {
+		printk("free: invalid pointer %p\n", ptr);
+	}
+	spin_unlock(&heap_lock);
+}
+
+/**
+ * Prepare an empty pool for objects of obj_size bytes, rounded up to full
+ * cache lines. Memory is allocated on demand, page by page, or in page runs
+ * for objects larger than a page.
+ */
+void mem_pool_init(struct mem_pool *pool, unsigned long obj_size)
+{
+	pool->obj_size = (obj_size + CACHE_LINE_SIZE - 1) &
+		~(CACHE_LINE_SIZE - 1);
+	if (pool->obj_size == 0)
+		pool->obj_size = CACHE_LINE_SIZE;
+	pool->free_list = NULL;
+}
+
+/**
+ * Take an object from the pool, growing it if it is empty.
+ *
+ * @return pointer to the cache-line aligned object, NULL if no memory is
+ * left.
+ */
+void *mem_pool_alloc(struct mem_pool *pool)
+{
+	unsigned long chunk_size, pos;
+	struct heap_object *obj;
+	char *chunk;
+
+	if (!pool->free_list) {
+		chunk_size = (pool->obj_size + HEAP_PAGE_SIZE - 1) &
+			HEAP_PAGE_MASK;
+
+		/* alloc() is shared, so serialize against malloc */
+		spin_lock(&heap_lock);
+		chunk = alloc(chunk_size, HEAP_PAGE_SIZE);
+		spin_unlock(&heap_lock);
+		if (!chunk)
+			return NULL;
+
+		for (pos = 0; pos + pool->obj_size <= chunk_size;
+		     pos += pool->obj_size)
+			mem_pool_free(pool, chunk + pos);
+	}
+
+	obj = pool->free_list;
+	pool->free_list = obj->next;
+	return obj;
+}
+
+/**
+ * Return an object to the pool it was taken from.
+ */
+void mem_pool_free(struct mem_pool *pool, void *obj)
+{
+	struct heap_object *object = obj;
+
+	object->next = pool->free_list;
+	pool->free_list = object;
+}
@@ -0,0 +1,141 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Log-linear latency histogram: each power of two is split into
+ * HIST_SUB_BUCKETS linear buckets, giving a relative resolution of about 3%
+ * over the full range of unsigned long. Recording only shifts and counts, so
+ * it can be done from interrupt handlers, also on targets without hardware
+ * division.
+ */
+
+#include <inmate.h>
+
+#define BITS_PER_ULONG		(sizeof(unsigned long) * 8)
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+
+static unsigned int hist_index(unsigned long value)
+{
+	unsigned int msb, shift;
+
+	if (value < HIST_SUB_BUCKETS)
+		return value;
+
+	msb = BITS_PER_ULONG - 1 - __builtin_clzl(value);
+	shift = msb - HIST_SUB_BITS;
+	return ((shift + 1) << HIST_SUB_BITS) +
+		((value >> shift) & (HIST_SUB_BUCKETS - 1));
+}
+
+/* largest value that falls into the bucket */
+static unsigned long hist_bucket_max(unsigned int index)
+{
+	unsigned int shift;
+
+	if (index < HIST_SUB_BUCKETS)
+		return index;
+
+	shift = (index >> HIST_SUB_BITS) - 1;
+	return ((unsigned long)(HIST_SUB_BUCKETS +
+				(index & (HIST_SUB_BUCKETS - 1))) << shift) +
+		(1UL << shift) - 1;
+}
+
+void hist_reset(struct histogram *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+	hist->min = ~0UL;
+}
+
+void hist_add(struct histogram *hist, unsigned long value)
+{
+	hist->buckets[hist_index(value)]++;
+	hist->samples++;
+	if (value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+/**
+ * Determine the value that all but 1/fraction of the samples do not exceed,
+ * e.g. the 99.9th percentile for a fraction of 1000.
+ *
+ * The result is the upper bound of the bucket containing the percentile,
+ * limited to the largest sample.
+ *
+ * @return percentile value, 0 if the histogram is empty.
+ */
+unsigned long hist_percentile(const struct histogram *hist,
+			      unsigned long fraction)
+{
+	unsigned long long above = 0;
+	unsigned int n;
+
+	for (n = HIST_BUCKETS; n > 0; n--) {
+		above += hist->buckets[n - 1];
+		if (above * fraction > hist->samples)
+			break;
+	}
+	if (n == 0)
+		return 0;
+
+	return hist_bucket_max(n - 1) < hist->max ?
+		hist_bucket_max(n - 1) : hist->max;
+}
+
+/**
+ * Print the sample count, minimum, maximum and percentiles from the median
+ * up to p99.999 in a single line.
+ *
+ * The histogram may be updated concurrently, e.g. from an interrupt handler,
+ * at the price of a slightly inconsistent summary. Values are converted to
+ * nanoseconds via to_ns unless it is NULL.
+ */
+void hist_print_summary(const struct histogram *hist, const char *name,
+			unsigned long (*to_ns)(unsigned long))
+{
+	static const unsigned long fractions[] = {
+		2, 100, 1000, 10000, 100000
+	};
+	unsigned long values[ARRAY_SIZE(fractions) + 2];
+	unsigned int n;
+
+	values[0] = hist->samples ? hist->min : 0;
+	for (n = 0; n < ARRAY_SIZE(fractions); n++)
+		values[n + 1] = hist_percentile(hist, fractions[n]);
+	values[n + 1] = hist->max;
+
+	if (to_ns)
+		for (n = 0; n < ARRAY_SIZE(values); n++)
+			values[n] = to_ns(values[n]);
+
+	printk("%s: samples %lu, min %lu, p50 %lu, p99 %lu, p99.9 %lu, "
+	       "p99.99 %lu, p99.999 %lu, max %lu ns\n", name, hist->samples,
+	       values[0], values[1], values[2], values[3], values[4],
+	       values[5], values[6]);
+}
+
+/**
+ * Print each non-empty bucket as a line "<name>,<upper bound>,<count>",
+ * converted to nanoseconds via to_ns unless it is NULL.
+ */
+void hist_print_buckets(const struct histogram *hist, const char *name,
+			unsigned long (*to_ns)(unsigned long))
+{
+	unsigned long bound;
+	unsigned int n;
+
+	for (n = 0; n < HIST_BUCKETS; n++) {
+		if (hist->buckets[n] == 0)
+			continue;
+		bound = hist_bucket_max(n);
+		printk("%s,%lu,%lu\n", name, to_ns ? to_ns(bound) : bound,
+		       hist->buckets[n]);
+	}
+}
@@ -34,14 +34,47 @@ typedef enum { true = 1, false = 0 } bool;
 #include <jailhouse/hypercall.h>
 
 #define comm_region	((struct jailhouse_comm_region *)COMM_REGION_BASE)
+#define comm_ext	((struct jailhouse_comm_ext *)(COMM_REGION_BASE + \
+					JAILHOUSE_COMM_EXT_OFFSET))
+
+void comm_heartbeat(void);
+void comm_watchdog_arm(unsigned int timeout_ms);
+bool comm_mailbox_write(unsigned int index, const void *data,
+			unsigned int len);
+int comm_mailbox_read(unsigned int index, void *buf, unsigned int size);
 
 extern unsigned int printk_uart_base;
 void printk(const char *fmt, ...);
 
+struct jailhouse_console;
+
+extern struct jailhouse_console *printk_ring;
+bool printk_ring_init(void);
+void printk_ring_write(const char *msg);
+
+/* console on an ivshmem link, only available to 64-bit x86 inmates */
+#ifdef __x86_64__
+extern bool printk_ivshmem;
+bool printk_ivshmem_init(void);
+void printk_ivshmem_write(const char *msg);
+#else
+#define printk_ivshmem		false
+static inline bool printk_ivshmem_init(void)
+{
+	return false;
+}
+
+static inline void printk_ivshmem_write(const char *msg)
+{
+}
+#endif
+
 void *memset(void *s, int c, unsigned long n);
 void *memcpy(void *d, const void *s, unsigned long n);
+void *memcpy_nt(void *d, const void *s, unsigned long n);
 unsigned long strlen(const char *s);
 int strncmp(const char *s1, const char *s2, unsigned long n);
+int strcmp(const char *s1, const char *s2);
 
 const char *cmdline_parse_str(const char *param, char *value_buffer,
 			      unsigned long buffer_size,
@@ -49,9 +82,132 @@ const char *cmdline_parse_str(const char *param, char *value_buffer,
 long long cmdline_parse_int(const char *param, long long default_value);
 bool cmdline_parse_bool(const char *param);
 
+#define CACHE_LINE_SIZE		64
+#define __cacheline_aligned	__attribute__((aligned(CACHE_LINE_SIZE)))
+
+static inline unsigned long atomic_fetch_add(volatile unsigned long *v,
+					     unsigned long n)
+{
+	return __atomic_fetch_add(v, n, __ATOMIC_SEQ_CST);
+}
+
+static inline bool atomic_cmpxchg(volatile unsigned long *v,
+				  unsigned long old, unsigned long new)
+{
+	return __atomic_compare_exchange_n(v, &old, new, 0, __ATOMIC_SEQ_CST,
+					   __ATOMIC_SEQ_CST);
+}
+
+static inline unsigned long atomic_load_acquire(const volatile unsigned long *v)
+{
+	return __atomic_load_n(v, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store_release(volatile unsigned long *v,
+					unsigned long value)
+{
+	__atomic_store_n(v, value, __ATOMIC_RELEASE);
+}
+
+/* ticket lock, zero-initialized */
+struct spinlock {
+	volatile unsigned long next;
+	volatile unsigned long owner;
+};
+
+static inline void spin_lock(struct spinlock *lock)
+{
+	unsigned long ticket = atomic_fetch_add(&lock->next, 1);
+
+	while (atomic_load_acquire(&lock->owner) != ticket)
+		cpu_relax();
+}
+
+static inline void spin_unlock(struct spinlock *lock)
+{
+	atomic_store_release(&lock->owner, lock->owner + 1);
+}
+
+struct smp_barrier {
+	volatile unsigned long arrived;
+	volatile unsigned long generation;
+	unsigned long num_cpus;
+} __cacheline_aligned;
+
+void smp_barrier_init(struct smp_barrier *barrier, unsigned int num_cpus);
+void smp_barrier_wait(struct smp_barrier *barrier);
+
+void wakeup_init_cpu(void);
+void wakeup_cpu(unsigned int cpu_id);
+void wakeup_wait(volatile unsigned int *flag);
+
+typedef void (*work_func_t)(void *arg);
+
+void work_init(void);
+void work_worker(void);
+void work_submit(work_func_t func, void *arg);
+void work_wait_all(void);
+
+void *alloc(unsigned long size, unsigned long align);
+
+struct mem_pool {
+	unsigned long obj_size;
+	void *free_list;
+};
+
+void *malloc(unsigned long size);
+void free(void *ptr);
+
+void mem_pool_init(struct mem_pool *pool, unsigned long obj_size);
+void *mem_pool_alloc(struct mem_pool *pool);
+void mem_pool_free(struct mem_pool *pool, void *obj);
+
 #define CMDLINE_BUFFER(size) \
 	const char cmdline[size] __attribute__((section(".cmdline")));
 
+struct jailhouse_queue;
+
+struct shmem_queue {
+	struct jailhouse_queue *queue;
+	bool producer;
+	u32 num_slots;
+	u32 slot_size;
+	/* local copy of head (producer) or tail (consumer) */
+	u32 idx;
+	/* value of idx when the peer was last checked for notification */
+	u32 notified_idx;
+};
+
+int shmem_queue_init_producer(struct shmem_queue *sq, void *mem,
+			      unsigned long size, unsigned int slot_size);
+int shmem_queue_init_consumer(struct shmem_queue *sq, void *mem,
+			      unsigned long size);
+bool shmem_queue_push(struct shmem_queue *sq, const void *data,
+		      unsigned int len);
+int shmem_queue_pop(struct shmem_queue *sq, void *buf, unsigned int size);
+bool shmem_queue_prepare_wait(struct shmem_queue *sq);
+bool shmem_queue_kick_needed(struct shmem_queue *sq);
+
+#define HIST_SUB_BITS		5
+#define HIST_SUB_BUCKETS	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS		((sizeof(unsigned long) * 8 - HIST_SUB_BITS + 1) \
+				 * HIST_SUB_BUCKETS)
+
+struct histogram {
+	unsigned long buckets[HIST_BUCKETS];
+	unsigned long samples;
+	unsigned long min, max;
+};
+
+void hist_reset(struct histogram *hist);
+void hist_add(struct histogram *hist, unsigned long value);
+unsigned long hist_percentile(const struct histogram *hist,
+			      unsigned long fraction);
+void hist_print_summary(const struct histogram *hist, const char *name,
+			unsigned long (*to_ns)(unsigned long));
+void hist_print_buckets(const struct histogram *hist, const char *name,
+			unsigned long (*to_ns)(unsigned long));
+
 void inmate_main(void);
 
 #endif /* !__ASSEMBLY__ */
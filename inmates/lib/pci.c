@@ -12,11 +12,189 @@
 
 #include <inmate.h>
 
+#define PCI_CFG_HEADER_TYPE	0x00e
+# define PCI_HDR_MULTIFUNC	0x80
+
+#define PCI_CACHE_DEVICES	32
+#define PCI_CACHE_CAPS		8
+#define PCI_NUM_BARS		6
+
+/* devices as found by pci_scan, ordered by BDF */
+struct pci_cache_entry {
+	u16 bdf;
+	u16 vendor_id;
+	u16 device_id;
+	/* more than PCI_CACHE_CAPS capabilities are looked up directly */
+	u8 num_caps;
+	u8 cap_id[PCI_CACHE_CAPS];
+	u8 cap_pos[PCI_CACHE_CAPS];
+	u32 bar[PCI_NUM_BARS];
+};
+
+static struct pci_cache_entry pci_cache[PCI_CACHE_DEVICES];
+static unsigned int pci_cache_entries;
+static bool pci_cache_valid;
+
+static struct pci_cache_entry *pci_cache_lookup(u16 bdf)
+{
+	unsigned int n;
+
+	if (!pci_cache_valid)
+		return NULL;
+	for (n = 0; n < pci_cache_entries; n++)
+		if (pci_cache[n].bdf == bdf)
+			return &pci_cache[n];
+	return NULL;
+}
+
+static int pci_walk_caps(u16 bdf, u16 cap)
+{
+	u8 pos = PCI_CFG_CAP_PTR - 1;
+
+	if (!(pci_read_config(bdf, PCI_CFG_STATUS, 2) & PCI_STS_CAPS))
+		return -1;
+
+	while (1) {
+		pos = pci_read_config(bdf, pos + 1, 1);
+		if (pos == 0)
+			return -1;
+		if (pci_read_config(bdf, pos, 1) == cap)
+			return pos;
+	}
+}
+
+static void pci_cache_add(u16 bdf, u32 id)
+{
+	struct pci_cache_entry *entry = &pci_cache[pci_cache_entries++];
+	u8 pos = PCI_CFG_CAP_PTR - 1;
+	unsigned int n;
+
+	entry->bdf = bdf;
+	entry->vendor_id = id & 0xffff;
+	entry->device_id = id >> 16;
+
+	for (n = 0; n < PCI_NUM_BARS; n++)
+		entry->bar[n] = pci_read_config(bdf, PCI_CFG_BAR + n * 4, 4);
+
+	entry->num_caps = 0;
+	if (!(pci_read_config(bdf, PCI_CFG_STATUS, 2) & PCI_STS_CAPS))
+		return;
+	while (entry->num_caps <= PCI_CACHE_CAPS) {
+		pos = pci_read_config(bdf, pos + 1, 1);
+		if (pos == 0)
+			break;
+		if (entry->num_caps < PCI_CACHE_CAPS) {
+			entry->cap_pos[entry->num_caps] = pos;
+			entry->cap_id[entry->num_caps] =
+				pci_read_config(bdf, pos, 1);
+		}
+		entry->num_caps++;
+	}
+}
+
+/**
+ * Enumerate the buses up to end_bus and cache the IDs, BARs and capability
+ * offsets of up to PCI_CACHE_DEVICES devices. Afterwards, pci_find_device,
+ * pci_find_cap and pci_read_bar no longer access the config space. Only
+ * function 0 of single-function devices is probed.
+ *
+ * @return number of devices cached.
+ */
+int pci_scan(unsigned int end_bus)
+{
+	unsigned int bus, dev, fn, max_fn;
+	u16 bdf;
+	u32 id;
+
+	pci_cache_valid = false;
+	pci_cache_entries = 0;
+
+	for (bus = 0; bus <= end_bus; bus++) {
+		for (dev = 0; dev < 32; dev++) {
+			max_fn = 1;
+			for (fn = 0; fn < max_fn; fn++) {
+				bdf = (bus << 8) | (dev << 3) | fn;
+				id = pci_read_config(bdf, PCI_CFG_VENDOR_ID,
+						     4);
+				if ((id & 0xffff) == PCI_ID_ANY)
+					continue;
+				if (fn == 0 &&
+				    pci_read_config(bdf, PCI_CFG_HEADER_TYPE,
+						    1) & PCI_HDR_MULTIFUNC)
+					max_fn = 8;
+				if (pci_cache_entries == PCI_CACHE_DEVICES) {
+					printk("pci: more than %d devices, "
+					       "not cached\n",
+					       PCI_CACHE_DEVICES);
+					return pci_cache_entries;
+				}
+				pci_cache_add(bdf, id);
+			}
+		}
+	}
+	pci_cache_valid = true;
+
+	return pci_cache_entries;
+}
+
+/* keep cached BARs in sync with config space writes */
+void pci_cache_update(u16 bdf, unsigned int addr, u32 value,
+		      unsigned int size)
+{
+	struct pci_cache_entry *entry;
+
+	if (size != 4 || addr < PCI_CFG_BAR ||
+	    addr >= PCI_CFG_BAR + PCI_NUM_BARS * 4)
+		return;
+
+	entry = pci_cache_lookup(bdf);
+	if (entry)
+		entry->bar[(addr - PCI_CFG_BAR) / 4] = value;
+}
+
+/**
+ * Return the address programmed into the memory BAR with the given index,
+ * combined with the following one for 64-bit BARs. I/O BARs return 0.
+ */
+u64 pci_read_bar(u16 bdf, unsigned int bar)
+{
+	struct pci_cache_entry *entry = pci_cache_lookup(bdf);
+	u32 lo, hi = 0;
+
+	if (bar >= PCI_NUM_BARS)
+		return 0;
+
+	lo = entry ? entry->bar[bar] :
+		pci_read_config(bdf, PCI_CFG_BAR + bar * 4, 4);
+	if (lo & 0x1)
+		return 0;
+	if ((lo & 0x6) == PCI_BAR_64BIT && bar + 1 < PCI_NUM_BARS)
+		hi = entry ? entry->bar[bar + 1] :
+			pci_read_config(bdf, PCI_CFG_BAR + (bar + 1) * 4, 4);
+
+	return ((u64)hi << 32) | (lo & ~0xf);
+}
+
 int pci_find_device(u16 vendor, u16 device, u16 start_bdf)
 {
-	unsigned int bdf;
+	struct pci_cache_entry *entry;
+	unsigned int bdf, n;
 	u16 id;
 
+	if (pci_cache_valid) {
+		for (n = 0; n < pci_cache_entries; n++) {
+			entry = &pci_cache[n];
+			if (entry->bdf < start_bdf ||
+			    (vendor != PCI_ID_ANY &&
+			     entry->vendor_id != vendor) ||
+			    (device != PCI_ID_ANY &&
+			     entry->device_id != device))
+				continue;
+			return entry->bdf;
+		}
+		return -1;
+	}
+
 	for (bdf = start_bdf; bdf < 0x10000; bdf++) {
 		id = pci_read_config(bdf, PCI_CFG_VENDOR_ID, 2);
 		if (id == PCI_ID_ANY || (vendor != PCI_ID_ANY && vendor != id))
@@ -30,16 +208,14 @@ int pci_find_device(u16 vendor, u16 device, u16 start_bdf)
 
 int pci_find_cap(u16 bdf, u16 cap)
 {
-	u8 pos = PCI_CFG_CAP_PTR - 1;
+	struct pci_cache_entry *entry = pci_cache_lookup(bdf);
+	unsigned int n;
 
-	if (!(pci_read_config(bdf, PCI_CFG_STATUS, 2) & PCI_STS_CAPS))
-		return -1;
+	if (!entry || entry->num_caps > PCI_CACHE_CAPS)
+		return pci_walk_caps(bdf, cap);
 
-	while (1) {
-		pos = pci_read_config(bdf, pos + 1, 1);
-		if (pos == 0)
-			return -1;
-		if (pci_read_config(bdf, pos, 1) == cap)
-			return pos;
-	}
+	for (n = 0; n < entry->num_caps; n++)
+		if (entry->cap_id[n] == cap)
+			return entry->cap_pos[n];
+	return -1;
 }
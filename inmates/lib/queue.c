@@ -0,0 +1,201 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+#include <jailhouse/queue.h>
+
+#define SLOT_PAYLOAD(sq)	((sq)->slot_size - \
+				 sizeof(struct jailhouse_queue_slot))
+
+static void shmem_queue_setup(struct shmem_queue *sq,
+			      struct jailhouse_queue *queue, bool producer,
+			      u32 num_slots, u32 slot_size, u32 idx)
+{
+	sq->queue = queue;
+	sq->producer = producer;
+	sq->num_slots = num_slots;
+	sq->slot_size = slot_size;
+	sq->idx = idx;
+	sq->notified_idx = idx;
+}
+
+/**
+ * Format a queue in shared memory and attach to it as producer.
+ *
+ * The producer resynchronizes with a consumer that may still be attached, so
+ * it can be restarted at any time. Messages not consumed yet are discarded.
+ *
+ * @return number of slots on success, -1 if the parameters do not fit.
+ */
+int shmem_queue_init_producer(struct shmem_queue *sq, void *mem,
+			      unsigned long size, unsigned int slot_size)
+{
+	struct jailhouse_queue *queue = mem;
+	u32 num_slots, idx;
+
+	if (slot_size < JAILHOUSE_QUEUE_MIN_SLOT_SIZE || slot_size % 8)
+		return -1;
+	num_slots = jailhouse_queue_slots(size, slot_size);
+	if (num_slots == 0)
+		return -1;
+
+	queue->magic = 0;
+	memory_store_barrier();
+
+	queue->num_slots = num_slots;
+	queue->slot_size = slot_size;
+	idx = queue->cons.tail;
+	queue->prod.head = idx;
+	queue->prod.space_event = idx - 1;
+
+	memory_store_barrier();
+	queue->magic = JAILHOUSE_QUEUE_MAGIC;
+
+	shmem_queue_setup(sq, queue, true, num_slots, slot_size, idx);
+	return num_slots;
+}
+
+/**
+ * Attach to a queue formatted by the producer as consumer.
+ *
+ * @return number of slots on success, -1 if the queue is not (yet) valid.
+ */
+int shmem_queue_init_consumer(struct shmem_queue *sq, void *mem,
+			      unsigned long size)
+{
+	struct jailhouse_queue *queue = mem;
+	u32 num_slots, slot_size, idx;
+
+	if (size < sizeof(struct jailhouse_queue) ||
+	    queue->magic != JAILHOUSE_QUEUE_MAGIC)
+		return -1;
+	memory_load_barrier();
+
+	/* do not trust the peer: validate the layout against our mapping */
+	num_slots = queue->num_slots;
+	slot_size = queue->slot_size;
+	if (num_slots == 0 || (num_slots & (num_slots - 1)) ||
+	    slot_size < JAILHOUSE_QUEUE_MIN_SLOT_SIZE || slot_size % 8 ||
+	    num_slots > (size - sizeof(struct jailhouse_queue)) / slot_size)
+		return -1;
+
+	idx = queue->prod.head;
+	queue->cons.tail = idx;
+	queue->cons.data_event = idx - 1;
+
+	shmem_queue_setup(sq, queue, false, num_slots, slot_size, idx);
+	return num_slots;
+}
+
+/**
+ * Add a message to the queue.
+ *
+ * The message is visible to the consumer on return, but the consumer is not
+ * notified. Call shmem_queue_kick_needed() after a batch of messages.
+ *
+ * @return true on success, false if the queue is full or the message too
+ * large.
+ */
+bool shmem_queue_push(struct shmem_queue *sq, const void *data,
+		      unsigned int len)
+{
+	struct jailhouse_queue *queue = sq->queue;
+	struct jailhouse_queue_slot *slot;
+
+	if (len > SLOT_PAYLOAD(sq))
+		return false;
+	if (sq->idx - queue->cons.tail >= sq->num_slots)
+		return false;
+	/* the consumer must be done with the slot before overwriting it */
+	memory_load_barrier();
+
+	slot = jailhouse_queue_slot(queue, sq->num_slots, sq->slot_size,
+				    sq->idx);
+	slot->len = len;
+	memcpy(slot->data, data, len);
+
+	memory_store_barrier();
+	queue->prod.head = ++sq->idx;
+
+	return true;
+}
+
+/**
+ * Remove a message from the queue.
+ *
+ * Messages larger than the buffer are truncated.
+ *
+ * @return length of the message on success, -1 if the queue is empty.
+ */
+int shmem_queue_pop(struct shmem_queue *sq, void *buf, unsigned int size)
+{
+	struct jailhouse_queue *queue = sq->queue;
+	struct jailhouse_queue_slot *slot;
+	unsigned int len;
+
+	if (queue->prod.head == sq->idx)
+		return -1;
+	memory_load_barrier();
+
+	slot = jailhouse_queue_slot(queue, sq->num_slots, sq->slot_size,
+				    sq->idx);
+	len = slot->len;
+	if (len > SLOT_PAYLOAD(sq))
+		len = SLOT_PAYLOAD(sq);
+	memcpy(buf, slot->data, len < size ? len : size);
+
+	/* finish reading the slot before handing it back */
+	memory_load_barrier();
+	queue->cons.tail = ++sq->idx;
+
+	return len;
+}
+
+/**
+ * Request a notification from the peer before waiting for it.
+ *
+ * A consumer asks to be kicked on new messages, a producer on free slots.
+ *
+ * @return true if the caller can wait, false if the queue changed meanwhile
+ * and should be processed again.
+ */
+bool shmem_queue_prepare_wait(struct shmem_queue *sq)
+{
+	struct jailhouse_queue *queue = sq->queue;
+
+	if (sq->producer) {
+		queue->prod.space_event = queue->cons.tail;
+		memory_barrier();
+		return sq->idx - queue->cons.tail >= sq->num_slots;
+	}
+
+	queue->cons.data_event = sq->idx;
+	memory_barrier();
+	return queue->prod.head == sq->idx;
+}
+
+/**
+ * Check if the peer has to be notified about the progress since the last
+ * call. The doorbell itself is up to the caller.
+ *
+ * @return true if the peer waits for the progress made.
+ */
+bool shmem_queue_kick_needed(struct shmem_queue *sq)
+{
+	struct jailhouse_queue *queue = sq->queue;
+	u32 old_idx = sq->notified_idx;
+	u32 event;
+
+	/* publish our index before looking at the peer's event */
+	memory_barrier();
+	event = sq->producer ? queue->cons.data_event : queue->prod.space_event;
+	sq->notified_idx = sq->idx;
+
+	return jailhouse_queue_need_event(event, sq->idx, old_idx);
+}
@@ -12,15 +12,112 @@
 
 #include <inmate.h>
 
+#define WORD_MASK	(sizeof(unsigned long) - 1)
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * The string instructions match SIMD copies on CPUs with Enhanced REP
+ * MOVSB/STOSB and need no SSE state to be enabled by the inmate.
+ */
+void *memset(void *s, int c, unsigned long n)
+{
+	void *d = s;
+
+	asm volatile("rep stosb"
+		: "+D" (d), "+c" (n)
+		: "a" (c)
+		: "memory");
+	return s;
+}
+
+void *memcpy(void *dest, const void *src, unsigned long n)
+{
+	void *d = dest;
+
+	asm volatile("rep movsb"
+		: "+D" (d), "+S" (src), "+c" (n)
+		:
+		: "memory");
+	return dest;
+}
+#else
 void *memset(void *s, int c, unsigned long n)
 {
+	unsigned long pattern = (~0UL / 0xff) * (u8)c;
 	u8 *p = s;
 
+	while (n > 0 && ((unsigned long)p & WORD_MASK)) {
+		*p++ = c;
+		n--;
+	}
+	for (; n >= sizeof(unsigned long); n -= sizeof(unsigned long)) {
+		*(unsigned long *)p = pattern;
+		p += sizeof(unsigned long);
+	}
 	while (n-- > 0)
 		*p++ = c;
 	return s;
 }
 
+void *memcpy(void *dest, const void *src, unsigned long n)
+{
+	const u8 *s = src;
+	u8 *d = dest;
+
+	if ((((unsigned long)d | (unsigned long)s) & WORD_MASK) == 0)
+		for (; n >= sizeof(unsigned long);
+		     n -= sizeof(unsigned long)) {
+			*(unsigned long *)d = *(const unsigned long *)s;
+			d += sizeof(unsigned long);
+			s += sizeof(unsigned long);
+		}
+	while (n-- > 0)
+		*d++ = *s++;
+	return dest;
+}
+#endif
+
+/**
+ * Copy a buffer that will be read by another agent, typically another cell
+ * via shared memory, bypassing the caches of the writing CPU where possible.
+ * Large transfers then neither evict the working set of the writer nor leave
+ * dirty lines behind that the reader has to snoop. All stores are globally
+ * visible when the function returns.
+ *
+ * @param dest	Destination buffer.
+ * @param src	Source buffer.
+ * @param n	Number of bytes to copy.
+ *
+ * @return Destination buffer.
+ */
+void *memcpy_nt(void *dest, const void *src, unsigned long n)
+{
+#ifdef __x86_64__
+	const u8 *s = src;
+	u8 *d = dest;
+
+	while (n > 0 && ((unsigned long)d & WORD_MASK)) {
+		*d++ = *s++;
+		n--;
+	}
+	for (; n >= sizeof(unsigned long); n -= sizeof(unsigned long)) {
+		asm volatile("movnti %1,%0"
+			: "=m" (*(unsigned long *)d)
+			: "r" (*(const unsigned long *)s));
+		d += sizeof(unsigned long);
+		s += sizeof(unsigned long);
+	}
+	while (n-- > 0)
+		*d++ = *s++;
+	/* non-temporal stores are weakly ordered */
+	asm volatile("sfence" : : : "memory");
+#else
+	memcpy(dest, src, n);
+	memory_barrier();
+#endif
+	return dest;
+}
+
 unsigned long strlen(const char *s1)
 {
 	unsigned long len = 0;
@@ -46,3 +143,13 @@ int strncmp(const char *s1, const char *s2, unsigned long n)
 	}
 	return 0;
 }
+
+/* GCC lowers strncmp calls with a string literal to strcmp */
+int strcmp(const char *s1, const char *s2)
+{
+	while (*s1 && *s1 == *s2) {
+		s1++;
+		s2++;
+	}
+	return *s1 - *s2;
+}
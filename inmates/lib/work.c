@@ -0,0 +1,240 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Barriers and a fork-join work dispatcher for inmates running on multiple
+ * CPUs.
+ *
+ * The CPU calling work_init submits work items via work_submit and joins
+ * them via work_wait_all, executing items itself meanwhile. The other CPUs
+ * run work_worker, e.g. started via smp_start_cpu on x86. Each CPU owns a
+ * queue, padded to full cache lines, to which it pushes its submissions and
+ * from which it takes the most recent item first. CPUs without own work
+ * steal the oldest items from the other queues. Idle workers sleep until
+ * they are woken up via wakeup_cpu, which is IPI-based on x86.
+ */
+
+#include <inmate.h>
+
+#define WORK_MAX_CPUS		8
+#define WORK_QUEUE_SIZE		64
+
+struct work_item {
+	work_func_t func;
+	void *arg;
+};
+
+struct work_cpu {
+	struct spinlock lock;
+	volatile unsigned long head, tail;
+	unsigned int cpu_id;
+	volatile unsigned int sleeping;
+	volatile unsigned int wakeup;
+	struct work_item items[WORK_QUEUE_SIZE];
+} __cacheline_aligned;
+
+static struct work_cpu work_cpus[WORK_MAX_CPUS];
+static struct spinlock work_cpus_lock;
+static volatile unsigned long work_num_cpus;
+/* submitted but not yet completed work items */
+static volatile unsigned long work_pending __cacheline_aligned;
+
+void smp_barrier_init(struct smp_barrier *barrier, unsigned int num_cpus)
+{
+	barrier->arrived = 0;
+	barrier->generation = 0;
+	barrier->num_cpus = num_cpus;
+}
+
+/**
+ * Wait until barrier->num_cpus CPUs arrived. The barrier can be reused
+ * right away.
+ */
+void smp_barrier_wait(struct smp_barrier *barrier)
+{
+	unsigned long generation = atomic_load_acquire(&barrier->generation);
+
+	if (atomic_fetch_add(&barrier->arrived, 1) == barrier->num_cpus - 1) {
+		barrier->arrived = 0;
+		atomic_store_release(&barrier->generation, generation + 1);
+	} else {
+		while (atomic_load_acquire(&barrier->generation) == generation)
+			cpu_relax();
+	}
+}
+
+static struct work_cpu *work_register_cpu(void)
+{
+	struct work_cpu *wcpu = NULL;
+	unsigned long num;
+
+	spin_lock(&work_cpus_lock);
+	num = work_num_cpus;
+	if (num < WORK_MAX_CPUS) {
+		wcpu = &work_cpus[num];
+		wcpu->cpu_id = cpu_id();
+		atomic_store_release(&work_num_cpus, num + 1);
+	}
+	spin_unlock(&work_cpus_lock);
+
+	return wcpu;
+}
+
+static struct work_cpu *this_work_cpu(void)
+{
+	unsigned long n, num = atomic_load_acquire(&work_num_cpus);
+	unsigned int id = cpu_id();
+
+	for (n = 0; n < num; n++)
+		if (work_cpus[n].cpu_id == id)
+			return &work_cpus[n];
+	return &work_cpus[0];
+}
+
+/* own work is taken LIFO, stolen work FIFO */
+static bool work_take(struct work_cpu *wcpu, bool steal,
+		      struct work_item *item)
+{
+	bool found = false;
+
+	spin_lock(&wcpu->lock);
+	if (wcpu->head != wcpu->tail) {
+		if (steal)
+			*item = wcpu->items[wcpu->head++ % WORK_QUEUE_SIZE];
+		else
+			*item = wcpu->items[--wcpu->tail % WORK_QUEUE_SIZE];
+		found = true;
+	}
+	spin_unlock(&wcpu->lock);
+
+	return found;
+}
+
+static bool work_run_one(struct work_cpu *wcpu)
+{
+	unsigned long n, num = atomic_load_acquire(&work_num_cpus);
+	unsigned long victim = wcpu - work_cpus;
+	struct work_item item;
+	bool found;
+
+	found = work_take(wcpu, false, &item);
+	for (n = 1; !found && n < num; n++) {
+		if (++victim == num)
+			victim = 0;
+		found = work_take(&work_cpus[victim], true, &item);
+	}
+	if (!found)
+		return false;
+
+	item.func(item.arg);
+	atomic_fetch_add(&work_pending, -1UL);
+
+	return true;
+}
+
+static bool work_queued(void)
+{
+	unsigned long n, num = atomic_load_acquire(&work_num_cpus);
+
+	for (n = 0; n < num; n++)
+		if (work_cpus[n].head != work_cpus[n].tail)
+			return true;
+	return false;
+}
+
+static void work_wake_one(void)
+{
+	unsigned long n, num = atomic_load_acquire(&work_num_cpus);
+	struct work_cpu *wcpu;
+
+	/* pairs with the barrier between setting sleeping and rechecking */
+	memory_barrier();
+
+	for (n = 0; n < num; n++) {
+		wcpu = &work_cpus[n];
+		if (wcpu->sleeping && !wcpu->wakeup) {
+			wcpu->wakeup = 1;
+			memory_barrier();
+			wakeup_cpu(wcpu->cpu_id);
+			return;
+		}
+	}
+}
+
+/**
+ * Register the calling CPU as the one that submits and joins work.
+ */
+void work_init(void)
+{
+	work_register_cpu();
+}
+
+/**
+ * Main loop of a worker CPU. It only returns if WORK_MAX_CPUS CPUs are
+ * already registered.
+ */
+void work_worker(void)
+{
+	struct work_cpu *wcpu = work_register_cpu();
+
+	if (!wcpu)
+		return;
+
+	wakeup_init_cpu();
+
+	while (1) {
+		if (work_run_one(wcpu))
+			continue;
+
+		wcpu->sleeping = 1;
+		memory_barrier();
+		if (!work_queued())
+			wakeup_wait(&wcpu->wakeup);
+		wcpu->wakeup = 0;
+		wcpu->sleeping = 0;
+	}
+}
+
+/**
+ * Queue func(arg) for execution by any registered CPU. If the queue of the
+ * calling CPU is full, the item is executed right away.
+ */
+void work_submit(work_func_t func, void *arg)
+{
+	struct work_cpu *wcpu = this_work_cpu();
+	bool queued = false;
+
+	atomic_fetch_add(&work_pending, 1);
+
+	spin_lock(&wcpu->lock);
+	if (wcpu->tail - wcpu->head < WORK_QUEUE_SIZE) {
+		wcpu->items[wcpu->tail++ % WORK_QUEUE_SIZE] =
+			(struct work_item){ .func = func, .arg = arg };
+		queued = true;
+	}
+	spin_unlock(&wcpu->lock);
+
+	if (queued) {
+		work_wake_one();
+	} else {
+		func(arg);
+		atomic_fetch_add(&work_pending, -1UL);
+	}
+}
+
+/**
+ * Wait for all submitted work items to complete, also those submitted by
+ * the items themselves, and help executing them.
+ */
+void work_wait_all(void)
+{
+	struct work_cpu *wcpu = this_work_cpu();
+
+	while (atomic_load_acquire(&work_pending) != 0)
+		if (!work_run_one(wcpu))
+			cpu_relax();
+}
@@ -0,0 +1,434 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2014-2016
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Polling driver for a single e1000 NIC with batched transmission and
+ * reception. Frames are copied into the transmit buffers of the driver, and
+ * the tail doorbell is written once per batch. Received frames are handed
+ * out in place and only returned to the NIC, again with one doorbell write,
+ * via e1000_receive_done. If an MSI vector is configured, waiting for frames
+ * falls back to the receive interrupt after polling for a while.
+ */
+
+#include <inmate.h>
+
+#define E1000_REG_CTRL		0x0000
+# define E1000_CTRL_LRST	(1 << 3)
+# define E1000_CTRL_SLU		(1 << 6)
+# define E1000_CTRL_FRCSPD	(1 << 11)
+# define E1000_CTRL_RST		(1 << 26)
+#define E1000_REG_STATUS	0x0008
+# define E1000_STATUS_LU	(1 << 1)
+# define E1000_STATUS_SPEEDSHFT	6
+# define E1000_STATUS_SPEED	(3 << E1000_STATUS_SPEEDSHFT)
+#define E1000_REG_EERD		0x0014
+# define E1000_EERD_START	(1 << 0)
+# define E1000_EERD_DONE	(1 << 4)
+# define E1000_EERD_ADDR_SHIFT	8
+# define E1000_EERD_DATA_SHIFT	16
+#define E1000_REG_MDIC		0x0020
+# define E1000_MDIC_REGADD_SHFT	16
+# define E1000_MDIC_PHYADD	(0x1 << 21)
+# define E1000_MDIC_OP_WRITE	(0x1 << 26)
+# define E1000_MDIC_OP_READ	(0x2 << 26)
+# define E1000_MDIC_READY	(0x1 << 28)
+#define E1000_REG_ICR		0x00c0
+# define E1000_ICR_RXT0		(1 << 7)
+#define E1000_REG_IMS		0x00d0
+#define E1000_REG_IMC		0x00d8
+#define E1000_REG_RCTL		0x0100
+# define E1000_RCTL_EN		(1 << 1)
+# define E1000_RCTL_BAM		(1 << 15)
+# define E1000_RCTL_BSIZE_2048	(0 << 16)
+# define E1000_RCTL_SECRC	(1 << 26)
+#define E1000_REG_TCTL		0x0400
+# define E1000_TCTL_EN		(1 << 1)
+# define E1000_TCTL_PSP		(1 << 3)
+# define E1000_TCTL_CT_DEF	(0xf << 4)
+# define E1000_TCTL_COLD_DEF	(0x40 << 12)
+#define E1000_REG_TIPG		0x0410
+# define E1000_TIPG_IPGT_DEF	(10 << 0)
+# define E1000_TIPG_IPGR1_DEF	(10 << 10)
+# define E1000_TIPG_IPGR2_DEF	(10 << 20)
+#define E1000_REG_RDBAL		0x2800
+#define E1000_REG_RDBAH		0x2804
+#define E1000_REG_RDLEN		0x2808
+#define E1000_REG_RDH		0x2810
+#define E1000_REG_RDT		0x2818
+#define E1000_REG_RXDCTL	0x2828
+# define E1000_RXDCTL_ENABLE	(1 << 25)
+#define E1000_REG_TDBAL		0x3800
+#define E1000_REG_TDBAH		0x3804
+#define E1000_REG_TDLEN		0x3808
+#define E1000_REG_TDH		0x3810
+#define E1000_REG_TDT		0x3818
+#define E1000_REG_TXDCTL	0x3828
+# define E1000_TXDCTL_ENABLE	(1 << 25)
+#define E1000_REG_RAL		0x5400
+#define E1000_REG_RAH		0x5404
+# define E1000_RAH_AV		(1 << 31)
+
+#define E1000_PHY_CTRL		0
+# define E1000_PHYC_POWER_DOWN	(1 << 11)
+
+#define E1000_MMIO_SIZE		(128 * 1024)
+
+#define RX_DESCRIPTORS		128
+#define TX_DESCRIPTORS		128
+#define BUFFER_SIZE		2048
+
+struct e1000_rxd {
+	u64	addr;
+	u16	len;
+	u16	crc;
+	u8	status;
+#define E1000_RXD_STAT_DD	(1 << 0)
+	u8	errors;
+	u16	vlan_tag;
+} __attribute__((packed));
+
+struct e1000_txd {
+	u64	addr;
+	u16	len;
+	u8	cso;
+	u8	cmd;
+#define E1000_TXD_CMD_EOP	(1 << 0)
+#define E1000_TXD_CMD_IFCS	(1 << 1)
+#define E1000_TXD_CMD_RS	(1 << 3)
+	u8	status;
+#define E1000_TXD_STAT_DD	(1 << 0)
+	u8	css;
+	u16	special;
+} __attribute__((packed));
+
+static const char *speed_info[] = { "10", "100", "1000", "1000" };
+
+static void *mmiobar;
+static volatile struct e1000_rxd *rx_ring;
+static volatile struct e1000_txd *tx_ring;
+static u8 *tx_buffers;
+/* free-running indices, masked on access */
+static unsigned int rx_next, rx_clean;
+static unsigned int tx_tail, tx_clean;
+static unsigned int irq_vector;
+
+static u16 phy_read(unsigned int reg)
+{
+	u32 val;
+
+	mmio_write32(mmiobar + E1000_REG_MDIC,
+		     (reg << E1000_MDIC_REGADD_SHFT) |
+		     E1000_MDIC_PHYADD | E1000_MDIC_OP_READ);
+	do {
+		val = mmio_read32(mmiobar + E1000_REG_MDIC);
+		cpu_relax();
+	} while (!(val & E1000_MDIC_READY));
+
+	return (u16)val;
+}
+
+static void phy_write(unsigned int reg, u16 val)
+{
+	mmio_write32(mmiobar + E1000_REG_MDIC,
+		     val | (reg << E1000_MDIC_REGADD_SHFT) |
+		     E1000_MDIC_PHYADD | E1000_MDIC_OP_WRITE);
+	while (!(mmio_read32(mmiobar + E1000_REG_MDIC) & E1000_MDIC_READY))
+		cpu_relax();
+}
+
+static void read_mac(u8 *mac)
+{
+	unsigned int n;
+	u32 eerd;
+
+	if (mmio_read32(mmiobar + E1000_REG_RAH) & E1000_RAH_AV) {
+		*(u32 *)mac = mmio_read32(mmiobar + E1000_REG_RAL);
+		*(u16 *)&mac[4] = mmio_read32(mmiobar + E1000_REG_RAH);
+		return;
+	}
+
+	for (n = 0; n < 3; n++) {
+		mmio_write32(mmiobar + E1000_REG_EERD,
+			     E1000_EERD_START | (n << E1000_EERD_ADDR_SHIFT));
+		do {
+			eerd = mmio_read32(mmiobar + E1000_REG_EERD);
+			cpu_relax();
+		} while (!(eerd & E1000_EERD_DONE));
+		mac[n * 2] = (u8)(eerd >> E1000_EERD_DATA_SHIFT);
+		mac[n * 2 + 1] = (u8)(eerd >> (E1000_EERD_DATA_SHIFT + 8));
+	}
+}
+
+static void setup_rings(void)
+{
+	u8 *rx_buffers;
+	unsigned int n;
+	u32 val;
+
+	rx_ring = alloc(RX_DESCRIPTORS * sizeof(*rx_ring), PAGE_SIZE);
+	tx_ring = alloc(TX_DESCRIPTORS * sizeof(*tx_ring), PAGE_SIZE);
+	rx_buffers = alloc(RX_DESCRIPTORS * BUFFER_SIZE, PAGE_SIZE);
+	tx_buffers = alloc(TX_DESCRIPTORS * BUFFER_SIZE, PAGE_SIZE);
+
+	for (n = 0; n < RX_DESCRIPTORS; n++) {
+		rx_ring[n].addr = (unsigned long)&rx_buffers[n * BUFFER_SIZE];
+		rx_ring[n].status = 0;
+	}
+	mmio_write32(mmiobar + E1000_REG_RDBAL, (unsigned long)rx_ring);
+	mmio_write32(mmiobar + E1000_REG_RDBAH, (unsigned long)rx_ring >> 32);
+	mmio_write32(mmiobar + E1000_REG_RDLEN,
+		     RX_DESCRIPTORS * sizeof(*rx_ring));
+	mmio_write32(mmiobar + E1000_REG_RDH, 0);
+	mmio_write32(mmiobar + E1000_REG_RDT, 0);
+	mmio_write32(mmiobar + E1000_REG_RXDCTL,
+		mmio_read32(mmiobar + E1000_REG_RXDCTL) | E1000_RXDCTL_ENABLE);
+
+	val = mmio_read32(mmiobar + E1000_REG_RCTL);
+	val |= E1000_RCTL_EN | E1000_RCTL_BAM | E1000_RCTL_BSIZE_2048 |
+		E1000_RCTL_SECRC;
+	mmio_write32(mmiobar + E1000_REG_RCTL, val);
+
+	/* hand all but one descriptor to the NIC */
+	mmio_write32(mmiobar + E1000_REG_RDT, RX_DESCRIPTORS - 1);
+
+	for (n = 0; n < TX_DESCRIPTORS; n++) {
+		tx_ring[n].addr = (unsigned long)&tx_buffers[n * BUFFER_SIZE];
+		tx_ring[n].status = 0;
+	}
+	mmio_write32(mmiobar + E1000_REG_TDBAL, (unsigned long)tx_ring);
+	mmio_write32(mmiobar + E1000_REG_TDBAH, (unsigned long)tx_ring >> 32);
+	mmio_write32(mmiobar + E1000_REG_TDLEN,
+		     TX_DESCRIPTORS * sizeof(*tx_ring));
+	mmio_write32(mmiobar + E1000_REG_TDH, 0);
+	mmio_write32(mmiobar + E1000_REG_TDT, 0);
+	mmio_write32(mmiobar + E1000_REG_TXDCTL,
+		mmio_read32(mmiobar + E1000_REG_TXDCTL) | E1000_TXDCTL_ENABLE);
+
+	val = mmio_read32(mmiobar + E1000_REG_TCTL);
+	val |= E1000_TCTL_EN | E1000_TCTL_PSP | E1000_TCTL_CT_DEF |
+		E1000_TCTL_COLD_DEF;
+	mmio_write32(mmiobar + E1000_REG_TCTL, val);
+	mmio_write32(mmiobar + E1000_REG_TIPG,
+		     E1000_TIPG_IPGT_DEF | E1000_TIPG_IPGR1_DEF |
+		     E1000_TIPG_IPGR2_DEF);
+}
+
+/**
+ * Reset the NIC at bdf, wait for the link and enable reception and
+ * transmission. Broadcast frames are accepted initially. The MAC address is
+ * stored in mac.
+ *
+ * @return 0 on success, -1 if the MMIO BAR is not usable.
+ */
+int e1000_init(u16 bdf, u8 *mac)
+{
+	u32 val;
+	u64 bar;
+
+	bar = pci_read_bar(bdf, 0);
+	if (!bar)
+		return -1;
+	mmiobar = (void *)bar;
+	map_range(mmiobar, E1000_MMIO_SIZE, MAP_UNCACHED);
+	printk("MMIO register BAR at %p\n", mmiobar);
+
+	pci_write_config(bdf, PCI_CFG_COMMAND,
+			 PCI_CMD_MEM | PCI_CMD_MASTER, 2);
+
+	mmio_write32(mmiobar + E1000_REG_CTRL, E1000_CTRL_RST);
+	delay_us(20000);
+
+	mmio_write32(mmiobar + E1000_REG_IMC, 0xffffffff);
+
+	val = mmio_read32(mmiobar + E1000_REG_CTRL);
+	val &= ~(E1000_CTRL_LRST | E1000_CTRL_FRCSPD);
+	val |= E1000_CTRL_SLU;
+	mmio_write32(mmiobar + E1000_REG_CTRL, val);
+
+	/* power up again in case the previous user turned it off */
+	phy_write(E1000_PHY_CTRL,
+		  phy_read(E1000_PHY_CTRL) & ~E1000_PHYC_POWER_DOWN);
+
+	printk("Waiting for link...");
+	while (!(mmio_read32(mmiobar + E1000_REG_STATUS) & E1000_STATUS_LU))
+		cpu_relax();
+	printk(" ok\n");
+
+	val = mmio_read32(mmiobar + E1000_REG_STATUS) & E1000_STATUS_SPEED;
+	val >>= E1000_STATUS_SPEEDSHFT;
+	printk("Link speed: %s Mb/s\n", speed_info[val]);
+
+	read_mac(mac);
+	printk("MAC: %02x:%02x:%02x:%02x:%02x:%02x\n",
+	       mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+	mmio_write32(mmiobar + E1000_REG_RAL, *(u32 *)mac);
+	mmio_write32(mmiobar + E1000_REG_RAH, *(u16 *)&mac[4] | E1000_RAH_AV);
+
+	setup_rings();
+
+	return 0;
+}
+
+void e1000_disable_broadcast(void)
+{
+	mmio_write32(mmiobar + E1000_REG_RCTL,
+		     mmio_read32(mmiobar + E1000_REG_RCTL) & ~E1000_RCTL_BAM);
+}
+
+static void e1000_irq_handler(void)
+{
+}
+
+/**
+ * Let e1000_wait_rx sleep on the receive interrupt, delivered via MSI with
+ * the given vector. int_init must have been called before.
+ *
+ * @return 0 on success, -1 if the NIC has no MSI capability.
+ */
+int e1000_enable_irq(u16 bdf, unsigned int vector)
+{
+	if (pci_find_cap(bdf, PCI_CAP_MSI) < 0)
+		return -1;
+
+	int_set_handler(vector, e1000_irq_handler);
+	pci_msi_set_vector(bdf, vector);
+	irq_vector = vector;
+
+	return 0;
+}
+
+/**
+ * Queue up to num frames for transmission and notify the NIC once. Frames
+ * are copied, so the caller may reuse them right away.
+ *
+ * @return number of frames queued, less than num if the ring is full.
+ */
+unsigned int e1000_send(const struct e1000_packet *packets, unsigned int num)
+{
+	volatile struct e1000_txd *txd;
+	unsigned int n, len;
+
+	/* reclaim completed descriptors */
+	while (tx_clean != tx_tail &&
+	       tx_ring[tx_clean % TX_DESCRIPTORS].status & E1000_TXD_STAT_DD)
+		tx_clean++;
+
+	for (n = 0; n < num; n++) {
+		if (tx_tail - tx_clean >= TX_DESCRIPTORS - 1)
+			break;
+
+		txd = &tx_ring[tx_tail % TX_DESCRIPTORS];
+		len = packets[n].len < BUFFER_SIZE ? packets[n].len :
+			BUFFER_SIZE;
+		memcpy((void *)(unsigned long)txd->addr, packets[n].data, len);
+		txd->len = len;
+		txd->cso = 0;
+		txd->status = 0;
+		txd->cmd = E1000_TXD_CMD_EOP | E1000_TXD_CMD_IFCS |
+			E1000_TXD_CMD_RS;
+		tx_tail++;
+	}
+
+	if (n > 0)
+		mmio_write32(mmiobar + E1000_REG_TDT, tx_tail % TX_DESCRIPTORS);
+
+	return n;
+}
+
+/**
+ * Wait until all queued frames have been sent.
+ */
+void e1000_send_flush(void)
+{
+	while (tx_clean != tx_tail) {
+		if (tx_ring[tx_clean % TX_DESCRIPTORS].status &
+		    E1000_TXD_STAT_DD)
+			tx_clean++;
+		else
+			cpu_relax();
+	}
+}
+
+/**
+ * Fetch up to num received frames. The frames point into the receive
+ * buffers and stay valid until they are returned via e1000_receive_done.
+ *
+ * @return number of frames stored in packets.
+ */
+unsigned int e1000_receive(struct e1000_packet *packets, unsigned int num)
+{
+	volatile struct e1000_rxd *rxd;
+	unsigned int n;
+
+	for (n = 0; n < num; n++) {
+		rxd = &rx_ring[rx_next % RX_DESCRIPTORS];
+		if (!(rxd->status & E1000_RXD_STAT_DD))
+			break;
+
+		packets[n].data = (void *)(unsigned long)rxd->addr;
+		packets[n].len = rxd->len;
+		rx_next++;
+	}
+
+	return n;
+}
+
+/**
+ * Return the num oldest frames obtained via e1000_receive to the NIC.
+ */
+void e1000_receive_done(unsigned int num)
+{
+	unsigned int idx = 0;
+
+	if (num > rx_next - rx_clean)
+		num = rx_next - rx_clean;
+	if (num == 0)
+		return;
+
+	while (num-- > 0) {
+		idx = rx_clean++ % RX_DESCRIPTORS;
+		rx_ring[idx].status = 0;
+	}
+	mmio_write32(mmiobar + E1000_REG_RDT, idx);
+}
+
+static bool rx_pending(void)
+{
+	return rx_ring[rx_next % RX_DESCRIPTORS].status & E1000_RXD_STAT_DD;
+}
+
+/**
+ * Wait for a received frame. Poll for up to spin_us microseconds first,
+ * then sleep on the receive interrupt if one is enabled.
+ */
+void e1000_wait_rx(unsigned long spin_us)
+{
+	unsigned long start = pm_timer_read(), rflags;
+
+	while (!rx_pending()) {
+		if (irq_vector &&
+		    pm_timer_read() - start >= spin_us * NS_PER_USEC)
+			break;
+		cpu_relax();
+	}
+	if (rx_pending())
+		return;
+
+	asm volatile("pushf; pop %0; cli" : "=r" (rflags) : : "memory");
+	mmio_read32(mmiobar + E1000_REG_ICR);
+	mmio_write32(mmiobar + E1000_REG_IMS, E1000_ICR_RXT0);
+	/* sti takes effect after hlt, so no interrupt is lost in between */
+	while (!rx_pending())
+		asm volatile("sti; hlt; cli" : : : "memory");
+	mmio_write32(mmiobar + E1000_REG_IMC, E1000_ICR_RXT0);
+	if (rflags & X86_EFLAGS_IF)
+		asm volatile("sti" : : : "memory");
+}
@@ -13,7 +13,7 @@
 #ifndef _JAILHOUSE_INMATE_H
 #define _JAILHOUSE_INMATE_H
 
-#define HEAP_BASE		0x000000
+#define HEAP_BASE		0x001000
 #define FSEGMENT_BASE		0x0f0000
 #define COMM_REGION_BASE	0x100000
 
@@ -61,6 +61,8 @@
 
 #define SMP_MAX_CPUS		255
 
+#define X86_EFLAGS_IF		(1 << 9)
+
 #ifndef __ASSEMBLY__
 typedef signed char s8;
 typedef unsigned char u8;
@@ -79,6 +81,21 @@ static inline void cpu_relax(void)
 	asm volatile("rep; nop" : : : "memory");
 }
 
+static inline void memory_barrier(void)
+{
+	asm volatile("mfence" : : : "memory");
+}
+
+static inline void memory_load_barrier(void)
+{
+	asm volatile("" : : : "memory");
+}
+
+static inline void memory_store_barrier(void)
+{
+	asm volatile("" : : : "memory");
+}
+
 static inline void outb(u8 v, u16 port)
 {
 	asm volatile("outb %0,%1" : : "a" (v), "dN" (port));
@@ -186,6 +203,7 @@ typedef void(*int_handler_t)(void);
 void int_init(void);
 void int_set_handler(unsigned int vector, int_handler_t handler);
 void int_send_ipi(unsigned int cpu_id, unsigned int vector);
+void int_set_wakeup_vector(unsigned int vector);
 
 enum ioapic_trigger_mode {
 	TRIGGER_EDGE = 0,
@@ -197,6 +215,7 @@ void ioapic_init(void);
 void ioapic_pin_set_vector(unsigned int pin,
 			   enum ioapic_trigger_mode trigger_mode,
 			   unsigned int vector);
+int ioapic_pins_set_mask(unsigned long pins, unsigned long mask);
 
 void hypercall_init(void);
 
@@ -204,6 +223,7 @@ unsigned long pm_timer_read(void);
 
 unsigned long tsc_read(void);
 unsigned long tsc_init(void);
+u64 tsc_cycles_to_ns(u64 cycles);
 
 void delay_us(unsigned long microsecs);
 
@@ -212,16 +232,36 @@ void apic_timer_set(unsigned long timeout_ns);
 
 enum map_type { MAP_CACHED, MAP_UNCACHED };
 
-void *alloc(unsigned long size, unsigned long align);
 void map_range(void *start, unsigned long size, enum map_type map_type);
 
 u32 pci_read_config(u16 bdf, unsigned int addr, unsigned int size);
 void pci_write_config(u16 bdf, unsigned int addr, u32 value,
 		      unsigned int size);
+int pci_init(void);
+int pci_scan(unsigned int end_bus);
+void pci_cache_update(u16 bdf, unsigned int addr, u32 value,
+		      unsigned int size);
+u64 pci_read_bar(u16 bdf, unsigned int bar);
 int pci_find_device(u16 vendor, u16 device, u16 start_bdf);
 int pci_find_cap(u16 bdf, u16 cap);
 void pci_msi_set_vector(u16 bdf, unsigned int vector);
 void pci_msix_set_vector(u16 bdf, unsigned int vector, u32 index);
+int pci_msix_set_vectors(u16 bdf, unsigned int vector, u32 index,
+			 unsigned int num);
+
+struct e1000_packet {
+	void *data;
+	unsigned int len;
+};
+
+int e1000_init(u16 bdf, u8 *mac);
+void e1000_disable_broadcast(void);
+int e1000_enable_irq(u16 bdf, unsigned int vector);
+unsigned int e1000_send(const struct e1000_packet *packets, unsigned int num);
+void e1000_send_flush(void);
+unsigned int e1000_receive(struct e1000_packet *packets, unsigned int num);
+void e1000_receive_done(unsigned int num);
+void e1000_wait_rx(unsigned long spin_us);
 
 extern volatile u32 smp_num_cpus;
 extern u8 smp_cpu_ids[SMP_MAX_CPUS];
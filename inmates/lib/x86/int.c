@@ -26,6 +26,7 @@ struct desc_table_reg {
 
 static u32 idt[NUM_IDT_DESC * 4];
 static int_handler_t int_handler[NUM_IDT_DESC];
+static unsigned int wakeup_vector;
 
 extern u8 irq_entry[];
 
@@ -112,3 +113,51 @@ void int_send_ipi(unsigned int cpu_id, unsigned int vector)
 {
 	write_msr(X2APIC_ICR, ((u64)cpu_id << 32) | APIC_LVL_ASSERT | vector);
 }
+
+static void wakeup_handler(void)
+{
+}
+
+/**
+ * Let wakeup_cpu send IPIs with the given vector. Without it, waiting CPUs
+ * poll.
+ */
+void int_set_wakeup_vector(unsigned int vector)
+{
+	int_set_handler(vector, wakeup_handler);
+	wakeup_vector = vector;
+}
+
+/* the IDT is shared, but has to be loaded on each CPU */
+void wakeup_init_cpu(void)
+{
+	if (wakeup_vector)
+		int_init();
+}
+
+void wakeup_cpu(unsigned int cpu_id)
+{
+	if (wakeup_vector)
+		int_send_ipi(cpu_id, wakeup_vector);
+}
+
+/*
+ * Wait until *flag is set. Interrupts are only enabled while halting, so
+ * that an IPI arriving after the check still ends the halt.
+ */
+void wakeup_wait(volatile unsigned int *flag)
+{
+	unsigned long rflags;
+
+	if (!wakeup_vector) {
+		while (!*flag)
+			cpu_relax();
+		return;
+	}
+
+	asm volatile("pushf; pop %0; cli" : "=r" (rflags) : : "memory");
+	while (!*flag)
+		asm volatile("sti; hlt; cli" : : : "memory");
+	if (rflags & X86_EFLAGS_IF)
+		asm volatile("sti" : : : "memory");
+}
@@ -34,3 +34,9 @@ void ioapic_pin_set_vector(unsigned int pin,
 		     IOAPIC_REDIR_TBL_START + pin * 2);
 	mmio_write32(IOAPIC_BASE + IOAPIC_REG_DATA, trigger_mode | vector);
 }
+
+int ioapic_pins_set_mask(unsigned long pins, unsigned long mask)
+{
+	return jailhouse_call_arg2(JAILHOUSE_HC_IRQCHIP_SET_MASK,
+				   JAILHOUSE_IRQCHIP_PINS_ARG(0, pins), mask);
+}
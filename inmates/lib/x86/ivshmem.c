@@ -0,0 +1,140 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Console output via an ivshmem link of protocol
+ * JAILHOUSE_SHMEM_PROTO_CONSOLE, enabled by the "console_ivshmem" command
+ * line parameter. The link carries one message queue per direction like
+ * jailhouse_queue, and the peer, typically the root cell, drains it into a
+ * hvc terminal. printk only writes into the shared memory and rings the
+ * doorbell if the peer waits for output. Nothing is written while the queue
+ * is full, the output is dropped instead of stalling the inmate.
+ */
+
+#include <inmate.h>
+#include <jailhouse/cell-config.h>
+#include <jailhouse/queue.h>
+
+#define IVSHMEM_VENDORID	0x1af4
+#define IVSHMEM_DEVICEID	0x1110
+
+#define IVSHMEM_CFG_CLASS	0x08
+#define IVSHMEM_CFG_SHMEM_PTR	0x40
+#define IVSHMEM_CFG_SHMEM_SZ	0x48
+
+#define IVSHMEM_REG_IVPOS	8
+#define IVSHMEM_REG_DBELL	12
+
+#define CONSOLE_CLASS		(0xff0000 | JAILHOUSE_SHMEM_PROTO_CONSOLE)
+#define CONSOLE_SLOT_SIZE	64
+#define CONSOLE_PAYLOAD		(CONSOLE_SLOT_SIZE - \
+				 sizeof(struct jailhouse_queue_slot))
+
+static struct shmem_queue console_queue;
+static void *console_registers;
+static u32 console_peer;
+
+bool printk_ivshmem;
+
+static u64 pci_cfg_read64(u16 bdf, unsigned int addr)
+{
+	return ((u64)pci_read_config(bdf, addr + 4, 4) << 32) |
+		pci_read_config(bdf, addr, 4);
+}
+
+static int console_find_device(void)
+{
+	int bdf = -1;
+
+	while (1) {
+		bdf = pci_find_device(IVSHMEM_VENDORID, IVSHMEM_DEVICEID,
+				      bdf + 1);
+		if (bdf < 0 ||
+		    pci_read_config(bdf, IVSHMEM_CFG_CLASS, 4) >> 8 ==
+		    CONSOLE_CLASS)
+			return bdf;
+	}
+}
+
+/**
+ * Attach printk to the console link if the command line contains
+ * "console_ivshmem". The register and MSI-X BARs of the device are placed
+ * right behind its shared memory.
+ *
+ * @return true if printk output goes to the link.
+ */
+bool printk_ivshmem_init(void)
+{
+	unsigned long regs, half;
+	u64 shmem_size;
+	void *shmem;
+	u32 ivpos;
+	int bdf;
+
+	if (!cmdline_parse_bool("console_ivshmem"))
+		return false;
+
+	pci_init();
+	bdf = console_find_device();
+	if (bdf < 0)
+		return false;
+
+	shmem = (void *)pci_cfg_read64(bdf, IVSHMEM_CFG_SHMEM_PTR);
+	shmem_size = pci_cfg_read64(bdf, IVSHMEM_CFG_SHMEM_SZ);
+
+	regs = ((unsigned long)shmem + shmem_size + PAGE_SIZE - 1) &
+		PAGE_MASK;
+	pci_write_config(bdf, PCI_CFG_BAR, regs, 4);
+	pci_write_config(bdf, PCI_CFG_BAR + 4, regs >> 32, 4);
+	pci_write_config(bdf, PCI_CFG_BAR + 16, regs + PAGE_SIZE, 4);
+	pci_write_config(bdf, PCI_CFG_BAR + 20, (regs + PAGE_SIZE) >> 32, 4);
+	pci_write_config(bdf, PCI_CFG_COMMAND, PCI_CMD_MEM, 2);
+	map_range(shmem, shmem_size, MAP_CACHED);
+	map_range((void *)regs, PAGE_SIZE, MAP_UNCACHED);
+	console_registers = (void *)regs;
+
+	ivpos = mmio_read32(console_registers + IVSHMEM_REG_IVPOS);
+	if (ivpos > 1)
+		return false;
+	console_peer = 1 - ivpos;
+
+	half = shmem_size / 2;
+	if (shmem_queue_init_producer(&console_queue, shmem + ivpos * half,
+				      half, CONSOLE_SLOT_SIZE) < 0)
+		return false;
+
+	/* let a waiting reader attach */
+	mmio_write32(console_registers + IVSHMEM_REG_DBELL,
+		     console_peer << 16);
+
+	printk_ivshmem = true;
+	return true;
+}
+
+void printk_ivshmem_write(const char *msg)
+{
+	char chunk[CONSOLE_PAYLOAD];
+	unsigned int len = 0;
+	bool sent = false;
+
+	while (*msg) {
+		/* terminals expect CR LF, keep both in the same chunk */
+		if (len >= sizeof(chunk) - 1) {
+			sent |= shmem_queue_push(&console_queue, chunk, len);
+			len = 0;
+		}
+		if (*msg == '\n')
+			chunk[len++] = '\r';
+		chunk[len++] = *msg++;
+	}
+	if (len > 0)
+		sent |= shmem_queue_push(&console_queue, chunk, len);
+
+	if (sent && shmem_queue_kick_needed(&console_queue))
+		mmio_write32(console_registers + IVSHMEM_REG_DBELL,
+			     console_peer << 16);
+}
@@ -17,8 +17,36 @@
 
 #define PCI_CONE		(1 << 31)
 
+static void *mmconfig;
+
+static void *mmconfig_address(u16 bdf, unsigned int addr)
+{
+	return mmconfig + ((unsigned long)bdf << 12) + (addr & 0xffc);
+}
+
+/*
+ * MMCONFIG takes one exit per access instead of two for the address and the
+ * data port. The hypervisor only accepts dword accesses, though, so smaller
+ * writes still go via the ports.
+ */
 u32 pci_read_config(u16 bdf, unsigned int addr, unsigned int size)
 {
+	u32 value;
+
+	if (mmconfig) {
+		value = mmio_read32(mmconfig_address(bdf, addr));
+		switch (size) {
+		case 1:
+			return (value >> ((addr & 0x3) * 8)) & 0xff;
+		case 2:
+			return (value >> ((addr & 0x3) * 8)) & 0xffff;
+		case 4:
+			return value;
+		default:
+			return -1;
+		}
+	}
+
 	outl(PCI_CONE | ((u32)bdf << 8) | (addr & 0xfc), PCI_REG_ADDR_PORT);
 	switch (size) {
 	case 1:
@@ -34,6 +62,13 @@ u32 pci_read_config(u16 bdf, unsigned int addr, unsigned int size)
 
 void pci_write_config(u16 bdf, unsigned int addr, u32 value, unsigned int size)
 {
+	pci_cache_update(bdf, addr, value, size);
+
+	if (mmconfig && size == 4) {
+		mmio_write32(mmconfig_address(bdf, addr), value);
+		return;
+	}
+
 	outl(PCI_CONE | ((u32)bdf << 8) | (addr & 0xfc), PCI_REG_ADDR_PORT);
 	switch (size) {
 	case 1:
@@ -48,45 +83,80 @@ void pci_write_config(u16 bdf, unsigned int addr, u32 value, unsigned int size)
 	}
 }
 
+/**
+ * Switch config space accesses to MMCONFIG if the hypervisor reports it and
+ * cache the devices of the cell, see pci_scan.
+ *
+ * @return number of devices found.
+ */
+int pci_init(void)
+{
+	unsigned int end_bus = 0xff;
+
+	if (comm_region->pci_mmconfig_base) {
+		end_bus = comm_region->pci_mmconfig_end_bus;
+		mmconfig = (void *)(unsigned long)
+			comm_region->pci_mmconfig_base;
+		map_range(mmconfig, (end_bus + 1) << 20, MAP_UNCACHED);
+	}
+
+	return pci_scan(end_bus);
+}
+
+static void msix_write_entry(u64 table, u32 index, unsigned int vector)
+{
+	u32 *entry = (u32 *)(unsigned long)(table + 16 * index);
+
+	mmio_write32(entry, 0xfee00000 | cpu_id() << 12);
+	mmio_write32(entry + 1, 0);
+	mmio_write32(entry + 2, vector);
+	mmio_write32(entry + 3, 0);
+}
+
 void pci_msix_set_vector(u16 bdf, unsigned int vector, u32 index)
+{
+	pci_msix_set_vectors(bdf, vector, index, 1);
+}
+
+/**
+ * Program num consecutive MSI-X entries, starting with index, to vector,
+ * vector + 1, ..., targeting the calling CPU. The function is masked only
+ * once for all entries.
+ *
+ * @return 0 on success, -1 if there is no MSI-X capability or the table is
+ * too small.
+ */
+int pci_msix_set_vectors(u16 bdf, unsigned int vector, u32 index,
+			 unsigned int num)
 {
 	int cap = pci_find_cap(bdf, PCI_CAP_MSIX);
-	unsigned int bar;
-	u64 msix_table = 0;
-	u32 addr;
+	u32 table_reg, n;
+	u64 table;
 	u16 ctrl;
-	u32 table;
 
 	if (cap < 0)
-		return;
+		return -1;
+
+	/* the table size field is encoded as N - 1 */
 	ctrl = pci_read_config(bdf, cap + 2, 2);
-	/* bounds check */
-	if (index > (ctrl & 0x3ff))
-		return;
-	table = pci_read_config(bdf, cap + 4, 4);
-	bar = (table & 7) * 4 + PCI_CFG_BAR;
-	addr = pci_read_config(bdf, bar, 4);
+	if (num == 0 || index + num - 1 > (ctrl & 0x3ff))
+		return -1;
 
-	if ((addr & 6) == PCI_BAR_64BIT) {
-		msix_table = pci_read_config(bdf, bar + 4, 4);
-		msix_table <<= 32;
-	}
-	msix_table |= addr & ~0xf;
-	msix_table += table & ~7;
+	table_reg = pci_read_config(bdf, cap + 4, 4);
+	table = pci_read_bar(bdf, table_reg & 7) + (table_reg & ~7);
 
 	/* enable and mask */
-	ctrl |= (MSIX_CTRL_ENABLE | MSIX_CTRL_FMASK);
+	ctrl |= MSIX_CTRL_ENABLE | MSIX_CTRL_FMASK;
 	pci_write_config(bdf, cap + 2, ctrl, 2);
 
-	msix_table += 16 * index;
-	mmio_write32((u32 *)msix_table, 0xfee00000 | cpu_id() << 12);
-	mmio_write32((u32 *)(msix_table + 4), 0);
-	mmio_write32((u32 *)(msix_table + 8), vector);
-	mmio_write32((u32 *)(msix_table + 12), 0);
+	for (n = 0; n < num; n++)
+		msix_write_entry(table, index + n, vector + n);
 
-	/* enable and unmask */
+	/* unmask */
 	ctrl &= ~MSIX_CTRL_FMASK;
 	pci_write_config(bdf, cap + 2, ctrl, 2);
+
+	return 0;
 }
 
 void pci_msi_set_vector(u16 bdf, unsigned int vector)
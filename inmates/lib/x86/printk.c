@@ -12,6 +12,7 @@
 
 #include <stdarg.h>
 #include <inmate.h>
+#include <jailhouse/header.h>
 
 #define UART_TX			0x0
 #define UART_DLL		0x0
@@ -41,9 +42,30 @@ static void uart_write(const char *msg)
 	}
 }
 
-#define console_write(msg)	uart_write(msg)
+static void console_write(const char *msg)
+{
+	if (printk_ring)
+		printk_ring_write(msg);
+	else if (printk_ivshmem)
+		printk_ivshmem_write(msg);
+	else
+		uart_write(msg);
+}
+
 #include "../../../hypervisor/printk-core.c"
 
+static void uart_init(void)
+{
+	outb(UART_LCR_DLAB, printk_uart_base + UART_LCR);
+#ifdef CONFIG_UART_OXPCIE952
+	outb(0x22, printk_uart_base + UART_DLL);
+#else
+	outb(1, printk_uart_base + UART_DLL);
+#endif
+	outb(0, printk_uart_base + UART_DLM);
+	outb(UART_LCR_8N1, printk_uart_base + UART_LCR);
+}
+
 void printk(const char *fmt, ...)
 {
 	static bool inited;
@@ -51,14 +73,14 @@ void printk(const char *fmt, ...)
 
 	if (!inited) {
 		inited = true;
-		outb(UART_LCR_DLAB, printk_uart_base + UART_LCR);
-#ifdef CONFIG_UART_OXPCIE952
-		outb(0x22, printk_uart_base + UART_DLL);
-#else
-		outb(1, printk_uart_base + UART_DLL);  
+		if (printk_ring_init()) {
+#ifdef __x86_64__
+			map_range(printk_ring, sizeof(struct jailhouse_console),
+				  MAP_CACHED);
 #endif
-		outb(0, printk_uart_base + UART_DLM);
-		outb(UART_LCR_8N1, printk_uart_base + UART_LCR);
+		} else if (!printk_ivshmem_init()) {
+			uart_init();
+		}
 	}
 
 	va_start(ap, fmt);
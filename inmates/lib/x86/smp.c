@@ -15,7 +15,10 @@
 #define APIC_DM_INIT	(5 << 8)
 #define APIC_DM_SIPI	(6 << 8)
 
+#define AP_STACK_SIZE	(16 * 1024)
+
 extern void (* volatile ap_entry)(void);
+extern void *ap_stack;
 
 void smp_wait_for_all_cpus(void)
 {
@@ -27,6 +30,10 @@ void smp_start_cpu(unsigned int cpu_id, void (*entry)(void))
 {
 	u64 base_val = ((u64)cpu_id << 32) | APIC_LVL_ASSERT;
 
+#ifdef __x86_64__
+	/* APs started earlier may still run, so each gets its own stack */
+	ap_stack = (char *)alloc(AP_STACK_SIZE, PAGE_SIZE) + AP_STACK_SIZE;
+#endif
 	ap_entry = entry;
 
 	write_msr(X2APIC_ICR, base_val | APIC_DM_INIT);
@@ -20,63 +20,120 @@
 #define X2APIC_TMCCT		0x839
 #define X2APIC_TDCR		0x83e
 
+#define TSC_CALIBRATION_MS	500
+#define TSC_CALIBRATION_MAX_MS	2000
+
+/* nanoseconds = (cycles * tsc_mult) >> TSC_SHIFT */
+#define TSC_SHIFT		32
+
 static unsigned long divided_apic_freq;
 static unsigned long pm_timer_last[SMP_MAX_CPUS];
 static unsigned long pm_timer_overflows[SMP_MAX_CPUS];
-static unsigned long tsc_freq, tsc_overflow;
-static unsigned long tsc_last[SMP_MAX_CPUS];
-static unsigned long tsc_overflows[SMP_MAX_CPUS];
+static unsigned long tsc_freq;
+static u64 tsc_base, tsc_mult;
 
 static u64 rdtsc(void)
 {
-#ifdef __x86_64__
 	u32 lo, hi;
 
 	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
 	return (u64)lo | (((u64)hi) << 32);
-#else
-	u64 v;
+}
 
-	asm volatile("rdtsc" : "=A" (v));
-	return v;
-#endif
+static void cpuid(u32 leaf, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx)
+{
+	asm volatile("cpuid"
+		: "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+		: "a" (leaf), "c" (0)
+		: "memory");
 }
 
+u64 tsc_cycles_to_ns(u64 cycles)
+{
+	return ((unsigned __int128)cycles * tsc_mult) >> TSC_SHIFT;
+}
+
+/*
+ * Nanoseconds since tsc_init, based on the full 64-bit TSC. It takes no
+ * division and keeps no per-CPU state, so it can be used from any CPU and
+ * from interrupt handlers.
+ */
 unsigned long tsc_read(void)
 {
-	unsigned int cpu = cpu_id();
-	unsigned long tmr;
+	return tsc_cycles_to_ns(rdtsc() - tsc_base);
+}
+
+/* TSC to crystal clock ratio and crystal frequency, as far as enumerated */
+static unsigned long tsc_freq_from_cpuid(void)
+{
+	u32 max_leaf, denominator, numerator, crystal_hz, edx;
+
+	cpuid(0, &max_leaf, &numerator, &crystal_hz, &edx);
+	if (max_leaf < 0x15)
+		return 0;
 
-	tmr = ((rdtsc() & 0xffffffffLL) * NS_PER_SEC) / tsc_freq;
-	if (tmr < tsc_last[cpu])
-		tsc_overflows[cpu] += tsc_overflow;
-	tsc_last[cpu] = tmr;
-	return tmr + tsc_overflows[cpu];
+	cpuid(0x15, &denominator, &numerator, &crystal_hz, &edx);
+	if (denominator == 0 || numerator == 0 || crystal_hz == 0)
+		return 0;
+
+	return (u64)crystal_hz * numerator / denominator;
 }
 
-unsigned long tsc_init(void)
+/*
+ * Read the PM timer right after it ticked, together with the TSC in the
+ * middle of the access.
+ */
+static unsigned long pm_timer_sample(u64 *tsc)
+{
+	unsigned long start = pm_timer_read(), pm;
+	u64 before, after;
+
+	do {
+		before = rdtsc();
+		pm = pm_timer_read();
+		after = rdtsc();
+	} while (pm == start);
+
+	*tsc = before + (after - before) / 2;
+	return pm;
+}
+
+static unsigned long tsc_freq_from_pm_timer(void)
 {
-	unsigned long start_pm, end_pm;
+	unsigned long window, start_pm, end_pm;
 	u64 start_tsc, end_tsc;
 
-	tsc_freq = cmdline_parse_int("tsc_freq", 0);
+	window = cmdline_parse_int("tsc_calibration_ms", TSC_CALIBRATION_MS);
+	if (window == 0 || window > TSC_CALIBRATION_MAX_MS)
+		window = TSC_CALIBRATION_MS;
 
-	if (tsc_freq == 0) {
-		start_pm = pm_timer_read();
-		start_tsc = rdtsc();
-		asm volatile("mfence" : : : "memory");
+	start_pm = pm_timer_sample(&start_tsc);
+	do
+		end_pm = pm_timer_sample(&end_tsc);
+	while (end_pm - start_pm < window * NS_PER_MSEC);
 
-		while (pm_timer_read() - start_pm < 100 * NS_PER_MSEC)
-			cpu_relax();
+	return (end_tsc - start_tsc) * NS_PER_SEC / (end_pm - start_pm);
+}
 
-		end_pm = pm_timer_read();
-		end_tsc = rdtsc();
-		asm volatile("mfence" : : : "memory");
+/*
+ * Determine the TSC frequency, in this order, from the command line
+ * parameter tsc_freq, from the clock in the communication region, from CPUID
+ * leaf 0x15 or by calibrating against the PM timer for tsc_calibration_ms
+ * (default 500). This also resets tsc_read to 0.
+ */
+unsigned long tsc_init(void)
+{
+	tsc_freq = cmdline_parse_int("tsc_freq", 0);
 
-		tsc_freq = (end_tsc - start_tsc) * NS_PER_SEC / (end_pm - start_pm);
-	}
+	if (tsc_freq == 0)
+		tsc_freq = comm_ext->clock.frequency_khz * 1000;
+	if (tsc_freq == 0)
+		tsc_freq = tsc_freq_from_cpuid();
+	if (tsc_freq == 0)
+		tsc_freq = tsc_freq_from_pm_timer();
 
-	tsc_overflow = (0x100000000L * NS_PER_SEC) / tsc_freq;
+	tsc_mult = (NS_PER_SEC << TSC_SHIFT) / tsc_freq;
+	tsc_base = rdtsc();
 
 	return tsc_freq;
 }
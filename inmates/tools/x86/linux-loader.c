@@ -13,6 +13,10 @@
 #include <inmate.h>
 
 #define ZERO_PAGE_ADDR		0xf5000UL
+/* identity map of the kernel, prepared by the jailhouse tool if non-zero */
+#define PAGE_TABLES_ADDR	0xf7000UL
+
+#define PG_PRESENT		0x01
 
 struct boot_params {
 	u8	padding1[0x230];
@@ -35,13 +39,18 @@ struct setup_data {
 void inmate_main(void)
 {
 	struct boot_params *boot_params = (struct boot_params *)ZERO_PAGE_ADDR;
+	unsigned long *pml4 = (unsigned long *)PAGE_TABLES_ADDR;
 	void (*entry)(int, struct boot_params *);
 	struct setup_data *setup_data;
 	void *kernel;
 
 	kernel = (void *)(unsigned long)boot_params->kernel_alignment;
 
-	map_range(kernel, boot_params->init_size, MAP_CACHED);
+	/* the prebuilt tables also cover the loader and the parameters */
+	if (pml4[0] & PG_PRESENT)
+		asm volatile("mov %0,%%cr3" : : "r" (PAGE_TABLES_ADDR));
+	else
+		map_range(kernel, boot_params->init_size, MAP_CACHED);
 
 	setup_data = (struct setup_data *)boot_params->setup_data;
 	setup_data->pm_timer_address = comm_region->pm_timer_address;
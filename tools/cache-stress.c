@@ -0,0 +1,116 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Cache and memory stressor for the root cell, companion of the cache-bench
+ * inmate. It sweeps over a buffer larger than the last-level cache and
+ * reports the achieved throughput once per second. Start one instance per
+ * root cell CPU to be loaded (e.g. pinned via taskset).
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#define CACHE_LINE_SIZE		64
+
+static void __attribute__((noreturn)) help(char *prog, int exit_status)
+{
+	printf("Usage: %s [-s | --size MB] [-t | --time SECONDS] "
+	       "[-r | --read-only]\n"
+	       "\nDefaults: 64 MB buffer, run until interrupted, read and "
+	       "write each\ncache line\n", prog);
+	exit(exit_status);
+}
+
+static unsigned long long ns_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sweep(volatile unsigned long *buffer, size_t size, bool read_only)
+{
+	size_t step = CACHE_LINE_SIZE / sizeof(*buffer);
+	size_t n, words = size / sizeof(*buffer);
+
+	for (n = 0; n < words; n += step)
+		if (read_only)
+			(void)buffer[n];
+		else
+			buffer[n]++;
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option options[] = {
+		{ "size", required_argument, NULL, 's' },
+		{ "time", required_argument, NULL, 't' },
+		{ "read-only", no_argument, NULL, 'r' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	unsigned long long start, last, now, bytes = 0;
+	unsigned long seconds = 0;
+	bool read_only = false;
+	size_t size = 64;
+	void *buffer;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "s:t:rh", options,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			read_only = true;
+			break;
+		case 'h':
+			help(argv[0], 0);
+		default:
+			help(argv[0], 1);
+		}
+	}
+	if (optind != argc || size == 0)
+		help(argv[0], 1);
+
+	size *= 1024 * 1024;
+	buffer = malloc(size);
+	if (!buffer) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+	/* populate the buffer before measuring */
+	memset(buffer, 0, size);
+
+	start = last = ns_now();
+	do {
+		sweep(buffer, size, read_only);
+		bytes += size;
+
+		now = ns_now();
+		if (now - last >= 1000000000ULL) {
+			printf("%.1f MB/s\n", (double)bytes * 1000 / (now - last));
+			fflush(stdout);
+			bytes = 0;
+			last = now;
+		}
+	} while (seconds == 0 || now - start < seconds * 1000000000ULL);
+
+	free(buffer);
+
+	return 0;
+}
@@ -0,0 +1,337 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2016
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Linux side of the inter-cell benchmark. It talks to the ivshmem-bench
+ * inmate via /dev/jailhouse-queue<n> and reports doorbell latencies and
+ * streaming bandwidth, in interrupt and in polling mode, as CSV lines.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <x86intrin.h>
+
+#define DEFAULT_DEVICE		"/dev/jailhouse-queue0"
+#define MAX_MSG_SIZE		4096
+
+/* keep in sync with inmates/demos/x86/ivshmem-bench.c */
+enum bench_msg_type {
+	BENCH_PING = 1,
+	BENCH_PONG,
+	BENCH_DATA,
+	BENCH_END,
+	BENCH_STATS,
+	BENCH_MODE,
+};
+
+struct bench_msg {
+	unsigned int type;
+	unsigned int seq;
+	unsigned long long tx_tsc;
+	unsigned long long rx_tsc;
+	unsigned long long value[2];
+} __attribute__((packed));
+
+enum bench_mode { MODE_IRQ, MODE_POLL };
+
+static const char *mode_names[] = { "irq", "poll" };
+
+static double tsc_per_ns;
+static int dev_fd;
+static enum bench_mode mode;
+
+static void __attribute__((noreturn)) help(char *prog, int exit_status)
+{
+	printf("Usage: %s [-d | --device DEVICE] [-n | --samples N]\n"
+	       "       [-m | --messages N] [-M | --mode { irq | poll }]\n"
+	       "\nDefaults: device " DEFAULT_DEVICE ", 10000 latency samples, "
+	       "100000 messages\nper bandwidth test, both modes\n", prog);
+	exit(exit_status);
+}
+
+static unsigned long long ns_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void calibrate_tsc(void)
+{
+	unsigned long long start_ns, start_tsc;
+	struct timespec delay = { .tv_nsec = 100000000 };
+
+	start_ns = ns_now();
+	start_tsc = __rdtsc();
+	nanosleep(&delay, NULL);
+	tsc_per_ns = (double)(__rdtsc() - start_tsc) / (ns_now() - start_ns);
+}
+
+static unsigned long long tsc_to_ns(long long cycles)
+{
+	return cycles < 0 ? 0 : cycles / tsc_per_ns;
+}
+
+static void set_nonblock(bool nonblock)
+{
+	int flags = fcntl(dev_fd, F_GETFL);
+
+	if (flags < 0 || fcntl(dev_fd, F_SETFL, nonblock ?
+			       flags | O_NONBLOCK : flags & ~O_NONBLOCK) < 0) {
+		perror("fcntl");
+		exit(1);
+	}
+}
+
+/* in polling mode, the device is non-blocking and we spin on EAGAIN */
+static void send_msg(const void *msg, size_t len)
+{
+	ssize_t ret;
+
+	do {
+		ret = write(dev_fd, msg, len);
+	} while (ret < 0 && (errno == EAGAIN || errno == EINTR));
+
+	if (ret != (ssize_t)len) {
+		perror("writing message");
+		exit(1);
+	}
+}
+
+static void receive_msg(struct bench_msg *msg, unsigned int type)
+{
+	ssize_t ret;
+
+	do {
+		do {
+			ret = read(dev_fd, msg, sizeof(*msg));
+		} while (ret < 0 && (errno == EAGAIN || errno == EINTR));
+
+		if (ret < 0) {
+			perror("reading message");
+			exit(1);
+		}
+	} while (ret < (ssize_t)sizeof(*msg) || msg->type != type);
+}
+
+static void set_mode(enum bench_mode new_mode)
+{
+	struct bench_msg msg = {
+		.type = BENCH_MODE,
+		.value[0] = new_mode == MODE_POLL,
+	};
+
+	mode = new_mode;
+	set_nonblock(mode == MODE_POLL);
+
+	send_msg(&msg, sizeof(msg));
+	receive_msg(&msg, BENCH_MODE);
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char *metric, unsigned long long *samples,
+		   unsigned int num)
+{
+	qsort(samples, num, sizeof(*samples), compare_samples);
+	printf("latency,%s,%s,%u,%llu,%llu,%llu,%llu\n", mode_names[mode],
+	       metric, num, samples[0], samples[num / 2],
+	       samples[num * 99 / 100], samples[num - 1]);
+}
+
+static void bench_latency(unsigned int num)
+{
+	unsigned long long *rtt, *to_cell, *from_cell, start, end;
+	struct bench_msg msg;
+	unsigned int n;
+
+	rtt = calloc(num, sizeof(*rtt));
+	to_cell = calloc(num, sizeof(*to_cell));
+	from_cell = calloc(num, sizeof(*from_cell));
+	if (!rtt || !to_cell || !from_cell) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	for (n = 0; n < num; n++) {
+		memset(&msg, 0, sizeof(msg));
+		msg.type = BENCH_PING;
+		msg.seq = n;
+
+		start = __rdtsc();
+		msg.tx_tsc = start;
+		send_msg(&msg, sizeof(msg));
+		receive_msg(&msg, BENCH_PONG);
+		end = __rdtsc();
+
+		rtt[n] = tsc_to_ns(end - start);
+		to_cell[n] = tsc_to_ns(msg.rx_tsc - start);
+		from_cell[n] = tsc_to_ns(end - msg.tx_tsc);
+	}
+
+	report("round_trip", rtt, num);
+	report("one_way_to_cell", to_cell, num);
+	report("one_way_from_cell", from_cell, num);
+
+	free(rtt);
+	free(to_cell);
+	free(from_cell);
+}
+
+static void bench_bandwidth(size_t size, unsigned int num)
+{
+	static char buffer[MAX_MSG_SIZE];
+	struct bench_msg *data = (struct bench_msg *)buffer;
+	unsigned long long start, duration, cell_ns;
+	struct bench_msg stats = { .type = BENCH_END };
+	unsigned int n;
+
+	data->type = BENCH_DATA;
+
+	start = ns_now();
+	for (n = 0; n < num; n++) {
+		data->seq = n;
+		send_msg(data, size);
+	}
+	send_msg(&stats, sizeof(stats));
+	receive_msg(&stats, BENCH_STATS);
+	duration = ns_now() - start;
+
+	cell_ns = tsc_to_ns(stats.tx_tsc - stats.rx_tsc);
+	printf("bandwidth,%s,%zu,%llu,%.1f,%.1f,%.0f\n", mode_names[mode],
+	       size, stats.value[1],
+	       (double)stats.value[0] * 1000 / duration,
+	       cell_ns ? (double)stats.value[0] * 1000 / cell_ns : 0.0,
+	       (double)stats.value[1] * 1e9 / duration);
+}
+
+/* the largest message the transmit queue accepts */
+static size_t probe_max_size(void)
+{
+	static char buffer[MAX_MSG_SIZE];
+	struct bench_msg *data = (struct bench_msg *)buffer;
+	size_t size = MAX_MSG_SIZE;
+
+	data->type = BENCH_DATA;
+	while (size > sizeof(*data)) {
+		if (write(dev_fd, data, size) == (ssize_t)size)
+			return size;
+		if (errno != EMSGSIZE && errno != EAGAIN && errno != EINTR) {
+			perror("writing message");
+			exit(1);
+		}
+		if (errno == EMSGSIZE)
+			size -= 8;
+	}
+	return size;
+}
+
+static void run(enum bench_mode bench_mode, unsigned int samples,
+		unsigned int messages, size_t max_size)
+{
+	struct bench_msg stats = { .type = BENCH_END };
+	size_t size;
+
+	set_mode(bench_mode);
+
+	bench_latency(samples);
+
+	/* reset the counters of the cell */
+	send_msg(&stats, sizeof(stats));
+	receive_msg(&stats, BENCH_STATS);
+
+	for (size = 8; size < max_size; size *= 2)
+		bench_bandwidth(size, messages);
+	bench_bandwidth(max_size, messages);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option options[] = {
+		{ "device", required_argument, NULL, 'd' },
+		{ "samples", required_argument, NULL, 'n' },
+		{ "messages", required_argument, NULL, 'm' },
+		{ "mode", required_argument, NULL, 'M' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	unsigned int samples = 10000, messages = 100000;
+	const char *device = DEFAULT_DEVICE;
+	bool run_irq = true, run_poll = true;
+	size_t max_size;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "d:n:m:M:h", options,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			samples = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			messages = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			run_irq = strcmp(optarg, "irq") == 0;
+			run_poll = strcmp(optarg, "poll") == 0;
+			if (!run_irq && !run_poll)
+				help(argv[0], 1);
+			break;
+		case 'h':
+			help(argv[0], 0);
+		default:
+			help(argv[0], 1);
+		}
+	}
+	if (optind != argc || samples == 0 || messages == 0)
+		help(argv[0], 1);
+
+	dev_fd = open(device, O_RDWR);
+	if (dev_fd < 0) {
+		fprintf(stderr, "opening %s: %s\n", device, strerror(errno));
+		exit(1);
+	}
+
+	calibrate_tsc();
+
+	/* the probe message is counted, the first run resets the counters */
+	max_size = probe_max_size();
+
+	printf("# ivshmem-bench: tsc_khz=%.0f max_msg_size=%zu\n",
+	       tsc_per_ns * 1e6, max_size);
+	printf("# latency,mode,metric,samples,min_ns,median_ns,p99_ns,"
+	       "max_ns\n");
+	printf("# bandwidth,mode,msg_size,messages,mb_per_s,cell_mb_per_s,"
+	       "msgs_per_s\n");
+
+	if (run_irq)
+		run(MODE_IRQ, samples, messages, max_size);
+	if (run_poll)
+		run(MODE_POLL, samples, messages, max_size);
+
+	close(dev_fd);
+
+	return 0;
+}
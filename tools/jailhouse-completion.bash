@@ -175,7 +175,7 @@ function _jailhouse_cell() {
 			# did we already start to type string switch?
 			if [[ "${COMP_CWORD}" -eq 4 && "$cur" == -* ]]; then
 				COMPREPLY=( $( compgen \
-					-W "-s --string" -- \
+					-W "-s --string -z --gzip" -- \
 					"${cur}") )
 			fi
 
@@ -185,20 +185,25 @@ function _jailhouse_cell() {
 
 		# the first image or string have to be given, after that it is:
 		#
-		# [{image | <-s|--string> string} [<-a|--address> <address>]
-		#  [{image | <-s|--string> string} [...] ... ]]
+		# [{image | <-s|--string> string | <-z|--gzip> image}
+		#  [<-a|--address> <address>] [{...} [...] ... ]]
 
 		# prev was an address or a string switch, no image here
 		if [[ "${prev}" = "-a" || "${prev}" = "--address" ||
 		      "${prev}" = "-s" || "${prev}" = "--string" ]]; then
 			return 0
 
+		# prev was a gzip switch, an image follows
+		elif [[ "${prev}" = "-z" || "${prev}" = "--gzip" ]]; then
+			_filedir
+			return 0
+
 		# prev was an image, a string or an address-number
 		else
 			# did we already start to type another switch
 			if [[ "$cur" == -* ]]; then
 				COMPREPLY=( $( compgen \
-					-W "-a --address -s --string" -- \
+					-W "-a --address -s --string -z --gzip" -- \
 					"${cur}") )
 			fi
 
@@ -220,9 +225,24 @@ function _jailhouse_cell() {
 		# takes only one argument (id/name)
 		_jailhouse_get_id "${cur}" "${prev}" || return 1
 		;;
+	set-cache)
+		# id/name, followed by start and size of the partition
+		if [ "${COMP_CWORD}" -eq 3 ]; then
+			_jailhouse_get_id "${cur}" "${prev}" || return 1
+		fi
+		;;
+	add-cpu|remove-cpu|add-memory|remove-memory)
+		# id/name, followed by the CPU or memory region number
+		if [ "${COMP_CWORD}" -eq 3 ]; then
+			_jailhouse_get_id "${cur}" "${prev}" || return 1
+		fi
+		;;
 	linux)
 		_jailhouse_cell_linux || return 1
 		;;
+	snapshot)
+		# takes no arguments
+		return 1;;
 	list)
 		# list all cells
 
@@ -254,7 +274,7 @@ function _jailhouse_config_create() {
 	prev="${COMP_WORDS[COMP_CWORD-1]}"
 
 	options="-h --help -g --generate-collector -r --root -t --template-dir \
-		--mem-inmates --mem-hv"
+		--mem-inmates --mem-hv --minimal --no-optimize"
 
 	# if we already have begun to write an option
 	if [[ "$cur" == -* ]]; then
@@ -281,6 +301,47 @@ function _jailhouse_config_create() {
 	return 0
 }
 
+function _jailhouse_config_create_cell() {
+	local cur prev
+
+	cur="${COMP_WORDS[COMP_CWORD]}"
+	prev="${COMP_WORDS[COMP_CWORD-1]}"
+
+	options="-h --help -r --root -t --template-dir -n --name -c --cpus \
+		-m --mem -d --device -i --isolation --cell"
+
+	# if we already have begun to write an option
+	if [[ "$cur" == -* ]]; then
+		COMPREPLY=( $( compgen -W "${options}" -- "${cur}") )
+	else
+		# if the previous was on of the following options
+		case "${prev}" in
+		-r|--root|-t|--template-dir)
+			_filedir -d
+			return $?
+			;;
+		-i|--isolation)
+			COMPREPLY=( $( compgen -W "shared cache strict" -- \
+					"${cur}") )
+			return 0
+			;;
+		-n|--name|-c|--cpus|-m|--mem|-d|--device)
+			# we can't really predict this
+			return 0
+			;;
+		--cell)
+			_filedir "cell"
+			return $?
+			;;
+		esac
+
+		# the system configuration, then the target-filename
+		_filedir
+	fi
+
+	return 0
+}
+
 function _jailhouse() {
 	# returns two value: - numeric from "return" (success/failure)
 	#                    - ${COMPREPLY}; an bash-array from which bash will
@@ -290,11 +351,12 @@ function _jailhouse() {
 	local command command_cell command_config cur prev subcommand
 
 	# first level
-	command="enable disable cell config hardware --help"
+	command="enable disable cell config hardware hypervisor --help"
 
 	# second level
-	command_cell="create load start shutdown destroy linux list stats"
-	command_config="create collect"
+	command_cell="create load start shutdown destroy set-cache add-cpu \
+		remove-cpu add-memory remove-memory snapshot linux list stats"
+	command_config="create create-cell collect check"
 
 	# ${COMP_WORDS} array containing the words on the current command line
 	# ${COMP_CWORD} index into COMP_WORDS, pointing at the current position
@@ -334,6 +396,9 @@ function _jailhouse() {
 		hardware)
 			COMPREPLY="check"
 			;;
+		hypervisor)
+			COMPREPLY="profile"
+			;;
 		--help|disable)
 			# these first level commands have no further subcommand
 			# or option OR we don't even know it
@@ -365,6 +430,13 @@ function _jailhouse() {
 
 				_filedir
 				;;
+			create-cell)
+				_jailhouse_config_create_cell || return 1
+				;;
+			check)
+				# the system configuration, then cell configurations
+				_filedir "cell"
+				;;
 			*)
 				return 1;;
 			esac
@@ -381,6 +453,21 @@ function _jailhouse() {
 				return 1;;
 			esac
 			;;
+		hypervisor)
+			case "${subcommand}" in
+			profile)
+				# the hypervisor ELF, followed by options
+				if [ "${COMP_CWORD}" -eq 3 ]; then
+					_filedir "o"
+				else
+					COMPREPLY=( $( compgen -W "-d --duration \
+						-f --format" -- "${cur}") )
+				fi
+				;;
+			*)
+				return 1;;
+			esac
+			;;
 		*)
 			# no further subsubcommand/option known for this
 			return 1;;
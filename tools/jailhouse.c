@@ -21,9 +21,13 @@
 #include <libgen.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <stddef.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 
 #include <jailhouse.h>
+#include <jailhouse/cell-config.h>
 
 #define JAILHOUSE_EXEC_DIR	LIBEXECDIR "/jailhouse"
 
@@ -38,12 +42,21 @@ static const struct extension extensions[] = {
 	  "              [-c | --cmdline \"STRING\"] "
 					"[-w | --write-params FILE]" },
 	{ "cell", "list", "" },
-	{ "cell", "stats", "{ ID | [--name] NAME }" },
+	{ "cell", "stats", "{ ID | [--name] NAME } [-i | --interval SECONDS]\n"
+	  "              [-f | --format { csv | json }] [-c | --count N]" },
 	{ "config", "create", "[-h] [-g] [-r ROOT] "
 	  "[--mem-inmates MEM_INMATES]\n"
-	  "                 [--mem-hv MEM_HV] FILE" },
+	  "                 [--mem-hv MEM_HV] [--minimal] [--no-optimize] "
+	  "FILE" },
+	{ "config", "create-cell", "[-h] [-r ROOT] -n NAME -c CPUS -m MEM\n"
+	  "                      [-d DEVICE ...] "
+	  "[-i { shared | cache | strict }]\n"
+	  "                      [--cell CELLCONFIG ...] SYSCONFIG FILE" },
 	{ "config", "collect", "FILE.TAR" },
+	{ "config", "check", "SYSCONFIG [CELLCONFIG ...]" },
 	{ "hardware", "check", "SYSCONFIG" },
+	{ "hypervisor", "profile", "HYPERVISOR_ELF [-d | --duration SECONDS]\n"
+	  "                       [-f | --format { folded | samples }]" },
 	{ NULL }
 };
 
@@ -57,11 +70,18 @@ static void __attribute__((noreturn)) help(char *prog, int exit_status)
 	       "   disable\n"
 	       "   cell create CELLCONFIG\n"
 	       "   cell load { ID | [--name] NAME } "
-				"{ IMAGE | { -s | --string } \"STRING\" }\n"
+				"{ IMAGE | { -s | --string } \"STRING\" |\n"
+	       "             { -z | --gzip } IMAGE }\n"
 	       "             [-a | --address ADDRESS] ...\n"
-	       "   cell start { ID | [--name] NAME }\n"
+	       "   cell start { ID | [--name] NAME } ...\n"
 	       "   cell shutdown { ID | [--name] NAME }\n"
-	       "   cell destroy { ID | [--name] NAME }\n",
+	       "   cell destroy { ID | [--name] NAME }\n"
+	       "   cell set-cache { ID | [--name] NAME } START SIZE\n"
+	       "   cell add-cpu { ID | [--name] NAME } CPU\n"
+	       "   cell remove-cpu { ID | [--name] NAME } CPU\n"
+	       "   cell add-memory { ID | [--name] NAME } REGION\n"
+	       "   cell remove-memory { ID | [--name] NAME } REGION\n"
+	       "   cell snapshot\n",
 	       basename(prog));
 	for (ext = extensions; ext->cmd; ext++)
 		printf("   %s %s %s\n", ext->cmd, ext->subcmd, ext->help);
@@ -160,6 +180,101 @@ static void *read_file(const char *name, size_t *size)
 	return buffer;
 }
 
+/*
+ * Read an image file straight into the cell's memory via a mapping of its
+ * loadable region. The cell has to be in loadable state on the passed file.
+ */
+static int load_file(int dev_fd, const char *name,
+		     unsigned long long target_address)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	unsigned long page_offs = target_address & (page_size - 1);
+	size_t map_size, done;
+	struct stat stat;
+	ssize_t count;
+	char *mem;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "opening %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+
+	if (fstat(fd, &stat) < 0) {
+		perror("fstat");
+		exit(1);
+	}
+
+	if (stat.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	map_size = page_offs + stat.st_size;
+	mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, dev_fd,
+		   target_address - page_offs);
+	if (mem == MAP_FAILED) {
+		fprintf(stderr, "mapping cell memory for %s: %s\n", name,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	for (done = 0; done < (size_t)stat.st_size; done += count) {
+		count = read(fd, mem + page_offs + done, stat.st_size - done);
+		if (count <= 0) {
+			fprintf(stderr, "reading %s: %s\n", name,
+				count < 0 ? strerror(errno) : "short read");
+			exit(1);
+		}
+	}
+
+	munmap(mem, map_size);
+	close(fd);
+
+	return 0;
+}
+
+/* compressed images are inflated by the driver, directly into cell memory */
+static int load_gzip_file(int dev_fd, const struct jailhouse_cell_id *cell_id,
+			  const char *name, unsigned long long target_address)
+{
+	struct {
+		struct jailhouse_cell_load_fd hdr;
+		struct jailhouse_preload_file file;
+	} cell_load;
+	struct stat stat;
+	int err, fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "opening %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+
+	if (fstat(fd, &stat) < 0) {
+		perror("fstat");
+		exit(1);
+	}
+
+	memset(&cell_load, 0, sizeof(cell_load));
+	cell_load.hdr.cell_id = *cell_id;
+	cell_load.hdr.num_preload_files = 1;
+	cell_load.file.fd = fd;
+	cell_load.file.flags = JAILHOUSE_PRELOAD_GZIP;
+	cell_load.file.size = stat.st_size;
+	cell_load.file.target_address = target_address;
+
+	err = ioctl(dev_fd, JAILHOUSE_CELL_LOAD_FD, &cell_load);
+	if (err)
+		fprintf(stderr, "loading %s: %s\n", name, strerror(errno));
+
+	close(fd);
+
+	return err;
+}
+
 static int enable(int argc, char *argv[])
 {
 	void *config;
@@ -251,11 +366,14 @@ static bool match_opt(const char *argv, const char *short_opt,
 static int cell_shutdown_load(int argc, char *argv[],
 			      enum shutdown_load_mode mode)
 {
+	unsigned long long target_address;
 	struct jailhouse_preload_image *image;
 	struct jailhouse_cell_load *cell_load;
 	struct jailhouse_cell_id cell_id;
 	int err, fd, id_args, arg_num;
 	unsigned int images, n;
+	const char *file;
+	bool gzip;
 	size_t size;
 	char *endp;
 
@@ -265,15 +383,20 @@ static int cell_shutdown_load(int argc, char *argv[],
 	    (mode == LOAD && arg_num == argc))
 		help(argv[0], 1);
 
+	/* only strings are passed along, files are loaded via mmap */
 	images = 0;
 	while (arg_num < argc) {
 		if (match_opt(argv[arg_num], "-s", "--string")) {
 			if (arg_num + 1 >= argc)
 				help(argv[0], 1);
 			arg_num++;
+			images++;
+		} else if (match_opt(argv[arg_num], "-z", "--gzip")) {
+			if (arg_num + 1 >= argc)
+				help(argv[0], 1);
+			arg_num++;
 		}
 
-		images++;
 		arg_num++;
 
 		if (arg_num < argc &&
@@ -294,29 +417,30 @@ static int cell_shutdown_load(int argc, char *argv[],
 
 	arg_num = 3 + id_args;
 
-	for (n = 0, image = cell_load->image; n < images; n++, image++) {
-		if (match_opt(argv[arg_num], "-s", "--string")) {
+	for (n = 0, image = cell_load->image; n < images; arg_num++) {
+		if (match_opt(argv[arg_num], "-z", "--gzip")) {
 			arg_num++;
-			image->source_address =
-				(unsigned long)read_string(argv[arg_num++],
-							   &size);
-		} else {
-			image->source_address =
-				(unsigned long)read_file(argv[arg_num++],
-							 &size);
+			continue;
 		}
+		if (!match_opt(argv[arg_num], "-s", "--string"))
+			continue;
+		arg_num++;
+		image->source_address =
+			(unsigned long)read_string(argv[arg_num], &size);
 		image->size = size;
 		image->target_address = 0;
 
-		if (arg_num < argc &&
-		    match_opt(argv[arg_num], "-a", "--address")) {
+		if (arg_num + 1 < argc &&
+		    match_opt(argv[arg_num + 1], "-a", "--address")) {
 			errno = 0;
 			image->target_address =
-				strtoll(argv[arg_num + 1], &endp, 0);
+				strtoll(argv[arg_num + 2], &endp, 0);
 			if (errno != 0 || *endp != 0)
 				help(argv[0], 1);
 			arg_num += 2;
 		}
+		n++;
+		image++;
 	}
 
 	fd = open_dev();
@@ -325,6 +449,37 @@ static int cell_shutdown_load(int argc, char *argv[],
 	if (err)
 		perror("JAILHOUSE_CELL_LOAD");
 
+	arg_num = 3 + id_args;
+	while (!err && arg_num < argc) {
+		gzip = false;
+		if (match_opt(argv[arg_num], "-s", "--string")) {
+			arg_num += 2;
+			file = NULL;
+		} else if (match_opt(argv[arg_num], "-z", "--gzip")) {
+			file = argv[arg_num + 1];
+			arg_num += 2;
+			gzip = true;
+		} else {
+			file = argv[arg_num++];
+		}
+
+		target_address = 0;
+		if (arg_num < argc &&
+		    match_opt(argv[arg_num], "-a", "--address")) {
+			errno = 0;
+			target_address = strtoll(argv[arg_num + 1], &endp, 0);
+			if (errno != 0 || *endp != 0)
+				help(argv[0], 1);
+			arg_num += 2;
+		}
+
+		if (gzip)
+			err = load_gzip_file(fd, &cell_id, file,
+					     target_address);
+		else if (file)
+			err = load_file(fd, file, target_address);
+	}
+
 	close(fd);
 	for (n = 0, image = cell_load->image; n < images; n++, image++)
 		free((void *)(unsigned long)image->source_address);
@@ -357,6 +512,604 @@ static int cell_simple_cmd(int argc, char *argv[], unsigned int command)
 	return err;
 }
 
+static int cell_start(int argc, char *argv[])
+{
+	struct jailhouse_cell_start_multi *start_multi;
+	struct jailhouse_cell_id cell_id;
+	unsigned int num_cells = 0;
+	int arg_pos, id_args, err, fd;
+
+	if (argc < 4)
+		help(argv[0], 1);
+
+	/* a single cell is started the classic way */
+	if (parse_cell_id(&cell_id, argc - 3, &argv[3]) == argc - 3)
+		return cell_simple_cmd(argc, argv, JAILHOUSE_CELL_START);
+
+	start_multi = malloc(sizeof(*start_multi) +
+			     sizeof(start_multi->cell_id[0]) * (argc - 3));
+	if (!start_multi) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	for (arg_pos = 3; arg_pos < argc; arg_pos += id_args) {
+		id_args = parse_cell_id(&start_multi->cell_id[num_cells],
+					argc - arg_pos, &argv[arg_pos]);
+		if (id_args == 0)
+			help(argv[0], 1);
+		num_cells++;
+	}
+	start_multi->num_cells = num_cells;
+	start_multi->padding = 0;
+
+	fd = open_dev();
+
+	err = ioctl(fd, JAILHOUSE_CELL_START_MULTI, start_multi);
+	if (err)
+		perror("JAILHOUSE_CELL_START_MULTI");
+
+	close(fd);
+	free(start_multi);
+
+	return err;
+}
+
+static int cell_set_cache(int argc, char *argv[])
+{
+	struct jailhouse_cell_cache cell_cache;
+	int id_args, err, fd;
+	char *endp;
+
+	id_args = parse_cell_id(&cell_cache.cell_id, argc - 3, &argv[3]);
+	if (id_args == 0 || 3 + id_args + 2 != argc)
+		help(argv[0], 1);
+
+	errno = 0;
+	cell_cache.start = strtoul(argv[3 + id_args], &endp, 0);
+	if (errno != 0 || *endp != 0)
+		help(argv[0], 1);
+	cell_cache.size = strtoul(argv[4 + id_args], &endp, 0);
+	if (errno != 0 || *endp != 0)
+		help(argv[0], 1);
+
+	fd = open_dev();
+
+	err = ioctl(fd, JAILHOUSE_CELL_SET_CACHE, &cell_cache);
+	if (err)
+		perror("JAILHOUSE_CELL_SET_CACHE");
+
+	close(fd);
+
+	return err;
+}
+
+static int cell_move_cpu(int argc, char *argv[], unsigned int command)
+{
+	struct jailhouse_cell_cpu cell_cpu;
+	int id_args, err, fd;
+	char *endp;
+
+	id_args = parse_cell_id(&cell_cpu.cell_id, argc - 3, &argv[3]);
+	if (id_args == 0 || 3 + id_args + 1 != argc)
+		help(argv[0], 1);
+
+	errno = 0;
+	cell_cpu.cpu = strtoul(argv[3 + id_args], &endp, 0);
+	if (errno != 0 || *endp != 0)
+		help(argv[0], 1);
+	cell_cpu.padding = 0;
+
+	fd = open_dev();
+
+	err = ioctl(fd, command, &cell_cpu);
+	if (err)
+		perror(command == JAILHOUSE_CELL_ADD_CPU ?
+		       "JAILHOUSE_CELL_ADD_CPU" : "JAILHOUSE_CELL_REMOVE_CPU");
+
+	close(fd);
+
+	return err;
+}
+
+static int cell_set_memory(int argc, char *argv[], unsigned int command)
+{
+	struct jailhouse_cell_memory cell_mem;
+	int id_args, err, fd;
+	char *endp;
+
+	id_args = parse_cell_id(&cell_mem.cell_id, argc - 3, &argv[3]);
+	if (id_args == 0 || 3 + id_args + 1 != argc)
+		help(argv[0], 1);
+
+	errno = 0;
+	cell_mem.region = strtoul(argv[3 + id_args], &endp, 0);
+	if (errno != 0 || *endp != 0)
+		help(argv[0], 1);
+	cell_mem.padding = 0;
+
+	fd = open_dev();
+
+	err = ioctl(fd, command, &cell_mem);
+	if (err)
+		perror(command == JAILHOUSE_CELL_ADD_MEMORY ?
+		       "JAILHOUSE_CELL_ADD_MEMORY" :
+		       "JAILHOUSE_CELL_REMOVE_MEMORY");
+
+	close(fd);
+
+	return err;
+}
+
+static const char *cell_state_name(unsigned int state)
+{
+	/* ordered like the JAILHOUSE_CELL_* states of the hypervisor */
+	static const char *const names[] = {
+		"running", "running/locked", "shut down", "failed",
+	};
+
+	return state < 4 ? names[state] : "invalid";
+}
+
+static void print_cpu_array(const char *key, const __u64 *cpus)
+{
+	const char *sep = "";
+	unsigned int cpu;
+
+	printf(",\"%s\":[", key);
+	for (cpu = 0; cpu < JAILHOUSE_SNAPSHOT_MAX_CPUS; cpu++)
+		if (cpus[cpu / 64] & (1ULL << (cpu % 64))) {
+			printf("%s%u", sep, cpu);
+			sep = ",";
+		}
+	printf("]");
+}
+
+/* Prints one JSON object per cell and line, taken in a single ioctl. */
+static int cell_snapshot(int argc, char *argv[])
+{
+	struct jailhouse_cell_snapshot *cells = NULL, *cell;
+	struct jailhouse_snapshot snapshot;
+	unsigned int n, stat;
+	int err, fd;
+	char *c;
+
+	if (argc != 3)
+		help(argv[0], 1);
+
+	fd = open_dev();
+
+	snapshot.num_cells = 8;
+	do {
+		free(cells);
+		snapshot.max_cells = snapshot.num_cells;
+		cells = malloc(sizeof(*cells) * snapshot.max_cells);
+		if (!cells) {
+			fprintf(stderr, "insufficient memory\n");
+			exit(1);
+		}
+		snapshot.cells_address = (unsigned long)cells;
+		snapshot.padding = 0;
+
+		err = ioctl(fd, JAILHOUSE_SNAPSHOT, &snapshot);
+		if (err) {
+			perror("JAILHOUSE_SNAPSHOT");
+			goto out;
+		}
+	} while (snapshot.num_cells > snapshot.max_cells);
+
+	for (n = 0, cell = cells; n < snapshot.num_cells; n++, cell++) {
+		printf("{\"id\":%d,\"name\":\"", cell->id);
+		for (c = cell->name; *c && c < cell->name + sizeof(cell->name);
+		     c++)
+			if (*c == '"' || *c == '\\')
+				printf("\\%c", *c);
+			else if ((unsigned char)*c < 0x20)
+				printf("\\u%04x", *c);
+			else
+				putchar(*c);
+		printf("\",\"state\":\"%s\"", cell_state_name(cell->state));
+		print_cpu_array("cpus_assigned", cell->cpus_assigned);
+		print_cpu_array("cpus_failed", cell->cpus_failed);
+		printf(",\"stats\":[");
+		for (stat = 0; stat < snapshot.num_stats; stat++)
+			printf("%s%llu", stat > 0 ? "," : "",
+			       (unsigned long long)cell->stats[stat]);
+		printf("]}\n");
+	}
+
+out:
+	close(fd);
+	free(cells);
+
+	return err;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Native boot of Linux cells, equivalent to jailhouse-cell-linux without
+ * --write-params. Kernel, initrd, linux-loader and the generated boot
+ * parameters are loaded into the cell via a single JAILHOUSE_CELL_LOAD_FD.
+ */
+#define LINUX_LOADER_ADDRESS	0xf0000
+#define LINUX_PARAMS_BASE	0xf5000
+/* within the loader image, below its reset vector */
+#define LINUX_PAGE_TABLES	0xf7000
+#define LINUX_MAX_PAGE_DIRS	6
+#define LINUX_MAX_CPUS		255
+#define LINUX_MAX_E820_ENTRIES	128
+
+/* zero page layout, see Documentation/x86/zero-page.txt of Linux */
+#define ZP_E820_ENTRIES		0x1e8
+#define ZP_SETUP_HEADER		0x1f0
+#define ZP_E820_TABLE		0x2d0
+#define ZP_SIZE			0x1000
+
+/* setup header fields, as offsets into the zero page */
+#define SH_SETUP_SECTS		0x1f1
+#define SH_SYSSIZE		0x1f4
+#define SH_JUMP			0x200
+#define SH_TYPE_OF_LOADER	0x210
+#define SH_RAMDISK_IMAGE	0x218
+#define SH_RAMDISK_SIZE		0x21c
+#define SH_CMD_LINE_PTR		0x228
+#define SH_KERNEL_ALIGNMENT	0x230
+#define SH_SETUP_DATA		0x250
+#define SH_INIT_SIZE		0x260
+
+#define E820_RAM		1
+#define E820_RESERVED		2
+
+#define PG_PRESENT		0x01
+#define PG_RW			0x02
+#define PG_PS			0x80
+#define HUGE_PAGE_SIZE		(2ULL << 20)
+
+struct e820_entry {
+	__u64 addr;
+	__u64 size;
+	__u32 type;
+} __attribute__((packed));
+
+/* filled in by linux-loader at runtime */
+struct linux_setup_data {
+	__u64 next;
+	__u32 type;
+	__u32 length;
+	__u16 pm_timer_address;
+	__u16 num_cpus;
+	__u8 cpu_ids[LINUX_MAX_CPUS];
+} __attribute__((packed));
+
+/* setup data and command line have to fit in front of the page tables */
+struct linux_params {
+	__u8 zero_page[ZP_SIZE];
+	struct linux_setup_data setup_data;
+	char cmdline[LINUX_PAGE_TABLES - LINUX_PARAMS_BASE - ZP_SIZE -
+		     sizeof(struct linux_setup_data)];
+	/* PML4, PDPT and up to LINUX_MAX_PAGE_DIRS page directories */
+	__u64 page_tables[2 + LINUX_MAX_PAGE_DIRS][512];
+};
+
+static __u32 zp_get(const struct linux_params *params, unsigned int offs,
+		    size_t size)
+{
+	__u32 val = 0;
+
+	memcpy(&val, &params->zero_page[offs], size);
+	return val;
+}
+
+static void zp_set(struct linux_params *params, unsigned int offs,
+		   size_t size, __u64 val)
+{
+	memcpy(&params->zero_page[offs], &val, size);
+}
+
+static int open_file(const char *name, off_t *size)
+{
+	struct stat stat;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "opening %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+
+	if (fstat(fd, &stat) < 0) {
+		perror("fstat");
+		exit(1);
+	}
+	*size = stat.st_size;
+
+	return fd;
+}
+
+static unsigned int
+linux_build_e820(struct linux_params *params,
+		 const struct jailhouse_cell_desc *config)
+{
+	const unsigned long long ram_mask = JAILHOUSE_MEM_READ |
+		JAILHOUSE_MEM_WRITE | JAILHOUSE_MEM_EXECUTE |
+		JAILHOUSE_MEM_DMA | JAILHOUSE_MEM_IO |
+		JAILHOUSE_MEM_COMM_REGION | JAILHOUSE_MEM_ROOTSHARED;
+	const unsigned long long ram_flags = JAILHOUSE_MEM_READ |
+		JAILHOUSE_MEM_WRITE | JAILHOUSE_MEM_EXECUTE |
+		JAILHOUSE_MEM_DMA;
+	const struct jailhouse_memory *mem =
+		jailhouse_cell_mem_regions(config);
+	struct e820_entry entry;
+	unsigned int n, entries = 0;
+	bool is_ram;
+
+	for (n = 0; n < config->num_memory_regions; n++, mem++) {
+		is_ram = (mem->flags & ram_mask) == ram_flags;
+		if (!is_ram && !(mem->flags & JAILHOUSE_MEM_COMM_REGION))
+			continue;
+
+		if (entries >= LINUX_MAX_E820_ENTRIES) {
+			fprintf(stderr, "Too many memory regions\n");
+			exit(1);
+		}
+
+		entry.addr = mem->virt_start;
+		entry.size = mem->size;
+		entry.type = is_ram ? E820_RAM : E820_RESERVED;
+		memcpy(&params->zero_page[ZP_E820_TABLE +
+					  entries * sizeof(entry)],
+		       &entry, sizeof(entry));
+		entries++;
+	}
+	params->zero_page[ZP_E820_ENTRIES] = entries;
+
+	return entries;
+}
+
+/*
+ * Identity-map the first 2 MB, holding loader and parameters, and the kernel
+ * with 2 MB pages, so that the loader can jump to the 64-bit entry of the
+ * kernel right away. Returns the size of the tables, 0 if the mapping does
+ * not fit. The loader then builds the mapping itself.
+ */
+static size_t linux_build_page_tables(struct linux_params *params,
+				      unsigned long long kernel_start,
+				      unsigned long long kernel_size)
+{
+	__u64 (*pt)[512] = params->page_tables;
+	unsigned long long addr, end, range[2][2] = {
+		{ 0, HUGE_PAGE_SIZE },
+		{ kernel_start, kernel_start + kernel_size },
+	};
+	unsigned int n, table, dirs = 0;
+	__u64 *pdpte;
+
+	for (n = 0; n < 2; n++) {
+		addr = range[n][0] & ~(HUGE_PAGE_SIZE - 1);
+		end = range[n][1];
+		for (; addr < end; addr += HUGE_PAGE_SIZE) {
+			if ((addr >> 30) >= 512)
+				goto no_fit;
+			pdpte = &pt[1][addr >> 30];
+			if (!*pdpte) {
+				if (dirs == LINUX_MAX_PAGE_DIRS)
+					goto no_fit;
+				table = 2 + dirs++;
+				*pdpte = (LINUX_PAGE_TABLES + table * 0x1000) |
+					PG_RW | PG_PRESENT;
+			}
+			table = ((*pdpte & ~0xfffULL) - LINUX_PAGE_TABLES) >>
+				12;
+			pt[table][(addr >> 21) & 0x1ff] =
+				addr | PG_PS | PG_RW | PG_PRESENT;
+		}
+	}
+	pt[0][0] = (LINUX_PAGE_TABLES + 0x1000) | PG_RW | PG_PRESENT;
+
+	return (2 + dirs) * sizeof(pt[0]);
+
+no_fit:
+	memset(pt, 0, sizeof(params->page_tables));
+	return 0;
+}
+
+static void linux_loader_path(char *path, size_t size, const char *prog)
+{
+	char *prog_copy = strdup(prog);
+
+	if (!prog_copy) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	/* prefer the loader of the source tree the tool is run from */
+	snprintf(path, size, "%s/../inmates/tools/x86/linux-loader.bin",
+		 dirname(prog_copy));
+	if (access(path, R_OK) != 0)
+		snprintf(path, size, "%s/linux-loader.bin",
+			 JAILHOUSE_EXEC_DIR);
+
+	free(prog_copy);
+}
+
+static int cell_linux(int argc, char *argv[])
+{
+	const char *config_file = NULL, *kernel_file = NULL;
+	const char *initrd_file = NULL, *cmdline = "";
+	struct jailhouse_cell_create cell_create;
+	struct jailhouse_cell_load_fd *cell_load;
+	struct jailhouse_preload_file *file;
+	struct jailhouse_cell_desc *config;
+	struct linux_params *params;
+	unsigned long long kernel_addr, initrd_addr = 0;
+	unsigned int setup_sects, header_size;
+	off_t kernel_size, initrd_size = 0, size;
+	char loader[PATH_MAX];
+	size_t config_size, params_size;
+	int arg_num, fd, err;
+	ssize_t count;
+
+	for (arg_num = 3; arg_num < argc; arg_num++) {
+		if (match_opt(argv[arg_num], "-i", "--initrd") &&
+		    arg_num + 1 < argc) {
+			initrd_file = argv[++arg_num];
+		} else if (match_opt(argv[arg_num], "-c", "--cmdline") &&
+			   arg_num + 1 < argc) {
+			cmdline = argv[++arg_num];
+		} else if (argv[arg_num][0] == '-') {
+			/* --write-params & co. are left to the helper script */
+			return -ENOSYS;
+		} else if (!config_file) {
+			config_file = argv[arg_num];
+		} else if (!kernel_file) {
+			kernel_file = argv[arg_num];
+		} else {
+			help(argv[0], 1);
+		}
+	}
+	if (!kernel_file)
+		return -ENOSYS;
+
+	config = read_file(config_file, &config_size);
+	if (config_size < sizeof(*config) ||
+	    memcmp(config->signature, JAILHOUSE_CELL_DESC_SIGNATURE,
+		   sizeof(config->signature)) != 0 ||
+	    config_size < jailhouse_cell_config_size(config)) {
+		fprintf(stderr, "%s: invalid cell configuration\n",
+			config_file);
+		exit(1);
+	}
+
+	if (strlen(cmdline) >= sizeof(params->cmdline)) {
+		fprintf(stderr, "kernel command line too long\n");
+		exit(1);
+	}
+
+	params = calloc(1, sizeof(*params));
+	if (!params) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	cell_load = calloc(1, sizeof(*cell_load) + sizeof(*file) * 4);
+	if (!cell_load) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+	cell_load->cell_id.id = JAILHOUSE_CELL_ID_UNUSED;
+	memcpy(cell_load->cell_id.name, config->name,
+	       sizeof(cell_load->cell_id.name));
+	cell_load->cell_id.name[JAILHOUSE_CELL_ID_NAMELEN] = 0;
+	file = cell_load->file;
+
+	linux_loader_path(loader, sizeof(loader), argv[0]);
+	file->fd = open_file(loader, &size);
+	file->size = size;
+	file->target_address = LINUX_LOADER_ADDRESS;
+	file++;
+
+	/* copy the setup header of the kernel into the zero page */
+	file->fd = open_file(kernel_file, &kernel_size);
+	count = pread(file->fd, &params->zero_page[ZP_SETUP_HEADER],
+		      ZP_E820_TABLE - ZP_SETUP_HEADER, ZP_SETUP_HEADER);
+	if (count != ZP_E820_TABLE - ZP_SETUP_HEADER) {
+		fprintf(stderr, "%s: invalid kernel image\n", kernel_file);
+		exit(1);
+	}
+	header_size = SH_JUMP + 2 + (zp_get(params, SH_JUMP, 2) >> 8) -
+		ZP_SETUP_HEADER;
+	if (ZP_SETUP_HEADER + header_size > ZP_E820_TABLE) {
+		fprintf(stderr, "%s: unsupported setup header\n",
+			kernel_file);
+		exit(1);
+	}
+	memset(&params->zero_page[ZP_SETUP_HEADER + header_size], 0,
+	       ZP_E820_TABLE - ZP_SETUP_HEADER - header_size);
+
+	setup_sects = zp_get(params, SH_SETUP_SECTS, 1);
+	kernel_addr = zp_get(params, SH_KERNEL_ALIGNMENT, 4) -
+		(setup_sects + 1) * 512;
+
+	file->size = kernel_size;
+	file->target_address = kernel_addr;
+	file++;
+
+	if (initrd_file) {
+		file->fd = open_file(initrd_file, &initrd_size);
+		initrd_addr = (kernel_addr - initrd_size) & ~0xfffULL;
+		file->size = initrd_size;
+		file->target_address = initrd_addr;
+		file++;
+	}
+
+	zp_set(params, SH_TYPE_OF_LOADER, 1, 0xff);
+	zp_set(params, SH_RAMDISK_IMAGE, 4, initrd_addr);
+	zp_set(params, SH_RAMDISK_SIZE, 4, initrd_size);
+	zp_set(params, SH_SETUP_DATA, 8,
+	       LINUX_PARAMS_BASE + offsetof(struct linux_params, setup_data));
+	zp_set(params, SH_CMD_LINE_PTR, 4,
+	       LINUX_PARAMS_BASE + offsetof(struct linux_params, cmdline));
+	linux_build_e820(params, config);
+
+	memcpy(&params->setup_data.type, "JLHS", 4);
+	params->setup_data.length = sizeof(params->setup_data) -
+		offsetof(struct linux_setup_data, pm_timer_address);
+	strcpy(params->cmdline, cmdline);
+	params_size = offsetof(struct linux_params, page_tables) +
+		linux_build_page_tables(params,
+					zp_get(params, SH_KERNEL_ALIGNMENT, 4),
+					zp_get(params, SH_INIT_SIZE, 4));
+
+	/* hand the parameters over as a file so that one ioctl loads all */
+	file->fd = syscall(SYS_memfd_create, "jailhouse-linux-params", 0);
+	if (file->fd < 0) {
+		perror("memfd_create");
+		exit(1);
+	}
+	if (write(file->fd, params, params_size) != (ssize_t)params_size) {
+		perror("writing boot parameters");
+		exit(1);
+	}
+	file->size = params_size;
+	file->target_address = LINUX_PARAMS_BASE;
+	file++;
+
+	cell_load->num_preload_files = file - cell_load->file;
+
+	fd = open_dev();
+
+	cell_create.config_address = (unsigned long)config;
+	cell_create.config_size = config_size;
+	cell_create.padding = 0;
+	err = ioctl(fd, JAILHOUSE_CELL_CREATE, &cell_create);
+	if (err && errno != EEXIST) {
+		perror("JAILHOUSE_CELL_CREATE");
+		goto out;
+	}
+
+	err = ioctl(fd, JAILHOUSE_CELL_LOAD_FD, cell_load);
+	if (err) {
+		perror("JAILHOUSE_CELL_LOAD_FD");
+		goto out;
+	}
+
+	err = ioctl(fd, JAILHOUSE_CELL_START, &cell_load->cell_id);
+	if (err)
+		perror("JAILHOUSE_CELL_START");
+
+out:
+	close(fd);
+	for (file = cell_load->file;
+	     file < &cell_load->file[cell_load->num_preload_files]; file++)
+		close(file->fd);
+	free(cell_load);
+	free(params);
+	free(config);
+
+	return err;
+}
+#endif /* x86 */
+
 static int cell_management(int argc, char *argv[])
 {
 	int err;
@@ -369,11 +1122,30 @@ static int cell_management(int argc, char *argv[])
 	} else if (strcmp(argv[2], "load") == 0) {
 		err = cell_shutdown_load(argc, argv, LOAD);
 	} else if (strcmp(argv[2], "start") == 0) {
-		err = cell_simple_cmd(argc, argv, JAILHOUSE_CELL_START);
+		err = cell_start(argc, argv);
 	} else if (strcmp(argv[2], "shutdown") == 0) {
 		err = cell_shutdown_load(argc, argv, SHUTDOWN);
 	} else if (strcmp(argv[2], "destroy") == 0) {
 		err = cell_simple_cmd(argc, argv, JAILHOUSE_CELL_DESTROY);
+	} else if (strcmp(argv[2], "set-cache") == 0) {
+		err = cell_set_cache(argc, argv);
+	} else if (strcmp(argv[2], "snapshot") == 0) {
+		err = cell_snapshot(argc, argv);
+	} else if (strcmp(argv[2], "add-cpu") == 0) {
+		err = cell_move_cpu(argc, argv, JAILHOUSE_CELL_ADD_CPU);
+	} else if (strcmp(argv[2], "remove-cpu") == 0) {
+		err = cell_move_cpu(argc, argv, JAILHOUSE_CELL_REMOVE_CPU);
+	} else if (strcmp(argv[2], "add-memory") == 0) {
+		err = cell_set_memory(argc, argv, JAILHOUSE_CELL_ADD_MEMORY);
+	} else if (strcmp(argv[2], "remove-memory") == 0) {
+		err = cell_set_memory(argc, argv,
+				      JAILHOUSE_CELL_REMOVE_MEMORY);
+#if defined(__x86_64__) || defined(__i386__)
+	} else if (strcmp(argv[2], "linux") == 0) {
+		err = cell_linux(argc, argv);
+		if (err == -ENOSYS)
+			call_extension_script("cell", argc, argv);
+#endif
 	} else {
 		call_extension_script("cell", argc, argv);
 		help(argv[0], 1);
@@ -401,7 +1173,8 @@ int main(int argc, char *argv[])
 	} else if (strcmp(argv[1], "cell") == 0) {
 		err = cell_management(argc, argv);
 	} else if (strcmp(argv[1], "config") == 0 ||
-		   strcmp(argv[1], "hardware") == 0) {
+		   strcmp(argv[1], "hardware") == 0 ||
+		   strcmp(argv[1], "hypervisor") == 0) {
 		call_extension_script(argv[1], argc, argv);
 		help(argv[0], 1);
 	} else if (strcmp(argv[1], "--version") == 0) {